@@ -2,10 +2,60 @@
  * shastina.c
  */
 
+/*
+ * If SHASTINA_POSIX is defined, the library makes use of POSIX
+ * facilities where they are helpful, such as mapping files into memory
+ * with mmap().  Otherwise, only the ANSI C library is used.
+ */
+
+/*
+ * If SHASTINA_THREADS is defined, the library can tokenize whole
+ * sources on several threads at once with POSIX threads, and parsers
+ * can read ahead of the client on a thread of their own.  See
+ * snparser_parallel() and snparser_pipeline() in the header.
+ * Otherwise, the library never starts any threads.
+ */
+/*
+ * If SHASTINA_STATS is defined, parsers count what they read, such as
+ * bytes, codepoints, tokens, and entities, along with buffer growth and
+ * stack depth.  See snparser_stats() in the header.  If
+ * SHASTINA_STATS_TIME is also defined, the time spent in each stage is
+ * measured with SNSTATS_CLOCK(), which defaults to clock().  Otherwise,
+ * none of the counting is compiled in.
+ */
+#if defined(SHASTINA_STATS_TIME) && !defined(SHASTINA_STATS)
+#define SHASTINA_STATS
+#endif
+
+#if defined(SHASTINA_POSIX) || defined(SHASTINA_THREADS)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+#endif
+
 #include "shastina.h"
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef SHASTINA_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef SHASTINA_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef SHASTINA_STATS_TIME
+#include <time.h>
+#ifndef SNSTATS_CLOCK
+#define SNSTATS_CLOCK() ((long) clock())
+#endif
+#endif
+
 /*
  * ASCII constants.
  */
@@ -54,6 +104,11 @@
 #define UNICODE_MIN_LO_SUR       (0xdc00L)
 #define UNICODE_MAX_LO_SUR       (0xdfffL)
 
+/*
+ * The maximum number of bytes in the UTF-8 encoding of a codepoint.
+ */
+#define UNICODE_MAX_UTF8         (4)
+
 /*
  * The bytes of the UTF-8 Byte Order Mark (BOM).
  */
@@ -61,6 +116,109 @@
 #define SNFILTER_BOM_2 (0xbb)
 #define SNFILTER_BOM_3 (0xbf)
 
+/*
+ * The maximum number of bytes that are validated in one go when
+ * scanning ahead in the window of a source.
+ * 
+ * Validating ahead in moderately-sized runs keeps the validated data
+ * in cache by the time it is decoded.
+ */
+#define SNSOURCE_SCAN_MAX (4096)
+
+/*
+ * The kinds of runs that can be skipped in bulk with snsource_skip().
+ * 
+ * SNRUN_WHITE is a run of whitespace.  SNRUN_COMMENT is a run of
+ * comment text.  SNRUN_QUOTED and SNRUN_CURLIED are runs of string data
+ * within quoted and curlied strings, respectively.  SNRUN_TOKEN is a
+ * run of characters within a simple token.
+ */
+#define SNRUN_WHITE   (0)
+#define SNRUN_COMMENT (1)
+#define SNRUN_QUOTED  (2)
+#define SNRUN_CURLIED (3)
+#define SNRUN_TOKEN   (4)
+
+/*
+ * Constants for word-at-a-time scanning.
+ * 
+ * SNWORD_ONES is an unsigned long with every byte set to 0x01,
+ * SNWORD_HIGHS is an unsigned long with the most significant bit of
+ * every byte set, and SNWORD_LOWS is an unsigned long with all the
+ * other bits of every byte set.  These are correct regardless of how
+ * many bytes are in an unsigned long.
+ */
+#define SNWORD_ONES  (((unsigned long) -1L) / 0xffUL)
+#define SNWORD_HIGHS (SNWORD_ONES * 0x80UL)
+#define SNWORD_LOWS  (SNWORD_ONES * 0x7fUL)
+
+/*
+ * Character class flags, used in the snchar_table.
+ * 
+ * SNCHAR_LEGAL is set for characters that are legal outside of string
+ * literals and comments.  This includes all visible, printing ASCII
+ * characters, plus Space (SP), Horizontal Tab (HT), and Line Feed (LF).
+ * 
+ * SNCHAR_ATOMIC is set for atomic primitive characters, which can
+ * stand by themselves as a full token.
+ * 
+ * SNCHAR_INCLUSIVE is set for inclusive token closers, which end the
+ * token and are included as the last character of the token.
+ * 
+ * SNCHAR_EXCLUSIVE is set for exclusive token closers, which end the
+ * token but are not included as the last character of the token.
+ */
+#define SNCHAR_LEGAL     (0x01)
+#define SNCHAR_ATOMIC    (0x02)
+#define SNCHAR_INCLUSIVE (0x04)
+#define SNCHAR_EXCLUSIVE (0x08)
+
+/*
+ * Combinations of the character class flags for each kind of legal
+ * character.
+ * 
+ * SNCHAR_PLAIN characters may appear anywhere in a token without
+ * ending it.  SNCHAR_BREAK characters end a token without being part
+ * of it.  SNCHAR_OPEN characters are the opening characters of string
+ * literals.  SNCHAR_ALONE characters are always a token by themselves.
+ */
+#define SNCHAR_PLAIN (SNCHAR_LEGAL)
+#define SNCHAR_BREAK (SNCHAR_LEGAL | SNCHAR_EXCLUSIVE)
+#define SNCHAR_OPEN  (SNCHAR_LEGAL | SNCHAR_ATOMIC | SNCHAR_INCLUSIVE)
+#define SNCHAR_ALONE (SNCHAR_LEGAL | SNCHAR_ATOMIC | SNCHAR_EXCLUSIVE)
+
+/*
+ * The primitive token types selected by the first character of a
+ * simple token, outside of metacommands.
+ * 
+ * These are stored in the upper four bits of entries in the
+ * snchar_table.  Use SNCHAR_PRIM() to shift a primitive type into
+ * place, SNCHAR_GETPRIM() to get the primitive type of a table entry,
+ * and SNCHAR_GETFLAGS() to get just the class flags of an entry.
+ * SNPRIM_OPERATION is zero, so it is the primitive type of every
+ * character that doesn't select something else.
+ * 
+ * The characters that select SNPRIM_LPAREN through SNPRIM_SEMICOLON
+ * are atomic, so they are always the whole token.
+ */
+#define SNPRIM_OPERATION (0)
+#define SNPRIM_NUMERIC   (1)
+#define SNPRIM_VARIABLE  (2)
+#define SNPRIM_CONSTANT  (3)
+#define SNPRIM_ASSIGN    (4)
+#define SNPRIM_GET       (5)
+#define SNPRIM_LPAREN    (6)
+#define SNPRIM_RPAREN    (7)
+#define SNPRIM_LSQR      (8)
+#define SNPRIM_RSQR      (9)
+#define SNPRIM_COMMA     (10)
+#define SNPRIM_PERCENT   (11)
+#define SNPRIM_SEMICOLON (12)
+
+#define SNCHAR_PRIM(p)     ((p) << 4)
+#define SNCHAR_GETPRIM(f)  (((f) >> 4) & 0xf)
+#define SNCHAR_GETFLAGS(f) ((f) & 0xf)
+
 /*
  * The types of tokens.
  */
@@ -68,6 +226,15 @@
 #define SNTOKEN_SIMPLE (1)  /* Simple tokens, except |; */
 #define SNTOKEN_STRING (2)  /* Quoted and curly string tokens */
 
+/*
+ * Special return value of the string reading functions, indicating
+ * that the buffer was filled before the end of the string.  This is
+ * positive so that it can never be confused with an SNERR_ code.
+ * 
+ * See snstr_readQuoted() for further information.
+ */
+#define SNSTR_PARTIAL (1)
+
 /*
  * The maximum number of queued entities.
  * 
@@ -125,6 +292,230 @@
 #define SNREADER_AGSTACK_INIT (8)
 #define SNREADER_AGSTACK_MAX (1024)
 
+/*
+ * The number of longs that a stack stores inline, within the SNSTACK
+ * structure itself.
+ * 
+ * Stacks start out in their inline storage, so that they only allocate
+ * memory once they grow beyond this.  With the default limits, this
+ * covers arrays nested up to SNREADER_AGSTACK_INIT levels deep.
+ */
+#define SNSTACK_INLINE (8)
+
+/*
+ * The initial allocation in bytes of the batch arena.
+ * 
+ * See snbatch_keep() for further information.
+ */
+#define SNBATCH_ARENA_INIT (1024)
+
+/*
+ * Flags returned by snbatch_strings() indicating which strings an
+ * entity has.
+ */
+#define SNBATCH_KEY   (1)
+#define SNBATCH_VALUE (2)
+
+/*
+ * The size in bytes of the internal window buffer that is allocated
+ * for block sources.
+ * 
+ * This is the maximum number of bytes that will be requested from the
+ * block read callback in a single call.  It fits within the range of a
+ * 16-bit integer so that it is safe on all platforms.
+ */
+#define SNSOURCE_BLOCK_SIZE (16384)
+
+/*
+ * The initial capacity in elements of the line break index of a whole
+ * source.
+ * 
+ * The index is built by snsource_locate(), doubling its capacity as
+ * necessary.
+ */
+#define SNSOURCE_LINES_INIT (256)
+
+/*
+ * The size in bytes of each buffer of a file descriptor source, and the
+ * alignment of those buffers in memory and of the file offset that
+ * reading starts from after a seek.
+ * 
+ * The buffer size must be a multiple of the alignment, which must be a
+ * power of two.
+ */
+#define SNFD_BUFFER_SIZE (262144L)
+#define SNFD_ALIGN       (4096L)
+
+/*
+ * The size in bytes of the output buffer of a writer.
+ * 
+ * Writes of string data that are at least this large bypass the buffer.
+ */
+#define SNWRITER_BUFFER_SIZE (262144L)
+
+/*
+ * The kinds of tokens that a writer can output, which determine the
+ * whitespace around them.
+ * 
+ * A space is written before each PLAIN or OPEN token that does not
+ * start a line or follow an OPEN token.  A CLOSE token is written
+ * directly after the token before it, unless that token is a lone |
+ * that would otherwise form a |; token with a semicolon.
+ */
+#define SNWRITER_PLAIN (0)  /* Tokens, strings, and |; */
+#define SNWRITER_OPEN  (1)  /* % ( [ */
+#define SNWRITER_CLOSE (2)  /* ; ) ] , */
+
+/*
+ * The default chunk size in bytes for parallel tokenization.
+ */
+#define SNSPEC_CHUNK_DEFAULT (262144L)
+
+/*
+ * The maximum number of threads for parallel tokenization.
+ * 
+ * Larger thread counts given to snparser_parallel() are lowered to this
+ * limit.
+ */
+#define SNSPEC_THREADS_MAX (64)
+
+/*
+ * The initial capacities of the token array and of the string arena of
+ * each chunk of parallel tokenization.
+ * 
+ * The token array capacity is in tokens and the arena capacity is in
+ * bytes.  Both are doubled as needed.
+ */
+#define SNSPEC_TOKEN_INIT (256)
+#define SNSPEC_ARENA_INIT (4096)
+
+/*
+ * The maximum number of workers of a parser pool.
+ * 
+ * Larger thread counts given to snpool_alloc() are lowered to this
+ * limit.
+ */
+#define SNPOOL_THREADS_MAX (256)
+
+/*
+ * The initial capacity in entities of the entity arrays of the workers
+ * of a parser pool.
+ * 
+ * The arrays are doubled as needed.
+ */
+#define SNPOOL_ENTITY_INIT (64)
+
+/*
+ * Results of scanning a stream for the next document.
+ */
+#define SNPOOL_SCAN_END   (0)  /* No more documents */
+#define SNPOOL_SCAN_DOC   (1)  /* Found a document */
+#define SNPOOL_SCAN_NOMEM (2)  /* Out of memory scanning a document */
+
+/*
+ * The default and maximum number of slots in the entity ring of a
+ * pipelined parser.
+ * 
+ * Smaller slot counts given to snparser_pipeline() are raised to two,
+ * and larger slot counts are lowered to the maximum.
+ */
+#define SNPIPE_SLOTS_DEFAULT (256)
+#define SNPIPE_SLOTS_MAX     (65536L)
+
+/*
+ * The initial size in bytes of the string slab of each slot of the
+ * entity ring of a pipelined parser.
+ * 
+ * Slabs are grown as needed and kept for the next time around the
+ * ring.
+ */
+#define SNPIPE_SLAB_INIT (256)
+
+/*
+ * The signature at the start of an entity cache file.
+ * 
+ * The first three bytes are "SNC" in ASCII, and the fourth byte is the
+ * format version.  Caches with any other signature are rejected.
+ */
+#define SNCACHE_SIG_1   (0x53)
+#define SNCACHE_SIG_2   (0x4e)
+#define SNCACHE_SIG_3   (0x43)
+#define SNCACHE_VERSION (2)
+
+/*
+ * The number of bytes in the fixed part of the cache header, which is
+ * the signature followed by the 32-bit content hash.
+ */
+#define SNCACHE_FIXED (8)
+
+/*
+ * The maximum number of bytes in a varint.
+ * 
+ * Varints store seven bits in each byte, so this is enough for an
+ * unsigned long of up to 112 bits.
+ */
+#define SNCACHE_VARINT_MAX (16)
+
+/*
+ * Tag byte encoding of cached entities.
+ * 
+ * If SNCACHE_TAG_ERROR is set, the low seven bits are the negated
+ * SNERR_ code.  Otherwise, the low SNCACHE_TAG_SHIFT bits are the
+ * SNENTITY_ code and the bits above hold the string type.
+ */
+#define SNCACHE_TAG_ERROR (0x80)
+#define SNCACHE_TAG_SHIFT (5)
+#define SNCACHE_TAG_MASK  (0x1f)
+
+/*
+ * The initial capacity in bytes of the entity section of an entity
+ * cache that is being written.
+ * 
+ * It is doubled as needed.
+ */
+#define SNCACHE_BYTES_INIT (4096)
+
+/*
+ * The initial capacities of string intern tables.
+ * 
+ * SNINTERN_BYTES_INIT is in bytes of string data, and
+ * SNINTERN_INDEX_INIT is in strings.  Both are doubled as needed.  The
+ * hash table starts out with twice as many slots as the index, so
+ * SNINTERN_INDEX_INIT must be a power of two.
+ */
+#define SNINTERN_BYTES_INIT (1024)
+#define SNINTERN_INDEX_INIT (64)
+
+/*
+ * The initial capacity in checkpoints of an offset index, and the
+ * default least number of bytes between its checkpoints.
+ * 
+ * The capacity is doubled as needed.
+ */
+#define SNINDEX_INIT            (64)
+#define SNINDEX_SPACING_DEFAULT (65536L)
+
+/*
+ * The offset basis and prime of the 32-bit FNV-1a hash, which is used
+ * both for the content hash of entity caches and for string intern
+ * tables.
+ */
+#define SNHASH_FNV_BASIS (0x811c9dc5UL)
+#define SNHASH_FNV_PRIME (0x01000193UL)
+
+/*
+ * Limits for decoding floating-point numbers exactly.
+ * 
+ * SNNUM_EXACT_MAX is two to the power 53.  Every integer below it is
+ * exactly representable as an IEEE double.  SNNUM_POW10_MAX is the
+ * greatest power of ten that is exactly representable.  SNNUM_EXP_MAX
+ * caps the exponents that are accumulated while decoding, well above
+ * any exponent that can be decoded, so they can't overflow.
+ */
+#define SNNUM_EXACT_MAX (9007199254740992.0)
+#define SNNUM_POW10_MAX (22)
+#define SNNUM_EXP_MAX   (100000L)
+
 /*
  * Structure for storing an input source.
  * 
@@ -169,9 +560,46 @@ struct SNSOURCE_TAG {
    * 
    *   the unsigned byte value of the byte that was read, or SNERR_EOF
    *   or SNERR_IOERR
+   * 
+   * This is NULL for block sources, which use pfBlock instead.
    */
   int (*pfRead)(void *);
   
+  /*
+   * Function pointer to the function that is used to read a block of
+   * bytes from input.
+   * 
+   * This is NULL for sources that read a byte at a time through pfRead.
+   * Exactly one of pfRead and pfBlock must be non-NULL.
+   * 
+   * The void pointer parameter is the pCustom field, the unsigned char
+   * pointer is the buffer to fill, and the long parameter is the
+   * maximum number of bytes to write into the buffer, which is always
+   * greater than zero.
+   * 
+   * The function should read at least one and at most the requested
+   * number of bytes into the buffer and return the number of bytes it
+   * read.  If there are no more bytes to read, return SNERR_EOF to
+   * indicate EOF.  If there was an I/O error, return SNERR_IOERR.  The
+   * same rules for status handling apply as for pfRead.
+   * 
+   * Bytes read through this callback are buffered in the window
+   * described by pWin, win_len, and win_pos.
+   * 
+   * Parameters:
+   * 
+   *   (void *) - the custom data parameter
+   * 
+   *   (unsigned char *) - the buffer to fill
+   * 
+   *   (long) - the maximum number of bytes to read
+   * 
+   * Return:
+   * 
+   *   the number of bytes read, or SNERR_EOF or SNERR_IOERR
+   */
+  long (*pfBlock)(void *, unsigned char *, long);
+  
   /*
    * Function pointer to an optional destructor function.
    * 
@@ -231,7 +659,8 @@ struct SNSOURCE_TAG {
    * 
    * For multipass sources, rewinding can clear SNERR_EOF condition, but
    * not SNERR_IOERR or SNERR_UTF8 conditions.  Failure during rewinding
-   * can set an SNERR_IOERR status.
+   * can set an SNERR_IOERR status.  Moving to a checkpoint with
+   * snsource_seek() clears everything except SNERR_IOERR.
    */
   int status;
   
@@ -251,862 +680,13692 @@ struct SNSOURCE_TAG {
    * custom data is a FILE * correpsonding to stdin).
    */
   void *pCustom;
-};
-
-/*
- * Structure used for string reader source.
- */
-typedef struct {
   
   /*
-   * The pointer to the string.
+   * Pointer to the block buffer.
    * 
-   * This is updated and advanced as the string is read until it reaches
-   * the terminating nul.
+   * For block sources, this is a dynamically allocated buffer of
+   * SNSOURCE_BLOCK_SIZE bytes that is owned by the source object and
+   * receives the bytes read through pfBlock.  For other sources, this
+   * is NULL.
    */
-  const unsigned char *pStr;
+  unsigned char *pBlock;
   
   /*
-   * The pointer to the start of the string.
+   * Pointer to the window.
+   * 
+   * The window is the range of input bytes that can be read directly
+   * from memory without calling through to a callback.
    * 
-   * This is *not* updated and *not* advanced as the string is read.  It
-   * is used during rewind operations to reset the source to the
-   * beginning.
+   * For block sources, this points to pBlock.  For whole sources (see
+   * the whole field), this points to the complete input data, which is
+   * not owned by the window.  For other sources, this is NULL.
    */
-  const unsigned char *pRewind;
+  const unsigned char *pWin;
   
-} SNSTRSRC;
-
-/*
- * Structure for storing state of Shastina numeric stacks.
- * 
- * Use the snstack_ functions to manipulate this structure.
- */
-typedef struct {
+  /*
+   * The number of valid bytes currently in the window.
+   * 
+   * This is always zero for sources that have no window.
+   */
+  long win_len;
   
   /*
-   * Pointer to the buffer.
+   * The index of the next byte to read from the window buffer.
    * 
-   * This pointer is NULL if cap is zero.
+   * This is in range zero up to and including win_len.  When it equals
+   * win_len, the window is empty and must be refilled through pfBlock
+   * before another byte can be read, or End Of File has been reached
+   * for whole sources.
    */
-  long *pBuf;
+  long win_pos;
   
   /*
-   * The number of longs stored in the buffer.
+   * The index in the window up to which input is known to be clean.
    * 
-   * This may not exceed the cap limit.
+   * Clean input consists only of complete, valid UTF-8 encodings that
+   * do not encode surrogates or CR characters.  Clean input can be
+   * decoded directly from the window without any further checks, and
+   * it passes through the input filter unchanged.
+   * 
+   * If this is less than or equal to win_pos, then nothing ahead in the
+   * window is currently known to be clean.  This is never greater than
+   * win_len.  It is reset to zero whenever the window is refilled or
+   * the source is rewound.
    */
-  long count;
+  long win_clean;
   
   /*
-   * The current capacity of the buffer in longs.
+   * The whole flag.
    * 
-   * If zero, it means that no buffer has been allocated yet.
+   * If non-zero, then this is a whole source, and the window holds the
+   * complete input data as one contiguous buffer.  pfRead and pfBlock
+   * are both NULL in this case.  Reaching the end of the window means
+   * End Of File, and rewinding is just a matter of resetting win_pos
+   * back to zero, so whole sources always support multipass.
    */
-  long cap;
+  int whole;
   
   /*
-   * The initial allocation capacity for this buffer in longs.
+   * The cache flag.
    * 
-   * This must be greater than zero and no greater than maxcap.
+   * If non-zero, then this is an entity cache source, and pCustom
+   * points to its SNCACHESRC structure.  Cache sources are whole
+   * sources with an empty window, so they have no bytes to read.
+   * Instead, readers replay the entities stored in the cache.
    */
-  long initcap;
+  int cache;
   
   /*
-   * The maximum capacity for this buffer in longs.
+   * The feed flag.
    * 
-   * This must be greater than or equal to initcap.  It may not exceed
-   * (LONG_MAX / 2).
+   * If non-zero, then this is a feed source, and pCustom points to its
+   * SNFEEDSRC structure.  The window of a feed source is the buffer of
+   * bytes that the client has pushed and that haven't been discarded
+   * yet.  Reaching the end of the window before the end of input has
+   * been marked doesn't change the status of the source, but rather
+   * sets the starved flag of the SNFEEDSRC structure.
    */
-  long maxcap;
+  int feed;
   
-} SNSTACK;
+  /*
+   * The line break index.
+   * 
+   * pLines is NULL until snsource_locate() builds the index for a whole
+   * source.  It then holds the offsets of all the LF bytes in the input
+   * data in ascending order, line_count is the number of them, and
+   * line_cap is the allocated capacity in elements.  The index is
+   * released along with the source.
+   */
+  long *pLines;
+  long line_count;
+  long line_cap;
+  
+  /*
+   * The memory allocator.
+   * 
+   * This is the allocator that the structure and its block buffer were
+   * allocated with, which is used to release them.
+   */
+  SNALLOC alloc;
+};
 
 /*
- * Structure for storing state of Shastina string buffers.
- * 
- * Use the snbuffer_ functions to manipulate this structure.
+ * Structure used for mapped file sources.
  */
 typedef struct {
   
   /*
-   * Pointer to the buffer.
-   * 
-   * The string data is null-terminated.
+   * Pointer to the file data.
    * 
-   * This pointer is NULL if cap is zero.
+   * This is NULL if the file is empty.
    */
-  char *pBuf;
+  unsigned char *pData;
   
   /*
-   * The number of bytes (not including terminating null) stored in the
-   * buffer.
-   * 
-   * This may not exceed the cap limit.
-   * 
-   * Note that this counts bytes in the UTF-8 encoding, not Unicode
-   * codepoints.
+   * The length of the file data in bytes.
    */
-  long count;
+  long len;
   
   /*
-   * The current capacity of the buffer in bytes.
-   * 
-   * This includes space for the terminating null.
+   * The mapped flag.
    * 
-   * If zero, it means that no buffer has been allocated yet.
-   * 
-   * Note that this counts byte capacity for UTF-8 encoding, not Unicode
-   * codepoint capacity.
+   * If non-zero, then pData was mapped into memory with mmap() and
+   * must be released with munmap().  Otherwise, pData was allocated
+   * through alloc and must be released through it.
    */
-  long cap;
+  int mapped;
   
   /*
-   * The initial allocation capacity for this buffer in bytes.
-   * 
-   * This must be greater than zero and no greater than maxcap.
+   * The allocated size of pData in bytes.
    * 
-   * Note that this counts bytes, not Unicode codepoints.
+   * This is only used when pData was allocated through alloc, in which
+   * case it may be larger than len.
    */
-  long initcap;
+  long cap;
   
   /*
-   * The maximum capacity for this buffer in bytes.
+   * The memory allocator.
    * 
-   * This must be greater than or equal to initcap.  It may not exceed
-   * (LONG_MAX / 2).
-   * 
-   * Note that this counts bytes, not Unicode codepoints.
+   * This is the allocator that the structure and the file data were
+   * allocated with, which is used to release them.
    */
-  long maxcap;
-  
-} SNBUFFER;
+  SNALLOC alloc;
+
+} SNMAPSRC;
 
 /*
- * Structure for storing state of the Shastina input filter.
- * 
- * Use the snfilter_ functions to manipulate this structure.
+ * Structure used for feed sources.
  */
 typedef struct {
   
   /*
-   * The line number of the codepoint that was most recently read, or
-   * zero if no characters have been read yet.
-   * 
-   * Line numbers change *after* the line feed, so the line_count of an
-   * LF character will be equal to the line it ends.  The next character
-   * after the LF will then have an incremented line_count.
+   * Pointer to the buffer of pushed bytes.
    * 
-   * The first line is line one.  A value of LONG_MAX means the counter
-   * has overflowed.
+   * This is the window of the source.  The number of valid bytes is the
+   * win_len field of the source.  The bytes before win_pos of the
+   * source may be discarded by moving the rest of the bytes down the
+   * next time bytes are pushed.  This is NULL if cap is zero.
    */
-  long line_count;
+  unsigned char *pData;
   
   /*
-   * The codepoint most recently read, or an error code.
-   * 
-   * This field is only valid if line_count is greater than zero.
-   * Otherwise, nothing has been read yet and this field is ignored.
-   * 
-   * If a Unicode codepoint, it is in range [0, UNICODE_MAX_CPV] and NOT
-   * in range [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE].
+   * The allocated size of pData in bytes.
+   */
+  long cap;
+  
+  /*
+   * The done flag.
    * 
-   * If it is less than zero, it is an SNERR_ code.
+   * If non-zero, then the end of input has been marked, so reaching the
+   * end of the window is End Of File.
    */
-  long c;
+  int done;
   
   /*
-   * The pushback flag.
+   * The starved flag.
    * 
-   * If zero, then pushback mode is not active.
+   * This is set whenever a read reaches the end of the window before
+   * the end of input has been marked.  Such reads return SNERR_EOF
+   * without changing the status of the source.  Readers clear the flag
+   * before reading and check it afterwards, so they can undo a read
+   * that ran out of input.
+   */
+  int starved;
+  
+  /*
+   * The hungry flag.
    * 
-   * If non-zero, it means pushback mode is active.  line_count must be
-   * greater than zero in this case, and c can not be an error code.
-   * The next read operation will read the buffered character rather
-   * than the next character.  Adjustment will also be made to the line
-   * count returned, although the line_count field remains unmodified.
+   * This is set when a reader had to undo a read because the source ran
+   * out of input, and cleared when more bytes are pushed or the end of
+   * input is marked.  While it is set, readers don't try again, since
+   * they would just run out of input at the same place.
    */
-  int pushback;
+  int hungry;
   
-} SNFILTER;
+  /*
+   * The memory allocator.
+   * 
+   * This is the allocator that the structure and the buffer were
+   * allocated with, which is used to release them.
+   */
+  SNALLOC alloc;
 
+} SNFEEDSRC;
+
+#ifdef SHASTINA_POSIX
 /*
- * Structure for a token read from a Shastina source file.
+ * Structure used for file descriptor sources.
  * 
- * This covers everything that can be found in a Shastina source file.
+ * The source is a block source whose block read callback hands out the
+ * contents of one of two large buffers, which are filled with read().
+ * With read-ahead, a background thread fills the other buffer while the
+ * current one is being handed out.  Without it, only the first buffer
+ * is used, and it is refilled when it runs out.
  */
 typedef struct {
+
+  /*
+   * The file descriptor, the owner flag, which is set if the descriptor
+   * is closed when the source is freed, and the random flag, which is
+   * set if the source can seek with lseek().
+   */
+  int fd;
+  int owner;
+  int random;
   
   /*
-   * The status of a token structure.
+   * The buffers.
    * 
-   * This is either one of the SNTOKEN_ constants, or it is negative,
-   * indicating an SNERR_ error.
+   * pBuf holds the aligned starting addresses of the two buffers of
+   * SNFD_BUFFER_SIZE bytes.  Each buffer is allocated with SNFD_ALIGN
+   * extra bytes so it can be aligned, and pRaw holds the allocated
+   * blocks, which are NULL if not allocated.  Only the first buffer is
+   * allocated without read-ahead.
    */
-  int status;
+  unsigned char *pBuf[2];
+  unsigned char *pRaw[2];
   
   /*
-   * The string type flag.
+   * The state of each buffer.
    * 
-   * For STRING token types, this will be set to one of the SNSTRING_
-   * constants to indicate the string type.  Otherwise, it should be
-   * ignored.
+   * len is the number of bytes in the buffer, and end is zero if more
+   * data may follow the buffer, or SNERR_EOF or SNERR_IOERR if that
+   * status follows it.  ready is set when the buffer has been filled
+   * and not yet taken by the reading side.
    */
-  int str_type;
+  long len[2];
+  int end[2];
+  int ready[2];
   
   /*
-   * Pointer to the key buffer.
-   * 
-   * This will always be reset on read operations.  For SIMPLE and FINAL
-   * token types, this buffer will contain the full token on return.
-   * For STRING token types, this buffer will contain the prefix
-   * (excluding the opening quote or bracket) on return.
-   * 
-   * The state of the buffer is undefined on error status returns.
+   * The buffer that is being handed out, or -1 if none, and the offset
+   * in that buffer of the next byte to hand out.
+   */
+  int cur;
+  long pos;
+  
+  /*
+   * The number of bytes to drop from the start of the next buffer that
+   * is taken, which is how seeks to unaligned offsets are handled.
+   */
+  long skip;
+  
+  /*
+   * The read-ahead flag, which is set if the background thread is
+   * running.
+   */
+  int ahead;
+  
+  /*
+   * The read-ahead state.
    * 
-   * The key and value buffer may not point to the same object.
+   * job is the buffer that the thread should fill next, or -1 if none.
+   * busy is set while the thread is filling a buffer, and stop is set
+   * to make the thread return.  All of these fields and the buffer
+   * state are protected by the lock while the thread is running, and
+   * the condition is signaled whenever any of them changes.
+   */
+  int job;
+  int busy;
+  int stop;
+
+#ifdef SHASTINA_THREADS
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+
+  /*
+   * The memory allocator.
    * 
-   * Note that this pointer will be to a buffer within the SNREADER
-   * structure.  The buffer is not owned by this structure.
+   * This is the allocator that the structure and the buffers were
+   * allocated with, which is used to release them.
    */
-  SNBUFFER *pKey;
+  SNALLOC alloc;
+
+} SNFDSRC;
+#endif
+
+/*
+ * Structure for a string intern table.
+ * 
+ * An intern table holds one copy of each distinct string that is added
+ * to it, and gives each string an index, counting up from zero in the
+ * order the strings were first added.
+ * 
+ * Use the snintern_ functions to manipulate this structure.
+ */
+typedef struct {
   
   /*
-   * Pointer to the value buffer.
-   * 
-   * This will always be reset on read operations.  For STRING token
-   * types, this buffer will contain the string data on return.  For
-   * other token types, this buffer will be empty on return.
+   * The string data.
    * 
-   * The state of the buffer is undefined on error status returns.
+   * Each string is stored as its bytes followed by a terminating nul.
+   * pData is NULL if nothing has been allocated yet.  data_cap is the
+   * allocated size in bytes and data_len is the number of bytes in use.
+   */
+  char *pData;
+  long data_cap;
+  long data_len;
+  
+  /*
+   * The string index.
    * 
-   * The key and value buffer may not point to the same object.
+   * For each string, this holds a pair of longs, which are the offset
+   * of the string in pData followed by its length, not including the
+   * terminating nul.  count is the number of strings and index_cap is
+   * the allocated number of pairs.
+   */
+  long *pIndex;
+  long count;
+  long index_cap;
+  
+  /*
+   * The hash table.
    * 
-   * Note that this pointer will be to a buffer within the SNREADER
-   * structure.  The buffer is not owned by this structure.
+   * Each slot is either zero for an empty slot, or one greater than the
+   * index of a string.  slot_cap is the number of slots, which is zero
+   * or a power of two, and the table is kept at most half full.
    */
-  SNBUFFER *pValue;
+  long *pSlots;
+  long slot_cap;
   
-} SNTOKEN;
+  /*
+   * The memory allocator, which belongs to the owner of the table.
+   */
+  const SNALLOC *pAlloc;
+
+} SNINTERN;
 
 /*
- * Structure for storing state of the Shastina source file reader.
+ * Structure used for entity cache sources.
  * 
- * Use the snreader_ functions to manipulate this structure.
+ * Use the sncache_ functions to manipulate this structure.
  */
 typedef struct {
   
   /*
-   * The status of the reader.
+   * The loaded cache file.
    * 
-   * This is normally zero.  If negative, it is one of the SNERR_
-   * constants, indicating that an error has occurred.
+   * This is always present.  It is released with snsource_map_free().
    */
-  int status;
+  SNMAPSRC *pMap;
   
   /*
-   * The queue of entities.
+   * The string index.
    * 
-   * The queue_count field determines how many entities are queued.
+   * pOff holds the offset in the file data of each string in the string
+   * section, and pLen holds its length in bytes, not including the
+   * terminating nul.  Both have str_count elements, and both are NULL
+   * if str_count is zero.
+   */
+  long *pOff;
+  long *pLen;
+  long str_count;
+  
+  /*
+   * The offset in the file data of the first entity, and the number of
+   * entities in the cache.
+   */
+  long ent_start;
+  long ent_count;
+  
+  /*
+   * The replay state.
    * 
-   * CAUTION:  Do not queue more than one entity that makes use of the
-   * string buffers, or there will be dangling pointers!
+   * pos is the offset in the file data of the next entity to decode,
+   * ent_read is the number of entities decoded so far, line is the
+   * line count after the last decoded entity, and offset is the byte
+   * offset of the last decoded entity.  Rewinding sets them back to the
+   * start of the entity section.
    */
-  SNENTITY queue[SNREADER_MAXQUEUE];
+  long pos;
+  long ent_read;
+  long line;
+  long offset;
   
   /*
-   * The number of queued entities.
+   * The final entity.
    * 
-   * This has range zero up to SNREADER_MAXQUEUE.
+   * Once the EOF entity or an error has been decoded, done is set and
+   * the entity is kept here to be returned again on all further reads,
+   * just like a parser does.
    */
-  int queue_count;
-
+  int done;
+  SNENTITY last;
+  
   /*
-   * The number of queued entities that have been read.
-   *
-   * This has range zero up to (queue_count - 1), except when
-   * queue_count is zero, in which case queue_read is also zero.
+   * The memory allocator.
+   * 
+   * This is the allocator that the structure and the string index were
+   * allocated with, which is used to release them.
    */
-  int queue_read;
+  SNALLOC alloc;
+
+} SNCACHESRC;
 
+/*
+ * Structure for an entity cache that is being written.
+ * 
+ * Use the sncache_ functions to manipulate this structure.
+ */
+typedef struct {
+  
   /*
-   * The buffer for key strings.
+   * The distinct strings of the entities.
    * 
-   * This needs to be properly initialized.  It also needs to be fully
-   * reset before the structure is released.
+   * The string section is written from this table, in index order.
+   * Each string is stored in the section as its length in a varint,
+   * followed by its bytes and a terminating nul.  str_bytes is the
+   * length of the string section in bytes.
    */
-  SNBUFFER buf_key;
+  SNINTERN strings;
+  long str_bytes;
   
   /*
-   * The buffer for value strings.
+   * The entity section.
    * 
-   * This needs to be properly initialized.  It also needs to be fully
-   * reset before the structure is released.
+   * pEnt is NULL if nothing has been allocated yet.  ent_cap is the
+   * allocated size in bytes and ent_len is the number of bytes in use.
    */
-  SNBUFFER buf_value;
+  unsigned char *pEnt;
+  long ent_cap;
+  long ent_len;
   
   /*
-   * The array stack.
+   * The number of entities in the entity section, and the line count
+   * after the last one and its byte offset.
+   */
+  long ent_count;
+  long line;
+  long offset;
+  
+  /*
+   * The memory allocator, which is that of the parser the cache is
+   * written with.
+   */
+  const SNALLOC *pAlloc;
+
+} SNCACHEWRITER;
+
+/*
+ * Union of the types that blocks of memory must be aligned for.
+ * 
+ * The blocks of fixed memory regions are rounded up to a multiple of
+ * the size of this union, so that each block is aligned for any of
+ * these types.
+ */
+typedef union {
+  long l;
+  double d;
+  void *p;
+} SNALIGN;
+
+/*
+ * Structure for storing state of a fixed memory region.
+ * 
+ * Use the snfixed_ functions to manipulate this structure.  Those
+ * functions are the callbacks of the memory allocator of parsers that
+ * are placed in client memory with snparser_place().  The structure is
+ * stored at the start of the client memory, followed by the region.
+ * 
+ * Blocks are taken from the front of the free space of the region.
+ * Only the block taken most recently can be grown in place or given
+ * back.  Any other block stays in use when it is released or moved,
+ * which wastes little, since the buffers of a parser only ever grow.
+ */
+typedef struct {
+  
+  /*
+   * Pointer to the start of the region.
+   */
+  unsigned char *pBase;
+  
+  /*
+   * The size of the region in bytes.
+   */
+  long size;
+  
+  /*
+   * The number of bytes at the start of the region that are in use.
+   */
+  long used;
+  
+  /*
+   * The offset of the block taken most recently, or -1 if there is no
+   * such block or it has been given back.
+   */
+  long last;
+
+} SNFIXED;
+
+/*
+ * Structure for storing state of Shastina numeric stacks.
+ * 
+ * Use the snstack_ functions to manipulate this structure.
+ */
+typedef struct {
+  
+  /*
+   * Pointer to the buffer.
    * 
-   * This needs to be properly initialized.  It also needs to be fully
-   * reset before the structure is released.
+   * This pointer is NULL if cap is zero.  It points to the inline
+   * storage while the stack fits in there.
+   */
+  long *pBuf;
+  
+  /*
+   * The inline storage.
    * 
-   * The numeric value on top of the stack counts the number of array
-   * elements.
+   * The stack is stored here until it grows beyond SNSTACK_INLINE
+   * longs, at which point it moves into an allocated buffer.  Since
+   * pBuf may point in here, the structure must not be moved.
    */
-  SNSTACK stack_array;
+  long inl[SNSTACK_INLINE];
   
   /*
-   * The group stack.
+   * The number of longs stored in the buffer.
    * 
-   * This needs to be properly initialized.  It also needs to be fully
-   * reset before the structure is released.
+   * This may not exceed the cap limit.
+   */
+  long count;
+  
+  /*
+   * The current capacity of the buffer in longs.
    * 
-   * The numeric value on top of the stack counts the number of open
-   * groups.  Array elements implicitly open special groups that can
-   * only be closed at the end of an array element.  Hence the need for
-   * a stack to track open groups.
+   * If zero, it means that no buffer has been allocated yet.
+   */
+  long cap;
+  
+  /*
+   * The initial allocation capacity for this buffer in longs.
    * 
-   * The height of this stack is regularly one greater than the height
-   * of the array stack.
+   * This must be greater than zero and no greater than maxcap.  The
+   * inline storage is used before the first allocation, which then
+   * has at least this capacity.
    */
-  SNSTACK stack_group;
+  long initcap;
   
   /*
-   * The metacommand flag.
+   * The maximum capacity for this buffer in longs.
    * 
-   * This is non-zero if currently in a metacommand, zero otherwise.
+   * This must be greater than or equal to initcap.  It may not exceed
+   * (LONG_MAX / 2).
    */
-  int meta_flag;
+  long maxcap;
   
   /*
-   * The array flag.
+   * Pointer to the memory allocator for the buffer.
    * 
-   * This is non-zero if a new array was just opened, zero otherwise.
+   * The allocator must remain allocated while the stack is in use.
    */
-  int array_flag;
+  const SNALLOC *pAlloc;
   
-} SNREADER;
+  /*
+   * The out of memory flag.
+   * 
+   * This is set if the buffer could not be allocated or grown, which
+   * makes a push fail as if the stack were out of capacity.  It stays
+   * set until a full reset, so that the failure can be reported as an
+   * SNERR_NOMEM error.
+   */
+  int nomem;
+
+#ifdef SHASTINA_STATS
+  /*
+   * The greatest count that the stack has reached.
+   * 
+   * This is only kept for statistics.  It is not changed by resets.
+   */
+  long peak;
+#endif
+
+} SNSTACK;
 
 /*
- * Structure for storing state of the Shastina metalanguage parser.
- * 
- * Use the snparser_ functions to manipulate this structure.
+ * Structure for storing state of Shastina string buffers.
  * 
- * The prototype of this structure (SNPARSER) is defined in the header.
+ * Use the snbuffer_ functions to manipulate this structure.
  */
-struct SNPARSER_TAG {
+typedef struct {
   
   /*
-   * The reader object.
+   * Pointer to the buffer.
    * 
-   * This must be initialized with snreader_init().
+   * The string data is null-terminated.
    * 
-   * It must be fully reset with snreader_reset() before the structure
-   * is released.
+   * This pointer is NULL if cap is zero.
    */
-  SNREADER reader;
+  char *pBuf;
   
   /*
-   * The input filter object.
+   * Pointer to the view, or NULL if the buffer is not a view.
    * 
-   * This must be initialized with snfilter_reset().
+   * If this is not NULL, then the string data is not stored in pBuf,
+   * but rather is the count bytes at this pointer, which points into
+   * the input data of a whole source.  The view is NOT null-terminated,
+   * and the buffer never modifies the data it points to.  Views are
+   * made with snbuffer_appendView().  The view is copied into pBuf if
+   * anything is appended that doesn't directly follow the viewed data
+   * in the input.  pBuf holds nothing while the buffer is a view.
    */
-  SNFILTER filter;
-};
-
-/* Function prototypes */
-static long snutf_pair(long hi, long lo);
-static int snutf_count(int c);
-static long snutf_decode(const unsigned char *pc);
-static void snutf_encode(long cpv, unsigned char *pb);
-
-static int snsource_file_read(void *pCustom);
-static void snsource_file_free(void *pCustom);
-static int snsource_file_rewind(void *pCustom);
-
-static int snsource_str_read(void *pCustom);
-static void snsource_str_free(void *pCustom);
-static int snsource_str_rewind(void *pCustom);
-
-static int snsource_read(SNSOURCE *pIn);
-static long snsource_readCPV(SNSOURCE *pIn);
-
-static void snstack_init(SNSTACK *pStack, long icap, long maxcap);
-static void snstack_reset(SNSTACK *pStack, int full);
-static int snstack_push(SNSTACK *pStack, long v);
-static long snstack_pop(SNSTACK *pStack);
-static long snstack_peek(SNSTACK *pStack);
-static int snstack_inc(SNSTACK *pStack);
-static int snstack_dec(SNSTACK *pStack);
-static long snstack_count(SNSTACK *pStack);
+  const char *pView;
+  
+  /*
+   * The number of bytes (not including terminating null) stored in the
+   * buffer.
+   * 
+   * This may not exceed the cap limit, except when the buffer is a
+   * view.  It may never reach maxcap.
+   * 
+   * Note that this counts bytes in the UTF-8 encoding, not Unicode
+   * codepoints.
+   */
+  long count;
+  
+  /*
+   * The current capacity of the buffer in bytes.
+   * 
+   * This includes space for the terminating null.
+   * 
+   * If zero, it means that no buffer has been allocated yet.
+   * 
+   * Note that this counts byte capacity for UTF-8 encoding, not Unicode
+   * codepoint capacity.
+   */
+  long cap;
+  
+  /*
+   * The initial allocation capacity for this buffer in bytes.
+   * 
+   * This must be greater than zero and no greater than maxcap.
+   * 
+   * Note that this counts bytes, not Unicode codepoints.
+   */
+  long initcap;
+  
+  /*
+   * The maximum capacity for this buffer in bytes.
+   * 
+   * This must be greater than or equal to initcap.  It may not exceed
+   * (LONG_MAX / 2).
+   * 
+   * Note that this counts bytes, not Unicode codepoints.
+   */
+  long maxcap;
+  
+  /*
+   * Pointer to the memory allocator for the buffer.
+   * 
+   * The allocator must remain allocated while the buffer is in use.
+   */
+  const SNALLOC *pAlloc;
+  
+  /*
+   * The out of memory flag.
+   * 
+   * This is set if the buffer could not be allocated or grown, which
+   * makes an append fail as if the buffer were out of capacity.  It
+   * stays set until a full reset, so that the failure can be reported
+   * as an SNERR_NOMEM error.
+   */
+  int nomem;
+  
+  /*
+   * The discard flag.
+   * 
+   * If this is non-zero, appended data is counted but not stored, so
+   * that the count and the capacity checks are exactly the same as if
+   * the data were stored, but nothing is allocated or copied.  The
+   * contents of the buffer are meaningless while this is set.  Use
+   * snbuffer_discard() to change this flag.
+   */
+  int discard;
 
-static void snbuffer_init(SNBUFFER *pBuffer, long icap, long maxcap);
-static void snbuffer_reset(SNBUFFER *pBuffer, int full);
-static int snbuffer_appendByte(SNBUFFER *pBuffer, int c);
-static int snbuffer_append(SNBUFFER *pBuffer, long cpv);
-static char *snbuffer_get(SNBUFFER *pBuffer);
-static long snbuffer_last(SNBUFFER *pBuffer);
-static int snbuffer_less(SNBUFFER *pBuffer);
+#ifdef SHASTINA_STATS
+  /*
+   * The number of times the buffer has been grown after its initial
+   * allocation, and the greatest capacity it has had.
+   * 
+   * These are only kept for statistics.  They are not changed by
+   * resets.
+   */
+  long grows;
+  long peak;
+#endif
 
-static void snfilter_reset(SNFILTER *pFilter);
-static long snfilter_read(SNFILTER *pFilter, SNSOURCE *pIn);
-static long snfilter_count(SNFILTER *pFilter);
-static int snfilter_pushback(SNFILTER *pFilter);
+} SNBUFFER;
 
-static int snchar_islegal(long c);
-static int snchar_isatomic(long c);
-static int snchar_isinclusive(long c);
-static int snchar_isexclusive(long c);
-static int snchar_strequals(int c, const char *pStr);
-static int snchar_strequals2(int c1, int c2, const char *pStr);
+/*
+ * Structure describing a run of input that was skipped in bulk.
+ * 
+ * Use snsource_skip() and snfilter_skip() to fill this structure.
+ */
+typedef struct {
+  
+  /*
+   * Pointer to the start of the run within the window of the source.
+   * 
+   * This is only valid until the next read from the source, and it is
+   * NULL if the run is empty.  The run is NOT nul-terminated.
+   */
+  const unsigned char *pData;
+  
+  /*
+   * The length of the run in bytes.
+   * 
+   * Zero if the run is empty.  Runs always end on a codepoint boundary.
+   */
+  long len;
+  
+  /*
+   * The number of LF characters within the run.
+   */
+  long lines;
+  
+  /*
+   * The last codepoint in the run, or -1 if the run is empty.
+   */
+  long last;
 
-static int snstr_readQuoted(
-    SNBUFFER * pBuffer,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter);
+} SNRUN;
 
-static int snstr_readCurlied(
-    SNBUFFER * pBuffer,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter);
+/*
+ * Structure for storing state of the Shastina input filter.
+ * 
+ * Use the snfilter_ functions to manipulate this structure.
+ */
+typedef struct {
+  
+  /*
+   * The line number of the codepoint that was most recently read, or
+   * zero if no characters have been read yet.
+   * 
+   * Line numbers change *after* the line feed, so the line_count of an
+   * LF character will be equal to the line it ends.  The next character
+   * after the LF will then have an incremented line_count.
+   * 
+   * The first line is line one.  A value of LONG_MAX means the counter
+   * has overflowed.
+   */
+  long line_count;
+  
+  /*
+   * The codepoint most recently read, or an error code.
+   * 
+   * A codepoint here is only valid if line_count is greater than zero.
+   * Otherwise, no codepoint has been read yet and this field is zero,
+   * unless the very first read ended in an error, which is kept here
+   * just like any other error.
+   * 
+   * If a Unicode codepoint, it is in range [0, UNICODE_MAX_CPV] and NOT
+   * in range [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE].
+   * 
+   * If it is less than zero, it is an SNERR_ code.
+   */
+  long c;
+  
+  /*
+   * The pushback flag.
+   * 
+   * If zero, then pushback mode is not active.
+   * 
+   * If non-zero, it means pushback mode is active.  line_count must be
+   * greater than zero in this case, and c can not be an error code.
+   * The next read operation will read the buffered character rather
+   * than the next character.  Adjustment will also be made to the line
+   * count returned, although the line_count field remains unmodified.
+   */
+  int pushback;
 
-static void sntk_skip(SNSOURCE *pIn, SNFILTER *pFilter);
-static int sntk_readToken(
-    SNBUFFER * pBuffer,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter);
+#ifdef SHASTINA_STATS
+  /*
+   * The number of codepoints read through the filter since it was last
+   * reset.
+   * 
+   * This is only kept for statistics.  Codepoints read again in
+   * pushback mode are not counted twice.  The reader counts the
+   * difference across each read, so it doesn't matter that resets
+   * start this over.
+   */
+  long cp_count;
+#endif
 
-static void sntoken_read(
-    SNTOKEN  * pToken,
-    SNSOURCE * pIn,
-    SNFILTER * pFil);
+} SNFILTER;
 
-static void snreader_init(SNREADER *pReader);
-static void snreader_reset(SNREADER *pReader, int full);
-static void snreader_read(
-    SNREADER * pReader,
-    SNENTITY * pEntity,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter);
+/*
+ * Structure for storing the state of a string that is being read in
+ * chunks.
+ * 
+ * Use snstr_init() to start a new string, and then pass the state to
+ * snstr_readQuoted() or snstr_readCurlied() to read each chunk.
+ */
+typedef struct {
+  
+  /*
+   * The string type of the string being read.
+   * 
+   * This is one of the SNSTRING_ constants while the string is being
+   * read.  It is zero if no string is in progress.
+   */
+  int str_type;
+  
+  /*
+   * The escape count at the end of the previous chunk.
+   * 
+   * Only the least significant bit is meaningful.
+   */
+  int esc_count;
+  
+  /*
+   * The curly nesting level at the end of the previous chunk.
+   * 
+   * This is only used for curlied strings.
+   */
+  long nest_level;
 
-static void snreader_addEntityZ(SNREADER *pReader, int entity);
-static void snreader_addEntityS(
-    SNREADER * pReader,
-    int        entity,
-    char     * s);
-static void snreader_addEntityL(
-    SNREADER * pReader,
-    int        entity,
-    long       l);
-static void snreader_addEntityT(
-    SNREADER * pReader,
-    int        entity,
-    char     * pPrefix,
-    int        str_type,
-    char     * pData);
+} SNSTRSTATE;
 
-static void snreader_arrayPrefix(SNREADER *pReader);
-static void snreader_fill(
-    SNREADER * pReader,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter);
+/*
+ * Structure for a token read from a Shastina source file.
+ * 
+ * This covers everything that can be found in a Shastina source file.
+ */
+typedef struct {
+  
+  /*
+   * The status of a token structure.
+   * 
+   * This is either one of the SNTOKEN_ constants, or it is negative,
+   * indicating an SNERR_ error.
+   */
+  int status;
+  
+  /*
+   * The string type flag.
+   * 
+   * For STRING token types, this will be set to one of the SNSTRING_
+   * constants to indicate the string type.  Otherwise, it should be
+   * ignored.
+   */
+  int str_type;
+  
+  /*
+   * Pointer to the key buffer.
+   * 
+   * This will always be reset on read operations.  For SIMPLE and FINAL
+   * token types, this buffer will contain the full token on return.
+   * For STRING token types, this buffer will contain the prefix
+   * (excluding the opening quote or bracket) on return.
+   * 
+   * The state of the buffer is undefined on error status returns.
+   * 
+   * The key and value buffer may not point to the same object.
+   * 
+   * Note that this pointer will be to a buffer within the SNREADER
+   * structure.  The buffer is not owned by this structure.
+   */
+  SNBUFFER *pKey;
+  
+  /*
+   * Pointer to the value buffer.
+   * 
+   * This will always be reset on read operations.  For STRING token
+   * types, this buffer will contain the string data on return.  For
+   * other token types, this buffer will be empty on return.
+   * 
+   * The state of the buffer is undefined on error status returns.
+   * 
+   * The key and value buffer may not point to the same object.
+   * 
+   * Note that this pointer will be to a buffer within the SNREADER
+   * structure.  The buffer is not owned by this structure.
+   */
+  SNBUFFER *pValue;
+  
+  /*
+   * The view flag.
+   * 
+   * This must be filled in upon entry along with pKey and pValue.  If
+   * non-zero, the source being read must be a whole source, and the
+   * key and value buffers will be made views into the input data of
+   * the source wherever possible, rather than copying the data.  See
+   * snbuffer_appendView() for further information.
+   */
+  int view;
+  
+  /*
+   * The unescape flag.
+   * 
+   * This must be filled in upon entry along with pKey and pValue.  If
+   * non-zero, the value buffer receives the unescaped string data.  See
+   * snstr_readQuoted() for further information.
+   */
+  int unescape;
+  
+  /*
+   * The chunk state, or NULL.
+   * 
+   * This must be filled in upon entry along with pKey and pValue.  If
+   * NULL, strings that are too long for the value buffer are errors.
+   * Otherwise, string data is read until the value buffer is full, and
+   * if the string is not finished, the str_type field of the chunk
+   * state is left non-zero on return and the rest of the string can be
+   * read with the chunk state.  See snstr_readQuoted() for further
+   * information.
+   */
+  SNSTRSTATE *pChunk;
+
+  /*
+   * The byte offset of the token.
+   * 
+   * This is set on return.  It is the number of bytes that had been
+   * read through the source before the first character of the token,
+   * as counted by the read_count field of the source.  On error status
+   * returns, it is instead the number of bytes that had been read when
+   * the error was found.
+   */
+  long offset;
+
+} SNTOKEN;
+
+/*
+ * Structure for storing a token that was read ahead by parallel
+ * tokenization.
+ * 
+ * Use the snspec_ functions to manipulate this structure.
+ */
+typedef struct {
+  
+  /*
+   * The status and string type of the token.
+   * 
+   * These have the same meaning as in SNTOKEN.
+   */
+  int status;
+  int str_type;
+  
+  /*
+   * The key string of the token.
+   * 
+   * If pKeyView is not NULL, then the key string is the key_len bytes
+   * at that pointer, which points into the input data or to a static
+   * empty string.  Otherwise, the key string is a null-terminated copy
+   * at offset key_off in the arena of the chunk that read the token.
+   * Offsets are used because the arena may move while it grows.
+   */
+  const char *pKeyView;
+  long key_off;
+  long key_len;
+  
+  /*
+   * The value string of the token.
+   * 
+   * This is stored in the same way as the key string.
+   */
+  const char *pValueView;
+  long value_off;
+  long value_len;
+  
+  /*
+   * The state of the source and the filter right after the token.
+   * 
+   * end_pos is the window position of the source and src_status is its
+   * status.  The line count in the filter is counted from the start of
+   * the chunk that read the token; see SNSPEC for how it is corrected.
+   * 
+   * start_pos is the window position that corresponds to the offset
+   * field of SNTOKEN, which is where the token starts, or where the
+   * error was found for errors.
+   */
+  long start_pos;
+  long end_pos;
+  int src_status;
+  SNFILTER filter;
+
+} SNSPECTOKEN;
+
+/*
+ * Structure for storing a chunk of input that is tokenized ahead by
+ * parallel tokenization.
+ * 
+ * Use the snspec_ functions to manipulate this structure.
+ */
+typedef struct {
+  
+  /*
+   * The private source and filter that the chunk is tokenized through.
+   * 
+   * The source is a copy of the whole source being parsed, positioned
+   * at the start of the chunk.  It shares the input data, but nothing
+   * else, so chunks can be tokenized at the same time.
+   */
+  SNSOURCE src;
+  SNFILTER filter;
+  
+  /*
+   * The private key and value buffers, with the same limits as the
+   * buffers of the reader.
+   */
+  SNBUFFER buf_key;
+  SNBUFFER buf_value;
+  
+  /*
+   * The view and unescape flags, which have the same meaning as in
+   * SNTOKEN.
+   */
+  int view;
+  int unescape;
+  
+  /*
+   * The window positions where the chunk starts and stops.
+   * 
+   * stop is -1 if the chunk runs to the end of the input.  Otherwise,
+   * tokenizing stops at the first token that starts at or beyond stop,
+   * which is where the next chunk starts.
+   */
+  long start;
+  long stop;
+  
+  /*
+   * The tokens that were read from the chunk.
+   * 
+   * tok_cap is the allocated capacity in tokens.  tok_count is the
+   * number of tokens read.  pTok is NULL if tok_cap is zero.
+   */
+  SNSPECTOKEN *pTok;
+  long tok_count;
+  long tok_cap;
+  
+  /*
+   * The arena holding copies of token strings.
+   * 
+   * arena_cap is the allocated size in bytes and arena_len is the
+   * number of bytes in use.  pArena is NULL if arena_cap is zero.
+   */
+  char *pArena;
+  long arena_len;
+  long arena_cap;
+  
+  /*
+   * The start of the first token of the chunk, and the state of the
+   * filter there.
+   * 
+   * The position is -1 if it can't be determined, which happens only
+   * when the token can't be valid.
+   */
+  long first_pos;
+  SNFILTER first_filter;
+  
+  /*
+   * The start of the first token at or beyond stop, and the state of
+   * the filter there.
+   * 
+   * The position is -1 if tokenizing ended with an error or the final
+   * token before reaching stop, or if stop is -1.
+   */
+  long next_pos;
+  SNFILTER next_filter;
+  
+  /*
+   * The out of memory flag.
+   * 
+   * This is set if tokenizing ended early because a token couldn't be
+   * stored.  The tokens before that are still valid.
+   */
+  int nomem;
+  
+  /*
+   * The started flag, and the thread that is tokenizing the chunk.
+   * 
+   * The flag is non-zero while a thread has been started for the chunk
+   * and not yet joined.  Without SHASTINA_THREADS, chunks are always
+   * tokenized on the calling thread.
+   */
+  int started;
+#ifdef SHASTINA_THREADS
+  pthread_t thread;
+#endif
+  
+  /*
+   * Pointer to the memory allocator.
+   */
+  const SNALLOC *pAlloc;
+
+} SNSPECCHUNK;
+
+/*
+ * Structure for storing the state of parallel tokenization.
+ * 
+ * Use the snspec_ functions to manipulate this structure.
+ * 
+ * Parallel tokenization works on a window of input ahead of the
+ * reader, which is split into chunks that each begin right after a line
+ * feed.  The first chunk is tokenized from the true state of the
+ * source and filter.  Each other chunk is tokenized at the same time,
+ * assuming that it begins outside of any string or comment.
+ * 
+ * The tokens are then handed to the reader in order, and the source
+ * and filter are moved along with each token exactly as if it had been
+ * read sequentially.  When the tokens of a chunk are used up, the next
+ * chunk is only used if the first token that the current chunk found
+ * at or beyond its stop position starts at the same position, with the
+ * same filter state, as the first token of the next chunk.  Since
+ * tokenizing from the start of a token depends only on the input from
+ * there on, the next chunk then holds exactly the tokens that
+ * sequential tokenizing would have read.  Otherwise, the window is
+ * dropped and a new window is read from the true state.
+ * 
+ * Line counts in the chunks are counted from the start of each chunk,
+ * so they are corrected by the offset of the current chunk.  Where two
+ * chunks meet, both have the filter state at the start of the same
+ * token, and the difference between their line counts there gives the
+ * offset of the next chunk.
+ */
+typedef struct {
+  
+  /*
+   * The number of threads, which is also the maximum number of chunks
+   * in a window.
+   * 
+   * If this is less than two, parallel tokenization is disabled and
+   * pChunks is NULL.
+   */
+  int threads;
+  
+  /*
+   * The approximate size of each chunk in bytes.
+   */
+  long chunk_size;
+  
+  /*
+   * The chunks, of which there are threads.
+   */
+  SNSPECCHUNK *pChunks;
+  
+  /*
+   * The number of chunks in the current window.
+   * 
+   * This is zero if there is no window.
+   */
+  int chunk_count;
+  
+  /*
+   * The index of the current chunk and of the next token to return
+   * from it.
+   */
+  int cur;
+  long cur_tok;
+  
+  /*
+   * The line count offset of the current chunk.
+   */
+  long offset;
+  
+  /*
+   * The source that the last window was read from, along with its
+   * input data and length.
+   * 
+   * A window is only used with the same source that it was read from.
+   * pSrc is NULL if no window has been read yet.
+   */
+  SNSOURCE *pSrc;
+  const unsigned char *pWin;
+  long win_len;
+  
+  /*
+   * The window position in the input data from which on there is no
+   * line feed, or -1 if no such position is known.
+   * 
+   * This prevents searching the same input for chunk boundaries over
+   * and over again.  It is cleared when the source changes.
+   */
+  long lf_none;
+  
+  /*
+   * The window position and read count of the source at the start of
+   * the window, and the view and unescape flags the window was read
+   * with.
+   */
+  long base_pos;
+  long base_count;
+  int view;
+  int unescape;
+  
+  /*
+   * The window position and status that the source must have for the
+   * window to continue.
+   * 
+   * If the source was moved in any other way, the window is dropped.
+   */
+  long expect_pos;
+  int expect_status;
+  
+  /*
+   * Pointer to the memory allocator.
+   */
+  const SNALLOC *pAlloc;
+
+} SNSPEC;
+
+/*
+ * Structure for storing state of the Shastina source file reader.
+ * 
+ * Use the snreader_ functions to manipulate this structure.
+ */
+typedef struct {
+  
+  /*
+   * The status of the reader.
+   * 
+   * This is normally zero.  If negative, it is one of the SNERR_
+   * constants, indicating that an error has occurred.
+   */
+  int status;
+  
+  /*
+   * The queue of entities.
+   * 
+   * The queue_count field determines how many entities are queued.
+   * 
+   * CAUTION:  Do not queue more than one entity that makes use of the
+   * string buffers, or there will be dangling pointers!
+   */
+  SNENTITY queue[SNREADER_MAXQUEUE];
+  
+  /*
+   * The number of queued entities.
+   * 
+   * This has range zero up to SNREADER_MAXQUEUE.
+   */
+  int queue_count;
+  
+  /*
+   * The number of queued entities that have been read.
+   * 
+   * This has range zero up to (queue_count - 1), except when
+   * queue_count is zero, in which case queue_read is also zero.
+   */
+  int queue_read;
+  
+  /*
+   * The buffer for key strings.
+   * 
+   * This needs to be properly initialized.  It also needs to be fully
+   * reset before the structure is released.
+   */
+  SNBUFFER buf_key;
+  
+  /*
+   * The buffer for value strings.
+   * 
+   * This needs to be properly initialized.  It also needs to be fully
+   * reset before the structure is released.
+   */
+  SNBUFFER buf_value;
+  
+  /*
+   * The array stack.
+   * 
+   * This needs to be properly initialized.  It also needs to be fully
+   * reset before the structure is released.
+   * 
+   * The numeric value on top of the stack counts the number of array
+   * elements.
+   */
+  SNSTACK stack_array;
+  
+  /*
+   * The group stack.
+   * 
+   * This needs to be properly initialized.  It also needs to be fully
+   * reset before the structure is released.
+   * 
+   * The numeric value on top of the stack counts the number of open
+   * groups.  Array elements implicitly open special groups that can
+   * only be closed at the end of an array element.  Hence the need for
+   * a stack to track open groups.
+   * 
+   * The height of this stack is regularly one greater than the height
+   * of the array stack.
+   */
+  SNSTACK stack_group;
+  
+  /*
+   * The metacommand flag.
+   * 
+   * This is non-zero if currently in a metacommand, zero otherwise.
+   */
+  int meta_flag;
+  
+  /*
+   * The array flag.
+   * 
+   * This is non-zero if a new array was just opened, zero otherwise.
+   */
+  int array_flag;
+  
+  /*
+   * The mode flags.
+   * 
+   * This is a combination of SNMODE_ flags, or SNMODE_NORMAL (zero).
+   * It is not changed by snreader_reset().
+   */
+  int mode;
+  
+  /*
+   * The entity mask.
+   * 
+   * This is a combination of SNMASK() bits for the kinds of entities
+   * that are returned.  Entities of other kinds are still queued, but
+   * they are dropped instead of being returned, and string data that
+   * no returned entity would hold is scanned without being buffered.
+   * The EOF bit is always set.  It is not changed by snreader_reset().
+   */
+  long mask;
+  
+  /*
+   * The offset index that checkpoints are recorded in.
+   * 
+   * This is NULL if no index is attached.  The index is not owned by
+   * the reader.  It is not changed by snreader_reset().
+   */
+  SNINDEX *pIndex;
+  
+  /*
+   * The byte offset of the entities being queued.
+   * 
+   * This is set to the offset of the token or the chunk of string data
+   * before any entities are queued for it, and the entities are queued
+   * with this offset.  See the offset field of SNENTITY.
+   */
+  long offset;
+  
+  /*
+   * The state of the chunked string being read.
+   * 
+   * The str_type field is non-zero while the reader is in the middle of
+   * returning a chunked string.  It is only used in SNMODE_CHUNK mode.
+   */
+  SNSTRSTATE chunk;
+  
+  /*
+   * The state of parallel tokenization.
+   * 
+   * This is initialized with parallel tokenization disabled.  It is
+   * released by a full reset of the reader.
+   */
+  SNSPEC spec;
+
+#ifdef SHASTINA_STATS
+  /*
+   * The statistics counted by the reader.
+   * 
+   * The buffer and stack fields are not kept here, since the buffers
+   * and stacks keep those themselves.  The statistics are not changed
+   * by resets.
+   */
+  SNSTATS stats;
+  
+  /*
+   * Non-zero if the EOF entity has been counted since the last reset.
+   */
+  int stats_eof;
+#endif
+
+} SNREADER;
+
+/*
+ * Structure for storing a checkpoint of an offset index.
+ * 
+ * A checkpoint is recorded right before a token is read outside of any
+ * array, so the array stack is empty and the group stack has a single
+ * value.  That is all the reader state that needs to be kept, besides
+ * the input filter, to resume reading at the checkpoint.
+ */
+typedef struct {
+
+  /*
+   * The byte offset of the token that was read right after the
+   * checkpoint.
+   * 
+   * Checkpoints are looked up by this offset.  It is never less than
+   * pos, but it may be greater, since whitespace and comments are
+   * skipped before the token.
+   */
+  long key;
+  
+  /*
+   * The read count of the source at the checkpoint.
+   * 
+   * This is greater than the offset of the next codepoint if the input
+   * filter has a codepoint in pushback.
+   */
+  long pos;
+  
+  /*
+   * The state of the input filter at the checkpoint.
+   * 
+   * This includes the line count and any codepoint in pushback.
+   */
+  SNFILTER filter;
+  
+  /*
+   * The number of open groups at the checkpoint.
+   */
+  long groups;
+  
+  /*
+   * The metacommand flag of the reader at the checkpoint.
+   */
+  int meta_flag;
+
+} SNCHECKPOINT;
+
+/*
+ * Structure for storing an offset index.
+ * 
+ * Use the snindex_ functions to manipulate this structure.
+ * 
+ * The prototype of this structure (SNINDEX) is defined in the header.
+ */
+struct SNINDEX_TAG {
+
+  /*
+   * The checkpoints, in ascending order of both their key and pos
+   * fields.
+   * 
+   * pList is NULL until the first checkpoint is recorded.  count is the
+   * number of checkpoints and cap is the allocated capacity in
+   * checkpoints.  A checkpoint that is being recorded is kept in the
+   * element after the last checkpoint until the token after it has
+   * been read.
+   */
+  SNCHECKPOINT *pList;
+  long count;
+  long cap;
+  
+  /*
+   * The least number of bytes between two checkpoints.
+   * 
+   * This is always greater than zero.
+   */
+  long spacing;
+  
+  /*
+   * The full flag.
+   * 
+   * This is set when the checkpoint list can not grow anymore, after
+   * which no further checkpoints are recorded.
+   */
+  int full;
+  
+  /*
+   * The memory allocator.
+   * 
+   * The structure and its checkpoint list are allocated through this
+   * allocator.
+   */
+  SNALLOC alloc;
+};
+
+/*
+ * Structure for storing a slot of the entity ring of a pipelined
+ * parser.
+ */
+typedef struct {
+
+  /*
+   * The entity.
+   * 
+   * Its key and value strings point into the slab of the slot.
+   */
+  SNENTITY ent;
+  
+  /*
+   * The line count right after the entity was read.
+   */
+  long lines;
+  
+  /*
+   * The string slab.
+   * 
+   * This holds null-terminated copies of the key and value strings of
+   * the entity.  It is NULL until a string is first copied, and
+   * slab_cap is its allocated size in bytes.  The slab is kept when the
+   * slot is reused.
+   */
+  char *pSlab;
+  long slab_cap;
+
+} SNPIPESLOT;
+
+/*
+ * Structure for storing the state of a pipelined parser.
+ * 
+ * While the pipeline is running, a producer thread owns the reader,
+ * the input filter, and the source of the parser, and it reads
+ * entities into the slots of a ring, which the client then takes them
+ * from.  The ring has a single producer and a single consumer.  Each
+ * side has fields that only it uses, and the fields they share are
+ * protected by the lock.  The consumer gives back slots in batches,
+ * so that it only needs the lock about once per quarter of the ring.
+ */
+typedef struct {
+
+  /*
+   * The number of slots in the ring, and the ring itself.
+   * 
+   * slots is zero and pRing is NULL if the pipeline is disabled.
+   * Otherwise, slots is at least two.
+   */
+  long slots;
+  SNPIPESLOT *pRing;
+  
+  /*
+   * The source that the producer is reading.
+   */
+  SNSOURCE *pIn;
+  
+  /*
+   * The running flag.
+   * 
+   * This is non-zero while a producer thread has been started and not
+   * yet joined.  It is only used by the consumer.
+   */
+  int running;
+  
+  /*
+   * The finished flag.
+   * 
+   * This is set once the EOF entity or an error other than SNERR_MORE
+   * has been taken from the ring.  The reader only ever returns that
+   * again afterwards, so further entities are read directly rather than
+   * starting another producer.  It is cleared by resets.
+   */
+  int finished;
+  
+  /*
+   * The line count after the entity most recently taken from the ring.
+   * 
+   * This is what snparser_count() returns while the pipeline is
+   * running, since the input filter is ahead of the client.
+   */
+  long lines;
+  
+  /*
+   * The state of the producer.
+   * 
+   * put is the index of the next slot to read an entity into, and
+   * space is the number of slots known to be free from there.
+   */
+  long put;
+  long space;
+  
+  /*
+   * The state of the consumer.
+   * 
+   * take is the index of the next slot to take, avail is the number of
+   * entities known to be ready from there, spent is the number of slots
+   * that have been taken and are no longer in use but have not been
+   * given back, and hold is non-zero if the client is still using the
+   * slot that was taken last.
+   */
+  long take;
+  long avail;
+  long spent;
+  int hold;
+  
+  /*
+   * The shared state.
+   * 
+   * filled is the number of slots that have been filled and not given
+   * back yet.  stop is set by the consumer to ask the producer to
+   * finish early.  ended is set by the producer once it is done.
+   * waiting is the number of threads waiting on the condition.
+   */
+  long filled;
+  int stop;
+  int ended;
+  int waiting;
+
+#ifdef SHASTINA_THREADS
+  /*
+   * The producer thread, and the lock and the condition that protect
+   * the shared state.
+   * 
+   * The sync flag is non-zero once the lock and the condition have been
+   * initialized.
+   */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int sync;
+#endif
+
+} SNPIPE;
+
+/*
+ * Structure for storing state of the Shastina metalanguage parser.
+ * 
+ * Use the snparser_ functions to manipulate this structure.
+ * 
+ * The prototype of this structure (SNPARSER) is defined in the header.
+ */
+struct SNPARSER_TAG {
+  
+  /*
+   * The reader object.
+   * 
+   * This must be initialized with snreader_init().
+   * 
+   * It must be fully reset with snreader_reset() before the structure
+   * is released.
+   */
+  SNREADER reader;
+  
+  /*
+   * The input filter object.
+   * 
+   * This must be initialized with snfilter_reset().
+   */
+  SNFILTER filter;
+  
+  /*
+   * The batch arena.
+   * 
+   * This holds copies of the strings of the entities returned by the
+   * most recent call to snparser_readbatch().  It is NULL if nothing
+   * has been allocated yet, and it must be released through alloc when
+   * the structure is released.
+   * 
+   * arena_cap is the allocated size in bytes, and arena_len is the
+   * number of bytes currently in use.
+   */
+  char *pArena;
+  long arena_cap;
+  long arena_len;
+  
+  /*
+   * The symbol table.
+   * 
+   * If sym_enabled is non-zero, then the symbol ID of a name is one
+   * greater than its index in the symbols table.  Otherwise, entities
+   * have no symbol IDs, and the table is empty.  The table must be
+   * released before the structure is released.
+   */
+  SNINTERN symbols;
+  int sym_enabled;
+  
+  /*
+   * The state of a skip that is waiting for more input.
+   * 
+   * skip_kind is the kind of entity that ends the skip, or zero if no
+   * skip is waiting, and skip_depth is the number of groups that were
+   * open within the skipped structure.  See snparser_skip().
+   */
+  int skip_kind;
+  long skip_depth;
+  
+  /*
+   * The state of the pipeline.
+   * 
+   * This is initialized with the pipeline disabled.  See
+   * snparser_pipeline().
+   */
+  SNPIPE pipe;
+  
+  /*
+   * The memory allocator.
+   * 
+   * All memory of the parser, including the structure itself, is
+   * allocated through this allocator.
+   */
+  SNALLOC alloc;
+};
+
+/*
+ * Structure for storing the state of a worker of a parser pool.
+ * 
+ * Use the snpool_ functions to manipulate this structure.
+ */
+typedef struct {
+  
+  /*
+   * The pool that the worker belongs to.
+   */
+  SNPOOL *pPool;
+  
+  /*
+   * The index of the worker in the pool.
+   */
+  int index;
+  
+  /*
+   * The parser of the worker, which is reused for each document.
+   * 
+   * Entity strings are copied into the batch arena of this parser.
+   */
+  SNPARSER *pParser;
+  
+  /*
+   * The entities of the current document and the line count after each
+   * of them.
+   * 
+   * ent_cap and line_cap are the allocated capacities of the arrays in
+   * elements, which are always at least one.  The smaller of the two is
+   * the number of entities that fit.
+   */
+  SNENTITY *pEnt;
+  long *pLines;
+  long ent_cap;
+  long line_cap;
+  
+  /*
+   * The started flag, and the thread that is running the worker.
+   * 
+   * The flag is non-zero while a thread has been started for the worker
+   * and not yet joined.  Worker zero always runs on the calling thread.
+   */
+  int started;
+#ifdef SHASTINA_THREADS
+  pthread_t thread;
+#endif
+
+} SNPOOLWORKER;
+
+/*
+ * Structure for storing the state of a parser pool.
+ * 
+ * Use the snpool_ functions to manipulate this structure.
+ * 
+ * The prototype of this structure (SNPOOL) is defined in the header.
+ * 
+ * All fields of the run state are protected by the lock while more
+ * than one worker is running.
+ */
+struct SNPOOL_TAG {
+  
+  /*
+   * The number of workers, which is at least one.
+   */
+  int threads;
+  
+  /*
+   * The workers.
+   */
+  SNPOOLWORKER *pWorkers;
+  
+  /*
+   * The parser used to scan streams for documents.
+   * 
+   * Only its key and value buffers and its filter are used.
+   */
+  SNPARSER *pScan;
+  
+  /*
+   * The sources of the current run of snpool_sources(), and their
+   * count.
+   * 
+   * ppSrc is NULL for runs of snpool_stream().
+   */
+  SNSOURCE **ppSrc;
+  long src_count;
+  
+  /*
+   * The source of the current run of snpool_stream(), or NULL.
+   * 
+   * The source is positioned at the start of the next document that
+   * has not been found yet, and the filter of the scan parser is in the
+   * state to go along with that.
+   */
+  SNSOURCE *pStream;
+  
+  /*
+   * The end of stream flag.
+   * 
+   * This is set once the scan has found the last document of the
+   * stream.
+   */
+  int stream_end;
+  
+  /*
+   * The index of the next document to give to a worker.
+   */
+  long next;
+  
+  /*
+   * The index of the next document to deliver.
+   * 
+   * This is only used with the SNPOOL_ORDERED flag.
+   */
+  long next_deliver;
+  
+  /*
+   * The number of documents delivered so far.
+   */
+  long delivered;
+  
+  /*
+   * The flags of the current run, the stopped flag, which is set when a
+   * callback returns zero, and the document callback with its custom
+   * pointer.
+   */
+  int flags;
+  int stopped;
+  int (*doc_func)(void *, const SNDOC *);
+  void *custom;
+
+#ifdef SHASTINA_THREADS
+  /*
+   * The lock protecting the run state, and the condition that is
+   * signaled whenever a document has been delivered or the run is
+   * stopped.
+   */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  
+  /*
+   * The sync flag, which is non-zero once the lock and the condition
+   * have been initialized.
+   */
+  int sync;
+#endif
+  
+  /*
+   * The memory allocator.
+   * 
+   * The structure itself and the worker arrays are allocated through
+   * this allocator, and each parser is allocated with it.
+   */
+  SNALLOC alloc;
+};
+
+/*
+ * Structure for storing the state of a writer.
+ * 
+ * Use the snwriter_ functions to manipulate this structure.
+ * 
+ * The prototype of this structure (SNWRITER) is defined in the header.
+ */
+struct SNWRITER_TAG {
+
+  /*
+   * The block sink callback, the destructor callback or NULL, and the
+   * custom pointer passed to both.
+   */
+  int (*pfSink)(void *, const unsigned char *, long);
+  void (*pfDestruct)(void *);
+  void *pCustom;
+  
+  /*
+   * The output buffer, which has SNWRITER_BUFFER_SIZE bytes, and the
+   * number of bytes in it that have not been handed to the sink yet.
+   */
+  unsigned char *pBuf;
+  long buf_len;
+  
+  /*
+   * The total number of bytes written, including the bytes still in the
+   * buffer.
+   */
+  long total;
+  
+  /*
+   * The status of the writer, which is zero or an SNERR_ code.
+   */
+  int status;
+  
+  /*
+   * The SNWRITE_ mode flags.
+   */
+  int mode;
+  
+  /*
+   * The limits that output is checked against, with the defaults filled
+   * in.
+   */
+  SNLIMITS lim;
+  
+  /*
+   * The array and grouping stacks, which work the same way as in the
+   * reader.
+   */
+  SNSTACK stack_array;
+  SNSTACK stack_group;
+  
+  /*
+   * The metacommand flag, the delayed array flag, which works the same
+   * way as in the reader, and the end flag, which is set once the |;
+   * token has been written.
+   */
+  int meta_flag;
+  int array_flag;
+  int eof;
+  
+  /*
+   * The position on the current line, which is zero at the start of a
+   * line, one after an OPEN token, and two after anything else; and the
+   * bar flag, which is set if the last token was a lone |.
+   */
+  int col;
+  int bar;
+  
+  /*
+   * The type of the string that is open, or zero if no string is open;
+   * the escape state, which is non-zero if the string data written so
+   * far ends in an odd number of backslashes; the curly nesting level
+   * within the string data; and the number of bytes of string data
+   * written so far.
+   */
+  int str_type;
+  int str_odd;
+  long str_depth;
+  long str_len;
+  
+  /*
+   * The memory allocator.
+   * 
+   * The structure itself, its buffer, and its stacks are allocated
+   * through this allocator.
+   */
+  SNALLOC alloc;
+};
+
+/*
+ * Character class table.
+ * 
+ * There is one entry for each US-ASCII character.  Each entry combines
+ * SNCHAR_ class flags with an SNPRIM_ primitive type shifted into
+ * place with SNCHAR_PRIM().  Characters that are not legal outside of
+ * string literals and comments have entries of zero.
+ * 
+ * Use snchar_class() to look up characters in this table.
+ */
+static const unsigned char snchar_table[128] = {
+  0, 0, 0, 0, 0, 0, 0, 0,                        /* 0x00 - 0x07 */
+  0,                                             /* 0x08 */
+  SNCHAR_BREAK, SNCHAR_BREAK,                    /* HT LF */
+  0, 0, 0, 0, 0, 0, 0, 0,                        /* 0x0b - 0x12 */
+  0, 0, 0, 0, 0, 0, 0, 0,                        /* 0x13 - 0x1a */
+  0, 0, 0, 0, 0,                                 /* 0x1b - 0x1f */
+  SNCHAR_BREAK,                                  /* SP */
+  SNCHAR_PLAIN,                                  /* ! */
+  SNCHAR_OPEN,                                   /* " */
+  SNCHAR_BREAK,                                  /* # */
+  SNCHAR_PLAIN,                                  /* $ */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_PERCENT),    /* % */
+  SNCHAR_PLAIN, SNCHAR_PLAIN,                    /* & ' */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_LPAREN),     /* ( */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_RPAREN),     /* ) */
+  SNCHAR_PLAIN,                                  /* * */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* + */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_COMMA),      /* , */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* - */
+  SNCHAR_PLAIN, SNCHAR_PLAIN,                    /* . / */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 0 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 1 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 2 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 3 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 4 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 5 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 6 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 7 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 8 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_NUMERIC),    /* 9 */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_ASSIGN),     /* : */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_SEMICOLON),  /* ; */
+  SNCHAR_PLAIN,                                  /* < */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_GET),        /* = */
+  SNCHAR_PLAIN,                                  /* > */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_VARIABLE),   /* ? */
+  SNCHAR_PLAIN | SNCHAR_PRIM(SNPRIM_CONSTANT),   /* @ */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* A B C */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* D E F */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* G H I */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* J K L */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* M N O */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* P Q R */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* S T U */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* V W X */
+  SNCHAR_PLAIN, SNCHAR_PLAIN,                    /* Y Z */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_LSQR),       /* [ */
+  SNCHAR_PLAIN,                                  /* \ */
+  SNCHAR_ALONE | SNCHAR_PRIM(SNPRIM_RSQR),       /* ] */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* ^ _ ` */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* a b c */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* d e f */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* g h i */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* j k l */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* m n o */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* p q r */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* s t u */
+  SNCHAR_PLAIN, SNCHAR_PLAIN, SNCHAR_PLAIN,      /* v w x */
+  SNCHAR_PLAIN, SNCHAR_PLAIN,                    /* y z */
+  SNCHAR_OPEN,                                   /* { */
+  SNCHAR_PLAIN,                                  /* | */
+  SNCHAR_ALONE,                                  /* } */
+  SNCHAR_PLAIN,                                  /* ~ */
+  0                                              /* 0x7f */
+};
+
+/*
+ * Powers of ten that are exactly representable as doubles.
+ * 
+ * Entry i is ten to the power i.  The table goes up to SNNUM_POW10_MAX,
+ * which is the greatest power of ten that is exact in IEEE double
+ * precision.
+ */
+static const double snnum_pow10[SNNUM_POW10_MAX + 1] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+  1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+  1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* Function prototypes */
+static void *snalloc_stdAlloc(void *custom, size_t size);
+static void *snalloc_stdRealloc(
+    void   * custom,
+    void   * p,
+    size_t   old_size,
+    size_t   new_size);
+static void snalloc_stdFree(void *custom, void *p, size_t size);
+
+static void snalloc_init(SNALLOC *pDest, const SNALLOC *pAlloc);
+static void *snalloc_get(const SNALLOC *pAlloc, long size);
+static void *snalloc_resize(
+    const SNALLOC * pAlloc,
+    void          * p,
+    long            old_size,
+    long            new_size);
+static void snalloc_release(const SNALLOC *pAlloc, void *p, long size);
+
+static long snfixed_round(long size);
+static void *snfixed_alloc(void *custom, size_t size);
+static void *snfixed_realloc(
+    void   * custom,
+    void   * p,
+    size_t   old_size,
+    size_t   new_size);
+static void snfixed_free(void *custom, void *p, size_t size);
+
+static unsigned long snword_load(const unsigned char *pc);
+static int snword_hasbyte(unsigned long w, int c);
+static unsigned long snword_match(unsigned long w, int c);
+static int snword_count(unsigned long m);
+
+static long snutf_pair(long hi, long lo);
+static int snutf_count(int c);
+static long snutf_decode(const unsigned char *pc);
+static void snutf_encode(long cpv, unsigned char *pb);
+static long snutf_scan(const unsigned char *pc, long len);
+
+static int snsource_file_read(void *pCustom);
+static void snsource_file_free(void *pCustom);
+static int snsource_file_rewind(void *pCustom);
+
+static void snsource_map_free(void *pCustom);
+static int snsource_map_load(SNMAPSRC *pMap, const char *pPath);
+
+static void snsource_feed_free(void *pCustom);
+static int snsource_starved(SNSOURCE *pIn);
+
+#ifdef SHASTINA_POSIX
+static void snfd_lock(SNFDSRC *pFd);
+static void snfd_unlock(SNFDSRC *pFd);
+static void snfd_wait(SNFDSRC *pFd);
+static void snfd_wake(SNFDSRC *pFd);
+static long snfd_load(SNFDSRC *pFd, int i);
+static void snfd_store(SNFDSRC *pFd, int i, long rc);
+#ifdef SHASTINA_THREADS
+static void *snfd_thread(void *pArg);
+#endif
+static void snfd_request(SNFDSRC *pFd, int i);
+static void snfd_idle(SNFDSRC *pFd);
+static void snfd_next(SNFDSRC *pFd);
+static int snfd_seek(SNFDSRC *pFd, long pos);
+static long snsource_fd_block(
+    void          * pCustom,
+    unsigned char * pBuf,
+    long            max);
+static void snsource_fd_free(void *pCustom);
+static int snsource_fd_rewind(void *pCustom);
+#endif
+
+static SNSOURCE *snsource_whole(
+    const unsigned char * pData,
+    long                  len,
+    void               (* free_func)(void *),
+    void                * custom,
+    const SNALLOC       * pAlloc);
+
+static int snsource_fill(SNSOURCE *pIn);
+static int snsource_read(SNSOURCE *pIn);
+static long snsource_readCPV(SNSOURCE *pIn);
+static const char *snsource_view(SNSOURCE *pIn);
+static int snsource_index(SNSOURCE *pSrc);
+static long snsource_clean(SNSOURCE *pIn);
+static long snsource_readClean(SNSOURCE *pIn);
+static void snsource_skip(
+    SNSOURCE * pIn,
+    int        kind,
+    long       max,
+    SNRUN    * pRun);
+static int snsource_seek(SNSOURCE *pIn, long pos);
+
+static void snstack_init(
+    SNSTACK       * pStack,
+    long            icap,
+    long            maxcap,
+    const SNALLOC * pAlloc);
+static void snstack_reset(SNSTACK *pStack, int full);
+static int snstack_push(SNSTACK *pStack, long v);
+static long snstack_pop(SNSTACK *pStack);
+static long snstack_peek(SNSTACK *pStack);
+static int snstack_inc(SNSTACK *pStack);
+static int snstack_dec(SNSTACK *pStack);
+static long snstack_count(SNSTACK *pStack);
+
+static void snbuffer_init(
+    SNBUFFER      * pBuffer,
+    long            icap,
+    long            maxcap,
+    const SNALLOC * pAlloc);
+static void snbuffer_reset(SNBUFFER *pBuffer, int full);
+static void snbuffer_discard(SNBUFFER *pBuffer, int discard);
+static int snbuffer_reserve(SNBUFFER *pBuffer, long n);
+static int snbuffer_appendByte(SNBUFFER *pBuffer, int c);
+static int snbuffer_appendRun(
+    SNBUFFER            * pBuffer,
+    const unsigned char * pData,
+    long                  len);
+static int snbuffer_appendView(
+    SNBUFFER   * pBuffer,
+    const char * pData,
+    long         len);
+static int snbuffer_appendFrom(
+    SNBUFFER   * pBuffer,
+    long         cpv,
+    const char * pFrom,
+    const char * pTo);
+static int snbuffer_append(SNBUFFER *pBuffer, long cpv);
+static char *snbuffer_get(SNBUFFER *pBuffer);
+static long snbuffer_last(SNBUFFER *pBuffer);
+static int snbuffer_less(SNBUFFER *pBuffer);
+
+static void snfilter_reset(SNFILTER *pFilter);
+static long snfilter_read(SNFILTER *pFilter, SNSOURCE *pIn);
+static long snfilter_count(SNFILTER *pFilter);
+static int snfilter_pushback(SNFILTER *pFilter);
+static void snfilter_skip(
+    SNFILTER * pFilter,
+    SNSOURCE * pIn,
+    int        kind,
+    long       max,
+    SNRUN    * pRun);
+
+static int snchar_class(long c);
+
+static void snstr_init(SNSTRSTATE *pState, int str_type);
+static int snstr_readQuoted(
+    SNBUFFER   * pBuffer,
+    SNSOURCE   * pIn,
+    SNFILTER   * pFilter,
+    int          view,
+    int          unescape,
+    SNSTRSTATE * pState);
+
+static int snstr_readCurlied(
+    SNBUFFER   * pBuffer,
+    SNSOURCE   * pIn,
+    SNFILTER   * pFilter,
+    int          view,
+    int          unescape,
+    SNSTRSTATE * pState);
+
+static int sntk_append(
+    SNBUFFER * pBuffer,
+    SNSOURCE * pIn,
+    long       c,
+    int        view);
+static void sntk_skip(SNSOURCE *pIn, SNFILTER *pFilter);
+static int sntk_readToken(
+    SNBUFFER * pBuffer,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter,
+    int        view,
+    long     * pStart);
+
+static void sntoken_read(
+    SNTOKEN  * pToken,
+    SNSOURCE * pIn,
+    SNFILTER * pFil);
+
+static void snspec_init(SNSPEC *pSpec, const SNALLOC *pAlloc);
+static void snspec_free(SNSPEC *pSpec);
+static int snspec_enable(
+    SNSPEC   * pSpec,
+    int        threads,
+    long       chunk,
+    SNBUFFER * pKey,
+    SNBUFFER * pValue);
+static void snspec_drop(SNSPEC *pSpec);
+static long snspec_pos(SNSOURCE *pIn, SNFILTER *pFilter);
+static int snspec_keep(
+    SNSPECCHUNK  * pChunk,
+    SNBUFFER     * pBuf,
+    const char  ** ppView,
+    long         * pOff);
+static int snspec_push(SNSPECCHUNK *pChunk, SNTOKEN *pToken);
+static void snspec_lex(SNSPECCHUNK *pChunk);
+#ifdef SHASTINA_THREADS
+static void *snspec_thread(void *pArg);
+#endif
+static int snspec_window(
+    SNSPEC   * pSpec,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter,
+    int        view,
+    int        unescape);
+static const SNSPECTOKEN *snspec_read(
+    SNSPEC    * pSpec,
+    SNSOURCE  * pIn,
+    SNFILTER  * pFilter,
+    int         view,
+    int         unescape,
+    char     ** ppKey,
+    char     ** ppValue);
+
+static void snreader_limits(SNLIMITS *pDest, const SNLIMITS *pLimits);
+static void snreader_init(
+    SNREADER       * pReader,
+    const SNLIMITS * pLimits,
+    const SNALLOC  * pAlloc);
+static void snreader_reset(SNREADER *pReader, int full);
+static SNENTITY *snreader_next(
+    SNREADER * pReader,
+    SNENTITY * pSpare,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter);
+static void snreader_read(
+    SNREADER * pReader,
+    SNENTITY * pEntity,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter);
+
+static void snreader_drop(SNREADER *pReader);
+static int snreader_skipstart(SNREADER *pReader, long *pDepth);
+static void snreader_addEntityZ(SNREADER *pReader, int entity);
+static void snreader_addEntityS(
+    SNREADER * pReader,
+    int        entity,
+    char     * s,
+    long       len);
+static void snreader_addEntityL(
+    SNREADER * pReader,
+    int        entity,
+    long       l);
+static void snreader_addEntityT(
+    SNREADER * pReader,
+    int        entity,
+    char     * pPrefix,
+    long       prefix_len,
+    int        str_type,
+    char     * pData,
+    long       data_len);
+static void snreader_addEntityC(
+    SNREADER * pReader,
+    int        entity,
+    int        str_type,
+    char     * pStr,
+    long       len);
+
+static void snreader_arrayPrefix(SNREADER *pReader);
+static void snreader_fill(
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter);
+static void snreader_chunk(
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter);
+static int snreader_feed(
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter);
+static int snreader_nomem(SNREADER *pReader);
+
+static int snindex_record(
+    SNINDEX  * pIndex,
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter);
+static void snindex_commit(SNINDEX *pIndex, long key);
+static long snindex_find(SNINDEX *pIndex, long offset);
+
+static int snsym_assign(SNPARSER *pParser, SNENTITY *pEntity);
+
+static int snnum_integer(const char *pc, long len, long *pResult);
+static int snnum_float(const char *pc, long len, double *pResult);
+static void snnum_decode(SNENTITY *pEntity, int mode);
+
+static int snbatch_strings(int status);
+static int snbatch_keep(
+    SNPARSER   * pParser,
+    const char * pStr,
+    long         len);
+static void snbatch_clear(SNENTITY *pEntity);
+
+static void snpool_lock(SNPOOL *pPool);
+static void snpool_unlock(SNPOOL *pPool);
+static void snpool_wait(SNPOOL *pPool);
+static void snpool_wake(SNPOOL *pPool);
+static int snpool_grow(SNPOOLWORKER *pWorker);
+static long snpool_read(SNPOOLWORKER *pWorker, SNSOURCE *pIn);
+static int snpool_scan(
+    SNPOOL   * pPool,
+    SNSOURCE * pDocSrc,
+    SNFILTER * pDocFilter);
+static void snpool_deliver(SNPOOL *pPool, const SNDOC *pDoc);
+static void snpool_work(SNPOOLWORKER *pWorker);
+#ifdef SHASTINA_THREADS
+static void *snpool_thread(void *pArg);
+#endif
+static long snpool_run(SNPOOL *pPool);
+
+static void snpipe_lock(SNPIPE *pPipe);
+static void snpipe_unlock(SNPIPE *pPipe);
+static void snpipe_wait(SNPIPE *pPipe);
+static void snpipe_wake(SNPIPE *pPipe);
+#ifdef SHASTINA_THREADS
+static int snpipe_keep(SNPIPESLOT *pSlot, const SNALLOC *pAlloc);
+static void snpipe_produce(SNPARSER *pParser);
+static void *snpipe_thread(void *pArg);
+#endif
+static void snpipe_start(SNPARSER *pParser, SNSOURCE *pIn);
+static SNENTITY *snpipe_take(SNPIPE *pPipe);
+static void snpipe_stop(SNPIPE *pPipe);
+static void snpipe_release(SNPIPE *pPipe, const SNALLOC *pAlloc);
+static SNENTITY *snpipe_next(
+    SNPARSER * pParser,
+    SNENTITY * pSpare,
+    SNSOURCE * pIn);
+
+static unsigned long snhash_fnv(const unsigned char *pc, long len);
+
+static void snintern_init(SNINTERN *pTable, const SNALLOC *pAlloc);
+static void snintern_release(SNINTERN *pTable);
+static int snintern_add(
+    SNINTERN   * pTable,
+    const char * pStr,
+    long         len,
+    long       * pIndex);
+static const char *snintern_get(
+    SNINTERN * pTable,
+    long       index,
+    long     * pLen);
+
+static int sncache_append(
+    SNCACHEWRITER       * pw,
+    unsigned char      ** ppBuf,
+    long                * pCap,
+    long                * pLen,
+    const unsigned char * pData,
+    long                  n);
+static int sncache_varint(unsigned char *pb, unsigned long v);
+static int sncache_string(
+    SNCACHEWRITER * pw,
+    const char    * pStr,
+    long            len,
+    long          * pIndex);
+static int sncache_entity(
+    SNCACHEWRITER  * pw,
+    const SNENTITY * pEntity,
+    long             line);
+static int sncache_flush(
+    SNCACHEWRITER       * pw,
+    const unsigned char * pSrc,
+    long                  src_len,
+    FILE                * pOut);
+static void sncache_release(SNCACHEWRITER *pw);
+
+static int sncache_decode(
+    const unsigned char * pData,
+    long                  len,
+    long                * pPos,
+    long                * pValue);
+static int sncache_load(
+    SNCACHESRC          * pCache,
+    const unsigned char * pSrc,
+    long                  src_len,
+    int                   check);
+static void sncache_free(void *pCustom);
+static void sncache_restart(SNCACHESRC *pCache);
+static void sncache_replay(
+    SNCACHESRC * pCache,
+    SNENTITY   * pEntity,
+    SNFILTER   * pFilter);
+
+static int snwriter_file_sink(
+    void                * pCustom,
+    const unsigned char * pData,
+    long                  len);
+static void snwriter_drain(SNWRITER *pWriter);
+static void snwriter_put(
+    SNWRITER            * pWriter,
+    const unsigned char * pData,
+    long                  len);
+static void snwriter_lead(SNWRITER *pWriter, int kind);
+static void snwriter_token(
+    SNWRITER   * pWriter,
+    const char * pc,
+    long         len,
+    int          kind);
+static void snwriter_newline(SNWRITER *pWriter);
+static int snwriter_start(SNWRITER *pWriter);
+static void snwriter_prefix(SNWRITER *pWriter);
+static long snwriter_plain(const char *pc);
+static int snwriter_name(
+    SNWRITER   * pWriter,
+    int          c,
+    const char * pName);
+static void snwriter_data(
+    SNWRITER            * pWriter,
+    const unsigned char * pc,
+    long                  len);
+
+#ifdef SHASTINA_STATS
+static void snstats_add(long *pCount, long n);
+static long snstats_text(const unsigned char *pc, long len);
+#endif
+
+/*
+ * The standard memory allocator.
+ * 
+ * This is used whenever no allocator is given.  It faults if memory
+ * runs out, so it never reports allocation failure.
+ */
+static const SNALLOC snalloc_std = {
+  &snalloc_stdAlloc,
+  &snalloc_stdRealloc,
+  &snalloc_stdFree,
+  NULL
+};
+
+/*
+ * Allocation callback of the standard memory allocator.
+ * 
+ * The function prototype matches alloc_func in SNALLOC.  This uses
+ * malloc() and faults if memory runs out.
+ */
+static void *snalloc_stdAlloc(void *custom, size_t size) {
+  
+  void *p = NULL;
+  
+  /* Ignore custom data */
+  (void) custom;
+  
+  /* Allocate the block */
+  p = malloc(size);
+  if (p == NULL) {
+    abort();
+  }
+  
+  /* Return the block */
+  return p;
+}
+
+/*
+ * Resize callback of the standard memory allocator.
+ * 
+ * The function prototype matches realloc_func in SNALLOC.  This uses
+ * realloc() and faults if memory runs out.
+ */
+static void *snalloc_stdRealloc(
+    void   * custom,
+    void   * p,
+    size_t   old_size,
+    size_t   new_size) {
+  
+  /* Ignore custom data and old size */
+  (void) custom;
+  (void) old_size;
+  
+  /* Resize the block */
+  p = realloc(p, new_size);
+  if (p == NULL) {
+    abort();
+  }
+  
+  /* Return the block */
+  return p;
+}
+
+/*
+ * Release callback of the standard memory allocator.
+ * 
+ * The function prototype matches free_func in SNALLOC.  This uses
+ * free().
+ */
+static void snalloc_stdFree(void *custom, void *p, size_t size) {
+  
+  /* Ignore custom data and size */
+  (void) custom;
+  (void) size;
+  
+  /* Release the block */
+  free(p);
+}
+
+/*
+ * Initialize a memory allocator structure from a client allocator.
+ * 
+ * pAlloc is the allocator that the client gave, which is copied into
+ * pDest.  If it is NULL, the standard allocator is copied instead.  A
+ * fault occurs if the alloc_func or free_func callbacks of pAlloc are
+ * NULL.
+ * 
+ * Parameters:
+ * 
+ *   pDest - the allocator structure to initialize
+ * 
+ *   pAlloc - the client allocator, or NULL
+ */
+static void snalloc_init(SNALLOC *pDest, const SNALLOC *pAlloc) {
+  
+  /* Check parameters */
+  if (pDest == NULL) {
+    abort();
+  }
+  if (pAlloc != NULL) {
+    if ((pAlloc->alloc_func == NULL) || (pAlloc->free_func == NULL)) {
+      abort();
+    }
+  }
+  
+  /* Copy the client allocator or the standard allocator */
+  if (pAlloc != NULL) {
+    memcpy(pDest, pAlloc, sizeof(SNALLOC));
+  } else {
+    memcpy(pDest, &snalloc_std, sizeof(SNALLOC));
+  }
+}
+
+/*
+ * Allocate a block of memory through a memory allocator.
+ * 
+ * size is the size of the block in bytes, which must be greater than
+ * zero.  NULL is returned if the size does not fit in a size_t.
+ * 
+ * Parameters:
+ * 
+ *   pAlloc - the memory allocator
+ * 
+ *   size - the size of the block
+ * 
+ * Return:
+ * 
+ *   the new block, or NULL if it could not be allocated
+ */
+static void *snalloc_get(const SNALLOC *pAlloc, long size) {
+  
+  void *p = NULL;
+  
+  /* Check parameters */
+  if ((pAlloc == NULL) || (size < 1)) {
+    abort();
+  }
+  
+  /* Allocate the block if the size is in range */
+  if ((unsigned long) ((size_t) size) == (unsigned long) size) {
+    p = (*(pAlloc->alloc_func))(pAlloc->custom, (size_t) size);
+  }
+  
+  /* Return the block or NULL */
+  return p;
+}
+
+/*
+ * Resize a block of memory through a memory allocator.
+ * 
+ * p is the block, which must have been allocated through the same
+ * allocator with a size of old_size bytes.  new_size is the new size in
+ * bytes.  Both sizes must be greater than zero.
+ * 
+ * If the allocator has no resize callback, a new block is allocated,
+ * the data is copied, and the old block is released.
+ * 
+ * If the block can not be resized, NULL is returned and the old block
+ * remains allocated and unchanged.
+ * 
+ * Parameters:
+ * 
+ *   pAlloc - the memory allocator
+ * 
+ *   p - the block to resize
+ * 
+ *   old_size - the current size of the block
+ * 
+ *   new_size - the new size of the block
+ * 
+ * Return:
+ * 
+ *   the resized block, or NULL if it could not be resized
+ */
+static void *snalloc_resize(
+    const SNALLOC * pAlloc,
+    void          * p,
+    long            old_size,
+    long            new_size) {
+  
+  void *pNew = NULL;
+  
+  /* Check parameters */
+  if ((pAlloc == NULL) || (p == NULL) ||
+      (old_size < 1) || (new_size < 1)) {
+    abort();
+  }
+  
+  /* Only proceed if the new size is in range */
+  if ((unsigned long) ((size_t) new_size) == (unsigned long) new_size) {
+    
+    /* Use the resize callback if there is one, else allocate a new
+     * block and move the data over */
+    if (pAlloc->realloc_func != NULL) {
+      pNew = (*(pAlloc->realloc_func))(pAlloc->custom, p,
+                (size_t) old_size, (size_t) new_size);
+    
+    } else {
+      pNew = (*(pAlloc->alloc_func))(pAlloc->custom, (size_t) new_size);
+      if (pNew != NULL) {
+        if (old_size < new_size) {
+          memcpy(pNew, p, (size_t) old_size);
+        } else {
+          memcpy(pNew, p, (size_t) new_size);
+        }
+        (*(pAlloc->free_func))(pAlloc->custom, p, (size_t) old_size);
+      }
+    }
+  }
+  
+  /* Return the resized block or NULL */
+  return pNew;
+}
+
+/*
+ * Release a block of memory through a memory allocator.
+ * 
+ * p is the block, which must have been allocated through the same
+ * allocator with a size of size bytes.  If p is NULL, the call is
+ * ignored.
+ * 
+ * Parameters:
+ * 
+ *   pAlloc - the memory allocator
+ * 
+ *   p - the block to release, or NULL
+ * 
+ *   size - the size of the block
+ */
+static void snalloc_release(const SNALLOC *pAlloc, void *p, long size) {
+  
+  /* Check parameters */
+  if (pAlloc == NULL) {
+    abort();
+  }
+  
+  /* Release the block if there is one */
+  if (p != NULL) {
+    if (size < 1) {
+      abort();
+    }
+    (*(pAlloc->free_func))(pAlloc->custom, p, (size_t) size);
+  }
+}
+
+/*
+ * Round a block size up to the alignment of fixed memory regions.
+ * 
+ * The result is a multiple of the size of SNALIGN.  size must be zero
+ * or greater, and it must be small enough that rounding it up does not
+ * overflow, which is the case for any size that fits in a region.
+ * 
+ * Parameters:
+ * 
+ *   size - the size in bytes
+ * 
+ * Return:
+ * 
+ *   the rounded size in bytes
+ */
+static long snfixed_round(long size) {
+  
+  long a = 0;
+  
+  /* Check parameter */
+  if ((size < 0) || (size > LONG_MAX - ((long) sizeof(SNALIGN)))) {
+    abort();
+  }
+  
+  /* Round up */
+  a = (long) sizeof(SNALIGN);
+  return ((size + (a - 1)) / a) * a;
+}
+
+/*
+ * Allocation callback of fixed memory regions.
+ * 
+ * The function prototype matches alloc_func in SNALLOC, with custom
+ * pointing to the SNFIXED structure.  The block is taken from the front
+ * of the free space, and NULL is returned if there is not enough space
+ * left.
+ */
+static void *snfixed_alloc(void *custom, size_t size) {
+  
+  SNFIXED *pFixed = NULL;
+  void *p = NULL;
+  long a = 0;
+  
+  /* Check parameters */
+  if (custom == NULL) {
+    abort();
+  }
+  pFixed = (SNFIXED *) custom;
+  
+  /* Take the block if it fits in the free space */
+  if (size <= (size_t) (pFixed->size - pFixed->used)) {
+    a = snfixed_round((long) size);
+    if (a <= pFixed->size - pFixed->used) {
+      p = (void *) (pFixed->pBase + pFixed->used);
+      pFixed->last = pFixed->used;
+      pFixed->used = pFixed->used + a;
+    }
+  }
+  
+  /* Return the block or NULL */
+  return p;
+}
+
+/*
+ * Resize callback of fixed memory regions.
+ * 
+ * The function prototype matches realloc_func in SNALLOC, with custom
+ * pointing to the SNFIXED structure.  The block taken most recently is
+ * resized in place.  Any other block is moved to a new block, and the
+ * space of the old block is not used again.  NULL is returned if there
+ * is not enough space left.
+ */
+static void *snfixed_realloc(
+    void   * custom,
+    void   * p,
+    size_t   old_size,
+    size_t   new_size) {
+  
+  SNFIXED *pFixed = NULL;
+  void *pNew = NULL;
+  long a = 0;
+  
+  /* Check parameters */
+  if ((custom == NULL) || (p == NULL)) {
+    abort();
+  }
+  pFixed = (SNFIXED *) custom;
+  
+  /* Resize in place if this is the most recent block, or else move the
+   * block, copying the data */
+  if ((pFixed->last >= 0) &&
+      (((unsigned char *) p) == pFixed->pBase + pFixed->last)) {
+    if (new_size <= (size_t) (pFixed->size - pFixed->last)) {
+      a = snfixed_round((long) new_size);
+      if (a <= pFixed->size - pFixed->last) {
+        pFixed->used = pFixed->last + a;
+        pNew = p;
+      }
+    }
+  
+  } else {
+    pNew = snfixed_alloc(custom, new_size);
+    if (pNew != NULL) {
+      if (old_size < new_size) {
+        memcpy(pNew, p, old_size);
+      } else {
+        memcpy(pNew, p, new_size);
+      }
+    }
+  }
+  
+  /* Return the block or NULL */
+  return pNew;
+}
+
+/*
+ * Release callback of fixed memory regions.
+ * 
+ * The function prototype matches free_func in SNALLOC, with custom
+ * pointing to the SNFIXED structure.  Only the space of the block taken
+ * most recently is given back.  Releasing any other block does nothing.
+ */
+static void snfixed_free(void *custom, void *p, size_t size) {
+  
+  SNFIXED *pFixed = NULL;
+  
+  /* Check parameters */
+  if ((custom == NULL) || (p == NULL)) {
+    abort();
+  }
+  pFixed = (SNFIXED *) custom;
+  
+  /* Ignore size */
+  (void) size;
+  
+  /* Give back the space if this is the most recent block */
+  if ((pFixed->last >= 0) &&
+      (((unsigned char *) p) == pFixed->pBase + pFixed->last)) {
+    pFixed->used = pFixed->last;
+    pFixed->last = -1;
+  }
+}
+
+/*
+ * Load an unsigned long from the given byte position.
+ * 
+ * pc points to at least sizeof(unsigned long) bytes.  It need not be
+ * aligned.  The bytes are copied into an unsigned long in memory order,
+ * so the result is only useful for tests that don't depend on byte
+ * order, such as snword_hasbyte().
+ * 
+ * Parameters:
+ * 
+ *   pc - pointer to the bytes to load
+ * 
+ * Return:
+ * 
+ *   the loaded word
+ */
+static unsigned long snword_load(const unsigned char *pc) {
+  
+  unsigned long w = 0;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  /* Copy the bytes into the word */
+  memcpy(&w, pc, sizeof(unsigned long));
+  
+  /* Return the word */
+  return w;
+}
+
+/*
+ * Determine whether any byte within a word has the given value.
+ * 
+ * w is a word loaded with snword_load().  c is the unsigned byte value
+ * to check for, in range [0, 255].
+ * 
+ * This uses the standard bit trick for finding a zero byte in a word,
+ * applied after XORing every byte with c, so that bytes equal to c
+ * become zero.
+ * 
+ * Parameters:
+ * 
+ *   w - the word to check
+ * 
+ *   c - the byte value to look for
+ * 
+ * Return:
+ * 
+ *   non-zero if some byte in the word equals c, zero if not
+ */
+static int snword_hasbyte(unsigned long w, int c) {
+  
+  int result = 0;
+  
+  /* Check parameter */
+  if ((c < 0) || (c > 255)) {
+    abort();
+  }
+  
+  /* Make bytes equal to c zero */
+  w = w ^ (SNWORD_ONES * ((unsigned long) c));
+  
+  /* Check for a zero byte */
+  if (((w - SNWORD_ONES) & (~w) & SNWORD_HIGHS) != 0) {
+    result = 1;
+  } else {
+    result = 0;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Find all the bytes within a word that have the given value.
+ * 
+ * w is a word loaded with snword_load().  c is the unsigned byte value
+ * to look for, in range [0, 255].
+ * 
+ * Unlike snword_hasbyte(), the result is exact for every byte of the
+ * word, so it can be combined with other matches and counted with
+ * snword_count().
+ * 
+ * Parameters:
+ * 
+ *   w - the word to check
+ * 
+ *   c - the byte value to look for
+ * 
+ * Return:
+ * 
+ *   a word that has the most significant bit set in each byte that
+ *   equals c, and all other bits clear
+ */
+static unsigned long snword_match(unsigned long w, int c) {
+  
+  /* Check parameter */
+  if ((c < 0) || (c > 255)) {
+    abort();
+  }
+  
+  /* Make bytes equal to c zero */
+  w = w ^ (SNWORD_ONES * ((unsigned long) c));
+  
+  /* Adding SNWORD_LOWS to the low bits of each byte sets the high bit
+   * of the byte unless the low bits are zero, and this can never carry
+   * into the next byte; then, the high bit is only clear in bytes that
+   * are entirely zero */
+  w = ((w & SNWORD_LOWS) + SNWORD_LOWS) | w;
+  
+  /* Return the inverted high bits */
+  return ((~w) & SNWORD_HIGHS);
+}
+
+/*
+ * Count the bytes that were found by snword_match().
+ * 
+ * m is a result of snword_match(), or a bitwise OR of such results.
+ * 
+ * Parameters:
+ * 
+ *   m - the match word
+ * 
+ * Return:
+ * 
+ *   the number of bytes in the word that have the most significant bit
+ *   set
+ */
+static int snword_count(unsigned long m) {
+  
+  /* Check parameter */
+  if ((m & SNWORD_LOWS) != 0) {
+    abort();
+  }
+  
+  /* Move each match down to a one in the low bit of its byte, and then
+   * multiply so the sum of all bytes accumulates in the most
+   * significant byte */
+  m = ((m >> 7) * SNWORD_ONES) >> ((sizeof(unsigned long) - 1) * 8);
+  
+  /* Return the count */
+  return ((int) m);
+}
+
+/*
+ * Given a high surrogate and a low surrogate, return the supplemental
+ * codepoint that the pair selects.
+ * 
+ * A fault occurs if hi is not in high surrogate range or lo is not in
+ * low surrogate range.
+ * 
+ * Parameters:
+ * 
+ *   hi - the high surrogate
+ * 
+ *   lo - the low surrogate
+ * 
+ * Return:
+ * 
+ *   the supplemental codepoint
+ */
+static long snutf_pair(long hi, long lo) {
+  
+  long result = 0;
+  
+  /* Check parameters */
+  if ((hi < UNICODE_MIN_HI_SUR) || (hi > UNICODE_MAX_HI_SUR) ||
+      (lo < UNICODE_MIN_LO_SUR) || (lo > UNICODE_MAX_LO_SUR)) {
+    abort();
+  }
+  
+  /* Convert hi and lo into offsets within their surrogate ranges */
+  hi = hi - UNICODE_MIN_HI_SUR;
+  lo = lo - UNICODE_MIN_LO_SUR;
+  
+  /* Combine hi and lo with bit shifting */
+  result = (hi << 10) | lo;
+  
+  /* Use as offset into surrogate range */
+  result = result + UNICODE_MIN_SUPPLEMENTAL;
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Check a byte within a UTF-8 encoding to determine how many bytes long
+ * the encoding is.
+ * 
+ * c is the unsigned byte value to check.  It must be in range [0, 255].
+ * 
+ * The return value is one if the most significant bit of the byte is
+ * clear (indicating an ASCII character), two to four if the given byte
+ * is a UTF-8 lead byte, zero if the byte is a UTF-8 continuation byte,
+ * and -1 if the byte is not a valid UTF-8 byte.
+ * 
+ * If a value greater than zero is returned, then the whole encoded
+ * codepoint (including the leading byte) has that many bytes in it,
+ * where any bytes after the first are continuation bytes.
+ * 
+ * Parameters:
+ * 
+ *   c - the byte value to check
+ * 
+ * Return:
+ * 
+ *   the number of bytes in the encoded codepoint, or zero if the given
+ *   byte is a continuation byte, or -1 if the byte is not valid UTF-8
+ */
+static int snutf_count(int c) {
+  
+  int result = 0;
+  
+  /* Check parameter */
+  if ((c < 0) || (c > 255)) {
+    abort();
+  }
+  
+  /* Determine result */
+  if (c <= 127) {
+    /* Everything in [0, 127] has one byte */
+    result = 1;
+  
+  } else if ((c & 0xC0) == 0x80) {
+    /* 10?????? bytes are continuation bytes */
+    result = 0;
+  
+  } else if ((c & 0xE0) == 0xC0) {
+    /* 110????? bytes are lead bytes for two-byte encodings */
+    result = 2;
+  
+  } else if ((c & 0xF0) == 0xE0) {
+    /* 1110???? bytes are lead bytes for three-byte encodings */
+    result = 3;
+  
+  } else if ((c & 0xF8) == 0xF0) {
+    /* 11110??? bytes are lead bytes for four-byte encodings */
+    result = 4;
+  
+  } else {
+    /* Everything else is invalid UTF-8 */
+    result = -1;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Decode a UTF-8 codepoint.
+ * 
+ * pc points to the start of an encoded UTF-8 codepoint.  Encoded UTF-8
+ * codepoints may have from one to four bytes for a codepoint.  This
+ * function will stop immediately and return an error if it encounters
+ * a faulty encoding, and it is guaranteed safe to use on nul-terminated
+ * strings, even if the strings have bad UTF-8 encodings.  (It will
+ * never read beyond the terminating nul, even if the terminating nul
+ * comes unexpectedly in the middle of an encoded UTF-8 codepoint.)
+ * 
+ * The leading byte pointed to by pc determines how many bytes are in
+ * the encoding.  You can use snutf_count() to get this information
+ * given a byte value.  Encodings that have more than one byte will have
+ * all bytes after the first byte be continuation bytes.
+ * 
+ * This function will check for and fail on overlong encodings -- that
+ * is, encodings of codepoints that are unnecessarily long.  These are
+ * blocked for security reasons, and should never occur in valid streams
+ * of UTF-8.  It will also fail on encodings of values beyond the range
+ * of Unicode codepoints.
+ * 
+ * This function allows surrogates to be decoded, even though surrogates
+ * aren't supposed to be used in UTF-8.  Surrogates need to be resolved
+ * by looking at more than one codepoint at a time, so they can't be
+ * handled properly by this function.
+ * 
+ * Parameters:
+ * 
+ *   pc - pointer to the UTF-8 codepoint
+ * 
+ * Return:
+ * 
+ *   a Unicode codepoint (including surrogates!), or -1 if the UTF-8
+ *   encoding wasn't valid
+ */
+static long snutf_decode(const unsigned char *pc) {
+  
+  int status = 1;
+  int ec = 0;
+  int x = 0;
+  long result = 0;
+  
+  /* Check parameter */
+  if (pc == NULL) {
+    abort();
+  }
+  
+  /* Determine encoded length */
+  ec = snutf_count(*pc);
+  if (ec < 1) {
+    /* If start of encoding is a continuation byte or not a valid UTF-8
+     * byte, fail */
+    status = 0;
+  }
+  
+  /* If there is more than one byte in the encoding, make sure all
+   * additional bytes are continuation bytes */
+  if (status) {
+    for(x = 1; x < ec; x++) {
+      if (snutf_count(pc[x]) != 0) {
+        status = 0;
+        break;
+      }
+    }
+  }
+  
+  /* All UTF-8 bytes are available and of the correct type, so begin by
+   * getting the payload of the lead byte */
+  if (status) {
+    switch (ec) {
+      case 1:
+        /* For one-byte codes, the byte value is equal to the code */
+        result = pc[0];
+        break;
+      
+      case 2:
+        /* For two-byte codes, lead byte payload is ---PPPPP */
+        result = (pc[0] & 0x1F);
+        break;
+      
+      case 3:
+        /* For three-byte codes, lead byte payload is ----PPPP */
+        result = (pc[0] & 0x0F);
+        break;
+      
+      case 4:
+        /* For four-byte codes, lead byte payload is -----PPP */
+        result = (pc[0] & 0x07);
+        break;
+      
+      default:
+        /* Shouldn't happen */
+        abort();
+    }
+  }
+  
+  /* Include the payload from any continuation bytes -- continuation
+   * byte payload is --PPPPPP */
+  if (status) {
+    for(x = 1; x < ec; x++) {
+      result = (result << 6) | (pc[x] & 0x3F);
+    }
+  }
+  
+  /* Fail for any overlong encodings */
+  if (status) {
+    switch (ec) {
+      case 1:
+        /* One-byte encodings are never overlong */
+        break;
+      
+      case 2:
+        /* Two-byte encodings must be at least U+0080 */
+        if (result < 0x80L) {
+          status = 0;
+        }
+        break;
+      
+      case 3:
+        /* Three-byte encodings must be at least U+0800 */
+        if (result < 0x800L) {
+          status = 0;
+        }
+        break;
+      
+      case 4:
+        /* Four-byte encodings must be at least U+10000 */
+        if (result < 0x10000L) {
+          status = 0;
+        }
+        break;
+      
+      default:
+        /* Shouldn't happen */
+        abort();
+    }
+  }
+  
+  /* Fail for anything beyond the Unicode codepoint range, which only
+   * four-byte encodings can reach */
+  if (status && (result > UNICODE_MAX_CPV)) {
+    status = 0;
+  }
+  
+  /* If we failed, set result to -1 */
+  if (!status) {
+    result = -1;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Encode a Unicode codepoint into UTF-8.
+ * 
+ * The given codepoint must be in [0, UNICODE_MAX_CPV] range.  Also, it
+ * must NOT be in [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE] range.
+ * 
+ * pb points to the buffer to write the encoded codepoint into.  This
+ * function will write from one to four bytes into the buffer.  Make
+ * sure there is enough room in the buffer for the encoded codepoint!
+ * 
+ * One way of handling the buffer is to allocate a buffer of five
+ * characters, initialize all the characters to nul, and then call this
+ * function on the buffer.  After this function returns, then, the
+ * result will be nul-terminated (except if the given codepoint is zero,
+ * in which case the result will be empty).
+ * 
+ * Parameters:
+ * 
+ *   cpv - the Unicode codepoint
+ * 
+ *   pb - the buffer to write the result into
+ */
+static void snutf_encode(long cpv, unsigned char *pb) {
+  
+  int ec = 0;
+  int c = 0;
+  int i = 0;
+  
+  /* Check parameters */
+  if (pb == NULL) {
+    abort();
+  }
+  if ((cpv < 0) || (cpv > UNICODE_MAX_CPV) ||
+        ((cpv >= UNICODE_MIN_SURROGATE) &&
+          (cpv <= UNICODE_MAX_SURROGATE))) {
+    abort();
+  }
+  
+  /* From the codepoint value, figure out the encoded length of the
+   * codepoint */
+  if (cpv < 0x80L) {
+    /* U+0000 to 0+007F has one-byte encodings */
+    ec = 1;
+  
+  } else if (cpv < 0x800L) {
+    /* U+0080 to U+07FF has two-byte encodings */
+    ec = 2;
+  
+  } else if (cpv < 0x10000L) {
+    /* U+0800 to U+FFFF has three-byte encodings */
+    ec = 3;
+  
+  } else if (cpv <= UNICODE_MAX_CPV) {
+    /* U+10000 to end of Unicode range has four-byte encodings */
+    ec = 4;
+  
+  } else {
+    /* Shouldn't happen */
+    abort();
+  }
+  
+  /* Align the cpv by left shifting so that everything has payload bits
+   * for three continuation bytes; that is, for one-byte codes, add
+   * 18 (= 6 x 3) bits; for two-byte codes, add 12 (= 6 x 2) bits; for
+   * three-byte codes, add 6 bits; and nothing for four-byte codes,
+   * which already have three continuation bytes */
+  if (ec == 1) {
+    cpv = cpv << 18;
+  
+  } else if (ec == 2) {
+    cpv = cpv << 12;
+  
+  } else if (ec == 3) {
+    cpv = cpv << 6;
+  }
+  
+  /* Lead byte payload is now always 18 bits shifted, so combine it with
+   * the appropriate marker bits and write the first encoded byte */
+  c = (int) (cpv >> 18);
+  
+  if (ec == 2) {
+    c = c | 0xC0;
+  
+  } else if (ec == 3) {
+    c = c | 0xE0;
+  
+  } else if (ec == 4) {
+    c = c | 0xF0;
+  }
+  
+  *pb = (unsigned char) c;
+  pb++;
+  
+  /* Mask out the lead byte payload, leaving just the continuation byte
+   * payloads */
+  cpv = cpv & 0x3ffffL;
+  
+  /* Write any continuation bytes */
+  for(i = 1; i < ec; i++) {
+    /* Get most significant continuation payload */
+    c = (int) (cpv >> 12);
+    
+    /* Add continuation marker bit */
+    c = c | 0x80;
+    
+    /* Output continuation byte */
+    *pb = (unsigned char) c;
+    pb++;
+    
+    /* Mask out most significant continuation payload */
+    cpv = cpv & 0xfffL;
+    
+    /* Shift continuation payloads left */
+    cpv = cpv << 6;
+  }
+}
+
+/*
+ * Reading callback for a stdio FILE * source.
+ * 
+ * The function prototype matches pfRead in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static int snsource_file_read(void *pCustom) {
+  
+  FILE *pIn = NULL;
+  int result = 0;
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Convert parameter to a FILE * handle */
+  pIn = (FILE *) pCustom;
+  
+  /* Read from the file and check for EOF and I/O error conditions */
+  result = getc(pIn);
+  if (result == EOF) {
+    if (feof(pIn)) {
+      result = SNERR_EOF;
+    } else {
+      result = SNERR_IOERR;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Scan a range of bytes to determine how much of it is clean input.
+ * 
+ * pc points to the bytes to scan and len is the number of bytes to
+ * scan.  len must be zero or greater.  pc may only be NULL if len is
+ * zero.
+ * 
+ * Clean input consists only of complete, valid UTF-8 encodings of
+ * Unicode codepoints, excluding encoded surrogates and the CR control
+ * character.  That is, clean input is exactly the input that passes
+ * through the input filter unchanged, except possibly for a Byte Order
+ * Mark at the very start of input.
+ * 
+ * The return value is the length in bytes of the longest prefix of the
+ * range that is clean.  This always ends on a codepoint boundary.  The
+ * prefix stops short of the first byte that starts an encoding that is
+ * invalid, encodes a surrogate or CR, or is cut off by the end of the
+ * range.  Such bytes may still be valid input if they are handled
+ * codepoint by codepoint through the input filter.
+ * 
+ * Runs of US-ASCII are checked a whole word at a time.
+ * 
+ * Parameters:
+ * 
+ *   pc - pointer to the bytes to scan
+ * 
+ *   len - the number of bytes to scan
+ * 
+ * Return:
+ * 
+ *   the number of bytes at the start of the range that are clean
+ */
+static long snutf_scan(const unsigned char *pc, long len) {
+  
+  long i = 0;
+  long cpv = 0;
+  unsigned long w = 0;
+  int ec = 0;
+  int c = 0;
+  int x = 0;
+  int clean = 1;
+  
+  /* Check parameters */
+  if ((len < 0) || ((len > 0) && (pc == NULL))) {
+    abort();
+  }
+  
+  /* Scan up to the first byte that is not clean */
+  while (clean && (i < len)) {
+    
+    /* Skip over whole words of US-ASCII that do not include CR */
+    while ((len - i) >= ((long) sizeof(unsigned long))) {
+      w = snword_load(pc + i);
+      if ((w & SNWORD_HIGHS) || snword_hasbyte(w, ASCII_CR)) {
+        break;
+      }
+      i = i + ((long) sizeof(unsigned long));
+    }
+    if (i >= len) {
+      break;
+    }
+    
+    /* Handle the next codepoint */
+    c = pc[i];
+    if (c < 0x80) {
+      /* US-ASCII is clean unless it is CR */
+      if (c != ASCII_CR) {
+        i++;
+      } else {
+        clean = 0;
+      }
+    
+    } else {
+      /* Make sure we have a lead byte and its whole encoding */
+      ec = snutf_count(c);
+      if ((ec < 2) || (ec > (len - i))) {
+        clean = 0;
+      }
+      
+      /* Make sure the rest of the encoding is continuation bytes and
+       * decode the codepoint */
+      if (clean) {
+        cpv = c & (0x7f >> ec);
+        for(x = 1; x < ec; x++) {
+          if ((pc[i + x] & 0xc0) != 0x80) {
+            clean = 0;
+            break;
+          }
+          cpv = (cpv << 6) | (pc[i + x] & 0x3f);
+        }
+      }
+      
+      /* Make sure the encoding is not overlong, not beyond the Unicode
+       * range, and not a surrogate */
+      if (clean) {
+        if (((ec == 2) && (cpv < 0x80L)) ||
+            ((ec == 3) && (cpv < 0x800L)) ||
+            ((ec == 4) && (cpv < 0x10000L)) ||
+            (cpv > UNICODE_MAX_CPV) ||
+            ((cpv >= UNICODE_MIN_SURROGATE) &&
+              (cpv <= UNICODE_MAX_SURROGATE))) {
+          clean = 0;
+        }
+      }
+      
+      /* If clean, skip over the encoding */
+      if (clean) {
+        i = i + ec;
+      }
+    }
+  }
+  
+  /* Return length of clean prefix */
+  return i;
+}
+
+/*
+ * Destructor callback for a stdio FILE * source.
+ * 
+ * The function prototype matches pfDestruct in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static void snsource_file_free(void *pCustom) {
+  
+  FILE *pIn = NULL;
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Convert parameter to a FILE * handle */
+  pIn = (FILE *) pCustom;
+  
+  /* Close the file */
+  fclose(pIn);
+}
+
+/*
+ * Rewind callback for a stdio FILE * source.
+ * 
+ * The function prototype matches pfRewind in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static int snsource_file_rewind(void *pCustom) {
+  
+  int status = 1;
+  FILE *pIn = NULL;
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Convert parameter to a FILE * handle */
+  pIn = (FILE *) pCustom;
+  
+  /* Seek back to the beginning of the file */
+  if (fseek(pIn, 0, SEEK_SET)) {
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Destructor callback for a mapped file source.
+ * 
+ * The function prototype matches pfDestruct in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static void snsource_map_free(void *pCustom) {
+  
+  SNMAPSRC *pMap = NULL;
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Convert parameter to the mapped file structure */
+  pMap = (SNMAPSRC *) pCustom;
+  
+  /* Release the file data, if any */
+  if (pMap->pData != NULL) {
+#ifdef SHASTINA_POSIX
+    if (pMap->mapped) {
+      munmap((void *) pMap->pData, (size_t) pMap->len);
+    } else {
+      snalloc_release(&(pMap->alloc), pMap->pData, pMap->cap);
+    }
+#else
+    snalloc_release(&(pMap->alloc), pMap->pData, pMap->cap);
+#endif
+    pMap->pData = NULL;
+  }
+  
+  /* Free the structure */
+  snalloc_release(&(pMap->alloc), pMap, (long) sizeof(SNMAPSRC));
+}
+
+/*
+ * Destructor callback for a feed source.
+ * 
+ * The function prototype matches pfDestruct in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static void snsource_feed_free(void *pCustom) {
+  
+  SNFEEDSRC *pFeed = NULL;
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Convert parameter to the feed structure */
+  pFeed = (SNFEEDSRC *) pCustom;
+  
+  /* Release the buffer, if any */
+  if (pFeed->pData != NULL) {
+    snalloc_release(&(pFeed->alloc), pFeed->pData, pFeed->cap);
+    pFeed->pData = NULL;
+  }
+  
+  /* Free the structure */
+  snalloc_release(&(pFeed->alloc), pFeed, (long) sizeof(SNFEEDSRC));
+}
+
+/*
+ * Check whether a source is a feed source that ran out of input.
+ * 
+ * This is the case if the starved flag of the feed source is set.  See
+ * the SNFEEDSRC structure for further information.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source
+ * 
+ * Return:
+ * 
+ *   non-zero if starved, zero otherwise
+ */
+static int snsource_starved(SNSOURCE *pIn) {
+  
+  int result = 0;
+  
+  /* Check parameter */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* Only feed sources can be starved */
+  if (pIn->feed) {
+    result = ((SNFEEDSRC *) pIn->pCustom)->starved;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+#ifdef SHASTINA_POSIX
+/*
+ * Lock the buffer state of a file descriptor source.
+ * 
+ * This does nothing if the source has no read-ahead thread.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ */
+static void snfd_lock(SNFDSRC *pFd) {
+
+  /* Check parameter */
+  if (pFd == NULL) {
+    abort();
+  }
+  
+  /* Lock */
+#ifdef SHASTINA_THREADS
+  if (pFd->ahead) {
+    if (pthread_mutex_lock(&(pFd->lock)) != 0) {
+      abort();
+    }
+  }
+#endif
+}
+
+/*
+ * Unlock the buffer state of a file descriptor source.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source, which must be locked
+ */
+static void snfd_unlock(SNFDSRC *pFd) {
+
+  /* Check parameter */
+  if (pFd == NULL) {
+    abort();
+  }
+  
+  /* Unlock */
+#ifdef SHASTINA_THREADS
+  if (pFd->ahead) {
+    if (pthread_mutex_unlock(&(pFd->lock)) != 0) {
+      abort();
+    }
+  }
+#endif
+}
+
+/*
+ * Wait until the buffer state of a file descriptor source changes.
+ * 
+ * The source must be locked, and it is locked again on return.  Without
+ * a read-ahead thread, nothing could ever change the state, so a fault
+ * occurs.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ */
+static void snfd_wait(SNFDSRC *pFd) {
+
+  /* Check parameter and state */
+  if (pFd == NULL) {
+    abort();
+  }
+  if (!(pFd->ahead)) {
+    abort();
+  }
+  
+  /* Wait */
+#ifdef SHASTINA_THREADS
+  if (pthread_cond_wait(&(pFd->cond), &(pFd->lock)) != 0) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Wake everything that is waiting with snfd_wait().
+ * 
+ * The source must be locked.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ */
+static void snfd_wake(SNFDSRC *pFd) {
+
+  /* Check parameter */
+  if (pFd == NULL) {
+    abort();
+  }
+  
+  /* Wake */
+#ifdef SHASTINA_THREADS
+  if (pFd->ahead) {
+    if (pthread_cond_broadcast(&(pFd->cond)) != 0) {
+      abort();
+    }
+  }
+#endif
+}
+
+/*
+ * Read the next block of a file descriptor source into one of its
+ * buffers.
+ * 
+ * A single read() call of SNFD_BUFFER_SIZE bytes is made, which is
+ * repeated only if it is interrupted by a signal.  Short reads are
+ * returned as they are, so that pipes and terminals deliver what they
+ * have without waiting for a whole buffer.
+ * 
+ * This does not change the state of the buffer, so it can be called
+ * without the lock.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ * 
+ *   i - the index of the buffer to read into
+ * 
+ * Return:
+ * 
+ *   the number of bytes read, which is greater than zero, or SNERR_EOF
+ *   or SNERR_IOERR
+ */
+static long snfd_load(SNFDSRC *pFd, int i) {
+
+  long result = 0;
+  ssize_t rc = 0;
+  
+  /* Check parameters */
+  if (pFd == NULL) {
+    abort();
+  }
+  if ((i < 0) || (i > 1)) {
+    abort();
+  }
+  if (pFd->pBuf[i] == NULL) {
+    abort();
+  }
+  
+  /* Read, trying again if interrupted */
+  do {
+    rc = read(pFd->fd, pFd->pBuf[i], (size_t) SNFD_BUFFER_SIZE);
+  } while ((rc < 0) && (errno == EINTR));
+  
+  /* Convert the result */
+  if (rc > 0) {
+    result = (long) rc;
+  } else if (rc == 0) {
+    result = SNERR_EOF;
+  } else {
+    result = SNERR_IOERR;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Store the result of snfd_load() in the state of a buffer.
+ * 
+ * The source must be locked if it has a read-ahead thread.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ * 
+ *   i - the index of the buffer
+ * 
+ *   rc - the result of snfd_load()
+ */
+static void snfd_store(SNFDSRC *pFd, int i, long rc) {
+
+  /* Check parameters */
+  if (pFd == NULL) {
+    abort();
+  }
+  if ((i < 0) || (i > 1)) {
+    abort();
+  }
+  
+  /* Store the data length and whatever follows the data */
+  if (rc > 0) {
+    (pFd->len)[i] = rc;
+    (pFd->end)[i] = 0;
+  } else {
+    (pFd->len)[i] = 0;
+    (pFd->end)[i] = (int) rc;
+  }
+  (pFd->ready)[i] = 1;
+}
+
+#ifdef SHASTINA_THREADS
+/*
+ * Read-ahead thread of a file descriptor source.
+ * 
+ * The thread waits for a buffer to be requested through the job field,
+ * fills it, and marks it as ready, until the stop flag is set.  The
+ * lock is released while reading.
+ * 
+ * The function prototype matches pthread_create().
+ * 
+ * Parameters:
+ * 
+ *   pArg - the file descriptor source
+ * 
+ * Return:
+ * 
+ *   NULL
+ */
+static void *snfd_thread(void *pArg) {
+
+  SNFDSRC *pFd = NULL;
+  long rc = 0;
+  int i = 0;
+  
+  /* Check parameter */
+  if (pArg == NULL) {
+    abort();
+  }
+  pFd = (SNFDSRC *) pArg;
+  
+  /* Fill buffers as they are requested until stopped */
+  snfd_lock(pFd);
+  while (!(pFd->stop)) {
+    if (pFd->job >= 0) {
+      i = pFd->job;
+      pFd->job = -1;
+      pFd->busy = 1;
+      snfd_unlock(pFd);
+      
+      rc = snfd_load(pFd, i);
+      
+      snfd_lock(pFd);
+      snfd_store(pFd, i, rc);
+      pFd->busy = 0;
+      snfd_wake(pFd);
+    
+    } else {
+      snfd_wait(pFd);
+    }
+  }
+  snfd_unlock(pFd);
+  
+  /* Return nothing */
+  return NULL;
+}
+#endif
+
+/*
+ * Request a buffer of a file descriptor source from the read-ahead
+ * thread.
+ * 
+ * The source must be locked and have a read-ahead thread.  Buffers are
+ * filled in the order they are requested, and only one request may be
+ * outstanding at a time.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ * 
+ *   i - the index of the buffer to fill
+ */
+static void snfd_request(SNFDSRC *pFd, int i) {
+
+  /* Check parameters and state */
+  if (pFd == NULL) {
+    abort();
+  }
+  if ((i < 0) || (i > 1) || (!(pFd->ahead))) {
+    abort();
+  }
+  
+  /* Request the buffer */
+  (pFd->ready)[i] = 0;
+  pFd->job = i;
+  snfd_wake(pFd);
+}
+
+/*
+ * Wait until the read-ahead thread of a file descriptor source is not
+ * filling any buffer and has no buffer requested.
+ * 
+ * This does nothing if the source has no read-ahead thread.  The
+ * source must not be locked.  Afterwards, the file descriptor may be
+ * used until the next request.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ */
+static void snfd_idle(SNFDSRC *pFd) {
+
+  /* Check parameter */
+  if (pFd == NULL) {
+    abort();
+  }
+  
+  /* Wait for the thread */
+  if (pFd->ahead) {
+    snfd_lock(pFd);
+    while ((pFd->job >= 0) || pFd->busy) {
+      snfd_wait(pFd);
+    }
+    snfd_unlock(pFd);
+  }
+}
+
+/*
+ * Move a file descriptor source on to its next buffer.
+ * 
+ * With read-ahead, this waits for the buffer after the current one to
+ * be filled, takes it, and requests the buffer that was current, unless
+ * the new buffer is followed by End Of File or an I/O error.  Without
+ * read-ahead, the first buffer is refilled.
+ * 
+ * Bytes that are still to be skipped after a seek are skipped at the
+ * start of the new buffer.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ */
+static void snfd_next(SNFDSRC *pFd) {
+
+  int i = 0;
+  
+  /* Check parameter */
+  if (pFd == NULL) {
+    abort();
+  }
+  
+  /* Take the next buffer */
+  if (pFd->ahead) {
+    if (pFd->cur >= 0) {
+      i = 1 - pFd->cur;
+    } else {
+      i = 0;
+    }
+    
+    snfd_lock(pFd);
+    if ((!((pFd->ready)[i])) && (pFd->job < 0) && (!(pFd->busy))) {
+      snfd_request(pFd, i);
+    }
+    while (!((pFd->ready)[i])) {
+      snfd_wait(pFd);
+    }
+    (pFd->ready)[i] = 0;
+    if ((pFd->end)[i] == 0) {
+      snfd_request(pFd, 1 - i);
+    }
+    snfd_unlock(pFd);
+  
+  } else {
+    i = 0;
+    snfd_store(pFd, i, snfd_load(pFd, i));
+    (pFd->ready)[i] = 0;
+  }
+  
+  /* Make it current, skipping whatever remains to be skipped */
+  pFd->cur = i;
+  pFd->pos = pFd->skip;
+  if (pFd->pos > (pFd->len)[i]) {
+    pFd->pos = (pFd->len)[i];
+  }
+  pFd->skip = pFd->skip - pFd->pos;
+}
+
+/*
+ * Move a file descriptor source with random access to a byte offset.
+ * 
+ * The file is positioned at the offset rounded down to SNFD_ALIGN, so
+ * that whole aligned blocks are read, and the bytes before the offset
+ * are skipped in the first buffer.  All buffered data is dropped.  With
+ * read-ahead, the first buffer is requested right away.
+ * 
+ * Parameters:
+ * 
+ *   pFd - the file descriptor source
+ * 
+ *   pos - the byte offset, which must be zero or greater
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file could not be positioned
+ */
+static int snfd_seek(SNFDSRC *pFd, long pos) {
+
+  int status = 1;
+  long base = 0;
+  
+  /* Check parameters and state */
+  if ((pFd == NULL) || (pos < 0)) {
+    abort();
+  }
+  if (!(pFd->random)) {
+    abort();
+  }
+  
+  /* Wait for the read-ahead thread to let go of the file */
+  snfd_idle(pFd);
+  
+  /* Position the file at the aligned offset */
+  base = pos - (pos % SNFD_ALIGN);
+  if (lseek(pFd->fd, (off_t) base, SEEK_SET) != (off_t) base) {
+    status = 0;
+  }
+  
+  /* Drop all buffered data and start reading again */
+  snfd_lock(pFd);
+  (pFd->ready)[0] = 0;
+  (pFd->ready)[1] = 0;
+  pFd->cur = -1;
+  pFd->pos = 0;
+  pFd->skip = pos - base;
+  if (status && pFd->ahead) {
+    snfd_request(pFd, 0);
+  }
+  snfd_unlock(pFd);
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Block reading callback for a file descriptor source.
+ * 
+ * The function prototype matches pfBlock in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static long snsource_fd_block(
+    void          * pCustom,
+    unsigned char * pBuf,
+    long            max) {
+  
+  SNFDSRC *pFd = NULL;
+  long result = 0;
+  long n = 0;
+  
+  /* Check parameters */
+  if ((pCustom == NULL) || (pBuf == NULL) || (max < 1)) {
+    abort();
+  }
+  
+  /* Convert parameter to the file descriptor structure */
+  pFd = (SNFDSRC *) pCustom;
+  
+  /* Hand out the rest of the current buffer, moving on to the next
+   * buffer while the current one is used up and more data follows */
+  while (result == 0) {
+    if ((pFd->cur >= 0) && (pFd->pos < (pFd->len)[pFd->cur])) {
+      n = (pFd->len)[pFd->cur] - pFd->pos;
+      if (n > max) {
+        n = max;
+      }
+      memcpy(pBuf, (pFd->pBuf)[pFd->cur] + pFd->pos, (size_t) n);
+      pFd->pos = pFd->pos + n;
+      result = n;
+    
+    } else if ((pFd->cur >= 0) && ((pFd->end)[pFd->cur] != 0)) {
+      result = (pFd->end)[pFd->cur];
+    
+    } else {
+      snfd_next(pFd);
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Destructor callback for a file descriptor source.
+ * 
+ * This also releases a partially constructed structure.
+ * 
+ * The function prototype matches pfDestruct in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static void snsource_fd_free(void *pCustom) {
+
+  SNFDSRC *pFd = NULL;
+  SNALLOC alloc;
+  int i = 0;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Convert parameter to the file descriptor structure */
+  pFd = (SNFDSRC *) pCustom;
+  
+  /* Stop the read-ahead thread */
+#ifdef SHASTINA_THREADS
+  if (pFd->ahead) {
+    snfd_lock(pFd);
+    pFd->stop = 1;
+    snfd_wake(pFd);
+    snfd_unlock(pFd);
+    if (pthread_join(pFd->thread, NULL) != 0) {
+      abort();
+    }
+    pthread_cond_destroy(&(pFd->cond));
+    pthread_mutex_destroy(&(pFd->lock));
+    pFd->ahead = 0;
+  }
+#endif
+
+  /* Close the file descriptor if owned */
+  if (pFd->owner) {
+    close(pFd->fd);
+  }
+  
+  /* Release the buffers, and then the structure through a copy of the
+   * allocator since it is stored in the structure */
+  for(i = 0; i < 2; i++) {
+    if ((pFd->pRaw)[i] != NULL) {
+      snalloc_release(&(pFd->alloc), (pFd->pRaw)[i],
+                      SNFD_BUFFER_SIZE + SNFD_ALIGN);
+      (pFd->pRaw)[i] = NULL;
+      (pFd->pBuf)[i] = NULL;
+    }
+  }
+  memcpy(&alloc, &(pFd->alloc), sizeof(SNALLOC));
+  snalloc_release(&alloc, pFd, (long) sizeof(SNFDSRC));
+}
+
+/*
+ * Rewind callback for a file descriptor source.
+ * 
+ * The function prototype matches pfRewind in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static int snsource_fd_rewind(void *pCustom) {
+
+  /* Check parameter */
+  if (pCustom == NULL) {
+    abort();
+  }
+  
+  /* Seek back to the beginning of the file */
+  return snfd_seek((SNFDSRC *) pCustom, 0);
+}
+#endif
+
+/*
+ * Load a whole file into a mapped file structure.
+ * 
+ * pMap is the structure to fill in.  It should be cleared to zero on
+ * entry, except for the alloc field, which must be set to the memory
+ * allocator.  On success, pData, len, cap, and mapped will be set
+ * appropriately.  On failure, they remain cleared.
+ * 
+ * pPath is the path to the file to load.
+ * 
+ * If SHASTINA_POSIX is defined, this function first tries to map the
+ * file into memory with mmap().  If that is unavailable or fails, then
+ * the whole file is read into a dynamically allocated buffer using
+ * standard I/O.
+ * 
+ * The function fails if the file can not be opened or read, if the
+ * file is too large for its length to be stored in a long, or if the
+ * buffer can not be allocated.
+ * 
+ * Parameters:
+ * 
+ *   pMap - the mapped file structure to fill in
+ * 
+ *   pPath - the path to the file
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if failure
+ */
+static int snsource_map_load(SNMAPSRC *pMap, const char *pPath) {
+  
+  int status = 1;
+  int done = 0;
+  FILE *pFile = NULL;
+  unsigned char *pBuf = NULL;
+  unsigned char *pNew = NULL;
+  long cap = 0;
+  long len = 0;
+  long newcap = 0;
+  size_t rc = 0;
+#ifdef SHASTINA_POSIX
+  int fd = -1;
+  struct stat st;
+  void *pMapped = NULL;
+#endif
+  
+  /* Check parameters */
+  if ((pMap == NULL) || (pPath == NULL)) {
+    abort();
+  }
+
+#ifdef SHASTINA_POSIX
+  /* First, try to map the file into memory -- empty regular files are
+   * handled here too since they can't be mapped, while anything that
+   * fails to map falls through to standard I/O below */
+  memset(&st, 0, sizeof(struct stat));
+  fd = open(pPath, O_RDONLY);
+  if (fd >= 0) {
+    if (fstat(fd, &st) == 0) {
+      if (S_ISREG(st.st_mode) && (st.st_size == 0)) {
+        /* Empty regular file */
+        pMap->pData = NULL;
+        pMap->len = 0;
+        pMap->cap = 0;
+        pMap->mapped = 0;
+        done = 1;
+      
+      } else if (S_ISREG(st.st_mode) && (st.st_size > 0) &&
+          ((unsigned long) st.st_size <= (unsigned long) LONG_MAX) &&
+          ((unsigned long) ((size_t) st.st_size) ==
+            (unsigned long) st.st_size)) {
+        /* Non-empty regular file that fits in range */
+        pMapped = mmap(NULL, (size_t) st.st_size, PROT_READ,
+                        MAP_PRIVATE, fd, 0);
+        if (pMapped != MAP_FAILED) {
+          pMap->pData = (unsigned char *) pMapped;
+          pMap->len = (long) st.st_size;
+          pMap->cap = 0;
+          pMap->mapped = 1;
+          done = 1;
+        }
+      }
+    }
+    close(fd);
+    fd = -1;
+  }
+#endif
+  
+  /* If the file wasn't mapped, open it with standard I/O */
+  if (!done) {
+    pFile = fopen(pPath, "rb");
+    if (pFile == NULL) {
+      status = 0;
+    }
+  }
+  
+  /* Read the whole file into a buffer that grows by doubling */
+  while (status && (!done)) {
+    
+    /* Make sure there is room for more data in the buffer */
+    if (len >= cap) {
+      if (cap < 1) {
+        newcap = SNSOURCE_BLOCK_SIZE;
+      } else if (cap <= (LONG_MAX / 2)) {
+        newcap = cap * 2;
+      } else if (cap < LONG_MAX) {
+        newcap = LONG_MAX;
+      } else {
+        /* File is too large */
+        status = 0;
+      }
+      
+      if (status &&
+          ((unsigned long) ((size_t) newcap) !=
+            (unsigned long) newcap)) {
+        /* Buffer size out of range of size_t */
+        status = 0;
+      }
+      
+      if (status) {
+        if (pBuf == NULL) {
+          pNew = (unsigned char *) snalloc_get(&(pMap->alloc), newcap);
+        } else {
+          pNew = (unsigned char *) snalloc_resize(
+                    &(pMap->alloc), pBuf, cap, newcap);
+        }
+        if (pNew != NULL) {
+          pBuf = pNew;
+          pNew = NULL;
+          cap = newcap;
+        } else {
+          /* Out of memory */
+          status = 0;
+        }
+      }
+    }
+    
+    /* Read as much as fits, stopping at EOF or error */
+    if (status) {
+      rc = fread(pBuf + len, 1, (size_t) (cap - len), pFile);
+      len = len + ((long) rc);
+      if (rc < 1) {
+        if (ferror(pFile)) {
+          status = 0;
+        }
+        break;
+      }
+    }
+  }
+  
+  /* Close the file if we opened it */
+  if (pFile != NULL) {
+    fclose(pFile);
+    pFile = NULL;
+  }
+  
+  /* If we read the file with standard I/O, store the results if
+   * successful, or release the buffer if not */
+  if ((!done) && status) {
+    if (len > 0) {
+      pMap->pData = pBuf;
+      pMap->cap = cap;
+    } else {
+      snalloc_release(&(pMap->alloc), pBuf, cap);
+      pMap->pData = NULL;
+      pMap->cap = 0;
+    }
+    pBuf = NULL;
+    pMap->len = len;
+    pMap->mapped = 0;
+  
+  } else if ((!done) && (pBuf != NULL)) {
+    snalloc_release(&(pMap->alloc), pBuf, cap);
+    pBuf = NULL;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Allocate a whole source.
+ * 
+ * Whole sources hold the complete input data as one contiguous buffer
+ * in their window.  See the whole field of SNSOURCE for further
+ * information.
+ * 
+ * pData is the input data, which must remain allocated and unchanged
+ * while the source is allocated.  It may be NULL only if len is zero.
+ * len is the number of bytes of input data, which must be zero or
+ * greater.
+ * 
+ * free_func and custom are the destructor and custom data for the
+ * source, with the same meaning as for snsource_custom().
+ * 
+ * pAlloc is the memory allocator for the source, or NULL to use the
+ * standard allocator.  If the source can not be allocated, NULL is
+ * returned and the destructor is not called.
+ * 
+ * Parameters:
+ * 
+ *   pData - the input data
+ * 
+ *   len - the number of bytes of input data
+ * 
+ *   free_func - the destructor callback, or NULL
+ * 
+ *   custom - the custom data, which may be NULL
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new whole source, or NULL if memory could not be allocated
+ */
+static SNSOURCE *snsource_whole(
+    const unsigned char * pData,
+    long                  len,
+    void               (* free_func)(void *),
+    void                * custom,
+    const SNALLOC       * pAlloc) {
+  
+  SNSOURCE *pSrc = NULL;
+  SNALLOC alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameters */
+  if ((len < 0) || ((len > 0) && (pData == NULL))) {
+    abort();
+  }
+  
+  /* Get the allocator and allocate structure */
+  snalloc_init(&alloc, pAlloc);
+  pSrc = (SNSOURCE *) snalloc_get(&alloc, (long) sizeof(SNSOURCE));
+  
+  /* Initialize structure */
+  if (pSrc != NULL) {
+    memset(pSrc, 0, sizeof(SNSOURCE));
+    
+    pSrc->pfRead = NULL;
+    pSrc->pfBlock = NULL;
+    pSrc->pfDestruct = free_func;
+    pSrc->pfRewind = NULL;
+    
+    pSrc->read_count = 0;
+    pSrc->status = 0;
+    pSrc->pCustom = custom;
+    
+    pSrc->pBlock = NULL;
+    pSrc->pWin = pData;
+    pSrc->win_len = len;
+    pSrc->win_pos = 0;
+    pSrc->win_clean = 0;
+    pSrc->whole = 1;
+    pSrc->cache = 0;
+    pSrc->feed = 0;
+    
+    pSrc->pLines = NULL;
+    pSrc->line_count = 0;
+    pSrc->line_cap = 0;
+    
+    memcpy(&(pSrc->alloc), &alloc, sizeof(SNALLOC));
+  }
+  
+  /* Return the new source object or NULL */
+  return pSrc;
+}
+
+/*
+ * Refill the window of a block source and read the first byte from it.
+ * 
+ * pIn must be a block source that is not in a special status and that
+ * has an empty window, or a fault occurs.
+ * 
+ * The block read callback is invoked to refill the window.  If it
+ * returns a special status code, that code is stored in the status
+ * field of the source and returned.  Otherwise, the first byte of the
+ * new window is consumed and returned.
+ * 
+ * Clients should use snsource_read() instead of calling this function
+ * directly.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the block source to refill
+ * 
+ * Return:
+ * 
+ *   the first byte of the refilled window, or SNERR_EOF or SNERR_IOERR
+ */
+static int snsource_fill(SNSOURCE *pIn) {
+  
+  long result = 0;
+  
+  /* Check parameter and state */
+  if (pIn == NULL) {
+    abort();
+  }
+  if ((pIn->pfBlock == NULL) || (pIn->pBlock == NULL) ||
+      (pIn->status < 0) || (pIn->win_pos < pIn->win_len)) {
+    abort();
+  }
+  
+  /* Clear the window and invoke the block read callback */
+  pIn->win_len = 0;
+  pIn->win_pos = 0;
+  pIn->win_clean = 0;
+  result = (*(pIn->pfBlock))(pIn->pCustom, pIn->pBlock,
+                              (long) SNSOURCE_BLOCK_SIZE);
+  
+  /* Check range of returned result */
+  if (((result < 1) || (result > SNSOURCE_BLOCK_SIZE)) &&
+        (result != SNERR_EOF) && (result != SNERR_IOERR)) {
+    abort();
+  }
+  
+  /* If we got bytes, set up the window and consume the first byte;
+   * otherwise, store the special status code */
+  if (result > 0) {
+    pIn->win_len = result;
+    result = pIn->pWin[0];
+    pIn->win_pos = 1;
+    if (pIn->read_count < LONG_MAX) {
+      (pIn->read_count)++;
+    }
+  } else {
+    pIn->status = (int) result;
+  }
+  
+  /* Return result */
+  return (int) result;
+}
+
+/*
+ * Read a single byte from a source object.
+ * 
+ * The return value is an unsigned byte value in range [0, 255], or else
+ * SNERR_EOF or SNERR_IOERR.  SNERR_UTF8 is never generated by this
+ * function, but it may be returned because snsource_readCPV() may set
+ * the status of the source object to that error.
+ * 
+ * Clients are recommended to use snsource_readCPV() instead of directly
+ * using this function.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source to read from
+ * 
+ * Return:
+ * 
+ *   the next byte read, or SNERR_EOF if nothing remains in input
+ *   source, or SNERR_IOERR if there was an error reading the input
+ *   source, or SNERR_UTF8 if there was a previous UTF-8 decoding error
+ */
+static int snsource_read(SNSOURCE *pIn) {
+  
+  int result = 0;
+  
+  /* Check parameter */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* Determine first whether we have a special condition to return
+   * without invoking the callback */
+  if (pIn->status < 0) {
+    /* We have a special status code, so just use that */
+    result = pIn->status;
+  
+  } else if (pIn->win_pos < pIn->win_len) {
+    /* Bytes remain in the window, so take the next one without calling
+     * through to the callback */
+    result = pIn->pWin[pIn->win_pos];
+    (pIn->win_pos)++;
+    if (pIn->read_count < LONG_MAX) {
+      (pIn->read_count)++;
+    }
+  
+  } else if (pIn->whole) {
+    /* Whole source with an empty window, so we are at End Of File */
+    result = SNERR_EOF;
+    pIn->status = result;
+  
+  } else if (pIn->feed) {
+    /* Feed source with an empty window, which is End Of File if the end
+     * of input has been marked, or else starves the source without
+     * changing its status */
+    result = SNERR_EOF;
+    if (((SNFEEDSRC *) pIn->pCustom)->done) {
+      pIn->status = result;
+    } else {
+      ((SNFEEDSRC *) pIn->pCustom)->starved = 1;
+    }
+  
+  } else if (pIn->pfBlock != NULL) {
+    /* Block source with an empty window, so refill the window */
+    result = snsource_fill(pIn);
+  
+  } else {
+    /* No special status code, so we need to invoke the read callback;
+     * check first that the callback is defined */
+    if (pIn->pfRead == NULL) {
+      abort();
+    }
+    
+    /* Invoke the read callback */
+    result = (*(pIn->pfRead))(pIn->pCustom);
+    
+    /* Check range of returned result */
+    if (((result < 0) || (result > 255)) &&
+          (result != SNERR_EOF) && (result != SNERR_IOERR)) {
+      abort();
+    }
+    
+    /* If returned result was an unsigned byte value, increment the read
+     * count (unless it has overflown); otherwise, if it is a special
+     * return code, store it in status so we return it in future
+     * invocations */
+    if ((result >= 0) && (result <= 255)) {
+      if (pIn->read_count < LONG_MAX) {
+        (pIn->read_count)++;
+      }
+    } else {
+      pIn->status = result;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Read a UTF-8 encoded Unicode codepoint from a source object.
+ * 
+ * The return value is a Unicode codepoint [0, UNICODE_MAX_CPV], or else
+ * SNERR_EOF if end of source file, SNERR_IOERR if I/O error reading
+ * from source, or SNERR_UTF8 if error decoding UTF-8.
+ * 
+ * This function will only decode a single UTF-8 codepoint.  It will
+ * check for overlong encodings and invalid encodings, causing the
+ * SNERR_UTF8 error if such illegal encodings occur.
+ * 
+ * This function WILL successfully decode surrogate codepoints, even
+ * though surrogates aren't supposed to be used in UTF-8.  It is assumed
+ * that surrogate pairs will be properly decoded at a higher level.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source to read from
+ * 
+ * Return:
+ * 
+ *   the next codepoint read (including surrogates!), or SNERR_EOF if
+ *   nothing remains in input source, or SNERR_IOERR if there was an
+ *   error reading the input source, or SNERR_UTF8 if there was a UTF-8
+ *   decoding error
+ */
+static long snsource_readCPV(SNSOURCE *pIn) {
+  
+  unsigned char buf[5];
+  long result = 0;
+  int err_num = 0;
+  int c = 0;
+  int ec = 0;
+  int i = 0;
+  
+  /* Initialize buffer */
+  memset(buf, 0, 5);
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* Get the next byte */
+  c = snsource_read(pIn);
+  
+  /* If we got a special status return, then result is that; if we got
+   * a US-ASCII byte, then the result is that byte; otherwise, proceed
+   * to decode */
+  if ((c >= 0) && (c < 0x80)) {
+    /* US-ASCII encodes itself */
+    result = c;
+  
+  } else if (c < 0) {
+    /* Special status return, so that will be the result */
+    result = c;
+  
+  } else {
+    /* We read a byte, so determine how many bytes in the encoded
+     * codepoint */
+    ec = snutf_count(c);
+    if (ec < 1) {
+      /* Not a valid first byte of an encoded codepoint, so fail */
+      err_num = SNERR_UTF8;
+    } else if (ec > 4) {
+      /* Shouldn't happen */
+      abort();
+    }
+    
+    /* Write the character we just read into the decoding buffer */
+    if (!err_num) {
+      buf[0] = (unsigned char) c;
+    }
+    
+    /* Read any additional bytes into the decoding buffer -- EOF returns
+     * will be changed to UTF-8 decoding errors */
+    if (!err_num) {
+      for(i = 1; i < ec; i++) {
+        c = snsource_read(pIn);
+        if (c < 0) {
+          if (c == SNERR_EOF) {
+            err_num = SNERR_UTF8;
+          } else {
+            err_num = c;
+          }
+          break;
+        } else {
+          buf[i] = (unsigned char) c;
+        }
+      }
+    }
+    
+    /* Decode the buffered character bytes into a codepoint */
+    if (!err_num) {
+      result = snutf_decode(buf);
+      if (result < 0) {
+        err_num = SNERR_UTF8;
+      }
+    }
+  }
+  
+  /* If error occurred, set result to error code and store error code in
+   * status field of source */
+  if (err_num) {
+    result = err_num;
+    pIn->status = err_num;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Get a pointer to the current position in the input data of a whole
+ * source.
+ * 
+ * For whole sources, the window holds the complete input data, so the
+ * input bytes that have already been consumed remain available before
+ * the returned pointer.  For sources that are not whole, NULL is
+ * returned.  For empty whole sources, the returned pointer is not NULL
+ * but can't be dereferenced.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source
+ * 
+ * Return:
+ * 
+ *   pointer to the next byte to read in the input data, or NULL if the
+ *   source is not whole
+ */
+static const char *snsource_view(SNSOURCE *pIn) {
+  
+  const char *pResult = NULL;
+  
+  /* Check parameter */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* Only whole sources have views */
+  if (pIn->whole) {
+    if (pIn->win_len > 0) {
+      pResult = ((const char *) pIn->pWin) + pIn->win_pos;
+    } else {
+      pResult = "";
+    }
+  }
+  
+  /* Return the pointer or NULL */
+  return pResult;
+}
+
+/*
+ * Build the line break index of a whole source, if it has not been
+ * built yet.
+ * 
+ * See the pLines field of SNSOURCE for the index.  The function fails
+ * if memory runs out, in which case no index is kept and the next call
+ * tries again.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the whole source, which must not be a cache source
+ * 
+ * Return:
+ * 
+ *   non-zero if the index is available, zero if out of memory
+ */
+static int snsource_index(SNSOURCE *pSrc) {
+  
+  int status = 1;
+  long pos = 0;
+  long cap = 0;
+  long *pNew = NULL;
+  const unsigned char *pLF = NULL;
+  
+  /* Check parameter */
+  if (pSrc == NULL) {
+    abort();
+  }
+  if ((!(pSrc->whole)) || pSrc->cache) {
+    abort();
+  }
+  
+  /* Only build the index if it is not there yet */
+  if (pSrc->pLines == NULL) {
+    
+    /* Allocate the initial index */
+    pSrc->pLines = (long *) snalloc_get(&(pSrc->alloc),
+                      SNSOURCE_LINES_INIT * ((long) sizeof(long)));
+    if (pSrc->pLines != NULL) {
+      pSrc->line_cap = SNSOURCE_LINES_INIT;
+      pSrc->line_count = 0;
+    } else {
+      status = 0;
+    }
+    
+    /* Add the offset of each LF, doubling the index as necessary */
+    while (status && (pos < pSrc->win_len)) {
+      pLF = (const unsigned char *) memchr(pSrc->pWin + pos, ASCII_LF,
+                                        (size_t) (pSrc->win_len - pos));
+      if (pLF == NULL) {
+        break;
+      }
+      
+      if (pSrc->line_count >= pSrc->line_cap) {
+        pNew = NULL;
+        if (pSrc->line_cap <= LONG_MAX / 2 / ((long) sizeof(long))) {
+          cap = pSrc->line_cap * 2;
+          pNew = (long *) snalloc_resize(&(pSrc->alloc), pSrc->pLines,
+                            pSrc->line_cap * ((long) sizeof(long)),
+                            cap * ((long) sizeof(long)));
+        }
+        if (pNew != NULL) {
+          pSrc->pLines = pNew;
+          pSrc->line_cap = cap;
+        } else {
+          status = 0;
+        }
+      }
+      
+      if (status) {
+        pos = (long) (pLF - pSrc->pWin);
+        (pSrc->pLines)[pSrc->line_count] = pos;
+        (pSrc->line_count)++;
+        pos++;
+      }
+    }
+    
+    /* Drop a partial index if memory ran out */
+    if ((!status) && (pSrc->pLines != NULL)) {
+      snalloc_release(&(pSrc->alloc), pSrc->pLines,
+                      pSrc->line_cap * ((long) sizeof(long)));
+      pSrc->pLines = NULL;
+      pSrc->line_count = 0;
+      pSrc->line_cap = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Determine how many bytes ahead in the window of a source are clean.
+ * 
+ * If nothing ahead in the window is known to be clean, this scans ahead
+ * with snutf_scan() to find out, updating the win_clean field.  See
+ * that field of SNSOURCE for what qualifies as clean input.  At most
+ * SNSOURCE_SCAN_MAX bytes are scanned at a time.
+ * 
+ * Zero is returned if the source is in a special status, the source
+ * has no window, the window is empty, or the next codepoint is not
+ * clean.  Otherwise, the clean bytes always end on a codepoint
+ * boundary.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source to check
+ * 
+ * Return:
+ * 
+ *   the number of clean bytes starting at the current window position
+ */
+static long snsource_clean(SNSOURCE *pIn) {
+  
+  long result = 0;
+  long avail = 0;
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* Only proceed if not in a special status */
+  if (pIn->status == 0) {
+    
+    /* If nothing ahead is known to be clean, scan ahead in the window
+     * to see how much is clean */
+    if (pIn->win_clean <= pIn->win_pos) {
+      avail = pIn->win_len - pIn->win_pos;
+      if (avail > SNSOURCE_SCAN_MAX) {
+        avail = SNSOURCE_SCAN_MAX;
+      }
+      if (avail > 0) {
+        pIn->win_clean = pIn->win_pos +
+                          snutf_scan(pIn->pWin + pIn->win_pos, avail);
+      }
+    }
+    
+    /* Determine how much is clean */
+    if (pIn->win_pos < pIn->win_clean) {
+      result = pIn->win_clean - pIn->win_pos;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Read a clean Unicode codepoint directly from the window of a source.
+ * 
+ * This is a fast path for snsource_readCPV().  If the next codepoint in
+ * the window is clean according to snsource_clean(), then the codepoint
+ * is decoded directly from the window and consumed.
+ * 
+ * Otherwise, nothing is consumed and -1 is returned to indicate that
+ * the regular, codepoint-by-codepoint path must be used.  Note that -1
+ * does NOT indicate an I/O error here.
+ * 
+ * Since clean input never includes surrogates or CR, the returned
+ * codepoint passes through the input filter unchanged.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source to read from
+ * 
+ * Return:
+ * 
+ *   the next clean codepoint, or -1 if the regular path must be used
+ */
+static long snsource_readClean(SNSOURCE *pIn) {
+  
+  const unsigned char *pc = NULL;
+  long result = -1;
+  int ec = 0;
+  int x = 0;
+  
+  /* Check parameters */
+  if (pIn == NULL) {
+    abort();
+  }
+  
+  /* If the next codepoint is clean, decode it directly */
+  if (snsource_clean(pIn) > 0) {
+    pc = pIn->pWin + pIn->win_pos;
+    if (*pc < 0x80) {
+      /* US-ASCII encodes itself */
+      result = *pc;
+      ec = 1;
+    
+    } else {
+      /* Clean multibyte encoding, so no checks needed */
+      ec = snutf_count(*pc);
+      result = *pc & (0x7f >> ec);
+      for(x = 1; x < ec; x++) {
+        result = (result << 6) | (pc[x] & 0x3f);
+      }
+    }
+    
+    /* Consume the encoding and update the read count */
+    pIn->win_pos = pIn->win_pos + ec;
+    if (pIn->read_count <= LONG_MAX - ec) {
+      pIn->read_count = pIn->read_count + ec;
+    } else {
+      pIn->read_count = LONG_MAX;
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Skip directly over a run of input in the window of a source.
+ * 
+ * kind is one of the SNRUN_ constants, which determines what the run
+ * consists of:
+ * 
+ *   SNRUN_WHITE - all the HT, SP, and LF characters immediately ahead
+ * 
+ *   SNRUN_COMMENT - all the clean input immediately ahead (see
+ *   snsource_clean()) up to but excluding the next LF
+ * 
+ *   SNRUN_QUOTED - all the clean input immediately ahead up to but
+ *   excluding the next double quote, backslash, or nul
+ * 
+ *   SNRUN_CURLIED - all the clean input immediately ahead up to but
+ *   excluding the next curly bracket, backslash, or nul
+ * 
+ *   SNRUN_TOKEN - all the SNCHAR_PLAIN characters immediately ahead
+ * 
+ * The characters after which the run stops are exactly those that need
+ * special handling, so the run can be processed in bulk.
+ * 
+ * max is the maximum length of the run in bytes, which must be zero or
+ * greater.  The run also ends early at the end of the window or the
+ * end of the clean input, so it is not necessarily complete.  Whole
+ * words are scanned at a time.
+ * 
+ * The run may also be empty, which is always the case if the source is
+ * in a special status or has no window.  Otherwise, the run is consumed
+ * and the read count is updated.  pRun receives a description of the
+ * run.  Since the run is always clean input, it passes through the
+ * input filter unchanged.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source to read from
+ * 
+ *   kind - the SNRUN_ constant selecting what kind of run to skip
+ * 
+ *   max - the maximum number of bytes to skip
+ * 
+ *   pRun - receives a description of the run
+ */
+static void snsource_skip(
+    SNSOURCE * pIn,
+    int        kind,
+    long       max,
+    SNRUN    * pRun) {
+  
+  const unsigned char *pc = NULL;
+  const unsigned char *pe = NULL;
+  unsigned long w = 0;
+  unsigned long m = 0;
+  long avail = 0;
+  long lines = 0;
+  long n = 0;
+  long i = 0;
+  int c = 0;
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pRun == NULL) || (max < 0)) {
+    abort();
+  }
+  if ((kind != SNRUN_WHITE) && (kind != SNRUN_COMMENT) &&
+      (kind != SNRUN_QUOTED) && (kind != SNRUN_CURLIED) &&
+      (kind != SNRUN_TOKEN)) {
+    abort();
+  }
+  
+  /* Clear the run description */
+  memset(pRun, 0, sizeof(SNRUN));
+  pRun->pData = NULL;
+  pRun->last = -1;
+  
+  /* Determine the longest the run could be; whitespace and token
+   * characters are always clean, so those don't need to be scanned */
+  if ((kind != SNRUN_WHITE) && (kind != SNRUN_TOKEN)) {
+    avail = snsource_clean(pIn);
+  } else if (pIn->status == 0) {
+    avail = pIn->win_len - pIn->win_pos;
+  }
+  if (avail > max) {
+    avail = max;
+  }
+  
+  /* Find the length of the run */
+  if (avail > 0) {
+    pc = pIn->pWin + pIn->win_pos;
+    if (kind == SNRUN_COMMENT) {
+      /* Comment text runs up to the next LF */
+      pe = (const unsigned char *) memchr(pc, ASCII_LF, (size_t) avail);
+      if (pe != NULL) {
+        n = (long) (pe - pc);
+      } else {
+        n = avail;
+      }
+    
+    } else if (kind == SNRUN_TOKEN) {
+      /* Token characters are looked up in the class table; anything
+       * other than plain characters needs special handling */
+      for(n = 0; n < avail; n++) {
+        if ((pc[n] >= 0x80) ||
+            (SNCHAR_GETFLAGS(snchar_table[pc[n]]) != SNCHAR_PLAIN)) {
+          break;
+        }
+      }
+    
+    } else if (kind == SNRUN_WHITE) {
+      /* Skip whole words that are entirely whitespace, counting the
+       * line feeds within them */
+      while ((avail - n) >= ((long) sizeof(unsigned long))) {
+        w = snword_load(pc + n);
+        m = snword_match(w, ASCII_LF);
+        if ((m | snword_match(w, ASCII_SP) | snword_match(w, ASCII_HT))
+              != SNWORD_HIGHS) {
+          break;
+        }
+        lines = lines + snword_count(m);
+        n = n + ((long) sizeof(unsigned long));
+      }
+      
+      /* Skip any remaining whitespace a byte at a time */
+      for( ; n < avail; n++) {
+        if (pc[n] == ASCII_LF) {
+          lines++;
+        } else if ((pc[n] != ASCII_SP) && (pc[n] != ASCII_HT)) {
+          break;
+        }
+      }
+    
+    } else {
+      /* Skip whole words that have no characters needing special
+       * handling within string data, counting the line feeds within
+       * them; continuation bytes never match these US-ASCII values, so
+       * multibyte encodings need no special treatment */
+      while ((avail - n) >= ((long) sizeof(unsigned long))) {
+        w = snword_load(pc + n);
+        m = snword_match(w, ASCII_BACKSLASH) | snword_match(w, 0);
+        if (kind == SNRUN_QUOTED) {
+          m = m | snword_match(w, ASCII_DQUOTE);
+        } else {
+          m = m | snword_match(w, ASCII_LCURL) |
+                snword_match(w, ASCII_RCURL);
+        }
+        if (m != 0) {
+          break;
+        }
+        lines = lines + snword_count(snword_match(w, ASCII_LF));
+        n = n + ((long) sizeof(unsigned long));
+      }
+      
+      /* Skip anything remaining a byte at a time */
+      for( ; n < avail; n++) {
+        c = pc[n];
+        if ((c == ASCII_BACKSLASH) || (c == 0)) {
+          break;
+        } else if ((kind == SNRUN_QUOTED) && (c == ASCII_DQUOTE)) {
+          break;
+        } else if ((kind == SNRUN_CURLIED) &&
+                    ((c == ASCII_LCURL) || (c == ASCII_RCURL))) {
+          break;
+        } else if (c == ASCII_LF) {
+          lines++;
+        }
+      }
+    }
+    
+    /* If max cut the run in the middle of an encoding, back up to the
+     * start of that encoding; LF is never part of a multibyte encoding,
+     * so this can't change the line feed count */
+    if (n > 0) {
+      for(i = n - 1; (pc[i] & 0xc0) == 0x80; i--);
+      if (i + snutf_count(pc[i]) > n) {
+        n = i;
+      }
+    }
+  }
+  
+  /* If the run is not empty, describe it and consume it */
+  if (n > 0) {
+    /* Find the start of the last codepoint and decode it */
+    for(i = n - 1; (pc[i] & 0xc0) == 0x80; i--);
+    pRun->last = snutf_decode(pc + i);
+    if (pRun->last < 0) {
+      abort();  /* shouldn't happen */
+    }
+    
+    /* Describe the run */
+    pRun->pData = pc;
+    pRun->len = n;
+    pRun->lines = lines;
+    
+    /* Consume the run and update the read count */
+    pIn->win_pos = pIn->win_pos + n;
+    if (pIn->read_count <= LONG_MAX - n) {
+      pIn->read_count = pIn->read_count + n;
+    } else {
+      pIn->read_count = LONG_MAX;
+    }
+  }
+}
+
+/*
+ * Move a multipass source to a byte offset.
+ * 
+ * pos is the byte offset from the start of the input, which must be
+ * zero or greater.  If successful, the read count of the source is pos
+ * afterwards, and the next byte read is the byte at that offset.  Any
+ * End Of File status or decoding error, such as SNERR_UTF8 from an
+ * earlier pass that stopped on invalid input, is cleared first, so
+ * only an I/O error keeps the source from moving.
+ * 
+ * Whole sources just move within the window, and stream sources made
+ * with SNSTREAM_RANDOM seek the file directly.  Other sources are
+ * rewound if they are already past the offset, and then read forward
+ * to it, skipping through the window of block sources a whole window
+ * at a time.
+ * 
+ * The source must support multipass and may not be an entity cache
+ * source, or a fault occurs.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source to move
+ * 
+ *   pos - the byte offset to move to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the source is in an I/O error
+ *   state, if there was an I/O error, or if the input ends before the
+ *   offset
+ */
+static int snsource_seek(SNSOURCE *pIn, long pos) {
+
+  int status = 1;
+  int eof = 0;
+  long n = 0;
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pos < 0)) {
+    abort();
+  }
+  if (((pIn->pfRewind == NULL) && (!(pIn->whole))) || pIn->cache) {
+    abort();
+  }
+  
+  /* Clear any EOF condition, remembering it for sources that have to
+   * be rewound to clear it in the callback too, and clear any decoding
+   * error left by an earlier pass in the same way that rewinding
+   * starts the source over; only I/O errors make the seek fail */
+  if (pIn->status == SNERR_EOF) {
+    pIn->status = 0;
+    eof = 1;
+  } else if (pIn->status != SNERR_IOERR) {
+    pIn->status = 0;
+  }
+  if (pIn->status != 0) {
+    status = 0;
+  }
+  
+  if (status && pIn->whole) {
+    /* Whole sources just move within the window */
+    if (pos <= pIn->win_len) {
+      pIn->win_pos = pos;
+      pIn->win_clean = 0;
+      pIn->read_count = pos;
+    } else {
+      status = 0;
+    }
+  
+  } else if (status && (pIn->pfRewind == &snsource_file_rewind)) {
+    /* Files with random access seek directly */
+    if (!fseek((FILE *) pIn->pCustom, pos, SEEK_SET)) {
+      pIn->read_count = pos;
+    } else {
+      status = 0;
+      pIn->status = SNERR_IOERR;
+    }
+  
+#ifdef SHASTINA_POSIX
+  } else if (status && (pIn->pfRewind == &snsource_fd_rewind)) {
+    /* File descriptors with random access seek directly, dropping the
+     * window */
+    if (snfd_seek((SNFDSRC *) pIn->pCustom, pos)) {
+      pIn->win_len = 0;
+      pIn->win_pos = 0;
+      pIn->win_clean = 0;
+      pIn->read_count = pos;
+    } else {
+      status = 0;
+      pIn->status = SNERR_IOERR;
+    }
+
+#endif
+  } else if (status) {
+    /* Other sources rewind if they are past the offset or were at End
+     * Of File */
+    if ((pos < pIn->read_count) || eof) {
+      status = snsource_rewind(pIn);
+    }
+    
+    /* Read forward to the offset, skipping through the window where
+     * there is one */
+    while (status && (pIn->read_count < pos)) {
+      n = pIn->win_len - pIn->win_pos;
+      if (n > 0) {
+        if (n > pos - pIn->read_count) {
+          n = pos - pIn->read_count;
+        }
+        pIn->win_pos = pIn->win_pos + n;
+        pIn->read_count = pIn->read_count + n;
+      
+      } else if (snsource_read(pIn) < 0) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Initialize a long stack.
+ * 
+ * Stacks must be initialized before they are used, or undefined 
+ * behavior occurs.  A full reset must be performed on the stack using
+ * snstack_reset() before the structure is released or a memory leak may
+ * occur.
+ * 
+ * icap is the initial allocation capacity in longs.  maxcap is the 
+ * maximum capacity for the buffer (in longs).
+ * 
+ * icap must be greater than zero, maxcap must be greater than or equal
+ * to icap, and maxcap must be no greater than (LONG_MAX / 2) or a fault
+ * will occur.
+ * 
+ * If (sizeof(size_t) < 2), this function will always fault.  Otherwise,
+ * if (sizeof(size_t) < 4), this function will fault if maxcap
+ * multiplied by sizeof(long) exceeds 65535.  Otherwise, it must be that
+ * (sizeof(size_t) >= 4) and this function will fault if maxcap times
+ * sizeof(long) exceeds 2147483647.  This is to prevent memory
+ * allocation problems.
+ * 
+ * pAlloc is the memory allocator for the buffer, which must remain
+ * allocated while the stack is in use.
+ * 
+ * Do not initialize a stack that is already initialized, or a memory
+ * leak may occur.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - pointer to the stack to initialize
+ * 
+ *   icap - the initial allocation capacity in longs
+ * 
+ *   maxcap - the maximum allocation capacity in longs
+ * 
+ *   pAlloc - the memory allocator
+ */
+static void snstack_init(
+    SNSTACK       * pStack,
+    long            icap,
+    long            maxcap,
+    const SNALLOC * pAlloc) {
+  
+  /* Check parameters */
+  if ((pStack == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  
+  if ((icap <= 0) || (maxcap < icap) || (maxcap > (LONG_MAX / 2))) {
+    abort();
+  }
+  
+  if (sizeof(size_t) < 2) {
+    abort();
+  } else if (sizeof(size_t) < 4) {
+    if (maxcap > (65535L / sizeof(long))) {
+      abort();
+    }
+  } else {
+    if (maxcap > (2147483647L / sizeof(long))) {
+      abort();
+    }
+  }
+  
+  /* Initialize structure */
+  memset(pStack, 0, sizeof(SNSTACK));
+  pStack->pBuf = NULL;
+  pStack->count = 0;
+  pStack->cap = 0;
+  pStack->initcap = icap;
+  pStack->maxcap = maxcap;
+  pStack->pAlloc = pAlloc;
+  pStack->nomem = 0;
+}
+
+/*
+ * Reset a stack back to empty.
+ * 
+ * The stack must already have been initialized with snstack_init() or
+ * undefined behavior occurs.
+ * 
+ * full is non-zero to perform a full reset, zero to perform a fast
+ * reset.  A fast reset just clears the buffer to empty without
+ * releasing the allocated memory buffer, allowing it to be reused.  A
+ * full reset also releases the allocated memory buffer, clearing the
+ * structure all the way back to its initial state, including the out
+ * of memory flag.
+ * 
+ * A full reset must be performed on all stacks before they are 
+ * released, or a memory leak may occur.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack to reset
+ * 
+ *   full - non-zero for a full reset, zero for a partial reset
+ */
+static void snstack_reset(SNSTACK *pStack, int full) {
+  
+  /* Check parameters */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Set the count back to zero */
+  pStack->count = 0;
+  
+  /* If a buffer is allocated, clear it all to zero */
+  if (pStack->cap > 0) {
+    memset(pStack->pBuf, 0, (size_t) (pStack->cap * sizeof(long)));
+  }
+  
+  /* If we're doing a full reset, release the buffer if allocated and
+   * reset capacity back to zero */
+  if (full && (pStack->cap > 0)) {
+    if (pStack->pBuf != pStack->inl) {
+      snalloc_release(pStack->pAlloc, pStack->pBuf,
+                      pStack->cap * ((long) sizeof(long)));
+    }
+    pStack->pBuf = NULL;
+    pStack->cap = 0;
+  }
+  if (full) {
+    pStack->nomem = 0;
+  }
+}
+
+/*
+ * Push a long on top of a stack.
+ * 
+ * The long value v may have any value.
+ * 
+ * The function fails if there is no more capacity left for another
+ * long, or if the buffer can not be allocated or grown, in which case
+ * the out of memory flag of the stack is set.  The buffer is
+ * unmodified in these cases.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack to push a long onto
+ * 
+ *   v - the long value to push
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if no more capacity
+ */
+static int snstack_push(SNSTACK *pStack, long v) {
+  
+  int status = 1;
+  long newcap = 0;
+  long *pNew = NULL;
+  
+  /* Check parameters */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Proceed only if we are not completely maxed out of capacity */
+  if (pStack->count < pStack->maxcap) {
+    /* We have capacity left; first, start out in the inline storage if
+     * we haven't got a buffer yet */
+    if (pStack->cap < 1) {
+      memset(pStack->inl, 0, sizeof(pStack->inl));
+      pStack->pBuf = pStack->inl;
+      pStack->cap = SNSTACK_INLINE;
+      if (pStack->cap > pStack->maxcap) {
+        pStack->cap = pStack->maxcap;
+      }
+    }
+    
+    /* Next, increase allocated memory buffer if we need more space */
+    if (pStack->count >= pStack->cap) {
+      /* New capacity should usually be double current capacity, but at
+       * least the initial capacity */
+      newcap = pStack->cap * 2;
+      if (newcap < pStack->initcap) {
+        newcap = pStack->initcap;
+      }
+      
+      /* If new capacity exceeds max capacity, set to max capacity */
+      if (newcap > pStack->maxcap) {
+        newcap = pStack->maxcap;
+      }
+      
+      /* Allocate new buffer, moving out of the inline storage if the
+       * stack is still in there */
+      if (pStack->pBuf == pStack->inl) {
+        pNew = (long *) snalloc_get(pStack->pAlloc,
+                          newcap * ((long) sizeof(long)));
+        if (pNew != NULL) {
+          memcpy(pNew, pStack->inl,
+                  (size_t) (pStack->cap * sizeof(long)));
+        }
+      } else {
+        pNew = (long *) snalloc_resize(pStack->pAlloc, pStack->pBuf,
+                          pStack->cap * ((long) sizeof(long)),
+                          newcap * ((long) sizeof(long)));
+      }
+      if (pNew != NULL) {
+        pStack->pBuf = pNew;
+        
+        /* Initialize new space to zero */
+        memset((void *) (pStack->pBuf + pStack->cap),
+                0,
+                (size_t) ((newcap - pStack->cap) * sizeof(long)));
+        
+        /* Update capacity */
+        pStack->cap = newcap;
+      
+      } else {
+        /* Out of memory */
+        pStack->nomem = 1;
+        status = 0;
+      }
+    }
+    
+    /* Append the new long */
+    if (status) {
+      (pStack->pBuf)[pStack->count] = v;
+      (pStack->count)++;
+#ifdef SHASTINA_STATS
+      if (pStack->count > pStack->peak) {
+        pStack->peak = pStack->count;
+      }
+#endif
+    }
+  
+  } else {
+    /* Out of capacity */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Pop a long value off the top of a stack.
+ * 
+ * pStack is the stack object to a pop a value off of.  It must be
+ * properly initialized.  It must not be empty, or a fault will occur.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack
+ * 
+ * Return:
+ * 
+ *   the popped long value
+ */
+static long snstack_pop(SNSTACK *pStack) {
+  
+  long v = 0;
+  
+  /* Check parameter */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Check state */
+  if (pStack->count < 1) {
+    abort();
+  }
+  
+  /* Get the top of the stack */
+  v = pStack->pBuf[pStack->count - 1];
+  
+  /* Take the top element off the stack */
+  (pStack->count)--;
+  
+  /* Return the removed value */
+  return v;
+}
+
+/*
+ * Peek at the long value on top of a stack without removing it.
+ * 
+ * pStack is the stack object to peek at.  It must be properly
+ * initialized.  It must not be empty, or a fault will occur.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack
+ * 
+ * Return:
+ * 
+ *   the peeked long value
+ */
+static long snstack_peek(SNSTACK *pStack) {
+  
+  /* Check parameter */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Check state */
+  if (pStack->count < 1) {
+    abort();
+  }
+  
+  /* Return the top of the stack */
+  return pStack->pBuf[pStack->count - 1];
+}
+
+/*
+ * Increment the long value on top of a stack.
+ * 
+ * pStack is the stack object.  It must be properly initialized.  It
+ * must not be empty, or a fault will occur.
+ * 
+ * The function fails if the top of the stack has value LONG_MAX.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if long value already at maximum
+ */
+static int snstack_inc(SNSTACK *pStack) {
+  
+  int status = 1;
+  
+  /* Check parameter */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Check state */
+  if (pStack->count < 1) {
+    abort();
+  }
+  
+  /* Increment if possible */
+  if (pStack->pBuf[pStack->count - 1] < LONG_MAX) {
+    (pStack->pBuf[pStack->count - 1])++;
+  } else {
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Decrement the long value on top of a stack.
+ * 
+ * pStack is the stack object.  It must be properly initialized.  It
+ * must not be empty, or a fault will occur.
+ * 
+ * The function fails if the top of the stack has already has value less
+ * than one.
+ * 
+ * Note that this function will not decrement into negative range.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if long value already less than one
+ */
+static int snstack_dec(SNSTACK *pStack) {
+  
+  int status = 1;
+  
+  /* Check parameter */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Check state */
+  if (pStack->count < 1) {
+    abort();
+  }
+  
+  /* Decrement if possible */
+  if (pStack->pBuf[pStack->count - 1] > 0) {
+    (pStack->pBuf[pStack->count - 1])--;
+  } else {
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Get the number of elements on a given stack.
+ * 
+ * Parameters:
+ * 
+ *   pStack - the stack to query
+ * 
+ * Return:
+ * 
+ *   the number of elements on the stack
+ */
+static long snstack_count(SNSTACK *pStack) {
+  
+  /* Check parameter */
+  if (pStack == NULL) {
+    abort();
+  }
+  
+  /* Return count */
+  return (pStack->count);
+}
+
+/*
+ * Initialize a string buffer.
+ * 
+ * String buffers must be initialized before they are used, or undefined
+ * behavior occurs.  A full reset must be performed on the string buffer
+ * using snbuffer_reset() before the structure is released or a memory
+ * leak may occur.
+ * 
+ * icap is the initial allocation capacity in bytes.  maxcap is the
+ * maximum capacity in bytes for the buffer.  Note that the capacity
+ * counts bytes, not Unicode codepoints.
+ * 
+ * icap must be greater than zero, maxcap must be greater than or equal
+ * to icap, and maxcap must be no greater than (LONG_MAX / 2) or a fault
+ * will occur.
+ * 
+ * If (sizeof(size_t) < 2), this function will always fault.  Otherwise,
+ * if (sizeof(size_t) < 4), this function will fault if maxcap exceeds
+ * 65535.  Otherwise, (sizeof(size_t) >= 4) and this function will fault
+ * if maxcap exceeds 2147483647.  This is to prevent memory allocation
+ * problems.
+ * 
+ * pAlloc is the memory allocator for the buffer, which must remain
+ * allocated while the string buffer is in use.
+ * 
+ * Do not initialize a string buffer that is already initialized, or a
+ * memory leak may occur.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - pointer to the buffer to initialize
+ * 
+ *   icap - the initial allocation capacity
+ * 
+ *   maxcap - the maximum allocation capacity
+ * 
+ *   pAlloc - the memory allocator
+ */
+static void snbuffer_init(
+    SNBUFFER      * pBuffer,
+    long            icap,
+    long            maxcap,
+    const SNALLOC * pAlloc) {
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  
+  if ((icap <= 0) || (maxcap < icap) || (maxcap > (LONG_MAX / 2))) {
+    abort();
+  }
+  
+  if (sizeof(size_t) < 2) {
+    abort();
+  } else if (sizeof(size_t) < 4) {
+    if (maxcap > 65535L) {
+      abort();
+    }
+  } else {
+    if (maxcap > 2147483647L) {
+      abort();
+    }
+  }
+  
+  /* Initialize structure */
+  memset(pBuffer, 0, sizeof(SNBUFFER));
+  pBuffer->pBuf = NULL;
+  pBuffer->pView = NULL;
+  pBuffer->count = 0;
+  pBuffer->cap = 0;
+  pBuffer->initcap = icap;
+  pBuffer->maxcap = maxcap;
+  pBuffer->pAlloc = pAlloc;
+  pBuffer->nomem = 0;
+  pBuffer->discard = 0;
+}
+
+/*
+ * Reset a string buffer back to empty.
+ * 
+ * The string buffer must already have been initialized with
+ * snbuffer_init() or undefined behavior occurs.
+ * 
+ * full is non-zero to perform a full reset, zero to perform a fast
+ * reset.  A fast reset just clears the buffer to empty without
+ * releasing the allocated memory buffer, allowing it to be reused.  A
+ * full reset also releases the allocated memory buffer, clearing the
+ * structure all the way back to its initial state, including the out
+ * of memory flag.
+ * 
+ * A full reset must be performed on all string buffers before they are
+ * released, or a memory leak may occur.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to reset
+ * 
+ *   full - non-zero for a full reset, zero for a partial reset
+ */
+static void snbuffer_reset(SNBUFFER *pBuffer, int full) {
+  
+  /* Check parameters */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  
+  /* If the buffer is a view, just drop the view, since nothing is
+   * stored in the allocated buffer; otherwise, if data is stored in the
+   * buffer, clear it to zero -- everything beyond the data is always
+   * zero already, and nothing is stored while discarding */
+  if (pBuffer->pView != NULL) {
+    pBuffer->pView = NULL;
+  
+  } else if ((!(pBuffer->discard)) &&
+              (pBuffer->cap > 0) && (pBuffer->count > 0)) {
+    memset(pBuffer->pBuf, 0, (size_t) pBuffer->count);
+  }
+  
+  /* Set the count back to zero */
+  pBuffer->count = 0;
+  
+  /* If we're doing a full reset, release the buffer if allocated and
+   * reset capacity back to zero */
+  if (full && (pBuffer->cap > 0)) {
+    snalloc_release(pBuffer->pAlloc, pBuffer->pBuf, pBuffer->cap);
+    pBuffer->pBuf = NULL;
+    pBuffer->cap = 0;
+  }
+  if (full) {
+    pBuffer->nomem = 0;
+    pBuffer->discard = 0;
+  }
+}
+
+/*
+ * Reset a string buffer back to empty and set whether it discards the
+ * data appended to it.
+ * 
+ * The buffer is given a fast reset with snbuffer_reset() before the
+ * discard flag is changed.  See the discard field of SNBUFFER for what
+ * discarding means.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer
+ * 
+ *   discard - non-zero to discard appended data, zero to store it
+ */
+static void snbuffer_discard(SNBUFFER *pBuffer, int discard) {
+
+  /* Check parameters */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  
+  /* Empty the buffer and then set the flag */
+  snbuffer_reset(pBuffer, 0);
+  if (discard) {
+    pBuffer->discard = 1;
+  } else {
+    pBuffer->discard = 0;
+  }
+}
+
+/*
+ * Make sure a string buffer has room for more bytes.
+ * 
+ * n is the number of additional bytes that are needed beyond the
+ * current count, which must be greater than zero.  The terminating nul
+ * is not included in n, since the buffer always keeps room for it.
+ * 
+ * The function fails if the maximum capacity of the buffer does not
+ * allow for that many more bytes, or if the buffer can not be allocated
+ * or grown, in which case the out of memory flag of the buffer is set.
+ * Otherwise, the buffer is allocated or grown as needed.  If the
+ * buffer is a view, the viewed data is copied into the allocated buffer
+ * and the buffer stops being a view.  If the buffer discards its data,
+ * only the maximum capacity is checked.  The buffer contents are
+ * unmodified in any case.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer
+ * 
+ *   n - the number of additional bytes needed
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not enough capacity
+ */
+static int snbuffer_reserve(SNBUFFER *pBuffer, long n) {
+  
+  int status = 1;
+  long newcap = 0;
+  char *pNew = NULL;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (n < 1)) {
+    abort();
+  }
+  
+  /* Proceed only if the maximum capacity allows for the bytes, and
+   * only allocate if the data is actually stored */
+  if ((n < (pBuffer->maxcap - pBuffer->count)) && pBuffer->discard) {
+    status = 1;
+  
+  } else if (n < (pBuffer->maxcap - pBuffer->count)) {
+    /* We have capacity left; first, make the initial allocation if we
+     * haven't allocated a memory buffer yet */
+    if (pBuffer->cap < 1) {
+      pNew = (char *) snalloc_get(pBuffer->pAlloc, pBuffer->initcap);
+      if (pNew != NULL) {
+        pBuffer->pBuf = pNew;
+        memset(pBuffer->pBuf, 0, (size_t) pBuffer->initcap);
+        pBuffer->cap = pBuffer->initcap;
+#ifdef SHASTINA_STATS
+        if (pBuffer->cap > pBuffer->peak) {
+          pBuffer->peak = pBuffer->cap;
+        }
+#endif
+      } else {
+        /* Out of memory */
+        pBuffer->nomem = 1;
+        status = 0;
+      }
+    }
+    
+    /* Next, increase allocated memory buffer if we need more space */
+    if (status && (n >= (pBuffer->cap - pBuffer->count))) {
+      /* New capacity should usually be double current capacity, or
+       * more if that is still not enough */
+      for(newcap = pBuffer->cap * 2;
+          (newcap < pBuffer->maxcap) &&
+            (n >= (newcap - pBuffer->count));
+          newcap = newcap * 2);
+      
+      /* If new capacity exceeds max capacity, set to max capacity */
+      if (newcap > pBuffer->maxcap) {
+        newcap = pBuffer->maxcap;
+      }
+      
+      /* Allocate new buffer */
+      pNew = (char *) snalloc_resize(pBuffer->pAlloc, pBuffer->pBuf,
+                        pBuffer->cap, newcap);
+      if (pNew != NULL) {
+        pBuffer->pBuf = pNew;
+        
+        /* Initialize new space to zero */
+        memset((pBuffer->pBuf + pBuffer->cap),
+                0,
+                (size_t) (newcap - pBuffer->cap));
+        
+        /* Update capacity */
+        pBuffer->cap = newcap;
+#ifdef SHASTINA_STATS
+        if (pBuffer->grows < LONG_MAX) {
+          (pBuffer->grows)++;
+        }
+        if (pBuffer->cap > pBuffer->peak) {
+          pBuffer->peak = pBuffer->cap;
+        }
+#endif
+      
+      } else {
+        /* Out of memory */
+        pBuffer->nomem = 1;
+        status = 0;
+      }
+    }
+    
+    /* If the buffer is a view, copy the viewed data into the buffer */
+    if (status && (pBuffer->pView != NULL)) {
+      memcpy(pBuffer->pBuf, pBuffer->pView, (size_t) pBuffer->count);
+      pBuffer->pView = NULL;
+    }
+  
+  } else {
+    /* Out of capacity */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append a byte value to a string buffer.
+ * 
+ * The character c may be any unsigned byte value except for zero.  That
+ * is, the range is 1-255.
+ * 
+ * The function fails if there is no more capacity left for another 
+ * byte.  The buffer is unmodified in this case.
+ * 
+ * This is a low-level function.  Clients should use append() instead to
+ * work with Unicode codepoints.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to add a byte to
+ * 
+ *   c - the unsigned byte value to add
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if no more capacity
+ */
+static int snbuffer_appendByte(SNBUFFER *pBuffer, int c) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (c < 1) || (c > 255)) {
+    abort();
+  }
+  
+  /* Proceed only if there is room for another byte */
+  if (snbuffer_reserve(pBuffer, 1)) {
+    /* Add the new character unless discarding */
+    if (!(pBuffer->discard)) {
+      ((unsigned char *) pBuffer->pBuf)[pBuffer->count] =
+        (unsigned char) c;
+    }
+    (pBuffer->count)++;
+  
+  } else {
+    /* Out of capacity */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append a run of bytes to a string buffer.
+ * 
+ * pData points to the bytes to append and len is the number of bytes,
+ * which must be greater than zero.  None of the bytes may be zero, and
+ * the run should be complete, valid UTF-8 so that the buffer stays
+ * valid UTF-8.  The bytes are copied in one go.
+ * 
+ * The function fails if there is not enough capacity left for all of
+ * the bytes.  The buffer is unmodified in this case.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to add the bytes to
+ * 
+ *   pData - the bytes to add
+ * 
+ *   len - the number of bytes to add
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not enough capacity
+ */
+static int snbuffer_appendRun(
+    SNBUFFER            * pBuffer,
+    const unsigned char * pData,
+    long                  len) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pData == NULL) || (len < 1)) {
+    abort();
+  }
+  
+  /* Proceed only if there is room for the bytes */
+  if (snbuffer_reserve(pBuffer, len)) {
+    /* Copy the bytes unless discarding, which are followed by zero
+     * bytes that the buffer already holds */
+    if (!(pBuffer->discard)) {
+      memcpy(pBuffer->pBuf + pBuffer->count, pData, (size_t) len);
+    }
+    pBuffer->count = pBuffer->count + len;
+  
+  } else {
+    /* Out of capacity */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append bytes to a string buffer by viewing them in the input.
+ * 
+ * pData points to the bytes to append within the input data of a whole
+ * source, and len is the number of bytes, which must be greater than
+ * zero.  The requirements on the bytes are the same as for
+ * snbuffer_appendRun().
+ * 
+ * If the buffer is empty, it becomes a view of the bytes.  If the
+ * buffer is already a view that ends right where the new bytes begin,
+ * the view is extended over the new bytes.  In both of these cases,
+ * nothing is copied.  Otherwise, the bytes are copied into the buffer
+ * with snbuffer_appendRun(), which also copies the viewed data into the
+ * buffer if the buffer is a view.
+ * 
+ * The function fails if there is not enough capacity left for all of
+ * the bytes, exactly as if they were being copied, or if the bytes had
+ * to be copied and the buffer could not be grown.  The buffer is
+ * unmodified in this case.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to add the bytes to
+ * 
+ *   pData - the bytes to add, in the input data of a whole source
+ * 
+ *   len - the number of bytes to add
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not enough capacity
+ */
+static int snbuffer_appendView(
+    SNBUFFER   * pBuffer,
+    const char * pData,
+    long         len) {
+  
+  int status = 1;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pData == NULL) || (len < 1)) {
+    abort();
+  }
+  
+  /* Check capacity as if copying */
+  if (len >= (pBuffer->maxcap - pBuffer->count)) {
+    status = 0;
+  }
+  
+  /* Count the bytes if discarding, or else start a view, extend the
+   * view, or copy the bytes */
+  if (status) {
+    if (pBuffer->discard) {
+      /* Discarding, so only count the bytes */
+      pBuffer->count = pBuffer->count + len;
+    
+    } else if (pBuffer->count < 1) {
+      /* Empty buffer, so start a view */
+      pBuffer->pView = pData;
+      pBuffer->count = len;
+    
+    } else if ((pBuffer->pView != NULL) &&
+                (pBuffer->pView + pBuffer->count == pData)) {
+      /* Bytes directly follow the view, so extend the view */
+      pBuffer->count = pBuffer->count + len;
+    
+    } else {
+      /* Copy the bytes, which can still fail if out of memory */
+      status = snbuffer_appendRun(pBuffer,
+                  (const unsigned char *) pData, len);
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append a Unicode codepoint that was read from the input to a string
+ * buffer, by viewing it in the input where possible.
+ * 
+ * cpv is the codepoint to append, which has the same requirements as
+ * for snbuffer_append().
+ * 
+ * If pFrom is NULL, then pTo is ignored and the codepoint is simply
+ * appended with snbuffer_append().
+ * 
+ * Otherwise, pFrom and pTo are the positions in the input data of a
+ * whole source before and after the codepoint was read through the
+ * input filter.  If the input bytes in that range are a single UTF-8
+ * encoding, then they are exactly the encoding of the codepoint, and
+ * they are appended with snbuffer_appendView().  Otherwise, the input
+ * filter must have changed the input -- for example, by converting
+ * CR+LF to LF or by combining a surrogate pair -- so the codepoint is
+ * copied with snbuffer_append().
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to add a codepoint to
+ * 
+ *   cpv - the Unicode codepoint to add
+ * 
+ *   pFrom - the input position before the codepoint, or NULL
+ * 
+ *   pTo - the input position after the codepoint
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not enough capacity
+ */
+static int snbuffer_appendFrom(
+    SNBUFFER   * pBuffer,
+    long         cpv,
+    const char * pFrom,
+    const char * pTo) {
+  
+  int status = 0;
+  
+  /* Check parameters */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  if ((pFrom != NULL) && ((pTo == NULL) || (pTo <= pFrom))) {
+    abort();
+  }
+  
+  /* View the input bytes if they are a single encoding, else copy */
+  if ((pFrom != NULL) && ((long) (pTo - pFrom) ==
+        snutf_count(*((const unsigned char *) pFrom)))) {
+    status = snbuffer_appendView(pBuffer, pFrom, (long) (pTo - pFrom));
+  } else {
+    status = snbuffer_append(pBuffer, cpv);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append a Unicode codepoint to a string buffer.
+ * 
+ * cpv is the Unicode codepoint to append.  It must be greater than zero
+ * and no greater than UNICODE_MAX_CPV.  Furthermore, it may not be in
+ * surrogate range [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE].
+ * 
+ * The codepoint will be encoded into UTF-8 and the bytes of the UTF-8
+ * encoding will be added to the string buffer.
+ * 
+ * The function fails if there is not enough capacity left for the full
+ * UTF-8 encoding of the codepoint.  The buffer is unmodified in this
+ * case.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to add a codepoint to
+ * 
+ *   cpv - the Unicode codepoint to add
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not enough capacity
+ */
+static int snbuffer_append(SNBUFFER *pBuffer, long cpv) {
+  
+  int status = 1;
+  unsigned char buf[5];
+  unsigned char *pc = NULL;
+  int elen = 0;
+  
+  /* Initialize buffer to all nul */
+  memset(buf, 0, 5);
+  
+  /* Check parameters */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  if ((cpv < 1) || (cpv > UNICODE_MAX_CPV) ||
+      ((cpv >= UNICODE_MIN_SURROGATE) &&
+        (cpv <= UNICODE_MAX_SURROGATE))) {
+    abort();
+  }
+  
+  /* US-ASCII codepoints encode to themselves, so just append those
+   * directly as a byte; otherwise, encode the codepoint and get the
+   * encoded length */
+  if (cpv < 0x80) {
+    status = snbuffer_appendByte(pBuffer, (int) cpv);
+    elen = 0;
+  
+  } else {
+    snutf_encode(cpv, buf);
+    elen = (int) strlen(buf);
+  }
+  
+  /* Make sure we have enough capacity for the all the bytes */
+  if (elen > 0) {
+    status = snbuffer_reserve(pBuffer, (long) elen);
+  }
+  
+  /* Add each of the bytes */
+  if (status && (elen > 0)) {
+    for(pc = buf; *pc != 0; pc++) {
+      if (!snbuffer_appendByte(pBuffer, *pc)) {
+        /* Shouldn't happen because we already checked that we have
+         * enough capacity remaining */
+        abort();
+      }
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Get a pointer to the current string stored in the buffer.
+ * 
+ * The string will be null-terminated, except if the buffer is a view,
+ * in which case the count field of the buffer must be used to find the
+ * end of the string.  The returned pointer remains valid until another
+ * character is appended to the buffer or the buffer is reset.
+ * 
+ * Clients should not modify the data pointed to, or undefined behavior
+ * occurs.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the string buffer to query
+ * 
+ * Return:
+ * 
+ *   the current buffered string
+ */
+static char *snbuffer_get(SNBUFFER *pBuffer) {
+  
+  char *pResult = NULL;
+  
+  /* Check parameter */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  
+  /* If we haven't made the initial allocation yet, try to do it */
+  if (pBuffer->cap < 1) {
+    pBuffer->pBuf = (char *) snalloc_get(pBuffer->pAlloc,
+                                          pBuffer->initcap);
+    if (pBuffer->pBuf != NULL) {
+      memset(pBuffer->pBuf, 0, (size_t) pBuffer->initcap);
+      pBuffer->cap = pBuffer->initcap;
+#ifdef SHASTINA_STATS
+      if (pBuffer->cap > pBuffer->peak) {
+        pBuffer->peak = pBuffer->cap;
+      }
+#endif
+    }
+  }
+  
+  /* Get the pointer to the view or to the buffer, or to a static empty
+   * string if the buffer is empty and couldn't be allocated */
+  if (pBuffer->pView != NULL) {
+    pResult = (char *) pBuffer->pView;
+  } else if (pBuffer->cap > 0) {
+    pResult = pBuffer->pBuf;
+  } else {
+    pResult = (char *) "";
+  }
+  
+  /* Return the pointer */
+  return pResult;
+}
+
+/*
+ * Get the last Unicode codepoint in a buffer.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the buffer to query
+ * 
+ * Return:
+ * 
+ *   the last Unicode codepoint, or zero if the buffer is empty
+ */
+static long snbuffer_last(SNBUFFER *pBuffer) {
+  
+  long c = 0;
+  unsigned char *pc = NULL;
+  int sw = 0;
+  
+  /* Check parameter */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  
+  /* Get last codepoint if buffer not empty */
+  if (pBuffer->count > 0) {
+    
+    /* Find the last byte in the buffer that is not a continuation
+     * byte */
+    sw = 1;
+    for(pc = &(((unsigned char *) snbuffer_get(pBuffer))
+                [pBuffer->count - 1]);
+        snutf_count(*pc) == 0;
+        pc--) {
+      sw++;
+    }
+    
+    /* Get how many encoded bytes and make sure valid and matches how
+     * many bytes we moved back in the search */
+    if (snutf_count(*pc) != sw) {
+      /* Shouldn't happen because everything in buffer should be
+       * valid */
+      abort();
+    }
+    
+    /* Decode the last codepoint */
+    c = snutf_decode(pc);
+    if (c < 0) {
+      /* Shouldn't happen because everything in buffer should be
+       * valid */
+      abort();
+    }
+  }
+  
+  /* Return character or zero */
+  return c;
+}
+
+/*
+ * Remove the last codepoint from the given buffer.
+ * 
+ * The function fails if the buffer is empty.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the buffer to remove a codepoint from
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if buffer already empty
+ */
+static int snbuffer_less(SNBUFFER *pBuffer) {
+  
+  int status = 1;
+  unsigned char *pc = NULL;
+  const unsigned char *pvc = NULL;
+  
+  /* Check parameter */
+  if (pBuffer == NULL) {
+    abort();
+  }
+  
+  /* Only proceed if not empty, and if the buffer is a view, just
+   * shorten the view */
+  if ((pBuffer->count > 0) && (pBuffer->pView != NULL)) {
+    /* Shorten the view by any continuation bytes at the end, and then
+     * by the last byte of the codepoint */
+    for(pvc = &(((const unsigned char *) pBuffer->pView)
+                [pBuffer->count - 1]);
+        snutf_count(*pvc) == 0;
+        pvc--) {
+      (pBuffer->count)--;
+    }
+    (pBuffer->count)--;
+    
+    /* If the view is now empty, the buffer is no longer a view */
+    if (pBuffer->count < 1) {
+      pBuffer->pView = NULL;
+    }
+  
+  } else if (pBuffer->count > 0) {
+    /* Remove any continuation bytes from the end of the buffer */
+    for(pc = &(((unsigned char *) pBuffer->pBuf)[pBuffer->count - 1]);
+        snutf_count(*pc) == 0;
+        pc--) {
+      *pc = (unsigned char) 0;
+      (pBuffer->count)--;
+    }
+    
+    /* Remove the last codepoint from the buffer */
+    *pc = (unsigned char) 0;
+    (pBuffer->count)--;
+  
+  } else {
+    /* Buffer was empty */
+    status = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Reset an input filter back to its original state.
+ * 
+ * This should also be used for initializing filter structures.
+ * 
+ * Parameters:
+ * 
+ *   pFilter - the filter to reset
+ */
+static void snfilter_reset(SNFILTER *pFilter) {
+  
+  /* Check parameter */
+  if (pFilter == NULL) {
+    abort();
+  }
+  
+  /* Clear structure */
+  memset(pFilter, 0, sizeof(SNFILTER));
+  
+  /* Set initial state */
+  pFilter->line_count = 0;
+  pFilter->c = 0;
+  pFilter->pushback = 0;
+}
+
+/*
+ * Read the next codepoint through the input filter.
+ * 
+ * The next codepoint value is in Unicode codepoint range, which is
+ * [0, UNICODE_MAX_CPV], excluding the surrogate characters, in range
+ * [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE].
+ * 
+ * CR+LF to LF conversion, UTF-8 Byte Order Mark (BOM) filtering, and
+ * correction of encoded surrogate pairs to supplemental codepoints are
+ * performed by this function.
+ * 
+ * Input that is clean (see the win_clean field of SNSOURCE) is read
+ * straight out of the window of the source when possible, since it
+ * doesn't need any filtering.  Only the very first codepoint, and
+ * codepoints that are not clean, go through the full filtering path.
+ * 
+ * SNERR_ codes are returned if there is an error.  These codes are
+ * always less than zero, so they are easy to distinguish from Unicode
+ * codepoints, which are always zero or greater.
+ * 
+ * The provided input filter state must be properly initialized.
+ * 
+ * Parameters:
+ * 
+ *   pFilter - the input filter state
+ * 
+ *   pIn - the source to read from
+ * 
+ * Return:
+ * 
+ *   the next codepoint value, or an SNERR_ value that is less than zero
+ */
+static long snfilter_read(SNFILTER *pFilter, SNSOURCE *pIn) {
+  
+  int err_num = 0;
+  int fast = 0;
+  long c = 0;
+  long c2 = 0;
+  
+  /* Check parameters */
+  if ((pFilter == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  
+  /* If we're not in pushback mode, we're past the first codepoint, and
+   * we don't have a special condition, try the fast path of reading a
+   * clean codepoint directly from the window of the source, which
+   * doesn't need any of the filtering below */
+  if ((!(pFilter->pushback)) && (pFilter->line_count > 0) &&
+        (pFilter->c >= 0)) {
+    c = snsource_readClean(pIn);
+    if (c >= 0) {
+      fast = 1;
+      if ((pFilter->c == ASCII_LF) &&
+            (pFilter->line_count < LONG_MAX)) {
+        (pFilter->line_count)++;
+      }
+      pFilter->c = c;
+#ifdef SHASTINA_STATS
+      if (pFilter->cp_count < LONG_MAX) {
+        (pFilter->cp_count)++;
+      }
+#endif
+    }
+  }
+  
+  /* If we're not in pushback mode, we didn't take the fast path, and we
+   * don't have a special condition, we need to read another codepoint
+   * the regular way; an error at the very first codepoint is a special
+   * condition too, so that it is never skipped */
+  if ((!(pFilter->pushback)) && (!fast) && (pFilter->c >= 0)) {
+    
+    /* Read a codepoint */
+    c = snsource_readCPV(pIn);
+    if (c < 0) {
+      err_num = (int) c;
+    }
+    
+    /* If this is the first codepoint read, and it is the U+FEFF Byte
+     * Order Mark (BOM), then skip it by reading again */
+    if ((!err_num) && (pFilter->line_count == 0) && (c == 0xfeffL)) {
+      c = snsource_readCPV(pIn);
+      if (c < 0) {
+        err_num = (int) c;
+      }
+    }
+    
+    /* If we read a CR, read the LF it must be paired with */
+    if ((!err_num) && (c == ASCII_CR)) {
+      
+      /* We read a CR, so read next character and make sure it is LF */
+      c = snsource_readCPV(pIn);
+      if (c < 0) {
+        err_num = (int) c;
+      } else if (c != ASCII_LF) {
+        err_num = SNERR_BADCR;
+      }
+    }
+    
+    /* If we read a low surrogate, error because it means surrogate is
+     * not paired properly */
+    if ((!err_num) && (c >= UNICODE_MIN_LO_SUR) && 
+          (c <= UNICODE_MAX_LO_SUR)) {
+      err_num = SNERR_UNPAIRED;
+    }
+    
+    /* If we read a high surrogate, read next codepoint which must be a
+     * low surrogate and then replace the character read with the
+     * supplemental codepoint selected by the surrogate pair */
+    if ((!err_num) && (c >= UNICODE_MIN_HI_SUR) &&
+          (c <= UNICODE_MAX_HI_SUR)) {
+      
+      /* Read the low surrogate */
+      c2 = snsource_readCPV(pIn);
+      if (c2 < 0) {
+        err_num = (int) c2;
+      } else if ((c2 < UNICODE_MIN_LO_SUR) ||
+                  (c2 > UNICODE_MAX_LO_SUR)) {
+        err_num = SNERR_UNPAIRED;
+      }
+      
+      /* Replace codepoint read with the supplemental codepoint */
+      if (!err_num) {
+        c = snutf_pair(c, c2);
+      }
+    }
+    
+    /* Update state of filter structure */
+    if (!err_num) {
+      if (pFilter->line_count == 0) {
+        /* Very first character -- set line count to one */
+        pFilter->c = c;
+        pFilter->line_count = 1;
+      
+      } else {
+        /* Not the very first character -- increase line count by one if
+         * the previous character was LF and the line count is not at
+         * the overflow value of LONG_MAX */
+        if ((pFilter->c == ASCII_LF) &&
+              (pFilter->line_count < LONG_MAX)) {
+          (pFilter->line_count)++;
+        }
+        pFilter->c = c;
+      }
+#ifdef SHASTINA_STATS
+      if (pFilter->cp_count < LONG_MAX) {
+        (pFilter->cp_count)++;
+      }
+#endif
+    }
+  }
+  
+  /* Clear the pushback flag if it is set -- even if there has been an
+   * error or EOF condition */
+  pFilter->pushback = 0;
+  
+  /* If we've encountered an error (or EOF), write it into the
+   * structure */
+  if (err_num) {
+    pFilter->c = err_num;
+  }
+  
+  /* Return the character or special condition */
+  return (pFilter->c);
+}
+
+/*
+ * Return the current line count.
+ * 
+ * The line count is always at least one and at most LONG_MAX.  The
+ * value of LONG_MAX is an overflow value, so any count of lines above
+ * that will just remain at LONG_MAX.
+ * 
+ * The line count is affected by pushback mode, changing backwards if
+ * characters are pushed back before a line break.
+ * 
+ * Parameters:
+ * 
+ *   pFilter - the input filter state
+ * 
+ * Return:
+ * 
+ *   the current line count
+ */
+static long snfilter_count(SNFILTER *pFilter) {
+  
+  long lc = 0;
+  
+  /* Check parameter */
+  if (pFilter == NULL) {
+    abort();
+  }
+  
+  /* Read current line count */
+  lc = pFilter->line_count;
+  
+  /* If line count is zero, change it to one to indicate the line count
+   * at the start of the file */
+  if (lc < 1) {
+    lc = 1;
+  }
+  
+  /* If we're not in pushback mode, c is LF, we're not at the very
+   * beginning of the file, and line_count is less than LONG_MAX,
+   * increase the line count by one */
+  if ((!(pFilter->pushback)) && (pFilter->line_count > 0) &&
+        (pFilter->c == ASCII_LF) && (lc < LONG_MAX)) {
+    lc++;
+  }
+  
+  /* Return the adjusted line count */
+  return lc;
+}
+
+/*
+ * Set the pushback flag, so the character that was just read will be
+ * read again.
+ * 
+ * This call is ignored if the filter state is currently in an EOF or
+ * error condition.
+ * 
+ * The call fails if the filter state is already in pushback mode or if
+ * no characters have been read yet.
+ * 
+ * Parameters:
+ * 
+ *   pFilter - the filter state
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if pushback mode could not be set
+ */
+static int snfilter_pushback(SNFILTER *pFilter) {
+  
+  int status = 1;
+  
+  /* Check parameter */
+  if (pFilter == NULL) {
+    abort();
+  }
+  
+  /* Only proceed if not in special state */
+  if (pFilter->c >= 0) {
+    
+    /* We can only set the pushback flag if it is not already set and at
+     * least one character has been read */
+    if ((pFilter->line_count > 0) && (!(pFilter->pushback))) {
+      pFilter->pushback = 1;
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Skip directly over a run of input.
+ * 
+ * This is a fast path for reading such a run one codepoint at a time
+ * with snfilter_read().  It has exactly the same effect as reading
+ * every codepoint in the run, including the effect on the line count,
+ * except that the run is skipped in bulk with snsource_skip().  See
+ * that function for the definition of the run selected by kind, the
+ * meaning of max, and the description written to pRun.
+ * 
+ * The run may be shorter than the full span of input of that kind, so
+ * the caller must keep reading with snfilter_read() afterwards to find
+ * where the span actually ends.
+ * 
+ * This call skips nothing and describes an empty run if the filter
+ * state is in pushback mode, in an EOF or error condition, or if no
+ * characters have been read yet.
+ * 
+ * Parameters:
+ * 
+ *   pFilter - the input filter state
+ * 
+ *   pIn - the source to read from
+ * 
+ *   kind - the SNRUN_ constant selecting what kind of run to skip
+ * 
+ *   max - the maximum number of bytes to skip
+ * 
+ *   pRun - receives a description of the run
+ */
+static void snfilter_skip(
+    SNFILTER * pFilter,
+    SNSOURCE * pIn,
+    int        kind,
+    long       max,
+    SNRUN    * pRun) {
+  
+  long lines = 0;
+  
+  /* Check parameters */
+  if ((pFilter == NULL) || (pIn == NULL) || (pRun == NULL)) {
+    abort();
+  }
+  
+  /* Only proceed if not in pushback mode, past the first codepoint, and
+   * not in a special condition; otherwise, describe an empty run */
+  if ((!(pFilter->pushback)) && (pFilter->line_count > 0) &&
+        (pFilter->c >= 0)) {
+    
+    /* Skip the run */
+    snsource_skip(pIn, kind, max, pRun);
+    if (pRun->len > 0) {
+      
+      /* Reading codepoint by codepoint, the line count would increase
+       * for each LF before a codepoint, which counts the LF that was
+       * the previous codepoint but not an LF at the end of the run */
+      lines = pRun->lines;
+      if (pFilter->c == ASCII_LF) {
+        lines++;
+      }
+      if (pRun->last == ASCII_LF) {
+        lines--;
+      }
+      
+      /* Update the line count, stopping at LONG_MAX */
+      if (pFilter->line_count <= LONG_MAX - lines) {
+        pFilter->line_count = pFilter->line_count + lines;
+      } else {
+        pFilter->line_count = LONG_MAX;
+      }
+      
+      /* Update the last codepoint read */
+      pFilter->c = pRun->last;
+#ifdef SHASTINA_STATS
+      snstats_add(&(pFilter->cp_count),
+                  snstats_text(pRun->pData, pRun->len));
+#endif
+    }
+  
+  } else {
+    memset(pRun, 0, sizeof(SNRUN));
+    pRun->pData = NULL;
+    pRun->last = -1;
+  }
+}
+
+/*
+ * Look up the class of a character.
+ * 
+ * c may be any value, including special SNERR_ values.  US-ASCII
+ * characters are looked up in the snchar_table, while all other values
+ * have a class of zero, since they are never legal outside of string
+ * literals and comments.
+ * 
+ * The result combines SNCHAR_ class flags with an SNPRIM_ primitive
+ * type that can be extracted with SNCHAR_GETPRIM().
+ * 
+ * Parameters:
+ * 
+ *   c - the character to look up
+ * 
+ * Return:
+ * 
+ *   the class of the character
+ */
+static int snchar_class(long c) {
+  
+  int result = 0;
+  
+  if ((c >= 0) && (c < 128)) {
+    result = snchar_table[c];
+  } else {
+    result = 0;
+  }
+  
+  return result;
+}
+
+/*
+ * Start reading a new string in chunks.
+ * 
+ * pState is the chunk state to initialize, and str_type is the
+ * SNSTRING_ constant of the string that is about to be read.  The
+ * opening quote or curly bracket should have just been read.
+ * 
+ * Parameters:
+ * 
+ *   pState - the chunk state to initialize
+ * 
+ *   str_type - the type of string
+ */
+static void snstr_init(SNSTRSTATE *pState, int str_type) {
+  
+  /* Check parameters */
+  if (pState == NULL) {
+    abort();
+  }
+  if ((str_type != SNSTRING_QUOTED) && (str_type != SNSTRING_CURLY)) {
+    abort();
+  }
+  
+  /* Initialize */
+  memset(pState, 0, sizeof(SNSTRSTATE));
+  pState->str_type = str_type;
+  pState->esc_count = 0;
+  pState->nest_level = 1;
+}
+
+/*
+ * Read a quoted string.
+ * 
+ * pBuffer is the buffer into which the string data will be read.  It
+ * must be properly initialized.  This function will reset the buffer
+ * and then write the string data into it.
+ * 
+ * pIn is the source to read data from.
+ * 
+ * pFilter is the input filter to read the data through.  It should be
+ * in the proper state.
+ * 
+ * This function assumes that the opening quote as already been read.
+ * The first character read is therefore the first character of string
+ * data.  The closing quote will be read and consumed by this function.
+ * 
+ * If view is non-zero, pIn must be a whole source, and the buffer will
+ * be made a view of the string data in the input wherever possible.
+ * See snbuffer_appendView() for further information.
+ * 
+ * If unescape is non-zero, the buffer receives the unescaped string
+ * data, where each backslash that escapes a double quote or another
+ * backslash is left out.  Other backslashes are kept.  The buffer can
+ * still be a view up to the first escape.  The buffer limit applies to
+ * the unescaped data.
+ * 
+ * pState is the chunk state, or NULL.  If NULL, the whole string is
+ * read into the buffer, and it is an SNERR_LONGSTR error if it does not
+ * fit.  Otherwise, pState must have been started with snstr_init() and
+ * the string is read in chunks.  Whenever the buffer might not have
+ * room for another codepoint, SNSTR_PARTIAL is returned with the buffer
+ * holding the chunk that was read so far, and the next call with the
+ * same state resets the buffer and continues with the next chunk.
+ * Otherwise, the str_type field of the state is cleared to zero upon
+ * return, meaning the string is finished or an error occurred.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the buffer to read the string data into
+ * 
+ *   pIn - the source to read the string data from
+ * 
+ *   pFilter - the input filter
+ * 
+ *   view - non-zero to make the buffer a view where possible
+ * 
+ *   unescape - non-zero to unescape the string data
+ * 
+ *   pState - the chunk state, or NULL
+ * 
+ * Return:
+ * 
+ *   zero if successful, SNSTR_PARTIAL if there is more of the string to
+ *   read, or one of the SNERR constants if error
+ */
+static int snstr_readQuoted(
+    SNBUFFER   * pBuffer,
+    SNSOURCE   * pIn,
+    SNFILTER   * pFilter,
+    int          view,
+    int          unescape,
+    SNSTRSTATE * pState) {
+  
+  SNRUN run;
+  const char *pFrom = NULL;
+  const char *pEsc = NULL;
+  int err_num = 0;
+  int esc_count = 0;
+  int held = 0;
+  long room = 0;
+  long c = 0;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  if (pState != NULL) {
+    if (pState->str_type == 0) {
+      abort();
+    }
+  }
+  
+  /* Initialize structures */
+  memset(&run, 0, sizeof(SNRUN));
+  run.pData = NULL;
+  
+  /* If continuing a chunked string, pick up where it left off */
+  if (pState != NULL) {
+    esc_count = pState->esc_count;
+  }
+  
+  /* Reset the buffer */
+  snbuffer_reset(pBuffer, 0);
+  
+  /* Read all string data */
+  while (!err_num) {
+    
+    /* If making a view, note where the character starts in the input,
+     * then read a character */
+    if (view) {
+      pFrom = snsource_view(pIn);
+    }
+    c = snfilter_read(pFilter, pIn);
+    if (c < 0) {
+      if (c == SNERR_EOF) {
+        err_num = SNERR_OPENSTR;
+      } else {
+        err_num = (int) c;
+      }
+    }
+    
+    /* Note whether a backslash is being held back from the buffer,
+     * which is the case whenever the escape count is odd while
+     * unescaping */
+    held = (unescape && (esc_count & 0x1)) ? 1 : 0;
+    
+    /* If this character is a double quote and the escape count is not
+     * odd, then we are done so leave loop */
+    if ((!err_num) && ((esc_count & 0x1) == 0) && (c == ASCII_DQUOTE)) {
+      break;
+    }
+    
+    /* Update escape count -- increment if current character is a
+     * backslash, clear otherwise; only least significant bit of the
+     * count is important so mask out upper bits to prevent overflow */
+    if ((!err_num) && (c == ASCII_BACKSLASH)) {
+      esc_count = (esc_count + 1) & 0x1;
+    } else {
+      esc_count = 0;
+    }
+    
+    /* Make sure character is not a null character */
+    if ((!err_num) && (c == 0)) {
+      err_num = SNERR_NULLCHR;
+    }
+    
+    /* If a backslash is held back and this character is not one that
+     * it escapes, the backslash goes into the buffer after all */
+    if ((!err_num) && held &&
+          (c != ASCII_BACKSLASH) && (c != ASCII_DQUOTE)) {
+      if (!snbuffer_appendFrom(pBuffer, ASCII_BACKSLASH,
+            pEsc, (pEsc != NULL) ? (pEsc + 1) : NULL)) {
+        err_num = SNERR_LONGSTR;
+      }
+    }
+    
+    /* Append character to buffer, unless unescaping and this is a
+     * backslash that begins an escape, which is held back until the
+     * next character shows whether it escapes that character */
+    if ((!err_num) && unescape && (!held) && (c == ASCII_BACKSLASH)) {
+      pEsc = pFrom;
+    
+    } else if (!err_num) {
+      if (!snbuffer_appendFrom(pBuffer, c, pFrom, snsource_view(pIn))) {
+        err_num = SNERR_LONGSTR;
+      }
+    }
+    
+    /* Skip over a run of string data that needs no special handling
+     * and copy it into the buffer in one go; the run is limited to the
+     * space remaining in the buffer, so that running out of space is
+     * detected at exactly the same character as above; the run never
+     * has a backslash, so the escape count is cleared, and a backslash
+     * that is held back goes into the buffer before the run */
+    if (!err_num) {
+      held = (unescape && (esc_count & 0x1)) ? 1 : 0;
+      room = pBuffer->maxcap - pBuffer->count - 1 - held;
+      if (room < 0) {
+        room = 0;
+      }
+      snfilter_skip(pFilter, pIn, SNRUN_QUOTED, room, &run);
+      if ((run.len > 0) && held) {
+        if (!snbuffer_appendFrom(pBuffer, ASCII_BACKSLASH,
+              pEsc, (pEsc != NULL) ? (pEsc + 1) : NULL)) {
+          err_num = SNERR_NOMEM;
+        }
+      }
+      if ((!err_num) && (run.len > 0)) {
+        if (view) {
+          if (!snbuffer_appendView(pBuffer,
+                (const char *) run.pData, run.len)) {
+            err_num = SNERR_NOMEM;
+          }
+        } else {
+          if (!snbuffer_appendRun(pBuffer, run.pData, run.len)) {
+            err_num = SNERR_NOMEM;
+          }
+        }
+        esc_count = 0;
+      }
+    }
+    
+    /* If reading in chunks, stop once the buffer might not have room
+     * for another codepoint, along with a backslash that is held back,
+     * so the rest goes into the next chunk */
+    if ((!err_num) && (pState != NULL)) {
+      held = (unescape && (esc_count & 0x1)) ? 1 : 0;
+      if (pBuffer->maxcap - pBuffer->count - 1 <
+            UNICODE_MAX_UTF8 + held) {
+        err_num = SNSTR_PARTIAL;
+      }
+    }
+  }
+  
+  /* If reading in chunks, save the state for the next chunk, or note
+   * that the string is finished */
+  if (pState != NULL) {
+    if (err_num == SNSTR_PARTIAL) {
+      pState->esc_count = esc_count;
+    } else {
+      pState->str_type = 0;
+    }
+  }
+  
+  /* Return okay, partial, or error code */
+  return err_num;
+}
+
+/*
+ * Read a curly-quoted string.
+ * 
+ * pBuffer is the buffer into which the string data will be read.  It
+ * must be properly initialized.  This function will reset the buffer
+ * and then write the string data into it.
+ * 
+ * pIn is the source to read data from.
+ * 
+ * pFilter is the input filter to read the data through.  It should be
+ * in the proper state.
+ * 
+ * This function assumes that the opening curly bracket as already been
+ * read.  The first character read is therefore the first character of
+ * string data.  The closing curly bracket will be read and consumed by
+ * this function.
+ * 
+ * If view is non-zero, pIn must be a whole source, and the buffer will
+ * be made a view of the string data in the input wherever possible.
+ * See snbuffer_appendView() for further information.
+ * 
+ * If unescape is non-zero, the buffer receives the unescaped string
+ * data, where each backslash that escapes a curly bracket or another
+ * backslash is left out.  Other backslashes are kept.  This otherwise
+ * works the same way as for snstr_readQuoted().
+ * 
+ * pState is the chunk state, or NULL.  It works the same way as for
+ * snstr_readQuoted().
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the buffer to read the string data into
+ * 
+ *   pIn - the source to read the string data from
+ * 
+ *   pFilter - the input filter
+ * 
+ *   view - non-zero to make the buffer a view where possible
+ * 
+ *   unescape - non-zero to unescape the string data
+ * 
+ *   pState - the chunk state, or NULL
+ * 
+ * Return:
+ * 
+ *   zero if successful, SNSTR_PARTIAL if there is more of the string to
+ *   read, or one of the SNERR constants if error
+ */
+static int snstr_readCurlied(
+    SNBUFFER   * pBuffer,
+    SNSOURCE   * pIn,
+    SNFILTER   * pFilter,
+    int          view,
+    int          unescape,
+    SNSTRSTATE * pState) {
+  
+  SNRUN run;
+  const char *pFrom = NULL;
+  const char *pEsc = NULL;
+  int err_num = 0;
+  int esc_count = 0;
+  int held = 0;
+  long nest_level = 1;
+  long room = 0;
+  long c = 0;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  if (pState != NULL) {
+    if (pState->str_type == 0) {
+      abort();
+    }
+  }
+  
+  /* Initialize structures */
+  memset(&run, 0, sizeof(SNRUN));
+  run.pData = NULL;
+  
+  /* If continuing a chunked string, pick up where it left off */
+  if (pState != NULL) {
+    esc_count = pState->esc_count;
+    nest_level = pState->nest_level;
+  }
+  
+  /* Reset the buffer */
+  snbuffer_reset(pBuffer, 0);
+  
+  /* Read all string data */
+  while (!err_num) {
+    
+    /* If making a view, note where the character starts in the input,
+     * then read a character */
+    if (view) {
+      pFrom = snsource_view(pIn);
+    }
+    c = snfilter_read(pFilter, pIn);
+    if (c < 0) {
+      if (c == SNERR_EOF) {
+        err_num = SNERR_OPENSTR;
+      } else {
+        err_num = (int) c;
+      }
+    }
+    
+    /* Note whether a backslash is being held back from the buffer,
+     * which is the case whenever the escape count is odd while
+     * unescaping */
+    held = (unescape && (esc_count & 0x1)) ? 1 : 0;
+    
+    /* If escape count is not odd, update the nesting level if current
+     * character is a curly bracket */
+    if ((!err_num) && ((esc_count & 0x1) == 0)) {
+      if (c == ASCII_LCURL) {
+        
+        /* Left curly -- increase nesting level, watching for
+         * overflow */
+        if (nest_level < LONG_MAX) {
+          nest_level++;
+        } else {
+          err_num = SNERR_DEEPCURLY;
+        }
+      
+      } else if (c == ASCII_RCURL) {
+        /* Right curly -- decrease nesting level */
+        nest_level--;
+      }
+    }
+    
+    /* If nesting level has been brought down to zero, leave loop */
+    if ((!err_num) && (nest_level < 1)) {
+      break;
+    }
+    
+    /* Update escape count -- increment if current character is a
+     * backslash, clear otherwise; only least significant bit of the
+     * count is important so mask out upper bits to prevent overflow */
+    if ((!err_num) && (c == ASCII_BACKSLASH)) {
+      esc_count = (esc_count + 1) & 0x1;
+    } else {
+      esc_count = 0;
+    }
+    
+    /* Make sure character is not a null character */
+    if ((!err_num) && (c == 0)) {
+      err_num = SNERR_NULLCHR;
+    }
+    
+    /* If a backslash is held back and this character is not one that
+     * it escapes, the backslash goes into the buffer after all */
+    if ((!err_num) && held && (c != ASCII_BACKSLASH) &&
+          (c != ASCII_LCURL) && (c != ASCII_RCURL)) {
+      if (!snbuffer_appendFrom(pBuffer, ASCII_BACKSLASH,
+            pEsc, (pEsc != NULL) ? (pEsc + 1) : NULL)) {
+        err_num = SNERR_LONGSTR;
+      }
+    }
+    
+    /* Append character to buffer, unless unescaping and this is a
+     * backslash that begins an escape, which is held back until the
+     * next character shows whether it escapes that character */
+    if ((!err_num) && unescape && (!held) && (c == ASCII_BACKSLASH)) {
+      pEsc = pFrom;
+    
+    } else if (!err_num) {
+      if (!snbuffer_appendFrom(pBuffer, c, pFrom, snsource_view(pIn))) {
+        err_num = SNERR_LONGSTR;
+      }
+    }
+    
+    /* Skip over a run of string data that needs no special handling
+     * and copy it into the buffer in one go; the run is limited to the
+     * space remaining in the buffer, so that running out of space is
+     * detected at exactly the same character as above; the run never
+     * has a backslash, so the escape count is cleared, and a backslash
+     * that is held back goes into the buffer before the run */
+    if (!err_num) {
+      held = (unescape && (esc_count & 0x1)) ? 1 : 0;
+      room = pBuffer->maxcap - pBuffer->count - 1 - held;
+      if (room < 0) {
+        room = 0;
+      }
+      snfilter_skip(pFilter, pIn, SNRUN_CURLIED, room, &run);
+      if ((run.len > 0) && held) {
+        if (!snbuffer_appendFrom(pBuffer, ASCII_BACKSLASH,
+              pEsc, (pEsc != NULL) ? (pEsc + 1) : NULL)) {
+          err_num = SNERR_NOMEM;
+        }
+      }
+      if ((!err_num) && (run.len > 0)) {
+        if (view) {
+          if (!snbuffer_appendView(pBuffer,
+                (const char *) run.pData, run.len)) {
+            err_num = SNERR_NOMEM;
+          }
+        } else {
+          if (!snbuffer_appendRun(pBuffer, run.pData, run.len)) {
+            err_num = SNERR_NOMEM;
+          }
+        }
+        esc_count = 0;
+      }
+    }
+    
+    /* If reading in chunks, stop once the buffer might not have room
+     * for another codepoint, along with a backslash that is held back,
+     * so the rest goes into the next chunk */
+    if ((!err_num) && (pState != NULL)) {
+      held = (unescape && (esc_count & 0x1)) ? 1 : 0;
+      if (pBuffer->maxcap - pBuffer->count - 1 <
+            UNICODE_MAX_UTF8 + held) {
+        err_num = SNSTR_PARTIAL;
+      }
+    }
+  }
+  
+  /* If reading in chunks, save the state for the next chunk, or note
+   * that the string is finished */
+  if (pState != NULL) {
+    if (err_num == SNSTR_PARTIAL) {
+      pState->esc_count = esc_count;
+      pState->nest_level = nest_level;
+    } else {
+      pState->str_type = 0;
+    }
+  }
+  
+  /* Return okay, partial, or error code */
+  return err_num;
+}
+
+/*
+ * Append a character of a token that was just read to a buffer.
+ * 
+ * pBuffer is the buffer holding the token, and c is the character that
+ * was just read from pIn.  c must be a character that is legal in
+ * tokens.
+ * 
+ * If view is non-zero, then pIn must be a whole source, and the
+ * character is added with snbuffer_appendView().  This relies on the
+ * fact that the characters of tokens are always US-ASCII that passes
+ * through the input filter unchanged, so the character just read is
+ * always the last byte consumed from the input -- even if it was read
+ * again after being pushed back.  Otherwise, the character is copied
+ * into the buffer with snbuffer_append().
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the buffer to append the character to
+ * 
+ *   pIn - the source the character was just read from
+ * 
+ *   c - the character
+ * 
+ *   view - non-zero to extend a view of the token in the input
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if not enough capacity
+ */
+static int sntk_append(
+    SNBUFFER * pBuffer,
+    SNSOURCE * pIn,
+    long       c,
+    int        view) {
+  
+  int status = 0;
+  const char *pc = NULL;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pIn == NULL) ||
+      (!(snchar_class(c) & SNCHAR_LEGAL))) {
+    abort();
+  }
+  
+  /* Append the character */
+  if (view) {
+    /* Find the last byte consumed, which must be the character */
+    pc = snsource_view(pIn);
+    if (pc == NULL) {
+      abort();
+    }
+    pc--;
+    if (*pc != (char) c) {
+      abort();  /* shouldn't happen */
+    }
+    
+    /* Extend the view */
+    status = snbuffer_appendView(pBuffer, pc, 1);
+  
+  } else {
+    /* Copy the character */
+    status = snbuffer_append(pBuffer, c);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Skip over zero or more characters of whitespace and comments.
+ * 
+ * After this operation, the source and filter will be positioned at the
+ * first character that is not whitespace and not part of a comment, or
+ * at the first special or error condition that was encountered.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the input source
+ * 
+ *   pFilter - the filter to pass the input through
+ */
+static void sntk_skip(SNSOURCE *pIn, SNFILTER *pFilter) {
+  
+  SNRUN run;
+  long c = 0;
+  
+  /* Initialize structures */
+  memset(&run, 0, sizeof(SNRUN));
+  run.pData = NULL;
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  
+  /* Skip over whitespace and comments */
+  while (c >= 0) {
+    
+    /* Skip over zero or more characters of whitespace, skipping runs of
+     * whitespace in bulk where possible */
+    for(c = snfilter_read(pFilter, pIn);
+        (c == ASCII_SP) || (c == ASCII_HT) || (c == ASCII_LF);
+        c = snfilter_read(pFilter, pIn)) {
+      snfilter_skip(pFilter, pIn, SNRUN_WHITE, LONG_MAX, &run);
+    }
+    
+    /* If we encountered anything except the pound sign, set pushback
+     * mode (unless a special condition) and leave the loop */
+    if (c != ASCII_POUNDSIGN) {
+      if (c >= 0) {
+        if (!snfilter_pushback(pFilter)) {
+          abort();  /* shouldn't happen */
+        }
+      }
+      break;
+    }
+    
+    /* We encountered the start of a comment -- read until we encounter
+     * LF or some special condition, skipping runs of comment text in
+     * bulk where possible */
+    for(c = snfilter_read(pFilter, pIn);
+        (c >= 0) && (c != ASCII_LF);
+        c = snfilter_read(pFilter, pIn)) {
+      snfilter_skip(pFilter, pIn, SNRUN_COMMENT, LONG_MAX, &run);
+    }
+  }
+}
+
+/*
+ * Read a token.
+ * 
+ * pBuffer is the buffer into which the token will be read.  It must be
+ * properly initialized.  This function will reset the buffer and then
+ * write the token into it.
+ * 
+ * pIn is the source to read data from.
+ * 
+ * pFilter is the input filter to read the data through.  It should be
+ * in the proper state.
+ * 
+ * This function will skip over comments and whitespace before reading
+ * the token.
+ * 
+ * For string tokens, this function only reads the opening token and not
+ * the data that follows it.  Input will be positioned such that the
+ * next byte read will the first byte of string data.
+ * 
+ * Note that it is not possible to use this function to iterate through
+ * all the tokens in a Shastina source file, because this function
+ * doesn't handle string data.
+ * 
+ * If view is non-zero, pIn must be a whole source, and the buffer will
+ * be made a view of the token in the input.  See sntk_append() for
+ * further information.
+ * 
+ * pStart receives the number of bytes that had been read through the
+ * source before the first character of the token, or the number of
+ * bytes read so far if there is no first character.
+ * 
+ * Parameters:
+ * 
+ *   pBuffer - the buffer to read the token into
+ * 
+ *   pIn - the input source to read the token from
+ * 
+ *   pFilter - the input filter
+ * 
+ *   view - non-zero to make the buffer a view
+ * 
+ *   pStart - receives the byte offset of the token
+ * 
+ * Return:
+ * 
+ *   zero if successful, or one of the SNERR constants if error
+ */
+static int sntk_readToken(
+    SNBUFFER * pBuffer,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter,
+    int        view,
+    long     * pStart) {
+  
+  SNRUN run;
+  int err_num = 0;
+  int cls = 0;
+  long c = 0;
+  long c2 = 0;
+  int term = 0;
+  int leave = 0;
+  int omit = 0;
+  
+  /* Check parameters */
+  if ((pBuffer == NULL) || (pIn == NULL) || (pFilter == NULL) ||
+      (pStart == NULL)) {
+    abort();
+  }
+  
+  /* Initialize structures */
+  memset(&run, 0, sizeof(SNRUN));
+  run.pData = NULL;
+  
+  /* Reset the buffer */
+  snbuffer_reset(pBuffer, 0);
+  
+  /* Skip over whitespace and comments */
+  sntk_skip(pIn, pFilter);
+  
+  /* Read a character and record where the token starts; the first
+   * character of a valid token is always a single byte, which is the
+   * last byte consumed from the source even if it was pushed back */
+  c = snfilter_read(pFilter, pIn);
+  if (c < 0) {
+    err_num = (int) c;
+  }
+  if ((c >= 0) && (pIn->read_count > 0)) {
+    *pStart = pIn->read_count - 1;
+  } else {
+    *pStart = pIn->read_count;
+  }
+  
+  /* Look up the character class and check that the character is
+   * legal */
+  if (!err_num) {
+    cls = snchar_class(c);
+    if (!(cls & SNCHAR_LEGAL)) {
+      err_num = SNERR_BADCHAR;
+    }
+  }
+  
+  /* Add the first character to the buffer */
+  if (!err_num) {
+    if (!sntk_append(pBuffer, pIn, c, view)) {
+      err_num = SNERR_LONGTOKEN;
+    }
+  }
+  
+  /* If the first character is a vertical bar, check if the second
+   * character is a semicolon, forming the |; pair; set the term flag
+   * in this case and add the semicolon to the token; else, unread the
+   * second character */
+  if ((!err_num) && (c == ASCII_BAR)) {
+    c2 = snfilter_read(pFilter, pIn);
+    if (c2 < 0) {
+      err_num = (int) c2;
+    }
+    
+    if ((!err_num) && (c2 == ASCII_SEMICOLON)) {
+      term = 1;
+      if (!sntk_append(pBuffer, pIn, c2, view)) {
+        err_num = SNERR_LONGTOKEN;
+      }
+    } else {
+      if (!snfilter_pushback(pFilter)) {
+        abort();  /* shouldn't happen */
+      }
+    }
+  }
+  
+  /* If the first character read is not atomic and the term flag is not
+   * set, read additional characters into the token up to the exclusive
+   * or inclusive character that ends the token */
+  if ((!err_num) && (!term)) {
+    if (!(cls & SNCHAR_ATOMIC)) {
+      
+      /* Read the additional characters */
+      while (!err_num) {
+        
+        /* Skip over a run of plain characters that can't end the token
+         * and copy it into the buffer in one go; the run is limited to
+         * the space remaining in the buffer, so that running out of
+         * space is detected at exactly the same character as below */
+        snfilter_skip(pFilter, pIn, SNRUN_TOKEN,
+                      pBuffer->maxcap - pBuffer->count - 1, &run);
+        if (run.len > 0) {
+          if (view) {
+            if (!snbuffer_appendView(pBuffer,
+                  (const char *) run.pData, run.len)) {
+              err_num = SNERR_NOMEM;
+            }
+          } else {
+            if (!snbuffer_appendRun(pBuffer, run.pData, run.len)) {
+              err_num = SNERR_NOMEM;
+            }
+          }
+        }
+        
+        /* Read another character */
+        if (!err_num) {
+          c = snfilter_read(pFilter, pIn);
+          if (c < 0) {
+            err_num = (int) c;
+          }
+        }
+        
+        /* Look up the character class and make sure the character is
+         * legal */
+        if (!err_num) {
+          cls = snchar_class(c);
+          if (!(cls & SNCHAR_LEGAL)) {
+            err_num = SNERR_BADCHAR;
+          }
+        }
+        
+        /* If the character is inclusive, set the leave flag */
+        if (!err_num) {
+          if (cls & SNCHAR_INCLUSIVE) {
+            leave = 1;
+          }
+        }
+        
+        /* If the character is exclusive, set the leave and omit
+         * flags, and push back the character */
+        if (!err_num) {
+          if (cls & SNCHAR_EXCLUSIVE) {
+            leave = 1;
+            omit = 1;
+            if (!snfilter_pushback(pFilter)) {
+              abort();  /* shouldn't happen */
+            }
+          }
+        }
+        
+        /* If the omit flag is not set, add the character to the
+         * token */
+        if ((!err_num) && (!omit)) {
+          if (!sntk_append(pBuffer, pIn, c, view)) {
+            err_num = SNERR_LONGTOKEN;
+          }
+        }
+        
+        /* If the leave flag is set, leave the loop */
+        if ((!err_num) && leave) {
+          break;
+        }
+      }
+    }
+  }
+  
+  /* Return okay or error number */
+  return err_num;
+}
+
+/*
+ * Read a complete token from the given file.
+ * 
+ * pToken is the structure to receive the read token.  Only the pKey,
+ * pValue, view, and pChunk fields need to be filled in upon entry.
+ * Upon return, all fields will be filled in.  See the structure
+ * documentation for further information.
+ * 
+ * pIn is the source to read data from.
+ * 
+ * pFilter is the input filter to read the data through.  It should be
+ * in the proper state.
+ * 
+ * This function differs from sntk_readToken() in that this function can
+ * also read string data.
+ * 
+ * Parameters:
+ * 
+ *   pToken - the token structure
+ * 
+ *   pIn - the input source
+ * 
+ *   pFil - the filter to pass input through
+ */
+static void sntoken_read(
+    SNTOKEN  * pToken,
+    SNSOURCE * pIn,
+    SNFILTER * pFil) {
+  
+  int err_num = 0;
+  long c = 0;
+  char *pks = NULL;
+  
+  /* Check parameters */
+  if ((pToken == NULL) || (pIn == NULL) || (pFil == NULL)) {
+    abort();
+  }
+  if ((pToken->pKey == NULL) || (pToken->pValue == NULL) ||
+      (pToken->pKey == pToken->pValue)) {
+    abort();
+  }
+  
+  /* Reset both buffers and the token fields */
+  snbuffer_reset(pToken->pKey, 0);
+  snbuffer_reset(pToken->pValue, 0);
+  pToken->status = 0;
+  pToken->str_type = 0;
+  
+  /* Read a token into the key buffer */
+  err_num = sntk_readToken(pToken->pKey, pIn, pFil, pToken->view,
+                            &(pToken->offset));
+  
+  /* Identify the token by its last character, also setting the str_type
+   * flag for string tokens */
+  if (!err_num) {
+    /* Get last character */
+    c = snbuffer_last(pToken->pKey);
+    
+    /* Identify token */
+    if (c == ASCII_DQUOTE) {
+      pToken->status = SNTOKEN_STRING;
+      pToken->str_type = SNSTRING_QUOTED;
+    
+    } else if (c == ASCII_LCURL) {
+      pToken->status = SNTOKEN_STRING;
+      pToken->str_type = SNSTRING_CURLY;
+    
+    } else {
+      pToken->status = SNTOKEN_SIMPLE;
+    }
+  }
+  
+  /* For simple tokens, distinguish between SIMPLE and FINAL */
+  if ((!err_num) && (pToken->status == SNTOKEN_SIMPLE)) {
+    pks = snbuffer_get(pToken->pKey);
+    if ((pToken->pKey->count == 2) &&
+          (pks[0] == ASCII_BAR) && (pks[1] == ASCII_SEMICOLON)) {
+      pToken->status = SNTOKEN_FINAL;
+    }
+  }
+  
+  /* For string tokens, remove the last character, so the key buffer
+   * only has the prefix */
+  if ((!err_num) && (pToken->status == SNTOKEN_STRING)) {
+    if (!snbuffer_less(pToken->pKey)) {
+      abort();  /* shouldn't happen */
+    }
+  }
+  
+  /* For string tokens, start the chunk state if reading in chunks */
+  if ((!err_num) && (pToken->status == SNTOKEN_STRING) &&
+        (pToken->pChunk != NULL)) {
+    snstr_init(pToken->pChunk, pToken->str_type);
+  }
+  
+  /* For string tokens, read the string data into the value buffer */
+  if ((!err_num) && (pToken->status == SNTOKEN_STRING)) {
+    if (pToken->str_type == SNSTRING_QUOTED) {
+      /* Quoted string */
+      err_num = snstr_readQuoted(pToken->pValue, pIn, pFil,
+                                  pToken->view, pToken->unescape,
+                                  pToken->pChunk);
+    
+    } else if (pToken->str_type == SNSTRING_CURLY) {
+      /* Curly string */
+      err_num = snstr_readCurlied(pToken->pValue, pIn, pFil,
+                                  pToken->view, pToken->unescape,
+                                  pToken->pChunk);
+    
+    } else {
+      /* Unknown string type */
+      abort();
+    }
+  }
+  
+  /* If only the first chunk of a string was read, that is not an
+   * error -- the chunk state shows that there is more to read */
+  if (err_num == SNSTR_PARTIAL) {
+    err_num = 0;
+  }
+  
+  /* If an error was encountered, clear the buffers and the fields, and
+   * set the status to the error */
+  if (err_num) {
+    snbuffer_reset(pToken->pKey, 0);
+    snbuffer_reset(pToken->pValue, 0);
+    pToken->str_type = 0;
+    pToken->status = err_num;
+    pToken->offset = pIn->read_count;
+  }
+}
+
+/*
+ * Initialize a parallel tokenization state structure.
+ * 
+ * Parallel tokenization starts out disabled.  Use snspec_enable() to
+ * enable it.  The structure must be released with snspec_free() before
+ * it is released itself, or a memory leak may occur.
+ * 
+ * pAlloc is the memory allocator, which must remain allocated while
+ * the structure is in use.
+ * 
+ * Parameters:
+ * 
+ *   pSpec - the structure to initialize
+ * 
+ *   pAlloc - the memory allocator
+ */
+static void snspec_init(SNSPEC *pSpec, const SNALLOC *pAlloc) {
+  
+  /* Check parameters */
+  if ((pSpec == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  
+  /* Initialize */
+  memset(pSpec, 0, sizeof(SNSPEC));
+  
+  pSpec->threads = 0;
+  pSpec->chunk_size = 0;
+  pSpec->pChunks = NULL;
+  pSpec->chunk_count = 0;
+  pSpec->cur = 0;
+  pSpec->cur_tok = 0;
+  pSpec->offset = 0;
+  pSpec->pSrc = NULL;
+  pSpec->pWin = NULL;
+  pSpec->win_len = 0;
+  pSpec->lf_none = -1;
+  pSpec->base_pos = 0;
+  pSpec->base_count = 0;
+  pSpec->view = 0;
+  pSpec->unescape = 0;
+  pSpec->expect_pos = 0;
+  pSpec->expect_status = 0;
+  pSpec->pAlloc = pAlloc;
+}
+
+/*
+ * Release all memory of a parallel tokenization state structure and
+ * disable parallel tokenization.
+ * 
+ * Parameters:
+ * 
+ *   pSpec - the structure to release
+ */
+static void snspec_free(SNSPEC *pSpec) {
+  
+  int i = 0;
+  SNSPECCHUNK *pc = NULL;
+  
+  /* Check parameter */
+  if (pSpec == NULL) {
+    abort();
+  }
+  
+  /* Release each chunk and then the chunk array */
+  if (pSpec->pChunks != NULL) {
+    for(i = 0; i < pSpec->threads; i++) {
+      pc = &((pSpec->pChunks)[i]);
+      snbuffer_reset(&(pc->buf_key), 1);
+      snbuffer_reset(&(pc->buf_value), 1);
+      if (pc->pTok != NULL) {
+        snalloc_release(pSpec->pAlloc, pc->pTok,
+          pc->tok_cap * ((long) sizeof(SNSPECTOKEN)));
+        pc->pTok = NULL;
+      }
+      if (pc->pArena != NULL) {
+        snalloc_release(pSpec->pAlloc, pc->pArena, pc->arena_cap);
+        pc->pArena = NULL;
+      }
+    }
+    snalloc_release(pSpec->pAlloc, pSpec->pChunks,
+      ((long) pSpec->threads) * ((long) sizeof(SNSPECCHUNK)));
+    pSpec->pChunks = NULL;
+  }
+  
+  /* Disable, dropping any window */
+  pSpec->threads = 0;
+  pSpec->chunk_size = 0;
+  pSpec->chunk_count = 0;
+  pSpec->cur = 0;
+  pSpec->cur_tok = 0;
+  pSpec->offset = 0;
+}
+
+/*
+ * Enable or disable parallel tokenization.
+ * 
+ * Any chunks from a previous call are released first.  threads is the
+ * number of chunks to tokenize at once, which is lowered to
+ * SNSPEC_THREADS_MAX if larger.  If it is less than two, parallel
+ * tokenization is disabled.  Without SHASTINA_THREADS, parallel
+ * tokenization is always disabled.  chunk is the chunk size in bytes,
+ * or zero or less for SNSPEC_CHUNK_DEFAULT.
+ * 
+ * The key and value buffers of each chunk are given the same initial
+ * and maximum capacities as pKey and pValue, which should be the
+ * buffers of the reader, so that tokens run into the same limits.
+ * 
+ * Parameters:
+ * 
+ *   pSpec - the parallel tokenization state
+ * 
+ *   threads - the number of threads
+ * 
+ *   chunk - the chunk size
+ * 
+ *   pKey - the key buffer to take the capacities from
+ * 
+ *   pValue - the value buffer to take the capacities from
+ * 
+ * Return:
+ * 
+ *   non-zero if parallel tokenization is enabled, zero if disabled,
+ *   including when memory could not be allocated
+ */
+static int snspec_enable(
+    SNSPEC   * pSpec,
+    int        threads,
+    long       chunk,
+    SNBUFFER * pKey,
+    SNBUFFER * pValue) {
+  
+  int i = 0;
+  SNSPECCHUNK *pc = NULL;
+  
+  /* Check parameters */
+  if ((pSpec == NULL) || (pKey == NULL) || (pValue == NULL)) {
+    abort();
+  }
+  
+  /* Release anything from before */
+  snspec_free(pSpec);
+  
+  /* Parallel tokenization needs threads */
+#ifndef SHASTINA_THREADS
+  threads = 0;
+#endif
+  
+  /* Apply the thread limit and the default chunk size */
+  if (threads > SNSPEC_THREADS_MAX) {
+    threads = SNSPEC_THREADS_MAX;
+  }
+  if (chunk < 1) {
+    chunk = SNSPEC_CHUNK_DEFAULT;
+  }
+  
+  /* Allocate and initialize the chunks */
+  if (threads >= 2) {
+    pSpec->pChunks = (SNSPECCHUNK *) snalloc_get(pSpec->pAlloc,
+                ((long) threads) * ((long) sizeof(SNSPECCHUNK)));
+    if (pSpec->pChunks != NULL) {
+      memset(pSpec->pChunks, 0,
+              ((size_t) threads) * sizeof(SNSPECCHUNK));
+      for(i = 0; i < threads; i++) {
+        pc = &((pSpec->pChunks)[i]);
+        snbuffer_init(&(pc->buf_key),
+                      pKey->initcap, pKey->maxcap, pSpec->pAlloc);
+        snbuffer_init(&(pc->buf_value),
+                      pValue->initcap, pValue->maxcap, pSpec->pAlloc);
+        pc->pTok = NULL;
+        pc->tok_count = 0;
+        pc->tok_cap = 0;
+        pc->pArena = NULL;
+        pc->arena_len = 0;
+        pc->arena_cap = 0;
+        pc->started = 0;
+        pc->pAlloc = pSpec->pAlloc;
+      }
+      pSpec->threads = threads;
+      pSpec->chunk_size = chunk;
+    }
+  }
+  
+  /* Return whether enabled */
+  return (pSpec->threads >= 2);
+}
+
+/*
+ * Drop the window of parallel tokenization, if there is one.
+ * 
+ * The next token is then read sequentially, or from a new window.  The
+ * chunks keep their memory for reuse.
+ * 
+ * Parameters:
+ * 
+ *   pSpec - the parallel tokenization state
+ */
+static void snspec_drop(SNSPEC *pSpec) {
+  
+  /* Check parameter */
+  if (pSpec == NULL) {
+    abort();
+  }
+  
+  /* Drop the window */
+  pSpec->chunk_count = 0;
+  pSpec->cur = 0;
+  pSpec->cur_tok = 0;
+  pSpec->offset = 0;
+}
+
+/*
+ * Determine the window position where the next token starts.
+ * 
+ * The source and filter must be positioned right after skipping over
+ * whitespace and comments with sntk_skip().  The filter is then either
+ * in pushback mode with the first character of the token, or in an EOF
+ * or error condition.
+ * 
+ * Only US-ASCII characters are a single byte ahead of the window
+ * position, so -1 is returned if the pushed back character is anything
+ * else.  Such characters can't begin a valid token anyway.
+ * 
+ * Parameters:
+ * 
+ *   pIn - the source, which must be whole
+ * 
+ *   pFilter - the filter
+ * 
+ * Return:
+ * 
+ *   the window position of the token, or -1 if it can't be determined
+ */
+static long snspec_pos(SNSOURCE *pIn, SNFILTER *pFilter) {
+  
+  long result = -1;
+  
+  /* Check parameters */
+  if ((pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  
+  /* Find the position */
+  if (pFilter->pushback) {
+    if ((pFilter->c >= 0) && (pFilter->c <= ASCII_VISIBLE_MAX) &&
+          (pIn->win_pos > 0)) {
+      result = pIn->win_pos - 1;
+    }
+  } else if (pFilter->c < 0) {
+    result = pIn->win_pos;
+  }
+  
+  /* Return the position or -1 */
+  return result;
+}
+
+/*
+ * Store a token string of a chunk.
+ * 
+ * If the buffer is a view, the view pointer is stored in *ppView.
+ * Otherwise, *ppView is set to NULL and the string is copied into the
+ * arena of the chunk with a terminating null, with its offset in the
+ * arena stored in *pOff.  Empty strings are stored as a view of a
+ * static empty string.
+ * 
+ * Parameters:
+ * 
+ *   pChunk - the chunk
+ * 
+ *   pBuf - the buffer holding the string
+ * 
+ *   ppView - receives the view pointer, or NULL
+ * 
+ *   pOff - receives the arena offset
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snspec_keep(
+    SNSPECCHUNK  * pChunk,
+    SNBUFFER     * pBuf,
+    const char  ** ppView,
+    long         * pOff) {
+  
+  int status = 1;
+  long n = 0;
+  long cap = 0;
+  char *pNew = NULL;
+  
+  /* Check parameters */
+  if ((pChunk == NULL) || (pBuf == NULL) ||
+      (ppView == NULL) || (pOff == NULL)) {
+    abort();
+  }
+  
+  /* Reset results */
+  *ppView = NULL;
+  *pOff = 0;
+  
+  /* Handle views and empty strings, else copy into the arena */
+  if (pBuf->count < 1) {
+    *ppView = "";
+  
+  } else if (pBuf->pView != NULL) {
+    *ppView = pBuf->pView;
+  
+  } else {
+    /* Make room for the string and its terminating null, doubling the
+     * arena as necessary */
+    n = pBuf->count + 1;
+    if (pChunk->arena_cap - pChunk->arena_len < n) {
+      cap = pChunk->arena_cap;
+      if (cap < 1) {
+        cap = SNSPEC_ARENA_INIT;
+      }
+      while ((cap - pChunk->arena_len < n) && (cap <= LONG_MAX / 2)) {
+        cap = cap * 2;
+      }
+      if (cap - pChunk->arena_len < n) {
+        status = 0;
+      }
+      
+      if (status) {
+        if (pChunk->pArena != NULL) {
+          pNew = (char *) snalloc_resize(pChunk->pAlloc,
+                    pChunk->pArena, pChunk->arena_cap, cap);
+        } else {
+          pNew = (char *) snalloc_get(pChunk->pAlloc, cap);
+        }
+        if (pNew != NULL) {
+          pChunk->pArena = pNew;
+          pChunk->arena_cap = cap;
+        } else {
+          status = 0;
+        }
+      }
+    }
+    
+    /* Copy the string */
+    if (status) {
+      memcpy(pChunk->pArena + pChunk->arena_len,
+              pBuf->pBuf, (size_t) n);
+      *pOff = pChunk->arena_len;
+      pChunk->arena_len = pChunk->arena_len + n;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Append a token that was just read to the tokens of a chunk.
+ * 
+ * The token strings are taken from the buffers of the chunk, and the
+ * state after the token from the source and filter of the chunk.
+ * 
+ * Parameters:
+ * 
+ *   pChunk - the chunk
+ * 
+ *   pToken - the token that was read into the buffers of the chunk
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snspec_push(SNSPECCHUNK *pChunk, SNTOKEN *pToken) {
+  
+  int status = 1;
+  long cap = 0;
+  SNSPECTOKEN *pNew = NULL;
+  SNSPECTOKEN *pt = NULL;
+  
+  /* Check parameters */
+  if ((pChunk == NULL) || (pToken == NULL)) {
+    abort();
+  }
+  
+  /* Make room for another token, doubling the array as necessary */
+  if (pChunk->tok_count >= pChunk->tok_cap) {
+    if (pChunk->tok_cap < 1) {
+      cap = SNSPEC_TOKEN_INIT;
+    } else if (pChunk->tok_cap <=
+                LONG_MAX / 2 / ((long) sizeof(SNSPECTOKEN))) {
+      cap = pChunk->tok_cap * 2;
+    } else {
+      status = 0;
+    }
+    
+    if (status) {
+      if (pChunk->pTok != NULL) {
+        pNew = (SNSPECTOKEN *) snalloc_resize(pChunk->pAlloc,
+                  pChunk->pTok,
+                  pChunk->tok_cap * ((long) sizeof(SNSPECTOKEN)),
+                  cap * ((long) sizeof(SNSPECTOKEN)));
+      } else {
+        pNew = (SNSPECTOKEN *) snalloc_get(pChunk->pAlloc,
+                  cap * ((long) sizeof(SNSPECTOKEN)));
+      }
+      if (pNew != NULL) {
+        pChunk->pTok = pNew;
+        pChunk->tok_cap = cap;
+      } else {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Fill in the token */
+  if (status) {
+    pt = &((pChunk->pTok)[pChunk->tok_count]);
+    memset(pt, 0, sizeof(SNSPECTOKEN));
+    
+    pt->status = pToken->status;
+    pt->str_type = pToken->str_type;
+    
+    status = snspec_keep(pChunk, &(pChunk->buf_key),
+                          &(pt->pKeyView), &(pt->key_off));
+    pt->key_len = pChunk->buf_key.count;
+    
+    if (status) {
+      status = snspec_keep(pChunk, &(pChunk->buf_value),
+                            &(pt->pValueView), &(pt->value_off));
+      pt->value_len = pChunk->buf_value.count;
+    }
+    
+    pt->start_pos = pToken->offset +
+                      (pChunk->src.win_pos - pChunk->src.read_count);
+    pt->end_pos = pChunk->src.win_pos;
+    pt->src_status = pChunk->src.status;
+    memcpy(&(pt->filter), &(pChunk->filter), sizeof(SNFILTER));
+  }
+  
+  /* Count the token if it was stored */
+  if (status) {
+    (pChunk->tok_count)++;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Tokenize a chunk.
+ * 
+ * The source, filter, view flag, start, and stop of the chunk must be
+ * set up, and the tokens, arena, and out of memory flag must be
+ * cleared.  Tokens are read until one starts at or beyond the stop
+ * position, or until an error or the final token is read, or until the
+ * input ends.  See SNSPECCHUNK for what is recorded.
+ * 
+ * Only the chunk structure is modified, so different chunks can be
+ * tokenized at the same time on different threads.
+ * 
+ * Parameters:
+ * 
+ *   pChunk - the chunk to tokenize
+ */
+static void snspec_lex(SNSPECCHUNK *pChunk) {
+  
+  int first = 1;
+  int done = 0;
+  long pos = 0;
+  SNTOKEN tk;
+  
+  /* Initialize structures */
+  memset(&tk, 0, sizeof(SNTOKEN));
+  
+  /* Check parameter */
+  if (pChunk == NULL) {
+    abort();
+  }
+  
+  /* Set up the token structure */
+  tk.pKey = &(pChunk->buf_key);
+  tk.pValue = &(pChunk->buf_value);
+  tk.view = pChunk->view;
+  tk.unescape = pChunk->unescape;
+  tk.pChunk = NULL;
+  
+  /* Read tokens */
+  while (!done) {
+    
+    /* Find where the next token starts; nothing is skipped before any
+     * character has been read, which leaves the very first codepoint,
+     * along with the Byte Order Mark that may come before it, to
+     * sntoken_read() just as when reading sequentially */
+    pos = -1;
+    if (pChunk->filter.line_count > 0) {
+      sntk_skip(&(pChunk->src), &(pChunk->filter));
+      pos = snspec_pos(&(pChunk->src), &(pChunk->filter));
+    }
+    
+    /* Record the start of the first token */
+    if (first) {
+      pChunk->first_pos = pos;
+      memcpy(&(pChunk->first_filter), &(pChunk->filter),
+              sizeof(SNFILTER));
+      first = 0;
+    }
+    
+    /* Stop at the first token at or beyond the stop position, which is
+     * where the next chunk takes over */
+    if ((pChunk->stop >= 0) && (pos >= pChunk->stop)) {
+      pChunk->next_pos = pos;
+      memcpy(&(pChunk->next_filter), &(pChunk->filter),
+              sizeof(SNFILTER));
+      done = 1;
+    }
+    
+    /* Read and store the token */
+    if (!done) {
+      sntoken_read(&tk, &(pChunk->src), &(pChunk->filter));
+      
+      /* Errors caused by running out of memory are left to sequential
+       * reading, so they are handled the same way */
+      if ((tk.status < 0) &&
+            ((pChunk->buf_key.nomem) || (pChunk->buf_value.nomem))) {
+        pChunk->nomem = 1;
+        done = 1;
+      }
+      
+      if (!done) {
+        if (!snspec_push(pChunk, &tk)) {
+          pChunk->nomem = 1;
+          done = 1;
+        }
+      }
+      
+      if ((!done) &&
+            ((tk.status < 0) || (tk.status == SNTOKEN_FINAL))) {
+        done = 1;
+      }
+    }
+  }
+}
+
+#ifdef SHASTINA_THREADS
+/*
+ * Thread start routine that tokenizes a chunk with snspec_lex().
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to the SNSPECCHUNK to tokenize
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *snspec_thread(void *pArg) {
+  
+  /* Check parameter */
+  if (pArg == NULL) {
+    abort();
+  }
+  
+  /* Tokenize the chunk */
+  snspec_lex((SNSPECCHUNK *) pArg);
+  
+  /* No result */
+  return NULL;
+}
+#endif
+
+/*
+ * Read a new window of parallel tokenization.
+ * 
+ * Any existing window must have been dropped.  The window starts at the
+ * current state of the source and filter, which are not changed.
+ * 
+ * No window is read if parallel tokenization is disabled, the source
+ * is not whole or in a special status, the filter is in an EOF or
+ * error condition, or not enough input remains to split into at least
+ * two chunks.
+ * 
+ * Parameters:
+ * 
+ *   pSpec - the parallel tokenization state
+ * 
+ *   pIn - the source
+ * 
+ *   pFilter - the filter
+ * 
+ *   view - non-zero if tokens are read as views
+ * 
+ *   unescape - non-zero if string data is unescaped
+ * 
+ * Return:
+ * 
+ *   non-zero if a window was read, zero if not
+ */
+static int snspec_window(
+    SNSPEC   * pSpec,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter,
+    int        view,
+    int        unescape) {
+  
+  int status = 1;
+  int count = 0;
+  int i = 0;
+  long b = 0;
+  long from = 0;
+  const unsigned char *pLF = NULL;
+  SNSPECCHUNK *pc = NULL;
+  
+  /* Check parameters and state */
+  if ((pSpec == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  if (pSpec->chunk_count > 0) {
+    abort();
+  }
+  
+  /* Check that the source and filter can be split into chunks; the
+   * line count must leave room for every byte to be a line feed */
+  if ((pSpec->threads < 2) || (!(pIn->whole)) || (pIn->status != 0) ||
+      (pFilter->c < 0) ||
+      (pFilter->line_count >= LONG_MAX - pIn->win_len)) {
+    status = 0;
+  }
+  
+  /* Forget what is known about line feeds if the source changed */
+  if (status) {
+    if ((pSpec->pSrc != pIn) || (pSpec->pWin != pIn->pWin) ||
+        (pSpec->win_len != pIn->win_len)) {
+      pSpec->pSrc = pIn;
+      pSpec->pWin = pIn->pWin;
+      pSpec->win_len = pIn->win_len;
+      pSpec->lf_none = -1;
+    }
+  }
+  
+  /* Split the input into chunks, each ending right after the first
+   * line feed at or after the chunk size, and the last one ending at
+   * the end of the input if there are not enough line feeds */
+  if (status) {
+    b = pIn->win_pos;
+    for(i = 0; i < pSpec->threads; i++) {
+      pc = &((pSpec->pChunks)[i]);
+      pc->start = b;
+      pc->stop = -1;
+      count = i + 1;
+      
+      if (pSpec->chunk_size < pIn->win_len - b) {
+        from = b + pSpec->chunk_size;
+        if ((pSpec->lf_none < 0) || (from < pSpec->lf_none)) {
+          pLF = (const unsigned char *) memchr(pIn->pWin + from,
+                    ASCII_LF, (size_t) (pIn->win_len - from));
+          if (pLF != NULL) {
+            pc->stop = ((long) (pLF - pIn->pWin)) + 1;
+          } else {
+            pSpec->lf_none = from;
+          }
+        }
+      }
+      
+      if ((pc->stop < 0) || (pc->stop >= pIn->win_len)) {
+        pc->stop = -1;
+        break;
+      }
+      b = pc->stop;
+    }
+    
+    if (count < 2) {
+      status = 0;
+    }
+  }
+  
+  /* Set up the chunks, with every chunk after the first starting right
+   * after a line feed outside of any string or comment */
+  if (status) {
+    for(i = 0; i < count; i++) {
+      pc = &((pSpec->pChunks)[i]);
+      memcpy(&(pc->src), pIn, sizeof(SNSOURCE));
+      if (i == 0) {
+        memcpy(&(pc->filter), pFilter, sizeof(SNFILTER));
+      } else {
+        pc->src.win_pos = pc->start;
+        pc->src.win_clean = pc->start;
+        snfilter_reset(&(pc->filter));
+        pc->filter.line_count = 1;
+        pc->filter.c = ASCII_LF;
+      }
+      pc->buf_key.nomem = 0;
+      pc->buf_value.nomem = 0;
+      pc->view = view;
+      pc->unescape = unescape;
+      pc->tok_count = 0;
+      pc->arena_len = 0;
+      pc->first_pos = -1;
+      pc->next_pos = -1;
+      pc->nomem = 0;
+      pc->started = 0;
+    }
+  }
+  
+  /* Tokenize the chunks after the first on their own threads, falling
+   * back to the calling thread if a thread can't be started, then
+   * tokenize the first chunk and wait for the others */
+  if (status) {
+    for(i = 1; i < count; i++) {
+      pc = &((pSpec->pChunks)[i]);
+#ifdef SHASTINA_THREADS
+      if (pthread_create(&(pc->thread), NULL,
+                          &snspec_thread, (void *) pc) == 0) {
+        pc->started = 1;
+      }
+#endif
+      if (!(pc->started)) {
+        snspec_lex(pc);
+      }
+    }
+    
+    snspec_lex(&((pSpec->pChunks)[0]));
+    
+    for(i = 1; i < count; i++) {
+      pc = &((pSpec->pChunks)[i]);
+      if (pc->started) {
+#ifdef SHASTINA_THREADS
+        if (pthread_join(pc->thread, NULL) != 0) {
+          abort();
+        }
+#endif
+        pc->started = 0;
+      }
+    }
+  }
+  
+  /* Start reading tokens from the first chunk */
+  if (status) {
+    pSpec->chunk_count = count;
+    pSpec->cur = 0;
+    pSpec->cur_tok = 0;
+    pSpec->offset = 0;
+    pSpec->base_pos = pIn->win_pos;
+    pSpec->base_count = pIn->read_count;
+    pSpec->view = view;
+    pSpec->unescape = unescape;
+    pSpec->expect_pos = pIn->win_pos;
+    pSpec->expect_status = pIn->status;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Read the next token through parallel tokenization.
+ * 
+ * If parallel tokenization can't provide the next token, NULL is
+ * returned and nothing is changed, so the token must be read
+ * sequentially with sntoken_read() instead.  Otherwise, the token is
+ * returned, the key and value strings are written to *ppKey and
+ * *ppValue, and the source and filter are moved past the token exactly
+ * as if the token had been read sequentially.  The returned token and
+ * its strings remain valid until the next call.
+ * 
+ * The current window is used if the source is still where the last
+ * token of the window left it.  Otherwise, or if there is no current
+ * window, a new window is read.  See SNSPEC for how the tokens are
+ * checked.
+ * 
+ * This function must not be used in SNMODE_CHUNK mode.
+ * 
+ * Parameters:
+ * 
+ *   pSpec - the parallel tokenization state
+ * 
+ *   pIn - the source
+ * 
+ *   pFilter - the filter
+ * 
+ *   view - non-zero if tokens are read as views
+ * 
+ *   unescape - non-zero if string data is unescaped
+ * 
+ *   ppKey - receives the key string
+ * 
+ *   ppValue - receives the value string
+ * 
+ * Return:
+ * 
+ *   the token, or NULL if the token must be read sequentially
+ */
+static const SNSPECTOKEN *snspec_read(
+    SNSPEC    * pSpec,
+    SNSOURCE  * pIn,
+    SNFILTER  * pFilter,
+    int         view,
+    int         unescape,
+    char     ** ppKey,
+    char     ** ppValue) {
+  
+  int tries = 0;
+  long delta = 0;
+  SNSPECCHUNK *pc = NULL;
+  SNSPECCHUNK *pn = NULL;
+  SNSPECTOKEN *pt = NULL;
+#ifdef SHASTINA_STATS
+  long cp_count = 0;
+#endif
+  
+  /* Check parameters */
+  if ((pSpec == NULL) || (pIn == NULL) || (pFilter == NULL) ||
+      (ppKey == NULL) || (ppValue == NULL)) {
+    abort();
+  }
+  
+  /* Only proceed if enabled */
+  if (pSpec->threads >= 2) {
+    
+    /* Drop the window if the source was moved in any other way since
+     * the last token, or if the view or unescape flag changed */
+    if (pSpec->chunk_count > 0) {
+      if ((pSpec->pSrc != pIn) || (pSpec->pWin != pIn->pWin) ||
+          (pSpec->win_len != pIn->win_len) ||
+          (pSpec->expect_pos != pIn->win_pos) ||
+          (pSpec->expect_status != pIn->status) ||
+          (pSpec->view != view) || (pSpec->unescape != unescape)) {
+        snspec_drop(pSpec);
+      }
+    }
+    
+    /* Get a token from the current window, or from a new window if the
+     * current window doesn't have it */
+    for(tries = 0; (pt == NULL) && (tries < 2); tries++) {
+      
+      /* Read a new window if necessary */
+      if (pSpec->chunk_count < 1) {
+        if (!snspec_window(pSpec, pIn, pFilter, view, unescape)) {
+          break;
+        }
+      }
+      
+      /* Move on to the next chunk while the current one is used up,
+       * dropping the window if the next chunk doesn't continue exactly
+       * where the current one leaves off */
+      while (pSpec->cur_tok >=
+              (pSpec->pChunks)[pSpec->cur].tok_count) {
+        pc = &((pSpec->pChunks)[pSpec->cur]);
+        pn = NULL;
+        if (pSpec->cur + 1 < pSpec->chunk_count) {
+          pn = &((pSpec->pChunks)[pSpec->cur + 1]);
+        }
+        
+        if ((pn != NULL) && (pc->next_pos >= 0) &&
+            (pc->next_pos == pn->first_pos) &&
+            (pn->first_filter.c >= 0) &&
+            (pc->next_filter.c == pn->first_filter.c) &&
+            (pc->next_filter.pushback == pn->first_filter.pushback)) {
+          pSpec->offset = pSpec->offset +
+            (pc->next_filter.line_count - pn->first_filter.line_count);
+          (pSpec->cur)++;
+          pSpec->cur_tok = 0;
+        
+        } else {
+          snspec_drop(pSpec);
+          break;
+        }
+      }
+      
+      /* Take the next token of the current chunk */
+      if (pSpec->chunk_count > 0) {
+        pc = &((pSpec->pChunks)[pSpec->cur]);
+        pt = &((pc->pTok)[pSpec->cur_tok]);
+        (pSpec->cur_tok)++;
+      }
+    }
+  }
+  
+  /* Resolve the strings and move the source and filter past the
+   * token */
+  if (pt != NULL) {
+    if (pt->pKeyView != NULL) {
+      *ppKey = (char *) pt->pKeyView;
+    } else {
+      *ppKey = pc->pArena + pt->key_off;
+    }
+    if (pt->pValueView != NULL) {
+      *ppValue = (char *) pt->pValueView;
+    } else {
+      *ppValue = pc->pArena + pt->value_off;
+    }
+    
+    /* The filter state of the token counts codepoints from the start
+     * of its chunk, so count the codepoints of the token instead */
+#ifdef SHASTINA_STATS
+    cp_count = pFilter->cp_count;
+    snstats_add(&cp_count, snstats_text(pIn->pWin + pIn->win_pos,
+                                        pt->end_pos - pIn->win_pos));
+#endif
+    
+    delta = pt->end_pos - pSpec->base_pos;
+    pIn->win_pos = pt->end_pos;
+    pIn->win_clean = pt->end_pos;
+    pIn->status = pt->src_status;
+    if (pSpec->base_count <= LONG_MAX - delta) {
+      pIn->read_count = pSpec->base_count + delta;
+    } else {
+      pIn->read_count = LONG_MAX;
+    }
+    
+    memcpy(pFilter, &(pt->filter), sizeof(SNFILTER));
+    pFilter->line_count = pFilter->line_count + pSpec->offset;
+#ifdef SHASTINA_STATS
+    pFilter->cp_count = cp_count;
+#endif
+    
+    pSpec->expect_pos = pIn->win_pos;
+    pSpec->expect_status = pIn->status;
+  }
+  
+  /* Return the token or NULL */
+  return pt;
+}
+
+/*
+ * Work out the buffer limits of a Shastina reader.
+ * 
+ * pLimits is the buffer limits that the client gave, or NULL to use the
+ * defaults.  Fields that are zero or less also select the defaults.
+ * See the SNLIMITS structure in the header for further information.
+ * The limits with all the defaults filled in are written to pDest.
+ * 
+ * Parameters:
+ * 
+ *   pDest - receives the limits
+ * 
+ *   pLimits - the buffer limits, or NULL
+ */
+static void snreader_limits(SNLIMITS *pDest, const SNLIMITS *pLimits) {
+  
+  /* Check parameters */
+  if (pDest == NULL) {
+    abort();
+  }
+  
+  /* Start with the given limits, if any */
+  memset(pDest, 0, sizeof(SNLIMITS));
+  if (pLimits != NULL) {
+    memcpy(pDest, pLimits, sizeof(SNLIMITS));
+  }
+  
+  /* Fill in the default for each maximum that was not given */
+  if (pDest->key_max <= 0) {
+    pDest->key_max = SNREADER_KEY_MAX;
+  }
+  if (pDest->value_max <= 0) {
+    pDest->value_max = SNREADER_VAL_MAX;
+  }
+  if (pDest->nest_max <= 0) {
+    pDest->nest_max = SNREADER_AGSTACK_MAX;
+  }
+  
+  /* Fill in the default for each initial allocation that was not
+   * given, lowering it to the maximum if necessary */
+  if (pDest->key_init <= 0) {
+    pDest->key_init = SNREADER_KEY_INIT;
+    if (pDest->key_init > pDest->key_max) {
+      pDest->key_init = pDest->key_max;
+    }
+  }
+  if (pDest->value_init <= 0) {
+    pDest->value_init = SNREADER_VAL_INIT;
+    if (pDest->value_init > pDest->value_max) {
+      pDest->value_init = pDest->value_max;
+    }
+  }
+  if (pDest->nest_init <= 0) {
+    pDest->nest_init = SNREADER_AGSTACK_INIT;
+    if (pDest->nest_init > pDest->nest_max) {
+      pDest->nest_init = pDest->nest_max;
+    }
+  }
+}
+
+/*
+ * Initialize a Shastina reader state structure.
+ * 
+ * All Shastina readers must be initialized before they are used, or
+ * undefined behavior occurs.
+ * 
+ * Do not re-initialize a Shastina reader that is already initialized,
+ * or a memory leak may occur.
+ * 
+ * Shastina readers must be fully reset with snreader_reset() before
+ * they are released, or a memory leak may occur.
+ * 
+ * pLimits is the buffer limits to use, or NULL to use the defaults.
+ * Fields that are zero or less also select the defaults.  See the
+ * SNLIMITS structure in the header for further information.
+ * 
+ * pAlloc is the memory allocator for the buffers of the reader, which
+ * must remain allocated while the reader is in use.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader structure to initialize
+ * 
+ *   pLimits - the buffer limits, or NULL
+ * 
+ *   pAlloc - the memory allocator
+ */
+static void snreader_init(
+    SNREADER       * pReader,
+    const SNLIMITS * pLimits,
+    const SNALLOC  * pAlloc) {
+  
+  SNLIMITS lim;
+  
+  /* Initialize structures */
+  memset(&lim, 0, sizeof(SNLIMITS));
+  
+  /* Check parameters */
+  if ((pReader == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  
+  /* Fill in the defaults of the limits */
+  snreader_limits(&lim, pLimits);
+  
+  /* Initialize */
+  memset(pReader, 0, sizeof(SNREADER));
+  
+  pReader->status = 0;
+  pReader->queue_count = 0;
+  pReader->queue_read = 0;
+  pReader->mode = SNMODE_NORMAL;
+  pReader->mask = SNMASK_ALL;
+  pReader->pIndex = NULL;
+  pReader->offset = 0;
+  pReader->chunk.str_type = 0;
+  
+  snbuffer_init(&(pReader->buf_key),
+                lim.key_init, lim.key_max, pAlloc);
+  snbuffer_init(&(pReader->buf_value),
+                lim.value_init, lim.value_max, pAlloc);
+  
+  snstack_init(&(pReader->stack_array),
+                lim.nest_init, lim.nest_max, pAlloc);
+  snstack_init(&(pReader->stack_group),
+                lim.nest_init, lim.nest_max, pAlloc);
+  
+  pReader->meta_flag = 0;
+  pReader->array_flag = 0;
+  
+  snspec_init(&(pReader->spec), pAlloc);
+}
+
+/*
+ * Reset a Shastina reader back to its initial state.
+ * 
+ * If full is non-zero, a full reset will be performed.  If full is
+ * zero, a fast reset is performed.  A full reset releases all memory
+ * buffers, while a fast reset keeps the memory buffers allocated.  The
+ * mode of the reader is kept in both cases, and any error state is
+ * cleared, including the out of memory flags of the buffers and
+ * stacks.  A fast reset drops the window of parallel tokenization but
+ * keeps it enabled, while a full reset releases it and disables it.
+ * 
+ * A full reset must be performed on a reader before it is released, or
+ * a memory leak occurs.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader structure to reset
+ * 
+ *   full - non-zero for full reset, zero for fast reset
+ */
+static void snreader_reset(SNREADER *pReader, int full) {
+  
+  /* Check parameters */
+  if (pReader == NULL) {
+    abort();
+  }
+  
+  /* Reset buffers and stacks */
+  snbuffer_reset(&(pReader->buf_key), full);
+  snbuffer_reset(&(pReader->buf_value), full);
+  
+  snstack_reset(&(pReader->stack_array), full);
+  snstack_reset(&(pReader->stack_group), full);
+  
+  /* Clear the out of memory flags, which a fast reset of the buffers
+   * and stacks keeps, since the error state of the reader is cleared */
+  pReader->buf_key.nomem = 0;
+  pReader->buf_value.nomem = 0;
+  pReader->stack_array.nomem = 0;
+  pReader->stack_group.nomem = 0;
+  
+  /* Reset fields */
+  pReader->status = 0;
+  pReader->queue_count = 0;
+  pReader->queue_read = 0;
+  pReader->offset = 0;
+  
+  pReader->meta_flag = 0;
+  pReader->array_flag = 0;
+  
+  memset(&(pReader->chunk), 0, sizeof(SNSTRSTATE));
+  pReader->chunk.str_type = 0;
+  
+#ifdef SHASTINA_STATS
+  pReader->stats_eof = 0;
+#endif
+  
+  /* Drop or release parallel tokenization */
+  if (full) {
+    snspec_free(&(pReader->spec));
+  } else {
+    snspec_drop(&(pReader->spec));
+  }
+}
+
+/*
+ * Get the next entity from a Shastina source file, without copying it.
+ * 
+ * pReader is the reader object, which must be properly initialized.
+ * 
+ * pSpare is an entity structure that the function may fill in and
+ * return, for entities that are not in the queue of the reader.  Its
+ * state upon entry to the function is irrelevant.
+ * 
+ * pIn is the input source to read from.
+ * 
+ * pFilter is the input filter to pass the input through.  It must be
+ * properly initialized.
+ * 
+ * The return value points either to the entity at the front of the
+ * queue of the reader, or to pSpare.  The entity is consumed, so the
+ * next call returns the entity after it.  The entity is only valid
+ * until the next call.  The caller may modify the symbol field of the
+ * returned entity, but nothing else.
+ * 
+ * Once an error is encountered, the reader object will return that same
+ * error each time this function is called without doing anything
+ * further.  The exception is SNERR_MORE, which is returned when a feed
+ * source needs more input, and which is not stored in the reader.
+ * 
+ * Once the End Of File (EOF) entity is returned, this function will
+ * return the EOF entity on all subsequent calls without doing anything
+ * further.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pSpare - the spare entity
+ * 
+ *   pIn - the input source
+ * 
+ *   pFilter - the input filter
+ * 
+ * Return:
+ * 
+ *   pointer to the entity
+ */
+static SNENTITY *snreader_next(
+    SNREADER * pReader,
+    SNENTITY * pSpare,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter) {
+  
+  SNENTITY *pResult = NULL;
+  int err_code = 0;
+#ifdef SHASTINA_STATS
+  long read_count = 0;
+  long cp_count = 0;
+#endif
+#ifdef SHASTINA_STATS_TIME
+  long clk_start = 0;
+  long clk_token = 0;
+#endif
+  
+  /* Check parameters */
+  if ((pReader == NULL) || (pSpare == NULL) || (pIn == NULL) ||
+      (pFilter == NULL)) {
+    abort();
+  }
+  
+  /* Remember where the counts start */
+#ifdef SHASTINA_STATS
+  read_count = pIn->read_count;
+  cp_count = pFilter->cp_count;
+#endif
+#ifdef SHASTINA_STATS_TIME
+  clk_token = pReader->stats.clk_token;
+  clk_start = SNSTATS_CLOCK();
+#endif
+  
+  /* Entity cache sources replay their entities without tokenizing, so
+   * the reader state is not used for them, except that entities which
+   * are masked out are passed over */
+  if (pIn->cache) {
+    do {
+      sncache_replay((SNCACHESRC *) pIn->pCustom, pSpare, pFilter);
+    } while ((pSpare->status > 0) &&
+              (!(pReader->mask & SNMASK(pSpare->status))));
+    if (pSpare->status == SNENTITY_NUMERIC) {
+      snnum_decode(pSpare, pReader->mode);
+    }
+    pResult = pSpare;
+  
+  } else {
+    /* Fail immediately if reader is in error state */
+    err_code = pReader->status;
+    
+    /* Drop entities that are masked out from the front of the queue */
+    if (pReader->mask != SNMASK_ALL) {
+      snreader_drop(pReader);
+    }
+  
+    /* If queue is empty, fill it until something is in it, continuing a
+     * chunked string if one is in progress */
+    while ((!err_code) && (pReader->queue_count < 1)) {
+      if (pIn->feed) {
+        if (!snreader_feed(pReader, pIn, pFilter)) {
+          err_code = SNERR_MORE;
+        }
+      } else if (pReader->chunk.str_type != 0) {
+        snreader_chunk(pReader, pIn, pFilter);
+      } else {
+        snreader_fill(pReader, pIn, pFilter);
+      }
+      if (!err_code) {
+        err_code = pReader->status;
+      }
+      if ((!err_code) && (pReader->mask != SNMASK_ALL)) {
+        snreader_drop(pReader);
+      }
+    }
+  
+    /* Return either an entity or an error code */
+    if (!err_code) {
+      /* Return the current entity */
+      pResult = &(pReader->queue[pReader->queue_read]);
+      
+      /* If current entity is not EOF, then remove it from queue, which
+       * leaves it in place until the queue is filled again */
+      if (pResult->status != SNENTITY_EOF) {
+        
+        (pReader->queue_read)++;
+        if (pReader->queue_read >= pReader->queue_count) {
+          /* We've read everything in the queue, so clear it */
+          pReader->queue_count = 0;
+          pReader->queue_read = 0;
+        }
+      }
+    
+    } else {
+      /* Error status -- write into the spare entity, along with where
+       * reading stopped */
+      memset(pSpare, 0, sizeof(SNENTITY));
+      pSpare->status = err_code;
+      pSpare->offset = pIn->read_count;
+      pResult = pSpare;
+    }
+  }
+  
+  /* Count what was read, with the EOF entity only counted the first
+   * time it is returned, and the time spent outside of the token stage
+   * in the reader stage */
+#ifdef SHASTINA_STATS
+  snstats_add(&(pReader->stats.bytes), pIn->read_count - read_count);
+  snstats_add(&(pReader->stats.codepoints),
+              pFilter->cp_count - cp_count);
+  if (pResult->status > 0) {
+    snstats_add(&((pReader->stats.entities)[pResult->status]), 1);
+  } else if ((pResult->status == SNENTITY_EOF) &&
+              (!(pReader->stats_eof))) {
+    snstats_add(&((pReader->stats.entities)[SNENTITY_EOF]), 1);
+    pReader->stats_eof = 1;
+  }
+#endif
+#ifdef SHASTINA_STATS_TIME
+  snstats_add(&(pReader->stats.clk_reader),
+              (SNSTATS_CLOCK() - clk_start) -
+                (pReader->stats.clk_token - clk_token));
+#endif
+  
+  /* Return the entity */
+  return pResult;
+}
+
+/*
+ * Read an entity from a Shastina source file.
+ * 
+ * This is the same as snreader_next(), except that the entity is copied
+ * into pEntity.
+ * 
+ * pEntity is the entity structure that will be filled in.  Its state
+ * upon entry to the function is irrelevant.  Upon return, it will hold
+ * the results of the operation.  See the structure documentation for
+ * further information.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pEntity - pointer to the entity to receive the results
+ * 
+ *   pIn - the input source
+ * 
+ *   pFilter - the input filter
+ */
+static void snreader_read(
+    SNREADER * pReader,
+    SNENTITY * pEntity,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter) {
+  
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if (pEntity == NULL) {
+    abort();
+  }
+  
+  /* Get the next entity and copy it unless it is already there */
+  pe = snreader_next(pReader, pEntity, pIn, pFilter);
+  if (pe != pEntity) {
+    memcpy(pEntity, pe, sizeof(SNENTITY));
+  }
+}
+
+/*
+ * Drop the entities at the front of the queue of a reader whose kinds
+ * are masked out.
+ * 
+ * Entities are removed from the front of the queue for as long as
+ * their kind is not in the mask of the reader.  The EOF entity is never
+ * dropped, since its kind is always in the mask.  If every entity is
+ * dropped, the queue is cleared.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ */
+static void snreader_drop(SNREADER *pReader) {
+
+  /* Check parameter */
+  if (pReader == NULL) {
+    abort();
+  }
+  
+  /* Drop masked entities */
+  while ((pReader->queue_read < pReader->queue_count) &&
+          (!(pReader->mask &
+              SNMASK((pReader->queue)[pReader->queue_read].status)))) {
+    (pReader->queue_read)++;
+  }
+  
+  /* Clear the queue if everything was dropped */
+  if (pReader->queue_read >= pReader->queue_count) {
+    pReader->queue_count = 0;
+    pReader->queue_read = 0;
+  }
+}
+
+/*
+ * Find the structure that a skip starting at the current position of a
+ * reader has to skip over.
+ * 
+ * The current position is right after the last entity that was taken
+ * from the reader, whether it was returned or dropped because it was
+ * masked out.  The state of the reader reflects the last token that
+ * was read, which is further along if entities of that token are still
+ * waiting in the queue.  Since only the tokens "," and "]" and the
+ * first token of an array element queue more than one structural
+ * entity, the entities that remain in the queue tell where the current
+ * position is within such a token.
+ * 
+ * The innermost metacommand, group, or array that is open at the
+ * current position is the one skipped.  The return value is the kind
+ * of entity that closes it, which is SNENTITY_END_META,
+ * SNENTITY_END_GROUP, or SNENTITY_ARRAY.  *pDepth receives the number
+ * of groups that are open within the structure, which for an array are
+ * the special groups of its elements.  Zero is returned if nothing is
+ * open, or if the EOF entity has been read.
+ * 
+ * The reader must not be in an error state.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pDepth - receives the number of open groups
+ * 
+ * Return:
+ * 
+ *   the kind of entity that closes the structure, or zero
+ */
+static int snreader_skipstart(SNREADER *pReader, long *pDepth) {
+
+  int result = 0;
+  int next = -1;
+  int prev = -1;
+  
+  /* Check parameters and state */
+  if ((pReader == NULL) || (pDepth == NULL)) {
+    abort();
+  }
+  if (pReader->status) {
+    abort();
+  }
+  
+  /* Get the kinds of the next entity in the queue and the entity taken
+   * just before it, if there is a next entity */
+  *pDepth = 0;
+  if (pReader->queue_count > 0) {
+    next = (pReader->queue)[pReader->queue_read].status;
+    if (pReader->queue_read > 0) {
+      prev = (pReader->queue)[pReader->queue_read - 1].status;
+    }
+  }
+  
+  /* Work out the structure from the queue if the current position is in
+   * the middle of a token with several structural entities, or else
+   * from the state of the reader */
+  if (next == SNENTITY_EOF) {
+    /* Document is over, so nothing is open */
+    result = 0;
+  
+  } else if ((next == SNENTITY_BEGIN_GROUP) &&
+              (prev == SNENTITY_END_GROUP)) {
+    /* Between two elements of an array after "," */
+    result = SNENTITY_ARRAY;
+  
+  } else if (next == SNENTITY_ARRAY) {
+    /* After the last element of an array, before the end of "]" */
+    result = SNENTITY_ARRAY;
+  
+  } else if ((next == SNENTITY_BEGIN_GROUP) ||
+              (next == SNENTITY_BEGIN_META) ||
+              (next == SNENTITY_END_GROUP)) {
+    /* Inside an array element, either right after its special group
+     * was opened by the first token of the element, or before the
+     * special group is closed by "," or "]" */
+    result = SNENTITY_ARRAY;
+    *pDepth = 1;
+  
+  } else if (pReader->meta_flag) {
+    /* In a metacommand */
+    result = SNENTITY_END_META;
+  
+  } else if ((snstack_count(&(pReader->stack_group)) > 0) &&
+              (snstack_peek(&(pReader->stack_group)) > 0)) {
+    /* In a group */
+    result = SNENTITY_END_GROUP;
+  
+  } else if (snstack_count(&(pReader->stack_array)) > 0) {
+    /* In an array element with no group open in it -- if an array was
+     * just opened, it is the first token of this element, and no
+     * entity of the new array has been queued yet */
+    result = SNENTITY_ARRAY;
+    *pDepth = 1;
+  
+  } else {
+    /* Nothing is open */
+    result = 0;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Add an entity with no parameters (type "Z") to the queue of a given
+ * reader.
+ * 
+ * pReader is the reader to add the entity to.
+ * 
+ * entity is the SNENTITY_ constant describing the kind of entity.
+ * 
+ * The only entities allowed by this function are:
+ * 
+ *   - SNENTITY_EOF
+ *   - SNENTITY_BEGIN_META
+ *   - SNENTITY_END_META
+ *   - SNENTITY_BEGIN_GROUP
+ *   - SNENTITY_END_GROUP
+ * 
+ * Passing any other kind of entity code results in a fault.
+ * 
+ * The queue of the reader must not be full or this function will fault.
+ * See SNREADER_MAXQUEUE for more information.
+ * 
+ * If the reader is in an error state, this call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   entity - the entity code
+ */
+static void snreader_addEntityZ(SNREADER *pReader, int entity) {
+  
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if (pReader == NULL) {
+    abort();
+  }
+  if ((entity != SNENTITY_EOF) &&
+      (entity != SNENTITY_BEGIN_META) &&
+      (entity != SNENTITY_END_META) &&
+      (entity != SNENTITY_BEGIN_GROUP) &&
+      (entity != SNENTITY_END_GROUP)) {
+    abort();
+  }
+  
+  /* Proceed only if reader not in error state */
+  if (!(pReader->status)) {
+    /* Make sure room for another entity */
+    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
+      abort();
+    }
+    
+    /* Get entity pointer */
+    pe = &(pReader->queue[pReader->queue_count]);
+    
+    /* Fill in entity */
+    pe->status = entity;
+    pe->symbol = 0;
+    pe->num_type = SNNUMBER_NONE;
+    pe->num_int = 0;
+    pe->num_float = 0.0;
+    pe->offset = pReader->offset;
+    pe->pKey = NULL;
+    pe->key_len = 0;
+    pe->pValue = NULL;
+    pe->value_len = 0;
+    pe->str_type = 0;
+    pe->count = 0;
+    
+    /* Increase the entity count */
+    (pReader->queue_count)++;
+  }
+}
+
+/*
+ * Add an entity with one string parameter (type "S") to the queue of a
+ * given reader.
+ * 
+ * pReader is the reader to add the entity to.
+ * 
+ * entity is the SNENTITY_ constant describing the kind of entity.
+ * 
+ * s is the string parameter, and len is its length in bytes, which
+ * must be zero or greater.  The string need not be null-terminated.
+ * 
+ * The only entities allowed by this function are:
+ * 
+ *   - SNENTITY_META_TOKEN
+ *   - SNENTITY_NUMERIC
+ *   - SNENTITY_VARIABLE
+ *   - SNENTITY_CONSTANT
+ *   - SNENTITY_ASSIGN
+ *   - SNENTITY_GET
+ *   - SNENTITY_OPERATION
+ * 
+ * Passing any other kind of entity code results in a fault.
+ * 
+ * The queue of the reader must not be full or this function will fault.
+ * See SNREADER_MAXQUEUE for more information.
+ * 
+ * If the reader is in an error state, this call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   entity - the entity code
+ * 
+ *   s - the string parameter
+ * 
+ *   len - the length of the string parameter
+ */
+static void snreader_addEntityS(
+    SNREADER * pReader,
+    int        entity,
+    char     * s,
+    long       len) {
+  
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if ((pReader == NULL) || (s == NULL) || (len < 0)) {
+    abort();
+  }
+  if ((entity != SNENTITY_META_TOKEN) &&
+      (entity != SNENTITY_NUMERIC) &&
+      (entity != SNENTITY_VARIABLE) &&
+      (entity != SNENTITY_CONSTANT) &&
+      (entity != SNENTITY_ASSIGN) &&
+      (entity != SNENTITY_GET) &&
+      (entity != SNENTITY_OPERATION)) {
+    abort();
+  }
+  
+  /* Proceed only if reader not in error state */
+  if (!(pReader->status)) {
+    /* Make sure room for another entity */
+    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
+      abort();
+    }
+    
+    /* Get entity pointer */
+    pe = &(pReader->queue[pReader->queue_count]);
+    
+    /* Fill in entity */
+    pe->status = entity;
+    pe->symbol = 0;
+    pe->num_type = SNNUMBER_NONE;
+    pe->num_int = 0;
+    pe->num_float = 0.0;
+    pe->offset = pReader->offset;
+    pe->pValue = NULL;
+    pe->value_len = 0;
+    pe->str_type = 0;
+    pe->count = 0;
+    pe->pKey = s;
+    pe->key_len = len;
+    
+    /* Increase the entity count */
+    (pReader->queue_count)++;
+  }
+}
+
+/*
+ * Add an entity with one long parameter (type "L") to the queue of a
+ * given reader.
+ * 
+ * pReader is the reader to add the entity to.
+ * 
+ * entity is the SNENTITY_ constant describing the kind of entity.
+ * 
+ * l is the long parameter.
+ * 
+ * The only entities allowed by this function are:
+ * 
+ *   - SNENTITY_ARRAY
+ * 
+ * Passing any other kind of entity code results in a fault.
+ * 
+ * The queue of the reader must not be full or this function will fault.
+ * See SNREADER_MAXQUEUE for more information.
+ * 
+ * If the reader is in an error state, this call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   entity - the entity code
+ * 
+ *   l - the long value
+ */
+static void snreader_addEntityL(
+    SNREADER * pReader,
+    int        entity,
+    long       l) {
+  
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if (pReader == NULL) {
+    abort();
+  }
+  if (entity != SNENTITY_ARRAY) {
+    abort();
+  }
+  
+  /* Proceed only if reader not in error state */
+  if (!(pReader->status)) {
+    /* Make sure room for another entity */
+    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
+      abort();
+    }
+    
+    /* Get entity pointer */
+    pe = &(pReader->queue[pReader->queue_count]);
+    
+    /* Fill in entity */
+    pe->status = entity;
+    pe->symbol = 0;
+    pe->num_type = SNNUMBER_NONE;
+    pe->num_int = 0;
+    pe->num_float = 0.0;
+    pe->offset = pReader->offset;
+    pe->pKey = NULL;
+    pe->key_len = 0;
+    pe->pValue = NULL;
+    pe->value_len = 0;
+    pe->str_type = 0;
+    pe->count = l;
+    
+    /* Increase the entity count */
+    (pReader->queue_count)++;
+  }
+}
+
+/*
+ * Add an entity with prefix, type, and data parameters (type "T") to
+ * the queue of a given reader.
+ * 
+ * pReader is the reader to add the entity to.
+ * 
+ * entity is the SNENTITY_ constant describing the kind of entity.
+ * 
+ * pPrefix points to the prefix string, and prefix_len is its length in
+ * bytes.
+ * 
+ * str_type is the string type.  It must be one of the SNSTRING_
+ * constants.
+ * 
+ * pData points to the string data, and data_len is its length in
+ * bytes.
+ * 
+ * Neither string need be null-terminated, and both lengths must be
+ * zero or greater.
+ * 
+ * The only entities allowed by this function are:
+ * 
+ *   - SNENTITY_STRING
+ *   - SNENTITY_META_STRING
+ * 
+ * Passing any other kind of entity code results in a fault.
+ * 
+ * The queue of the reader must not be full or this function will fault.
+ * See SNREADER_MAXQUEUE for more information.
+ * 
+ * If the reader is in an error state, this call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   entity - the entity code
+ * 
+ *   pPrefix - the prefix string
+ * 
+ *   prefix_len - the length of the prefix string
+ * 
+ *   str_type - the string type
+ * 
+ *   pData - the string data
+ * 
+ *   data_len - the length of the string data
+ */
+static void snreader_addEntityT(
+    SNREADER * pReader,
+    int        entity,
+    char     * pPrefix,
+    long       prefix_len,
+    int        str_type,
+    char     * pData,
+    long       data_len) {
+  
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if ((pReader == NULL) || (pPrefix == NULL) || (pData == NULL) ||
+      (prefix_len < 0) || (data_len < 0)) {
+    abort();
+  }
+  if ((str_type != SNSTRING_QUOTED) && (str_type != SNSTRING_CURLY)) {
+    abort();
+  }
+  if ((entity != SNENTITY_STRING) &&
+      (entity != SNENTITY_META_STRING)) {
+    abort();
+  }
+  
+  /* Proceed only if reader not in error state */
+  if (!(pReader->status)) {
+    /* Make sure room for another entity */
+    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
+      abort();
+    }
+    
+    /* Get entity pointer */
+    pe = &(pReader->queue[pReader->queue_count]);
+    
+    /* Fill in entity */
+    pe->status = entity;
+    pe->symbol = 0;
+    pe->num_type = SNNUMBER_NONE;
+    pe->num_int = 0;
+    pe->num_float = 0.0;
+    pe->offset = pReader->offset;
+    pe->count = 0;
+    pe->pKey = pPrefix;
+    pe->key_len = prefix_len;
+    pe->str_type = str_type;
+    pe->pValue = pData;
+    pe->value_len = data_len;
+    
+    /* Increase the entity count */
+    (pReader->queue_count)++;
+  }
+}
+
+/*
+ * Add an entity belonging to a chunked string (type "C") to the queue
+ * of a given reader.
+ * 
+ * pReader is the reader to add the entity to.
+ * 
+ * entity is the SNENTITY_ constant describing the kind of entity.
+ * 
+ * str_type is the string type.  It must be one of the SNSTRING_
+ * constants.
+ * 
+ * pStr points to the string parameter, and len is its length in bytes,
+ * which must be zero or greater.  The string need not be
+ * null-terminated.  For BEGIN_STRING entities, this is the prefix.  For
+ * STRING_CHUNK entities, this is the chunk of string data.  For
+ * END_STRING entities, pStr must be NULL and len must be zero.
+ * 
+ * The only entities allowed by this function are:
+ * 
+ *   - SNENTITY_BEGIN_STRING
+ *   - SNENTITY_STRING_CHUNK
+ *   - SNENTITY_END_STRING
+ * 
+ * Passing any other kind of entity code results in a fault.
+ * 
+ * The queue of the reader must not be full or this function will fault.
+ * See SNREADER_MAXQUEUE for more information.
+ * 
+ * If the reader is in an error state, this call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   entity - the entity code
+ * 
+ *   str_type - the string type
+ * 
+ *   pStr - the string parameter, or NULL for END_STRING
+ * 
+ *   len - the length of the string parameter
+ */
+static void snreader_addEntityC(
+    SNREADER * pReader,
+    int        entity,
+    int        str_type,
+    char     * pStr,
+    long       len) {
+  
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if ((pReader == NULL) || (len < 0)) {
+    abort();
+  }
+  if ((str_type != SNSTRING_QUOTED) && (str_type != SNSTRING_CURLY)) {
+    abort();
+  }
+  if ((entity == SNENTITY_BEGIN_STRING) ||
+      (entity == SNENTITY_STRING_CHUNK)) {
+    if (pStr == NULL) {
+      abort();
+    }
+  } else if (entity == SNENTITY_END_STRING) {
+    if ((pStr != NULL) || (len != 0)) {
+      abort();
+    }
+  } else {
+    abort();
+  }
+  
+  /* Proceed only if reader not in error state */
+  if (!(pReader->status)) {
+    /* Make sure room for another entity */
+    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
+      abort();
+    }
+    
+    /* Get entity pointer */
+    pe = &(pReader->queue[pReader->queue_count]);
+    
+    /* Fill in entity */
+    pe->status = entity;
+    pe->symbol = 0;
+    pe->num_type = SNNUMBER_NONE;
+    pe->num_int = 0;
+    pe->num_float = 0.0;
+    pe->offset = pReader->offset;
+    pe->str_type = str_type;
+    pe->pKey = NULL;
+    pe->key_len = 0;
+    pe->pValue = NULL;
+    pe->value_len = 0;
+    pe->count = 0;
+    if (entity == SNENTITY_BEGIN_STRING) {
+      pe->pKey = pStr;
+      pe->key_len = len;
+    
+    } else if (entity == SNENTITY_STRING_CHUNK) {
+      pe->pValue = pStr;
+      pe->value_len = len;
+    }
+    
+    /* Increase the entity count */
+    (pReader->queue_count)++;
+  }
+}
+
+/*
+ * Perform the array prefix operation.
+ * 
+ * This should be performed before processing any token except for "]".
+ * 
+ * pReader is the reader object.  The reader must not be in an error
+ * state, or a fault occurs.
+ * 
+ * This operation only does something if the array flag is on.  In that
+ * case, the array flag is turned off, the array and grouping stacks are
+ * adjusted to indicate a new array, and a BEGIN_GROUP entity is added
+ * to the reader.
+ * 
+ * These are operations that should have properly been done when the "["
+ * token was processed.  But that token needs to know whether the array
+ * is empty (followed immediately by a "]" token) or non-empty.  Hence,
+ * it sets the array flag and its processing is delayed until the next
+ * token, which calls into this array prefix operation to do the delayed
+ * array operation if the array flag is set.
+ * 
+ * This is therefore done before every token except for "]", which
+ * handles the situation differently because the empty array case is
+ * different.  Hence, this function must *not* be called before the "]"
+ * token.
+ * 
+ * This function may set the reader into an error state.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ */
+static void snreader_arrayPrefix(SNREADER *pReader) {
+  
+  int err_code = 0;
+  
+  /* Check parameter and state */
+  if (pReader == NULL) {
+    abort();
+  }
+  if (pReader->status) {
+    abort();
+  }
+  
+  /* Only do something if array flag is set */
+  if (pReader->array_flag) {
+    
+    /* Clear the array flag */
+    pReader->array_flag = 0;
+    
+    /* Push a value of one on top of the array stack and a value of zero
+     * on top of the grouping stack to begin a new array */
+    if (!snstack_push(&(pReader->stack_array), 1)) {
+      err_code = SNERR_DEEPARRAY;
+    }
+    
+    if (!err_code) {
+      if (!snstack_push(&(pReader->stack_group), 0)) {
+        err_code = SNERR_DEEPARRAY;
+      }
+    }
+    
+    /* Add a BEGIN_GROUP entity */
+    if (!err_code) {
+      snreader_addEntityZ(pReader, SNENTITY_BEGIN_GROUP);
+    }
+    
+    /* If error, set error in reader */
+    if (err_code) {
+      pReader->status = err_code;
+    }
+  }
+}
+
+/* 
+ * Read a token from a Shastina source file in an effort to fill the
+ * entity queue.
+ * 
+ * Clients should not use this function directly.  Use snreader_read()
+ * instead (which makes use of this function).
+ * 
+ * The reader must not be in an error state and the queue must be empty.
+ * If these conditions are not satisfied, a fault occurs.  A fault may
+ * also occur if SNREADER_MAXQUEUE is not large enough -- see that
+ * constant for further information.
+ * 
+ * Not all tokens result in entities being read, so to ensure the entity
+ * buffer is filled with at least one entity, call this function in a
+ * loop.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pIn - the input file
+ * 
+ *   pFilter - the filter to pass input through
+ */
+static void snreader_fill(
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter) {
+  
+  int err_code = 0;
+  int prim = 0;
+  int kind = 0;
+  int discard = 0;
+  int mark = 0;
+  char *pks = NULL;
+  char *pvs = NULL;
+  long klen = 0;
+  long vlen = 0;
+  const SNSPECTOKEN *pst = NULL;
+#ifdef SHASTINA_STATS_TIME
+  long clk_start = 0;
+#endif
+  SNTOKEN tk;
+  
+  /* Initialize structures */
+  memset(&tk, 0, sizeof(SNTOKEN));
+  
+  /* Check parameters and state */
+  if ((pReader == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  if (pReader->status) {
+    abort();
+  }
+  if (pReader->queue_count > 0) {
+    abort();
+  }
+  
+  /* If grouping stack is empty, initialize it with a value of zero,
+   * which can only fail if out of memory */
+  if (snstack_count(&(pReader->stack_group)) < 1) {
+    if (!snstack_push(&(pReader->stack_group), 0)) {
+      err_code = SNERR_NOMEM;
+    }
+  }
+  
+  /* Start recording a checkpoint before the token if an index is
+   * attached */
+  if ((!err_code) && (pReader->pIndex != NULL)) {
+    mark = snindex_record(pReader->pIndex, pReader, pIn, pFilter);
+  }
+  
+  /* Read a token */
+  if (!err_code) {
+    tk.pKey = &(pReader->buf_key);
+    tk.pValue = &(pReader->buf_value);
+    if ((pReader->mode & SNMODE_VIEW) && (snsource_view(pIn) != NULL)) {
+      tk.view = 1;
+    } else {
+      tk.view = 0;
+    }
+    if (pReader->mode & SNMODE_UNESCAPE) {
+      tk.unescape = 1;
+    } else {
+      tk.unescape = 0;
+    }
+    if (pReader->mode & SNMODE_CHUNK) {
+      tk.pChunk = &(pReader->chunk);
+    } else {
+      tk.pChunk = NULL;
+    }
+    
+    /* If no entity that would hold the string data of a string token
+     * is returned, scan the data without buffering it */
+    if (pReader->meta_flag) {
+      kind = SNENTITY_META_STRING;
+    } else {
+      kind = SNENTITY_STRING;
+    }
+    discard = 0;
+    if ((!(pReader->mask & SNMASK(kind))) && ((tk.pChunk == NULL) ||
+          (!(pReader->mask & SNMASK(SNENTITY_STRING_CHUNK))))) {
+      discard = 1;
+    }
+    if (discard != pReader->buf_value.discard) {
+      snbuffer_discard(&(pReader->buf_value), discard);
+    }
+    
+    /* Take the token from parallel tokenization if possible, which is
+     * never used for chunked strings */
+#ifdef SHASTINA_STATS_TIME
+    clk_start = SNSTATS_CLOCK();
+#endif
+    if (tk.pChunk == NULL) {
+      pst = snspec_read(&(pReader->spec), pIn, pFilter, tk.view,
+                        tk.unescape, &pks, &pvs);
+    }
+    
+    if (pst != NULL) {
+      tk.status = pst->status;
+      tk.str_type = pst->str_type;
+      tk.offset = pIn->read_count - (pst->end_pos - pst->start_pos);
+      klen = pst->key_len;
+      vlen = pst->value_len;
+    
+    } else {
+      sntoken_read(&tk, pIn, pFilter);
+      if (tk.status >= 0) {
+        pks = snbuffer_get(tk.pKey);
+        klen = tk.pKey->count;
+        pvs = snbuffer_get(tk.pValue);
+        vlen = tk.pValue->count;
+      }
+    }
+    
+#ifdef SHASTINA_STATS_TIME
+    snstats_add(&(pReader->stats.clk_token),
+                SNSTATS_CLOCK() - clk_start);
+#endif
+    
+    if (tk.status < 0) {
+      err_code = tk.status;
+    }
+    pReader->offset = tk.offset;
+    
+    /* If a feed source ran out of input while reading the token, then
+     * the token might continue, so it must be read again later */
+    if (snsource_starved(pIn)) {
+      err_code = SNERR_MORE;
+    }
+    
+    /* Commit the checkpoint under the offset of the token */
+    if (mark && (!err_code)) {
+      snindex_commit(pReader->pIndex, tk.offset);
+    }
+  }
+  
+  /* Count the token, unless it has to be read again */
+#ifdef SHASTINA_STATS
+  if (!err_code) {
+    if (tk.status == SNTOKEN_SIMPLE) {
+      snstats_add(&(pReader->stats.tok_simple), 1);
+    } else if (tk.status == SNTOKEN_STRING) {
+      snstats_add(&(pReader->stats.tok_string), 1);
+    } else if (tk.status == SNTOKEN_FINAL) {
+      snstats_add(&(pReader->stats.tok_final), 1);
+    }
+  }
+#endif
+  
+  /* For simple tokens, get the primitive type selected by the first
+   * character */
+  if (!err_code) {
+    if (tk.status == SNTOKEN_SIMPLE) {
+      prim = SNCHAR_GETPRIM(snchar_class(((unsigned char *) pks)[0]));
+    }
+  }
+  
+  /* Perform array prefix operation if not in metacommand mode, except
+   * for "]" token */
+  if ((!err_code) && (!pReader->meta_flag)) {
+    if (tk.status == SNTOKEN_SIMPLE) {
+      if (prim != SNPRIM_RSQR) {
+        /* Simple token except for "]" */
+        snreader_arrayPrefix(pReader);
+      }
+    
+    } else {
+      /* Not in metacommand mode and not a simple token */
+      snreader_arrayPrefix(pReader);
+    }
+    
+    /* Check for errors from the prefix operation */
+    err_code = pReader->status;
+  }
+  
+  /* Handle the token types */
+  if ((tk.status == SNTOKEN_SIMPLE) && (!err_code)) {
+    /* Simple token -- handle non-primitive and primitive cases */
+    if (prim == SNPRIM_PERCENT) {
+      /* % token -- enter metacommand mode */
+      if (!pReader->meta_flag) {
+        pReader->meta_flag = 1;
+        snreader_addEntityZ(pReader, SNENTITY_BEGIN_META);
+      
+      } else {
+        /* Nested metacommands */
+        err_code = SNERR_METANEST;
+      }
+    
+    } else if (prim == SNPRIM_SEMICOLON) {
+      /* ; token -- leave metacommand mode */
+      if (pReader->meta_flag) {
+        pReader->meta_flag = 0;
+        snreader_addEntityZ(pReader, SNENTITY_END_META);
+      
+      } else {
+        /* Semicolon outside of metacommand */
+        err_code = SNERR_SEMICOLON;
+      }
+    
+    } else if (pReader->meta_flag) {
+      /* Other simple tokens in metacommand mode */
+      snreader_addEntityS(pReader, SNENTITY_META_TOKEN, pks, klen);
+    
+    } else {
+      /* Primitive tokens -- dispatch on the primitive type selected by
+       * the first character */
+      switch (prim) {
+        
+        case SNPRIM_NUMERIC:
+          /* Numeric token, decoded if the mode asks for it */
+          snreader_addEntityS(pReader, SNENTITY_NUMERIC, pks, klen);
+          snnum_decode(&(pReader->queue[pReader->queue_count - 1]),
+                        pReader->mode);
+          break;
+        
+        case SNPRIM_VARIABLE:
+          /* Declare variable */
+          snreader_addEntityS(pReader, SNENTITY_VARIABLE,
+                              (pks + 1), (klen - 1));
+          break;
+        
+        case SNPRIM_CONSTANT:
+          /* Declare constant */
+          snreader_addEntityS(pReader, SNENTITY_CONSTANT,
+                              (pks + 1), (klen - 1));
+          break;
+        
+        case SNPRIM_ASSIGN:
+          /* Assign variable */
+          snreader_addEntityS(pReader, SNENTITY_ASSIGN,
+                              (pks + 1), (klen - 1));
+          break;
+        
+        case SNPRIM_GET:
+          /* Get variable or constant value */
+          snreader_addEntityS(pReader, SNENTITY_GET,
+                              (pks + 1), (klen - 1));
+          break;
+        
+        case SNPRIM_LPAREN:
+          /* Begin group */
+          if (snstack_inc(&(pReader->stack_group))) {
+            snreader_addEntityZ(pReader, SNENTITY_BEGIN_GROUP);
+          } else {
+            /* Too much group nesting */
+            err_code = SNERR_DEEPGROUP;
+          }
+          break;
+        
+        case SNPRIM_RPAREN:
+          /* End group */
+          if (snstack_dec(&(pReader->stack_group))) {
+            snreader_addEntityZ(pReader, SNENTITY_END_GROUP);
+          } else {
+            /* Closing parenthesis without an opening parenthesis */
+            err_code = SNERR_RPAREN;
+          }
+          break;
+        
+        case SNPRIM_LSQR:
+          /* Begin array */
+          pReader->array_flag = 1;
+          break;
+        
+        case SNPRIM_RSQR:
+          /* End array */
+          if (!(pReader->array_flag)) {
+            /* Non-empty array -- check that array stack is not empty
+             * and that value on top of grouping stack is zero, then
+             * perform operation */
+            if (snstack_count(&(pReader->stack_array)) > 0) {
+              if (snstack_peek(&(pReader->stack_group)) == 0) {
+                snreader_addEntityZ(pReader, SNENTITY_END_GROUP);
+                snreader_addEntityL(pReader, SNENTITY_ARRAY,
+                  snstack_pop(&(pReader->stack_array)));
+                snstack_pop(&(pReader->stack_group));
+              
+              } else {
+                /* Still unclosed parentheses in current element */
+                err_code = SNERR_OPENGROUP;
+              }
+            
+            } else {
+              /* "]" without a corresponding opening bracket */
+              err_code = SNERR_RSQR;
+            }
+          
+          } else {
+            /* Empty array */
+            pReader->array_flag = 0;
+            snreader_addEntityL(pReader, SNENTITY_ARRAY, 0);
+          }
+          break;
+        
+        case SNPRIM_COMMA:
+          /* Array separator -- check that array stack is not empty and
+           * that value on top of grouping stack is zero, then perform
+           * operation */
+          if (snstack_count(&(pReader->stack_array)) > 0) {
+            if (snstack_peek(&(pReader->stack_group)) == 0) {
+              if (snstack_inc(&(pReader->stack_array))) {
+                snreader_addEntityZ(pReader, SNENTITY_END_GROUP);
+                snreader_addEntityZ(pReader, SNENTITY_BEGIN_GROUP);
+              
+              } else {
+                /* Too many array elements */
+                err_code = SNERR_LONGARRAY;
+              }
+            
+            } else {
+              /* Open parentheses in current element */
+              err_code = SNERR_OPENGROUP;
+            }
+          
+          } else {
+            /* Comma used outside of array */
+            err_code = SNERR_COMMA;
+          }
+          break;
+        
+        case SNPRIM_OPERATION:
+          /* Operator */
+          snreader_addEntityS(pReader, SNENTITY_OPERATION, pks, klen);
+          break;
+        
+        default:
+          /* Unknown primitive type */
+          abort();
+      }
+    }
+  
+  } else if ((tk.status == SNTOKEN_STRING) && (!err_code)) {
+    /* String token -- either the start of a chunked string, a normal
+     * string, or a meta string */
+    if (pReader->chunk.str_type != 0) {
+      /* Chunked string, which is continued by snreader_chunk() */
+      snreader_addEntityC(pReader, SNENTITY_BEGIN_STRING,
+        tk.str_type, pks, klen);
+      snreader_addEntityC(pReader, SNENTITY_STRING_CHUNK,
+        tk.str_type, pvs, vlen);
+    
+    } else if (pReader->meta_flag) {
+      /* Meta string */
+      snreader_addEntityT(pReader, SNENTITY_META_STRING,
+        pks, klen, tk.str_type, pvs, vlen);
+    } else {
+      /* Normal string */
+      snreader_addEntityT(pReader, SNENTITY_STRING,
+        pks, klen, tk.str_type, pvs, vlen);
+    }
+  
+  } else if ((tk.status == SNTOKEN_FINAL) && (!err_code)) {
+    /* Final token */
+    if (!(pReader->meta_flag)) {
+      if ((!pReader->array_flag) &&
+            (snstack_count(&(pReader->stack_array)) == 0)) {
+        if (snstack_peek(&(pReader->stack_group)) == 0) {
+          
+          /* Add the EOF entity */
+          snreader_addEntityZ(pReader, SNENTITY_EOF);
+        
+        } else {
+          /* Open parentheses group remains */
+          err_code = SNERR_OPENGROUP;
+        }
+      } else {
+        /* Open array remains */
+        err_code = SNERR_OPENARRAY;
+      }
+    } else {
+      /* Open metacommand remains */
+      err_code = SNERR_OPENMETA;
+    }
+  
+  } else if (!err_code) {
+    /* Unknown token type */
+    abort();
+  }
+  
+  /* Error if now an error state in reader */
+  if (!err_code) {
+    err_code = pReader->status;
+  }
+  
+  /* If memory ran out, report that instead of the error it caused */
+  if (err_code && snreader_nomem(pReader)) {
+    err_code = SNERR_NOMEM;
+  }
+  
+  /* If error, set error in reader */
+  if (err_code) {
+    pReader->status = err_code;
+  }
+}
+
+/*
+ * Read the next chunk of a chunked string in an effort to fill the
+ * entity queue.
+ * 
+ * Clients should not use this function directly.  Use snreader_read()
+ * instead (which makes use of this function).
+ * 
+ * The reader must not be in an error state, the queue must be empty,
+ * and a chunked string must be in progress, which means the str_type
+ * field of the chunk state is non-zero.  A chunked string is started by
+ * snreader_fill() in SNMODE_CHUNK mode when a string does not fit in
+ * the value buffer.  If these conditions are not satisfied, a fault
+ * occurs.
+ * 
+ * A STRING_CHUNK entity is added for the next chunk of string data.
+ * If this is the end of the string, an END_STRING entity is then added
+ * and the chunked string is finished.  An empty last chunk is left out,
+ * so that only the END_STRING entity is added.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pIn - the input file
+ * 
+ *   pFilter - the filter to pass input through
+ */
+static void snreader_chunk(
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter) {
+  
+  int err_code = 0;
+  int str_type = 0;
+  int view = 0;
+  int unescape = 0;
+  int discard = 0;
+  SNBUFFER *pValue = NULL;
+#ifdef SHASTINA_STATS_TIME
+  long clk_start = 0;
+#endif
+  
+  /* Check parameters and state */
+  if ((pReader == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  if (pReader->status) {
+    abort();
+  }
+  if ((pReader->queue_count > 0) || (pReader->chunk.str_type == 0)) {
+    abort();
+  }
+  
+  /* Get the string type and the value buffer, and determine whether
+   * the chunk can be a view and whether it is unescaped */
+  str_type = pReader->chunk.str_type;
+  pValue = &(pReader->buf_value);
+  if ((pReader->mode & SNMODE_VIEW) && (snsource_view(pIn) != NULL)) {
+    view = 1;
+  } else {
+    view = 0;
+  }
+  if (pReader->mode & SNMODE_UNESCAPE) {
+    unescape = 1;
+  } else {
+    unescape = 0;
+  }
+  
+  /* Scan the chunk without buffering it if chunks aren't returned */
+  if (pReader->mask & SNMASK(SNENTITY_STRING_CHUNK)) {
+    discard = 0;
+  } else {
+    discard = 1;
+  }
+  if (discard != pValue->discard) {
+    snbuffer_discard(pValue, discard);
+  }
+  
+  /* Read the next chunk of string data, which starts at the current
+   * position of the source */
+  pReader->offset = pIn->read_count;
+#ifdef SHASTINA_STATS_TIME
+  clk_start = SNSTATS_CLOCK();
+#endif
+  if (str_type == SNSTRING_QUOTED) {
+    err_code = snstr_readQuoted(pValue, pIn, pFilter, view, unescape,
+                                &(pReader->chunk));
+  
+  } else if (str_type == SNSTRING_CURLY) {
+    err_code = snstr_readCurlied(pValue, pIn, pFilter, view, unescape,
+                                  &(pReader->chunk));
+  
+  } else {
+    /* Unknown string type */
+    abort();
+  }
+#ifdef SHASTINA_STATS_TIME
+  snstats_add(&(pReader->stats.clk_token), SNSTATS_CLOCK() - clk_start);
+#endif
+  
+  /* If a feed source ran out of input while reading the chunk, then
+   * the chunk must be read again later */
+  if (snsource_starved(pIn)) {
+    err_code = SNERR_MORE;
+  }
+  
+  /* Add the chunk unless it is an empty last chunk, and then add the
+   * end of the string if it was finished */
+  if ((err_code == 0) || (err_code == SNSTR_PARTIAL)) {
+    if ((err_code == SNSTR_PARTIAL) || (pValue->count > 0)) {
+      snreader_addEntityC(pReader, SNENTITY_STRING_CHUNK,
+        str_type, snbuffer_get(pValue), pValue->count);
+    }
+    if (err_code == 0) {
+      snreader_addEntityC(pReader, SNENTITY_END_STRING,
+        str_type, NULL, 0);
+    }
+    err_code = 0;
+  }
+  
+  /* Error if now an error state in reader */
+  if (!err_code) {
+    err_code = pReader->status;
+  }
+  
+  /* If memory ran out, report that instead of the error it caused */
+  if (err_code && snreader_nomem(pReader)) {
+    err_code = SNERR_NOMEM;
+  }
+  
+  /* If error, set error in reader */
+  if (err_code) {
+    pReader->status = err_code;
+  }
+}
+
+/*
+ * Fill the entity queue from a feed source, undoing the attempt if the
+ * source runs out of input.
+ * 
+ * Clients should not use this function directly.  Use snreader_read()
+ * instead (which makes use of this function).
+ * 
+ * The same conditions apply as for snreader_fill(), and pIn must be a
+ * feed source.  snreader_chunk() is used instead of snreader_fill() if
+ * a chunked string is in progress.
+ * 
+ * If the source runs out of input before the end of input has been
+ * marked, then the position of the source, the state of the input
+ * filter, and the state of the reader are all restored to what they
+ * were before the call, so that the same token can be read again from
+ * its start once more input has been pushed.  This only works because
+ * snreader_fill() and snreader_chunk() don't change anything else in
+ * the reader until they have read all the input they need.  If the
+ * previous attempt was undone and nothing has been pushed since, then
+ * the function returns zero right away.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pIn - the feed source
+ * 
+ *   pFilter - the filter to pass input through
+ * 
+ * Return:
+ * 
+ *   non-zero if the attempt was completed, zero if it was undone
+ *   because more input is needed
+ */
+static int snreader_feed(
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter) {
+  
+  int result = 1;
+  long win_pos = 0;
+  long win_clean = 0;
+  long read_count = 0;
+  int status = 0;
+  SNFEEDSRC *pFeed = NULL;
+  SNFILTER filter;
+  SNSTRSTATE chunk;
+  
+  /* Initialize structures */
+  memset(&filter, 0, sizeof(SNFILTER));
+  memset(&chunk, 0, sizeof(SNSTRSTATE));
+  
+  /* Check parameters */
+  if ((pReader == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  if (!(pIn->feed)) {
+    abort();
+  }
+  pFeed = (SNFEEDSRC *) pIn->pCustom;
+  
+  /* Don't try again if nothing was pushed since the last attempt ran
+   * out of input */
+  if (pFeed->hungry) {
+    result = 0;
+  }
+  
+  /* Remember the state that reading input changes */
+  win_pos = pIn->win_pos;
+  win_clean = pIn->win_clean;
+  read_count = pIn->read_count;
+  status = pIn->status;
+  memcpy(&filter, pFilter, sizeof(SNFILTER));
+  memcpy(&chunk, &(pReader->chunk), sizeof(SNSTRSTATE));
+  
+  /* Make the attempt */
+  if (result) {
+    pFeed->starved = 0;
+    if (pReader->chunk.str_type != 0) {
+      snreader_chunk(pReader, pIn, pFilter);
+    } else {
+      snreader_fill(pReader, pIn, pFilter);
+    }
+  }
+  
+  /* If more input is needed, undo the attempt */
+  if (result && (pReader->status == SNERR_MORE)) {
+    pIn->win_pos = win_pos;
+    pIn->win_clean = win_clean;
+    pIn->read_count = read_count;
+    pIn->status = status;
+    memcpy(pFilter, &filter, sizeof(SNFILTER));
+    memcpy(&(pReader->chunk), &chunk, sizeof(SNSTRSTATE));
+    pReader->status = 0;
+    pFeed->starved = 0;
+    pFeed->hungry = 1;
+    result = 0;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Check whether a reader has run out of memory.
+ * 
+ * This is the case if the out of memory flag of any of the buffers or
+ * stacks of the reader is set.  Running out of memory makes buffers
+ * and stacks fail as if they were out of capacity, so this is used to
+ * report the resulting errors as SNERR_NOMEM instead.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ * Return:
+ * 
+ *   non-zero if out of memory, zero otherwise
+ */
+static int snreader_nomem(SNREADER *pReader) {
+  
+  int result = 0;
+  
+  /* Check parameter */
+  if (pReader == NULL) {
+    abort();
+  }
+  
+  /* Check all the flags */
+  if (pReader->buf_key.nomem || pReader->buf_value.nomem ||
+      pReader->stack_array.nomem || pReader->stack_group.nomem) {
+    result = 1;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Start recording a checkpoint in an offset index if the reader is at
+ * a point where one can be recorded.
+ * 
+ * This is called by snreader_fill() right before it reads a token.  A
+ * checkpoint is only recorded if no array is open, the source is not a
+ * feed or entity cache source, and the read count of the source is at
+ * least the spacing of the index past the last checkpoint, or past the
+ * start of input if there are no checkpoints yet.
+ * 
+ * The checkpoint is stored in the element after the last checkpoint,
+ * but it is not counted until snindex_commit() is called once the
+ * token has been read successfully.  If the checkpoint list can not
+ * grow, the index is marked as full and nothing further is recorded in
+ * it.
+ * 
+ * Parameters:
+ * 
+ *   pIndex - the offset index
+ * 
+ *   pReader - the reader that is about to read a token
+ * 
+ *   pIn - the input source
+ * 
+ *   pFilter - the input filter
+ * 
+ * Return:
+ * 
+ *   non-zero if a checkpoint was stored and should be committed, zero
+ *   otherwise
+ */
+static int snindex_record(
+    SNINDEX  * pIndex,
+    SNREADER * pReader,
+    SNSOURCE * pIn,
+    SNFILTER * pFilter) {
+  
+  int result = 0;
+  long last = 0;
+  long cap = 0;
+  SNCHECKPOINT *pNew = NULL;
+  SNCHECKPOINT *pc = NULL;
+  
+  /* Check parameters */
+  if ((pIndex == NULL) || (pReader == NULL) ||
+      (pIn == NULL) || (pFilter == NULL)) {
+    abort();
+  }
+  
+  /* Only record outside of arrays, on sources that can be moved to the
+   * checkpoint later, and while the filter is not in an error state */
+  if ((!(pIndex->full)) && (!(pIn->feed)) && (!(pIn->cache)) &&
+      (pIn->read_count < LONG_MAX) &&
+      (pFilter->c >= 0) &&
+      (snstack_count(&(pReader->stack_array)) == 0) &&
+      (snstack_count(&(pReader->stack_group)) == 1) &&
+      (!(pReader->array_flag)) && (pReader->chunk.str_type == 0)) {
+    
+    /* Only record if far enough past the last checkpoint */
+    if (pIndex->count > 0) {
+      last = (pIndex->pList)[pIndex->count - 1].pos;
+    } else {
+      last = 0;
+    }
+    if ((pIn->read_count > last) &&
+        (pIn->read_count - last >= pIndex->spacing)) {
+      
+      /* Allocate or grow the checkpoint list if necessary */
+      if (pIndex->pList == NULL) {
+        pIndex->pList = (SNCHECKPOINT *) snalloc_get(&(pIndex->alloc),
+                    SNINDEX_INIT * ((long) sizeof(SNCHECKPOINT)));
+        if (pIndex->pList != NULL) {
+          pIndex->cap = SNINDEX_INIT;
+        } else {
+          pIndex->full = 1;
+        }
+      
+      } else if (pIndex->count >= pIndex->cap) {
+        pNew = NULL;
+        if (pIndex->cap <=
+              LONG_MAX / 2 / ((long) sizeof(SNCHECKPOINT))) {
+          cap = pIndex->cap * 2;
+          pNew = (SNCHECKPOINT *) snalloc_resize(&(pIndex->alloc),
+                    pIndex->pList,
+                    pIndex->cap * ((long) sizeof(SNCHECKPOINT)),
+                    cap * ((long) sizeof(SNCHECKPOINT)));
+        }
+        if (pNew != NULL) {
+          pIndex->pList = pNew;
+          pIndex->cap = cap;
+        } else {
+          pIndex->full = 1;
+        }
+      }
+      
+      /* Store the checkpoint after the last one, with its key filled
+       * in when it is committed */
+      if (!(pIndex->full)) {
+        pc = &((pIndex->pList)[pIndex->count]);
+        memset(pc, 0, sizeof(SNCHECKPOINT));
+        pc->key = -1;
+        pc->pos = pIn->read_count;
+        memcpy(&(pc->filter), pFilter, sizeof(SNFILTER));
+        pc->groups = snstack_peek(&(pReader->stack_group));
+        pc->meta_flag = pReader->meta_flag;
+        result = 1;
+      }
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Commit the checkpoint that was stored by snindex_record().
+ * 
+ * key is the byte offset of the token that was read right after the
+ * checkpoint.  It is only committed if the key is greater than the key
+ * of the last checkpoint, so that the keys stay in ascending order.
+ * 
+ * Parameters:
+ * 
+ *   pIndex - the offset index
+ * 
+ *   key - the byte offset of the token after the checkpoint
+ */
+static void snindex_commit(SNINDEX *pIndex, long key) {
+
+  SNCHECKPOINT *pc = NULL;
+  
+  /* Check parameters and state */
+  if ((pIndex == NULL) || (key < 0)) {
+    abort();
+  }
+  if (pIndex->count >= pIndex->cap) {
+    abort();
+  }
+  
+  /* Count the checkpoint if its key is in order */
+  pc = &((pIndex->pList)[pIndex->count]);
+  if ((pIndex->count < 1) ||
+      ((pIndex->pList)[pIndex->count - 1].key < key)) {
+    pc->key = key;
+    (pIndex->count)++;
+  }
+}
+
+/*
+ * Find the last checkpoint of an offset index at or before a byte
+ * offset.
+ * 
+ * Parameters:
+ * 
+ *   pIndex - the offset index
+ * 
+ *   offset - the byte offset
+ * 
+ * Return:
+ * 
+ *   the index of the checkpoint, or -1 if there is no checkpoint at or
+ *   before the offset
+ */
+static long snindex_find(SNINDEX *pIndex, long offset) {
+
+  long lo = 0;
+  long hi = 0;
+  long mid = 0;
+  
+  /* Check parameter */
+  if (pIndex == NULL) {
+    abort();
+  }
+  
+  /* Binary search for the first checkpoint past the offset */
+  lo = 0;
+  hi = pIndex->count;
+  while (lo < hi) {
+    mid = lo + ((hi - lo) / 2);
+    if ((pIndex->pList)[mid].key <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  
+  /* Return the checkpoint before it */
+  return (lo - 1);
+}
+
+/*
+ * Set the symbol ID of an entity that was just read by a parser with a
+ * symbol table.
+ * 
+ * OPERATION, VARIABLE, CONSTANT, ASSIGN, and GET entities get the
+ * symbol ID of their key, which is interned in the symbol table of the
+ * parser if it is not there yet.  All other entities are left alone,
+ * with a symbol ID of zero.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser, which must have a symbol table
+ * 
+ *   pEntity - the entity
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snsym_assign(SNPARSER *pParser, SNENTITY *pEntity) {
+  
+  int status = 1;
+  long index = 0;
+  
+  /* Check parameters */
+  if ((pParser == NULL) || (pEntity == NULL)) {
+    abort();
+  }
+  if (!(pParser->sym_enabled)) {
+    abort();
+  }
+  
+  /* Only look up names */
+  switch (pEntity->status) {
+    
+    case SNENTITY_OPERATION:
+    case SNENTITY_VARIABLE:
+    case SNENTITY_CONSTANT:
+    case SNENTITY_ASSIGN:
+    case SNENTITY_GET:
+      status = snintern_add(&(pParser->symbols),
+                  pEntity->pKey, pEntity->key_len, &index);
+      if (status) {
+        pEntity->symbol = index + 1;
+      }
+      break;
+    
+    default:
+      pEntity->symbol = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Decode a decimal integer.
+ * 
+ * pc points to the len characters of the token, which need not be
+ * null-terminated.  The token is an integer if it is an optional sign
+ * followed by one or more decimal digits, and the value is in the
+ * range of a long.
+ * 
+ * Parameters:
+ * 
+ *   pc - the token
+ * 
+ *   len - the length of the token
+ * 
+ *   pResult - receives the value if successful
+ * 
+ * Return:
+ * 
+ *   non-zero if the token is an integer, zero otherwise
+ */
+static int snnum_integer(const char *pc, long len, long *pResult) {
+  
+  int status = 1;
+  int neg = 0;
+  int d = 0;
+  long i = 0;
+  unsigned long limit = 0;
+  unsigned long v = 0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (len < 0) || (pResult == NULL)) {
+    abort();
+  }
+  
+  /* Optional sign */
+  if (i < len) {
+    if ((pc[i] == '+') || (pc[i] == '-')) {
+      neg = (pc[i] == '-');
+      i++;
+    }
+  }
+  
+  /* At least one digit is required */
+  if (i >= len) {
+    status = 0;
+  }
+  
+  /* The magnitude of negative numbers may be one greater */
+  limit = (unsigned long) LONG_MAX;
+  if (neg) {
+    limit++;
+  }
+  
+  /* Accumulate the digits, checking for overflow */
+  for( ; status && (i < len); i++) {
+    if ((pc[i] >= '0') && (pc[i] <= '9')) {
+      d = pc[i] - '0';
+      if (v <= (limit - ((unsigned long) d)) / 10) {
+        v = (v * 10) + ((unsigned long) d);
+      } else {
+        status = 0;
+      }
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Store the value, taking care not to overflow on the most negative
+   * value */
+  if (status) {
+    if (!neg) {
+      *pResult = (long) v;
+    } else if (v > 0) {
+      *pResult = -((long) (v - 1)) - 1;
+    } else {
+      *pResult = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Decode a decimal floating-point number exactly.
+ * 
+ * pc points to the len characters of the token, which need not be
+ * null-terminated.  See SNMODE_FLOAT in the header for the syntax.
+ * 
+ * The significant digits are accumulated into an integer significand
+ * that must stay below SNNUM_EXACT_MAX, with trailing zeros moved into
+ * the decimal exponent.  Then the value is the significand multiplied
+ * or divided by an exact power of ten, which IEEE arithmetic rounds
+ * correctly because both operands are exact.  Exponents a little above
+ * SNNUM_POW10_MAX work too, if the significand fits after the excess
+ * power of ten has been multiplied into it.  Numbers outside these
+ * ranges are not decoded.
+ * 
+ * Parameters:
+ * 
+ *   pc - the token
+ * 
+ *   len - the length of the token
+ * 
+ *   pResult - receives the value if successful
+ * 
+ * Return:
+ * 
+ *   non-zero if the token was decoded, zero otherwise
+ */
+static int snnum_float(const char *pc, long len, double *pResult) {
+  
+  int status = 1;
+  int neg = 0;
+  int eneg = 0;
+  int dot = 0;
+  int c = 0;
+  long i = 0;
+  long digits = 0;
+  long zeros = 0;
+  long frac = 0;
+  long ev = 0;
+  long e10 = 0;
+  double m = 0.0;
+  
+  /* Check parameters */
+  if ((pc == NULL) || (len < 0) || (pResult == NULL)) {
+    abort();
+  }
+  
+  /* Optional sign */
+  if (i < len) {
+    if ((pc[i] == '+') || (pc[i] == '-')) {
+      neg = (pc[i] == '-');
+      i++;
+    }
+  }
+  
+  /* Digits with an optional decimal point, holding back zeros until a
+   * non-zero digit follows them */
+  for( ; status && (i < len); i++) {
+    c = pc[i];
+    if ((c >= '0') && (c <= '9')) {
+      digits++;
+      if (dot) {
+        frac++;
+      }
+      if (c == '0') {
+        zeros++;
+      } else {
+        for( ; zeros > 0; zeros--) {
+          m = m * 10.0;
+          if (m >= SNNUM_EXACT_MAX) {
+            status = 0;
+            break;
+          }
+        }
+        if (status) {
+          m = (m * 10.0) + ((double) (c - '0'));
+          if (m >= SNNUM_EXACT_MAX) {
+            status = 0;
+          }
+        }
+      }
+    
+    } else if ((c == '.') && (!dot)) {
+      dot = 1;
+    
+    } else {
+      break;
+    }
+  }
+  if (status && (digits < 1)) {
+    status = 0;
+  }
+  
+  /* Optional exponent, which needs at least one digit */
+  if (status && (i < len)) {
+    if ((pc[i] == 'e') || (pc[i] == 'E')) {
+      i++;
+      if (i < len) {
+        if ((pc[i] == '+') || (pc[i] == '-')) {
+          eneg = (pc[i] == '-');
+          i++;
+        }
+      }
+      if (i >= len) {
+        status = 0;
+      }
+      for( ; status && (i < len); i++) {
+        if ((pc[i] >= '0') && (pc[i] <= '9')) {
+          if (ev < SNNUM_EXP_MAX) {
+            ev = (ev * 10) + (pc[i] - '0');
+          }
+        } else {
+          status = 0;
+        }
+      }
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Get the decimal exponent of the significand */
+  if (status) {
+    if (eneg) {
+      ev = -ev;
+    }
+    e10 = ev + zeros - frac;
+  }
+  
+  /* Scale the significand by an exact power of ten */
+  if (status && (m != 0.0)) {
+    if (e10 > SNNUM_POW10_MAX) {
+      if (e10 - SNNUM_POW10_MAX <= SNNUM_POW10_MAX) {
+        m = m * snnum_pow10[e10 - SNNUM_POW10_MAX];
+        if (m < SNNUM_EXACT_MAX) {
+          m = m * snnum_pow10[SNNUM_POW10_MAX];
+        } else {
+          status = 0;
+        }
+      } else {
+        status = 0;
+      }
+    
+    } else if (e10 >= 0) {
+      m = m * snnum_pow10[e10];
+    
+    } else if (e10 >= -SNNUM_POW10_MAX) {
+      m = m / snnum_pow10[-e10];
+    
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Store the value */
+  if (status) {
+    if (neg) {
+      m = -m;
+    }
+    *pResult = m;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Decode the token of a NUMERIC entity according to the mode flags.
+ * 
+ * The num_type, num_int, and num_float fields of the entity must be
+ * cleared on entry.  If the entity is not a NUMERIC entity, or if the
+ * mode has neither SNMODE_INTEGER nor SNMODE_FLOAT, nothing is done.
+ * Otherwise, the token in pKey is decoded into the entity as described
+ * for those flags in the header.
+ * 
+ * Parameters:
+ * 
+ *   pEntity - the entity
+ * 
+ *   mode - the SNMODE_ flags of the reader
+ */
+static void snnum_decode(SNENTITY *pEntity, int mode) {
+  
+  /* Check parameter */
+  if (pEntity == NULL) {
+    abort();
+  }
+  
+  /* Decode as an integer first, and then as a float */
+  if (pEntity->status == SNENTITY_NUMERIC) {
+    if (mode & SNMODE_INTEGER) {
+      if (snnum_integer(pEntity->pKey, pEntity->key_len,
+            &(pEntity->num_int))) {
+        pEntity->num_type = SNNUMBER_INTEGER;
+      }
+    }
+    if ((pEntity->num_type == SNNUMBER_NONE) && (mode & SNMODE_FLOAT)) {
+      if (snnum_float(pEntity->pKey, pEntity->key_len,
+            &(pEntity->num_float))) {
+        pEntity->num_type = SNNUMBER_FLOAT;
+      }
+    }
+  }
+}
+
+/*
+ * Determine which strings an entity of a given type has.
+ * 
+ * status is the status of an entity.  It may also be an error code or
+ * the status of an entity that has no strings.
+ * 
+ * The return value is a combination of SNBATCH_KEY if the entity has a
+ * key string, and SNBATCH_VALUE if the entity has a value string.  It
+ * is zero if the entity has no strings.
+ * 
+ * Parameters:
+ * 
+ *   status - the entity status
+ * 
+ * Return:
+ * 
+ *   the SNBATCH flags for the kind of entity
+ */
+static int snbatch_strings(int status) {
+  
+  int result = 0;
+  
+  switch (status) {
+    
+    case SNENTITY_META_TOKEN:
+    case SNENTITY_NUMERIC:
+    case SNENTITY_VARIABLE:
+    case SNENTITY_CONSTANT:
+    case SNENTITY_ASSIGN:
+    case SNENTITY_GET:
+    case SNENTITY_OPERATION:
+    case SNENTITY_BEGIN_STRING:
+      result = SNBATCH_KEY;
+      break;
+    
+    case SNENTITY_STRING:
+    case SNENTITY_META_STRING:
+      result = SNBATCH_KEY | SNBATCH_VALUE;
+      break;
+    
+    case SNENTITY_STRING_CHUNK:
+      result = SNBATCH_VALUE;
+      break;
+    
+    default:
+      result = 0;
+  }
+  
+  return result;
+}
+
+/*
+ * Copy a string to the end of the batch arena of a parser.
+ * 
+ * pStr points to the string, and len is its length in bytes, which
+ * must be zero or greater.  The string need not be null-terminated.  A
+ * terminating nul is added after the copy in the arena.
+ * 
+ * The arena grows by doubling as needed, through the allocator of the
+ * parser.  Since growing the arena may move it, no pointers into the
+ * arena are returned.  Instead, strings are located afterwards by
+ * adding up the lengths of the strings that were copied before them.
+ * The function fails if the arena can not grow, in which case the
+ * arena is unmodified.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser whose arena the string is added to
+ * 
+ *   pStr - the string to copy
+ * 
+ *   len - the length of the string
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snbatch_keep(
+    SNPARSER   * pParser,
+    const char * pStr,
+    long         len) {
+  
+  int status = 1;
+  long newcap = 0;
+  char *pNew = NULL;
+  
+  /* Check parameters */
+  if ((pParser == NULL) || (pStr == NULL) || (len < 0)) {
+    abort();
+  }
+  if (len >= LONG_MAX - pParser->arena_len) {
+    abort();
+  }
+  
+  /* Grow the arena if there isn't room for the string and the nul */
+  if (len >= pParser->arena_cap - pParser->arena_len) {
+    /* New capacity should usually be double the current capacity, or
+     * more if that is still not enough */
+    if (pParser->arena_cap < 1) {
+      newcap = SNBATCH_ARENA_INIT;
+    } else {
+      newcap = pParser->arena_cap;
+    }
+    while (status && (len >= newcap - pParser->arena_len)) {
+      if (newcap > (LONG_MAX / 2)) {
+        status = 0;
+      } else {
+        newcap = newcap * 2;
+      }
+    }
+    
+    /* Allocate new arena */
+    if (status) {
+      if (pParser->pArena == NULL) {
+        pNew = (char *) snalloc_get(&(pParser->alloc), newcap);
+      } else {
+        pNew = (char *) snalloc_resize(&(pParser->alloc),
+                  pParser->pArena, pParser->arena_cap, newcap);
+      }
+      if (pNew != NULL) {
+        pParser->pArena = pNew;
+        pParser->arena_cap = newcap;
+      } else {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Copy the string and the terminating nul */
+  if (status) {
+    if (len > 0) {
+      memcpy(pParser->pArena + pParser->arena_len, pStr, (size_t) len);
+    }
+    (pParser->pArena)[pParser->arena_len + len] = (char) 0;
+    pParser->arena_len += (len + 1);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Clear the fields that an entity does not use.
+ * 
+ * Entities are read into reader queue slots that are reused, so the
+ * fields that an entity kind does not use may still hold values left
+ * over from an earlier entity, including pointers into buffers of the
+ * reader and the source.  Before an entity is kept beyond the next
+ * read, the string fields that snbatch_strings() does not list for its
+ * kind are set to NULL and zero, the count is set to zero unless it is
+ * an ARRAY entity, and the string type is set to zero unless it is one
+ * of the string entities, as the SNENTITY documentation promises.
+ * 
+ * Parameters:
+ * 
+ *   pEntity - the entity to clear
+ */
+static void snbatch_clear(SNENTITY *pEntity) {
+
+  int flags = 0;
+  
+  /* Check parameter */
+  if (pEntity == NULL) {
+    abort();
+  }
+  
+  /* Clear the strings the entity doesn't have */
+  flags = snbatch_strings(pEntity->status);
+  if (!(flags & SNBATCH_KEY)) {
+    pEntity->pKey = NULL;
+    pEntity->key_len = 0;
+  }
+  if (!(flags & SNBATCH_VALUE)) {
+    pEntity->pValue = NULL;
+    pEntity->value_len = 0;
+  }
+  
+  /* Clear the count and the string type unless they are used */
+  if (pEntity->status != SNENTITY_ARRAY) {
+    pEntity->count = 0;
+  }
+  if ((pEntity->status != SNENTITY_STRING) &&
+      (pEntity->status != SNENTITY_META_STRING) &&
+      (pEntity->status != SNENTITY_BEGIN_STRING) &&
+      (pEntity->status != SNENTITY_STRING_CHUNK) &&
+      (pEntity->status != SNENTITY_END_STRING)) {
+    pEntity->str_type = 0;
+  }
+}
+
+/*
+ * Lock the run state of a parser pool.
+ * 
+ * Without SHASTINA_THREADS, this does nothing, since there is only ever
+ * one worker.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ */
+static void snpool_lock(SNPOOL *pPool) {
+  
+  /* Check parameter */
+  if (pPool == NULL) {
+    abort();
+  }
+  
+  /* Lock */
+#ifdef SHASTINA_THREADS
+  if (pthread_mutex_lock(&(pPool->lock)) != 0) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Unlock the run state of a parser pool.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool, which must be locked
+ */
+static void snpool_unlock(SNPOOL *pPool) {
+  
+  /* Check parameter */
+  if (pPool == NULL) {
+    abort();
+  }
+  
+  /* Unlock */
+#ifdef SHASTINA_THREADS
+  if (pthread_mutex_unlock(&(pPool->lock)) != 0) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Wait until a document is delivered or the run is stopped.
+ * 
+ * The pool must be locked, and it is locked again on return.  Without
+ * SHASTINA_THREADS, nothing could ever change the run state, so a
+ * fault occurs.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ */
+static void snpool_wait(SNPOOL *pPool) {
+  
+  /* Check parameter */
+  if (pPool == NULL) {
+    abort();
+  }
+  
+  /* Wait */
+#ifdef SHASTINA_THREADS
+  if (pthread_cond_wait(&(pPool->cond), &(pPool->lock)) != 0) {
+    abort();
+  }
+#else
+  abort();
+#endif
+}
+
+/*
+ * Wake all workers that are waiting with snpool_wait().
+ * 
+ * The pool must be locked.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ */
+static void snpool_wake(SNPOOL *pPool) {
+  
+  /* Check parameter */
+  if (pPool == NULL) {
+    abort();
+  }
+  
+  /* Wake */
+#ifdef SHASTINA_THREADS
+  if (pthread_cond_broadcast(&(pPool->cond)) != 0) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Double the capacity of the entity and line arrays of a worker.
+ * 
+ * Parameters:
+ * 
+ *   pWorker - the worker
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snpool_grow(SNPOOLWORKER *pWorker) {
+  
+  int status = 1;
+  long cap = 0;
+  void *pNew = NULL;
+  const SNALLOC *pAlloc = NULL;
+  
+  /* Check parameter */
+  if (pWorker == NULL) {
+    abort();
+  }
+  pAlloc = &(pWorker->pPool->alloc);
+  
+  /* Double the smaller of the capacities */
+  cap = pWorker->ent_cap;
+  if (pWorker->line_cap < cap) {
+    cap = pWorker->line_cap;
+  }
+  if (cap <= LONG_MAX / 2 / ((long) sizeof(SNENTITY))) {
+    cap = cap * 2;
+  } else {
+    status = 0;
+  }
+  
+  /* Grow each array that is smaller than that; if only the first one
+   * grows, the capacities just differ until the next try */
+  if (status && (pWorker->ent_cap < cap)) {
+    pNew = snalloc_resize(pAlloc, pWorker->pEnt,
+              pWorker->ent_cap * ((long) sizeof(SNENTITY)),
+              cap * ((long) sizeof(SNENTITY)));
+    if (pNew != NULL) {
+      pWorker->pEnt = (SNENTITY *) pNew;
+      pWorker->ent_cap = cap;
+    } else {
+      status = 0;
+    }
+  }
+  
+  if (status && (pWorker->line_cap < cap)) {
+    pNew = snalloc_resize(pAlloc, pWorker->pLines,
+              pWorker->line_cap * ((long) sizeof(long)),
+              cap * ((long) sizeof(long)));
+    if (pNew != NULL) {
+      pWorker->pLines = (long *) pNew;
+      pWorker->line_cap = cap;
+    } else {
+      status = 0;
+    }
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Parse a complete document with the parser of a worker.
+ * 
+ * The parser must be in the state to begin the document.  Entities are
+ * read from pIn into the entity array of the worker until the EOF
+ * entity or an error has been read, with the line count after each
+ * entity in the line array.  Entity strings are copied into the batch
+ * arena of the parser, in the same way as snparser_readbatch().  If
+ * memory runs out, the document ends with an SNERR_NOMEM error.
+ * 
+ * Parameters:
+ * 
+ *   pWorker - the worker
+ * 
+ *   pIn - the source to read the document from
+ * 
+ * Return:
+ * 
+ *   the number of entities, which is at least one
+ */
+static long snpool_read(SNPOOLWORKER *pWorker, SNSOURCE *pIn) {
+  
+  SNPARSER *pParser = NULL;
+  SNENTITY *pe = NULL;
+  long count = 0;
+  long i = 0;
+  long pos = 0;
+  long mark = 0;
+  int flags = 0;
+  int status = 0;
+  int done = 0;
+  
+  /* Check parameters */
+  if ((pWorker == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  pParser = pWorker->pParser;
+  
+  /* Clear the arena */
+  pParser->arena_len = 0;
+  
+  /* Read entities until EOF or an error */
+  while (!done) {
+    
+    /* Make room for another entity; if there is no room, turn the last
+     * entity into an out of memory error, which ends the document */
+    if ((count >= pWorker->ent_cap) || (count >= pWorker->line_cap)) {
+      if (!snpool_grow(pWorker)) {
+        pe = &((pWorker->pEnt)[count - 1]);
+        memset(pe, 0, sizeof(SNENTITY));
+        pe->status = SNERR_NOMEM;
+        pe->offset = snsource_bytes(pIn);
+        pParser->reader.status = SNERR_NOMEM;
+        break;
+      }
+    }
+    
+    /* Read an entity and copy its strings into the arena, turning it
+     * into an out of memory error if they don't fit */
+    pe = &((pWorker->pEnt)[count]);
+    snreader_read(&(pParser->reader), pe, pIn, &(pParser->filter));
+    count++;
+    
+    mark = pParser->arena_len;
+    status = 1;
+    flags = snbatch_strings(pe->status);
+    if (flags & SNBATCH_KEY) {
+      status = snbatch_keep(pParser, pe->pKey, pe->key_len);
+    }
+    if (status && (flags & SNBATCH_VALUE)) {
+      status = snbatch_keep(pParser, pe->pValue, pe->value_len);
+    }
+    
+    if (!status) {
+      pParser->arena_len = mark;
+      memset(pe, 0, sizeof(SNENTITY));
+      pe->status = SNERR_NOMEM;
+      pe->offset = snsource_bytes(pIn);
+      pParser->reader.status = SNERR_NOMEM;
+    }
+    
+    /* Record the line count */
+    (pWorker->pLines)[count - 1] = snfilter_count(&(pParser->filter));
+    
+    if (pe->status <= 0) {
+      done = 1;
+    }
+  }
+  
+  /* Now that the arena won't move any more, point the strings of each
+   * entity at their copies, and clear whatever the entity does not use,
+   * since that may point into the buffers of the worker parser */
+  for(i = 0; i < count; i++) {
+    pe = &((pWorker->pEnt)[i]);
+    snbatch_clear(pe);
+    flags = snbatch_strings(pe->status);
+    if (flags & SNBATCH_KEY) {
+      pe->pKey = pParser->pArena + pos;
+      pos += (pe->key_len + 1);
+    }
+    if (flags & SNBATCH_VALUE) {
+      pe->pValue = pParser->pArena + pos;
+      pos += (pe->value_len + 1);
+    }
+  }
+  
+  /* Return the number of entities */
+  return count;
+}
+
+/*
+ * Find the next document of the stream of a parser pool.
+ * 
+ * The pool must be locked and running snpool_stream().  If there is
+ * another document, the state of the stream source and the scan filter
+ * at its start is copied to pDocSrc and pDocFilter, and the stream is
+ * moved past the |; token that ends the document.  Only tokens are
+ * read, so entity errors don't stop the scan, but token errors end the
+ * stream after the document that has them.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ * 
+ *   pDocSrc - receives the state of the source at the document
+ * 
+ *   pDocFilter - receives the state of the filter at the document
+ * 
+ * Return:
+ * 
+ *   SNPOOL_SCAN_DOC if a document was found, SNPOOL_SCAN_NOMEM if one
+ *   was found but memory ran out while scanning it, or SNPOOL_SCAN_END
+ *   if there are no more documents
+ */
+static int snpool_scan(
+    SNPOOL   * pPool,
+    SNSOURCE * pDocSrc,
+    SNFILTER * pDocFilter) {
+  
+  int result = SNPOOL_SCAN_END;
+  SNREADER *pReader = NULL;
+  SNFILTER *pFilter = NULL;
+  SNSOURCE src;
+  SNFILTER filter;
+  SNTOKEN tk;
+  
+  /* Initialize structures */
+  memset(&src, 0, sizeof(SNSOURCE));
+  memset(&filter, 0, sizeof(SNFILTER));
+  memset(&tk, 0, sizeof(SNTOKEN));
+  
+  /* Check parameters */
+  if ((pPool == NULL) || (pDocSrc == NULL) || (pDocFilter == NULL)) {
+    abort();
+  }
+  if (pPool->pStream == NULL) {
+    abort();
+  }
+  pReader = &(pPool->pScan->reader);
+  pFilter = &(pPool->pScan->filter);
+  
+  /* Check for another document by skipping whitespace and comments on
+   * a copy of the state, so the state itself is left as a parser would
+   * find it */
+  if (!(pPool->stream_end)) {
+    memcpy(&src, pPool->pStream, sizeof(SNSOURCE));
+    memcpy(&filter, pFilter, sizeof(SNFILTER));
+    sntk_skip(&src, &filter);
+    if ((!(filter.pushback)) && (filter.c == SNERR_EOF)) {
+      pPool->stream_end = 1;
+    } else {
+      result = SNPOOL_SCAN_DOC;
+    }
+  }
+  
+  /* Record the start of the document and then read tokens up to and
+   * including the |; token */
+  if (result == SNPOOL_SCAN_DOC) {
+    memcpy(pDocSrc, pPool->pStream, sizeof(SNSOURCE));
+    memcpy(pDocFilter, pFilter, sizeof(SNFILTER));
+    
+    tk.pKey = &(pReader->buf_key);
+    tk.pValue = &(pReader->buf_value);
+    tk.view = 0;
+    tk.unescape = 0;
+    tk.pChunk = NULL;
+    do {
+      sntoken_read(&tk, pPool->pStream, pFilter);
+    } while ((tk.status >= 0) && (tk.status != SNTOKEN_FINAL));
+    
+    /* A token error ends the stream, and if memory ran out, the
+     * document is reported as out of memory */
+    if (tk.status < 0) {
+      pPool->stream_end = 1;
+      if (snreader_nomem(pReader)) {
+        result = SNPOOL_SCAN_NOMEM;
+      }
+    }
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Deliver a parsed document to the callback of a parser pool.
+ * 
+ * With the SNPOOL_ORDERED flag, this waits until all earlier documents
+ * have been delivered.  Nothing is delivered once the run is stopped.
+ * The pool must not be locked.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ * 
+ *   pDoc - the document
+ */
+static void snpool_deliver(SNPOOL *pPool, const SNDOC *pDoc) {
+  
+  int ordered = 0;
+  int go = 0;
+  int result = 1;
+  
+  /* Check parameters */
+  if ((pPool == NULL) || (pDoc == NULL)) {
+    abort();
+  }
+  ordered = pPool->flags & SNPOOL_ORDERED;
+  
+  /* Wait for our turn if ordered, then claim the delivery unless
+   * stopped */
+  snpool_lock(pPool);
+  if (ordered) {
+    while ((!(pPool->stopped)) &&
+            (pPool->next_deliver != pDoc->index)) {
+      snpool_wait(pPool);
+    }
+  }
+  if (!(pPool->stopped)) {
+    go = 1;
+    (pPool->delivered)++;
+  }
+  snpool_unlock(pPool);
+  
+  /* Invoke the callback without holding the lock */
+  if (go) {
+    result = (*(pPool->doc_func))(pPool->custom, pDoc);
+  }
+  
+  /* Stop the run if the callback asked for it, and let the next
+   * document through */
+  snpool_lock(pPool);
+  if (go && (!result)) {
+    pPool->stopped = 1;
+  }
+  if (ordered && (pPool->next_deliver == pDoc->index)) {
+    (pPool->next_deliver)++;
+  }
+  snpool_wake(pPool);
+  snpool_unlock(pPool);
+}
+
+/*
+ * Run a worker of a parser pool until there are no more documents or
+ * the run is stopped.
+ * 
+ * Parameters:
+ * 
+ *   pWorker - the worker
+ */
+static void snpool_work(SNPOOLWORKER *pWorker) {
+  
+  SNPOOL *pPool = NULL;
+  SNSOURCE *pIn = NULL;
+  int kind = 0;
+  int done = 0;
+  long index = 0;
+  long count = 0;
+  SNSOURCE src;
+  SNFILTER filter;
+  SNDOC doc;
+  
+  /* Initialize structures */
+  memset(&src, 0, sizeof(SNSOURCE));
+  memset(&filter, 0, sizeof(SNFILTER));
+  memset(&doc, 0, sizeof(SNDOC));
+  
+  /* Check parameter */
+  if (pWorker == NULL) {
+    abort();
+  }
+  pPool = pWorker->pPool;
+  
+  /* Process documents */
+  while (!done) {
+    
+    /* Take the next document, if any */
+    kind = SNPOOL_SCAN_END;
+    snpool_lock(pPool);
+    if (!(pPool->stopped)) {
+      if (pPool->ppSrc != NULL) {
+        if (pPool->next < pPool->src_count) {
+          kind = SNPOOL_SCAN_DOC;
+          pIn = (pPool->ppSrc)[pPool->next];
+        }
+      } else {
+        kind = snpool_scan(pPool, &src, &filter);
+        pIn = &src;
+      }
+      if (kind != SNPOOL_SCAN_END) {
+        index = pPool->next;
+        (pPool->next)++;
+      }
+    }
+    snpool_unlock(pPool);
+    
+    /* Parse the document, which for streams continues with the filter
+     * state the scan found at its start */
+    if (kind == SNPOOL_SCAN_END) {
+      done = 1;
+    
+    } else if (kind == SNPOOL_SCAN_DOC) {
+      snparser_reset(pWorker->pParser, SNRESET_NORMAL);
+      if (pPool->ppSrc == NULL) {
+        memcpy(&(pWorker->pParser->filter), &filter, sizeof(SNFILTER));
+      }
+      count = snpool_read(pWorker, pIn);
+    
+    } else {
+      count = 1;
+      memset(pWorker->pEnt, 0, sizeof(SNENTITY));
+      (pWorker->pEnt)[0].status = SNERR_NOMEM;
+      (pWorker->pLines)[0] = snfilter_count(&filter);
+    }
+    
+    /* Deliver it */
+    if (!done) {
+      doc.index = index;
+      doc.worker = pWorker->index;
+      doc.pEntities = pWorker->pEnt;
+      doc.pLines = pWorker->pLines;
+      doc.count = count;
+      snpool_deliver(pPool, &doc);
+    }
+  }
+}
+
+#ifdef SHASTINA_THREADS
+/*
+ * Thread start routine that runs a worker with snpool_work().
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to the SNPOOLWORKER to run
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *snpool_thread(void *pArg) {
+  
+  /* Check parameter */
+  if (pArg == NULL) {
+    abort();
+  }
+  
+  /* Run the worker */
+  snpool_work((SNPOOLWORKER *) pArg);
+  
+  /* No result */
+  return NULL;
+}
+#endif
+
+/*
+ * Run all workers of a parser pool on the current run.
+ * 
+ * The run state must be set up, apart from the counters, which are
+ * cleared.  Worker zero runs on the calling thread.  Workers whose
+ * thread can't be started are left out.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ * 
+ * Return:
+ * 
+ *   the number of documents that were delivered
+ */
+static long snpool_run(SNPOOL *pPool) {
+  
+  int i = 0;
+  SNPOOLWORKER *pw = NULL;
+  
+  /* Check parameter */
+  if (pPool == NULL) {
+    abort();
+  }
+  
+  /* Clear the counters */
+  pPool->next = 0;
+  pPool->next_deliver = 0;
+  pPool->delivered = 0;
+  pPool->stopped = 0;
+  
+  /* Start the other workers, run worker zero, and wait for the rest */
+  for(i = 1; i < pPool->threads; i++) {
+    pw = &((pPool->pWorkers)[i]);
+    pw->started = 0;
+#ifdef SHASTINA_THREADS
+    if (pthread_create(&(pw->thread), NULL,
+                        &snpool_thread, (void *) pw) == 0) {
+      pw->started = 1;
+    }
+#endif
+  }
+  
+  snpool_work(&((pPool->pWorkers)[0]));
+  
+  for(i = 1; i < pPool->threads; i++) {
+    pw = &((pPool->pWorkers)[i]);
+    if (pw->started) {
+#ifdef SHASTINA_THREADS
+      if (pthread_join(pw->thread, NULL) != 0) {
+        abort();
+      }
+#endif
+      pw->started = 0;
+    }
+  }
+  
+  /* Return the number of documents delivered */
+  return pPool->delivered;
+}
+
+/*
+ * Lock the shared state of a pipelined parser.
+ * 
+ * Without SHASTINA_THREADS, this does nothing, since the pipeline is
+ * never enabled.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state
+ */
+static void snpipe_lock(SNPIPE *pPipe) {
+
+  /* Check parameter */
+  if (pPipe == NULL) {
+    abort();
+  }
+  
+  /* Lock */
+#ifdef SHASTINA_THREADS
+  if (pthread_mutex_lock(&(pPipe->lock)) != 0) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Unlock the shared state of a pipelined parser.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state, which must be locked
+ */
+static void snpipe_unlock(SNPIPE *pPipe) {
+
+  /* Check parameter */
+  if (pPipe == NULL) {
+    abort();
+  }
+  
+  /* Unlock */
+#ifdef SHASTINA_THREADS
+  if (pthread_mutex_unlock(&(pPipe->lock)) != 0) {
+    abort();
+  }
+#endif
+}
+
+/*
+ * Wait until the other side of a pipelined parser changes the shared
+ * state.
+ * 
+ * The pipeline must be locked, and it is locked again on return.  The
+ * waiting count is kept up to date, so that the other side knows to
+ * wake this one.  Without SHASTINA_THREADS, there is no other side, so
+ * a fault occurs.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state
+ */
+static void snpipe_wait(SNPIPE *pPipe) {
+
+  /* Check parameter */
+  if (pPipe == NULL) {
+    abort();
+  }
+  
+  /* Wait */
+#ifdef SHASTINA_THREADS
+  (pPipe->waiting)++;
+  if (pthread_cond_wait(&(pPipe->cond), &(pPipe->lock)) != 0) {
+    abort();
+  }
+  (pPipe->waiting)--;
+#else
+  abort();
+#endif
+}
+
+/*
+ * Wake the other side of a pipelined parser if it is waiting with
+ * snpipe_wait().
+ * 
+ * The pipeline must be locked.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state
+ */
+static void snpipe_wake(SNPIPE *pPipe) {
+
+  /* Check parameter */
+  if (pPipe == NULL) {
+    abort();
+  }
+  
+  /* Wake, unless nothing is waiting */
+#ifdef SHASTINA_THREADS
+  if (pPipe->waiting > 0) {
+    if (pthread_cond_broadcast(&(pPipe->cond)) != 0) {
+      abort();
+    }
+  }
+#endif
+}
+
+#ifdef SHASTINA_THREADS
+/*
+ * Copy the strings of the entity in a slot of the entity ring into the
+ * slab of the slot.
+ * 
+ * The key and value strings that the entity has, according to
+ * snbatch_strings(), are copied into the slab with a terminating nul
+ * after each, and the entity is then pointed at the copies.  The fields
+ * that the entity does not use are cleared with snbatch_clear(), so
+ * that nothing in the slot points into the buffers of the reader.  The
+ * slab grows by doubling as needed.  The function fails if the slab
+ * can not grow, in which case the entity is unmodified.
+ * 
+ * Parameters:
+ * 
+ *   pSlot - the slot
+ * 
+ *   pAlloc - the allocator of the parser
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snpipe_keep(SNPIPESLOT *pSlot, const SNALLOC *pAlloc) {
+
+  int status = 1;
+  int flags = 0;
+  long need = 0;
+  long newcap = 0;
+  char *pNew = NULL;
+  SNENTITY *pe = NULL;
+  
+  /* Check parameters */
+  if ((pSlot == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  pe = &(pSlot->ent);
+  
+  /* Add up the room needed for the strings and their nuls */
+  flags = snbatch_strings(pe->status);
+  if (flags & SNBATCH_KEY) {
+    need = need + pe->key_len + 1;
+  }
+  if (flags & SNBATCH_VALUE) {
+    need = need + pe->value_len + 1;
+  }
+  
+  /* Grow the slab if it is too small, replacing it since none of its
+   * contents are needed anymore */
+  if (need > pSlot->slab_cap) {
+    newcap = pSlot->slab_cap;
+    if (newcap < SNPIPE_SLAB_INIT) {
+      newcap = SNPIPE_SLAB_INIT;
+    }
+    while (status && (newcap < need)) {
+      if (newcap > (LONG_MAX / 2)) {
+        status = 0;
+      } else {
+        newcap = newcap * 2;
+      }
+    }
+    
+    if (status) {
+      pNew = (char *) snalloc_get(pAlloc, newcap);
+      if (pNew != NULL) {
+        if (pSlot->pSlab != NULL) {
+          snalloc_release(pAlloc, pSlot->pSlab, pSlot->slab_cap);
+        }
+        pSlot->pSlab = pNew;
+        pSlot->slab_cap = newcap;
+      } else {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Copy the strings and point the entity at the copies */
+  if (status && (flags & SNBATCH_KEY)) {
+    if (pe->key_len > 0) {
+      memcpy(pSlot->pSlab, pe->pKey, (size_t) pe->key_len);
+    }
+    (pSlot->pSlab)[pe->key_len] = (char) 0;
+    pe->pKey = pSlot->pSlab;
+  }
+  if (status && (flags & SNBATCH_VALUE)) {
+    pNew = pSlot->pSlab;
+    if (flags & SNBATCH_KEY) {
+      pNew = pNew + pe->key_len + 1;
+    }
+    if (pe->value_len > 0) {
+      memcpy(pNew, pe->pValue, (size_t) pe->value_len);
+    }
+    pNew[pe->value_len] = (char) 0;
+    pe->pValue = pNew;
+  }
+  if (status) {
+    snbatch_clear(pe);
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Run the producer of a pipelined parser.
+ * 
+ * Entities are read into the slots of the ring with the reader and
+ * published one at a time, waiting for the consumer to give back slots
+ * whenever the ring is full, until the EOF entity or an error has been
+ * published or the consumer asks the producer to stop.  If the strings
+ * of an entity can not be copied into its slot, the entity is turned
+ * into an out of memory error, which the reader then keeps returning.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser
+ */
+static void snpipe_produce(SNPARSER *pParser) {
+
+  SNPIPE *pp = NULL;
+  SNPIPESLOT *ps = NULL;
+  int done = 0;
+  
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
+  pp = &(pParser->pipe);
+  
+  while (!done) {
+    /* Wait for a free slot unless one is already known to be free */
+    if (pp->space < 1) {
+      snpipe_lock(pp);
+      while ((pp->filled >= pp->slots) && (!(pp->stop))) {
+        snpipe_wait(pp);
+      }
+      pp->space = pp->slots - pp->filled;
+      if (pp->stop) {
+        done = 1;
+      }
+      snpipe_unlock(pp);
+    }
+    
+    /* Read the next entity into the slot, with its strings and the line
+     * count after it */
+    if (!done) {
+      ps = &((pp->pRing)[pp->put]);
+      snreader_read(&(pParser->reader), &(ps->ent), pp->pIn,
+                    &(pParser->filter));
+      if (!snpipe_keep(ps, &(pParser->alloc))) {
+        memset(&(ps->ent), 0, sizeof(SNENTITY));
+        ps->ent.status = SNERR_NOMEM;
+        ps->ent.offset = snsource_bytes(pp->pIn);
+        pParser->reader.status = SNERR_NOMEM;
+      }
+      ps->lines = snfilter_count(&(pParser->filter));
+      
+      pp->put = (pp->put + 1) % pp->slots;
+      (pp->space)--;
+      if (ps->ent.status <= 0) {
+        done = 1;
+      }
+      
+      /* Publish the entity */
+      snpipe_lock(pp);
+      (pp->filled)++;
+      if (pp->stop) {
+        done = 1;
+      }
+      snpipe_wake(pp);
+      snpipe_unlock(pp);
+    }
+  }
+  
+  /* Let the consumer know the producer is done */
+  snpipe_lock(pp);
+  pp->ended = 1;
+  snpipe_wake(pp);
+  snpipe_unlock(pp);
+}
+
+/*
+ * Thread function that runs the producer of a pipelined parser.
+ * 
+ * The function prototype matches pthread_create().
+ * 
+ * Parameters:
+ * 
+ *   pArg - pointer to the SNPARSER
+ * 
+ * Return:
+ * 
+ *   always NULL
+ */
+static void *snpipe_thread(void *pArg) {
+
+  /* Check parameter */
+  if (pArg == NULL) {
+    abort();
+  }
+  
+  /* Run the producer */
+  snpipe_produce((SNPARSER *) pArg);
+  
+  /* No result */
+  return NULL;
+}
+#endif
+
+/*
+ * Start the producer of a pipelined parser on a source.
+ * 
+ * The pipeline must be enabled and not running.  If the thread can't
+ * be started, the pipeline is left not running, and entities are then
+ * read directly.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser
+ * 
+ *   pIn - the input source
+ */
+static void snpipe_start(SNPARSER *pParser, SNSOURCE *pIn) {
+
+  SNPIPE *pp = NULL;
+  
+  /* Check parameters */
+  if ((pParser == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  pp = &(pParser->pipe);
+  if ((pp->slots < 2) || pp->running) {
+    abort();
+  }
+  
+  /* Start with an empty ring */
+  pp->pIn = pIn;
+  pp->lines = snfilter_count(&(pParser->filter));
+  pp->put = 0;
+  pp->space = pp->slots;
+  pp->take = 0;
+  pp->avail = 0;
+  pp->spent = 0;
+  pp->hold = 0;
+  pp->filled = 0;
+  pp->stop = 0;
+  pp->ended = 0;
+  pp->waiting = 0;
+  
+  /* Start the producer thread */
+#ifdef SHASTINA_THREADS
+  if (pthread_create(&(pp->thread), NULL,
+                      &snpipe_thread, (void *) pParser) == 0) {
+    pp->running = 1;
+  }
+#endif
+}
+
+/*
+ * Take the next entity from the ring of a running pipelined parser.
+ * 
+ * The slot of the entity taken before is given up, and slots that are
+ * given up are given back to the producer in batches.  If no entity is
+ * ready, the function waits for the producer.
+ * 
+ * The return value points to the entity in its slot.  Its strings are
+ * in the slab of the slot.  It remains valid until the next call or
+ * until the pipeline is stopped or started again.  The caller may
+ * modify the symbol field of the entity, but nothing else.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state
+ * 
+ * Return:
+ * 
+ *   pointer to the entity
+ */
+static SNENTITY *snpipe_take(SNPIPE *pPipe) {
+
+  SNPIPESLOT *ps = NULL;
+  
+  /* Check parameter */
+  if (pPipe == NULL) {
+    abort();
+  }
+  if (!(pPipe->running)) {
+    abort();
+  }
+  
+  /* The slot taken before is no longer in use */
+  if (pPipe->hold) {
+    (pPipe->spent)++;
+    pPipe->hold = 0;
+  }
+  
+  /* If no entity is known to be ready, or a quarter of the ring is
+   * waiting to be given back, give back the spent slots and find out
+   * how many entities are ready, waiting for at least one */
+  if ((pPipe->avail < 1) || (pPipe->spent >= pPipe->slots / 4)) {
+    snpipe_lock(pPipe);
+    pPipe->filled -= pPipe->spent;
+    pPipe->spent = 0;
+    snpipe_wake(pPipe);
+    while ((pPipe->filled < 1) && (!(pPipe->ended))) {
+      snpipe_wait(pPipe);
+    }
+    pPipe->avail = pPipe->filled;
+    snpipe_unlock(pPipe);
+    
+    /* The producer always publishes the EOF entity or an error before
+     * it ends, unless it was stopped */
+    if (pPipe->avail < 1) {
+      abort();
+    }
+  }
+  
+  /* Take the entity */
+  ps = &((pPipe->pRing)[pPipe->take]);
+  pPipe->take = (pPipe->take + 1) % pPipe->slots;
+  (pPipe->avail)--;
+  pPipe->hold = 1;
+  pPipe->lines = ps->lines;
+  
+  /* Return the entity */
+  return &(ps->ent);
+}
+
+/*
+ * Stop the producer of a pipelined parser, if it is running.
+ * 
+ * If the producer is still running, it is asked to stop, and any
+ * entities it has read ahead are discarded.  The function then waits
+ * for the producer thread to finish.  Afterwards, the reader, the input
+ * filter, and the source are back in the hands of the caller.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state
+ */
+static void snpipe_stop(SNPIPE *pPipe) {
+
+  /* Check parameter */
+  if (pPipe == NULL) {
+    abort();
+  }
+  
+  /* Only do something if running */
+  if (pPipe->running) {
+    /* Ask the producer to stop */
+    snpipe_lock(pPipe);
+    pPipe->stop = 1;
+    snpipe_wake(pPipe);
+    snpipe_unlock(pPipe);
+    
+    /* Wait for the producer thread */
+#ifdef SHASTINA_THREADS
+    if (pthread_join(pPipe->thread, NULL) != 0) {
+      abort();
+    }
+#endif
+    pPipe->running = 0;
+  }
+}
+
+/*
+ * Release the entity ring of a pipelined parser.
+ * 
+ * The pipeline must not be running.  Afterwards, the pipeline is
+ * disabled.  The lock and the condition are kept.
+ * 
+ * Parameters:
+ * 
+ *   pPipe - the pipeline state
+ * 
+ *   pAlloc - the allocator of the parser
+ */
+static void snpipe_release(SNPIPE *pPipe, const SNALLOC *pAlloc) {
+
+  long i = 0;
+  SNPIPESLOT *ps = NULL;
+  
+  /* Check parameters */
+  if ((pPipe == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  if (pPipe->running) {
+    abort();
+  }
+  
+  /* Release the slabs and the ring */
+  if (pPipe->pRing != NULL) {
+    for(i = 0; i < pPipe->slots; i++) {
+      ps = &((pPipe->pRing)[i]);
+      if (ps->pSlab != NULL) {
+        snalloc_release(pAlloc, ps->pSlab, ps->slab_cap);
+        ps->pSlab = NULL;
+      }
+    }
+    snalloc_release(pAlloc, pPipe->pRing,
+                    pPipe->slots * ((long) sizeof(SNPIPESLOT)));
+    pPipe->pRing = NULL;
+  }
+  pPipe->slots = 0;
+}
+
+/*
+ * Get the next entity of a parser, through the pipeline if it is
+ * enabled.
+ * 
+ * If the pipeline is enabled but not running, the producer is started
+ * on the source, unless the reader only has a stored error or the EOF
+ * entity left to return.  If the pipeline is running, the entity is
+ * taken from the ring, and pIn must be the source that the producer was
+ * started on.  Once the EOF entity or an error has been taken, the
+ * producer is done, so its thread is joined.  Otherwise, the entity is
+ * read directly with snreader_next().
+ * 
+ * The return value is as for snreader_next(), except that it may also
+ * point into the ring.  See snpipe_take().
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser
+ * 
+ *   pSpare - the spare entity
+ * 
+ *   pIn - the input source
+ * 
+ * Return:
+ * 
+ *   pointer to the entity
+ */
+static SNENTITY *snpipe_next(
+    SNPARSER * pParser,
+    SNENTITY * pSpare,
+    SNSOURCE * pIn) {
+  
+  SNPIPE *pp = NULL;
+  SNENTITY *pResult = NULL;
+  
+  /* Check parameters */
+  if ((pParser == NULL) || (pSpare == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  pp = &(pParser->pipe);
+  
+  /* Start the producer if the pipeline is enabled and idle */
+  if ((pp->slots > 0) && (!(pp->running)) && (!(pp->finished)) &&
+      (pParser->reader.status == 0)) {
+    snpipe_start(pParser, pIn);
+  }
+  
+  if (pp->running) {
+    /* Take from the ring, joining the producer once it is done */
+    if (pIn != pp->pIn) {
+      abort();
+    }
+    pResult = snpipe_take(pp);
+    if (pResult->status <= 0) {
+      snpipe_stop(pp);
+      if (pResult->status != SNERR_MORE) {
+        pp->finished = 1;
+      }
+    }
+  
+  } else {
+    /* Read directly */
+    pResult = snreader_next(&(pParser->reader), pSpare, pIn,
+                            &(pParser->filter));
+  }
+  
+  /* Return the entity */
+  return pResult;
+}
+
+/*
+ * Compute the 32-bit FNV-1a hash of a run of bytes.
+ * 
+ * The result is always in the range of 32 bits, even on platforms
+ * where unsigned long is wider.
+ * 
+ * Parameters:
+ * 
+ *   pc - the bytes, which may be NULL only if len is zero
+ * 
+ *   len - the number of bytes, zero or greater
+ * 
+ * Return:
+ * 
+ *   the hash value
+ */
+static unsigned long snhash_fnv(const unsigned char *pc, long len) {
+  
+  unsigned long h = SNHASH_FNV_BASIS;
+  long i = 0;
+  
+  /* Check parameters */
+  if ((len < 0) || ((len > 0) && (pc == NULL))) {
+    abort();
+  }
+  
+  /* Hash each byte */
+  for(i = 0; i < len; i++) {
+    h = ((h ^ ((unsigned long) pc[i])) * SNHASH_FNV_PRIME)
+          & 0xffffffffUL;
+  }
+  
+  /* Return hash */
+  return h;
+}
+
+/*
+ * Initialize a string intern table.
+ * 
+ * The table starts out empty, without anything allocated.  It must
+ * eventually be released with snintern_release().
+ * 
+ * Parameters:
+ * 
+ *   pTable - the table to initialize
+ * 
+ *   pAlloc - the memory allocator, which must remain valid while the
+ *   table is in use
+ */
+static void snintern_init(SNINTERN *pTable, const SNALLOC *pAlloc) {
+  
+  /* Check parameters */
+  if ((pTable == NULL) || (pAlloc == NULL)) {
+    abort();
+  }
+  
+  /* Initialize structure */
+  memset(pTable, 0, sizeof(SNINTERN));
+  pTable->pData = NULL;
+  pTable->pIndex = NULL;
+  pTable->pSlots = NULL;
+  pTable->pAlloc = pAlloc;
+}
+
+/*
+ * Release all the memory of a string intern table.
+ * 
+ * The table is left empty, and it may be used again afterwards.
+ * 
+ * Parameters:
+ * 
+ *   pTable - the table to release
+ */
+static void snintern_release(SNINTERN *pTable) {
+  
+  /* Check parameter */
+  if (pTable == NULL) {
+    abort();
+  }
+  
+  /* Release each buffer that was allocated */
+  if (pTable->pData != NULL) {
+    snalloc_release(pTable->pAlloc, pTable->pData, pTable->data_cap);
+    pTable->pData = NULL;
+  }
+  if (pTable->pIndex != NULL) {
+    snalloc_release(pTable->pAlloc, pTable->pIndex,
+                    pTable->index_cap * 2 * ((long) sizeof(long)));
+    pTable->pIndex = NULL;
+  }
+  if (pTable->pSlots != NULL) {
+    snalloc_release(pTable->pAlloc, pTable->pSlots,
+                    pTable->slot_cap * ((long) sizeof(long)));
+    pTable->pSlots = NULL;
+  }
+  
+  /* Clear the counters */
+  pTable->data_cap = 0;
+  pTable->data_len = 0;
+  pTable->count = 0;
+  pTable->index_cap = 0;
+  pTable->slot_cap = 0;
+}
+
+/*
+ * Get the index of a string in a string intern table, adding the
+ * string if it is not there yet.
+ * 
+ * New strings get the next index, so a string is new exactly if the
+ * count of the table went up.  The function fails if memory runs out,
+ * in which case the string is not added and the table is otherwise
+ * unchanged.
+ * 
+ * Parameters:
+ * 
+ *   pTable - the table
+ * 
+ *   pStr - the string, which need not be null-terminated
+ * 
+ *   len - the length of the string in bytes, zero or greater
+ * 
+ *   pIndex - receives the index of the string
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int snintern_add(
+    SNINTERN   * pTable,
+    const char * pStr,
+    long         len,
+    long       * pIndex) {
+  
+  int status = 1;
+  int found = 0;
+  long i = 0;
+  long slot = 0;
+  long newcap = 0;
+  long *pNew = NULL;
+  char *pNewData = NULL;
+  
+  /* Check parameters */
+  if ((pTable == NULL) || (pStr == NULL) || (len < 0) ||
+      (pIndex == NULL)) {
+    abort();
+  }
+  
+  /* Double the hash table, rehashing all strings, if adding one more
+   * would make it more than half full */
+  if (pTable->count >= pTable->slot_cap / 2) {
+    if (pTable->slot_cap < 1) {
+      newcap = SNINTERN_INDEX_INIT * 2;
+    } else if (pTable->slot_cap <=
+                (LONG_MAX / 2) / ((long) sizeof(long))) {
+      newcap = pTable->slot_cap * 2;
+    } else {
+      status = 0;
+    }
+    
+    if (status) {
+      pNew = (long *) snalloc_get(pTable->pAlloc,
+                        newcap * ((long) sizeof(long)));
+      if (pNew == NULL) {
+        status = 0;
+      }
+    }
+    
+    if (status) {
+      memset(pNew, 0, ((size_t) newcap) * sizeof(long));
+      for(i = 0; i < pTable->count; i++) {
+        slot = (long) (snhash_fnv(
+                  (const unsigned char *)
+                    (pTable->pData + (pTable->pIndex)[2 * i]),
+                  (pTable->pIndex)[(2 * i) + 1])
+                & ((unsigned long) (newcap - 1)));
+        while (pNew[slot] != 0) {
+          slot = (slot + 1) & (newcap - 1);
+        }
+        pNew[slot] = i + 1;
+      }
+      
+      if (pTable->pSlots != NULL) {
+        snalloc_release(pTable->pAlloc, pTable->pSlots,
+                        pTable->slot_cap * ((long) sizeof(long)));
+      }
+      pTable->pSlots = pNew;
+      pTable->slot_cap = newcap;
+      pNew = NULL;
+    }
+  }
+  
+  /* Look for the string, stopping at the empty slot where it would go
+   * if it isn't there */
+  if (status) {
+    slot = (long) (snhash_fnv((const unsigned char *) pStr, len)
+                    & ((unsigned long) (pTable->slot_cap - 1)));
+    while ((!found) && ((pTable->pSlots)[slot] != 0)) {
+      i = (pTable->pSlots)[slot] - 1;
+      if (((pTable->pIndex)[(2 * i) + 1] == len) && ((len < 1) ||
+            (memcmp(pTable->pData + (pTable->pIndex)[2 * i],
+                    pStr, (size_t) len) == 0))) {
+        found = 1;
+      } else {
+        slot = (slot + 1) & (pTable->slot_cap - 1);
+      }
+    }
+  }
+  
+  /* If the string is new, make room for it in the index */
+  if (status && (!found) && (pTable->count >= pTable->index_cap)) {
+    if (pTable->index_cap < 1) {
+      newcap = SNINTERN_INDEX_INIT;
+    } else if (pTable->index_cap <=
+                (LONG_MAX / 4) / ((long) sizeof(long))) {
+      newcap = pTable->index_cap * 2;
+    } else {
+      status = 0;
+    }
+    
+    if (status) {
+      if (pTable->pIndex == NULL) {
+        pNew = (long *) snalloc_get(pTable->pAlloc,
+                          newcap * 2 * ((long) sizeof(long)));
+      } else {
+        pNew = (long *) snalloc_resize(pTable->pAlloc, pTable->pIndex,
+                          pTable->index_cap * 2 * ((long) sizeof(long)),
+                          newcap * 2 * ((long) sizeof(long)));
+      }
+      if (pNew != NULL) {
+        pTable->pIndex = pNew;
+        pTable->index_cap = newcap;
+        pNew = NULL;
+      } else {
+        status = 0;
+      }
+    }
+  }
+  
+  /* If the string is new, make room for it and its nul in the data */
+  if (status && (!found)) {
+    if (len >= LONG_MAX - pTable->data_len) {
+      status = 0;
+    }
+    if (status && (len >= pTable->data_cap - pTable->data_len)) {
+      if (pTable->data_cap < 1) {
+        newcap = SNINTERN_BYTES_INIT;
+      } else {
+        newcap = pTable->data_cap;
+      }
+      while (status && (len >= newcap - pTable->data_len)) {
+        if (newcap > (LONG_MAX / 2)) {
+          status = 0;
+        } else {
+          newcap = newcap * 2;
+        }
+      }
+      
+      if (status) {
+        if (pTable->pData == NULL) {
+          pNewData = (char *) snalloc_get(pTable->pAlloc, newcap);
+        } else {
+          pNewData = (char *) snalloc_resize(pTable->pAlloc,
+                        pTable->pData, pTable->data_cap, newcap);
+        }
+        if (pNewData != NULL) {
+          pTable->pData = pNewData;
+          pTable->data_cap = newcap;
+          pNewData = NULL;
+        } else {
+          status = 0;
+        }
+      }
+    }
+  }
+  
+  /* Add a new string */
+  if (status && (!found)) {
+    if (len > 0) {
+      memcpy(pTable->pData + pTable->data_len, pStr, (size_t) len);
+    }
+    (pTable->pData)[pTable->data_len + len] = (char) 0;
+    
+    i = pTable->count;
+    (pTable->pIndex)[2 * i] = pTable->data_len;
+    (pTable->pIndex)[(2 * i) + 1] = len;
+    (pTable->pSlots)[slot] = i + 1;
+    
+    pTable->data_len += (len + 1);
+    (pTable->count)++;
+  }
+  
+  /* Return the index if successful */
+  if (status) {
+    *pIndex = i;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Get a string from a string intern table.
+ * 
+ * The returned pointer is only valid until the next string is added to
+ * the table, since adding strings may move the data.  The string is
+ * null-terminated.
+ * 
+ * Parameters:
+ * 
+ *   pTable - the table
+ * 
+ *   index - the index of the string, which must be in range
+ * 
+ *   pLen - receives the length of the string, or NULL
+ * 
+ * Return:
+ * 
+ *   pointer to the string
+ */
+static const char *snintern_get(
+    SNINTERN * pTable,
+    long       index,
+    long     * pLen) {
+  
+  /* Check parameters */
+  if (pTable == NULL) {
+    abort();
+  }
+  if ((index < 0) || (index >= pTable->count)) {
+    abort();
+  }
+  
+  /* Return the string and its length */
+  if (pLen != NULL) {
+    *pLen = (pTable->pIndex)[(2 * index) + 1];
+  }
+  return (pTable->pData + (pTable->pIndex)[2 * index]);
+}
+
+/*
+ * Append bytes to a section of an entity cache that is being written.
+ * 
+ * ppBuf, pCap, and pLen are the buffer pointer, allocated size, and
+ * used length of the section.  The buffer grows by doubling as needed,
+ * through the allocator of the writer.  The function fails if the
+ * buffer can not grow, in which case the section is unmodified.
+ * 
+ * Parameters:
+ * 
+ *   pw - the cache writer
+ * 
+ *   ppBuf - the buffer pointer of the section
+ * 
+ *   pCap - the allocated size of the section
+ * 
+ *   pLen - the used length of the section
+ * 
+ *   pData - the bytes to append, which may be NULL only if n is zero
+ * 
+ *   n - the number of bytes to append, zero or greater
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory
+ */
+static int sncache_append(
+    SNCACHEWRITER       * pw,
+    unsigned char      ** ppBuf,
+    long                * pCap,
+    long                * pLen,
+    const unsigned char * pData,
+    long                  n) {
+  
+  int status = 1;
+  long newcap = 0;
+  unsigned char *pNew = NULL;
+  
+  /* Check parameters */
+  if ((pw == NULL) || (ppBuf == NULL) || (pCap == NULL) ||
+      (pLen == NULL) || (n < 0) || ((n > 0) && (pData == NULL))) {
+    abort();
+  }
+  
+  /* Grow the buffer if there isn't room */
+  if (n > *pCap - *pLen) {
+    if (*pCap < 1) {
+      newcap = SNCACHE_BYTES_INIT;
+    } else {
+      newcap = *pCap;
+    }
+    while (status && (n > newcap - *pLen)) {
+      if (newcap > (LONG_MAX / 2)) {
+        status = 0;
+      } else {
+        newcap = newcap * 2;
+      }
+    }
+    
+    if (status) {
+      if (*ppBuf == NULL) {
+        pNew = (unsigned char *) snalloc_get(pw->pAlloc, newcap);
+      } else {
+        pNew = (unsigned char *) snalloc_resize(
+                  pw->pAlloc, *ppBuf, *pCap, newcap);
+      }
+      if (pNew != NULL) {
+        *ppBuf = pNew;
+        *pCap = newcap;
+      } else {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Copy the bytes */
+  if (status && (n > 0)) {
+    memcpy(*ppBuf + *pLen, pData, (size_t) n);
+    *pLen += n;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Encode a value as a varint.
+ * 
+ * Varints store seven bits of the value in each byte, least
+ * significant bits first, with the high bit of each byte set if more
+ * bytes follow.
+ * 
+ * Parameters:
+ * 
+ *   pb - the buffer, which must have room for SNCACHE_VARINT_MAX bytes
+ * 
+ *   v - the value to encode
+ * 
+ * Return:
+ * 
+ *   the number of bytes written to the buffer
+ */
+static int sncache_varint(unsigned char *pb, unsigned long v) {
+  
+  int count = 0;
+  
+  /* Check parameter */
+  if (pb == NULL) {
+    abort();
+  }
+  
+  /* Write bytes with the continuation bit until the rest fits in
+   * seven bits */
+  while (v > 0x7fUL) {
+    if (count >= SNCACHE_VARINT_MAX - 1) {
+      abort();
+    }
+    pb[count] = (unsigned char) ((v & 0x7fUL) | 0x80UL);
+    count++;
+    v = v >> 7;
+  }
+  pb[count] = (unsigned char) v;
+  count++;
+  
+  /* Return byte count */
+  return count;
+}
 
 /*
- * Given a high surrogate and a low surrogate, return the supplemental
- * codepoint that the pair selects.
+ * Get the index of a string in the string section of an entity cache
+ * that is being written, adding the string if it is not there yet.
  * 
- * A fault occurs if hi is not in high surrogate range or lo is not in
- * low surrogate range.
+ * Identical strings are only stored once.  The function fails if
+ * memory runs out, in which case the string is not added.
  * 
  * Parameters:
  * 
- *   hi - the high surrogate
+ *   pw - the cache writer
  * 
- *   lo - the low surrogate
+ *   pStr - the string, which need not be null-terminated
+ * 
+ *   len - the length of the string in bytes, zero or greater
+ * 
+ *   pIndex - receives the index of the string
  * 
  * Return:
  * 
- *   the supplemental codepoint
+ *   non-zero if successful, zero if out of memory
  */
-static long snutf_pair(long hi, long lo) {
+static int sncache_string(
+    SNCACHEWRITER * pw,
+    const char    * pStr,
+    long            len,
+    long          * pIndex) {
   
-  long result = 0;
+  int status = 1;
+  long count = 0;
+  long size = 0;
+  unsigned char vb[SNCACHE_VARINT_MAX];
+  
+  /* Initialize buffers */
+  memset(vb, 0, sizeof(vb));
   
   /* Check parameters */
-  if ((hi < UNICODE_MIN_HI_SUR) || (hi > UNICODE_MAX_HI_SUR) ||
-      (lo < UNICODE_MIN_LO_SUR) || (lo > UNICODE_MAX_LO_SUR)) {
+  if ((pw == NULL) || (pIndex == NULL)) {
     abort();
   }
   
-  /* Convert hi and lo into offsets within their surrogate ranges */
-  hi = hi - UNICODE_MIN_HI_SUR;
-  lo = lo - UNICODE_MIN_LO_SUR;
-  
-  /* Combine hi and lo with bit shifting */
-  result = (hi << 10) | lo;
-  
-  /* Use as offset into surrogate range */
-  result = result + UNICODE_MIN_SUPPLEMENTAL;
+  /* Intern the string, and if it is new, count the bytes it takes in
+   * the string section */
+  count = pw->strings.count;
+  status = snintern_add(&(pw->strings), pStr, len, pIndex);
+  if (status && (pw->strings.count > count)) {
+    size = (long) sncache_varint(vb, (unsigned long) len);
+    if ((len >= LONG_MAX - size) ||
+        (len + size >= LONG_MAX - pw->str_bytes)) {
+      status = 0;
+    } else {
+      pw->str_bytes += (len + size + 1);
+    }
+  }
   
-  /* Return result */
-  return result;
+  /* Return status */
+  return status;
 }
 
 /*
- * Check a byte within a UTF-8 encoding to determine how many bytes long
- * the encoding is.
+ * Add an entity to the entity section of an entity cache that is being
+ * written.
  * 
- * c is the unsigned byte value to check.  It must be in range [0, 255].
- * 
- * The return value is one if the most significant bit of the byte is
- * clear (indicating an ASCII character), two to four if the given byte
- * is a UTF-8 lead byte, zero if the byte is a UTF-8 continuation byte,
- * and -1 if the byte is not a valid UTF-8 byte.
+ * Each entity is stored as a tag byte holding its status and string
+ * type (see SNCACHE_TAG_ERROR), followed by varints for the change in
+ * the line count, the change in the byte offset, the index of the key
+ * string if the entity has one, the index of the value string if the
+ * entity has one, and the count of ARRAY entities.
  * 
- * If a value greater than zero is returned, then the whole encoded
- * codepoint (including the leading byte) has that many bytes in it,
- * where any bytes after the first are continuation bytes.
+ * Line counts and byte offsets may never go down.  The function fails
+ * if memory runs out, in which case the cache should be discarded.
  * 
  * Parameters:
  * 
- *   c - the byte value to check
+ *   pw - the cache writer
+ * 
+ *   pEntity - the entity to add
+ * 
+ *   line - the line count after the entity was read
  * 
  * Return:
  * 
- *   the number of bytes in the encoded codepoint, or zero if the given
- *   byte is a continuation byte, or -1 if the byte is not valid UTF-8
+ *   non-zero if successful, zero if out of memory
  */
-static int snutf_count(int c) {
+static int sncache_entity(
+    SNCACHEWRITER  * pw,
+    const SNENTITY * pEntity,
+    long             line) {
   
-  int result = 0;
+  int status = 1;
+  int flags = 0;
+  long key = 0;
+  long value = 0;
+  long n = 0;
+  unsigned char eb[1 + (5 * SNCACHE_VARINT_MAX)];
   
-  /* Check parameter */
-  if ((c < 0) || (c > 255)) {
+  /* Initialize buffers */
+  memset(eb, 0, sizeof(eb));
+  
+  /* Check parameters */
+  if ((pw == NULL) || (pEntity == NULL) || (line < pw->line) ||
+      (pEntity->offset < pw->offset)) {
+    abort();
+  }
+  if ((pEntity->status < -(SNCACHE_TAG_ERROR - 1)) ||
+      (pEntity->status > SNCACHE_TAG_MASK) ||
+      (pEntity->str_type < 0) ||
+      (pEntity->str_type >
+        (SNCACHE_TAG_ERROR - 1) >> SNCACHE_TAG_SHIFT)) {
     abort();
   }
   
-  /* Determine result */
-  if (c <= 127) {
-    /* Everything in [0, 127] has one byte */
-    result = 1;
+  /* Get the string indices */
+  flags = snbatch_strings(pEntity->status);
+  if (flags & SNBATCH_KEY) {
+    status = sncache_string(pw, pEntity->pKey, pEntity->key_len, &key);
+  }
+  if (status && (flags & SNBATCH_VALUE)) {
+    status = sncache_string(pw,
+                pEntity->pValue, pEntity->value_len, &value);
+  }
   
-  } else if ((c & 0xC0) == 0x80) {
-    /* 10?????? bytes are continuation bytes */
-    result = 0;
-    
-  } else if ((c & 0xE0) == 0xC0) {
-    /* 110????? bytes are lead bytes for two-byte encodings */
-    result = 2;
-    
-  } else if ((c & 0xF0) == 0xE0) {
-    /* 1110???? bytes are lead bytes for three-byte encodings */
-    result = 3;
+  /* Encode the entity and add it to the section */
+  if (status) {
+    if (pEntity->status < 0) {
+      eb[n] = (unsigned char)
+                (SNCACHE_TAG_ERROR | (-(pEntity->status)));
+    } else {
+      eb[n] = (unsigned char) (pEntity->status |
+                (pEntity->str_type << SNCACHE_TAG_SHIFT));
+    }
+    n++;
     
-  } else if ((c & 0xF8) == 0xF0) {
-    /* 11110??? bytes are lead bytes for four-byte encodings */
-    result = 4;
+    n += sncache_varint(eb + n, (unsigned long) (line - pw->line));
+    n += sncache_varint(eb + n,
+            (unsigned long) (pEntity->offset - pw->offset));
+    if (flags & SNBATCH_KEY) {
+      n += sncache_varint(eb + n, (unsigned long) key);
+    }
+    if (flags & SNBATCH_VALUE) {
+      n += sncache_varint(eb + n, (unsigned long) value);
+    }
+    if (pEntity->status == SNENTITY_ARRAY) {
+      n += sncache_varint(eb + n, (unsigned long) pEntity->count);
+    }
     
-  } else {
-    /* Everything else is invalid UTF-8 */
-    result = -1;
+    status = sncache_append(pw, &(pw->pEnt), &(pw->ent_cap),
+                &(pw->ent_len), eb, n);
   }
   
-  /* Return result */
-  return result;
+  /* Update the counters */
+  if (status) {
+    (pw->ent_count)++;
+    pw->line = line;
+    pw->offset = pEntity->offset;
+  }
+  
+  /* Return status */
+  return status;
 }
 
 /*
- * Decode a UTF-8 codepoint.
+ * Write a complete entity cache to a file.
  * 
- * pc points to the start of an encoded UTF-8 codepoint.  Encoded UTF-8
- * codepoints may have from one to four bytes for a codepoint.  This
- * function will stop immediately and return an error if it encounters
- * a faulty encoding, and it is guaranteed safe to use on nul-terminated
- * strings, even if the strings have bad UTF-8 encodings.  (It will
- * never read beyond the terminating nul, even if the terminating nul
- * comes unexpectedly in the middle of an encoded UTF-8 codepoint.)
+ * The cache starts with the SNCACHE signature and the content hash of
+ * the source as four bytes, least significant first.  Then come
+ * varints for the length of the source in bytes, the number of
+ * strings, the length of the string section in bytes, and the number
+ * of entities.  Then come the string section and the entity section.
  * 
- * The leading byte pointed to by pc determines how many bytes are in
- * the encoding.  You can use snutf_count() to get this information
- * given a byte value.  Encodings that have more than one byte will have
- * all bytes after the first byte be continuation bytes.
+ * Parameters:
  * 
- * This function will check for and fail on overlong encodings -- that
- * is, encodings of codepoints that are unnecessarily long.  These are
- * blocked for security reasons, and should never occur in valid streams
- * of UTF-8.
+ *   pw - the cache writer holding the sections
  * 
- * This function allows surrogates to be decoded, even though surrogates
- * aren't supposed to be used in UTF-8.  Surrogates need to be resolved
- * by looking at more than one codepoint at a time, so they can't be
- * handled properly by this function.
+ *   pSrc - the source data that was parsed
  * 
- * Parameters:
+ *   src_len - the length of the source data in bytes
  * 
- *   pc - pointer to the UTF-8 codepoint
+ *   pOut - the file to write to
  * 
  * Return:
  * 
- *   a Unicode codepoint (including surrogates!), or -1 if the UTF-8
- *   encoding wasn't valid
+ *   non-zero if successful, zero if there was an I/O error
  */
-static long snutf_decode(const unsigned char *pc) {
+static int sncache_flush(
+    SNCACHEWRITER       * pw,
+    const unsigned char * pSrc,
+    long                  src_len,
+    FILE                * pOut) {
   
   int status = 1;
-  int ec = 0;
-  int x = 0;
-  long result = 0;
+  unsigned long h = 0;
+  long n = 0;
+  long i = 0;
+  long len = 0;
+  const char *pStr = NULL;
+  unsigned char hb[SNCACHE_FIXED + (4 * SNCACHE_VARINT_MAX)];
   
-  /* Check parameter */
-  if (pc == NULL) {
+  /* Initialize buffers */
+  memset(hb, 0, sizeof(hb));
+  
+  /* Check parameters */
+  if ((pw == NULL) || (pOut == NULL)) {
     abort();
   }
   
-  /* Determine encoded length */
-  ec = snutf_count(*pc);
-  if (ec < 1) {
-    /* If start of encoding is a continuation byte or not a valid UTF-8
-     * byte, fail */
+  /* Encode the header */
+  h = snhash_fnv(pSrc, src_len);
+  hb[0] = (unsigned char) SNCACHE_SIG_1;
+  hb[1] = (unsigned char) SNCACHE_SIG_2;
+  hb[2] = (unsigned char) SNCACHE_SIG_3;
+  hb[3] = (unsigned char) SNCACHE_VERSION;
+  hb[4] = (unsigned char) (h & 0xffUL);
+  hb[5] = (unsigned char) ((h >> 8) & 0xffUL);
+  hb[6] = (unsigned char) ((h >> 16) & 0xffUL);
+  hb[7] = (unsigned char) ((h >> 24) & 0xffUL);
+  n = SNCACHE_FIXED;
+  n += sncache_varint(hb + n, (unsigned long) src_len);
+  n += sncache_varint(hb + n, (unsigned long) pw->strings.count);
+  n += sncache_varint(hb + n, (unsigned long) pw->str_bytes);
+  n += sncache_varint(hb + n, (unsigned long) pw->ent_count);
+  
+  /* Write the header */
+  if (fwrite(hb, 1, (size_t) n, pOut) != (size_t) n) {
     status = 0;
   }
   
-  /* If there is more than one byte in the encoding, make sure all
-   * additional bytes are continuation bytes */
-  if (status) {
-    for(x = 1; x < ec; x++) {
-      if (snutf_count(pc[x]) != 0) {
-        status = 0;
-        break;
-      }
+  /* Write the string section, with each string written as its length
+   * followed by the string and its nul */
+  for(i = 0; status && (i < pw->strings.count); i++) {
+    pStr = snintern_get(&(pw->strings), i, &len);
+    n = sncache_varint(hb, (unsigned long) len);
+    if ((fwrite(hb, 1, (size_t) n, pOut) != (size_t) n) ||
+        (fwrite(pStr, 1, (size_t) (len + 1), pOut) !=
+          (size_t) (len + 1))) {
+      status = 0;
     }
   }
   
-  /* All UTF-8 bytes are available and of the correct type, so begin by
-   * getting the payload of the lead byte */
-  if (status) {
-    switch (ec) {
-      case 1:
-        /* For one-byte codes, the byte value is equal to the code */
-        result = pc[0];
-        break;
-      
-      case 2:
-        /* For two-byte codes, lead byte payload is ---PPPPP */
-        result = (pc[0] & 0x1F);
-        break;
-      
-      case 3:
-        /* For three-byte codes, lead byte payload is ----PPPP */
-        result = (pc[0] & 0x0F);
-        break;
-      
-      case 4:
-        /* For four-byte codes, lead byte payload is -----PPP */
-        result = (pc[0] & 0x07);
-        break;
-      
-      default:
-        /* Shouldn't happen */
-        abort();
+  /* Write the entity section */
+  if (status && (pw->ent_len > 0)) {
+    if (fwrite(pw->pEnt, 1, (size_t) pw->ent_len, pOut) !=
+          (size_t) pw->ent_len) {
+      status = 0;
     }
   }
   
-  /* Include the payload from any continuation bytes -- continuation
-   * byte payload is --PPPPPP */
-  if (status) {
-    for(x = 1; x < ec; x++) {
-      result = (result << 6) | (pc[x] & 0x3F);
-    }
+  /* Return status */
+  return status;
+}
+
+/*
+ * Release all the memory of an entity cache that is being written.
+ * 
+ * The structure itself is not released.
+ * 
+ * Parameters:
+ * 
+ *   pw - the cache writer
+ */
+static void sncache_release(SNCACHEWRITER *pw) {
+  
+  /* Check parameter */
+  if (pw == NULL) {
+    abort();
   }
   
-  /* Fail for any overlong encodings */
-  if (status) {
-    switch (ec) {
-      case 1:
-        /* One-byte encodings are never overlong */
-        break;
-      
-      case 2:
-        /* Two-byte encodings must be at least U+0080 */
-        if (result < 0x80L) {
-          status = 0;
-        }
-        break;
-      
-      case 3:
-        /* Three-byte encodings must be at least U+0800 */
-        if (result < 0x800L) {
-          status = 0;
-        }
-        break;
+  /* Release the strings and the entity section */
+  snintern_release(&(pw->strings));
+  if (pw->pEnt != NULL) {
+    snalloc_release(pw->pAlloc, pw->pEnt, pw->ent_cap);
+    pw->pEnt = NULL;
+  }
+}
+
+/*
+ * Decode a varint from cache data.
+ * 
+ * See sncache_varint() for the encoding.  The function fails if the
+ * varint runs past the end of the data or if its value is greater
+ * than LONG_MAX, which only happens if the cache is corrupt.
+ * 
+ * Parameters:
+ * 
+ *   pData - the cache data
+ * 
+ *   len - the length of the cache data
+ * 
+ *   pPos - the offset of the varint, which is advanced past it
+ * 
+ *   pValue - receives the value
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the varint is invalid
+ */
+static int sncache_decode(
+    const unsigned char * pData,
+    long                  len,
+    long                * pPos,
+    long                * pValue) {
+  
+  int status = 1;
+  int done = 0;
+  long pos = 0;
+  long v = 0;
+  long scale = 1;
+  long part = 0;
+  
+  /* Check parameters */
+  if ((pData == NULL) || (pPos == NULL) || (pValue == NULL)) {
+    abort();
+  }
+  
+  /* Add up the seven-bit parts until the last byte, failing if the
+   * value goes out of range */
+  pos = *pPos;
+  while (status && (!done)) {
+    if ((pos < 0) || (pos >= len)) {
+      status = 0;
+    }
+    
+    if (status) {
+      part = (long) (pData[pos] & 0x7f);
+      done = !(pData[pos] & 0x80);
+      pos++;
       
-      case 4:
-        /* Four-byte encodings must be at least U+10000 */
-        if (result < 0x10000L) {
+      if (part > 0) {
+        if ((scale > LONG_MAX / part) ||
+            (part * scale > LONG_MAX - v)) {
           status = 0;
+        } else {
+          v += part * scale;
         }
-        break;
-      
-      default:
-        /* Shouldn't happen */
-        abort();
+      }
+    }
+    
+    if (status && (!done)) {
+      if (scale > LONG_MAX / 128) {
+        status = 0;
+      } else {
+        scale = scale * 128;
+      }
     }
   }
   
-  /* If we failed, set result to -1 */
-  if (!status) {
-    result = -1;
+  /* Store the results if successful */
+  if (status) {
+    *pPos = pos;
+    *pValue = v;
   }
   
-  /* Return result */
-  return result;
+  /* Return status */
+  return status;
 }
 
 /*
- * Encode a Unicode codepoint into UTF-8.
- * 
- * The given codepoint must be in [0, UNICODE_MAX_CPV] range.  Also, it
- * must NOT be in [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE] range.
+ * Check the header of a loaded entity cache and index its strings.
  * 
- * pb points to the buffer to write the encoded codepoint into.  This
- * function will write from one to four bytes into the buffer.  Make
- * sure there is enough room in the buffer for the encoded codepoint!
+ * pCache must have its cache file loaded in pMap and nothing else set
+ * up yet.  If check is non-zero, then pSrc and src_len are the source
+ * data that the cache must have been written from, and the function
+ * fails if the length or hash in the cache doesn't match, so that
+ * stale caches are rejected.  If check is zero, they are ignored.
  * 
- * One way of handling the buffer is to allocate a buffer of five
- * characters, initialize all the characters to nul, and then call this
- * function on the buffer.  After this function returns, then, the
- * result will be nul-terminated (except if the given codepoint is zero,
- * in which case the result will be empty).
+ * The function also fails if the cache is not a valid cache, or if the
+ * string index can not be allocated.  If successful, the replay state
+ * is set to the start of the entities.
  * 
  * Parameters:
  * 
- *   cpv - the Unicode codepoint
+ *   pCache - the cache source
  * 
- *   pb - the buffer to write the result into
+ *   pSrc - the source data to check against
+ * 
+ *   src_len - the length of the source data
+ * 
+ *   check - non-zero to check against the source data
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the cache can not be used
  */
-static void snutf_encode(long cpv, unsigned char *pb) {
+static int sncache_load(
+    SNCACHESRC          * pCache,
+    const unsigned char * pSrc,
+    long                  src_len,
+    int                   check) {
   
-  int ec = 0;
-  int c = 0;
-  int i = 0;
+  int status = 1;
+  const unsigned char *pd = NULL;
+  long len = 0;
+  long pos = 0;
+  long end = 0;
+  long i = 0;
+  long slen = 0;
+  long stored_len = 0;
+  long str_bytes = 0;
+  unsigned long h = 0;
   
   /* Check parameters */
-  if (pb == NULL) {
+  if ((pCache == NULL) || (pCache->pMap == NULL)) {
     abort();
   }
-  if ((cpv < 0) || (cpv > UNICODE_MAX_CPV) ||
-        ((cpv >= UNICODE_MIN_SURROGATE) &&
-          (cpv <= UNICODE_MAX_SURROGATE))) {
-    abort();
+  
+  pd = pCache->pMap->pData;
+  len = pCache->pMap->len;
+  
+  /* Check the signature */
+  if (len < SNCACHE_FIXED) {
+    status = 0;
+  } else if ((pd[0] != SNCACHE_SIG_1) || (pd[1] != SNCACHE_SIG_2) ||
+              (pd[2] != SNCACHE_SIG_3) || (pd[3] != SNCACHE_VERSION)) {
+    status = 0;
   }
   
-  /* From the codepoint value, figure out the encoded length of the
-   * codepoint */
-  if (cpv < 0x80L) {
-    /* U+0000 to 0+007F has one-byte encodings */
-    ec = 1;
+  /* Decode the rest of the header */
+  if (status) {
+    h = ((unsigned long) pd[4]) |
+        (((unsigned long) pd[5]) << 8) |
+        (((unsigned long) pd[6]) << 16) |
+        (((unsigned long) pd[7]) << 24);
+    pos = SNCACHE_FIXED;
+    if ((!sncache_decode(pd, len, &pos, &stored_len)) ||
+        (!sncache_decode(pd, len, &pos, &(pCache->str_count))) ||
+        (!sncache_decode(pd, len, &pos, &str_bytes)) ||
+        (!sncache_decode(pd, len, &pos, &(pCache->ent_count)))) {
+      status = 0;
+    }
+  }
+  
+  /* Check against the source, comparing the lengths before going to
+   * the trouble of hashing */
+  if (status && check) {
+    if ((stored_len != src_len) || (h != snhash_fnv(pSrc, src_len))) {
+      status = 0;
+    }
+  }
+  
+  /* Check that the sections make sense, where every string takes at
+   * least two bytes and there is at least one entity */
+  if (status) {
+    if ((str_bytes > len - pos) ||
+        (pCache->str_count > str_bytes / 2) ||
+        (pCache->ent_count < 1)) {
+      status = 0;
+    }
+  }
+  
+  /* Allocate the string index */
+  if (status && (pCache->str_count > 0)) {
+    if (pCache->str_count > LONG_MAX / ((long) sizeof(long))) {
+      status = 0;
+    }
+    if (status) {
+      pCache->pOff = (long *) snalloc_get(&(pCache->alloc),
+                        pCache->str_count * ((long) sizeof(long)));
+      pCache->pLen = (long *) snalloc_get(&(pCache->alloc),
+                        pCache->str_count * ((long) sizeof(long)));
+      if ((pCache->pOff == NULL) || (pCache->pLen == NULL)) {
+        status = 0;
+      }
+    }
+  }
+  
+  /* Index the strings, each of which must fit in the string section
+   * and end with a nul */
+  end = pos + str_bytes;
+  for(i = 0; status && (i < pCache->str_count); i++) {
+    if (!sncache_decode(pd, end, &pos, &slen)) {
+      status = 0;
+    } else if (slen >= end - pos) {
+      status = 0;
+    } else if (pd[pos + slen] != 0) {
+      status = 0;
+    } else {
+      (pCache->pOff)[i] = pos;
+      (pCache->pLen)[i] = slen;
+      pos += (slen + 1);
+    }
+  }
+  if (status && (pos != end)) {
+    status = 0;
+  }
+  
+  /* Set up replay, or release the string index if failed */
+  if (status) {
+    pCache->ent_start = end;
+    sncache_restart(pCache);
   
-  } else if (cpv < 0x800L) {
-    /* U+0080 to U+07FF has two-byte encodings */
-    ec = 2;
-    
-  } else if (cpv < 0x10000L) {
-    /* U+0800 to U+FFFF has three-byte encodings */
-    ec = 3;
-    
-  } else if (cpv <= UNICODE_MAX_CPV) {
-    /* U+10000 to end of Unicode range has four-byte encodings */
-    ec = 4;
-    
   } else {
-    /* Shouldn't happen */
+    if (pCache->pOff != NULL) {
+      snalloc_release(&(pCache->alloc), pCache->pOff,
+                      pCache->str_count * ((long) sizeof(long)));
+      pCache->pOff = NULL;
+    }
+    if (pCache->pLen != NULL) {
+      snalloc_release(&(pCache->alloc), pCache->pLen,
+                      pCache->str_count * ((long) sizeof(long)));
+      pCache->pLen = NULL;
+    }
+    pCache->str_count = 0;
+  }
+  
+  /* Return status */
+  return status;
+}
+
+/*
+ * Destructor callback for an entity cache source.
+ * 
+ * The function prototype matches pfDestruct in SNSOURCE.  See the
+ * documentation of that field for further information.
+ */
+static void sncache_free(void *pCustom) {
+  
+  SNCACHESRC *pCache = NULL;
+  SNALLOC alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameter */
+  if (pCustom == NULL) {
     abort();
   }
   
-  /* Align the cpv by left shifting so that everything has payload bits
-   * for three continuation bytes; that is, for one-byte codes, add
-   * 18 (= 6 x 3) bits; for two-byte codes, add 12 (= 6 x 2) bits; for
-   * three-byte codes, add 6 bits; and nothing for four-byte codes,
-   * which already have three continuation bytes */
-  if (ec == 1) {
-    cpv = cpv << 18;
+  /* Convert parameter to the cache structure */
+  pCache = (SNCACHESRC *) pCustom;
   
-  } else if (ec == 2) {
-    cpv = cpv << 12;
-    
-  } else if (ec == 3) {
-    cpv = cpv << 6;
+  /* Release the string index and the cache file */
+  if (pCache->pOff != NULL) {
+    snalloc_release(&(pCache->alloc), pCache->pOff,
+                    pCache->str_count * ((long) sizeof(long)));
+    pCache->pOff = NULL;
+  }
+  if (pCache->pLen != NULL) {
+    snalloc_release(&(pCache->alloc), pCache->pLen,
+                    pCache->str_count * ((long) sizeof(long)));
+    pCache->pLen = NULL;
+  }
+  if (pCache->pMap != NULL) {
+    snsource_map_free((void *) pCache->pMap);
+    pCache->pMap = NULL;
   }
   
-  /* Lead byte payload is now always 18 bits shifted, so combine it with
-   * the appropriate marker bits and write the first encoded byte */
-  c = (int) (cpv >> 18);
+  /* Free the structure, through a copy of the allocator since the
+   * allocator is stored in the structure */
+  memcpy(&alloc, &(pCache->alloc), sizeof(SNALLOC));
+  snalloc_release(&alloc, pCache, (long) sizeof(SNCACHESRC));
+}
+
+/*
+ * Set the replay state of an entity cache source back to the first
+ * entity.
+ * 
+ * Parameters:
+ * 
+ *   pCache - the cache source
+ */
+static void sncache_restart(SNCACHESRC *pCache) {
   
-  if (ec == 2) {
-    c = c | 0xC0;
+  /* Check parameter */
+  if (pCache == NULL) {
+    abort();
+  }
   
-  } else if (ec == 3) {
-    c = c | 0xE0;
-    
-  } else if (ec == 4) {
-    c = c | 0xF0;
+  /* Reset the replay state */
+  pCache->pos = pCache->ent_start;
+  pCache->ent_read = 0;
+  pCache->line = 1;
+  pCache->offset = 0;
+  pCache->done = 0;
+  memset(&(pCache->last), 0, sizeof(SNENTITY));
+}
+
+/*
+ * Replay the next entity from an entity cache source.
+ * 
+ * The strings of the entity point directly into the cache data, so
+ * they stay valid while the source is allocated, and they are always
+ * null-terminated.
+ * 
+ * The line count of the filter is set to the line count that was
+ * stored with the entity, so that snfilter_count() returns it.
+ * 
+ * Once the EOF entity or an error has been replayed, it is returned
+ * again on all further calls.  If the cache data turns out to be
+ * corrupt, an SNERR_IOERR error is returned.
+ * 
+ * Parameters:
+ * 
+ *   pCache - the cache source
+ * 
+ *   pEntity - receives the entity
+ * 
+ *   pFilter - the input filter of the parser
+ */
+static void sncache_replay(
+    SNCACHESRC * pCache,
+    SNENTITY   * pEntity,
+    SNFILTER   * pFilter) {
+  
+  int status = 1;
+  int tag = 0;
+  int flags = 0;
+  const unsigned char *pd = NULL;
+  long len = 0;
+  long pos = 0;
+  long v = 0;
+  long line = 0;
+  long offset = 0;
+  
+  /* Check parameters */
+  if ((pCache == NULL) || (pEntity == NULL) || (pFilter == NULL)) {
+    abort();
   }
   
-  *pb = (unsigned char) c;
-  pb++;
+  /* Clear provided entity */
+  memset(pEntity, 0, sizeof(SNENTITY));
   
-  /* Mask out the lead byte payload, leaving just the continuation byte
-   * payloads */
-  cpv = cpv & 0x3ffffL;
+  pd = pCache->pMap->pData;
+  len = pCache->pMap->len;
+  pos = pCache->pos;
+  line = pCache->line;
+  offset = pCache->offset;
   
-  /* Write any continuation bytes */
-  for(i = 1; i < ec; i++) {
-    /* Get most significant continuation payload */
-    c = (int) (cpv >> 12);
+  /* Decode the next entity unless the final entity was reached */
+  if (!(pCache->done)) {
     
-    /* Add continuation marker bit */
-    c = c | 0x80;
+    /* Decode the tag byte into the status and string type */
+    if ((pCache->ent_read >= pCache->ent_count) || (pos >= len)) {
+      status = 0;
+    } else {
+      tag = (int) pd[pos];
+      pos++;
+      if (tag & SNCACHE_TAG_ERROR) {
+        pEntity->status = -(tag & (SNCACHE_TAG_ERROR - 1));
+        if (pEntity->status == 0) {
+          status = 0;
+        }
+      } else {
+        pEntity->status = tag & SNCACHE_TAG_MASK;
+        pEntity->str_type = tag >> SNCACHE_TAG_SHIFT;
+        if ((pEntity->status > SNENTITY_END_STRING) ||
+            (pEntity->str_type > SNSTRING_CURLY)) {
+          status = 0;
+        }
+      }
+    }
     
-    /* Output continuation byte */
-    *pb = (unsigned char) c;
-    pb++;
+    /* Decode the change in line count */
+    if (status) {
+      if (!sncache_decode(pd, len, &pos, &v)) {
+        status = 0;
+      } else if (v > LONG_MAX - line) {
+        status = 0;
+      } else {
+        line += v;
+      }
+    }
     
-    /* Mask out most significant continuation payload */
-    cpv = cpv & 0xfffL;
+    /* Decode the change in byte offset */
+    if (status) {
+      if (!sncache_decode(pd, len, &pos, &v)) {
+        status = 0;
+      } else if (v > LONG_MAX - offset) {
+        status = 0;
+      } else {
+        offset += v;
+        pEntity->offset = offset;
+      }
+    }
     
-    /* Shift continuation payloads left */
-    cpv = cpv << 6;
+    /* Decode the strings and the array count */
+    flags = snbatch_strings(pEntity->status);
+    if (status && (flags & SNBATCH_KEY)) {
+      if ((!sncache_decode(pd, len, &pos, &v)) ||
+          (v >= pCache->str_count)) {
+        status = 0;
+      } else {
+        pEntity->pKey = (char *) (pd + (pCache->pOff)[v]);
+        pEntity->key_len = (pCache->pLen)[v];
+      }
+    }
+    if (status && (flags & SNBATCH_VALUE)) {
+      if ((!sncache_decode(pd, len, &pos, &v)) ||
+          (v >= pCache->str_count)) {
+        status = 0;
+      } else {
+        pEntity->pValue = (char *) (pd + (pCache->pOff)[v]);
+        pEntity->value_len = (pCache->pLen)[v];
+      }
+    }
+    if (status && (pEntity->status == SNENTITY_ARRAY)) {
+      if (!sncache_decode(pd, len, &pos, &(pEntity->count))) {
+        status = 0;
+      }
+    }
+    
+    /* Advance the replay state, turning corrupt data into an I/O
+     * error, and keep the entity if it is the final one */
+    if (status) {
+      pCache->pos = pos;
+      pCache->line = line;
+      pCache->offset = offset;
+      (pCache->ent_read)++;
+    } else {
+      memset(pEntity, 0, sizeof(SNENTITY));
+      pEntity->status = SNERR_IOERR;
+    }
+    
+    if (pEntity->status <= 0) {
+      memcpy(&(pCache->last), pEntity, sizeof(SNENTITY));
+      pCache->done = 1;
+    }
+  
+  } else {
+    /* Final entity already reached, so return it again */
+    memcpy(pEntity, &(pCache->last), sizeof(SNENTITY));
   }
+  
+  /* Make the filter report the line count of the entity */
+  pFilter->line_count = pCache->line;
+  pFilter->c = 0;
+  pFilter->pushback = 0;
 }
 
 /*
- * Reading callback for a stdio FILE * source.
+ * Block sink callback for a stdio FILE * writer.
  * 
- * The function prototype matches pfRead in SNSOURCE.  See the
+ * The function prototype matches pfSink in SNWRITER.  See the
  * documentation of that field for further information.
  */
-static int snsource_file_read(void *pCustom) {
+static int snwriter_file_sink(
+    void                * pCustom,
+    const unsigned char * pData,
+    long                  len) {
   
-  FILE *pIn = NULL;
+  FILE *pOut = NULL;
   int result = 0;
   
-  /* Check parameter */
-  if (pCustom == NULL) {
+  /* Check parameters */
+  if ((pCustom == NULL) || (pData == NULL) || (len < 1)) {
     abort();
   }
   
   /* Convert parameter to a FILE * handle */
-  pIn = (FILE *) pCustom;
+  pOut = (FILE *) pCustom;
   
-  /* Read from the file and check for EOF and I/O error conditions */
-  result = getc(pIn);
-  if (result == EOF) {
-    if (feof(pIn)) {
-      result = SNERR_EOF;
-    } else {
-      result = SNERR_IOERR;
-    }
+  /* Write the bytes */
+  if (fwrite(pData, 1, (size_t) len, pOut) == (size_t) len) {
+    result = 1;
+  } else {
+    result = 0;
   }
   
   /* Return result */
@@ -1114,3184 +14373,3765 @@ static int snsource_file_read(void *pCustom) {
 }
 
 /*
- * Destructor callback for a stdio FILE * source.
+ * Hand everything in the buffer of a writer to its sink.
  * 
- * The function prototype matches pfDestruct in SNSOURCE.  See the
- * documentation of that field for further information.
- */
-static void snsource_file_free(void *pCustom) {
-  
-  FILE *pIn = NULL;
-  
+ * The buffer is empty afterwards.  If the sink fails, the writer is put
+ * into an SNERR_IOERR error state.  Nothing is handed to the sink if
+ * the writer is already in an error state.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ */
+static void snwriter_drain(SNWRITER *pWriter) {
+
   /* Check parameter */
-  if (pCustom == NULL) {
+  if (pWriter == NULL) {
     abort();
   }
   
-  /* Convert parameter to a FILE * handle */
-  pIn = (FILE *) pCustom;
+  /* Hand the buffered bytes to the sink */
+  if ((!(pWriter->status)) && (pWriter->buf_len > 0)) {
+    if (!(*(pWriter->pfSink))(pWriter->pCustom,
+                              pWriter->pBuf, pWriter->buf_len)) {
+      pWriter->status = SNERR_IOERR;
+    }
+  }
   
-  /* Close the file */
-  fclose(pIn);
+  /* Empty the buffer */
+  pWriter->buf_len = 0;
 }
 
 /*
- * Rewind callback for a stdio FILE * source.
+ * Write bytes through the buffer of a writer.
  * 
- * The function prototype matches pfRewind in SNSOURCE.  See the
- * documentation of that field for further information.
+ * The bytes are copied into the buffer, which is handed to the sink
+ * whenever it fills up.  Runs of bytes that are at least as large as
+ * the whole buffer are handed to the sink directly, after whatever is
+ * already in the buffer.
+ * 
+ * Nothing is written if the writer is in an error state, which may
+ * also happen partway through if the sink fails.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pData - the bytes to write
+ * 
+ *   len - the number of bytes to write
  */
-static int snsource_file_rewind(void *pCustom) {
+static void snwriter_put(
+    SNWRITER            * pWriter,
+    const unsigned char * pData,
+    long                  len) {
   
-  int status = 1;
-  FILE *pIn = NULL;
+  long n = 0;
   
-  /* Check parameter */
-  if (pCustom == NULL) {
+  /* Check parameters */
+  if ((pWriter == NULL) || (len < 0) ||
+      ((len > 0) && (pData == NULL))) {
     abort();
   }
   
-  /* Convert parameter to a FILE * handle */
-  pIn = (FILE *) pCustom;
+  /* Update the total, which stops at LONG_MAX */
+  if (!(pWriter->status)) {
+    if (len <= LONG_MAX - pWriter->total) {
+      pWriter->total = pWriter->total + len;
+    } else {
+      pWriter->total = LONG_MAX;
+    }
+  }
   
-  /* Seek back to the beginning of the file */
-  if (fseek(pIn, 0, SEEK_SET)) {
-    status = 0;
+  /* Large runs bypass the buffer */
+  if ((!(pWriter->status)) && (len >= SNWRITER_BUFFER_SIZE)) {
+    snwriter_drain(pWriter);
+    if (!(pWriter->status)) {
+      if (!(*(pWriter->pfSink))(pWriter->pCustom, pData, len)) {
+        pWriter->status = SNERR_IOERR;
+      }
+    }
+    len = 0;
   }
   
-  /* Return status */
-  return status;
+  /* Copy everything else through the buffer */
+  while ((!(pWriter->status)) && (len > 0)) {
+    n = SNWRITER_BUFFER_SIZE - pWriter->buf_len;
+    if (n > len) {
+      n = len;
+    }
+    memcpy(pWriter->pBuf + pWriter->buf_len, pData, (size_t) n);
+    pWriter->buf_len = pWriter->buf_len + n;
+    pData = pData + n;
+    len = len - n;
+    
+    if (pWriter->buf_len >= SNWRITER_BUFFER_SIZE) {
+      snwriter_drain(pWriter);
+    }
+  }
 }
 
 /*
- * Reading callback for a string source.
+ * Write the whitespace that goes before a token.
  * 
- * The function prototype matches pfRead in SNSOURCE.  See the
- * documentation of that field for further information.
+ * kind is one of the SNWRITER_ token kinds.  The position on the line
+ * and the bar flag are updated as if the token has been written,
+ * assuming it is not a lone |.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   kind - the kind of token that follows
  */
-static int snsource_str_read(void *pCustom) {
-  
-  SNSTRSRC *pStS = NULL;
-  int c = 0;
+static void snwriter_lead(SNWRITER *pWriter, int kind) {
+
+  int sp = 0;
   
-  /* Check parameter */
-  if (pCustom == NULL) {
+  /* Check parameters */
+  if (pWriter == NULL) {
     abort();
   }
   
-  /* Convert parameter to the string handling structure */
-  pStS = (SNSTRSRC *) pCustom;
+  /* Determine whether a space is needed */
+  if (kind == SNWRITER_CLOSE) {
+    if (pWriter->bar) {
+      sp = 1;
+    }
+  } else if ((kind == SNWRITER_PLAIN) || (kind == SNWRITER_OPEN)) {
+    if (pWriter->col > 1) {
+      sp = 1;
+    }
+  } else {
+    abort();
+  }
   
-  /* Get current character */
-  c = *(pStS->pStr);
+  /* Write the space */
+  if (sp) {
+    snwriter_put(pWriter, (const unsigned char *) " ", 1);
+  }
   
-  /* If current character is not nul, then advance pointer; else, set
-   * return to EOF condition and don't advance pointer */
-  if (c != 0) {
-    (pStS->pStr)++;
+  /* Update the position and the bar flag */
+  if (kind == SNWRITER_OPEN) {
+    pWriter->col = 1;
   } else {
-    c = SNERR_EOF;
+    pWriter->col = 2;
   }
-  
-  /* Return the character or EOF */
-  return c;
+  pWriter->bar = 0;
 }
 
 /*
- * Destructor callback for a string source.
+ * Write a token along with the whitespace that goes before it.
  * 
- * The function prototype matches pfDestruct in SNSOURCE.  See the
- * documentation of that field for further information.
+ * pc points to the token and len is its length, which must be greater
+ * than zero.  kind is one of the SNWRITER_ token kinds.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pc - the token
+ * 
+ *   len - the length of the token
+ * 
+ *   kind - the kind of token
  */
-static void snsource_str_free(void *pCustom) {
+static void snwriter_token(
+    SNWRITER   * pWriter,
+    const char * pc,
+    long         len,
+    int          kind) {
   
-  SNSTRSRC *pStS = NULL;
-  
-  /* Check parameter */
-  if (pCustom == NULL) {
+  /* Check parameters */
+  if ((pWriter == NULL) || (pc == NULL) || (len < 1)) {
     abort();
   }
   
-  /* Convert parameter to the string handling structure */
-  pStS = (SNSTRSRC *) pCustom;
+  /* Write the token */
+  snwriter_lead(pWriter, kind);
+  snwriter_put(pWriter, (const unsigned char *) pc, len);
   
-  /* Free the structure */
-  free(pStS);
+  /* Set the bar flag if this is a lone | */
+  if ((len == 1) && (pc[0] == ASCII_BAR)) {
+    pWriter->bar = 1;
+  }
 }
 
 /*
- * Rewind callback for a string source.
+ * Write a line break.
  * 
- * The function prototype matches pfRewind in SNSOURCE.  See the
- * documentation of that field for further information.
+ * Parameters:
+ * 
+ *   pWriter - the writer
  */
-static int snsource_str_rewind(void *pCustom) {
-  
-  SNSTRSRC *pStS = NULL;
-  
+static void snwriter_newline(SNWRITER *pWriter) {
+
   /* Check parameter */
-  if (pCustom == NULL) {
+  if (pWriter == NULL) {
     abort();
   }
   
-  /* Convert parameter to the string handling structure */
-  pStS = (SNSTRSRC *) pCustom;
-  
-  /* Reset the string pointer back to its initial value */
-  pStS->pStr = pStS->pRewind;
-  
-  /* This operation always succeeds */
-  return 1;
+  /* Write the line break and note the start of a new line */
+  snwriter_put(pWriter, (const unsigned char *) "\n", 1);
+  pWriter->col = 0;
+  pWriter->bar = 0;
 }
 
 /*
- * Read a single byte from a source object.
- * 
- * The return value is an unsigned byte value in range [0, 255], or else
- * SNERR_EOF or SNERR_IOERR.  SNERR_UTF8 is never generated by this
- * function, but it may be returned because snsource_readCPV() may set
- * the status of the source object to that error.
+ * Check that a writer can write another entity.
  * 
- * Clients are recommended to use snsource_readCPV() instead of directly
- * using this function.
+ * A fault occurs if a string begun with snwriter_beginstring() is still
+ * open.  If the |; token has already been written, the writer is put
+ * into an SNERR_TRAILER error state.  The grouping stack is given its
+ * initial zero value if it is still empty.
  * 
  * Parameters:
  * 
- *   pIn - the source to read from
+ *   pWriter - the writer
  * 
  * Return:
  * 
- *   the next byte read, or SNERR_EOF if nothing remains in input
- *   source, or SNERR_IOERR if there was an error reading the input
- *   source, or SNERR_UTF8 if there was a previous UTF-8 decoding error
+ *   the status of the writer, which is zero if the entity can be
+ *   written
  */
-static int snsource_read(SNSOURCE *pIn) {
+static int snwriter_start(SNWRITER *pWriter) {
+
+  /* Check parameter and state */
+  if (pWriter == NULL) {
+    abort();
+  }
+  if ((!(pWriter->status)) && (pWriter->str_type != 0)) {
+    abort();
+  }
   
-  int result = 0;
+  /* Nothing may follow the |; token */
+  if ((!(pWriter->status)) && pWriter->eof) {
+    pWriter->status = SNERR_TRAILER;
+  }
+  
+  /* If grouping stack is empty, initialize it with a value of zero,
+   * which can only fail if out of memory */
+  if (!(pWriter->status)) {
+    if (snstack_count(&(pWriter->stack_group)) < 1) {
+      if (!snstack_push(&(pWriter->stack_group), 0)) {
+        pWriter->status = SNERR_NOMEM;
+      }
+    }
+  }
+  
+  /* Return status */
+  return pWriter->status;
+}
+
+/*
+ * Perform the array prefix operation of a writer.
+ * 
+ * This works the same way as snreader_arrayPrefix(), and it should be
+ * performed before every token outside of metacommands except for "]".
+ * The "[" token has already been written, so nothing is written here.
+ * 
+ * This function may set the writer into an error state.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ */
+static void snwriter_prefix(SNWRITER *pWriter) {
+
+  int err_code = 0;
   
   /* Check parameter */
-  if (pIn == NULL) {
+  if (pWriter == NULL) {
     abort();
   }
   
-  /* Determine first whether we have a special condition to return
-   * without invoking the callback */
-  if (pIn->status < 0) {
-    /* We have a special status code, so just use that */
-    result = pIn->status;
+  /* Only do something if array flag is set */
+  if ((!(pWriter->status)) && pWriter->array_flag) {
     
-  } else {
-    /* No special status code, so we need to invoke the read callback;
-     * check first that the callback is defined */
-    if (pIn->pfRead == NULL) {
-      abort();
-    }
+    /* Clear the array flag */
+    pWriter->array_flag = 0;
     
-    /* Invoke the read callback */
-    result = (*(pIn->pfRead))(pIn->pCustom);
+    /* Push a value of one on top of the array stack and a value of zero
+     * on top of the grouping stack to begin a new array */
+    if (!snstack_push(&(pWriter->stack_array), 1)) {
+      err_code = SNERR_DEEPARRAY;
+    }
+    if (!err_code) {
+      if (!snstack_push(&(pWriter->stack_group), 0)) {
+        err_code = SNERR_DEEPARRAY;
+      }
+    }
     
-    /* Check range of returned result */
-    if (((result < 0) || (result > 255)) &&
-          (result != SNERR_EOF) && (result != SNERR_IOERR)) {
-      abort();
+    /* If memory ran out, report that instead */
+    if (err_code && (pWriter->stack_array.nomem ||
+                      pWriter->stack_group.nomem)) {
+      err_code = SNERR_NOMEM;
     }
     
-    /* If returned result was an unsigned byte value, increment the read
-     * count (unless it has overflown); otherwise, if it is a special
-     * return code, store it in status so we return it in future
-     * invocations */
-    if ((result >= 0) && (result <= 255)) {
-      if (pIn->read_count < LONG_MAX) {
-        (pIn->read_count)++;
-      }
-    } else {
-      pIn->status = result;
+    /* If error, set error in writer */
+    if (err_code) {
+      pWriter->status = err_code;
     }
   }
-  
-  /* Return result */
-  return result;
 }
 
 /*
- * Read a UTF-8 encoded Unicode codepoint from a source object.
- * 
- * The return value is a Unicode codepoint [0, UNICODE_MAX_CPV], or else
- * SNERR_EOF if end of source file, SNERR_IOERR if I/O error reading
- * from source, or SNERR_UTF8 if error decoding UTF-8.
+ * Get the length of a token that only has plain characters.
  * 
- * This function will only decode a single UTF-8 codepoint.  It will
- * check for overlong encodings and invalid encodings, causing the
- * SNERR_UTF8 error if such illegal encodings occur.
- * 
- * This function WILL successfully decode surrogate codepoints, even
- * though surrogates aren't supposed to be used in UTF-8.  It is assumed
- * that surrogate pairs will be properly decoded at a higher level.
+ * pc is the nul-terminated token.  Plain characters are the characters
+ * that can appear anywhere in a token without ending it, according to
+ * snchar_class().
  * 
  * Parameters:
  * 
- *   pIn - the source to read from
+ *   pc - the token
  * 
  * Return:
  * 
- *   the next codepoint read (including surrogates!), or SNERR_EOF if
- *   nothing remains in input source, or SNERR_IOERR if there was an
- *   error reading the input source, or SNERR_UTF8 if there was a UTF-8
- *   decoding error
+ *   the length of the token, which may be zero, or -1 if the token has
+ *   a character that is not plain
  */
-static long snsource_readCPV(SNSOURCE *pIn) {
-  
-  unsigned char buf[5];
-  long result = 0;
-  int err_num = 0;
-  int c = 0;
-  int ec = 0;
-  int i = 0;
-  
-  /* Initialize buffer */
-  memset(buf, 0, 5);
+static long snwriter_plain(const char *pc) {
+
+  long len = 0;
   
-  /* Check parameters */
-  if (pIn == NULL) {
+  /* Check parameter */
+  if (pc == NULL) {
     abort();
   }
   
-  /* Get the next byte */
-  c = snsource_read(pIn);
-  
-  /* If we got a special status return, then result is that; otherwise,
-   * proceed */
-  if (c < 0) {
-    /* Special status return, so that will be the result */
-    result = c;
-  
-  } else {
-    /* We read a byte, so determine how many bytes in the encoded
-     * codepoint */
-    ec = snutf_count(c);
-    if (ec < 1) {
-      /* Not a valid first byte of an encoded codepoint, so fail */
-      err_num = SNERR_UTF8;
-    } else if (ec > 4) {
-      /* Shouldn't happen */
-      abort();
-    }
-    
-    /* Write the character we just read into the decoding buffer */
-    if (!err_num) {
-      buf[0] = (unsigned char) c;
-    }
-    
-    /* Read any additional bytes into the decoding buffer -- EOF returns
-     * will be changed to UTF-8 decoding errors */
-    if (!err_num) {
-      for(i = 1; i < ec; i++) {
-        c = snsource_read(pIn);
-        if (c < 0) {
-          if (c == SNERR_EOF) {
-            err_num = SNERR_UTF8;
-          } else {
-            err_num = c;
-          }
-          break;
-        } else {
-          buf[i] = (unsigned char) c;
-        }
-      }
+  /* Count plain characters */
+  for( ; pc[len] != 0; len++) {
+    if (SNCHAR_GETFLAGS(snchar_class(((const unsigned char *) pc)[len]))
+          != SNCHAR_PLAIN) {
+      len = -1;
+      break;
     }
-    
-    /* Decode the buffered character bytes into a codepoint */
-    if (!err_num) {
-      result = snutf_decode(buf);
-      if (result < 0) {
-        err_num = SNERR_UTF8;
-      }
+  }
+  
+  /* Return length or -1 */
+  return len;
+}
+
+/*
+ * Write a token that is a symbol followed by a name.
+ * 
+ * This is used for the variable, constant, assign, and get entities.
+ * c is the US-ASCII symbol.  pName is the nul-terminated name, which
+ * may be empty.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   c - the symbol
+ * 
+ *   pName - the name
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+static int snwriter_name(
+    SNWRITER   * pWriter,
+    int          c,
+    const char * pName) {
+  
+  unsigned char sym = 0;
+  long len = 0;
+  
+  /* Check parameters */
+  if ((pWriter == NULL) || (pName == NULL) ||
+      (c < ASCII_VISIBLE_MIN) || (c > ASCII_VISIBLE_MAX)) {
+    abort();
+  }
+  
+  /* Check that the name is plain and that the token isn't too long */
+  if (!snwriter_start(pWriter)) {
+    len = snwriter_plain(pName);
+    if ((len < 0) || pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    } else if (len >= pWriter->lim.key_max - 1) {
+      pWriter->status = SNERR_LONGTOKEN;
     }
   }
   
-  /* If error occurred, set result to error code and store error code in
-   * status field of source */
-  if (err_num) {
-    result = err_num;
-    pIn->status = err_num;
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
+  
+  /* Write the token */
+  if (!(pWriter->status)) {
+    sym = (unsigned char) c;
+    snwriter_lead(pWriter, SNWRITER_PLAIN);
+    snwriter_put(pWriter, &sym, 1);
+    snwriter_put(pWriter, (const unsigned char *) pName, len);
   }
   
-  /* Return result */
-  return result;
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * Initialize a long stack.
- * 
- * Stacks must be initialized before they are used, or undefined 
- * behavior occurs.  A full reset must be performed on the stack using
- * snstack_reset() before the structure is released or a memory leak may
- * occur.
+ * Write string data to a writer.
  * 
- * icap is the initial allocation capacity in longs.  maxcap is the 
- * maximum capacity for the buffer (in longs).
- * 
- * icap must be greater than zero, maxcap must be greater than or equal
- * to icap, and maxcap must be no greater than (LONG_MAX / 2) or a fault
- * will occur.
+ * A string must be open in the writer.  pc points to the data and len
+ * is its length in bytes.
  * 
- * If (sizeof(size_t) < 2), this function will always fault.  Otherwise,
- * if (sizeof(size_t) < 4), this function will fault if maxcap
- * multiplied by sizeof(long) exceeds 65535.  Otherwise, it must be that
- * (sizeof(size_t) >= 4) and this function will fault if maxcap times
- * sizeof(long) exceeds 2147483647.  This is to prevent memory
- * allocation problems.
+ * The data is checked in full before any of it is written.  It must be
+ * clean according to snutf_scan() and have no nul bytes.  In
+ * SNWRITE_ESCAPE mode, the number of backslashes that escaping adds is
+ * counted.  Otherwise, the escape state and curly nesting level of the
+ * string are tracked to make sure the data doesn't end the string or
+ * escape its closing delimiter.  Either way, the data is scanned a word
+ * at a time, and only words that have a backslash, a nul byte, or a
+ * delimiter of the string type are looked at byte by byte.  The length
+ * of the string is then checked against the limit, and the data is
+ * written, with the escapes added in SNWRITE_ESCAPE mode.
  * 
- * Do not initialize a stack that is already initialized, or a memory
- * leak may occur.
+ * This function may set the writer into an error state.
  * 
  * Parameters:
  * 
- *   pBuffer - pointer to the stack to initialize
+ *   pWriter - the writer
  * 
- *   icap - the initial allocation capacity in longs
+ *   pc - the string data
  * 
- *   maxcap - the maximum allocation capacity in longs
+ *   len - the length of the string data
  */
-static void snstack_init(SNSTACK *pStack, long icap, long maxcap) {
+static void snwriter_data(
+    SNWRITER            * pWriter,
+    const unsigned char * pc,
+    long                  len) {
+  
+  const long ws = (long) sizeof(unsigned long);
+  unsigned long w = 0;
+  unsigned long m = 0;
+  long i = 0;
+  long j = 0;
+  long k = 0;
+  long extra = 0;
+  long depth = 0;
+  int escape = 0;
+  int odd = 0;
+  int d1 = 0;
+  int d2 = 0;
+  int c = 0;
+  int err_code = 0;
   
-  /* Check parameters */
-  if (pStack == NULL) {
+  /* Check parameters and state */
+  if ((pWriter == NULL) || (len < 0) || ((len > 0) && (pc == NULL))) {
     abort();
   }
-  
-  if ((icap <= 0) || (maxcap < icap) || (maxcap > (LONG_MAX / 2))) {
+  if (pWriter->str_type == 0) {
     abort();
   }
   
-  if (sizeof(size_t) < 2) {
+  /* Get the delimiters of the string type, and the escape state */
+  if (pWriter->str_type == SNSTRING_QUOTED) {
+    d1 = ASCII_DQUOTE;
+    d2 = ASCII_DQUOTE;
+  } else if (pWriter->str_type == SNSTRING_CURLY) {
+    d1 = ASCII_LCURL;
+    d2 = ASCII_RCURL;
+  } else {
     abort();
-  } else if (sizeof(size_t) < 4) {
-    if (maxcap > (65535L / sizeof(long))) {
-      abort();
+  }
+  
+  escape = ((pWriter->mode & SNWRITE_ESCAPE) ? 1 : 0);
+  odd = pWriter->str_odd;
+  depth = pWriter->str_depth;
+  
+  /* Check that the data is clean */
+  if (!(pWriter->status)) {
+    i = snutf_scan(pc, len);
+    if (i < len) {
+      if (pc[i] == ASCII_CR) {
+        err_code = SNERR_BADCR;
+      } else {
+        err_code = SNERR_UTF8;
+      }
     }
   } else {
-    if (maxcap > (2147483647L / sizeof(long))) {
-      abort();
+    err_code = pWriter->status;
+  }
+  
+  /* Scan the data */
+  for(i = 0; (!err_code) && (i < len); i = k) {
+    
+    /* Find the end of this word, or of the data if less than a whole
+     * word is left */
+    k = i + ws;
+    if (k > len) {
+      k = len;
+    }
+    
+    /* Skip whole words that have nothing to look at; in escape mode,
+     * words that only need escapes can be counted as a whole */
+    if ((k - i) == ws) {
+      w = snword_load(pc + i);
+      m = snword_match(w, ASCII_BACKSLASH) |
+          snword_match(w, d1) | snword_match(w, d2);
+      if ((m == 0) && (!snword_hasbyte(w, 0))) {
+        odd = 0;
+        continue;
+      }
+      if (escape && (!snword_hasbyte(w, 0))) {
+        extra = extra + snword_count(m);
+        continue;
+      }
+    }
+    
+    /* Look at the word byte by byte */
+    for(j = i; (!err_code) && (j < k); j++) {
+      c = pc[j];
+      
+      if (c == 0) {
+        /* Nul bytes can't be read back */
+        err_code = SNERR_NULLCHR;
+      
+      } else if (escape) {
+        /* Count the escapes */
+        if ((c == ASCII_BACKSLASH) || (c == d1) || (c == d2)) {
+          extra++;
+        }
+      
+      } else {
+        /* Check delimiters that are not escaped */
+        if (!odd) {
+          if (c == ASCII_DQUOTE) {
+            if (pWriter->str_type == SNSTRING_QUOTED) {
+              err_code = SNERR_WRITE;
+            }
+          
+          } else if (c == ASCII_LCURL) {
+            if (pWriter->str_type == SNSTRING_CURLY) {
+              if (depth < LONG_MAX - 1) {
+                depth++;
+              } else {
+                err_code = SNERR_DEEPCURLY;
+              }
+            }
+          
+          } else if (c == ASCII_RCURL) {
+            if (pWriter->str_type == SNSTRING_CURLY) {
+              if (depth > 0) {
+                depth--;
+              } else {
+                err_code = SNERR_WRITE;
+              }
+            }
+          }
+        }
+        
+        /* Update the escape state */
+        if (c == ASCII_BACKSLASH) {
+          odd = !odd;
+        } else {
+          odd = 0;
+        }
+      }
     }
   }
   
-  /* Initialize structure */
-  memset(pStack, 0, sizeof(SNSTACK));
-  pStack->pBuf = NULL;
-  pStack->count = 0;
-  pStack->cap = 0;
-  pStack->initcap = icap;
-  pStack->maxcap = maxcap;
+  /* Check the length of the string, which stops at LONG_MAX */
+  if (!err_code) {
+    if (len <= LONG_MAX - pWriter->str_len - extra) {
+      pWriter->str_len = pWriter->str_len + len + extra;
+    } else {
+      pWriter->str_len = LONG_MAX;
+    }
+    if ((!(pWriter->mode & SNWRITE_LONG)) &&
+        (pWriter->str_len >= pWriter->lim.value_max)) {
+      err_code = SNERR_LONGSTR;
+    }
+  }
+  
+  /* Write the data */
+  if ((!err_code) && (!escape)) {
+    /* Written as given */
+    snwriter_put(pWriter, pc, len);
+    pWriter->str_odd = odd;
+    pWriter->str_depth = depth;
+  
+  } else if (!err_code) {
+    /* Write runs of data up to each byte that needs an escape, skipping
+     * whole words that need none */
+    j = 0;
+    i = 0;
+    while (i < len) {
+      if ((len - i) >= ws) {
+        w = snword_load(pc + i);
+        if ((snword_match(w, ASCII_BACKSLASH) |
+              snword_match(w, d1) | snword_match(w, d2)) == 0) {
+          i = i + ws;
+          continue;
+        }
+      }
+      
+      c = pc[i];
+      if ((c == ASCII_BACKSLASH) || (c == d1) || (c == d2)) {
+        snwriter_put(pWriter, pc + j, i - j);
+        snwriter_put(pWriter, (const unsigned char *) "\\", 1);
+        j = i;
+      }
+      i++;
+    }
+    snwriter_put(pWriter, pc + j, len - j);
+  }
+  
+  /* If error, set error in writer */
+  if (err_code) {
+    pWriter->status = err_code;
+  }
 }
 
+#ifdef SHASTINA_STATS
+
 /*
- * Reset a stack back to empty.
- * 
- * The stack must already have been initialized with snstack_init() or
- * undefined behavior occurs.
- * 
- * full is non-zero to perform a full reset, zero to perform a fast
- * reset.  A fast reset just clears the buffer to empty without
- * releasing the allocated memory buffer, allowing it to be reused.  A
- * full reset also releases the allocated memory buffer, clearing the
- * structure all the way back to its initial state.
+ * Add to a statistics counter.
  * 
- * A full reset must be performed on all stacks before they are 
- * released, or a memory leak may occur.
+ * The counter stops at LONG_MAX instead of overflowing.  Nothing is
+ * added if n is zero or less.
  * 
  * Parameters:
  * 
- *   pStack - the stack to reset
+ *   pCount - the counter
  * 
- *   full - non-zero for a full reset, zero for a partial reset
+ *   n - the amount to add
  */
-static void snstack_reset(SNSTACK *pStack, int full) {
+static void snstats_add(long *pCount, long n) {
   
   /* Check parameters */
-  if (pStack == NULL) {
+  if (pCount == NULL) {
     abort();
   }
   
-  /* Set the count back to zero */
-  pStack->count = 0;
-  
-  /* If a buffer is allocated, clear it all to zero */
-  if (pStack->cap > 0) {
-    memset(pStack->pBuf, 0, (size_t) (pStack->cap * sizeof(long)));
-  }
-  
-  /* If we're doing a full reset, release the buffer if allocated and
-   * reset capacity back to zero */
-  if (full && (pStack->cap > 0)) {
-    free(pStack->pBuf);
-    pStack->pBuf = NULL;
-    pStack->cap = 0;
+  /* Add, stopping at LONG_MAX */
+  if (n > 0) {
+    if (*pCount <= LONG_MAX - n) {
+      *pCount = *pCount + n;
+    } else {
+      *pCount = LONG_MAX;
+    }
   }
 }
 
 /*
- * Push a long on top of a stack.
- * 
- * The long value v may have any value.
+ * Count the codepoints that the input filter would read from a span of
+ * UTF-8 input.
  * 
- * The function fails if there is no more capacity left for another
- * long.  The buffer is unmodified in this case.
+ * This counts the bytes that are not UTF-8 continuation bytes, leaving
+ * out CR characters, since the input filter turns each CR+LF pair into
+ * a single LF.  The span must hold valid input.
  * 
  * Parameters:
  * 
- *   pStack - the stack to push a long onto
+ *   pc - the input
  * 
- *   v - the long value to push
+ *   len - the number of bytes of input
  * 
  * Return:
  * 
- *   non-zero if successful, zero if no more capacity
+ *   the number of codepoints
  */
-static int snstack_push(SNSTACK *pStack, long v) {
+static long snstats_text(const unsigned char *pc, long len) {
   
-  int status = 1;
-  long newcap = 0;
+  long result = 0;
+  long i = 0;
   
   /* Check parameters */
-  if (pStack == NULL) {
+  if ((len < 0) || ((len > 0) && (pc == NULL))) {
     abort();
   }
   
-  /* Proceed only if we are not completely maxed out of capacity */
-  if (pStack->count < pStack->maxcap) {
-    /* We have capacity left; first, make the initial allocation if we
-     * haven't allocated a memory buffer yet */
-    if (pStack->cap < 1) {
-      pStack->pBuf = (long *) malloc(
-                        (size_t) (pStack->initcap * sizeof(long)));
-      if (pStack->pBuf == NULL) {
-        abort();
-      }
-      memset(pStack->pBuf, 0,
-        (size_t) (pStack->initcap * sizeof(long)));
-      pStack->cap = pStack->initcap;
-    }
-    
-    /* Next, increase allocated memory buffer if we need more space */
-    if (pStack->count >= pStack->cap) {
-      /* New capacity should usually be double current capacity */
-      newcap = pStack->cap * 2;
-      
-      /* If new capacity exceeds max capacity, set to max capacity */
-      if (newcap > pStack->maxcap) {
-        newcap = pStack->maxcap;
-      }
-      
-      /* Allocate new buffer */
-      pStack->pBuf = (long *) realloc(pStack->pBuf,
-                                (size_t) (newcap * sizeof(long)));
-      if (pStack->pBuf == NULL) {
-        abort();
-      }
-      
-      /* Initialize new space to zero */
-      memset((void *) (pStack->pBuf + pStack->cap),
-              0,
-              (size_t) ((newcap - pStack->cap) * sizeof(long)));
-      
-      /* Update capacity */
-      pStack->cap = newcap;
+  /* Count the bytes that begin codepoints */
+  for(i = 0; i < len; i++) {
+    if (((pc[i] & 0xc0) != 0x80) && (pc[i] != ASCII_CR)) {
+      result++;
     }
-    
-    /* Append the new long */
-    (pStack->pBuf)[pStack->count] = v;
-    (pStack->count)++;
-    
-  } else {
-    /* Out of capacity */
-    status = 0;
   }
   
-  /* Return status */
-  return status;
+  /* Return result */
+  return result;
 }
 
+#endif
+
 /*
- * Pop a long value off the top of a stack.
- * 
- * pStack is the stack object to a pop a value off of.  It must be
- * properly initialized.  It must not be empty, or a fault will occur.
- * 
- * Parameters:
- * 
- *   pStack - the stack
- * 
- * Return:
+ * Public functions
+ * ================
  * 
- *   the popped long value
+ * (see the header for specifications)
+ */
+
+/*
+ * snsource_file function.
+ */
+SNSOURCE *snsource_file(FILE *pFile, int owner) {
+  
+  SNSOURCE *pSrc = NULL;
+  
+  /* Call through to stream function */
+  if (owner) {
+    pSrc = snsource_stream(pFile, SNSTREAM_OWNER);
+  } else {
+    pSrc = snsource_stream(pFile, SNSTREAM_NORMAL);
+  }
+  
+  /* Return new source */
+  return pSrc;
+}
+
+/*
+ * snsource_stream function.
+ */
+SNSOURCE *snsource_stream(FILE *pFile, int flags) {
+  return snsource_streamwith(pFile, flags, NULL);
+}
+
+/*
+ * snsource_streamwith function.
+ */
+SNSOURCE *snsource_streamwith(
+    FILE          * pFile,
+    int             flags,
+    const SNALLOC * pAlloc) {
+  
+  void (*pDestruct)(void *) = NULL;
+  int (*pRewind)(void *) = NULL;
+  
+  /* Check parameters */
+  if (pFile == NULL) {
+    abort();
+  }
+  
+  /* Set destructor based on OWNER flag */
+  if (flags & SNSTREAM_OWNER) {
+    pDestruct = &snsource_file_free;
+  } else {
+    pDestruct = NULL;
+  }
+  
+  /* Set rewind routine based on RANDOM flag */
+  if (flags & SNSTREAM_RANDOM) {
+    pRewind = &snsource_file_rewind;
+  } else {
+    pRewind = NULL;
+  }
+  
+  /* Call through to construct object */
+  return snsource_customwith(
+            &snsource_file_read,
+            pDestruct,
+            pRewind,
+            (void *) pFile,
+            pAlloc);
+}
+
+/*
+ * snsource_fd function.
  */
-static long snstack_pop(SNSTACK *pStack) {
-  
-  long v = 0;
+SNSOURCE *snsource_fd(int fd, int flags) {
+  return snsource_fdwith(fd, flags, NULL);
+}
+
+/*
+ * snsource_fdwith function.
+ */
+SNSOURCE *snsource_fdwith(int fd, int flags, const SNALLOC *pAlloc) {
+
+  SNSOURCE *pSrc = NULL;
+#ifdef SHASTINA_POSIX
+  SNFDSRC *pFd = NULL;
+  SNALLOC alloc;
+  int count = 0;
+  int status = 1;
+  int i = 0;
   
-  /* Check parameter */
-  if (pStack == NULL) {
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+#endif
+
+  /* Check parameters */
+  if (fd < 0) {
     abort();
   }
+
+#ifdef SHASTINA_POSIX
+  /* Get the allocator and allocate new structure */
+  snalloc_init(&alloc, pAlloc);
+  pFd = (SNFDSRC *) snalloc_get(&alloc, (long) sizeof(SNFDSRC));
+  if (pFd != NULL) {
+    memset(pFd, 0, sizeof(SNFDSRC));
+    pFd->fd = fd;
+    pFd->owner = 0;
+    pFd->random = ((flags & SNSTREAM_RANDOM) ? 1 : 0);
+    pFd->cur = -1;
+    pFd->pos = 0;
+    pFd->skip = 0;
+    pFd->ahead = 0;
+    pFd->job = -1;
+    pFd->busy = 0;
+    pFd->stop = 0;
+    memcpy(&(pFd->alloc), &alloc, sizeof(SNALLOC));
+  } else {
+    status = 0;
+  }
   
-  /* Check state */
-  if (pStack->count < 1) {
-    abort();
+  /* Allocate the buffers with room to align them to the page size;
+   * there are two buffers only if reading ahead in the background */
+  count = 1;
+#ifdef SHASTINA_THREADS
+  if (flags & SNSTREAM_AHEAD) {
+    count = 2;
+  }
+#endif
+  for(i = 0; status && (i < count); i++) {
+    (pFd->pRaw)[i] = (unsigned char *) snalloc_get(
+                        &alloc, SNFD_BUFFER_SIZE + SNFD_ALIGN);
+    if ((pFd->pRaw)[i] != NULL) {
+      (pFd->pBuf)[i] = (pFd->pRaw)[i] + (SNFD_ALIGN -
+                  (long) (((size_t) (pFd->pRaw)[i]) % SNFD_ALIGN));
+    } else {
+      status = 0;
+    }
   }
   
-  /* Get the top of the stack */
-  v = pStack->pBuf[pStack->count - 1];
+  /* Start the read-ahead thread if requested */
+#ifdef SHASTINA_THREADS
+  if (status && (flags & SNSTREAM_AHEAD)) {
+    if (pthread_mutex_init(&(pFd->lock), NULL) != 0) {
+      abort();
+    }
+    if (pthread_cond_init(&(pFd->cond), NULL) != 0) {
+      abort();
+    }
+    pFd->ahead = 1;
+    if (pthread_create(&(pFd->thread), NULL, &snfd_thread,
+                        (void *) pFd) != 0) {
+      pthread_cond_destroy(&(pFd->cond));
+      pthread_mutex_destroy(&(pFd->lock));
+      pFd->ahead = 0;
+      status = 0;
+    }
+  }
+#endif
+
+  /* Tell the kernel the file will be read in order so it can read
+   * ahead more aggressively, ignoring any error since this is only a
+   * hint */
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (status) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
+
+  /* Start filling the first buffer right away if reading ahead; with
+   * random access, this happens when the new source is rewound */
+  if (status && pFd->ahead && (!(pFd->random))) {
+    snfd_lock(pFd);
+    snfd_request(pFd, 0);
+    snfd_unlock(pFd);
+  }
   
-  /* Take the top element off the stack */
-  (pStack->count)--;
+  /* Construct a block source around the structure */
+  if (status) {
+    pSrc = snsource_blockwith(
+              &snsource_fd_block,
+              &snsource_fd_free,
+              (pFd->random ? &snsource_fd_rewind : NULL),
+              (void *) pFd,
+              &alloc);
+    if (pSrc == NULL) {
+      status = 0;
+    }
+  }
   
-  /* Return the removed value */
-  return v;
+  /* The file descriptor only becomes owned once the source exists, so
+   * that it is left open on failure; release everything on failure */
+  if (status) {
+    pFd->owner = ((flags & SNSTREAM_OWNER) ? 1 : 0);
+  } else if (pFd != NULL) {
+    snsource_fd_free((void *) pFd);
+    pFd = NULL;
+  }
+#else
+  /* File descriptor sources need POSIX */
+  (void) flags;
+  (void) pAlloc;
+#endif
+
+  /* Return the new source or NULL */
+  return pSrc;
 }
 
 /*
- * Peek at the long value on top of a stack without removing it.
- * 
- * pStack is the stack object to peek at.  It must be properly
- * initialized.  It must not be empty, or a fault will occur.
- * 
- * Parameters:
- * 
- *   pStack - the stack
- * 
- * Return:
- * 
- *   the peeked long value
+ * snsource_string function.
  */
-static long snstack_peek(SNSTACK *pStack) {
+SNSOURCE *snsource_string(const char *pStr) {
+  return snsource_stringwith(pStr, NULL);
+}
+
+/*
+ * snsource_stringwith function.
+ */
+SNSOURCE *snsource_stringwith(const char *pStr, const SNALLOC *pAlloc) {
+  
+  size_t slen = 0;
   
   /* Check parameter */
-  if (pStack == NULL) {
+  if (pStr == NULL) {
     abort();
   }
   
-  /* Check state */
-  if (pStack->count < 1) {
+  /* Get the length of the string, which must fit in a long */
+  slen = strlen(pStr);
+  if (slen > (size_t) LONG_MAX) {
     abort();
   }
   
-  /* Return the top of the stack */
-  return pStack->pBuf[pStack->count - 1];
+  /* Call through to construct a whole source over the string, with no
+   * destructor since the string is owned by the caller */
+  return snsource_whole(
+            (const unsigned char *) pStr,
+            (long) slen,
+            NULL,
+            NULL,
+            pAlloc);
+}
+  
+/*
+ * snsource_map function.
+ */
+SNSOURCE *snsource_map(const char *pPath) {
+  return snsource_mapwith(pPath, NULL);
 }
 
 /*
- * Increment the long value on top of a stack.
- * 
- * pStack is the stack object.  It must be properly initialized.  It
- * must not be empty, or a fault will occur.
- * 
- * The function fails if the top of the stack has value LONG_MAX.
- * 
- * Parameters:
- * 
- *   pStack - the stack
- * 
- * Return:
- * 
- *   non-zero if successful, zero if long value already at maximum
+ * snsource_mapwith function.
  */
-static int snstack_inc(SNSTACK *pStack) {
+SNSOURCE *snsource_mapwith(const char *pPath, const SNALLOC *pAlloc) {
   
-  int status = 1;
+  SNSOURCE *pSrc = NULL;
+  SNMAPSRC *pMap = NULL;
+  SNALLOC alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
   
   /* Check parameter */
-  if (pStack == NULL) {
+  if (pPath == NULL) {
     abort();
   }
   
-  /* Check state */
-  if (pStack->count < 1) {
-    abort();
+  /* Get the allocator and allocate new structure */
+  snalloc_init(&alloc, pAlloc);
+  pMap = (SNMAPSRC *) snalloc_get(&alloc, (long) sizeof(SNMAPSRC));
+  if (pMap != NULL) {
+    memset(pMap, 0, sizeof(SNMAPSRC));
+    memcpy(&(pMap->alloc), &alloc, sizeof(SNALLOC));
   }
   
-  /* Increment if possible */
-  if (pStack->pBuf[pStack->count - 1] < LONG_MAX) {
-    (pStack->pBuf[pStack->count - 1])++;
-  } else {
-    status = 0;
+  /* Load the file into memory and construct a whole source over it, or
+   * release the structure if the file couldn't be loaded */
+  if (pMap != NULL) {
+    if (snsource_map_load(pMap, pPath)) {
+      pSrc = snsource_whole(
+                pMap->pData,
+                pMap->len,
+                &snsource_map_free,
+                (void *) pMap,
+                &alloc);
+      if (pSrc == NULL) {
+        snsource_map_free((void *) pMap);
+        pMap = NULL;
+      }
+    } else {
+      snalloc_release(&alloc, pMap, (long) sizeof(SNMAPSRC));
+      pMap = NULL;
+    }
   }
   
-  /* Return status */
-  return status;
+  /* Return the new source or NULL */
+  return pSrc;
 }
 
 /*
- * Decrement the long value on top of a stack.
- * 
- * pStack is the stack object.  It must be properly initialized.  It
- * must not be empty, or a fault will occur.
- * 
- * The function fails if the top of the stack has already has value less
- * than one.
- * 
- * Note that this function will not decrement into negative range.
- * 
- * Parameters:
- * 
- *   pStack - the stack
- * 
- * Return:
- * 
- *   non-zero if successful, zero if long value already less than one
+ * snsource_cache function.
  */
-static int snstack_dec(SNSTACK *pStack) {
+SNSOURCE *snsource_cache(const char *pPath, SNSOURCE *pCheck) {
+  return snsource_cachewith(pPath, pCheck, NULL);
+}
+
+/*
+ * snsource_cachewith function.
+ */
+SNSOURCE *snsource_cachewith(
+    const char    * pPath,
+    SNSOURCE      * pCheck,
+    const SNALLOC * pAlloc) {
   
-  int status = 1;
+  SNSOURCE *pSrc = NULL;
+  SNCACHESRC *pCache = NULL;
+  SNMAPSRC *pMap = NULL;
+  const unsigned char *pData = NULL;
+  long len = 0;
+  SNALLOC alloc;
   
-  /* Check parameter */
-  if (pStack == NULL) {
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameters */
+  if (pPath == NULL) {
     abort();
   }
+  if (pCheck != NULL) {
+    if ((!(pCheck->whole)) || pCheck->cache) {
+      abort();
+    }
+    pData = (const unsigned char *) snsource_buffer(pCheck, &len);
+  }
   
-  /* Check state */
-  if (pStack->count < 1) {
-    abort();
+  /* Get the allocator and allocate new structures */
+  snalloc_init(&alloc, pAlloc);
+  pCache = (SNCACHESRC *) snalloc_get(&alloc,
+                                        (long) sizeof(SNCACHESRC));
+  if (pCache != NULL) {
+    memset(pCache, 0, sizeof(SNCACHESRC));
+    memcpy(&(pCache->alloc), &alloc, sizeof(SNALLOC));
+    pMap = (SNMAPSRC *) snalloc_get(&alloc, (long) sizeof(SNMAPSRC));
+    if (pMap != NULL) {
+      memset(pMap, 0, sizeof(SNMAPSRC));
+      memcpy(&(pMap->alloc), &alloc, sizeof(SNALLOC));
+    } else {
+      snalloc_release(&alloc, pCache, (long) sizeof(SNCACHESRC));
+      pCache = NULL;
+    }
   }
   
-  /* Decrement if possible */
-  if (pStack->pBuf[pStack->count - 1] > 0) {
-    (pStack->pBuf[pStack->count - 1])--;
-  } else {
-    status = 0;
+  /* Load the cache file into memory and check it, releasing everything
+   * if it can't be used */
+  if (pCache != NULL) {
+    if (snsource_map_load(pMap, pPath)) {
+      pCache->pMap = pMap;
+      pMap = NULL;
+      if (!sncache_load(pCache, pData, len, (pCheck != NULL))) {
+        sncache_free((void *) pCache);
+        pCache = NULL;
+      }
+    } else {
+      snalloc_release(&alloc, pMap, (long) sizeof(SNMAPSRC));
+      pMap = NULL;
+      snalloc_release(&alloc, pCache, (long) sizeof(SNCACHESRC));
+      pCache = NULL;
+    }
   }
   
-  /* Return status */
-  return status;
+  /* Construct a whole source with no data over the cache */
+  if (pCache != NULL) {
+    pSrc = snsource_whole(
+              NULL,
+              0,
+              &sncache_free,
+              (void *) pCache,
+              &alloc);
+    if (pSrc != NULL) {
+      pSrc->cache = 1;
+    } else {
+      sncache_free((void *) pCache);
+      pCache = NULL;
+    }
+  }
+  
+  /* Return the new source or NULL */
+  return pSrc;
 }
 
 /*
- * Get the number of elements on a given stack.
- * 
- * Parameters:
- * 
- *   pStack - the stack to query
- * 
- * Return:
- * 
- *   the number of elements on the stack
+ * snsource_custom function.
  */
-static long snstack_count(SNSTACK *pStack) {
+SNSOURCE *snsource_custom(
+    int (*read_func)(void *),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom) {
+  return snsource_customwith(
+            read_func, free_func, rewind_func, custom, NULL);
+}
+
+/*
+ * snsource_customwith function.
+ */
+SNSOURCE *snsource_customwith(
+    int (*read_func)(void *),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom,
+    const SNALLOC *pAlloc) {
   
-  /* Check parameter */
-  if (pStack == NULL) {
+  SNSOURCE *pSrc = NULL;
+  SNALLOC alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameters */
+  if (read_func == NULL) {
     abort();
   }
   
-  /* Return count */
-  return (pStack->count);
-}
-
-/*
- * Initialize a string buffer.
- * 
- * String buffers must be initialized before they are used, or undefined
- * behavior occurs.  A full reset must be performed on the string buffer
- * using snbuffer_reset() before the structure is released or a memory
- * leak may occur.
- * 
- * icap is the initial allocation capacity in bytes.  maxcap is the
- * maximum capacity in bytes for the buffer.  Note that the capacity
- * counts bytes, not Unicode codepoints.
- * 
- * icap must be greater than zero, maxcap must be greater than or equal
- * to icap, and maxcap must be no greater than (LONG_MAX / 2) or a fault
- * will occur.
- * 
- * If (sizeof(size_t) < 2), this function will always fault.  Otherwise,
- * if (sizeof(size_t) < 4), this function will fault if maxcap exceeds
- * 65535.  Otherwise, (sizeof(size_t) >= 4) and this function will fault
- * if maxcap exceeds 2147483647.  This is to prevent memory allocation
- * problems.
- * 
- * Do not initialize a string buffer that is already initialized, or a
- * memory leak may occur.
- * 
- * Parameters:
- * 
- *   pBuffer - pointer to the buffer to initialize
- * 
- *   icap - the initial allocation capacity
- * 
- *   maxcap - the maximum allocation capacity
+  /* Get the allocator and allocate structure */
+  snalloc_init(&alloc, pAlloc);
+  pSrc = (SNSOURCE *) snalloc_get(&alloc, (long) sizeof(SNSOURCE));
+  
+  /* Initialize structure */
+  if (pSrc != NULL) {
+    memset(pSrc, 0, sizeof(SNSOURCE));
+    
+    pSrc->pfRead = read_func;
+    pSrc->pfBlock = NULL;
+    pSrc->pfDestruct = free_func;
+    pSrc->pfRewind = rewind_func;
+    
+    pSrc->read_count = 0;
+    pSrc->status = 0;
+    pSrc->pCustom = custom;
+    
+    pSrc->pBlock = NULL;
+    pSrc->pWin = NULL;
+    pSrc->win_len = 0;
+    pSrc->win_pos = 0;
+    pSrc->win_clean = 0;
+    pSrc->whole = 0;
+    pSrc->cache = 0;
+    pSrc->feed = 0;
+    
+    pSrc->pLines = NULL;
+    pSrc->line_count = 0;
+    pSrc->line_cap = 0;
+    
+    memcpy(&(pSrc->alloc), &alloc, sizeof(SNALLOC));
+  }
+  
+  /* If a rewind routine was provided, rewind right away; errors ignored
+   * since they will immediately set structure into IOERR status */
+  if ((pSrc != NULL) && (rewind_func != NULL)) {
+    snsource_rewind(pSrc);
+  }
+  
+  /* Return the new source object or NULL */
+  return pSrc;
+}
+
+/*
+ * snsource_block function.
+ */
+SNSOURCE *snsource_block(
+    long (*read_func)(void *, unsigned char *, long),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom) {
+  return snsource_blockwith(
+            read_func, free_func, rewind_func, custom, NULL);
+}
+
+/*
+ * snsource_blockwith function.
  */
-static void snbuffer_init(SNBUFFER *pBuffer, long icap, long maxcap) {
+SNSOURCE *snsource_blockwith(
+    long (*read_func)(void *, unsigned char *, long),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom,
+    const SNALLOC *pAlloc) {
   
-  /* Check parameters */
-  if (pBuffer == NULL) {
-    abort();
-  }
+  SNSOURCE *pSrc = NULL;
+  unsigned char *pBlock = NULL;
+  SNALLOC alloc;
   
-  if ((icap <= 0) || (maxcap < icap) || (maxcap > (LONG_MAX / 2))) {
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameters */
+  if (read_func == NULL) {
     abort();
   }
   
-  if (sizeof(size_t) < 2) {
-    abort();
-  } else if (sizeof(size_t) < 4) {
-    if (maxcap > 65535L) {
-      abort();
-    }
-  } else {
-    if (maxcap > 2147483647L) {
-      abort();
+  /* Get the allocator, and allocate the block buffer and then the
+   * structure, releasing the block buffer if the structure can't be
+   * allocated */
+  snalloc_init(&alloc, pAlloc);
+  pBlock = (unsigned char *) snalloc_get(&alloc, SNSOURCE_BLOCK_SIZE);
+  if (pBlock != NULL) {
+    pSrc = (SNSOURCE *) snalloc_get(&alloc, (long) sizeof(SNSOURCE));
+    if (pSrc == NULL) {
+      snalloc_release(&alloc, pBlock, SNSOURCE_BLOCK_SIZE);
+      pBlock = NULL;
     }
   }
   
   /* Initialize structure */
-  memset(pBuffer, 0, sizeof(SNBUFFER));
-  pBuffer->pBuf = NULL;
-  pBuffer->count = 0;
-  pBuffer->cap = 0;
-  pBuffer->initcap = icap;
-  pBuffer->maxcap = maxcap;
+  if (pSrc != NULL) {
+    memset(pSrc, 0, sizeof(SNSOURCE));
+    
+    pSrc->pfRead = NULL;
+    pSrc->pfBlock = read_func;
+    pSrc->pfDestruct = free_func;
+    pSrc->pfRewind = rewind_func;
+    
+    pSrc->read_count = 0;
+    pSrc->status = 0;
+    pSrc->pCustom = custom;
+    
+    pSrc->pBlock = pBlock;
+    pSrc->pWin = pSrc->pBlock;
+    pSrc->win_len = 0;
+    pSrc->win_pos = 0;
+    pSrc->win_clean = 0;
+    pSrc->whole = 0;
+    pSrc->cache = 0;
+    pSrc->feed = 0;
+    
+    pSrc->pLines = NULL;
+    pSrc->line_count = 0;
+    pSrc->line_cap = 0;
+    
+    memcpy(&(pSrc->alloc), &alloc, sizeof(SNALLOC));
+  }
+  
+  /* If a rewind routine was provided, rewind right away; errors ignored
+   * since they will immediately set structure into IOERR status */
+  if ((pSrc != NULL) && (rewind_func != NULL)) {
+    snsource_rewind(pSrc);
+  }
+  
+  /* Return the new source object or NULL */
+  return pSrc;
 }
 
 /*
- * Reset a string buffer back to empty.
- * 
- * The string buffer must already have been initialized with
- * snbuffer_init() or undefined behavior occurs.
- * 
- * full is non-zero to perform a full reset, zero to perform a fast
- * reset.  A fast reset just clears the buffer to empty without
- * releasing the allocated memory buffer, allowing it to be reused.  A
- * full reset also releases the allocated memory buffer, clearing the
- * structure all the way back to its initial state.
- * 
- * A full reset must be performed on all string buffers before they are
- * released, or a memory leak may occur.
- * 
- * Parameters:
- * 
- *   pBuffer - the string buffer to reset
- * 
- *   full - non-zero for a full reset, zero for a partial reset
+ * snsource_feed function.
  */
-static void snbuffer_reset(SNBUFFER *pBuffer, int full) {
-  
-  /* Check parameters */
-  if (pBuffer == NULL) {
-    abort();
-  }
+SNSOURCE *snsource_feed(void) {
+  return snsource_feedwith(NULL);
+}
+
+/*
+ * snsource_feedwith function.
+ */
+SNSOURCE *snsource_feedwith(const SNALLOC *pAlloc) {
   
-  /* Set the count back to zero */
-  pBuffer->count = 0;
+  SNSOURCE *pSrc = NULL;
+  SNFEEDSRC *pFeed = NULL;
+  SNALLOC alloc;
   
-  /* If a buffer is allocated, clear it all to zero */
-  if (pBuffer->cap > 0) {
-    memset(pBuffer->pBuf, 0, (size_t) pBuffer->cap);
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Get the allocator and allocate new structure */
+  snalloc_init(&alloc, pAlloc);
+  pFeed = (SNFEEDSRC *) snalloc_get(&alloc, (long) sizeof(SNFEEDSRC));
+  if (pFeed != NULL) {
+    memset(pFeed, 0, sizeof(SNFEEDSRC));
+    pFeed->pData = NULL;
+    pFeed->cap = 0;
+    pFeed->done = 0;
+    pFeed->starved = 0;
+    pFeed->hungry = 0;
+    memcpy(&(pFeed->alloc), &alloc, sizeof(SNALLOC));
   }
   
-  /* If we're doing a full reset, release the buffer if allocated and
-   * reset capacity back to zero */
-  if (full && (pBuffer->cap > 0)) {
-    free(pBuffer->pBuf);
-    pBuffer->pBuf = NULL;
-    pBuffer->cap = 0;
+  /* Construct an empty window source over the feed structure, which is
+   * not whole because the window is not all of the input */
+  if (pFeed != NULL) {
+    pSrc = snsource_whole(
+              NULL,
+              0,
+              &snsource_feed_free,
+              (void *) pFeed,
+              &alloc);
+    if (pSrc != NULL) {
+      pSrc->whole = 0;
+      pSrc->feed = 1;
+    } else {
+      snsource_feed_free((void *) pFeed);
+      pFeed = NULL;
+    }
   }
+  
+  /* Return the new source or NULL */
+  return pSrc;
 }
 
 /*
- * Append a byte value to a string buffer.
- * 
- * The character c may be any unsigned byte value except for zero.  That
- * is, the range is 1-255.
- * 
- * The function fails if there is no more capacity left for another 
- * byte.  The buffer is unmodified in this case.
- * 
- * This is a low-level function.  Clients should use append() instead to
- * work with Unicode codepoints.
- * 
- * Parameters:
- * 
- *   pBuffer - the string buffer to add a byte to
- * 
- *   c - the unsigned byte value to add
- * 
- * Return:
- * 
- *   non-zero if successful, zero if no more capacity
+ * snsource_push function.
  */
-static int snbuffer_appendByte(SNBUFFER *pBuffer, int c) {
+int snsource_push(SNSOURCE *pSrc, const char *pData, long len) {
   
   int status = 1;
+  long keep = 0;
   long newcap = 0;
+  unsigned char *pNew = NULL;
+  SNFEEDSRC *pFeed = NULL;
   
-  /* Check parameters */
-  if ((pBuffer == NULL) || (c < 1) || (c > 255)) {
+  /* Check parameters and state */
+  if ((pSrc == NULL) || (len < 0) || ((len > 0) && (pData == NULL))) {
+    abort();
+  }
+  if (!(pSrc->feed)) {
+    abort();
+  }
+  pFeed = (SNFEEDSRC *) pSrc->pCustom;
+  if (pFeed->done) {
     abort();
   }
   
-  /* Proceed only if we are not completely maxed out of capacity */
-  if (pBuffer->count < (pBuffer->maxcap - 1)) {
-    /* We have capacity left; first, make the initial allocation if we
-     * haven't allocated a memory buffer yet */
-    if (pBuffer->cap < 1) {
-      pBuffer->pBuf = (char *) malloc((size_t) pBuffer->initcap);
-      if (pBuffer->pBuf == NULL) {
-        abort();
-      }
-      memset(pBuffer->pBuf, 0, (size_t) pBuffer->initcap);
-      pBuffer->cap = pBuffer->initcap;
+  /* If the bytes don't fit after the window, first discard the bytes
+   * that have already been read by moving the rest down */
+  keep = pSrc->win_len - pSrc->win_pos;
+  if ((len > pFeed->cap - pSrc->win_len) && (pSrc->win_pos > 0)) {
+    if (keep > 0) {
+      memmove(pFeed->pData, pFeed->pData + pSrc->win_pos,
+              (size_t) keep);
     }
-    
-    /* Next, increase allocated memory buffer if we need more space */
-    if (pBuffer->count >= (pBuffer->cap - 1)) {
-      /* New capacity should usually be double current capacity */
-      newcap = pBuffer->cap * 2;
-      
-      /* If new capacity exceeds max capacity, set to max capacity */
-      if (newcap > pBuffer->maxcap) {
-        newcap = pBuffer->maxcap;
+    pSrc->win_clean -= pSrc->win_pos;
+    if (pSrc->win_clean < 0) {
+      pSrc->win_clean = 0;
+    }
+    pSrc->win_len = keep;
+    pSrc->win_pos = 0;
+  }
+  
+  /* If the bytes still don't fit, grow the buffer by doubling */
+  if (len > pFeed->cap - pSrc->win_len) {
+    if (len > LONG_MAX - pSrc->win_len) {
+      status = 0;
+    }
+    if (status) {
+      newcap = pFeed->cap;
+      if (newcap < 1) {
+        newcap = SNSOURCE_BLOCK_SIZE;
       }
-      
-      /* Allocate new buffer */
-      pBuffer->pBuf = (char *) realloc(pBuffer->pBuf, (size_t) newcap);
-      if (pBuffer->pBuf == NULL) {
-        abort();
+      while (newcap < pSrc->win_len + len) {
+        if (newcap <= (LONG_MAX / 2)) {
+          newcap = newcap * 2;
+        } else {
+          newcap = LONG_MAX;
+        }
       }
       
-      /* Initialize new space to zero */
-      memset((pBuffer->pBuf + pBuffer->cap),
-              0,
-              (size_t) (newcap - pBuffer->cap));
-      
-      /* Update capacity */
-      pBuffer->cap = newcap;
+      if (pFeed->pData == NULL) {
+        pNew = (unsigned char *) snalloc_get(&(pFeed->alloc), newcap);
+      } else {
+        pNew = (unsigned char *) snalloc_resize(
+                  &(pFeed->alloc), pFeed->pData, pFeed->cap, newcap);
+      }
+      if (pNew != NULL) {
+        pFeed->pData = pNew;
+        pFeed->cap = newcap;
+        pNew = NULL;
+      } else {
+        status = 0;
+      }
     }
-    
-    /* Add the new character */
-    ((unsigned char *) pBuffer->pBuf)[pBuffer->count] =
-      (unsigned char) c;
-    (pBuffer->count)++;
-    
-  } else {
-    /* Out of capacity */
-    status = 0;
   }
   
+  /* Append the bytes to the window */
+  if (status && (len > 0)) {
+    memcpy(pFeed->pData + pSrc->win_len, pData, (size_t) len);
+    pSrc->win_len += len;
+    pFeed->hungry = 0;
+  }
+  pSrc->pWin = pFeed->pData;
+  
   /* Return status */
   return status;
 }
 
 /*
- * Append a Unicode codepoint to a string buffer.
- * 
- * cpv is the Unicode codepoint to append.  It must be greater than zero
- * and no greater than UNICODE_MAX_CPV.  Furthermore, it may not be in
- * surrogate range [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE].
- * 
- * The codepoint will be encoded into UTF-8 and the bytes of the UTF-8
- * encoding will be added to the string buffer.
- * 
- * The function fails if there is not enough capacity left for the full
- * UTF-8 encoding of the codepoint.  The buffer is unmodified in this
- * case.
- * 
- * Parameters:
- * 
- *   pBuffer - the string buffer to add a codepoint to
- * 
- *   cpv - the Unicode codepoint to add
- * 
- * Return:
- * 
- *   non-zero if successful, zero if not enough capacity
+ * snsource_end function.
  */
-static int snbuffer_append(SNBUFFER *pBuffer, long cpv) {
-  
-  int status = 1;
-  unsigned char buf[5];
-  unsigned char *pc = NULL;
-  int elen = 0;
-  
-  /* Initialize buffer to all nul */
-  memset(buf, 0, 5);
+void snsource_end(SNSOURCE *pSrc) {
   
-  /* Check parameters */
-  if (pBuffer == NULL) {
+  /* Check parameter */
+  if (pSrc == NULL) {
     abort();
   }
-  if ((cpv < 1) || (cpv > UNICODE_MAX_CPV) ||
-      ((cpv >= UNICODE_MIN_SURROGATE) &&
-        (cpv <= UNICODE_MAX_SURROGATE))) {
+  if (!(pSrc->feed)) {
     abort();
   }
   
-  /* Encode the codepoint and get the encoded length */
-  snutf_encode(cpv, buf);
-  elen = (int) strlen(buf);
+  /* Mark the end of input */
+  ((SNFEEDSRC *) pSrc->pCustom)->done = 1;
+  ((SNFEEDSRC *) pSrc->pCustom)->hungry = 0;
+}
+
+/*
+ * snsource_free function.
+ */
+void snsource_free(SNSOURCE *pSrc) {
+  
+  SNALLOC alloc;
   
-  /* Make sure we have enough capacity for the all the bytes */
-  if (pBuffer->count >= (pBuffer->maxcap - elen)) {
-    status = 0;
-  }
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
   
-  /* Add each of the bytes */
-  if (status) {
-    for(pc = buf; *pc != 0; pc++) {
-      if (!snbuffer_appendByte(pBuffer, *pc)) {
-        /* Shouldn't happen because we already checked that we have
-         * enough capacity remaining */
-        abort();
-      }
+  /* Only proceed if non-NULL parameter passed */
+  if (pSrc != NULL) {
+    
+    /* If destructor is defined, call it */
+    if (pSrc->pfDestruct != NULL) {
+      (*(pSrc->pfDestruct))(pSrc->pCustom);
+    }
+    
+    /* Release the block buffer, if allocated */
+    if (pSrc->pBlock != NULL) {
+      snalloc_release(&(pSrc->alloc), pSrc->pBlock,
+                      SNSOURCE_BLOCK_SIZE);
+      pSrc->pBlock = NULL;
+    }
+    
+    /* Release the line break index, if built */
+    if (pSrc->pLines != NULL) {
+      snalloc_release(&(pSrc->alloc), pSrc->pLines,
+                      pSrc->line_cap * ((long) sizeof(long)));
+      pSrc->pLines = NULL;
     }
+    
+    /* Release the structure, through a copy of the allocator since the
+     * allocator is stored in the structure */
+    memcpy(&alloc, &(pSrc->alloc), sizeof(SNALLOC));
+    snalloc_release(&alloc, pSrc, (long) sizeof(SNSOURCE));
   }
-  
-  /* Return status */
-  return status;
 }
 
 /*
- * Get a pointer to the current string stored in the buffer.
- * 
- * The string will be null-terminated.  The returned pointer remains
- * valid until another character is appended to the buffer or the buffer
- * is reset.
- * 
- * Clients should not modify the data pointed to, or undefined behavior
- * occurs.
- * 
- * Parameters:
- * 
- *   pBuffer - the string buffer to query
- * 
- * Return:
- * 
- *   the current buffered string
+ * snsource_bytes function.
+ */
+long snsource_bytes(SNSOURCE *pSrc) {
+  
+  /* Check parameter */
+  if (pSrc == NULL) {
+    abort();
+  }
+  
+  /* Return count */
+  return pSrc->read_count;
+}
+
+/*
+ * snsource_consume function.
  */
-static char *snbuffer_get(SNBUFFER *pBuffer) {
+int snsource_consume(SNSOURCE *pSrc) {
+  
+  long c = 0;
+  int result = 0;
+  SNRUN run;
+  
+  /* Initialize structures */
+  memset(&run, 0, sizeof(SNRUN));
   
   /* Check parameter */
-  if (pBuffer == NULL) {
+  if (pSrc == NULL) {
     abort();
   }
   
-  /* If we haven't made the initial allocation yet, do it */
-  if (pBuffer->cap < 1) {
-    pBuffer->pBuf = (char *) malloc((size_t) pBuffer->initcap);
-    if (pBuffer->pBuf == NULL) {
-      abort();
-    }
-    memset(pBuffer->pBuf, 0, (size_t) pBuffer->initcap);
-    pBuffer->cap = pBuffer->initcap;
+  /* Keep reading until we get something besides SP HT CR LF, skipping
+   * whitespace in bulk wherever it is in the window */
+  if (pSrc->feed) {
+    ((SNFEEDSRC *) pSrc->pCustom)->starved = 0;
   }
+  do {
+    snsource_skip(pSrc, SNRUN_WHITE, LONG_MAX, &run);
+    c = snsource_readCPV(pSrc);
+  } while ((c == ASCII_SP) || (c == ASCII_HT) ||
+            (c == ASCII_CR) || (c == ASCII_LF));
   
-  /* Return the pointer */
-  return pBuffer->pBuf;
+  /* Set result depending on what we stopped on */
+  if ((c == SNERR_EOF) && snsource_starved(pSrc)) {
+    /* Only whitespace so far, but a feed source needs more input */
+    result = SNERR_MORE;
+  
+  } else if (c == SNERR_EOF) {
+    /* Nothing but whitespace and blank lines present, so succeed */
+    result = 1;
+  
+  } else if (c == SNERR_IOERR) {
+    /* I/O error, so return that */
+    result = SNERR_IOERR;
+  
+  } else {
+    /* In all other cases, including data bytes besides whitespace and
+     * line breaks and other kinds of errors, return a trailer error */
+    result = SNERR_TRAILER;
+  }
+  
+  /* Return result */
+  return result;
 }
 
 /*
- * Get the last Unicode codepoint in a buffer.
- * 
- * Parameters:
- * 
- *   pBuffer - the buffer to query
- * 
- * Return:
- * 
- *   the last Unicode codepoint, or zero if the buffer is empty
+ * snsource_ismulti function.
  */
-static long snbuffer_last(SNBUFFER *pBuffer) {
+int snsource_ismulti(SNSOURCE *pSrc) {
   
-  long c = 0;
-  unsigned char *pc = NULL;
-  int sw = 0;
+  int result = 0;
   
   /* Check parameter */
-  if (pBuffer == NULL) {
+  if (pSrc == NULL) {
     abort();
   }
   
-  /* Get last codepoint if buffer not empty */
-  if (pBuffer->count > 0) {
-    
-    /* Find the last byte in the buffer that is not a continuation
-     * byte */
-    sw = 1;
-    for(pc = &(((unsigned char *) pBuffer->pBuf)[pBuffer->count - 1]);
-        snutf_count(*pc) == 0;
-        pc--) {
-      sw++;
-    }
-    
-    /* Get how many encoded bytes and make sure valid and matches how
-     * many bytes we moved back in the search */
-    if (snutf_count(*pc) != sw) {
-      /* Shouldn't happen because everything in buffer should be
-       * valid */
-      abort();
-    }
-    
-    /* Decode the last codepoint */
-    c = snutf_decode(pc);
-    if (c < 0) {
-      /* Shouldn't happen because everything in buffer should be
-       * valid */
-      abort();
-    }
+  /* Whole sources and sources with a rewind function support
+   * multipass */
+  if ((pSrc->pfRewind != NULL) || pSrc->whole) {
+    result = 1;
+  } else {
+    result = 0;
   }
   
-  /* Return character or zero */
-  return c;
+  /* Return result */
+  return result;
 }
 
 /*
- * Remove the last codepoint from the given buffer.
- * 
- * The function fails if the buffer is empty.
- * 
- * Parameters:
- * 
- *   pBuffer - the buffer to remove a codepoint from
- * 
- * Return:
- * 
- *   non-zero if successful, zero if buffer already empty
+ * snsource_rewind function.
  */
-static int snbuffer_less(SNBUFFER *pBuffer) {
+int snsource_rewind(SNSOURCE *pSrc) {
   
   int status = 1;
-  unsigned char *pc = NULL;
   
-  /* Check parameter */
-  if (pBuffer == NULL) {
+  /* Check parameter and state */
+  if (pSrc == NULL) {
+    abort();
+  }
+  if ((pSrc->pfRewind == NULL) && (!(pSrc->whole))) {
     abort();
   }
   
-  /* Only proceed if not empty */
-  if (pBuffer->count > 0) {
-    /* Remove any continuation bytes from the end of the buffer */
-    for(pc = &(((unsigned char *) pBuffer->pBuf)[pBuffer->count - 1]);
-        snutf_count(*pc) == 0;
-        pc--) {
-      *pc = (unsigned char) 0;
-      (pBuffer->count)--;
-    }
-    
-    /* Remove the last codepoint from the buffer */
-    *pc = (unsigned char) 0;
-    (pBuffer->count)--;
-    
-  } else {
-    /* Buffer was empty */
+  /* If source currently in EOF state, clear that */
+  if (pSrc->status == SNERR_EOF) {
+    pSrc->status = 0;
+  }
+  
+  /* If we are in an error state, rewind fails */
+  if (pSrc->status != 0) {
     status = 0;
   }
   
-  /* Return status */
+  /* Attempt to rewind the source, which for whole sources is just a
+   * matter of moving back to the start of the window */
+  if (status && (!(pSrc->whole))) {
+    if (!(*(pSrc->pfRewind))(pSrc->pCustom)) {
+      status = 0;
+      pSrc->status = SNERR_IOERR;
+    }
+  }
+  
+  /* If we rewound successfully, clear the read counter and reset the
+   * window, discarding anything that remains in the window of block
+   * sources */
+  if (status) {
+    pSrc->read_count = 0;
+    if (!(pSrc->whole)) {
+      pSrc->win_len = 0;
+    }
+    pSrc->win_pos = 0;
+    pSrc->win_clean = 0;
+    if (pSrc->cache) {
+      sncache_restart((SNCACHESRC *) pSrc->pCustom);
+    }
+  }
+  
+  /* Return status of operation */
   return status;
 }
 
 /*
- * Reset an input filter back to its original state.
- * 
- * This should also be used for initializing filter structures.
- * 
- * Parameters:
- * 
- *   pFilter - the filter to reset
+ * snsource_buffer function.
  */
-static void snfilter_reset(SNFILTER *pFilter) {
+const char *snsource_buffer(SNSOURCE *pSrc, long *pLen) {
+  
+  const char *pResult = NULL;
   
   /* Check parameter */
-  if (pFilter == NULL) {
+  if (pSrc == NULL) {
     abort();
   }
   
-  /* Clear structure */
-  memset(pFilter, 0, sizeof(SNFILTER));
+  /* Only whole sources expose their data, and cache sources have no
+   * data to expose */
+  if (pSrc->whole && (!(pSrc->cache))) {
+    if (pSrc->win_len > 0) {
+      pResult = (const char *) pSrc->pWin;
+    } else {
+      pResult = "";
+    }
+    if (pLen != NULL) {
+      *pLen = pSrc->win_len;
+    }
   
-  /* Set initial state */
-  pFilter->line_count = 0;
-  pFilter->c = 0;
-  pFilter->pushback = 0;
+  } else {
+    if (pLen != NULL) {
+      *pLen = 0;
+    }
+  }
+  
+  /* Return the data pointer or NULL */
+  return pResult;
 }
 
 /*
- * Read the next codepoint through the input filter.
- * 
- * The next codepoint value is in Unicode codepoint range, which is
- * [0, UNICODE_MAX_CPV], excluding the surrogate characters, in range
- * [UNICODE_MIN_SURROGATE, UNICODE_MAX_SURROGATE].
- * 
- * CR+LF to LF conversion, UTF-8 Byte Order Mark (BOM) filtering, and
- * correction of encoded surrogate pairs to supplemental codepoints are
- * performed by this function.
- * 
- * SNERR_ codes are returned if there is an error.  These codes are
- * always less than zero, so they are easy to distinguish from Unicode
- * codepoints, which are always zero or greater.
- * 
- * The provided input filter state must be properly initialized.
- * 
- * Parameters:
- * 
- *   pFilter - the input filter state
- * 
- *   pIn - the source to read from
- * 
- * Return:
- * 
- *   the next codepoint value, or an SNERR_ value that is less than zero
+ * snsource_locate function.
  */
-static long snfilter_read(SNFILTER *pFilter, SNSOURCE *pIn) {
+int snsource_locate(
+    SNSOURCE * pSrc,
+    long       offset,
+    long     * pLine,
+    long     * pCol) {
   
-  int err_num = 0;
-  long c = 0;
-  long c2 = 0;
+  int status = 1;
+  long lo = 0;
+  long hi = 0;
+  long mid = 0;
+  long breaks = 0;
+  long start = 0;
+  long col = 1;
+  long i = 0;
+  const unsigned char *pd = NULL;
+  const unsigned char *pLF = NULL;
   
   /* Check parameters */
-  if ((pFilter == NULL) || (pIn == NULL)) {
+  if ((pSrc == NULL) || (pLine == NULL) || (pCol == NULL)) {
     abort();
   }
   
-  /* If we're not in pushback mode and we don't have a special
-   * condition, we need to read another codepoint */
-  if ((!(pFilter->pushback)) &&
-        ((pFilter->line_count == 0) || (pFilter->c >= 0))) {
-    
-    /* Read a codepoint */
-    c = snsource_readCPV(pIn);
-    if (c < 0) {
-      err_num = (int) c;
-    }
-    
-    /* If this is the first codepoint read, and it is the U+FEFF Byte
-     * Order Mark (BOM), then skip it by reading again */
-    if ((!err_num) && (pFilter->line_count == 0) && (c == 0xfeffL)) {
-      c = snsource_readCPV(pIn);
-      if (c < 0) {
-        err_num = (int) c;
-      }
-    }
-    
-    /* If we read a CR, read the LF it must be paired with */
-    if ((!err_num) && (c == ASCII_CR)) {
-      
-      /* We read a CR, so read next character and make sure it is LF */
-      c = snsource_readCPV(pIn);
-      if (c < 0) {
-        err_num = (int) c;
-      } else if (c != ASCII_LF) {
-        err_num = SNERR_BADCR;
-      }
-    }
-    
-    /* If we read a low surrogate, error because it means surrogate is
-     * not paired properly */
-    if ((!err_num) && (c >= UNICODE_MIN_LO_SUR) && 
-          (c <= UNICODE_MAX_LO_SUR)) {
-      err_num = SNERR_UNPAIRED;
-    }
-    
-    /* If we read a high surrogate, read next codepoint which must be a
-     * low surrogate and then replace the character read with the
-     * supplemental codepoint selected by the surrogate pair */
-    if ((!err_num) && (c >= UNICODE_MIN_HI_SUR) &&
-          (c <= UNICODE_MAX_HI_SUR)) {
-      
-      /* Read the low surrogate */
-      c2 = snsource_readCPV(pIn);
-      if (c2 < 0) {
-        err_num = (int) c2;
-      } else if ((c2 < UNICODE_MIN_LO_SUR) ||
-                  (c2 > UNICODE_MAX_LO_SUR)) {
-        err_num = SNERR_UNPAIRED;
+  /* Only whole sources hold their input, and cache sources have no
+   * input to locate in */
+  if ((!(pSrc->whole)) || pSrc->cache) {
+    status = 0;
+  }
+  if (status && ((offset < 0) || (offset > pSrc->win_len))) {
+    status = 0;
+  }
+  
+  /* Count the line breaks before the offset and find the start of the
+   * line, with a binary search of the index if it is available, or
+   * else by counting the line breaks directly */
+  if (status) {
+    pd = pSrc->pWin;
+    if (snsource_index(pSrc)) {
+      lo = 0;
+      hi = pSrc->line_count;
+      while (lo < hi) {
+        mid = lo + ((hi - lo) / 2);
+        if ((pSrc->pLines)[mid] < offset) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
       }
-      
-      /* Replace codepoint read with the supplemental codepoint */
-      if (!err_num) {
-        c = snutf_pair(c, c2);
+      breaks = lo;
+      if (breaks > 0) {
+        start = (pSrc->pLines)[breaks - 1] + 1;
       }
-    }
     
-    /* Update state of filter structure */
-    if (!err_num) {
-      if (pFilter->line_count == 0) {
-        /* Very first character -- set line count to one */
-        pFilter->c = c;
-        pFilter->line_count = 1;
-        
-      } else {
-        /* Not the very first character -- increase line count by one if
-         * the previous character was LF and the line count is not at
-         * the overflow value of LONG_MAX */
-        if ((pFilter->c == ASCII_LF) &&
-              (pFilter->line_count < LONG_MAX)) {
-          (pFilter->line_count)++;
+    } else {
+      while (start < offset) {
+        pLF = (const unsigned char *) memchr(pd + start, ASCII_LF,
+                                        (size_t) (offset - start));
+        if (pLF == NULL) {
+          break;
         }
-        pFilter->c = c;
+        breaks++;
+        start = ((long) (pLF - pd)) + 1;
       }
     }
   }
   
-  /* Clear the pushback flag if it is set -- even if there has been an
-   * error or EOF condition */
-  pFilter->pushback = 0;
+  /* The input filter drops a Byte Order Mark at the start of input, so
+   * it doesn't count as a column */
+  if (status && (start == 0) && (offset >= 3)) {
+    if ((pd[0] == SNFILTER_BOM_1) && (pd[1] == SNFILTER_BOM_2) &&
+        (pd[2] == SNFILTER_BOM_3)) {
+      start = 3;
+    }
+  }
   
-  /* If we've encountered an error (or EOF), write it into the
-   * structure */
-  if (err_num) {
-    pFilter->c = err_num;
+  /* Count the codepoints before the offset in the line, which are all
+   * the bytes that are not UTF-8 continuation bytes */
+  if (status) {
+    for(i = start; i < offset; i++) {
+      if ((pd[i] & 0xc0) != 0x80) {
+        col++;
+      }
+    }
   }
   
-  /* Return the character or special condition */
-  return (pFilter->c);
+  /* Store the results */
+  if (status) {
+    *pLine = breaks + 1;
+    *pCol = col;
+  } else {
+    *pLine = 0;
+    *pCol = 0;
+  }
+  
+  /* Return status */
+  return status;
 }
 
 /*
- * Return the current line count.
- * 
- * The line count is always at least one and at most LONG_MAX.  The
- * value of LONG_MAX is an overflow value, so any count of lines above
- * that will just remain at LONG_MAX.
- * 
- * The line count is affected by pushback mode, changing backwards if
- * characters are pushed back before a line break.
- * 
- * Parameters:
- * 
- *   pFilter - the input filter state
- * 
- * Return:
- * 
- *   the current line count
+ * snparser_alloc function.
  */
-static long snfilter_count(SNFILTER *pFilter) {
+SNPARSER *snparser_alloc(void) {
+  return snparser_alloclimits(NULL);
+}
+
+/*
+ * snparser_alloclimits function.
+ */
+SNPARSER *snparser_alloclimits(const SNLIMITS *pLimits) {
+  return snparser_allocwith(pLimits, NULL);
+}
+
+/*
+ * snparser_allocwith function.
+ */
+SNPARSER *snparser_allocwith(
+    const SNLIMITS * pLimits,
+    const SNALLOC  * pAlloc) {
   
-  long lc = 0;
+  SNPARSER *pParser = NULL;
+  SNALLOC alloc;
   
-  /* Check parameter */
-  if (pFilter == NULL) {
-    abort();
-  }
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
   
-  /* Read current line count */
-  lc = pFilter->line_count;
+  /* Get the allocator and allocate structure */
+  snalloc_init(&alloc, pAlloc);
+  pParser = (SNPARSER *) snalloc_get(&alloc, (long) sizeof(SNPARSER));
   
-  /* If line count is zero, change it to one to indicate the line count
-   * at the start of the file */
-  if (lc < 1) {
-    lc = 1;
+  /* Initialize, with the reader using the copy of the allocator in the
+   * parser structure */
+  if (pParser != NULL) {
+    memset(pParser, 0, sizeof(SNPARSER));
+    memcpy(&(pParser->alloc), &alloc, sizeof(SNALLOC));
+    snreader_init(&(pParser->reader), pLimits, &(pParser->alloc));
+    snfilter_reset(&(pParser->filter));
+    pParser->pArena = NULL;
+    pParser->arena_cap = 0;
+    pParser->arena_len = 0;
+    snintern_init(&(pParser->symbols), &(pParser->alloc));
+    pParser->sym_enabled = 0;
+    pParser->skip_kind = 0;
+    pParser->skip_depth = 0;
+    pParser->pipe.slots = 0;
+    pParser->pipe.pRing = NULL;
+    pParser->pipe.pIn = NULL;
+    pParser->pipe.running = 0;
+    pParser->pipe.finished = 0;
+#ifdef SHASTINA_THREADS
+    pParser->pipe.sync = 0;
+#endif
   }
   
-  /* If we're not in pushback mode, c is LF, we're not at the very
-   * beginning of the file, and line_count is less than LONG_MAX,
-   * increase the line count by one */
-  if ((!(pFilter->pushback)) && (pFilter->line_count > 0) &&
-        (pFilter->c == ASCII_LF) && (lc < LONG_MAX)) {
-    lc++;
+  /* Return parser or NULL */
+  return pParser;
+}
+
+/*
+ * snparser_placesize function.
+ */
+long snparser_placesize(const SNLIMITS *pLimits) {
+  
+  long result = 0;
+  long cap = 0;
+  SNLIMITS lim;
+  
+  /* Initialize structures */
+  memset(&lim, 0, sizeof(SNLIMITS));
+  
+  /* Fill in the defaults of the limits */
+  snreader_limits(&lim, pLimits);
+  
+  /* Room for the region state, the parser structure, and the initial
+   * allocations of the key and value buffers */
+  result = snfixed_round((long) sizeof(SNFIXED)) +
+            snfixed_round((long) sizeof(SNPARSER)) +
+            snfixed_round(lim.key_init) +
+            snfixed_round(lim.value_init);
+  
+  /* Stacks are inline at first, but if their initial allocation goes
+   * beyond that, add room for the buffers they grow into, which is
+   * what snstack_push() allocates when leaving the inline storage */
+  if ((lim.nest_init > SNSTACK_INLINE) &&
+      (lim.nest_max > SNSTACK_INLINE)) {
+    cap = SNSTACK_INLINE * 2;
+    if (cap < lim.nest_init) {
+      cap = lim.nest_init;
+    }
+    if (cap > lim.nest_max) {
+      cap = lim.nest_max;
+    }
+    result = result + 2 * snfixed_round(cap * ((long) sizeof(long)));
   }
   
-  /* Return the adjusted line count */
-  return lc;
+  /* Return result */
+  return result;
 }
 
 /*
- * Set the pushback flag, so the character that was just read will be
- * read again.
- * 
- * This call is ignored if the filter state is currently in an EOF or
- * error condition.
- * 
- * The call fails if the filter state is already in pushback mode or if
- * no characters have been read yet.
- * 
- * Parameters:
- * 
- *   pFilter - the filter state
- * 
- * Return:
- * 
- *   non-zero if successful, zero if pushback mode could not be set
+ * snparser_place function.
  */
-static int snfilter_pushback(SNFILTER *pFilter) {
+SNPARSER *snparser_place(
+    void           * pMem,
+    long             size,
+    const SNLIMITS * pLimits) {
   
-  int status = 1;
+  SNPARSER *pParser = NULL;
+  SNFIXED *pFixed = NULL;
+  long hdr = 0;
+  SNALLOC alloc;
   
-  /* Check parameter */
-  if (pFilter == NULL) {
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameters */
+  if ((pMem == NULL) || (size < 0)) {
     abort();
   }
   
-  /* Only proceed if not in special state */
-  if ((pFilter->line_count == 0) || (pFilter->c >= 0)) {
+  /* Only proceed if there is room for the region state */
+  hdr = snfixed_round((long) sizeof(SNFIXED));
+  if (size > hdr) {
     
-    /* We can only set the pushback flag if it is not already set and at
-     * least one character has been read */
-    if ((pFilter->line_count > 0) && (!(pFilter->pushback))) {
-      pFilter->pushback = 1;
-    } else {
-      status = 0;
-    }
+    /* Set up the region in the rest of the memory */
+    pFixed = (SNFIXED *) pMem;
+    memset(pFixed, 0, sizeof(SNFIXED));
+    pFixed->pBase = ((unsigned char *) pMem) + hdr;
+    pFixed->size = size - hdr;
+    pFixed->used = 0;
+    pFixed->last = -1;
+    
+    /* Allocate the parser with the region as its allocator, which
+     * fails if the region can't hold the parser structure */
+    alloc.alloc_func = &snfixed_alloc;
+    alloc.realloc_func = &snfixed_realloc;
+    alloc.free_func = &snfixed_free;
+    alloc.custom = (void *) pFixed;
+    pParser = snparser_allocwith(pLimits, &alloc);
   }
   
-  /* Return status */
-  return status;
+  /* Return parser or NULL */
+  return pParser;
 }
 
 /*
- * Determine whether the given character is legal, outside of string
- * literals and comments.
- * 
- * This range includes all visible, printing ASCII characters, plus
- * Space (SP), Horizontal Tab (HT), and Line Feed (LF).
- * 
- * Parameters:
- * 
- *   c - the character to check
- * 
- * Return:
- * 
- *   non-zero if legal, zero if not
+ * snparser_free function.
  */
-static int snchar_islegal(long c) {
+void snparser_free(SNPARSER *pParser) {
   
-  int result = 0;
+  SNALLOC alloc;
   
-  if (((c >= ASCII_VISIBLE_MIN) && (c <= ASCII_VISIBLE_MAX)) ||
-      (c == ASCII_SP) || (c == ASCII_HT) || (c == ASCII_LF)) {
-    result = 1;
-  } else {
-    result = 0;
-  }
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
   
-  return result;
+  /* Only do something if not NULL */
+  if (pParser != NULL) {
+    /* Stop the pipeline and release its ring, lock, and condition */
+    snpipe_stop(&(pParser->pipe));
+    snpipe_release(&(pParser->pipe), &(pParser->alloc));
+#ifdef SHASTINA_THREADS
+    if (pParser->pipe.sync) {
+      pthread_cond_destroy(&(pParser->pipe.cond));
+      pthread_mutex_destroy(&(pParser->pipe.lock));
+      pParser->pipe.sync = 0;
+    }
+#endif
+
+    /* Fully reset reader, release the arena, and release through a copy
+     * of the allocator since it is stored in the structure */
+    snreader_reset(&(pParser->reader), 1);
+    if (pParser->pArena != NULL) {
+      snalloc_release(&(pParser->alloc),
+                      pParser->pArena, pParser->arena_cap);
+      pParser->pArena = NULL;
+    }
+    snintern_release(&(pParser->symbols));
+    memcpy(&alloc, &(pParser->alloc), sizeof(SNALLOC));
+    snalloc_release(&alloc, pParser, (long) sizeof(SNPARSER));
+  }
 }
 
 /*
- * Determine whether the given character is an atomic primitive
- * character.
- * 
- * These characters can stand by themselves as a full token.
- * 
- * Parameters:
- * 
- *   c - the character to check
- * 
- * Return:
- * 
- *   non-zero if atomic, zero if not
+ * snparser_reset function.
  */
-static int snchar_isatomic(long c) {
+void snparser_reset(SNPARSER *pParser, int flags) {
   
-  int result = 0;
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
   
-  if ((c == ASCII_LPAREN) || (c == ASCII_RPAREN) ||
-      (c == ASCII_LSQR) || (c == ASCII_RSQR) ||
-      (c == ASCII_COMMA) || (c == ASCII_PERCENT) ||
-      (c == ASCII_SEMICOLON) || (c == ASCII_DQUOTE) ||
-      (c == ASCII_LCURL) || (c == ASCII_RCURL)) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Stop the pipeline, discarding anything it read ahead */
+  snpipe_stop(&(pParser->pipe));
+  pParser->pipe.finished = 0;
+  
+  /* Fast reset of the reader, which keeps the buffers and the mode */
+  snreader_reset(&(pParser->reader), 0);
+  
+  /* Start line counting over unless continuing it */
+  if (!(flags & SNRESET_LINES)) {
+    snfilter_reset(&(pParser->filter));
   }
   
-  return result;
+  /* Clear the arena, keeping its allocation, and drop any skip that
+   * is waiting for more input */
+  pParser->arena_len = 0;
+  pParser->skip_kind = 0;
 }
 
 /*
- * Determine whether the given character is an inclusive token closer.
- * 
- * Inclusive token closers end the token and are included as the last
- * character of the token.
- * 
- * Parameters:
- * 
- *   c - the character to check
- * 
- * Return:
- * 
- *   non-zero if inclusive, zero if not
+ * snparser_mode function.
  */
-static int snchar_isinclusive(long c) {
-  
-  int result = 0;
+void snparser_mode(SNPARSER *pParser, int flags) {
   
-  if ((c == ASCII_DQUOTE) || (c == ASCII_LCURL)) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
+  if (pParser->pipe.running) {
+    abort();
   }
   
-  return result;
+  /* Store the recognized flags in the reader */
+  pParser->reader.mode = flags & (SNMODE_VIEW | SNMODE_CHUNK |
+                            SNMODE_INTEGER | SNMODE_FLOAT |
+                            SNMODE_UNESCAPE);
 }
 
 /*
- * Determine whether the given character is an exclusive token closer.
- * 
- * Exclusive token closers end the token but are not included as the
- * last character of the token.
- * 
- * Parameters:
- * 
- *   c - the character to check
- * 
- * Return:
- * 
- *   non-zero if exclusive, zero if not
+ * snparser_mask function.
  */
-static int snchar_isexclusive(long c) {
+void snparser_mask(SNPARSER *pParser, long mask) {
+
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
+  if (pParser->pipe.running) {
+    abort();
+  }
   
-  int result = 0;
+  /* Store the recognized bits in the reader, always including EOF */
+  pParser->reader.mask = (mask & SNMASK_ALL) | SNMASK(SNENTITY_EOF);
+}
+
+/*
+ * snparser_parallel function.
+ */
+int snparser_parallel(SNPARSER *pParser, int threads, long chunk) {
   
-  if ((c == ASCII_HT) || (c == ASCII_SP) || (c == ASCII_LF) ||
-      (c == ASCII_LPAREN) || (c == ASCII_RPAREN) ||
-      (c == ASCII_LSQR) || (c == ASCII_RSQR) ||
-      (c == ASCII_COMMA) || (c == ASCII_PERCENT) ||
-      (c == ASCII_SEMICOLON) || (c == ASCII_POUNDSIGN) ||
-      (c == ASCII_RCURL)) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
+  if (pParser->pipe.running) {
+    abort();
   }
   
-  return result;
+  /* Enable or disable, with the chunk buffers taking the limits of the
+   * reader buffers */
+  return snspec_enable(&(pParser->reader.spec), threads, chunk,
+            &(pParser->reader.buf_key), &(pParser->reader.buf_value));
 }
 
 /*
- * Determine whether a given string consists purely of the given byte.
- * 
- * c is a unsigned byte value in 7-bit range excluding nul (1-127) and
- * pStr points to a null-terminated string.
- * 
- * This function returns non-zero only if the string has exactly one
- * byte, which is equal to c.
- * 
- * Parameters:
- * 
- *   c - the byte
- * 
- *   pStr - pointer to the string
- * 
- * Return:
- * 
- *   non-zero if string is equal to byte, zero if not
+ * snparser_pipeline function.
  */
-static int snchar_strequals(int c, const char *pStr) {
-  
-  char strb[2];
+int snparser_pipeline(SNPARSER *pParser, int enable, long slots) {
+
   int result = 0;
+  SNPIPE *pp = NULL;
   
-  /* Initialize buffer */
-  memset(&(strb[0]), 0, 2);
-  
-  /* Check parameters */
-  if ((c < 1) || (c > 127) || (pStr == NULL)) {
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
+  pp = &(pParser->pipe);
+  if (pp->running) {
     abort();
   }
   
-  /* Write character into local buffer */
-  strb[0] = (char) c;
+  /* Drop any ring there is now */
+  snpipe_release(pp, &(pParser->alloc));
   
-  /* Compare strings */
-  if (strcmp(pStr, &(strb[0])) == 0) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Apply the slot limits */
+  if (slots < 1) {
+    slots = SNPIPE_SLOTS_DEFAULT;
+  } else if (slots < 2) {
+    slots = 2;
+  } else if (slots > SNPIPE_SLOTS_MAX) {
+    slots = SNPIPE_SLOTS_MAX;
+  }
+  
+  /* Set up the lock and the condition the first time, and then
+   * allocate the ring; without threads, the pipeline stays disabled */
+#ifdef SHASTINA_THREADS
+  if (enable && (!(pp->sync))) {
+    if (pthread_mutex_init(&(pp->lock), NULL) == 0) {
+      if (pthread_cond_init(&(pp->cond), NULL) == 0) {
+        pp->sync = 1;
+      } else {
+        pthread_mutex_destroy(&(pp->lock));
+      }
+    }
   }
   
-  /* Return result */
+  if (enable && pp->sync) {
+    pp->pRing = (SNPIPESLOT *) snalloc_get(&(pParser->alloc),
+                  slots * ((long) sizeof(SNPIPESLOT)));
+    if (pp->pRing != NULL) {
+      memset(pp->pRing, 0, ((size_t) slots) * sizeof(SNPIPESLOT));
+      pp->slots = slots;
+      result = 1;
+    }
+  }
+#else
+  (void) enable;
+#endif
+
+  /* Return whether the pipeline is now enabled */
   return result;
 }
 
 /*
- * Determine whether a given string consists purely of two given bytes.
- * 
- * c1 and c2 are unsigned byte values in 7-bit range excluding nul
- * (1-127) and pStr points to a null-terminated string.
- * 
- * This function returns non-zero only if the string has exactly two
- * bytes, the first of which equals c1 and the second of which equals
- * c2.
- * 
- * Parameters:
- * 
- *   c1 - the first byte
- * 
- *   c2 - the second byte
- * 
- *   pStr - pointer to the string
- * 
- * Return:
- * 
- *   non-zero if string is equal to the two bytes, zero if not
+ * snparser_read function.
  */
-static int snchar_strequals2(int c1, int c2, const char *pStr) {
-  
-  char strb[3];
-  int result = 0;
+void snparser_read(
+    SNPARSER * pParser,
+    SNENTITY * pEntity,
+    SNSOURCE * pIn) {
   
-  /* Initialize buffer */
-  memset(&(strb[0]), 0, 3);
+  SNENTITY *pe = NULL;
   
   /* Check parameters */
-  if ((c1 < 1) || (c1 > 127) || (pStr == NULL) ||
-      (c2 < 1) || (c2 > 127)) {
+  if ((pParser == NULL) || (pEntity == NULL) || (pIn == NULL)) {
     abort();
   }
   
-  /* Write characters into local buffer */
-  strb[0] = (char) c1;
-  strb[1] = (char) c2;
-  
-  /* Compare strings */
-  if (strcmp(pStr, &(strb[0])) == 0) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Get the next entity, through the pipeline if it is enabled, and
+   * then look up the symbol ID, turning the entity into an out of
+   * memory error that the reader then keeps returning if the symbol
+   * table can not grow; reading abandons any skip that is waiting for
+   * more input */
+  pParser->skip_kind = 0;
+  pe = snpipe_next(pParser, pEntity, pIn);
+  if (pe != pEntity) {
+    memcpy(pEntity, pe, sizeof(SNENTITY));
+  }
+  if (pParser->sym_enabled) {
+    if (!snsym_assign(pParser, pEntity)) {
+      snpipe_stop(&(pParser->pipe));
+      memset(pEntity, 0, sizeof(SNENTITY));
+      pEntity->status = SNERR_NOMEM;
+      pEntity->offset = snsource_bytes(pIn);
+      pParser->reader.status = SNERR_NOMEM;
+    }
   }
-  
-  /* Return result */
-  return result;
 }
 
 /*
- * Read a quoted string.
- * 
- * pBuffer is the buffer into which the string data will be read.  It
- * must be properly initialized.  This function will reset the buffer
- * and then write the string data into it.
- * 
- * pIn is the source to read data from.
- * 
- * pFilter is the input filter to read the data through.  It should be
- * in the proper state.
- * 
- * This function assumes that the opening quote as already been read.
- * The first character read is therefore the first character of string
- * data.  The closing quote will be read and consumed by this function.
- * 
- * Parameters:
- * 
- *   pBuffer - the buffer to read the string data into
- * 
- *   pIn - the source to read the string data from
- * 
- *   pFilter - the input filter
- * 
- * Return:
- * 
- *   zero if successful, or one of the SNERR constants if error
+ * snparser_readbatch function.
  */
-static int snstr_readQuoted(
-    SNBUFFER * pBuffer,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter) {
+long snparser_readbatch(
+    SNPARSER * pParser,
+    SNENTITY * pEntities,
+    long       max,
+    SNSOURCE * pIn) {
   
-  int err_num = 0;
-  int esc_count = 0;
-  long c = 0;
+  SNENTITY *pe = NULL;
+  SNENTITY *pNext = NULL;
+  long count = 0;
+  long i = 0;
+  long pos = 0;
+  long mark = 0;
+  int flags = 0;
+  int status = 0;
   
   /* Check parameters */
-  if ((pBuffer == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+  if ((pParser == NULL) || (pEntities == NULL) || (pIn == NULL) ||
+      (max < 1)) {
     abort();
   }
   
-  /* Reset the buffer */
-  snbuffer_reset(pBuffer, 0);
-  
-  /* Read all string data */
-  while (!err_num) {
-    
-    /* Read a character */
-    c = snfilter_read(pFilter, pIn);
-    if (c < 0) {
-      if (c == SNERR_EOF) {
-        err_num = SNERR_OPENSTR;
-      } else {
-        err_num = (int) c;
-      }
+  /* Clear the arena, invalidating the strings of the previous batch,
+   * and abandon any skip that is waiting for more input */
+  pParser->arena_len = 0;
+  pParser->skip_kind = 0;
+  
+  /* Read entities, copying their strings into the arena, until the
+   * array is full or EOF or an error has been read */
+  while (count < max) {
+    pe = &(pEntities[count]);
+    pNext = snpipe_next(pParser, pe, pIn);
+    if (pNext != pe) {
+      memcpy(pe, pNext, sizeof(SNENTITY));
     }
+    count++;
     
-    /* If this character is a double quote and the escape count is not
-     * odd, then we are done so leave loop */
-    if ((!err_num) && ((esc_count & 0x1) == 0) && (c == ASCII_DQUOTE)) {
-      break;
+    mark = pParser->arena_len;
+    status = 1;
+    if (pParser->sym_enabled) {
+      status = snsym_assign(pParser, pe);
     }
-    
-    /* Update escape count -- increment if current character is a
-     * backslash, clear otherwise; only least significant bit of the
-     * count is important so mask out upper bits to prevent overflow */
-    if ((!err_num) && (c == ASCII_BACKSLASH)) {
-      esc_count = (esc_count + 1) & 0x1;
-    } else {
-      esc_count = 0;
+    flags = snbatch_strings(pe->status);
+    if (status && (flags & SNBATCH_KEY)) {
+      status = snbatch_keep(pParser, pe->pKey, pe->key_len);
+    }
+    if (status && (flags & SNBATCH_VALUE)) {
+      status = snbatch_keep(pParser, pe->pValue, pe->value_len);
     }
     
-    /* Make sure character is not a null character */
-    if ((!err_num) && (c == 0)) {
-      err_num = SNERR_NULLCHR;
+    /* If the strings couldn't be copied, drop them and turn the entity
+     * into an out of memory error, which the reader then keeps
+     * returning */
+    if (!status) {
+      snpipe_stop(&(pParser->pipe));
+      pParser->arena_len = mark;
+      memset(pe, 0, sizeof(SNENTITY));
+      pe->status = SNERR_NOMEM;
+      pe->offset = snsource_bytes(pIn);
+      pParser->reader.status = SNERR_NOMEM;
     }
     
-    /* Append character to buffer */
-    if (!err_num) {
-      if (!snbuffer_append(pBuffer, c)) {
-        err_num = SNERR_LONGSTR;
-      }
+    if (pe->status <= 0) {
+      break;
     }
   }
   
-  /* Return okay or error code */
-  return err_num;
+  /* Now that the arena won't move any more, point the strings of each
+   * entity at their copies, which are in the same order as the
+   * entities, and clear whatever the entity does not use, since that
+   * may point into buffers that the next read overwrites */
+  for(i = 0; i < count; i++) {
+    pe = &(pEntities[i]);
+    snbatch_clear(pe);
+    flags = snbatch_strings(pe->status);
+    if (flags & SNBATCH_KEY) {
+      pe->pKey = pParser->pArena + pos;
+      pos += (pe->key_len + 1);
+    }
+    if (flags & SNBATCH_VALUE) {
+      pe->pValue = pParser->pArena + pos;
+      pos += (pe->value_len + 1);
+    }
+  }
+  
+  /* Return the number of entities */
+  return count;
 }
 
 /*
- * Read a curly-quoted string.
- * 
- * pBuffer is the buffer into which the string data will be read.  It
- * must be properly initialized.  This function will reset the buffer
- * and then write the string data into it.
- * 
- * pIn is the source to read data from.
- * 
- * pFilter is the input filter to read the data through.  It should be
- * in the proper state.
- * 
- * This function assumes that the opening curly bracket as already been
- * read.  The first character read is therefore the first character of
- * string data.  The closing curly bracket will be read and consumed by
- * this function.
- * 
- * Parameters:
- * 
- *   pBuffer - the buffer to read the string data into
- * 
- *   pIn - the source to read the string data from
- * 
- *   pFilter - the input filter
- * 
- * Return:
- * 
- *   zero if successful, or one of the SNERR constants if error
+ * snparser_dispatch function.
  */
-static int snstr_readCurlied(
-    SNBUFFER * pBuffer,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter) {
+int snparser_dispatch(
+    SNPARSER         * pParser,
+    SNSOURCE         * pIn,
+    const SNHANDLERS * pHandlers) {
   
-  int err_num = 0;
-  int esc_count = 0;
-  long nest_level = 1;
-  long c = 0;
+  SNENTITY spare;
+  SNENTITY *pe = NULL;
+  SNHANDLER func = NULL;
+  int result = 0;
+  int done = 0;
+  
+  /* Initialize structures */
+  memset(&spare, 0, sizeof(SNENTITY));
   
   /* Check parameters */
-  if ((pBuffer == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+  if ((pParser == NULL) || (pIn == NULL) || (pHandlers == NULL)) {
+    abort();
+  }
+  if (pHandlers->op_count < 0) {
+    abort();
+  }
+  if ((pHandlers->op_count > 0) && (pHandlers->pOps == NULL)) {
     abort();
   }
   
-  /* Reset the buffer */
-  snbuffer_reset(pBuffer, 0);
+  /* Abandon any skip that is waiting for more input */
+  pParser->skip_kind = 0;
   
-  /* Read all string data */
-  while (!err_num) {
-    
-    /* Read a character */
-    c = snfilter_read(pFilter, pIn);
-    if (c < 0) {
-      if (c == SNERR_EOF) {
-        err_num = SNERR_OPENSTR;
-      } else {
-        err_num = (int) c;
-      }
-    }
+  /* Drain the entities of the reader straight into the handlers, until
+   * EOF, an error, or a handler stops */
+  while (!done) {
+    pe = snpipe_next(pParser, &spare, pIn);
     
-    /* If escape count is not odd, update the nesting level if current
-     * character is a curly bracket */
-    if ((!err_num) && ((esc_count & 0x1) == 0)) {
-      if (c == ASCII_LCURL) {
-        
-        /* Left curly -- increase nesting level, watching for
-         * overflow */
-        if (nest_level < LONG_MAX) {
-          nest_level++;
-        } else {
-          err_num = SNERR_DEEPCURLY;
-        }
-        
-      } else if (c == ASCII_RCURL) {
-        /* Right curly -- decrease nesting level */
-        nest_level--;
+    /* Look up the symbol ID in place, turning the entity into an out of
+     * memory error that the reader then keeps returning if the symbol
+     * table can not grow */
+    if ((pe->status > 0) && pParser->sym_enabled) {
+      if (!snsym_assign(pParser, pe)) {
+        snpipe_stop(&(pParser->pipe));
+        pParser->reader.status = SNERR_NOMEM;
+        pe = &spare;
+        memset(pe, 0, sizeof(SNENTITY));
+        pe->status = SNERR_NOMEM;
+        pe->offset = snsource_bytes(pIn);
       }
     }
     
-    /* If nesting level has been brought down to zero, leave loop */
-    if ((!err_num) && (nest_level < 1)) {
-      break;
-    }
-    
-    /* Update escape count -- increment if current character is a
-     * backslash, clear otherwise; only least significant bit of the
-     * count is important so mask out upper bits to prevent overflow */
-    if ((!err_num) && (c == ASCII_BACKSLASH)) {
-      esc_count = (esc_count + 1) & 0x1;
-    } else {
-      esc_count = 0;
-    }
-    
-    /* Make sure character is not a null character */
-    if ((!err_num) && (c == 0)) {
-      err_num = SNERR_NULLCHR;
+    /* Errors are returned rather than dispatched */
+    if (pe->status < 0) {
+      result = pe->status;
+      done = 1;
     }
     
-    /* Append character to buffer */
-    if (!err_num) {
-      if (!snbuffer_append(pBuffer, c)) {
-        err_num = SNERR_LONGSTR;
+    /* Find the handler, preferring the handler of the operation */
+    if (!done) {
+      func = NULL;
+      if ((pe->status == SNENTITY_OPERATION) &&
+          (pe->symbol > 0) && (pe->symbol <= pHandlers->op_count)) {
+        func = (pHandlers->pOps)[pe->symbol - 1];
+      }
+      if (func == NULL) {
+        func = (pHandlers->entity_func)[pe->status];
+      }
+      
+      /* Call the handler, stopping at EOF or if the handler says so */
+      if (func != NULL) {
+        if (!func(pHandlers->custom, pe)) {
+          result = pe->status;
+          done = 1;
+        }
+      }
+      if (pe->status == SNENTITY_EOF) {
+        result = SNENTITY_EOF;
+        done = 1;
       }
     }
   }
   
-  /* Return okay or error code */
-  return err_num;
+  /* Return result */
+  return result;
 }
 
 /*
- * Skip over zero or more characters of whitespace and comments.
- * 
- * After this operation, the source and filter will be positioned at the
- * first character that is not whitespace and not part of a comment, or
- * at the first special or error condition that was encountered.
- * 
- * Parameters:
- * 
- *   pIn - the input source
- * 
- *   pFilter - the filter to pass the input through
+ * snparser_skip function.
  */
-static void sntk_skip(SNSOURCE *pIn, SNFILTER *pFilter) {
+int snparser_skip(SNPARSER *pParser, SNSOURCE *pIn) {
+
+  SNENTITY spare;
+  SNENTITY *pe = NULL;
+  SNREADER *pr = NULL;
+  long mask = 0;
+  long depth = 0;
+  int kind = 0;
+  int result = 0;
+  int done = 0;
   
-  long c = 0;
+  /* Initialize structures */
+  memset(&spare, 0, sizeof(SNENTITY));
   
   /* Check parameters */
-  if ((pIn == NULL) || (pFilter == NULL)) {
+  if ((pParser == NULL) || (pIn == NULL)) {
+    abort();
+  }
+  if (pIn->cache || pParser->pipe.running) {
     abort();
   }
+  pr = &(pParser->reader);
   
-  /* Skip over whitespace and comments */
-  while (c >= 0) {
-    
-    /* Skip over zero or more characters of whitespace */
-    for(c = snfilter_read(pFilter, pIn);
-        (c == ASCII_SP) || (c == ASCII_HT) || (c == ASCII_LF);
-        c = snfilter_read(pFilter, pIn));
+  /* Continue a skip that was waiting for more input, or else return
+   * the error state, or else find the structure to skip, which is done
+   * already if nothing is open */
+  if (pParser->skip_kind != 0) {
+    kind = pParser->skip_kind;
+    depth = pParser->skip_depth;
+  
+  } else if (pr->status) {
+    result = pr->status;
+    done = 1;
+  
+  } else {
+    kind = snreader_skipstart(pr, &depth);
+    if (kind == 0) {
+      done = 1;
+    }
+  }
+  pParser->skip_kind = 0;
+  
+  /* Read entities with a mask that only lets the structural entities
+   * through, so that all string data is scanned without buffering it,
+   * and count the groups until the entity that closes the structure is
+   * read at the level of the structure */
+  mask = pr->mask;
+  pr->mask = SNMASK(SNENTITY_EOF) |
+              SNMASK(SNENTITY_BEGIN_META) |
+              SNMASK(SNENTITY_END_META) |
+              SNMASK(SNENTITY_BEGIN_GROUP) |
+              SNMASK(SNENTITY_END_GROUP) |
+              SNMASK(SNENTITY_ARRAY);
+  
+  while (!done) {
+    pe = snreader_next(pr, &spare, pIn, &(pParser->filter));
     
-    /* If we encountered anything except the pound sign, set pushback
-     * mode (unless a special condition) and leave the loop */
-    if (c != ASCII_POUNDSIGN) {
-      if (c >= 0) {
-        if (!snfilter_pushback(pFilter)) {
-          abort();  /* shouldn't happen */
-        }
+    if (pe->status < 0) {
+      /* Error, which is kept along with the skip if more input is
+       * needed */
+      result = pe->status;
+      if (result == SNERR_MORE) {
+        pParser->skip_kind = kind;
+        pParser->skip_depth = depth;
       }
-      break;
-    }
+      done = 1;
     
-    /* We encountered the start of a comment -- read until we encounter
-     * LF or some special condition */
-    for(c = snfilter_read(pFilter, pIn);
-        (c >= 0) && (c != ASCII_LF);
-        c = snfilter_read(pFilter, pIn));
+    } else if ((pe->status == kind) && (depth < 1)) {
+      /* Structure is closed */
+      result = kind;
+      done = 1;
+    
+    } else if (pe->status == SNENTITY_BEGIN_GROUP) {
+      depth++;
+    
+    } else if (pe->status == SNENTITY_END_GROUP) {
+      depth--;
+    
+    } else if (pe->status == SNENTITY_EOF) {
+      /* Shouldn't happen, since the document can't end while the
+       * structure is open */
+      abort();
+    }
   }
+  
+  pr->mask = mask;
+  
+  /* Return result */
+  return result;
 }
 
 /*
- * Read a token.
- * 
- * pBuffer is the buffer into which the token will be read.  It must be
- * properly initialized.  This function will reset the buffer and then
- * write the token into it.
- * 
- * pIn is the source to read data from.
- * 
- * pFilter is the input filter to read the data through.  It should be
- * in the proper state.
- * 
- * This function will skip over comments and whitespace before reading
- * the token.
- * 
- * For string tokens, this function only reads the opening token and not
- * the data that follows it.  Input will be positioned such that the
- * next byte read will the first byte of string data.
- * 
- * Note that it is not possible to use this function to iterate through
- * all the tokens in a Shastina source file, because this function
- * doesn't handle string data.
- * 
- * Parameters:
- * 
- *   pBuffer - the buffer to read the token into
- * 
- *   pIn - the input source to read the token from
- * 
- *   pFilter - the input filter
- * 
- * Return:
- * 
- *   zero if successful, or one of the SNERR constants if error
+ * snparser_count function.
  */
-static int sntk_readToken(
-    SNBUFFER * pBuffer,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter) {
+long snparser_count(SNPARSER *pParser) {
   
-  int err_num = 0;
-  long c = 0;
-  long c2 = 0;
-  int term = 0;
-  int leave = 0;
-  int omit = 0;
+  long result = 0;
   
-  /* Check parameters */
-  if ((pBuffer == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+  /* Check parameter */
+  if (pParser == NULL) {
     abort();
   }
   
-  /* Reset the buffer */
-  snbuffer_reset(pBuffer, 0);
+  /* Return line count, which is the line count after the entity most
+   * recently taken from the pipeline while it is running */
+  if (pParser->pipe.running) {
+    result = pParser->pipe.lines;
+  } else {
+    result = snfilter_count(&(pParser->filter));
+  }
+  return result;
+}
+
+/*
+ * snparser_stats function.
+ */
+int snparser_stats(SNPARSER *pParser, SNSTATS *pStats, int clear) {
   
-  /* Skip over whitespace and comments */
-  sntk_skip(pIn, pFilter);
+  int result = 0;
+#ifdef SHASTINA_STATS
+  SNREADER *pr = NULL;
+#endif
   
-  /* Read a character */
-  c = snfilter_read(pFilter, pIn);
-  if (c < 0) {
-    err_num = (int) c;
+  /* Check parameters */
+  if ((pParser == NULL) || (pStats == NULL)) {
+    abort();
+  }
+  if (pParser->pipe.running) {
+    abort();
   }
   
-  /* Check that the character is legal */
-  if (!err_num) {
-    if (!snchar_islegal(c)) {
-      err_num = SNERR_BADCHAR;
-    }
+  /* Start with all zeros */
+  memset(pStats, 0, sizeof(SNSTATS));
+
+#ifdef SHASTINA_STATS
+  /* Copy the counts of the reader and gather the counts that the
+   * buffers and stacks keep themselves */
+  pr = &(pParser->reader);
+  memcpy(pStats, &(pr->stats), sizeof(SNSTATS));
+  
+  pStats->buf_grows = pr->buf_key.grows;
+  snstats_add(&(pStats->buf_grows), pr->buf_value.grows);
+  pStats->key_peak = pr->buf_key.peak;
+  pStats->value_peak = pr->buf_value.peak;
+  pStats->array_peak = pr->stack_array.peak;
+  pStats->group_peak = pr->stack_group.peak;
+  
+  /* Clear the statistics if requested, with the peaks starting over
+   * from where things are now */
+  if (clear) {
+    memset(&(pr->stats), 0, sizeof(SNSTATS));
+    pr->buf_key.grows = 0;
+    pr->buf_value.grows = 0;
+    pr->buf_key.peak = pr->buf_key.cap;
+    pr->buf_value.peak = pr->buf_value.cap;
+    pr->stack_array.peak = pr->stack_array.count;
+    pr->stack_group.peak = pr->stack_group.count;
   }
   
-  /* Add the first character to the buffer */
-  if (!err_num) {
-    if (!snbuffer_append(pBuffer, c)) {
-      err_num = SNERR_LONGTOKEN;
-    }
+  result = 1;
+#else
+  /* Statistics are not collected, so the parameter is unused */
+  (void) clear;
+#endif
+  
+  /* Return whether statistics are collected */
+  return result;
+}
+
+/*
+ * snparser_symbols function.
+ */
+int snparser_symbols(
+    SNPARSER          * pParser,
+    const char * const * ppNames,
+    long                 count) {
+  
+  int status = 1;
+  long i = 0;
+  long index = 0;
+  
+  /* Check parameters */
+  if ((pParser == NULL) || (count < 0) ||
+      ((count > 0) && (ppNames == NULL))) {
+    abort();
   }
   
-  /* If the first character is a vertical bar, check if the second
-   * character is a semicolon, forming the |; pair; set the term flag
-   * in this case and add the semicolon to the token; else, unread the
-   * second character */
-  if ((!err_num) && (c == ASCII_BAR)) {
-    c2 = snfilter_read(pFilter, pIn);
-    if (c2 < 0) {
-      err_num = (int) c2;
+  /* Drop any previous symbol table */
+  snintern_release(&(pParser->symbols));
+  pParser->sym_enabled = 0;
+  
+  /* Intern the known names in order, so that each one gets the index
+   * of its position in the array, which fails to happen only if the
+   * name was already given */
+  for(i = 0; status && (i < count); i++) {
+    if (ppNames[i] == NULL) {
+      abort();
     }
-    
-    if ((!err_num) && (c2 == ASCII_SEMICOLON)) {
-      term = 1;
-      if (!snbuffer_append(pBuffer, c2)) {
-        err_num = SNERR_LONGTOKEN;
-      }
-    } else {
-      if (!snfilter_pushback(pFilter)) {
-        abort();  /* shouldn't happen */
-      }
+    status = snintern_add(&(pParser->symbols), ppNames[i],
+                (long) strlen(ppNames[i]), &index);
+    if (status && (index != i)) {
+      abort();
     }
   }
   
-  /* If the first character read is not atomic and the term flag is not
-   * set, read additional characters into the token up to the exclusive
-   * or inclusive character that ends the token */
-  if ((!err_num) && (!term)) {
-    if (!snchar_isatomic(c)) {
-      
-      /* Read the additional characters */
-      while (!err_num) {
-        
-        /* Read another character */
-        c = snfilter_read(pFilter, pIn);
-        if (c < 0) {
-          err_num = (int) c;
-        }
-        
-        /* Make sure the character is legal */
-        if (!err_num) {
-          if (!snchar_islegal(c)) {
-            err_num = SNERR_BADCHAR;
-          }
-        }
-        
-        /* If the character is inclusive, set the leave flag */
-        if (!err_num) {
-          if (snchar_isinclusive(c)) {
-            leave = 1;
-          }
-        }
-        
-        /* If the character is exclusive, set the leave and omit
-         * flags, and push back the character */
-        if (!err_num) {
-          if (snchar_isexclusive(c)) {
-            leave = 1;
-            omit = 1;
-            if (!snfilter_pushback(pFilter)) {
-              abort();  /* shouldn't happen */
-            }
-          }
-        }
-        
-        /* If the omit flag is not set, add the character to the
-         * token */
-        if ((!err_num) && (!omit)) {
-          if (!snbuffer_append(pBuffer, c)) {
-            err_num = SNERR_LONGTOKEN;
-          }
-        }
-        
-        /* If the leave flag is set, leave the loop */
-        if ((!err_num) && leave) {
-          break;
-        }
-      }
-    }
+  /* Enable the table if successful, or drop it if not */
+  if (status) {
+    pParser->sym_enabled = 1;
+  } else {
+    snintern_release(&(pParser->symbols));
   }
   
-  /* Return okay or error number */
-  return err_num;
+  /* Return status */
+  return status;
 }
 
 /*
- * Read a complete token from the given file.
- * 
- * pToken is the structure to receive the read token.  Only the pKey and
- * pValue fields need to be filled in upon entry.  Upon return, all 
- * fields will be filled in.  See the structure documentation for
- * further information.
- * 
- * pIn is the source to read data from.
- * 
- * pFilter is the input filter to read the data through.  It should be
- * in the proper state.
- * 
- * This function differs from sntk_readToken() in that this function can
- * also read string data.
- * 
- * Parameters:
- * 
- *   pToken - the token structure
- * 
- *   pIn - the input source
- * 
- *   pFil - the filter to pass input through
+ * snparser_writecache function.
  */
-static void sntoken_read(
-    SNTOKEN  * pToken,
+int snparser_writecache(
+    SNPARSER * pParser,
     SNSOURCE * pIn,
-    SNFILTER * pFil) {
+    FILE     * pOut) {
   
-  int err_num = 0;
-  long c = 0;
+  int status = 1;
+  int done = 0;
+  const char *pData = NULL;
+  long len = 0;
+  long mask = 0;
+  SNCACHEWRITER w;
+  SNENTITY ent;
+  
+  /* Initialize structures */
+  memset(&w, 0, sizeof(SNCACHEWRITER));
+  memset(&ent, 0, sizeof(SNENTITY));
   
   /* Check parameters */
-  if ((pToken == NULL) || (pIn == NULL) || (pFil == NULL)) {
+  if ((pParser == NULL) || (pIn == NULL) || (pOut == NULL)) {
     abort();
   }
-  if ((pToken->pKey == NULL) || (pToken->pValue == NULL) ||
-      (pToken->pKey == pToken->pValue)) {
+  if ((!(pIn->whole)) || pIn->cache || pParser->pipe.running) {
     abort();
   }
   
-  /* Reset both buffers and the token fields */
-  snbuffer_reset(pToken->pKey, 0);
-  snbuffer_reset(pToken->pValue, 0);
-  pToken->status = 0;
-  pToken->str_type = 0;
-  
-  /* Read a token into the key buffer */
-  err_num = sntk_readToken(pToken->pKey, pIn, pFil);
-  
-  /* Identify the token by its last character, also setting the str_type
-   * flag for string tokens */
-  if (!err_num) {
-    /* Get last character */
-    c = snbuffer_last(pToken->pKey);
-    
-    /* Identify token */
-    if (c == ASCII_DQUOTE) {
-      pToken->status = SNTOKEN_STRING;
-      pToken->str_type = SNSTRING_QUOTED;
-    
-    } else if (c == ASCII_LCURL) {
-      pToken->status = SNTOKEN_STRING;
-      pToken->str_type = SNSTRING_CURLY;
-    
+  /* Get the source data for the content hash */
+  pData = snsource_buffer(pIn, &len);
+  
+  /* Parse the whole source with every entity let through, adding each
+   * entity to the cache along with the line count after it, but fail
+   * on out of memory errors since those don't belong to the source */
+  mask = pParser->reader.mask;
+  pParser->reader.mask = SNMASK_ALL;
+  snintern_init(&(w.strings), &(pParser->alloc));
+  w.pAlloc = &(pParser->alloc);
+  w.line = 1;
+  w.offset = 0;
+  while (status && (!done)) {
+    snreader_read(&(pParser->reader), &ent, pIn, &(pParser->filter));
+    if (ent.status == SNERR_NOMEM) {
+      status = 0;
     } else {
-      pToken->status = SNTOKEN_SIMPLE;
+      status = sncache_entity(&w, &ent,
+                  snfilter_count(&(pParser->filter)));
+      if (ent.status <= 0) {
+        done = 1;
+      }
     }
   }
   
-  /* For simple tokens, distinguish between SIMPLE and FINAL */
-  if ((!err_num) && (pToken->status == SNTOKEN_SIMPLE)) {
-    if (snchar_strequals2(ASCII_BAR, ASCII_SEMICOLON,
-          snbuffer_get(pToken->pKey))) {
-      pToken->status = SNTOKEN_FINAL;
-    }
-  }
+  pParser->reader.mask = mask;
   
-  /* For string tokens, remove the last character, so the key buffer
-   * only has the prefix */
-  if ((!err_num) && (pToken->status == SNTOKEN_STRING)) {
-    if (!snbuffer_less(pToken->pKey)) {
-      abort();  /* shouldn't happen */
-    }
+  /* Write the cache */
+  if (status) {
+    status = sncache_flush(&w, (const unsigned char *) pData, len,
+                            pOut);
   }
   
-  /* For string tokens, read the string data into the value buffer */
-  if ((!err_num) && (pToken->status == SNTOKEN_STRING)) {
-    if (pToken->str_type == SNSTRING_QUOTED) {
-      /* Quoted string */
-      err_num = snstr_readQuoted(pToken->pValue, pIn, pFil);
-      
-    } else if (pToken->str_type == SNSTRING_CURLY) {
-      /* Curly string */
-      err_num = snstr_readCurlied(pToken->pValue, pIn, pFil);
-      
+  /* Release the writer and return status */
+  sncache_release(&w);
+  return status;
+}
+
+/*
+ * snindex_alloc function.
+ */
+SNINDEX *snindex_alloc(long spacing) {
+  return snindex_allocwith(spacing, NULL);
+}
+
+/*
+ * snindex_allocwith function.
+ */
+SNINDEX *snindex_allocwith(long spacing, const SNALLOC *pAlloc) {
+
+  SNINDEX *pIndex = NULL;
+  SNALLOC alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Get the allocator and allocate structure */
+  snalloc_init(&alloc, pAlloc);
+  pIndex = (SNINDEX *) snalloc_get(&alloc, (long) sizeof(SNINDEX));
+  
+  /* Initialize, with the checkpoint list allocated when the first
+   * checkpoint is recorded */
+  if (pIndex != NULL) {
+    memset(pIndex, 0, sizeof(SNINDEX));
+    memcpy(&(pIndex->alloc), &alloc, sizeof(SNALLOC));
+    pIndex->pList = NULL;
+    pIndex->count = 0;
+    pIndex->cap = 0;
+    if (spacing > 0) {
+      pIndex->spacing = spacing;
     } else {
-      /* Unknown string type */
-      abort();
+      pIndex->spacing = SNINDEX_SPACING_DEFAULT;
     }
+    pIndex->full = 0;
   }
   
-  /* If an error was encountered, clear the buffers and the fields, and
-   * set the status to the error */
-  if (err_num) {
-    snbuffer_reset(pToken->pKey, 0);
-    snbuffer_reset(pToken->pValue, 0);
-    pToken->str_type = 0;
-    pToken->status = err_num;
-  }
+  /* Return index or NULL */
+  return pIndex;
 }
 
 /*
- * Initialize a Shastina reader state structure.
- * 
- * All Shastina readers must be initialized before they are used, or
- * undefined behavior occurs.
- * 
- * Do not re-initialize a Shastina reader that is already initialized,
- * or a memory leak may occur.
- * 
- * Shastina readers must be fully reset with snreader_reset() before
- * they are released, or a memory leak may occur.
- * 
- * Parameters:
- * 
- *   pReader - the reader structure to initialize
+ * snindex_free function.
  */
-static void snreader_init(SNREADER *pReader) {
+void snindex_free(SNINDEX *pIndex) {
+
+  SNALLOC alloc;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
   
+  /* Only do something if not NULL */
+  if (pIndex != NULL) {
+    /* Release the checkpoint list, and then release the structure
+     * through a copy of the allocator since it is stored in the
+     * structure */
+    if (pIndex->pList != NULL) {
+      snalloc_release(&(pIndex->alloc), pIndex->pList,
+                      pIndex->cap * ((long) sizeof(SNCHECKPOINT)));
+      pIndex->pList = NULL;
+    }
+    memcpy(&alloc, &(pIndex->alloc), sizeof(SNALLOC));
+    snalloc_release(&alloc, pIndex, (long) sizeof(SNINDEX));
+  }
+}
+
+/*
+ * snindex_count function.
+ */
+long snindex_count(SNINDEX *pIndex) {
+
   /* Check parameter */
-  if (pReader == NULL) {
+  if (pIndex == NULL) {
     abort();
   }
   
-  /* Initialize */
-  memset(pReader, 0, sizeof(SNREADER));
-  
-  pReader->status = 0;
-  pReader->queue_count = 0;
-  pReader->queue_read = 0;
-  
-  snbuffer_init(&(pReader->buf_key),
-    SNREADER_KEY_INIT, SNREADER_KEY_MAX);
-  snbuffer_init(&(pReader->buf_value),
-    SNREADER_VAL_INIT, SNREADER_VAL_MAX);
-  
-  snstack_init(&(pReader->stack_array),
-    SNREADER_AGSTACK_INIT, SNREADER_AGSTACK_MAX);
-  snstack_init(&(pReader->stack_group),
-    SNREADER_AGSTACK_INIT, SNREADER_AGSTACK_MAX);
-  
-  pReader->meta_flag = 0;
-  pReader->array_flag = 0;
+  /* Return count */
+  return pIndex->count;
 }
 
 /*
- * Reset a Shastina reader back to its initial state.
- * 
- * If full is non-zero, a full reset will be performed.  If full is
- * zero, a fast reset is performed.  A full reset releases all memory
- * buffers, while a fast reset keeps the memory buffers allocated.
- * 
- * A full reset must be performed on a reader before it is released, or
- * a memory leak occurs.
- * 
- * Parameters:
- * 
- *   pReader - the reader structure to reset
- * 
- *   full - non-zero for full reset, zero for fast reset
+ * snparser_index function.
  */
-static void snreader_reset(SNREADER *pReader, int full) {
-  
-  /* Check parameters */
-  if (pReader == NULL) {
+void snparser_index(SNPARSER *pParser, SNINDEX *pIndex) {
+
+  /* Check parameter */
+  if (pParser == NULL) {
+    abort();
+  }
+  if (pParser->pipe.running) {
     abort();
   }
   
-  /* Reset buffers and stacks */
-  snbuffer_reset(&(pReader->buf_key), full);
-  snbuffer_reset(&(pReader->buf_value), full);
-  
-  snstack_reset(&(pReader->stack_array), full);
-  snstack_reset(&(pReader->stack_group), full);
-  
-  /* Reset fields */
-  pReader->status = 0;
-  pReader->queue_count = 0;
-  pReader->queue_read = 0;
-  
-  pReader->meta_flag = 0;
-  pReader->array_flag = 0;
+  /* Attach the index to the reader, which records the checkpoints */
+  pParser->reader.pIndex = pIndex;
 }
 
 /*
- * Read an entity from a Shastina source file.
- * 
- * pReader is the reader object, which must be properly initialized.
- * 
- * pEntity is the entity structure that will be filled in.  Its state
- * upon entry to the function is irrelevant.  Upon return, it will hold
- * the results of the operation.  See the structure documentation for
- * further information.
- * 
- * pIn is the input source to read from.
- * 
- * pFilter is the input filter to pass the input through.  It must be
- * properly initialized.
- * 
- * Once an error is encountered, the reader object will return that same
- * error each time this function is called without doing anything
- * further.
- * 
- * Once the End Of File (EOF) entity is returned, this function will
- * return the EOF entity on all subsequent calls without doing anything
- * further.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
- * 
- *   pEntity - pointer to the entity to receive the results
- * 
- *   pIn - the input source
- * 
- *   pFilter - the input filter
+ * snparser_seek function.
  */
-static void snreader_read(
-    SNREADER * pReader,
-    SNENTITY * pEntity,
+long snparser_seek(
+    SNPARSER * pParser,
     SNSOURCE * pIn,
-    SNFILTER * pFilter) {
+    SNINDEX  * pIndex,
+    long       offset) {
   
-  int err_code = 0;
+  long result = -1;
+  long i = 0;
+  const SNCHECKPOINT *pc = NULL;
   
   /* Check parameters */
-  if ((pReader == NULL) || (pEntity == NULL) || (pIn == NULL) ||
-      (pFilter == NULL)) {
+  if ((pParser == NULL) || (pIn == NULL) || (pIndex == NULL)) {
+    abort();
+  }
+  if (((pIn->pfRewind == NULL) && (!(pIn->whole))) || pIn->cache) {
     abort();
   }
   
-  /* Clear provided entity */
-  memset(pEntity, 0, sizeof(SNENTITY));
-  
-  /* Fail immediately if reader is in error state */
-  err_code = pReader->status;
-  
-  /* If queue is empty, fill it until something is in it */
-  while ((!err_code) && (pReader->queue_count < 1)) {
-    snreader_fill(pReader, pIn, pFilter);
-    err_code = pReader->status;
+  /* Find the checkpoint, if there is one */
+  i = snindex_find(pIndex, offset);
+  if (i >= 0) {
+    pc = &((pIndex->pList)[i]);
   }
   
-  /* Return either an entity or an error code */
-  if (!err_code) {
-    /* Copy current entity to provided entity */
-    memcpy(pEntity, &(pReader->queue[pReader->queue_read]),
-            sizeof(SNENTITY));
-    
-    /* If current entity is not EOF, then remove it from queue */
-    if ((pReader->queue[pReader->queue_read]).status !=
-          SNENTITY_EOF) {
-      
-      (pReader->queue_read)++;
-      if (pReader->queue_read >= pReader->queue_count) {
-        /* We've read everything in the queue, so clear it */
-        pReader->queue_count = 0;
-        pReader->queue_read = 0;
+  /* Reset the parser in the same way as snparser_reset(), except for
+   * the filter, which is restored below */
+  snpipe_stop(&(pParser->pipe));
+  pParser->pipe.finished = 0;
+  snreader_reset(&(pParser->reader), 0);
+  pParser->arena_len = 0;
+  pParser->skip_kind = 0;
+  
+  /* Move the source to the checkpoint and restore the state recorded
+   * there, or start over at the beginning if there is no checkpoint;
+   * the group stack holds a single value at checkpoints, which is
+   * pushed here so that the reader doesn't start it at zero */
+  if (pc != NULL) {
+    if (snsource_seek(pIn, pc->pos)) {
+      memcpy(&(pParser->filter), &(pc->filter), sizeof(SNFILTER));
+      pParser->reader.meta_flag = pc->meta_flag;
+      if (snstack_push(&(pParser->reader.stack_group), pc->groups)) {
+        result = pc->key;
       }
     }
-    
+  
   } else {
-    /* Error status -- write into the entity */
-    pEntity->status = err_code;
+    snfilter_reset(&(pParser->filter));
+    if (snsource_seek(pIn, 0)) {
+      result = 0;
+    }
   }
+  
+  /* Return the key of the checkpoint or -1 */
+  return result;
 }
 
 /*
- * Add an entity with no parameters (type "Z") to the queue of a given
- * reader.
- * 
- * pReader is the reader to add the entity to.
- * 
- * entity is the SNENTITY_ constant describing the kind of entity.
- * 
- * The only entities allowed by this function are:
- * 
- *   - SNENTITY_EOF
- *   - SNENTITY_BEGIN_META
- *   - SNENTITY_END_META
- *   - SNENTITY_BEGIN_GROUP
- *   - SNENTITY_END_GROUP
- * 
- * Passing any other kind of entity code results in a fault.
- * 
- * The queue of the reader must not be full or this function will fault.
- * See SNREADER_MAXQUEUE for more information.
- * 
- * If the reader is in an error state, this call is ignored.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
- * 
- *   entity - the entity code
+ * snpool_alloc function.
  */
-static void snreader_addEntityZ(SNREADER *pReader, int entity) {
+SNPOOL *snpool_alloc(
+    int              threads,
+    const SNLIMITS * pLimits,
+    const SNALLOC  * pAlloc) {
+  
+  SNPOOL *pPool = NULL;
+  SNPOOLWORKER *pw = NULL;
+  SNALLOC alloc;
+  int status = 1;
+  int i = 0;
   
-  SNENTITY *pe = NULL;
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Apply the thread limits, with a single worker unless threads are
+   * available */
+  if (threads < 1) {
+    threads = 1;
+  } else if (threads > SNPOOL_THREADS_MAX) {
+    threads = SNPOOL_THREADS_MAX;
+  }
+#ifndef SHASTINA_THREADS
+  threads = 1;
+#endif
+  
+  /* Get the allocator and allocate structure */
+  snalloc_init(&alloc, pAlloc);
+  pPool = (SNPOOL *) snalloc_get(&alloc, (long) sizeof(SNPOOL));
+  if (pPool == NULL) {
+    status = 0;
+  }
   
-  /* Check parameters */
-  if (pReader == NULL) {
-    abort();
+  /* Initialize the structure, so that it can be freed at any point */
+  if (status) {
+    memset(pPool, 0, sizeof(SNPOOL));
+    memcpy(&(pPool->alloc), &alloc, sizeof(SNALLOC));
+    pPool->threads = 0;
+    pPool->pWorkers = NULL;
+    pPool->pScan = NULL;
+    pPool->ppSrc = NULL;
+    pPool->pStream = NULL;
+#ifdef SHASTINA_THREADS
+    pPool->sync = 0;
+#endif
   }
-  if ((entity != SNENTITY_EOF) &&
-      (entity != SNENTITY_BEGIN_META) &&
-      (entity != SNENTITY_END_META) &&
-      (entity != SNENTITY_BEGIN_GROUP) &&
-      (entity != SNENTITY_END_GROUP)) {
-    abort();
+  
+  /* Initialize the lock and the condition */
+#ifdef SHASTINA_THREADS
+  if (status) {
+    if (pthread_mutex_init(&(pPool->lock), NULL) == 0) {
+      if (pthread_cond_init(&(pPool->cond), NULL) == 0) {
+        pPool->sync = 1;
+      } else {
+        pthread_mutex_destroy(&(pPool->lock));
+        status = 0;
+      }
+    } else {
+      status = 0;
+    }
   }
+#endif
   
-  /* Proceed only if reader not in error state */
-  if (!(pReader->status)) {
-    /* Make sure room for another entity */
-    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
-      abort();
+  /* Allocate the workers and the scan parser */
+  if (status) {
+    pPool->pWorkers = (SNPOOLWORKER *) snalloc_get(&(pPool->alloc),
+                ((long) threads) * ((long) sizeof(SNPOOLWORKER)));
+    if (pPool->pWorkers != NULL) {
+      memset(pPool->pWorkers, 0,
+              ((size_t) threads) * sizeof(SNPOOLWORKER));
+      pPool->threads = threads;
+    } else {
+      status = 0;
     }
-    
-    /* Get entity pointer */
-    pe = &(pReader->queue[pReader->queue_count]);
-    
-    /* Fill in entity */
-    pe->status = entity;
-    
-    /* Increase the entity count */
-    (pReader->queue_count)++;
   }
-}
-
-/*
- * Add an entity with one string parameter (type "S") to the queue of a
- * given reader.
- * 
- * pReader is the reader to add the entity to.
- * 
- * entity is the SNENTITY_ constant describing the kind of entity.
- * 
- * s is the string parameter.
- * 
- * The only entities allowed by this function are:
- * 
- *   - SNENTITY_META_TOKEN
- *   - SNENTITY_NUMERIC
- *   - SNENTITY_VARIABLE
- *   - SNENTITY_CONSTANT
- *   - SNENTITY_ASSIGN
- *   - SNENTITY_GET
- *   - SNENTITY_OPERATION
- * 
- * Passing any other kind of entity code results in a fault.
- * 
- * The queue of the reader must not be full or this function will fault.
- * See SNREADER_MAXQUEUE for more information.
- * 
- * If the reader is in an error state, this call is ignored.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
- * 
- *   entity - the entity code
- * 
- *   s - the string parameter
- */
-static void snreader_addEntityS(
-    SNREADER * pReader,
-    int        entity,
-    char     * s) {
   
-  SNENTITY *pe = NULL;
+  for(i = 0; status && (i < threads); i++) {
+    pw = &((pPool->pWorkers)[i]);
+    pw->pPool = pPool;
+    pw->index = i;
+    pw->started = 0;
+    
+    pw->pParser = snparser_allocwith(pLimits, &(pPool->alloc));
+    pw->pEnt = (SNENTITY *) snalloc_get(&(pPool->alloc),
+                SNPOOL_ENTITY_INIT * ((long) sizeof(SNENTITY)));
+    if (pw->pEnt != NULL) {
+      pw->ent_cap = SNPOOL_ENTITY_INIT;
+    }
+    pw->pLines = (long *) snalloc_get(&(pPool->alloc),
+                SNPOOL_ENTITY_INIT * ((long) sizeof(long)));
+    if (pw->pLines != NULL) {
+      pw->line_cap = SNPOOL_ENTITY_INIT;
+    }
+    
+    if ((pw->pParser == NULL) || (pw->pEnt == NULL) ||
+        (pw->pLines == NULL)) {
+      status = 0;
+    }
+  }
   
-  /* Check parameters */
-  if ((pReader == NULL) || (s == NULL)) {
-    abort();
+  if (status) {
+    pPool->pScan = snparser_allocwith(pLimits, &(pPool->alloc));
+    if (pPool->pScan == NULL) {
+      status = 0;
+    }
   }
-  if ((entity != SNENTITY_META_TOKEN) &&
-      (entity != SNENTITY_NUMERIC) &&
-      (entity != SNENTITY_VARIABLE) &&
-      (entity != SNENTITY_CONSTANT) &&
-      (entity != SNENTITY_ASSIGN) &&
-      (entity != SNENTITY_GET) &&
-      (entity != SNENTITY_OPERATION)) {
-    abort();
+  
+  /* Free everything if anything failed */
+  if ((!status) && (pPool != NULL)) {
+    snpool_free(pPool);
+    pPool = NULL;
   }
-      
-  /* Proceed only if reader not in error state */
-  if (!(pReader->status)) {
-    /* Make sure room for another entity */
-    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
-      abort();
+  
+  /* Return pool or NULL */
+  return pPool;
+}
+
+/*
+ * snpool_free function.
+ */
+void snpool_free(SNPOOL *pPool) {
+  
+  SNPOOLWORKER *pw = NULL;
+  SNALLOC alloc;
+  int i = 0;
+  
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Only do something if not NULL */
+  if (pPool != NULL) {
+    
+    /* Release the workers */
+    if (pPool->pWorkers != NULL) {
+      for(i = 0; i < pPool->threads; i++) {
+        pw = &((pPool->pWorkers)[i]);
+        snparser_free(pw->pParser);
+        if (pw->pEnt != NULL) {
+          snalloc_release(&(pPool->alloc), pw->pEnt,
+                          pw->ent_cap * ((long) sizeof(SNENTITY)));
+        }
+        if (pw->pLines != NULL) {
+          snalloc_release(&(pPool->alloc), pw->pLines,
+                          pw->line_cap * ((long) sizeof(long)));
+        }
+      }
+      snalloc_release(&(pPool->alloc), pPool->pWorkers,
+        ((long) pPool->threads) * ((long) sizeof(SNPOOLWORKER)));
+      pPool->pWorkers = NULL;
     }
     
-    /* Get entity pointer */
-    pe = &(pReader->queue[pReader->queue_count]);
+    /* Release the scan parser */
+    snparser_free(pPool->pScan);
+    pPool->pScan = NULL;
     
-    /* Fill in entity */
-    pe->status = entity;
-    pe->pKey = s;
+    /* Release the lock and the condition */
+#ifdef SHASTINA_THREADS
+    if (pPool->sync) {
+      pthread_cond_destroy(&(pPool->cond));
+      pthread_mutex_destroy(&(pPool->lock));
+      pPool->sync = 0;
+    }
+#endif
     
-    /* Increase the entity count */
-    (pReader->queue_count)++;
+    /* Release through a copy of the allocator since it is stored in the
+     * structure */
+    memcpy(&alloc, &(pPool->alloc), sizeof(SNALLOC));
+    snalloc_release(&alloc, pPool, (long) sizeof(SNPOOL));
   }
 }
 
 /*
- * Add an entity with one long parameter (type "L") to the queue of a
- * given reader.
- * 
- * pReader is the reader to add the entity to.
- * 
- * entity is the SNENTITY_ constant describing the kind of entity.
- * 
- * l is the long parameter.
- * 
- * The only entities allowed by this function are:
- * 
- *   - SNENTITY_ARRAY
- * 
- * Passing any other kind of entity code results in a fault.
- * 
- * The queue of the reader must not be full or this function will fault.
- * See SNREADER_MAXQUEUE for more information.
- * 
- * If the reader is in an error state, this call is ignored.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
- * 
- *   entity - the entity code
- * 
- *   l - the long value
+ * snpool_sources function.
  */
-static void snreader_addEntityL(
-    SNREADER * pReader,
-    int        entity,
-    long       l) {
+long snpool_sources(
+    SNPOOL    * pPool,
+    SNSOURCE ** ppSrc,
+    long        count,
+    int         flags,
+    int      (* doc_func)(void *custom, const SNDOC *pDoc),
+    void      * custom) {
   
-  SNENTITY *pe = NULL;
+  long result = 0;
   
   /* Check parameters */
-  if (pReader == NULL) {
+  if ((pPool == NULL) || (count < 0) || (doc_func == NULL)) {
     abort();
   }
-  if (entity != SNENTITY_ARRAY) {
+  if ((count > 0) && (ppSrc == NULL)) {
     abort();
   }
   
-  /* Proceed only if reader not in error state */
-  if (!(pReader->status)) {
-    /* Make sure room for another entity */
-    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
-      abort();
-    }
-    
-    /* Get entity pointer */
-    pe = &(pReader->queue[pReader->queue_count]);
+  /* Run on the sources, if there are any */
+  if (count > 0) {
+    pPool->ppSrc = ppSrc;
+    pPool->src_count = count;
+    pPool->pStream = NULL;
+    pPool->flags = flags;
+    pPool->doc_func = doc_func;
+    pPool->custom = custom;
     
-    /* Fill in entity */
-    pe->status = entity;
-    pe->count = l;
+    result = snpool_run(pPool);
     
-    /* Increase the entity count */
-    (pReader->queue_count)++;
+    pPool->ppSrc = NULL;
+    pPool->src_count = 0;
   }
+  
+  /* Return the number of documents delivered */
+  return result;
 }
 
 /*
- * Add an entity with prefix, type, and data parameters (type "T") to
- * the queue of a given reader.
- * 
- * pReader is the reader to add the entity to.
- * 
- * entity is the SNENTITY_ constant describing the kind of entity.
- * 
- * pPrefix points to the prefix string.
- * 
- * str_type is the string type.  It must be one of the SNSTRING_
- * constants.
- * 
- * pData points to the string data.
- * 
- * The only entities allowed by this function are:
- * 
- *   - SNENTITY_STRING
- *   - SNENTITY_META_STRING
- * 
- * Passing any other kind of entity code results in a fault.
- * 
- * The queue of the reader must not be full or this function will fault.
- * See SNREADER_MAXQUEUE for more information.
- * 
- * If the reader is in an error state, this call is ignored.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
- * 
- *   entity - the entity code
+ * snpool_stream function.
  */
-static void snreader_addEntityT(
-    SNREADER * pReader,
-    int        entity,
-    char     * pPrefix,
-    int        str_type,
-    char     * pData) {
+long snpool_stream(
+    SNPOOL    * pPool,
+    SNSOURCE  * pSrc,
+    int         flags,
+    int      (* doc_func)(void *custom, const SNDOC *pDoc),
+    void      * custom) {
   
-  SNENTITY *pe = NULL;
+  long result = 0;
   
   /* Check parameters */
-  if ((pReader == NULL) || (pPrefix == NULL) || (pData == NULL)) {
+  if ((pPool == NULL) || (pSrc == NULL) || (doc_func == NULL)) {
     abort();
   }
-  if ((str_type != SNSTRING_QUOTED) && (str_type != SNSTRING_CURLY)) {
-    abort();
-  }
-  if ((entity != SNENTITY_STRING) &&
-      (entity != SNENTITY_META_STRING)) {
+  if ((!(pSrc->whole)) || pSrc->cache) {
     abort();
   }
   
-  /* Proceed only if reader not in error state */
-  if (!(pReader->status)) {
-    /* Make sure room for another entity */
-    if (pReader->queue_count >= SNREADER_MAXQUEUE) {
-      abort();
-    }
-    
-    /* Get entity pointer */
-    pe = &(pReader->queue[pReader->queue_count]);
-    
-    /* Fill in entity */
-    pe->status = entity;
-    pe->pKey = pPrefix;
-    pe->str_type = str_type;
-    pe->pValue = pData;
-    
-    /* Increase the entity count */
-    (pReader->queue_count)++;
-  }
+  /* Run on the stream, scanning it from where it is with fresh line
+   * counting */
+  snparser_reset(pPool->pScan, SNRESET_NORMAL);
+  pPool->ppSrc = NULL;
+  pPool->src_count = 0;
+  pPool->pStream = pSrc;
+  pPool->stream_end = 0;
+  pPool->flags = flags;
+  pPool->doc_func = doc_func;
+  pPool->custom = custom;
+  
+  result = snpool_run(pPool);
+  
+  pPool->pStream = NULL;
+  
+  /* Return the number of documents delivered */
+  return result;
 }
 
 /*
- * Perform the array prefix operation.
- * 
- * This should be performed before processing any token except for "]".
- * 
- * pReader is the reader object.  The reader must not be in an error
- * state, or a fault occurs.
- * 
- * This operation only does something if the array flag is on.  In that
- * case, the array flag is turned off, the array and grouping stacks are
- * adjusted to indicate a new array, and a BEGIN_GROUP entity is added
- * to the reader.
- * 
- * These are operations that should have properly been done when the "["
- * token was processed.  But that token needs to know whether the array
- * is empty (followed immediately by a "]" token) or non-empty.  Hence,
- * it sets the array flag and its processing is delayed until the next
- * token, which calls into this array prefix operation to do the delayed
- * array operation if the array flag is set.
- * 
- * This is therefore done before every token except for "]", which
- * handles the situation differently because the empty array case is
- * different.  Hence, this function must *not* be called before the "]"
- * token.
- * 
- * This function may set the reader into an error state.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
+ * snwriter_block function.
  */
-static void snreader_arrayPrefix(SNREADER *pReader) {
+SNWRITER *snwriter_block(
+    int (*sink_func)(void *, const unsigned char *, long),
+    void (*free_func)(void *),
+    void *custom) {
+  return snwriter_blockwith(sink_func, free_func, custom, NULL);
+}
+
+/*
+ * snwriter_blockwith function.
+ */
+SNWRITER *snwriter_blockwith(
+    int (*sink_func)(void *, const unsigned char *, long),
+    void (*free_func)(void *),
+    void *custom,
+    const SNALLOC *pAlloc) {
   
-  int err_code = 0;
+  SNWRITER *pWriter = NULL;
+  SNALLOC alloc;
   
-  /* Check parameter and state */
-  if (pReader == NULL) {
-    abort();
-  }
-  if (pReader->status) {
+  /* Initialize structures */
+  memset(&alloc, 0, sizeof(SNALLOC));
+  
+  /* Check parameters */
+  if (sink_func == NULL) {
     abort();
   }
   
-  /* Only do something if array flag is set */
-  if (pReader->array_flag) {
+  /* Get the allocator and allocate structure */
+  snalloc_init(&alloc, pAlloc);
+  pWriter = (SNWRITER *) snalloc_get(&alloc, (long) sizeof(SNWRITER));
+  
+  /* Initialize structure, with the stacks using the copy of the
+   * allocator in the structure */
+  if (pWriter != NULL) {
+    memset(pWriter, 0, sizeof(SNWRITER));
+    memcpy(&(pWriter->alloc), &alloc, sizeof(SNALLOC));
     
-    /* Clear the array flag */
-    pReader->array_flag = 0;
+    pWriter->pfSink = sink_func;
+    pWriter->pfDestruct = free_func;
+    pWriter->pCustom = custom;
     
-    /* Push a value of one on top of the array stack and a value of zero
-     * on top of the grouping stack to begin a new array */
-    if (!snstack_push(&(pReader->stack_array), 1)) {
-      err_code = SNERR_DEEPARRAY;
-    }
+    pWriter->pBuf = NULL;
+    pWriter->buf_len = 0;
+    pWriter->total = 0;
+    pWriter->status = 0;
+    pWriter->mode = SNWRITE_NORMAL;
     
-    if (!err_code) {
-      if (!snstack_push(&(pReader->stack_group), 0)) {
-        err_code = SNERR_DEEPARRAY;
-      }
-    }
+    snreader_limits(&(pWriter->lim), NULL);
+    snstack_init(&(pWriter->stack_array),
+                  pWriter->lim.nest_init, pWriter->lim.nest_max,
+                  &(pWriter->alloc));
+    snstack_init(&(pWriter->stack_group),
+                  pWriter->lim.nest_init, pWriter->lim.nest_max,
+                  &(pWriter->alloc));
     
-    /* Add a BEGIN_GROUP entity */
-    if (!err_code) {
-      snreader_addEntityZ(pReader, SNENTITY_BEGIN_GROUP);
+    pWriter->meta_flag = 0;
+    pWriter->array_flag = 0;
+    pWriter->eof = 0;
+    pWriter->col = 0;
+    pWriter->bar = 0;
+    
+    pWriter->str_type = 0;
+    pWriter->str_odd = 0;
+    pWriter->str_depth = 0;
+    pWriter->str_len = 0;
+  }
+  
+  /* Allocate the buffer */
+  if (pWriter != NULL) {
+    pWriter->pBuf = (unsigned char *) snalloc_get(
+                      &(pWriter->alloc), SNWRITER_BUFFER_SIZE);
+    if (pWriter->pBuf == NULL) {
+      snalloc_release(&alloc, pWriter, (long) sizeof(SNWRITER));
+      pWriter = NULL;
     }
   }
+  
+  /* Return the new writer or NULL */
+  return pWriter;
 }
 
-/* 
- * Read a token from a Shastina source file in an effort to fill the
- * entity queue.
- * 
- * Clients should not use this function directly.  Use snreader_read()
- * instead (which makes use of this function).
- * 
- * The reader must not be in an error state and the queue must be empty.
- * If these conditions are not satisfied, a fault occurs.  A fault may
- * also occur if SNREADER_MAXQUEUE is not large enough -- see that
- * constant for further information.
- * 
- * Not all tokens result in entities being read, so to ensure the entity
- * buffer is filled with at least one entity, call this function in a
- * loop.
- * 
- * Parameters:
- * 
- *   pReader - the reader object
- * 
- *   pIn - the input file
- * 
- *   pFilter - the filter to pass input through
+/*
+ * snwriter_stream function.
+ */
+SNWRITER *snwriter_stream(FILE *pFile, int flags) {
+  return snwriter_streamwith(pFile, flags, NULL);
+}
+
+/*
+ * snwriter_streamwith function.
  */
-static void snreader_fill(
-    SNREADER * pReader,
-    SNSOURCE * pIn,
-    SNFILTER * pFilter) {
+SNWRITER *snwriter_streamwith(
+    FILE          * pFile,
+    int             flags,
+    const SNALLOC * pAlloc) {
   
-  int err_code = 0;
-  int firstchar = 0;
-  char *pks = NULL;
-  SNTOKEN tk;
+  void (*pDestruct)(void *) = NULL;
+  
+  /* Check parameters */
+  if (pFile == NULL) {
+    abort();
+  }
+  
+  /* Set destructor based on OWNER flag; closing the file works the same
+   * way as for sources */
+  if (flags & SNSTREAM_OWNER) {
+    pDestruct = &snsource_file_free;
+  } else {
+    pDestruct = NULL;
+  }
+  
+  /* Call through to construct object */
+  return snwriter_blockwith(
+            &snwriter_file_sink,
+            pDestruct,
+            (void *) pFile,
+            pAlloc);
+}
+
+/*
+ * snwriter_free function.
+ */
+void snwriter_free(SNWRITER *pWriter) {
+
+  SNALLOC alloc;
   
   /* Initialize structures */
-  memset(&tk, 0, sizeof(SNTOKEN));
+  memset(&alloc, 0, sizeof(SNALLOC));
   
+  /* Only proceed if non-NULL parameter passed */
+  if (pWriter != NULL) {
+    
+    /* If destructor is defined, call it */
+    if (pWriter->pfDestruct != NULL) {
+      (*(pWriter->pfDestruct))(pWriter->pCustom);
+    }
+    
+    /* Release the buffer and the stacks */
+    snalloc_release(&(pWriter->alloc), pWriter->pBuf,
+                    SNWRITER_BUFFER_SIZE);
+    pWriter->pBuf = NULL;
+    snstack_reset(&(pWriter->stack_array), 1);
+    snstack_reset(&(pWriter->stack_group), 1);
+    
+    /* Release the structure, through a copy of the allocator since the
+     * allocator is stored in the structure */
+    memcpy(&alloc, &(pWriter->alloc), sizeof(SNALLOC));
+    snalloc_release(&alloc, pWriter, (long) sizeof(SNWRITER));
+  }
+}
+
+/*
+ * snwriter_limits function.
+ */
+void snwriter_limits(SNWRITER *pWriter, const SNLIMITS *pLimits) {
+
   /* Check parameters and state */
-  if ((pReader == NULL) || (pIn == NULL) || (pFilter == NULL)) {
+  if (pWriter == NULL) {
     abort();
   }
-  if (pReader->status) {
+  if ((pWriter->total > 0) || (pWriter->array_flag) ||
+      (snstack_count(&(pWriter->stack_group)) > 0)) {
     abort();
   }
-  if (pReader->queue_count > 0) {
+  
+  /* Fill in the defaults of the limits and set up the stacks again */
+  snreader_limits(&(pWriter->lim), pLimits);
+  
+  snstack_reset(&(pWriter->stack_array), 1);
+  snstack_reset(&(pWriter->stack_group), 1);
+  snstack_init(&(pWriter->stack_array),
+                pWriter->lim.nest_init, pWriter->lim.nest_max,
+                &(pWriter->alloc));
+  snstack_init(&(pWriter->stack_group),
+                pWriter->lim.nest_init, pWriter->lim.nest_max,
+                &(pWriter->alloc));
+}
+
+/*
+ * snwriter_mode function.
+ */
+void snwriter_mode(SNWRITER *pWriter, int flags) {
+
+  /* Check parameters and state */
+  if (pWriter == NULL) {
     abort();
   }
-  
-  /* If grouping stack is empty, initialize it with a value of zero */
-  if (snstack_count(&(pReader->stack_group)) < 1) {
-    if (!snstack_push(&(pReader->stack_group), 0)) {
-      abort();
-    }
+  if (pWriter->str_type != 0) {
+    abort();
   }
   
-  /* Read a token */
-  tk.pKey = &(pReader->buf_key);
-  tk.pValue = &(pReader->buf_value);
-  sntoken_read(&tk, pIn, pFilter);
-  if (tk.status < 0) {
-    err_code = tk.status;
+  /* Set the mode */
+  pWriter->mode = flags;
+}
+
+/*
+ * snwriter_status function.
+ */
+int snwriter_status(SNWRITER *pWriter) {
+
+  /* Check parameter */
+  if (pWriter == NULL) {
+    abort();
   }
   
-  /* Get the key string pointer */
-  if (!err_code) {
-    pks = snbuffer_get(tk.pKey);
+  /* Return status */
+  return pWriter->status;
+}
+
+/*
+ * snwriter_bytes function.
+ */
+long snwriter_bytes(SNWRITER *pWriter) {
+
+  /* Check parameter */
+  if (pWriter == NULL) {
+    abort();
   }
   
-  /* Perform array prefix operation if not in metacommand mode, except
-   * for "]" token */
-  if ((!err_code) && (!pReader->meta_flag)) {
-    if (tk.status == SNTOKEN_SIMPLE) {
-      if (!snchar_strequals(ASCII_RSQR, pks)) {
-        /* Simple token except for "]" */
-        snreader_arrayPrefix(pReader);
-      }
-      
-    } else {
-      /* Not in metacommand mode and not a simple token */
-      snreader_arrayPrefix(pReader);
-    }
-    
-    /* Check for errors from the prefix operation */
-    err_code = pReader->status;
+  /* Return total */
+  return pWriter->total;
+}
+
+/*
+ * snwriter_flush function.
+ */
+int snwriter_flush(SNWRITER *pWriter) {
+
+  /* Check parameter */
+  if (pWriter == NULL) {
+    abort();
   }
   
-  /* Handle the token types */
-  if ((tk.status == SNTOKEN_SIMPLE) && (!err_code)) {
-    /* Simple token -- handle non-primitive and primitive cases */
-    if (snchar_strequals(ASCII_PERCENT, pks)) {
-      /* % token -- enter metacommand mode */
-      if (!pReader->meta_flag) {
-        pReader->meta_flag = 1;
-        snreader_addEntityZ(pReader, SNENTITY_BEGIN_META);
-        
-      } else {
-        /* Nested metacommands */
-        err_code = SNERR_METANEST;
-      }
-      
-    } else if (snchar_strequals(ASCII_SEMICOLON, pks)) {
-      /* ; token -- leave metacommand mode */
-      if (pReader->meta_flag) {
-        pReader->meta_flag = 0;
-        snreader_addEntityZ(pReader, SNENTITY_END_META);
-        
-      } else {
-        /* Semicolon outside of metacommand */
-        err_code = SNERR_SEMICOLON;
-      }
-      
-    } else if (pReader->meta_flag) {
-      /* Other simple tokens in metacommand mode */
-      snreader_addEntityS(pReader, SNENTITY_META_TOKEN, pks);
-      
-    } else {
-      /* Primitive tokens -- first, get first byte */
-      firstchar = pks[0];
-      
-      /* Handle the various primitive tokens */
-      if ((firstchar == ASCII_PLUS) ||
-          (firstchar == ASCII_HYPHEN) ||
-          ((firstchar >= ASCII_ZERO) && (firstchar <= ASCII_NINE))) {
-        /* Numeric token */
-        snreader_addEntityS(pReader, SNENTITY_NUMERIC, pks);
-        
-      } else if (firstchar == ASCII_QUESTION) {
-        /* Declare variable */
-        snreader_addEntityS(pReader, SNENTITY_VARIABLE, (pks + 1));
-        
-      } else if (firstchar == ASCII_ATSIGN) {
-        /* Declare constant */
-        snreader_addEntityS(pReader, SNENTITY_CONSTANT, (pks + 1));
-        
-      } else if (firstchar == ASCII_COLON) {
-        /* Assign variable */
-        snreader_addEntityS(pReader, SNENTITY_ASSIGN, (pks + 1));
-        
-      } else if (firstchar == ASCII_EQUALS) {
-        /* Get variable or constant value */
-        snreader_addEntityS(pReader, SNENTITY_GET, (pks + 1));
-        
-      } else if (snchar_strequals(ASCII_LPAREN, pks)) {
-        /* Begin group */
-        if (snstack_inc(&(pReader->stack_group))) {
-          snreader_addEntityZ(pReader, SNENTITY_BEGIN_GROUP);
-        } else {
-          /* Too much group nesting */
-          err_code = SNERR_DEEPGROUP;
-        }
-        
-      } else if (snchar_strequals(ASCII_RPAREN, pks)) {
-        /* End group */
-        if (snstack_dec(&(pReader->stack_group))) {
-          snreader_addEntityZ(pReader, SNENTITY_END_GROUP);
-        } else {
-          /* Closing parenthesis without an opening parenthesis */
-          err_code = SNERR_RPAREN;
-        }
-        
-      } else if (snchar_strequals(ASCII_LSQR, pks)) {
-        /* Begin array */
-        pReader->array_flag = 1;
-        
-      } else if (snchar_strequals(ASCII_RSQR, pks)) {
-        /* End array */
-        if (!(pReader->array_flag)) {
-          /* Non-empty array -- check that array stack is not empty and
-           * that value on top of grouping stack is zero, then perform
-           * operation */
-          if (snstack_count(&(pReader->stack_array)) > 0) {
-            if (snstack_peek(&(pReader->stack_group)) == 0) {
-              snreader_addEntityZ(pReader, SNENTITY_END_GROUP);
-              snreader_addEntityL(pReader, SNENTITY_ARRAY,
-                snstack_pop(&(pReader->stack_array)));
-              snstack_pop(&(pReader->stack_group));
-              
-            } else {
-              /* Still unclosed parentheses in current element */
-              err_code = SNERR_OPENGROUP;
-            }
-            
-          } else {
-            /* "]" without a corresponding opening bracket */
-            err_code = SNERR_RSQR;
-          }
-          
-        } else {
-          /* Empty array */
-          pReader->array_flag = 0;
-          snreader_addEntityL(pReader, SNENTITY_ARRAY, 0);
-        }
-        
-      } else if (snchar_strequals(ASCII_COMMA, pks)) {
-        /* Array separator -- check that array stack is not empty and
-         * that value on top of grouping stack is zero, then perform
-         * operation */
-        if (snstack_count(&(pReader->stack_array)) > 0) {
-          if (snstack_peek(&(pReader->stack_group)) == 0) {
-            if (snstack_inc(&(pReader->stack_array))) {
-              snreader_addEntityZ(pReader, SNENTITY_END_GROUP);
-              snreader_addEntityZ(pReader, SNENTITY_BEGIN_GROUP);
-              
-            } else {
-              /* Too many array elements */
-              err_code = SNERR_LONGARRAY;
-            }
-              
-          } else {
-            /* Open parentheses in current element */
-            err_code = SNERR_OPENGROUP;
-          }
-            
-        } else {
-          /* Comma used outside of array */
-          err_code = SNERR_COMMA;
-        }
-        
-      } else {
-        /* Operator */
-        snreader_addEntityS(pReader, SNENTITY_OPERATION, pks);
-      }
-    }
-    
-  } else if ((tk.status == SNTOKEN_STRING) && (!err_code)) {
-    /* String token -- either a normal string or a meta string */
-    if (pReader->meta_flag) {
-      /* Meta string */
-      snreader_addEntityT(pReader, SNENTITY_META_STRING,
-        pks, tk.str_type, snbuffer_get(tk.pValue));
-    } else {
-      /* Normal string */
-      snreader_addEntityT(pReader, SNENTITY_STRING,
-        pks, tk.str_type, snbuffer_get(tk.pValue));
-    }
+  /* Hand the buffer to the sink */
+  snwriter_drain(pWriter);
   
-  } else if ((tk.status == SNTOKEN_FINAL) && (!err_code)) {
-    /* Final token */
-    if (!(pReader->meta_flag)) {
-      if ((!pReader->array_flag) &&
-            (snstack_count(&(pReader->stack_array)) == 0)) {
-        if (snstack_peek(&(pReader->stack_group)) == 0) {
-          
-          /* Add the EOF entity */
-          snreader_addEntityZ(pReader, SNENTITY_EOF);
-          
-        } else {
-          /* Open parentheses group remains */
-          err_code = SNERR_OPENGROUP;
-        }
-      } else {
-        /* Open array remains */
-        err_code = SNERR_OPENARRAY;
-      }
-    } else {
-      /* Open metacommand remains */
-      err_code = SNERR_OPENMETA;
+  /* Return status */
+  return pWriter->status;
+}
+
+/*
+ * snwriter_beginmeta function.
+ */
+int snwriter_beginmeta(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_METANEST;
     }
-    
-  } else if (!err_code) {
-    /* Unknown token type */
-    abort();
   }
   
-  /* Error if now an error state in reader */
-  if (!err_code) {
-    err_code = pReader->status;
-  }
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
   
-  /* If error, set error in reader */
-  if (err_code) {
-    pReader->status = err_code;
+  /* Write the token and enter metacommand mode */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, "%", 1, SNWRITER_OPEN);
+    pWriter->meta_flag = 1;
   }
+  
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * Public functions
- * ================
- * 
- * (see the header for specifications)
+ * snwriter_endmeta function.
  */
+int snwriter_endmeta(SNWRITER *pWriter) {
 
-/*
- * snsource_file function.
- */
-SNSOURCE *snsource_file(FILE *pFile, int owner) {
-  
-  SNSOURCE *pSrc = NULL;
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (!(pWriter->meta_flag)) {
+      pWriter->status = SNERR_SEMICOLON;
+    }
+  }
   
-  /* Call through to stream function */
-  if (owner) {
-    pSrc = snsource_stream(pFile, SNSTREAM_OWNER);
-  } else {
-    pSrc = snsource_stream(pFile, SNSTREAM_NORMAL);
+  /* Write the token and line break, and leave metacommand mode */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, ";", 1, SNWRITER_CLOSE);
+    snwriter_newline(pWriter);
+    pWriter->meta_flag = 0;
   }
   
-  /* Return new source */
-  return pSrc;
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_stream function.
+ * snwriter_metatoken function.
  */
-SNSOURCE *snsource_stream(FILE *pFile, int flags) {
-  
-  void (*pDestruct)(void *) = NULL;
-  int (*pRewind)(void *) = NULL;
+int snwriter_metatoken(SNWRITER *pWriter, const char *pToken) {
+
+  long len = 0;
+  int kind = SNWRITER_PLAIN;
   
   /* Check parameters */
-  if (pFile == NULL) {
+  if (pToken == NULL) {
     abort();
   }
   
-  /* Set destructor based on OWNER flag */
-  if (flags & SNSTREAM_OWNER) {
-    pDestruct = &snsource_file_free;
-  } else {
-    pDestruct = NULL;
+  /* Check state, and check the token, which is either plain or one of
+   * the atomic tokens that can appear within metacommands */
+  if (!snwriter_start(pWriter)) {
+    len = snwriter_plain(pToken);
+    if ((len < 0) && (pToken[0] != 0) && (pToken[1] == 0)) {
+      len = 1;
+      if ((pToken[0] == ASCII_LPAREN) || (pToken[0] == ASCII_LSQR)) {
+        kind = SNWRITER_OPEN;
+      } else if ((pToken[0] == ASCII_RPAREN) ||
+                  (pToken[0] == ASCII_RSQR) ||
+                  (pToken[0] == ASCII_COMMA)) {
+        kind = SNWRITER_CLOSE;
+      } else {
+        len = -1;
+      }
+    }
+    
+    if ((len < 1) || (!(pWriter->meta_flag))) {
+      pWriter->status = SNERR_WRITE;
+    } else if (len >= pWriter->lim.key_max) {
+      pWriter->status = SNERR_LONGTOKEN;
+    }
   }
   
-  /* Set rewind routine based on RANDOM flag */
-  if (flags & SNSTREAM_RANDOM) {
-    pRewind = &snsource_file_rewind;
-  } else {
-    pRewind = NULL;
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, pToken, len, kind);
   }
   
-  /* Call through to construct object */
-  return snsource_custom(
-            &snsource_file_read,
-            pDestruct,
-            pRewind,
-            (void *) pFile);
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_string function.
+ * snwriter_string function.
  */
-SNSOURCE *snsource_string(const char *pStr) {
-  
-  SNSTRSRC *pStS = NULL;
+int snwriter_string(
+    SNWRITER   * pWriter,
+    int          str_type,
+    const char * pPrefix,
+    const char * pData,
+    long         len) {
   
-  /* Check parameter */
-  if (pStr == NULL) {
+  /* Check parameters */
+  if ((len < 0) || ((len > 0) && (pData == NULL))) {
     abort();
   }
   
-  /* Allocate new structure */
-  pStS = (SNSTRSRC *) malloc(sizeof(SNSTRSRC));
-  if (pStS == NULL) {
-    abort();
+  /* Write the whole string */
+  if (!snwriter_beginstring(pWriter, str_type, pPrefix)) {
+    snwriter_chunk(pWriter, pData, len);
+    snwriter_endstring(pWriter);
   }
-  memset(pStS, 0, sizeof(SNSTRSRC));
   
-  /* Copy the pointer into the structure */
-  pStS->pStr = (const unsigned char *) pStr;
-  pStS->pRewind = (const unsigned char *) pStr;
-  
-  /* Call through to construct object */
-  return snsource_custom(
-            &snsource_str_read,
-            &snsource_str_free,
-            &snsource_str_rewind,
-            (void *) pStS);
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_custom function.
+ * snwriter_beginstring function.
  */
-SNSOURCE *snsource_custom(
-    int (*read_func)(void *),
-    void (*free_func)(void *),
-    int (*rewind_func)(void *),
-    void *custom) {
+int snwriter_beginstring(
+    SNWRITER   * pWriter,
+    int          str_type,
+    const char * pPrefix) {
   
-  SNSOURCE *pSrc = NULL;
+  long len = 0;
   
   /* Check parameters */
-  if (read_func == NULL) {
+  if ((str_type != SNSTRING_QUOTED) && (str_type != SNSTRING_CURLY)) {
     abort();
   }
   
-  /* Allocate structure */
-  pSrc = (SNSOURCE *) malloc(sizeof(SNSOURCE));
-  if (pSrc == NULL) {
-    abort();
+  /* Check state, and check that the prefix is plain and that the token
+   * with the opening delimiter isn't too long */
+  if (!snwriter_start(pWriter)) {
+    if (pPrefix != NULL) {
+      len = snwriter_plain(pPrefix);
+    }
+    if (len < 0) {
+      pWriter->status = SNERR_WRITE;
+    } else if (len >= pWriter->lim.key_max - 1) {
+      pWriter->status = SNERR_LONGTOKEN;
+    }
   }
-  memset(pSrc, 0, sizeof(SNSOURCE));
   
-  /* Initialize structure */
-  pSrc->pfRead = read_func;
-  pSrc->pfDestruct = free_func;
-  pSrc->pfRewind = rewind_func;
-  
-  pSrc->read_count = 0;
-  pSrc->status = 0;
-  pSrc->pCustom = custom;
+  /* Perform the array prefix operation if not in a metacommand */
+  if (!(pWriter->meta_flag)) {
+    snwriter_prefix(pWriter);
+  }
   
-  /* If a rewind routine was provided, rewind right away; errors ignored
-   * since they will immediately set structure into IOERR status */
-  if (rewind_func != NULL) {
-    snsource_rewind(pSrc);
+  /* Write the prefix and the opening delimiter, and open the string */
+  if (!(pWriter->status)) {
+    snwriter_lead(pWriter, SNWRITER_PLAIN);
+    snwriter_put(pWriter, (const unsigned char *) pPrefix, len);
+    if (str_type == SNSTRING_QUOTED) {
+      snwriter_put(pWriter, (const unsigned char *) "\"", 1);
+    } else {
+      snwriter_put(pWriter, (const unsigned char *) "{", 1);
+    }
+    
+    pWriter->str_type = str_type;
+    pWriter->str_odd = 0;
+    pWriter->str_depth = 0;
+    pWriter->str_len = 0;
   }
   
-  /* Return the new source object */
-  return pSrc;
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_free function.
+ * snwriter_chunk function.
  */
-void snsource_free(SNSOURCE *pSrc) {
+int snwriter_chunk(SNWRITER *pWriter, const char *pData, long len) {
+
+  /* Check parameters and state */
+  if ((pWriter == NULL) || (len < 0) ||
+      ((len > 0) && (pData == NULL))) {
+    abort();
+  }
+  if ((!(pWriter->status)) && (pWriter->str_type == 0)) {
+    abort();
+  }
   
-  /* Only proceed if non-NULL parameter passed */
-  if (pSrc != NULL) {
-    
-    /* If destructor is defined, call it */
-    if (pSrc->pfDestruct != NULL) {
-      (*(pSrc->pfDestruct))(pSrc->pCustom);
-    }
-    
-    /* Release the structure */
-    free(pSrc);
+  /* Write the data */
+  if (!(pWriter->status)) {
+    snwriter_data(pWriter, (const unsigned char *) pData, len);
   }
+  
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_bytes function.
+ * snwriter_endstring function.
  */
-long snsource_bytes(SNSOURCE *pSrc) {
-  
-  /* Check parameter */
-  if (pSrc == NULL) {
+int snwriter_endstring(SNWRITER *pWriter) {
+
+  /* Check parameter and state */
+  if (pWriter == NULL) {
+    abort();
+  }
+  if ((!(pWriter->status)) && (pWriter->str_type == 0)) {
     abort();
   }
   
-  /* Return count */
-  return pSrc->read_count;
+  /* The data must not escape the closing delimiter or leave curly
+   * brackets open */
+  if (!(pWriter->status)) {
+    if (pWriter->str_odd || (pWriter->str_depth != 0)) {
+      pWriter->status = SNERR_WRITE;
+    }
+  }
+  
+  /* Write the closing delimiter */
+  if (!(pWriter->status)) {
+    if (pWriter->str_type == SNSTRING_QUOTED) {
+      snwriter_put(pWriter, (const unsigned char *) "\"", 1);
+    } else {
+      snwriter_put(pWriter, (const unsigned char *) "}", 1);
+    }
+  }
+  
+  /* Close the string */
+  pWriter->str_type = 0;
+  
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_consume function.
+ * snwriter_numeric function.
  */
-int snsource_consume(SNSOURCE *pSrc) {
-  
-  long c = 0;
-  int result = 0;
+int snwriter_numeric(SNWRITER *pWriter, const char *pToken) {
+
+  long len = 0;
   
-  /* Check parameter */
-  if (pSrc == NULL) {
+  /* Check parameters */
+  if (pToken == NULL) {
     abort();
   }
   
-  /* Keep reading until we get something besides SP HT CR LF */
-  for(c = snsource_readCPV(pSrc);
-      (c == ASCII_SP) || (c == ASCII_HT) ||
-      (c == ASCII_CR) || (c == ASCII_LF);
-      c = snsource_readCPV(pSrc));
+  /* Check state, and check that the token is plain and begins with a
+   * sign or digit */
+  if (!snwriter_start(pWriter)) {
+    len = snwriter_plain(pToken);
+    if ((len < 1) || pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    } else if (SNCHAR_GETPRIM(snchar_class(
+                  ((const unsigned char *) pToken)[0]))
+                    != SNPRIM_NUMERIC) {
+      pWriter->status = SNERR_WRITE;
+    } else if (len >= pWriter->lim.key_max) {
+      pWriter->status = SNERR_LONGTOKEN;
+    }
+  }
   
-  /* Set result depending on what we stopped on */
-  if (c == SNERR_EOF) {
-    /* Nothing but whitespace and blank lines present, so succeed */
-    result = 1;
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
   
-  } else if (c == SNERR_IOERR) {
-    /* I/O error, so return that */
-    result = SNERR_IOERR;
-    
-  } else {
-    /* In all other cases, including data bytes besides whitespace and
-     * line breaks and other kinds of errors, return a trailer error */
-    result = SNERR_TRAILER;
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, pToken, len, SNWRITER_PLAIN);
   }
   
-  /* Return result */
-  return result;
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snsource_ismulti function.
+ * snwriter_integer function.
  */
-int snsource_ismulti(SNSOURCE *pSrc) {
+int snwriter_integer(SNWRITER *pWriter, long v) {
+
+  char buf[32];
+  unsigned long u = 0;
+  int i = 0;
   
-  int result = 0;
+  /* Initialize buffer */
+  memset(buf, 0, sizeof(buf));
   
-  /* Check parameter */
-  if (pSrc == NULL) {
-    abort();
+  /* Get the magnitude, which works for LONG_MIN too */
+  if (v < 0) {
+    u = ((unsigned long) (-(v + 1))) + 1;
+  } else {
+    u = (unsigned long) v;
   }
   
-  /* Presence of rewind function determines multipass support */
-  if (pSrc->pfRewind != NULL) {
-    result = 1;
-  } else {
-    result = 0;
+  /* Convert the digits from the end of the buffer backwards, leaving
+   * the terminating nul in place */
+  i = ((int) sizeof(buf)) - 1;
+  do {
+    i--;
+    buf[i] = (char) (ASCII_ZERO + (int) (u % 10));
+    u = u / 10;
+  } while (u > 0);
+  
+  if (v < 0) {
+    i--;
+    buf[i] = (char) ASCII_HYPHEN;
   }
   
-  /* Return result */
-  return result;
+  /* Write the numeric literal */
+  return snwriter_numeric(pWriter, &(buf[i]));
 }
 
 /*
- * snsource_rewind function.
+ * snwriter_variable function.
  */
-int snsource_rewind(SNSOURCE *pSrc) {
+int snwriter_variable(SNWRITER *pWriter, const char *pName) {
+  return snwriter_name(pWriter, ASCII_QUESTION, pName);
+}
+
+/*
+ * snwriter_constant function.
+ */
+int snwriter_constant(SNWRITER *pWriter, const char *pName) {
+  return snwriter_name(pWriter, ASCII_ATSIGN, pName);
+}
+
+/*
+ * snwriter_assign function.
+ */
+int snwriter_assign(SNWRITER *pWriter, const char *pName) {
+  return snwriter_name(pWriter, ASCII_COLON, pName);
+}
+
+/*
+ * snwriter_get function.
+ */
+int snwriter_get(SNWRITER *pWriter, const char *pName) {
+  return snwriter_name(pWriter, ASCII_EQUALS, pName);
+}
+
+/*
+ * snwriter_begingroup function.
+ */
+int snwriter_begingroup(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    }
+  }
   
-  int status = 1;
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
   
-  /* Check parameter and state */
-  if (pSrc == NULL) {
-    abort();
+  /* Open the group */
+  if (!(pWriter->status)) {
+    if (!snstack_inc(&(pWriter->stack_group))) {
+      pWriter->status = SNERR_DEEPGROUP;
+    }
   }
-  if (pSrc->pfRewind == NULL) {
-    abort();
+  
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, "(", 1, SNWRITER_OPEN);
   }
   
-  /* If source currently in EOF state, clear that */
-  if (pSrc->status == SNERR_EOF) {
-    pSrc->status = 0;
+  /* Return status */
+  return pWriter->status;
+}
+
+/*
+ * snwriter_endgroup function.
+ */
+int snwriter_endgroup(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    }
   }
   
-  /* If we are in an error state, rewind fails */
-  if (pSrc->status != 0) {
-    status = 0;
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
+  
+  /* Close the group */
+  if (!(pWriter->status)) {
+    if (!snstack_dec(&(pWriter->stack_group))) {
+      pWriter->status = SNERR_RPAREN;
+    }
   }
   
-  /* Attempt to rewind the source */
-  if (status) {
-    if (!(*(pSrc->pfRewind))(pSrc->pCustom)) {
-      status = 0;
-      pSrc->status = SNERR_IOERR;
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, ")", 1, SNWRITER_CLOSE);
+  }
+  
+  /* Return status */
+  return pWriter->status;
+}
+
+/*
+ * snwriter_beginarray function.
+ */
+int snwriter_beginarray(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
     }
   }
   
-  /* If we rewound successfully, clear the read counter */
-  if (status) {
-    pSrc->read_count = 0;
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
+  
+  /* Write the token, delaying the array operation until it is known
+   * whether the array is empty */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, "[", 1, SNWRITER_OPEN);
+    pWriter->array_flag = 1;
   }
   
-  /* Return status of operation */
-  return status;
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snparser_alloc function.
+ * snwriter_comma function.
  */
-SNPARSER *snparser_alloc(void) {
+int snwriter_comma(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    }
+  }
   
-  SNPARSER *pParser = NULL;
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
   
-  /* Allocate structure */
-  pParser = (SNPARSER *) malloc(sizeof(SNPARSER));
-  if (pParser == NULL) {
-    abort();
+  /* Start the next element, which requires an open array without open
+   * groups in the current element */
+  if (!(pWriter->status)) {
+    if (snstack_count(&(pWriter->stack_array)) > 0) {
+      if (snstack_peek(&(pWriter->stack_group)) == 0) {
+        if (!snstack_inc(&(pWriter->stack_array))) {
+          pWriter->status = SNERR_LONGARRAY;
+        }
+      } else {
+        pWriter->status = SNERR_OPENGROUP;
+      }
+    } else {
+      pWriter->status = SNERR_COMMA;
+    }
   }
-  memset(pParser, 0, sizeof(SNPARSER));
   
-  /* Initialize */
-  snreader_init(&(pParser->reader));
-  snfilter_reset(&(pParser->filter));
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, ",", 1, SNWRITER_CLOSE);
+  }
   
-  /* Return parser */
-  return pParser;
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snparser_free function.
+ * snwriter_endarray function.
  */
-void snparser_free(SNPARSER *pParser) {
+int snwriter_endarray(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    }
+  }
   
-  /* Only do something if not NULL */
-  if (pParser != NULL) {
-    /* Fully reset reader and release */
-    snreader_reset(&(pParser->reader), 1);
-    free(pParser);
+  /* Close the array, which is either empty, or requires no open groups
+   * in the last element */
+  if (!(pWriter->status)) {
+    if (pWriter->array_flag) {
+      pWriter->array_flag = 0;
+    
+    } else if (snstack_count(&(pWriter->stack_array)) > 0) {
+      if (snstack_peek(&(pWriter->stack_group)) == 0) {
+        snstack_pop(&(pWriter->stack_array));
+        snstack_pop(&(pWriter->stack_group));
+      } else {
+        pWriter->status = SNERR_OPENGROUP;
+      }
+    
+    } else {
+      pWriter->status = SNERR_RSQR;
+    }
+  }
+  
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, "]", 1, SNWRITER_CLOSE);
   }
+  
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snparser_read function.
+ * snwriter_operation function.
  */
-void snparser_read(
-    SNPARSER * pParser,
-    SNENTITY * pEntity,
-    SNSOURCE * pIn) {
+int snwriter_operation(SNWRITER *pWriter, const char *pName) {
+
+  long len = 0;
   
   /* Check parameters */
-  if ((pParser == NULL) || (pEntity == NULL) || (pIn == NULL)) {
+  if (pName == NULL) {
     abort();
   }
   
-  /* Call through to reader */
-  snreader_read(&(pParser->reader), pEntity, pIn, &(pParser->filter));
+  /* Check state, and check that the token is plain and not some other
+   * kind of primitive */
+  if (!snwriter_start(pWriter)) {
+    len = snwriter_plain(pName);
+    if ((len < 1) || pWriter->meta_flag) {
+      pWriter->status = SNERR_WRITE;
+    } else if (SNCHAR_GETPRIM(snchar_class(
+                  ((const unsigned char *) pName)[0]))
+                    != SNPRIM_OPERATION) {
+      pWriter->status = SNERR_WRITE;
+    } else if (len >= pWriter->lim.key_max) {
+      pWriter->status = SNERR_LONGTOKEN;
+    }
+  }
+  
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
+  
+  /* Write the token */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, pName, len, SNWRITER_PLAIN);
+  }
+  
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
- * snparser_count function.
+ * snwriter_eof function.
  */
-long snparser_count(SNPARSER *pParser) {
+int snwriter_eof(SNWRITER *pWriter) {
+
+  /* Check state */
+  if (!snwriter_start(pWriter)) {
+    if (pWriter->meta_flag) {
+      pWriter->status = SNERR_OPENMETA;
+    }
+  }
   
-  /* Check parameter */
-  if (pParser == NULL) {
-    abort();
+  /* Perform the array prefix operation */
+  snwriter_prefix(pWriter);
+  
+  /* No arrays or groups may be open */
+  if (!(pWriter->status)) {
+    if (snstack_count(&(pWriter->stack_array)) > 0) {
+      pWriter->status = SNERR_OPENARRAY;
+    } else if (snstack_peek(&(pWriter->stack_group)) != 0) {
+      pWriter->status = SNERR_OPENGROUP;
+    }
+  }
+  
+  /* Write the token and a line break, and flush the writer */
+  if (!(pWriter->status)) {
+    snwriter_token(pWriter, "|;", 2, SNWRITER_PLAIN);
+    snwriter_newline(pWriter);
+    snwriter_drain(pWriter);
+    pWriter->eof = 1;
   }
   
-  /* Return line count */
-  return snfilter_count(&(pParser->filter));
+  /* Return status */
+  return pWriter->status;
 }
 
 /*
@@ -4338,7 +18178,7 @@ const char *snerror_str(int code) {
     case SNERR_LONGTOKEN:
       pResult = "Token is too long";
       break;
-      
+    
     case SNERR_TRAILER:
       pResult = "Content present after |; token";
       break;
@@ -4370,7 +18210,7 @@ const char *snerror_str(int code) {
     case SNERR_OPENGROUP:
       pResult = "Open group";
       break;
-
+    
     case SNERR_LONGARRAY:
       pResult = "Array has too many elements";
       break;
@@ -4395,6 +18235,18 @@ const char *snerror_str(int code) {
       pResult = "Invalid UTF-8 encountered in input";
       break;
     
+    case SNERR_NOMEM:
+      pResult = "Out of memory";
+      break;
+    
+    case SNERR_MORE:
+      pResult = "More input needed";
+      break;
+    
+    case SNERR_WRITE:
+      pResult = "Entity can't be written as given";
+      break;
+    
     default:
       pResult = "Unknown error";
   }
@@ -37,9 +37,12 @@
 #define SNERR_OPENARRAY (-21) /* Unclosed array */
 #define SNERR_COMMA     (-22) /* Comma used outside of array or meta */
 #define SNERR_UTF8      (-23) /* Invalid UTF-8 in input */
+#define SNERR_NOMEM     (-24) /* Memory allocation failed */
+#define SNERR_MORE      (-25) /* More input needed from feed source */
+#define SNERR_WRITE     (-26) /* Entity can't be written as given */
 
 /*
- * Flags for use with snsource_stream().
+ * Flags for use with snsource_stream() and snsource_fd().
  * 
  * SNSTREAM_NORMAL has a value of zero, meaning no special flags set.
  * The other flags can be combined with bitwise OR.
@@ -52,10 +55,134 @@
  * If RANDOM flag is set, then the file handle supports random access,
  * so multiplass operation is enabled with file I/O.  Do not use RANDOM
  * with stdin!
+ * 
+ * If AHEAD flag is set, then snsource_fd() reads the next block of the
+ * file on a background thread while the current block is parsed.  This
+ * requires the library to be built with SHASTINA_THREADS defined, and
+ * the flag is ignored otherwise.  snsource_stream() ignores it.
  */
 #define SNSTREAM_NORMAL   (0)
 #define SNSTREAM_OWNER    (1)
 #define SNSTREAM_RANDOM   (2)
+#define SNSTREAM_AHEAD    (4)
+
+/*
+ * Flags for use with snparser_mode().
+ * 
+ * SNMODE_NORMAL has a value of zero, meaning no special flags set.  The
+ * other flags can be combined with bitwise OR.
+ * 
+ * If VIEW flag is set, then when the parser reads from a whole source
+ * (see snsource_buffer()), the key and value strings of entities point
+ * directly into the input data of the source wherever their bytes are
+ * unchanged from the input, instead of being copied into buffers.
+ * Strings that the input filter changes -- for example, by converting
+ * CR+LF line breaks to LF or by combining surrogate pairs -- are still
+ * copied.  Since strings that point into the input data are NOT
+ * null-terminated, clients using this flag must use the key_len and
+ * value_len fields of the entity rather than looking for a terminating
+ * nul.  The flag has no effect with other kinds of sources.
+ * 
+ * If CHUNK flag is set, then a string or meta string that is too long
+ * to fit in the value buffer of the parser is not an SNERR_LONGSTR
+ * error.  Instead, the string is returned as a BEGIN_STRING entity,
+ * followed by one or more STRING_CHUNK entities that each hold part of
+ * the string data, followed by an END_STRING entity.  Strings that fit
+ * in the value buffer are still returned as single STRING and
+ * META_STRING entities.  This allows strings of any length to be read
+ * with bounded memory.  See snparser_alloclimits() for how to set the
+ * size of the value buffer.
+ * 
+ * If INTEGER flag is set, then NUMERIC entities whose token is a
+ * decimal integer -- an optional sign followed by one or more decimal
+ * digits -- are decoded into the num_int field of the entity, with
+ * num_type set to SNNUMBER_INTEGER.  Integers that don't fit in a long
+ * are not decoded as integers.
+ * 
+ * If FLOAT flag is set, then NUMERIC entities that weren't decoded as
+ * integers and whose token is a decimal floating-point number -- an
+ * optional sign, decimal digits with an optional decimal point, and an
+ * optional exponent made of "e" or "E", an optional sign, and decimal
+ * digits -- are decoded into the num_float field of the entity, with
+ * num_type set to SNNUMBER_FLOAT.  Only numbers that can be converted
+ * exactly with double arithmetic are decoded, which are those with
+ * fewer than 16 significant digits and a decimal exponent of small
+ * magnitude, so the result is always correctly rounded and does not
+ * depend on the locale.
+ * 
+ * The token of NUMERIC entities is always in pKey, so clients can use
+ * their own conversion for tokens that weren't decoded.
+ * 
+ * If UNESCAPE flag is set, then the string data of STRING, META_STRING,
+ * and STRING_CHUNK entities is unescaped while it is read.  In quoted
+ * strings, a backslash followed by a double quote or another backslash
+ * is replaced by the second character.  In curly strings, a backslash
+ * followed by a curly bracket or another backslash is replaced by the
+ * second character.  Pairs are matched from left to right, following
+ * the same odd-backslash rule that finds the end of the string, and all
+ * other backslashes are kept.  The value_len field is the length of the
+ * unescaped data, and the value buffer limit applies to the unescaped
+ * data.  In CHUNK mode, the value buffer should then be at least six
+ * bytes.  Strings with escapes are copied even with the VIEW flag.
+ * This reverses the escaping of writers in SNWRITE_ESCAPE mode.  By
+ * default, string data is returned exactly as it appears in the input.
+ */
+#define SNMODE_NORMAL   (0)
+#define SNMODE_VIEW     (1)
+#define SNMODE_CHUNK    (2)
+#define SNMODE_INTEGER  (4)
+#define SNMODE_FLOAT    (8)
+#define SNMODE_UNESCAPE (16)
+
+/*
+ * Flags for use with snparser_reset().
+ * 
+ * SNRESET_NORMAL has a value of zero, meaning no special flags set.
+ * 
+ * If LINES flag is set, then line counting continues from where it
+ * left off in the previous document, so that line numbers count lines
+ * in the whole stream rather than in each document.  Otherwise, line
+ * counting starts over, so that the next document begins at line one,
+ * and a UTF-8 Byte Order Mark (BOM) at the start of the next document
+ * is skipped just as at the start of the stream.
+ */
+#define SNRESET_NORMAL (0)
+#define SNRESET_LINES  (1)
+
+/*
+ * Flags for use with snpool_sources() and snpool_stream().
+ * 
+ * SNPOOL_NORMAL has a value of zero, meaning no special flags set.
+ * 
+ * If ORDERED flag is set, then the document callback is invoked for one
+ * document at a time, in the order of the documents.  Otherwise, the
+ * callback is invoked as soon as each document has been parsed, which
+ * may be on several threads at once and in any order.
+ */
+#define SNPOOL_NORMAL  (0)
+#define SNPOOL_ORDERED (1)
+
+/*
+ * Flags for use with snwriter_mode().
+ * 
+ * SNWRITE_NORMAL has a value of zero, meaning no special flags set.
+ * The other flags can be combined with bitwise OR.
+ * 
+ * If ESCAPE flag is set, then string data is escaped as it is written.
+ * Each backslash is written as two backslashes, and each double quote
+ * in a quoted string or curly bracket in a curly string is written
+ * with a backslash before it, so that any string data can be written.
+ * A parser in SNMODE_UNESCAPE mode reads back the original data.
+ * Otherwise, string data is written exactly as given, and it is an
+ * SNERR_WRITE error if the data would not be read back unchanged.
+ * 
+ * If LONG flag is set, then strings may be longer than the value
+ * buffer limit of the writer (see snwriter_limits()), for output that
+ * will be read in SNMODE_CHUNK mode.
+ */
+#define SNWRITE_NORMAL (0)
+#define SNWRITE_ESCAPE (1)
+#define SNWRITE_LONG   (2)
 
 /*
  * The types of entities.
@@ -75,6 +202,25 @@
 #define SNENTITY_END_GROUP    (12)  /* End group */
 #define SNENTITY_ARRAY        (13)  /* Define array */
 #define SNENTITY_OPERATION    (14)  /* Operation */
+#define SNENTITY_BEGIN_STRING (15)  /* Begin chunked string */
+#define SNENTITY_STRING_CHUNK (16)  /* Chunk of string data */
+#define SNENTITY_END_STRING   (17)  /* End chunked string */
+
+/*
+ * The number of entity types, which is one more than the greatest
+ * entity type.
+ */
+#define SNENTITY_KINDS (18)
+
+/*
+ * Entity masks for use with snparser_mask().
+ * 
+ * SNMASK() gives the bit of one of the SNENTITY_ kinds of entities, and
+ * the bits of several kinds can be combined with bitwise OR.
+ * SNMASK_ALL has the bits of all kinds of entities.
+ */
+#define SNMASK(kind) (1L << (kind))
+#define SNMASK_ALL ((1L << SNENTITY_KINDS) - 1)
 
 /*
  * The types of strings.
@@ -82,6 +228,13 @@
 #define SNSTRING_QUOTED (1) /* Double-quoted strings */
 #define SNSTRING_CURLY  (2) /* Curly-bracketed strings */
 
+/*
+ * The types of decoded numbers.
+ */
+#define SNNUMBER_NONE    (0) /* Not decoded */
+#define SNNUMBER_INTEGER (1) /* Decoded into num_int */
+#define SNNUMBER_FLOAT   (2) /* Decoded into num_float */
+
 /*
  * The SNSOURCE structure prototype.
  * 
@@ -98,6 +251,30 @@ typedef struct SNSOURCE_TAG SNSOURCE;
 struct SNPARSER_TAG;
 typedef struct SNPARSER_TAG SNPARSER;
 
+/*
+ * The SNINDEX structure prototype.
+ * 
+ * The actual structure definition is given in the implementation file.
+ */
+struct SNINDEX_TAG;
+typedef struct SNINDEX_TAG SNINDEX;
+
+/*
+ * The SNPOOL structure prototype.
+ * 
+ * The actual structure definition is given in the implementation file.
+ */
+struct SNPOOL_TAG;
+typedef struct SNPOOL_TAG SNPOOL;
+
+/*
+ * The SNWRITER structure prototype.
+ * 
+ * The actual structure definition is given in the implementation file.
+ */
+struct SNWRITER_TAG;
+typedef struct SNWRITER_TAG SNWRITER;
+
 /*
  * Structure for an entity read from a Shastina source file.
  */
@@ -127,17 +304,30 @@ typedef struct {
    * For NUMERIC entities, this is the numeric value represented as a
    * string.  It is up to the clients to parse this as a number.
    * 
-   * For STRING and META_STRING entities, this is the string prefix,
-   * which does not include the opening quote or curly bracket.
+   * For STRING, META_STRING, and BEGIN_STRING entities, this is the
+   * string prefix, which does not include the opening quote or curly
+   * bracket.
    * 
    * For all other entities, this is set to NULL and ignored.
    * 
    * The pointer is valid until the next entity is read or the entity
    * reader is reset (whichever occurs first).  The client should not
    * modify the data at the pointer.
+   * 
+   * If the parser is in SNMODE_VIEW mode, the string is not necessarily
+   * null-terminated.  See SNMODE_VIEW for further information.
    */
   char *pKey;
   
+  /*
+   * The length of the key string in bytes.
+   * 
+   * This does not include any terminating nul.  It is valid whenever
+   * pKey is used.  For all other entities, this is set to zero and
+   * ignored.
+   */
+  long key_len;
+  
   /*
    * Pointer to the null-terminated value string.
    * 
@@ -145,20 +335,35 @@ typedef struct {
    * data, which does not include the opening and closing quotes or
    * brackets.
    * 
+   * For STRING_CHUNK entities, this is the next part of the data of a
+   * chunked string.  Chunks always end on a codepoint boundary.
+   * 
    * For all other entities, this is set to NULL and ignored.
    * 
    * The pointer is valid until the next entity is read or the entity
    * reader is reset (whichever occurs first).  The client should not
    * modify the data at the pointer.
+   * 
+   * If the parser is in SNMODE_VIEW mode, the string is not necessarily
+   * null-terminated.  See SNMODE_VIEW for further information.
    */
   char *pValue;
   
+  /*
+   * The length of the value string in bytes.
+   * 
+   * This does not include any terminating nul.  It is valid whenever
+   * pValue is used.  For all other entities, this is set to zero and
+   * ignored.
+   */
+  long value_len;
+  
   /*
    * The string type.
    * 
-   * For STRING and META_STRING entities, this is one of the SNSTRING_
-   * constants, which defines whether the string is a quoted string or a
-   * curly-bracket string.
+   * For STRING, META_STRING, BEGIN_STRING, STRING_CHUNK, and END_STRING
+   * entities, this is one of the SNSTRING_ constants, which defines
+   * whether the string is a quoted string or a curly-bracket string.
    * 
    * For all other entities, this is set to zero and ignored.
    */
@@ -174,8 +379,344 @@ typedef struct {
    */
   long count;
   
+  /*
+   * The byte offset of the entity.
+   * 
+   * This is the number of bytes in the source before the token that
+   * the entity was read from, counted the same way as snsource_bytes()
+   * counts them, so it is reset by rewinding.  All the entities that a
+   * single token produces have the same offset, except that the later
+   * chunks of a chunked string have the offset where their chunk of
+   * string data begins.  For errors, this is the number of bytes that
+   * had been read when the error was found.
+   * 
+   * Use snsource_locate() to turn the offset into a line and column.
+   */
+  long offset;
+  
+  /*
+   * The symbol ID of the key string.
+   * 
+   * If the parser has a symbol table (see snparser_symbols()), then for
+   * OPERATION, VARIABLE, CONSTANT, ASSIGN, and GET entities, this is
+   * the symbol ID of the name in pKey, which is one or greater.  Equal
+   * names always have the same ID, so clients can dispatch on the ID
+   * instead of comparing strings.
+   * 
+   * For all other entities, and if the parser has no symbol table,
+   * this is set to zero.
+   */
+  long symbol;
+  
+  /*
+   * The type of the decoded number.
+   * 
+   * For NUMERIC entities, this is one of the SNNUMBER_ constants, which
+   * defines which of num_int and num_float holds the decoded value of
+   * the token.  Numbers are only decoded if the parser is in
+   * SNMODE_INTEGER or SNMODE_FLOAT mode.
+   * 
+   * For all other entities, this is set to SNNUMBER_NONE (zero).
+   */
+  int num_type;
+  
+  /*
+   * The decoded integer value, if num_type is SNNUMBER_INTEGER.
+   * 
+   * Otherwise, this is set to zero and ignored.
+   */
+  long num_int;
+  
+  /*
+   * The decoded floating-point value, if num_type is SNNUMBER_FLOAT.
+   * 
+   * Otherwise, this is set to zero and ignored.
+   */
+  double num_float;
+
 } SNENTITY;
 
+/*
+ * Structure for specifying the buffer limits of a parser.
+ * 
+ * Use with snparser_alloclimits().  Each limit comes as a pair of an
+ * initial allocation and a maximum allocation.  Buffers start out at
+ * their initial allocation and grow as needed up to their maximum.
+ * 
+ * Any field that is zero or less selects the default value.  If only
+ * the maximum of a pair is given and it is below the default initial
+ * allocation, the initial allocation is lowered to match.
+ */
+typedef struct {
+  
+  /*
+   * The initial and maximum allocations of the key buffer, in bytes.
+   * 
+   * The key buffer holds tokens and string prefixes, including a
+   * terminating nul, so the longest token is one byte less than the
+   * maximum.  The defaults are 16 and 65535.
+   */
+  long key_init;
+  long key_max;
+  
+  /*
+   * The initial and maximum allocations of the value buffer, in bytes.
+   * 
+   * The value buffer holds string data, including a terminating nul,
+   * so the longest string is one byte less than the maximum.  In
+   * SNMODE_CHUNK mode, this bounds the data in a STRING_CHUNK entity,
+   * and it should be at least five so that any codepoint fits in an
+   * empty chunk, or six with SNMODE_UNESCAPE.  The defaults are 256
+   * and 65535.
+   */
+  long value_init;
+  long value_max;
+  
+  /*
+   * The initial and maximum allocations of the array and group stacks,
+   * in elements.
+   * 
+   * This limits how deeply arrays can be nested.  The group stack
+   * holds one more element than there are open arrays, so arrays can
+   * be nested one level less deep than the maximum.  The defaults are
+   * 8 and 1024.
+   */
+  long nest_init;
+  long nest_max;
+
+} SNLIMITS;
+
+/*
+ * Structure for specifying a memory allocator.
+ * 
+ * Use with snparser_allocwith() and the snsource_ functions that end
+ * in "with" to route all memory that a parser or source allocates
+ * through the given callbacks, for example to draw it from an arena
+ * that is released all at once, or to count allocations.
+ * 
+ * All callbacks receive the custom pointer as their first argument.
+ * Sizes are in bytes and are always greater than zero.
+ * 
+ * alloc_func allocates a block of memory of the given size.  It
+ * returns NULL if the memory can not be allocated.
+ * 
+ * realloc_func changes the size of a block of memory from old_size to
+ * new_size, preserving its contents up to the smaller of the two sizes.
+ * It returns a pointer to the resized block, which may have moved, or
+ * NULL if the block can not be resized, in which case the old block
+ * must remain allocated and unchanged.  This may be NULL, in which case
+ * blocks are resized by allocating a new block, copying the data, and
+ * freeing the old block.
+ * 
+ * free_func releases a block of memory.  size is the size that the
+ * block was allocated or last resized with.
+ * 
+ * alloc_func and free_func may not be NULL.
+ * 
+ * When memory can not be allocated, constructors return NULL, and
+ * parsers return SNERR_NOMEM errors.  The standard allocator that is
+ * used when no allocator is given uses malloc(), realloc(), and free(),
+ * and faults if memory runs out.
+ */
+typedef struct {
+  void *(*alloc_func)(void *custom, size_t size);
+  void *(*realloc_func)(void *custom, void *p,
+                        size_t old_size, size_t new_size);
+  void (*free_func)(void *custom, void *p, size_t size);
+  void *custom;
+} SNALLOC;
+
+/*
+ * Structure for a document parsed by a parser pool.
+ * 
+ * This is passed to the document callback of snpool_sources() and
+ * snpool_stream().  It and everything it points to is only valid
+ * until the callback returns.
+ */
+typedef struct {
+  
+  /*
+   * The index of the document.
+   * 
+   * For snpool_sources(), this is the index of the source in the
+   * array.  For snpool_stream(), this counts the documents in the
+   * stream, starting at zero.
+   */
+  long index;
+  
+  /*
+   * The index of the worker that parsed the document.
+   * 
+   * This is in range zero up to but excluding the number of threads of
+   * the pool.  Worker zero runs on the thread that started the run.
+   * Clients can use this to keep separate state for each worker.
+   */
+  int worker;
+  
+  /*
+   * The entities of the document.
+   * 
+   * These are the entities that snparser_read() would return for the
+   * document, in order.  The last entity is always the EOF entity or an
+   * error, and there is always at least one entity.  The strings of
+   * the entities are copies that stay valid while the callback runs.
+   */
+  const SNENTITY *pEntities;
+  
+  /*
+   * The line count after each entity.
+   * 
+   * This is what snparser_count() would return right after reading
+   * each entity.
+   */
+  const long *pLines;
+  
+  /*
+   * The number of entities.
+   */
+  long count;
+
+} SNDOC;
+
+/*
+ * Function pointer type for entity handlers of snparser_dispatch().
+ * 
+ * The handler is called with the custom pointer of the handler table
+ * and the entity.  The entity and its strings are only valid until the
+ * handler returns.
+ * 
+ * The handler returns non-zero to continue parsing, or zero to stop
+ * snparser_dispatch().
+ */
+typedef int (*SNHANDLER)(void *custom, const SNENTITY *pEntity);
+
+/*
+ * Structure for a table of entity handlers for snparser_dispatch().
+ */
+typedef struct {
+  
+  /*
+   * The handler for each entity type, indexed by the SNENTITY constant.
+   * 
+   * Entities whose handler is NULL are skipped.  The handler for
+   * SNENTITY_EOF is called once when the end of the document is
+   * reached.
+   */
+  SNHANDLER entity_func[SNENTITY_KINDS];
+  
+  /*
+   * Handlers for OPERATION entities, indexed by symbol ID minus one.
+   * 
+   * If op_count is greater than zero, pOps points to an array of
+   * op_count handlers.  An OPERATION entity whose symbol ID is in range
+   * one up to and including op_count is passed to the handler at index
+   * symbol ID minus one, if that handler is not NULL.  All other
+   * OPERATION entities go to the SNENTITY_OPERATION handler of
+   * entity_func.  Since there are no symbol IDs unless the parser has a
+   * symbol table, this is meant to be used together with the known
+   * names given to snparser_symbols().  pOps may be NULL if op_count is
+   * zero.
+   */
+  const SNHANDLER *pOps;
+  long op_count;
+  
+  /*
+   * The custom pointer passed to each handler.
+   */
+  void *custom;
+
+} SNHANDLERS;
+
+/*
+ * Structure for the statistics of a parser.
+ * 
+ * Use snparser_stats() to get the statistics.  Parsers only collect
+ * statistics if the library was built with SHASTINA_STATS defined.
+ * Otherwise, the counting compiles away to nothing and all fields are
+ * zero.
+ * 
+ * The counts cover everything that the parser has read since it was
+ * allocated or since the statistics were last cleared, across any
+ * number of snparser_reset() calls.  All counts stop at LONG_MAX.
+ */
+typedef struct {
+  
+  /*
+   * The number of bytes of input consumed from sources.
+   */
+  long bytes;
+  
+  /*
+   * The number of codepoints passed through the input filter.
+   * 
+   * A CR+LF pair counts as a single codepoint, as does a surrogate
+   * pair.  For tokens taken from parallel tokenization, this counts
+   * the UTF-8 sequences the token spans, leaving out CR characters.
+   */
+  long codepoints;
+  
+  /*
+   * The number of tokens read, by kind of token.
+   * 
+   * tok_simple counts simple tokens and tok_string counts string
+   * literals.  tok_final counts the final |; token, which is read once
+   * per document.  Entities replayed from an entity cache do not
+   * involve any tokens.
+   */
+  long tok_simple;
+  long tok_string;
+  long tok_final;
+  
+  /*
+   * The number of entities returned, indexed by the SNENTITY constant.
+   * 
+   * The EOF entity is only counted the first time it is returned after
+   * each reset, and errors are not counted at all.
+   */
+  long entities[SNENTITY_KINDS];
+  
+  /*
+   * The number of times the key and value buffers of the reader have
+   * been grown after their initial allocation.
+   */
+  long buf_grows;
+  
+  /*
+   * The greatest capacity in bytes that the key and value buffers have
+   * each had.
+   */
+  long key_peak;
+  long value_peak;
+  
+  /*
+   * The greatest depth of the array and group stacks of the reader.
+   * 
+   * The group stack holds one more level than the array stack while
+   * parsing, for the outermost level of groups.
+   */
+  long array_peak;
+  long group_peak;
+  
+  /*
+   * Time spent in the parser stages, in ticks of the stage clock.
+   * 
+   * These are only collected if the library was also built with
+   * SHASTINA_STATS_TIME defined, and they are zero otherwise.  The
+   * stage clock is clock() unless the build defines SNSTATS_CLOCK() as
+   * some other expression, such as a cycle counter.
+   * 
+   * clk_token is the time spent reading tokens, which includes reading
+   * the source and passing it through the input filter, since those
+   * stages run interleaved with the tokenizer.  clk_reader is the time
+   * spent turning tokens into entities, leaving out clk_token.  Timing
+   * every token is intrusive, so these are best used to compare stages
+   * rather than to measure overall throughput.
+   */
+  long clk_token;
+  long clk_reader;
+
+} SNSTATS;
+
 /*
  * Simple wrapper around snsource_stream().
  * 
@@ -237,6 +778,111 @@ SNSOURCE *snsource_file(FILE *pFile, int owner);
  */
 SNSOURCE *snsource_stream(FILE *pFile, int flags);
 
+/*
+ * Allocate a Shastina source that wraps a stdio FILE handle, using a
+ * given memory allocator.
+ * 
+ * This is the same as snsource_stream(), except that the memory of the
+ * source is allocated through pAlloc, and NULL is returned if memory
+ * can not be allocated.  In that case, the file handle is not closed,
+ * even if the OWNER flag was given.  pAlloc may be NULL to use the
+ * standard allocator.  See the SNALLOC structure for further
+ * information.  The structure is copied, so it need not remain
+ * allocated after the call.
+ * 
+ * Parameters:
+ * 
+ *   pFile - the file handle to wrap
+ * 
+ *   flags - combination of SNSTREAM flags
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source wrapping the file handle, or NULL if memory
+ *   could not be allocated
+ */
+SNSOURCE *snsource_streamwith(
+    FILE          * pFile,
+    int             flags,
+    const SNALLOC * pAlloc);
+
+/*
+ * Allocate a Shastina source that reads a POSIX file descriptor in
+ * large blocks.
+ * 
+ * fd is the file descriptor to read, which must be open for reading.
+ * Nothing besides the allocated Shastina source should use the file
+ * descriptor while the source object is allocated or undefined behavior
+ * occurs.
+ * 
+ * flags is a combination of SNSTREAM flags, or SNSTREAM_NORMAL (zero).
+ * See the documentation of the SNSTREAM constants for further
+ * information.  Unrecognized flags are ignored.  With the OWNER flag,
+ * the file descriptor is closed when the source is freed.  With the
+ * RANDOM flag, multipass is supported, and the source seeks in the
+ * file with lseek() when it is rewound or when snparser_seek() moves
+ * it.  With the AHEAD flag, a background thread reads the next block
+ * while the parser works on the current one, so that waiting for the
+ * file overlaps with parsing.
+ * 
+ * Unlike snsource_stream(), which reads a byte at a time through
+ * stdio, this source reads the file with read() a quarter megabyte at
+ * a time into page-aligned buffers, and the parser takes the bytes out
+ * of those buffers in bulk.  The kernel is told with posix_fadvise()
+ * that the file is read sequentially.  Since the source reads ahead,
+ * the file position after the |; EOF token is not right after the
+ * token, but snsource_bytes() and snsource_consume() still work from
+ * the byte immediately after the semicolon, as for snsource_block().
+ * 
+ * File descriptors are only supported if the library was compiled with
+ * SHASTINA_POSIX defined.  Otherwise, this function always returns
+ * NULL.
+ * 
+ * The returned source object should eventually be freed with
+ * snsource_free().
+ * 
+ * Parameters:
+ * 
+ *   fd - the file descriptor to read
+ * 
+ *   flags - combination of SNSTREAM flags
+ * 
+ * Return:
+ * 
+ *   a new Shastina source reading the file descriptor, or NULL if the
+ *   library was compiled without SHASTINA_POSIX, if memory could not be
+ *   allocated, or if the background thread could not be started
+ */
+SNSOURCE *snsource_fd(int fd, int flags);
+
+/*
+ * Allocate a Shastina source that reads a POSIX file descriptor in
+ * large blocks, using a given memory allocator.
+ * 
+ * This is the same as snsource_fd(), except that the memory of the
+ * source, including its buffers, is allocated through pAlloc.  pAlloc
+ * may be NULL to use the standard allocator.  See the SNALLOC structure
+ * for further information.  The structure is copied, so it need not
+ * remain allocated after the call.  If NULL is returned, the file
+ * descriptor is not closed, even if the OWNER flag was given.
+ * 
+ * Parameters:
+ * 
+ *   fd - the file descriptor to read
+ * 
+ *   flags - combination of SNSTREAM flags
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source reading the file descriptor, or NULL if it
+ *   could not be allocated
+ */
+SNSOURCE *snsource_fdwith(int fd, int flags, const SNALLOC *pAlloc);
+
 /*
  * Allocate a Shastina source that wraps a nul-terminated string.
  * 
@@ -248,7 +894,9 @@ SNSOURCE *snsource_stream(FILE *pFile, int flags);
  * is not included in the bytes that are read through the source.
  * 
  * Calls to read from the Shastina source will read bytes from the given
- * string.  String sources have full support for multipass.
+ * string.  String sources have full support for multipass.  The whole
+ * string is held as one contiguous buffer, so rewinding is free, and
+ * the string data is available through snsource_buffer().
  * 
  * The returned source object should eventually be freed with
  * snsource_free().
@@ -277,31 +925,204 @@ SNSOURCE *snsource_stream(FILE *pFile, int flags);
 SNSOURCE *snsource_string(const char *pStr);
 
 /*
- * Allocate a custom Shastina source.
+ * Allocate a Shastina source that wraps a nul-terminated string, using
+ * a given memory allocator.
  * 
- * This is the most flexible Shastina source constructor, which allows
- * you full control over how the Shastina source works.  The other
- * snsource_file() and snsource_string() constructors are much easier to
- * use, but more limited.
+ * This is the same as snsource_string(), except that the memory of the
+ * source is allocated through pAlloc, and NULL is returned if memory
+ * can not be allocated.  pAlloc may be NULL to use the standard
+ * allocator.  See the SNALLOC structure for further information.  The
+ * structure is copied, so it need not remain allocated after the call.
  * 
- * read_func is a function pointer to a callback function.  It may not
- * be NULL.  The void pointer it takes will always be the same as the
- * custom parameter passed to this constructor function.  The read
- * function should return the unsigned byte value (0-255) of the next
- * byte from the input source, or SNERR_EOF if End Of File (EOF) has
- * been reached, or SNERR_IOERR if there was an I/O error reading the
- * input source.
+ * Parameters:
  * 
- * Once the callback function has returned SNERR_EOF or SNERR_IOERR, it
- * will not be called again.  However, multipass sources can clear the
- * SNERR_EOF condition by rewinding.
+ *   pStr - the nul-terminated string to wrap
  * 
- * free_func is a function pointer to a destructor function, or NULL if
- * no destructor function is required.
+ *   pAlloc - the memory allocator, or NULL
  * 
- * If free_func is not NULL, then it will be called immediately before
- * releasing the Shastina source object, with the void pointer set to
- * the custom parameter passed to this constructor function.  The
+ * Return:
+ * 
+ *   a new Shastina source wrapping the string, or NULL if memory could
+ *   not be allocated
+ */
+SNSOURCE *snsource_stringwith(const char *pStr, const SNALLOC *pAlloc);
+
+/*
+ * Allocate a Shastina source that holds a whole file in memory.
+ * 
+ * pPath is the path to the file to read.
+ * 
+ * If the library was compiled with SHASTINA_POSIX defined, the file is
+ * mapped into memory with mmap() when possible.  Otherwise, or if the
+ * file can not be mapped, the whole file is read into a dynamically
+ * allocated buffer using standard I/O.  Either way, the complete input
+ * is available as one contiguous buffer through snsource_buffer().
+ * 
+ * The file is completely loaded or mapped during construction, and the
+ * file is not otherwise held open.  If the file is mapped, it should
+ * not be modified while the source is allocated, or undefined behavior
+ * occurs.
+ * 
+ * Mapped file sources have full support for multipass.  Rewinding just
+ * resets the read position back to the start of the buffer.
+ * 
+ * Unlike string sources, nul bytes in the file do not end the input.
+ * They are read through the source like any other byte.
+ * 
+ * The returned source object should eventually be freed with
+ * snsource_free(), which will release the file data.
+ * 
+ * The function fails if the file can not be opened, can not be read,
+ * or is too large for its size in bytes to fit in a long.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file
+ * 
+ * Return:
+ * 
+ *   a new Shastina source holding the file data, or NULL if the file
+ *   could not be loaded
+ */
+SNSOURCE *snsource_map(const char *pPath);
+
+/*
+ * Allocate a Shastina source that holds a whole file in memory, using a
+ * given memory allocator.
+ * 
+ * This is the same as snsource_map(), except that the memory of the
+ * source, including the buffer that the file is read into if it is not
+ * mapped, is allocated through pAlloc.  NULL is returned if memory can
+ * not be allocated, as well as if the file can not be loaded.  pAlloc
+ * may be NULL to use the standard allocator.  See the SNALLOC
+ * structure for further information.  The structure is copied, so it
+ * need not remain allocated after the call.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the file to load
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source holding the file, or NULL if the file could
+ *   not be loaded or memory could not be allocated
+ */
+SNSOURCE *snsource_mapwith(const char *pPath, const SNALLOC *pAlloc);
+
+/*
+ * Allocate a Shastina source that replays an entity cache file.
+ * 
+ * Entity caches are written by snparser_writecache().  They hold all
+ * the entities of a parsed source in a compact binary form, so that
+ * they can be read back much faster than parsing the source again.
+ * 
+ * The returned source is used with snparser_read() and the other
+ * parser functions just like any other source.  Instead of tokenizing
+ * any input, the parser replays the cached entities one by one, in the
+ * same order, with the same line counts from snparser_count(), and
+ * ending with the same EOF entity or error as the original parse.  The
+ * entities are replayed as they were written, so the mode of the
+ * parser has no effect on them.  A parser that has read from another
+ * source should be reset with snparser_reset() before reading from a
+ * cache source, and the other way around.
+ * 
+ * The strings of replayed entities point directly into the cache data.
+ * They are always null-terminated, and unlike with other sources, they
+ * remain valid until the source is freed.
+ * 
+ * The file is completely loaded during construction in the same way as
+ * for snsource_map(), so with SHASTINA_POSIX, the cache is usually
+ * mapped into memory and only the part that is replayed is ever read.
+ * 
+ * pCheck is the source that the cache was written from, which must be
+ * a whole source, as for snparser_writecache().  The length and
+ * content hash of its data are compared to those stored in the cache,
+ * and if they differ, the cache is stale and NULL is returned.  pCheck
+ * is not read from and need not remain allocated after the call.  If
+ * pCheck is NULL, the cache is used without checking it.
+ * 
+ * Cache sources have full support for multipass.  Rewinding starts the
+ * replay over from the first entity.  Cache sources have no bytes to
+ * read, so snsource_buffer() returns NULL for them, and they can not be
+ * used with snpool_stream() or snparser_writecache().
+ * 
+ * If the cache data turns out to be corrupt during replay, an
+ * SNERR_IOERR error is returned as the final entity.
+ * 
+ * The returned source object should eventually be freed with
+ * snsource_free(), which will release the cache data.
+ * 
+ * The function fails if the file can not be loaded, if it is not a
+ * valid entity cache, or if it is stale.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the cache file
+ * 
+ *   pCheck - the source the cache was written from, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source replaying the cache, or NULL if the cache
+ *   could not be loaded or is stale
+ */
+SNSOURCE *snsource_cache(const char *pPath, SNSOURCE *pCheck);
+
+/*
+ * Allocate a Shastina source that replays an entity cache file, using
+ * a given memory allocator.
+ * 
+ * This is the same as snsource_cache(), except that the memory of the
+ * source is allocated through pAlloc, in the same way as for
+ * snsource_mapwith().  NULL is also returned if memory can not be
+ * allocated.  pAlloc may be NULL to use the standard allocator.
+ * 
+ * Parameters:
+ * 
+ *   pPath - the path to the cache file
+ * 
+ *   pCheck - the source the cache was written from, or NULL
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source replaying the cache, or NULL if the cache
+ *   could not be loaded, is stale, or memory could not be allocated
+ */
+SNSOURCE *snsource_cachewith(
+    const char    * pPath,
+    SNSOURCE      * pCheck,
+    const SNALLOC * pAlloc);
+
+/*
+ * Allocate a custom Shastina source.
+ * 
+ * This is the most flexible Shastina source constructor, which allows
+ * you full control over how the Shastina source works.  The other
+ * snsource_file() and snsource_string() constructors are much easier to
+ * use, but more limited.
+ * 
+ * read_func is a function pointer to a callback function.  It may not
+ * be NULL.  The void pointer it takes will always be the same as the
+ * custom parameter passed to this constructor function.  The read
+ * function should return the unsigned byte value (0-255) of the next
+ * byte from the input source, or SNERR_EOF if End Of File (EOF) has
+ * been reached, or SNERR_IOERR if there was an I/O error reading the
+ * input source.
+ * 
+ * Once the callback function has returned SNERR_EOF or SNERR_IOERR, it
+ * will not be called again.  However, multipass sources can clear the
+ * SNERR_EOF condition by rewinding.
+ * 
+ * free_func is a function pointer to a destructor function, or NULL if
+ * no destructor function is required.
+ * 
+ * If free_func is not NULL, then it will be called immediately before
+ * releasing the Shastina source object, with the void pointer set to
+ * the custom parameter passed to this constructor function.  The
  * destructor may be used for freeing whatever is pointed to by the
  * custom parameter.  If this is not needed, use NULL for the
  * destructor.
@@ -344,6 +1165,224 @@ SNSOURCE *snsource_custom(
     int (*rewind_func)(void *),
     void *custom);
 
+/*
+ * Allocate a Shastina source that uses custom callbacks, using a given
+ * memory allocator.
+ * 
+ * This is the same as snsource_custom(), except that the memory of the
+ * source is allocated through pAlloc, and NULL is returned if memory
+ * can not be allocated.  In that case, free_func is not called.
+ * pAlloc may be NULL to use the standard allocator.  See the SNALLOC
+ * structure for further information.  The structure is copied, so it
+ * need not remain allocated after the call.
+ * 
+ * Parameters:
+ * 
+ *   read_func - the read callback
+ * 
+ *   free_func - the destructor callback, or NULL
+ * 
+ *   rewind_func - the multipass rewind callback, or NULL
+ * 
+ *   custom - the custom data, which may be NULL
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source, or NULL if memory could not be allocated
+ */
+SNSOURCE *snsource_customwith(
+    int (*read_func)(void *),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom,
+    const SNALLOC *pAlloc);
+
+/*
+ * Allocate a custom Shastina source that reads blocks of bytes.
+ * 
+ * This is a companion to snsource_custom() for sources that can supply
+ * many bytes at a time.  The source keeps an internal window buffer
+ * that is filled through the read callback, and the parser consumes
+ * bytes directly out of that window.  This avoids the overhead of
+ * invoking a callback for every byte of input, which matters for large
+ * inputs.
+ * 
+ * read_func is a function pointer to a callback function.  It may not
+ * be NULL.  The void pointer it takes will always be the same as the
+ * custom parameter passed to this constructor function.  The unsigned
+ * char pointer is a buffer to fill, and the long parameter is the
+ * maximum number of bytes to write into the buffer, which is always
+ * greater than zero.  The read function should write at least one and
+ * at most that many bytes into the buffer and return how many bytes it
+ * wrote.  Short reads are fine.  If End Of File (EOF) has been reached,
+ * the read function should instead return SNERR_EOF, and if there was
+ * an I/O error, it should return SNERR_IOERR.  Returning zero or a
+ * value above the requested maximum causes a fault.
+ * 
+ * Once the callback function has returned SNERR_EOF or SNERR_IOERR, it
+ * will not be called again.  However, multipass sources can clear the
+ * SNERR_EOF condition by rewinding.
+ * 
+ * free_func, rewind_func, and custom have the same meaning as for
+ * snsource_custom().  Rewinding discards anything that remains in the
+ * internal window before calling through to rewind_func.
+ * 
+ * Since the source reads ahead in blocks, the data that was delivered
+ * through the callback may extend beyond the |; EOF token.  However,
+ * snsource_bytes() only counts the bytes that were actually consumed
+ * from the window, so after reading the |; EOF token it will still
+ * count the bytes up to and including the semicolon, and
+ * snsource_consume() will continue from the byte immediately after the
+ * semicolon.
+ * 
+ * The returned source object should eventually be freed with
+ * snsource_free().
+ * 
+ * Parameters:
+ * 
+ *   read_func - the block read callback
+ * 
+ *   free_func - the destructor callback, or NULL
+ * 
+ *   rewind_func - the multipass rewind callback, or NULL
+ * 
+ *   custom - the custom data, which may be NULL
+ * 
+ * Return:
+ * 
+ *   a new, custom Shastina block source
+ */
+SNSOURCE *snsource_block(
+    long (*read_func)(void *, unsigned char *, long),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom);
+
+/*
+ * Allocate a Shastina source that reads blocks through custom
+ * callbacks, using a given memory allocator.
+ * 
+ * This is the same as snsource_block(), except that the memory of the
+ * source, including its block buffer, is allocated through pAlloc, and
+ * NULL is returned if memory can not be allocated.  In that case,
+ * free_func is not called.  pAlloc may be NULL to use the standard
+ * allocator.  See the SNALLOC structure for further information.  The
+ * structure is copied, so it need not remain allocated after the call.
+ * 
+ * Parameters:
+ * 
+ *   read_func - the block read callback
+ * 
+ *   free_func - the destructor callback, or NULL
+ * 
+ *   rewind_func - the multipass rewind callback, or NULL
+ * 
+ *   custom - the custom data, which may be NULL
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina source, or NULL if memory could not be allocated
+ */
+SNSOURCE *snsource_blockwith(
+    long (*read_func)(void *, unsigned char *, long),
+    void (*free_func)(void *),
+    int (*rewind_func)(void *),
+    void *custom,
+    const SNALLOC *pAlloc);
+
+/*
+ * Allocate a feed source.
+ * 
+ * Feed sources are for input that arrives in pieces, such as data
+ * received from a non-blocking socket in an event loop.  Instead of
+ * the source pulling bytes from a callback, the client pushes bytes
+ * into the source with snsource_push() as they arrive, and marks the
+ * end of input with snsource_end().
+ * 
+ * When the parser needs input that has not been pushed yet, it returns
+ * an SNERR_MORE error instead of waiting.  Unlike other errors,
+ * SNERR_MORE is not kept by the parser.  The client should push more
+ * input and then call the parser again, which continues where it left
+ * off.  The token that was interrupted is read again from its start,
+ * so the bytes of at most one token are kept in the source between
+ * calls.  SNERR_MORE is only ever returned for feed sources.
+ * 
+ * Feed sources do not support multipass, and they can not be used
+ * with snsource_buffer(), parser pools, or snparser_writecache().
+ * 
+ * The returned source object should eventually be freed with
+ * snsource_free().
+ * 
+ * Return:
+ * 
+ *   a new feed source
+ */
+SNSOURCE *snsource_feed(void);
+
+/*
+ * Allocate a feed source using a given memory allocator.
+ * 
+ * This is the same as snsource_feed(), except that the memory of the
+ * source, including the buffer of pushed bytes, is allocated through
+ * pAlloc, and NULL is returned if memory can not be allocated.  pAlloc
+ * may be NULL to use the standard allocator.  See the SNALLOC structure
+ * for further information.  The structure is copied, so it need not
+ * remain allocated after the call.
+ * 
+ * Parameters:
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new feed source, or NULL if memory could not be allocated
+ */
+SNSOURCE *snsource_feedwith(const SNALLOC *pAlloc);
+
+/*
+ * Push input bytes into a feed source.
+ * 
+ * pSrc must be a feed source allocated with snsource_feed() or
+ * snsource_feedwith(), and snsource_end() must not have been called on
+ * it yet, or a fault occurs.
+ * 
+ * pData points to len bytes of input, which are copied into the
+ * source.  len must be zero or greater, and pData may be NULL only if
+ * len is zero.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the feed source
+ * 
+ *   pData - the input bytes
+ * 
+ *   len - the number of input bytes
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory, in which case
+ *   nothing was pushed
+ */
+int snsource_push(SNSOURCE *pSrc, const char *pData, long len);
+
+/*
+ * Mark the end of input for a feed source.
+ * 
+ * pSrc must be a feed source, or a fault occurs.  After this call, the
+ * end of the pushed bytes is End Of File, so the parser no longer
+ * returns SNERR_MORE for the source, and no more bytes may be pushed.
+ * Calling this function more than once has no further effect.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the feed source
+ */
+void snsource_end(SNSOURCE *pSrc);
+
 /*
  * Free a Shastina source.
  * 
@@ -427,6 +1466,12 @@ long snsource_bytes(SNSOURCE *pSrc);
  * You may call this on a source that has already reached EOF, in which
  * case this function will just return greater than zero.
  * 
+ * For feed sources, SNERR_MORE is returned if only whitespace and
+ * blank lines were found before the end of the pushed bytes, but
+ * snsource_end() has not been called yet.  The whitespace that was
+ * found is consumed, so the function can be called again after more
+ * bytes have been pushed.
+ * 
  * Parameters:
  * 
  *   pSrc - the Shastina source object
@@ -437,7 +1482,7 @@ long snsource_bytes(SNSOURCE *pSrc);
  *   source and nothing besides whitespace and blank lines remained,
  *   SNERR_TRAILER if something besides whitespace and blank lines was
  *   encountered, SNERR_IOERR if there was an I/O error reading from the
- *   source object
+ *   source object, SNERR_MORE if a feed source needs more input
  */
 int snsource_consume(SNSOURCE *pSrc);
 
@@ -481,6 +1526,86 @@ int snsource_ismulti(SNSOURCE *pSrc);
  */
 int snsource_rewind(SNSOURCE *pSrc);
 
+/*
+ * Get direct access to the complete input data of a Shastina source.
+ * 
+ * This is only supported for sources that hold their whole input as
+ * one contiguous buffer in memory, which are string sources constructed
+ * with snsource_string() and file sources constructed with
+ * snsource_map().  For all other sources, NULL is returned.
+ * 
+ * pLen points to a variable to receive the number of bytes in the
+ * buffer, or it may be NULL if the length is not needed.  If NULL is
+ * returned, the length is set to zero.
+ * 
+ * The returned pointer is to the beginning of the input data, which
+ * does not depend on how many bytes have been read through the source.
+ * The data is not necessarily nul-terminated, so use the length.  The
+ * pointer remains valid until the source is freed.  The client should
+ * not modify the data at the pointer.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the Shastina source object
+ * 
+ *   pLen - pointer to variable to receive the length, or NULL
+ * 
+ * Return:
+ * 
+ *   pointer to the input data, or NULL if the source does not hold its
+ *   whole input in memory
+ */
+const char *snsource_buffer(SNSOURCE *pSrc, long *pLen);
+
+/*
+ * Find the line and column of a byte offset in a Shastina source.
+ * 
+ * This is only supported for sources that hold their whole input in
+ * memory, the same as for snsource_buffer().  offset is a byte offset
+ * in the input data, such as the offset field of an entity, which must
+ * be in range zero up to and including the length of the input data.
+ * 
+ * Lines are counted the same way as snparser_count() counts them, so
+ * the first line is line one and each LF starts a new line.  Columns
+ * count Unicode codepoints from the start of the line, and the first
+ * column is column one.  A UTF-8 Byte Order Mark at the start of the
+ * input is not counted.
+ * 
+ * Entity offsets are cheap to record, so this function does all the
+ * work of finding positions, and only when it is called.  The
+ * first call builds an index of the line breaks in the whole input,
+ * and then each call only needs to look up the line in the index and
+ * count the codepoints before the offset in the line.  The index is
+ * released along with the source.  If there is not enough memory for
+ * the index, then the line breaks before the offset are counted on
+ * each call instead.
+ * 
+ * Since the index is stored in the source, this function must not be
+ * called at the same time on different threads with the same source.
+ * 
+ * Parameters:
+ * 
+ *   pSrc - the Shastina source object
+ * 
+ *   offset - the byte offset to locate
+ * 
+ *   pLine - pointer to variable to receive the line number
+ * 
+ *   pCol - pointer to variable to receive the column number
+ * 
+ * If the function fails, both the line and the column are set to zero.
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the source does not hold its whole
+ *   input in memory or the offset is out of range
+ */
+int snsource_locate(
+    SNSOURCE * pSrc,
+    long       offset,
+    long     * pLine,
+    long     * pCol);
+
 /*
  * Allocate a new Shastina parser.
  * 
@@ -493,43 +1618,365 @@ int snsource_rewind(SNSOURCE *pSrc);
 SNPARSER *snparser_alloc(void);
 
 /*
- * Free a Shastina parser.
+ * Allocate a new Shastina parser with specific buffer limits.
  * 
- * This call is ignored if NULL is passed.
+ * pLimits points to the limits to use, or it may be NULL to use the
+ * defaults, in which case this is the same as snparser_alloc().  See
+ * the SNLIMITS structure for further information.  The structure is
+ * only read during this call.
  * 
- * The parser object must not be used again after freeing it.
+ * Each maximum must be at least as great as its initial allocation, or
+ * a fault occurs.  A fault also occurs if a buffer or stack at its
+ * maximum allocation would take more than 2147483647 bytes, or more
+ * than 65535 bytes on platforms where size_t is less than 32 bits.
+ * 
+ * The parser must eventually be freed with snparser_free().
  * 
  * Parameters:
  * 
- *   pParser - the parser object to free or NULL
+ *   pLimits - the buffer limits, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina parser
  */
-void snparser_free(SNPARSER *pParser);
+SNPARSER *snparser_alloclimits(const SNLIMITS *pLimits);
 
 /*
- * Parse an entity from a Shastina source file.
+ * Allocate a new Shastina parser with specific buffer limits, using a
+ * given memory allocator.
+ * 
+ * This is the same as snparser_alloclimits(), except that all memory
+ * of the parser is allocated through pAlloc, including the buffers
+ * that grow while parsing and the arena of snparser_readbatch().  NULL
+ * is returned if the parser structure can not be allocated.  If memory
+ * can not be allocated while parsing, the parser returns an
+ * SNERR_NOMEM error instead.  pAlloc may be NULL to use the standard
+ * allocator.  See the SNALLOC structure for further information.  The
+ * structure is copied, so it need not remain allocated after the call.
  * 
- * pParser is the parser object.
+ * Parameters:
  * 
- * pEntity is the entity structure that will be filled in.  Its state
- * upon entry to the function is irrelevant.  Upon return, it will hold
- * the results of the operation.  See the structure documentation for
- * further information.
+ *   pLimits - the buffer limits, or NULL
  * 
- * pIn is the input source to read from.
+ *   pAlloc - the memory allocator, or NULL
  * 
- * Once an error is encountered, the parser object will return that same
- * error each time this function is called without doing anything
- * further.
+ * Return:
  * 
- * Once the End Of File (EOF) entity is returned, this function will
- * return the EOF entity on all subsequent calls without doing anything
- * further.
+ *   a new Shastina parser, or NULL if memory could not be allocated
+ */
+SNPARSER *snparser_allocwith(
+    const SNLIMITS * pLimits,
+    const SNALLOC  * pAlloc);
+
+/*
+ * Place a new Shastina parser in a block of memory given by the
+ * client.
+ * 
+ * This is the same as snparser_alloclimits(), except that the parser
+ * structure and everything the parser allocates while parsing are
+ * taken from the size bytes at pMem, so the parser never allocates any
+ * memory of its own.  The block may be static storage or on the stack,
+ * which makes the parser suitable for paths where calls to malloc()
+ * cost too much.
+ * 
+ * The block is a fixed budget.  If it runs out while parsing, the
+ * parser returns an SNERR_NOMEM error, just as with a custom allocator
+ * that runs out of memory.  The array and group stacks of the parser
+ * are kept inside the parser structure until arrays are nested more
+ * than a few levels deep, so they normally don't use any of the
+ * budget.  Use snparser_placesize() to find a size that is enough to
+ * parse typical documents.  Larger strings and deeper nesting take more
+ * of the budget as the buffers grow, up to the limits given by
+ * pLimits.
+ * 
+ * pMem must be aligned for any type, as memory from malloc() is, and
+ * it must remain allocated while the parser is in use.  NULL is
+ * returned if size is too small to hold the parser structure.
+ * 
+ * The parser may be freed with snparser_free(), but it doesn't need to
+ * be, since everything it uses is in the block.  Once the parser is no
+ * longer in use, the block can simply be reused for something else.
  * 
  * Parameters:
  * 
- *   pReader - the reader object
+ *   pMem - the block of memory
  * 
- *   pEntity - pointer to the entity to receive the results
+ *   size - the size of the block in bytes
+ * 
+ *   pLimits - the buffer limits, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina parser in the block, or NULL if the block is too
+ *   small
+ */
+SNPARSER *snparser_place(
+    void           * pMem,
+    long             size,
+    const SNLIMITS * pLimits);
+
+/*
+ * Return the size of memory block that snparser_place() needs for a
+ * parser to parse typical documents.
+ * 
+ * This is enough for the parser structure and for the initial
+ * allocations of its buffers under the limits given by pLimits, which
+ * may be NULL to use the defaults.  A parser placed in a block of this
+ * size parses any document whose strings and tokens fit in the initial
+ * buffers and whose arrays are nested no deeper than the initial
+ * allocation of the stacks.  Give more memory to allow for more.
+ * Memory for snparser_readbatch() and snparser_symbols() also comes
+ * out of the block, and it is not included.
+ * 
+ * Parameters:
+ * 
+ *   pLimits - the buffer limits, or NULL
+ * 
+ * Return:
+ * 
+ *   the size of memory block in bytes
+ */
+long snparser_placesize(const SNLIMITS *pLimits);
+
+/*
+ * Free a Shastina parser.
+ * 
+ * This call is ignored if NULL is passed.
+ * 
+ * The parser object must not be used again after freeing it.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object to free or NULL
+ */
+void snparser_free(SNPARSER *pParser);
+
+/*
+ * Reset a Shastina parser so that it can parse another document.
+ * 
+ * Parsing stops right after the |; token that ends a Shastina document,
+ * so several documents can follow each other in one source.  After the
+ * EOF entity of one document has been read, reset the parser and then
+ * keep reading from the same source to parse the next document.  The
+ * parser may also be reset after an error, but parsing then resumes
+ * wherever the error left the source, which is usually in the middle
+ * of the failed document.
+ * 
+ * The reset returns the parser to the state of a newly allocated
+ * parser, except that the buffers it has already allocated are kept
+ * for reuse, the limits it was allocated with still apply, and the mode
+ * set with snparser_mode() remains in effect.  Any error state is
+ * cleared.  Entity strings that were returned before the reset,
+ * including those in batches read with snparser_readbatch(), are no
+ * longer valid after the reset.
+ * 
+ * flags is a combination of SNRESET flags, or SNRESET_NORMAL (zero) if
+ * no flags are required.  See the documentation of the SNRESET
+ * constants for further information.  Unrecognized flags are ignored.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   flags - combination of SNRESET flags
+ */
+void snparser_reset(SNPARSER *pParser, int flags);
+
+/*
+ * Set the mode flags of a Shastina parser.
+ * 
+ * flags is a combination of SNMODE flags, or SNMODE_NORMAL (zero) if no
+ * flags are required.  See the documentation of the SNMODE constants
+ * for further information.  Unrecognized flags are ignored.  The mode
+ * of a newly allocated parser is SNMODE_NORMAL.
+ * 
+ * The mode may be changed at any time.  The new mode applies to tokens
+ * that are read after the call.  A chunked string that is in progress
+ * is always finished in chunks, even if SNMODE_CHUNK is cleared.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   flags - combination of SNMODE flags
+ */
+void snparser_mode(SNPARSER *pParser, int flags);
+
+/*
+ * Set which kinds of entities a Shastina parser returns.
+ * 
+ * mask is a combination of SNMASK() bits for the kinds of entities
+ * that are wanted.  The mask of a newly allocated parser is SNMASK_ALL.
+ * Bits of unknown kinds are ignored, and the EOF entity is always
+ * returned, whether or not its bit is set.  The mask is kept by
+ * snparser_reset().
+ * 
+ * Entities of the other kinds are still parsed and checked in full, so
+ * that exactly the same errors are reported at the same places, but
+ * they are passed over instead of being returned by snparser_read(),
+ * snparser_readbatch(), and snparser_dispatch().  The string data of a
+ * string token is also scanned without being buffered at all if the
+ * entity that would hold it is not wanted.  That is the STRING or
+ * META_STRING entity, and in SNMODE_CHUNK mode also the STRING_CHUNK
+ * entities.  Such strings still count against the size of the value
+ * buffer, so they still cause SNERR_LONGSTR errors where they would
+ * otherwise.  For example, masking out SNENTITY_META_STRING lets a
+ * client pass over large metacommand strings it has no use for without
+ * copying them.
+ * 
+ * The mask applies to entities that are read after the call, and it
+ * also applies to entity cache sources.  It does not apply to
+ * snparser_writecache(), which always caches every entity.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   mask - combination of SNMASK() bits
+ */
+void snparser_mask(SNPARSER *pParser, long mask);
+
+/*
+ * Enable or disable parallel tokenization for a Shastina parser.
+ * 
+ * When parsing a whole source, which is a string or map source (see
+ * snsource_buffer()), the parser can tokenize the input ahead in
+ * chunks on several threads at once.  Each chunk begins right after a
+ * line break.  The tokens are then checked in order against each
+ * other, and wherever the guess that a chunk begins between tokens
+ * turns out to be wrong, the parser falls back to tokenizing
+ * sequentially from there.  The entities, errors, and line numbers are
+ * always exactly the same as those of sequential parsing.
+ * 
+ * threads is the number of chunks tokenized at once, one of which is
+ * tokenized on the calling thread.  A value of one or less disables
+ * parallel tokenization, which is the default for a newly allocated
+ * parser.  chunk is the approximate size of each chunk in bytes, or
+ * zero or less to use a default of 256 KiB.  Parallel tokenization is
+ * only used while at least one chunk of input remains, and it is never
+ * used in SNMODE_CHUNK mode or with sources that are not whole.
+ * 
+ * The library must be built with SHASTINA_THREADS defined for this to
+ * have any effect.  Otherwise, the call is ignored and zero is
+ * returned.  Zero is also returned if threads is one or less, or if
+ * memory for the chunks could not be allocated, in which case
+ * parallel tokenization stays disabled.
+ * 
+ * The memory allocator of the parser is called from several threads at
+ * once while parallel tokenization is enabled, so it must be safe to
+ * use that way.  The standard allocator is.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   threads - the number of threads, or one or less to disable
+ * 
+ *   chunk - the chunk size in bytes, or zero or less for the default
+ * 
+ * Return:
+ * 
+ *   non-zero if parallel tokenization is now enabled, zero if not
+ */
+int snparser_parallel(SNPARSER *pParser, int threads, long chunk);
+
+/*
+ * Enable or disable pipelined reading for a Shastina parser.
+ * 
+ * In pipelined mode, the first time an entity is read from a source,
+ * the parser starts a producer thread that reads the source, decodes
+ * and tokenizes it, and reads the entities ahead of the client.  The
+ * entities are copied into the slots of a ring, and snparser_read(),
+ * snparser_readbatch(), and snparser_dispatch() then take them from
+ * the ring in order, so that the client can work on each entity while
+ * the entities after it are being read.  When the ring is full, the
+ * producer waits for the client to catch up.  The entities, errors,
+ * and line numbers are always exactly the same as without the
+ * pipeline, and snparser_count() gives the line count after the entity
+ * that the client read last, rather than how far the producer has
+ * read.  The strings of the entities are always null-terminated, even
+ * in SNMODE_VIEW mode, and they remain valid until the next entity is
+ * read, the same as without the pipeline.
+ * 
+ * The producer finishes once it has read the EOF entity or an error,
+ * and its thread is joined once the client reads that.  If the error
+ * is SNERR_MORE, a new producer is started by the next read, so feed
+ * sources can be pushed more input as usual.  A producer that is still
+ * running is stopped by snparser_reset(), snparser_seek(), and
+ * snparser_free(), and whatever it has read ahead is discarded, so the
+ * source is then positioned past those entities.
+ * 
+ * While the producer is running, the source belongs to it.  The same
+ * source must be passed to each read until the EOF entity or an error
+ * has been read, and the client may not use the source in any other
+ * way.  snparser_mode(), snparser_mask(), snparser_parallel(),
+ * snparser_pipeline(), snparser_skip(), snparser_stats(),
+ * snparser_writecache(), and snparser_index() may not be called then
+ * either, because they would interfere with the producer.  Call them
+ * before the first read or after the end of the document.
+ * 
+ * If enable is non-zero, the pipeline is enabled with a ring of the
+ * given number of slots, or 256 slots if slots is zero or less.  Each
+ * slot keeps its own buffer for the strings of its entity, which grows
+ * as needed and is reused each time around the ring, so the memory
+ * used for strings is at most about the number of slots times the
+ * sizes of the key and value buffers.  If enable is zero, the pipeline
+ * is disabled, which is the default for a newly allocated parser.
+ * 
+ * The library must be built with SHASTINA_THREADS defined for this to
+ * have any effect.  Otherwise, the call is ignored and zero is
+ * returned, and entities are read sequentially on the calling thread.
+ * Zero is also returned if enable is zero or if memory for the ring
+ * could not be allocated, in which case the pipeline stays disabled.
+ * If the producer thread can not be started, the entities are read
+ * directly on the calling thread instead.
+ * 
+ * The memory allocator of the parser is called from the producer thread
+ * and the calling thread at once while the producer is running, so it
+ * must be safe to use that way.  The standard allocator is.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   enable - non-zero to enable the pipeline, zero to disable it
+ * 
+ *   slots - the number of entities in the ring, or zero or less for
+ *   the default
+ * 
+ * Return:
+ * 
+ *   non-zero if the pipeline is now enabled, zero if not
+ */
+int snparser_pipeline(SNPARSER *pParser, int enable, long slots);
+
+/*
+ * Parse an entity from a Shastina source file.
+ * 
+ * pParser is the parser object.
+ * 
+ * pEntity is the entity structure that will be filled in.  Its state
+ * upon entry to the function is irrelevant.  Upon return, it will hold
+ * the results of the operation.  See the structure documentation for
+ * further information.
+ * 
+ * pIn is the input source to read from.
+ * 
+ * Once an error is encountered, the parser object will return that same
+ * error each time this function is called without doing anything
+ * further.  The exception is SNERR_MORE for feed sources, which is not
+ * kept.  See snsource_feed() for further information.
+ * 
+ * Once the End Of File (EOF) entity is returned, this function will
+ * return the EOF entity on all subsequent calls without doing anything
+ * further.
+ * 
+ * Parameters:
+ * 
+ *   pReader - the reader object
+ * 
+ *   pEntity - pointer to the entity to receive the results
  * 
  *   pIn - the input source
  */
@@ -538,6 +1985,138 @@ void snparser_read(
     SNENTITY * pEntity,
     SNSOURCE * pIn);
 
+/*
+ * Parse a batch of entities from a Shastina source file.
+ * 
+ * pParser is the parser object.
+ * 
+ * pEntities points to an array of at least max entity structures, and
+ * max must be one or greater.  Entities are read with snparser_read()
+ * into the array in order until max entities have been read, or until
+ * an EOF entity or an error has been read.  The EOF entity or error
+ * entity is stored in the array as the last entity of the batch.  The
+ * return value is how many entities were stored, which is always at
+ * least one.
+ * 
+ * Unlike snparser_read(), the key and value strings of all entities in
+ * the batch are copied into an arena that is owned by the parser, so
+ * they all remain valid until the next call to this function or until
+ * the parser is freed.  The strings in the arena are always
+ * null-terminated, even in SNMODE_VIEW mode.  The client should not
+ * modify the data at the pointers.  The fields that an entity does not
+ * use are always NULL or zero, as the SNENTITY documentation says.
+ * 
+ * Since parsing stops at an error, snparser_count() gives the line
+ * number of the error after this function returns an error entity.
+ * 
+ * Calls to this function may be mixed with calls to snparser_read(),
+ * which do not affect the arena.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pEntities - the array to receive the entities
+ * 
+ *   max - the maximum number of entities to read
+ * 
+ *   pIn - the input source
+ * 
+ * Return:
+ * 
+ *   the number of entities stored in the array
+ */
+long snparser_readbatch(
+    SNPARSER * pParser,
+    SNENTITY * pEntities,
+    long       max,
+    SNSOURCE * pIn);
+
+/*
+ * Parse a Shastina source file, passing each entity to a handler.
+ * 
+ * pParser is the parser object and pIn is the input source, as for
+ * snparser_read().
+ * 
+ * pHandlers is the table of handlers.  See the SNHANDLERS structure
+ * for further information.  Entities are read from the source and
+ * passed to their handlers in order, without being copied, until the
+ * end of the document, an error, or a handler that returns zero.  This
+ * gives the same entities as calling snparser_read() in a loop, but
+ * without the overhead of a call and a copy for every entity.
+ * 
+ * Errors are never passed to a handler.  Instead, the error code is
+ * returned, and the parser is then in the same error state that
+ * snparser_read() would leave it in, so snparser_count() gives the line
+ * number of the error.
+ * 
+ * If a handler returns zero, the function returns the entity type of
+ * the entity that was passed to it.  Parsing can then be continued with
+ * another call to this function or with snparser_read(), which begin
+ * at the entity after the one that was passed to the handler.  If the
+ * EOF handler returns zero, SNENTITY_EOF is returned, so that case can
+ * not be told apart from the end of the document.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pIn - the input source
+ * 
+ *   pHandlers - the table of handlers
+ * 
+ * Return:
+ * 
+ *   SNENTITY_EOF (zero) at the end of the document, the entity type
+ *   (greater than zero) if a handler stopped parsing, or the error code
+ *   (less than zero) if there was an error
+ */
+int snparser_dispatch(
+    SNPARSER         * pParser,
+    SNSOURCE         * pIn,
+    const SNHANDLERS * pHandlers);
+
+/*
+ * Skip the rest of the metacommand, group, or array that a Shastina
+ * parser is currently in.
+ * 
+ * pParser is the parser object and pIn is the input source, as for
+ * snparser_read().  pIn may not be an entity cache source.
+ * 
+ * The innermost metacommand, group, or array that is open right after
+ * the last entity that was read is skipped, including the entity that
+ * closes it, so that the next entity read is the one after the
+ * SNENTITY_END_META, SNENTITY_END_GROUP, or SNENTITY_ARRAY entity that
+ * closes it.  Within an array element, the element is not a structure
+ * of its own, so the rest of the whole array is skipped unless a group
+ * is open within the element.
+ * 
+ * The skipped input is scanned without buffering any string data or
+ * returning any entities, using the same bracket, group, and
+ * metacommand tracking as reading the entities one by one would.  All
+ * the same checks are made, so an error is returned if the skipped
+ * input has an error, and the parser is then in the same error state
+ * that snparser_read() would leave it in.  The entity mask set with
+ * snparser_mask() makes no difference to what is skipped.
+ * 
+ * For feed sources, SNERR_MORE is returned if more input is needed to
+ * finish the skip.  Push more input and call this function again to
+ * continue the skip.  Reading entities instead abandons the skip.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pIn - the input source
+ * 
+ * Return:
+ * 
+ *   the entity type that closed the skipped structure, zero if nothing
+ *   was open so that nothing was skipped, or the error code (less than
+ *   zero) if there was an error
+ */
+int snparser_skip(SNPARSER *pParser, SNSOURCE *pIn);
+
 /*
  * Return the current line count.
  * 
@@ -555,6 +2134,954 @@ void snparser_read(
  */
 long snparser_count(SNPARSER *pParser);
 
+/*
+ * Get the statistics of a Shastina parser.
+ * 
+ * The statistics are written to pStats.  See the SNSTATS structure for
+ * what they count.  If clear is non-zero, the statistics are cleared
+ * after they are written, so that the next call only counts what is
+ * read in between.  Clearing sets the peak capacities and depths to the
+ * current capacities and depths.
+ * 
+ * Statistics are only collected if the library was built with
+ * SHASTINA_STATS defined.  Otherwise, pStats is filled with zeros and
+ * zero is returned.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pStats - receives the statistics
+ * 
+ *   clear - non-zero to clear the statistics afterwards
+ * 
+ * Return:
+ * 
+ *   non-zero if statistics are collected, zero if not
+ */
+int snparser_stats(SNPARSER *pParser, SNSTATS *pStats, int clear);
+
+/*
+ * Give a parser a symbol table for the names in entities.
+ * 
+ * Once a parser has a symbol table, snparser_read() and
+ * snparser_readbatch() set the symbol field of OPERATION, VARIABLE,
+ * CONSTANT, ASSIGN, and GET entities to the symbol ID of their name.
+ * See the SNENTITY structure for further information.
+ * 
+ * ppNames points to an array of count names that the client knows in
+ * advance, such as the names of the operations it supports.  Each name
+ * is a null-terminated string, and the names must all be different, or
+ * a fault occurs.  The first name has symbol ID one, the second name
+ * has symbol ID two, and so forth, so the IDs can be used directly as
+ * the cases of a switch or as indices into an array.  The names are
+ * copied, so the array need not remain allocated after the call.
+ * count may be zero, in which case ppNames may be NULL.
+ * 
+ * Every other name that the parser reads gets the next free symbol ID
+ * above count when it is first seen, and keeps that ID from then on.
+ * The symbol table grows with each new name, through the allocator of
+ * the parser.  If it can not grow, an SNERR_NOMEM error is returned.
+ * 
+ * Symbol IDs stay the same when the parser is reset with
+ * snparser_reset(), so they can be kept across documents.  Calling
+ * this function again replaces the whole symbol table, so all names
+ * that are not in the new array lose their IDs.
+ * 
+ * Entities in documents parsed by a parser pool do not have symbol
+ * IDs.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   ppNames - the array of known names, or NULL if count is zero
+ * 
+ *   count - the number of known names
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if out of memory, in which case the
+ *   parser has no symbol table
+ */
+int snparser_symbols(
+    SNPARSER          * pParser,
+    const char * const * ppNames,
+    long                 count);
+
+/*
+ * Parse a whole source and write its entities to an entity cache file.
+ * 
+ * pIn must be a whole source, which is a string source or a mapped
+ * file source, or a fault occurs.  pParser should be a new or reset
+ * parser, and nothing should have been read from pIn yet.  The source
+ * is parsed with snparser_read() until the EOF entity or an error,
+ * using the mode and limits of the parser, and every entity is stored
+ * in the cache along with its line count and byte offset.  Source
+ * errors are stored too, so that replaying the cache gives the same
+ * error.
+ * 
+ * Read the cache back with snsource_cache().  The cache format stores
+ * each entity as a type byte followed by varints, with each distinct
+ * key and value string stored only once.  It also holds the length
+ * and a 32-bit hash of the data of pIn, so that a cache can be checked
+ * against the source it was written from.
+ * 
+ * The cache is written to pOut in binary form, starting at its current
+ * position.  The file should be opened in binary mode, and it is not
+ * closed by this function.
+ * 
+ * The function fails if there is an I/O error writing the file, or if
+ * memory runs out, including an SNERR_NOMEM error while parsing.  In
+ * that case, the partial cache should be discarded.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pIn - the whole source to parse
+ * 
+ *   pOut - the file to write the cache to
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the cache could not be written
+ */
+int snparser_writecache(
+    SNPARSER * pParser,
+    SNSOURCE * pIn,
+    FILE     * pOut);
+
+/*
+ * Allocate an offset index.
+ * 
+ * An offset index records checkpoints of the state of a parser while
+ * it reads through a multipass source, so that a later pass can start
+ * parsing at a checkpoint with snparser_seek() instead of reading all
+ * the input before it again.  Attach the index to a parser with
+ * snparser_index() to record checkpoints.
+ * 
+ * spacing is the least number of bytes between two checkpoints.  Lower
+ * spacing gives seeks that land closer to the requested offset, at the
+ * cost of a larger index.  If spacing is zero or less, a default of 64
+ * kilobytes is used.
+ * 
+ * snindex_allocwith() also takes the memory allocator, or NULL for the
+ * standard allocator.  The index and its checkpoints are allocated
+ * through it.
+ * 
+ * The returned index should eventually be freed with snindex_free().
+ * 
+ * Parameters:
+ * 
+ *   spacing - the least number of bytes between checkpoints
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new offset index, or NULL if it could not be allocated
+ */
+SNINDEX *snindex_alloc(long spacing);
+SNINDEX *snindex_allocwith(long spacing, const SNALLOC *pAlloc);
+
+/*
+ * Free an offset index.
+ * 
+ * If NULL is passed, the call is ignored.  The index must not be
+ * attached to a parser anymore when it is freed.
+ * 
+ * Parameters:
+ * 
+ *   pIndex - the offset index to free, or NULL
+ */
+void snindex_free(SNINDEX *pIndex);
+
+/*
+ * Return the number of checkpoints recorded in an offset index.
+ * 
+ * Parameters:
+ * 
+ *   pIndex - the offset index
+ * 
+ * Return:
+ * 
+ *   the number of checkpoints
+ */
+long snindex_count(SNINDEX *pIndex);
+
+/*
+ * Attach an offset index to a Shastina parser, or detach it.
+ * 
+ * While an index is attached, the parser records a checkpoint in it
+ * each time it is about to read a token outside of any array, at least
+ * the spacing of the index past the last checkpoint.  A checkpoint
+ * holds the position in the source, the input filter state with the
+ * line count, the metacommand flag, and the number of open groups, so
+ * it is enough to resume parsing at that point.  The offset of a
+ * checkpoint is the byte offset of the token read right after it,
+ * which is the offset of the entities read from that token.
+ * Checkpoints are only added in increasing order of offset, so the
+ * index is built by the first pass through the source and later passes
+ * that read the same input don't add anything to it.  Nothing is
+ * recorded while reading feed sources or entity cache sources, or once
+ * memory for the index runs out.
+ * 
+ * Pass NULL to detach the index.  The parser does not own the index.
+ * An index must only ever be used with one and the same input data,
+ * since the checkpoints are only valid for that data.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pIndex - the offset index to attach, or NULL to detach
+ */
+void snparser_index(SNPARSER *pParser, SNINDEX *pIndex);
+
+/*
+ * Move a Shastina parser and its source to a checkpoint of an offset
+ * index.
+ * 
+ * pIn must be a multipass source that is not an entity cache source,
+ * and pIndex must have been recorded over the same input data, or a
+ * fault occurs.
+ * 
+ * The last checkpoint with an offset at or before the byte offset given
+ * by offset is chosen, or the start of the input if there is no such
+ * checkpoint.  See snparser_index() for the offset of a checkpoint.
+ * The source is moved to the checkpoint, and the parser is reset and
+ * then given the state recorded at the checkpoint, so that reading
+ * continues exactly as it would have when the checkpoint was recorded.
+ * No entity read after the seek has an offset less than the offset of
+ * the checkpoint.  Passing the offset field of an entity that was read
+ * in an earlier pass therefore makes the parser read that entity
+ * again, after the entities between the checkpoint and the entity.
+ * The mode, mask, symbol table, and attached index of the parser are
+ * kept.
+ * 
+ * Sources that can't seek directly are rewound and then read forward
+ * to the checkpoint.  Stream and file descriptor sources made with the
+ * SNSTREAM_RANDOM flag seek directly in the file.
+ * 
+ * An End Of File status or decoding error that an earlier pass left in
+ * the source, such as SNERR_UTF8 from invalid input after the
+ * checkpoint, is cleared by the seek, so an index recorded by a pass
+ * that stopped on an error can still be used.  Only a source in an I/O
+ * error state can't be moved.
+ * 
+ * Parameters:
+ * 
+ *   pParser - the parser object
+ * 
+ *   pIn - the input source
+ * 
+ *   pIndex - the offset index
+ * 
+ *   offset - the byte offset to seek to
+ * 
+ * Return:
+ * 
+ *   the offset of the chosen checkpoint, zero for the start of the
+ *   input, or -1 if the source could not be moved there, in which
+ *   case the parser should be reset and the source rewound before
+ *   they are used again
+ */
+long snparser_seek(
+    SNPARSER * pParser,
+    SNSOURCE * pIn,
+    SNINDEX  * pIndex,
+    long       offset);
+
+/*
+ * Allocate a Shastina parser pool.
+ * 
+ * A parser pool parses many documents at once on a number of worker
+ * threads, each of which keeps its own parser for reuse.  Use
+ * snpool_sources() to parse a document from each of a list of sources,
+ * and snpool_stream() to parse a stream of documents from one source.
+ * 
+ * threads is the number of workers, including the thread that starts
+ * each run.  It is raised to one if less.  If the library was not
+ * built with SHASTINA_THREADS defined, there is always only one worker
+ * and documents are parsed on the calling thread.
+ * 
+ * pLimits is the buffer limits of the parsers, or NULL for the
+ * defaults, as for snparser_alloclimits().  pAlloc is the memory
+ * allocator, or NULL for the standard allocator, as for
+ * snparser_allocwith().  A custom allocator is called from all the
+ * workers at once, so it must be safe to use that way.
+ * 
+ * The returned pool should eventually be freed with snpool_free().
+ * 
+ * Parameters:
+ * 
+ *   threads - the number of workers
+ * 
+ *   pLimits - the buffer limits, or NULL
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new parser pool, or NULL if it could not be allocated
+ */
+SNPOOL *snpool_alloc(
+    int              threads,
+    const SNLIMITS * pLimits,
+    const SNALLOC  * pAlloc);
+
+/*
+ * Free a Shastina parser pool.
+ * 
+ * The call is ignored if NULL is passed.  The pool must not be running.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool to free, or NULL
+ */
+void snpool_free(SNPOOL *pPool);
+
+/*
+ * Parse one document from each of a list of sources with a parser
+ * pool.
+ * 
+ * ppSrc points to an array of count sources, which must all be
+ * different.  count may be zero.  Each source is parsed from where it
+ * currently is up to the end of its document, exactly as a newly
+ * allocated parser would parse it.  The workers take the sources one
+ * at a time as they become free, so the work stays balanced even if
+ * the documents are of very different sizes.
+ * 
+ * doc_func is called with the custom pointer and the parsed document
+ * for each source.  See the SNDOC structure and the SNPOOL flags for
+ * further information.  If the callback returns zero, the run ends
+ * early.  No further callbacks are started then, though callbacks that
+ * are already running on other threads finish.
+ * 
+ * The function returns when all documents have been delivered or the
+ * run has ended early.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ * 
+ *   ppSrc - the array of sources
+ * 
+ *   count - the number of sources
+ * 
+ *   flags - combination of SNPOOL flags
+ * 
+ *   doc_func - the document callback
+ * 
+ *   custom - the custom pointer passed to the callback
+ * 
+ * Return:
+ * 
+ *   the number of documents that were delivered to the callback
+ */
+long snpool_sources(
+    SNPOOL    * pPool,
+    SNSOURCE ** ppSrc,
+    long        count,
+    int         flags,
+    int      (* doc_func)(void *custom, const SNDOC *pDoc),
+    void      * custom);
+
+/*
+ * Parse a stream of documents from one source with a parser pool.
+ * 
+ * pSrc must be a whole source, which is a string or map source (see
+ * snsource_buffer()), or a fault occurs.  Starting from where pSrc
+ * currently is, it holds Shastina documents that follow each other,
+ * each ending with its |; token.  The stream ends where nothing but
+ * whitespace and comments remains.  An empty stream has no documents.
+ * Line numbers count lines in the whole stream, as with the
+ * SNRESET_LINES flag of snparser_reset().
+ * 
+ * The documents are found with a quick scan of the tokens, which runs
+ * one document at a time ahead of the workers.  The workers then parse
+ * the documents they are given at the same time.  Since each document
+ * ends at the next |; token, an error such as an unbalanced group only
+ * ends its own document, and the next document is parsed as usual.
+ * Errors in the tokens themselves, such as an unterminated string or
+ * bad UTF-8, end the whole stream after the document that has them.
+ * If memory runs out during the scan, the stream ends with a document
+ * that has only an SNERR_NOMEM error.
+ * 
+ * The documents are delivered to doc_func just as with
+ * snpool_sources().  When the function returns, pSrc is positioned
+ * after the last document that was found.
+ * 
+ * Parameters:
+ * 
+ *   pPool - the parser pool
+ * 
+ *   pSrc - the whole source
+ * 
+ *   flags - combination of SNPOOL flags
+ * 
+ *   doc_func - the document callback
+ * 
+ *   custom - the custom pointer passed to the callback
+ * 
+ * Return:
+ * 
+ *   the number of documents that were delivered to the callback
+ */
+long snpool_stream(
+    SNPOOL    * pPool,
+    SNSOURCE  * pSrc,
+    int         flags,
+    int      (* doc_func)(void *custom, const SNDOC *pDoc),
+    void      * custom);
+
+/*
+ * Allocate a Shastina writer that hands its output to a block sink
+ * callback.
+ * 
+ * A writer is the counterpart of a parser.  Each of the snwriter_
+ * entity functions writes the text of one entity, so that parsing the
+ * output with snparser_read() returns the same entities with the same
+ * keys, string types, and string data.  The writer keeps track of
+ * metacommands, groups, and arrays in the same way as the parser, and
+ * it checks tokens and string data before writing them, so that output
+ * that would not be read back the same is never written.
+ * 
+ * Tokens are separated by single spaces, except that nothing separates
+ * an opening %, (, or [ from what follows it, or the token before a
+ * closing ;, ), ], or comma from that token.  A line break follows each
+ * metacommand and the |; token.
+ * 
+ * Output is collected in a large buffer within the writer, and the
+ * buffer is handed to sink_func whenever it fills up, when
+ * snwriter_flush() is called, and when the |; token is written with
+ * snwriter_eof().  Pieces of string data that are at least as large as
+ * the buffer are handed to the sink directly.
+ * 
+ * sink_func is called with custom as its first argument, a pointer to
+ * the bytes as its second argument, and the number of bytes as its
+ * third argument, which is always greater than zero.  It returns
+ * non-zero if all the bytes were written, or zero if there was an I/O
+ * error, which puts the writer into an SNERR_IOERR error state.
+ * 
+ * free_func is called with custom as its argument when the writer is
+ * freed, or it may be NULL if nothing needs to be done then.
+ * 
+ * The returned writer should eventually be freed with snwriter_free().
+ * 
+ * Parameters:
+ * 
+ *   sink_func - the block sink callback
+ * 
+ *   free_func - the destructor callback, or NULL
+ * 
+ *   custom - the custom pointer for the callbacks
+ * 
+ * Return:
+ * 
+ *   a new Shastina writer, or NULL if memory could not be allocated
+ */
+SNWRITER *snwriter_block(
+    int (*sink_func)(void *, const unsigned char *, long),
+    void (*free_func)(void *),
+    void *custom);
+
+/*
+ * Allocate a Shastina writer that hands its output to a block sink
+ * callback, using a given memory allocator.
+ * 
+ * This is the same as snwriter_block(), except that the writer and its
+ * buffers are allocated through pAlloc.  pAlloc may be NULL to use the
+ * standard allocator.  See the SNALLOC structure for further
+ * information.  The structure is copied, so it need not remain
+ * allocated after the call.
+ * 
+ * Parameters:
+ * 
+ *   sink_func - the block sink callback
+ * 
+ *   free_func - the destructor callback, or NULL
+ * 
+ *   custom - the custom pointer for the callbacks
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina writer, or NULL if memory could not be allocated
+ */
+SNWRITER *snwriter_blockwith(
+    int (*sink_func)(void *, const unsigned char *, long),
+    void (*free_func)(void *),
+    void *custom,
+    const SNALLOC *pAlloc);
+
+/*
+ * Allocate a Shastina writer that writes to a stdio FILE *.
+ * 
+ * The buffered output is written with fwrite().  The file is not
+ * flushed by the writer, so stdio buffering still applies after
+ * snwriter_flush() and snwriter_eof().
+ * 
+ * flags is a combination of SNSTREAM flags, or SNSTREAM_NORMAL (zero).
+ * Only the OWNER flag is used, which closes the file with fclose() when
+ * the writer is freed.  Other flags are ignored.
+ * 
+ * See snwriter_block() for further information.
+ * 
+ * Parameters:
+ * 
+ *   pFile - the file to write to
+ * 
+ *   flags - combination of SNSTREAM flags
+ * 
+ * Return:
+ * 
+ *   a new Shastina writer, or NULL if memory could not be allocated
+ */
+SNWRITER *snwriter_stream(FILE *pFile, int flags);
+
+/*
+ * Allocate a Shastina writer that writes to a stdio FILE *, using a
+ * given memory allocator.
+ * 
+ * This is the same as snwriter_stream(), except that the memory is
+ * allocated through pAlloc, as for snwriter_blockwith().
+ * 
+ * Parameters:
+ * 
+ *   pFile - the file to write to
+ * 
+ *   flags - combination of SNSTREAM flags
+ * 
+ *   pAlloc - the memory allocator, or NULL
+ * 
+ * Return:
+ * 
+ *   a new Shastina writer, or NULL if memory could not be allocated
+ */
+SNWRITER *snwriter_streamwith(
+    FILE          * pFile,
+    int             flags,
+    const SNALLOC * pAlloc);
+
+/*
+ * Free a Shastina writer.
+ * 
+ * Output that is still in the buffer of the writer is discarded, so
+ * call snwriter_flush() first if the output is wanted without the |;
+ * token.  The destructor callback, if any, is called.
+ * 
+ * If NULL is passed, the call is ignored.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer to free, or NULL
+ */
+void snwriter_free(SNWRITER *pWriter);
+
+/*
+ * Set the limits that a Shastina writer checks its output against.
+ * 
+ * The output should be readable by a parser with the same limits.  The
+ * key_max field limits the length of tokens and string prefixes, the
+ * value_max field limits the length of string data unless the
+ * SNWRITE_LONG mode flag is set, and the nest_max field limits how
+ * deeply arrays can be nested.  The initial allocations are used for
+ * the array and group stacks of the writer.  Tokens, strings, and
+ * arrays that go beyond the limits are SNERR_LONGTOKEN, SNERR_LONGSTR,
+ * and SNERR_DEEPARRAY errors.
+ * 
+ * pLimits may be NULL to use the default limits, which are also the
+ * limits of a new writer.  See the SNLIMITS structure for further
+ * information.  The structure is copied.
+ * 
+ * This may only be called before anything has been written, or a fault
+ * occurs.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pLimits - the limits, or NULL
+ */
+void snwriter_limits(SNWRITER *pWriter, const SNLIMITS *pLimits);
+
+/*
+ * Set the mode of a Shastina writer.
+ * 
+ * flags is a combination of SNWRITE flags, or SNWRITE_NORMAL (zero)
+ * for the default mode.  See the documentation of the SNWRITE
+ * constants for further information.  The mode can be changed between
+ * entities, but not while a string is open with snwriter_beginstring(),
+ * or a fault occurs.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   flags - combination of SNWRITE flags
+ */
+void snwriter_mode(SNWRITER *pWriter, int flags);
+
+/*
+ * Get the status of a Shastina writer.
+ * 
+ * Errors are kept, so once an entity function returns an error, every
+ * later call returns the same error without writing anything.  The
+ * output written so far is then incomplete and should be discarded.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if there has been no error, or the error code (less than zero)
+ */
+int snwriter_status(SNWRITER *pWriter);
+
+/*
+ * Get the number of bytes that a Shastina writer has written.
+ * 
+ * This includes bytes that are still in the buffer of the writer.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   the number of bytes written
+ */
+long snwriter_bytes(SNWRITER *pWriter);
+
+/*
+ * Hand everything in the buffer of a Shastina writer to its sink.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_flush(SNWRITER *pWriter);
+
+/*
+ * Write the % token that begins a metacommand.
+ * 
+ * Within a metacommand, only snwriter_metatoken(), the string
+ * functions, and snwriter_endmeta() may be used.  Other entity
+ * functions are SNERR_WRITE errors there, and this function is an
+ * SNERR_METANEST error.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_beginmeta(SNWRITER *pWriter);
+
+/*
+ * Write the ; token that ends a metacommand, followed by a line break.
+ * 
+ * This is an SNERR_SEMICOLON error outside of a metacommand.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_endmeta(SNWRITER *pWriter);
+
+/*
+ * Write a metacommand token.
+ * 
+ * pToken is the nul-terminated token, which is the key of the
+ * META_TOKEN entity that is read back.  It is either one or more
+ * visible US-ASCII characters other than ( ) [ ] , % ; " { } and #, or
+ * it is one of ( ) [ ] and comma by itself.  Other tokens are
+ * SNERR_WRITE errors, as is using this function outside of a
+ * metacommand.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pToken - the token
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_metatoken(SNWRITER *pWriter, const char *pToken);
+
+/*
+ * Write a string.
+ * 
+ * Within a metacommand, this is read back as a META_STRING entity, and
+ * otherwise as a STRING entity.
+ * 
+ * str_type is SNSTRING_QUOTED or SNSTRING_CURLY.  pPrefix is the
+ * nul-terminated string prefix, which may be empty or NULL for no
+ * prefix.  It may only have the characters that metacommand tokens
+ * that are not by themselves may have.  pData points to the string
+ * data, and len is its length in bytes, which must be zero or greater.
+ * pData may only be NULL if len is zero.
+ * 
+ * The string data must be valid UTF-8 without nul characters,
+ * surrogates, or CR characters, or it is an SNERR_NULLCHR,
+ * SNERR_UTF8, or SNERR_BADCR error.  (CR+LF line breaks would be read
+ * back as LF.)  In the default mode, the data must also already follow
+ * the escaping rules of the string type, since it is written as it is.
+ * In a quoted string, every double quote must be escaped by an odd
+ * number of backslashes before it.  In a curly string, the curly
+ * brackets that are not escaped that way must be balanced.  In both,
+ * the data may not end with an odd number of backslashes.  Otherwise,
+ * it is an SNERR_WRITE error.  In SNWRITE_ESCAPE mode, any data can be
+ * written, and it is escaped instead.  The data is scanned a whole
+ * word at a time.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   str_type - the string type
+ * 
+ *   pPrefix - the string prefix, or NULL
+ * 
+ *   pData - the string data
+ * 
+ *   len - the length of the string data
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_string(
+    SNWRITER   * pWriter,
+    int          str_type,
+    const char * pPrefix,
+    const char * pData,
+    long         len);
+
+/*
+ * Begin writing a string in pieces.
+ * 
+ * This writes the prefix and the opening quote or curly bracket of a
+ * string.  The string data is then written with any number of calls to
+ * snwriter_chunk(), and the string is ended with snwriter_endstring().
+ * No other entity function may be used in between, or a fault occurs.
+ * The result is the same as writing all the data at once with
+ * snwriter_string(), which allows strings that don't fit in memory to
+ * be written.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   str_type - the string type
+ * 
+ *   pPrefix - the string prefix, or NULL
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_beginstring(
+    SNWRITER   * pWriter,
+    int          str_type,
+    const char * pPrefix);
+
+/*
+ * Write a piece of the data of a string begun with
+ * snwriter_beginstring().
+ * 
+ * pData points to the data and len is its length in bytes, which must
+ * be zero or greater.  pData may only be NULL if len is zero.  Each
+ * piece must be complete UTF-8, so a codepoint may not be split
+ * between pieces.  Escaping is checked across pieces.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pData - the string data
+ * 
+ *   len - the length of the string data
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_chunk(SNWRITER *pWriter, const char *pData, long len);
+
+/*
+ * End a string begun with snwriter_beginstring().
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_endstring(SNWRITER *pWriter);
+
+/*
+ * Write a numeric literal.
+ * 
+ * pToken is the nul-terminated token, which must begin with a sign or
+ * a decimal digit, followed by any characters that metacommand tokens
+ * may have.  Other tokens are SNERR_WRITE errors.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pToken - the numeric token
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_numeric(SNWRITER *pWriter, const char *pToken);
+
+/*
+ * Write an integer as a numeric literal.
+ * 
+ * The integer is written in decimal, with a minus sign if it is
+ * negative, so that it is decoded back in SNMODE_INTEGER mode.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   v - the integer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_integer(SNWRITER *pWriter, long v);
+
+/*
+ * Write an entity that declares a variable, declares a constant,
+ * assigns a variable, or gets the value of a variable or constant.
+ * 
+ * pName is the nul-terminated name, which is the key of the VARIABLE,
+ * CONSTANT, ASSIGN, or GET entity that is read back.  It is written
+ * after the ?, @, :, or = symbol.  It may be empty, and it may only
+ * have the characters that metacommand tokens that are not by
+ * themselves may have.  Other names are SNERR_WRITE errors.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pName - the name
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_variable(SNWRITER *pWriter, const char *pName);
+int snwriter_constant(SNWRITER *pWriter, const char *pName);
+int snwriter_assign(SNWRITER *pWriter, const char *pName);
+int snwriter_get(SNWRITER *pWriter, const char *pName);
+
+/*
+ * Write the ( and ) tokens that begin and end a group.
+ * 
+ * Ending a group that was not begun in the same array element, or at
+ * the top level outside of any array, is an SNERR_RPAREN error.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_begingroup(SNWRITER *pWriter);
+int snwriter_endgroup(SNWRITER *pWriter);
+
+/*
+ * Write the [ token that begins an array, the comma that separates its
+ * elements, and the ] token that ends it.
+ * 
+ * The parser returns the elements as groups, followed by an ARRAY
+ * entity with the number of elements.  An array with nothing between
+ * [ and ] has no elements.  Otherwise, the commas separate the
+ * elements, and elements may be empty.
+ * 
+ * A comma outside of an array is an SNERR_COMMA error, and ending an
+ * array outside of an array is an SNERR_RSQR error.  Both are
+ * SNERR_OPENGROUP errors if a group is still open in the element.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_beginarray(SNWRITER *pWriter);
+int snwriter_comma(SNWRITER *pWriter);
+int snwriter_endarray(SNWRITER *pWriter);
+
+/*
+ * Write an operation.
+ * 
+ * pName is the nul-terminated operation, which is the key of the
+ * OPERATION entity that is read back.  It must not be empty, it may
+ * only have the characters that metacommand tokens that are not by
+ * themselves may have, and it may not begin with a sign, a decimal
+ * digit, or one of ? @ : and =, since such tokens are other entities.
+ * Other operations are SNERR_WRITE errors.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ *   pName - the operation
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_operation(SNWRITER *pWriter, const char *pName);
+
+/*
+ * Write the |; token that ends the Shastina file, followed by a line
+ * break, and flush the writer.
+ * 
+ * It is an SNERR_OPENMETA, SNERR_OPENARRAY, or SNERR_OPENGROUP error
+ * if a metacommand, array, or group is still open.  Writing anything
+ * after the |; token is an SNERR_TRAILER error.
+ * 
+ * Parameters:
+ * 
+ *   pWriter - the writer
+ * 
+ * Return:
+ * 
+ *   zero if successful, or the error code (less than zero)
+ */
+int snwriter_eof(SNWRITER *pWriter);
+
 /*
  * Convert a Shastina SNERR_ error code into a string.
  * 
@@ -0,0 +1,997 @@
+/*
+ * shbench.c
+ * =========
+ * 
+ * Benchmark the Shastina library on synthetic corpora or on given
+ * files, reporting the throughput of each processing stage for each
+ * kind of input source.
+ * 
+ * Syntax:
+ * 
+ *   shbench [-s kilobytes] [-t seconds] [-w directory] [file ...]
+ * 
+ * Without file arguments, six corpora are generated in memory: a long
+ * stream of short tokens, arrays nested close to the maximum depth,
+ * large curly strings, text with heavy use of non-ASCII UTF-8, the
+ * token stream again with CR+LF line breaks, and comment-heavy input.
+ * -s sets the approximate size of each generated corpus, which is 4096
+ * kilobytes by default.  The corpora are generated the same way every
+ * time, so results can be compared between builds.
+ * 
+ * With file arguments, the given Shastina files are benchmarked
+ * instead.  -w writes each generated corpus to a file in the given
+ * directory, so that the same corpora can be given to the Perl
+ * benchmark (perl/shbench.pl) and back to this program.
+ * 
+ * Each corpus is run through four stages on each source type.  The
+ * "source" stage reads raw bytes, the "filter" stage reads codepoints
+ * through the input filter, the "token" stage reads tokens, and the
+ * "reader" stage reads entities with snparser_read().  Each measurement
+ * is repeated until it has taken at least the number of seconds given
+ * with -t, which is 0.25 by default.  The output has one line per
+ * measurement, with the number of items that a single pass produced
+ * (bytes, codepoints, tokens, or entities), the throughput in megabytes
+ * of input per second, and the items per second.
+ * 
+ * The source types are string (snsource_string), file (snsource_file
+ * on a temporary file), custom (snsource_custom reading from memory),
+ * and block (snsource_block reading from memory).  With SHASTINA_POSIX,
+ * there are also fd (snsource_fd on the temporary file) and fdahead
+ * (the same with SNSTREAM_AHEAD, which only reads ahead if
+ * SHASTINA_THREADS is also defined).  All source types
+ * must produce the same entities, and the generated corpora must parse
+ * without error, so the program fails if they don't.
+ * 
+ * The stages below the reader are internal to the library, so this
+ * program includes shastina.c directly rather than linking with it.
+ * Compile this file by itself, for example:
+ * 
+ *   cc -O2 -o shbench shbench.c
+ * 
+ * Define SHASTINA_POSIX and SHASTINA_THREADS the same way as for the
+ * library build that is being measured.
+ */
+
+#include "shastina.c"
+#include <time.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of source types and stages.
+ */
+#ifdef SHASTINA_POSIX
+#define BENCH_SRC_COUNT   (6)
+#else
+#define BENCH_SRC_COUNT   (4)
+#endif
+#define BENCH_STAGE_COUNT (4)
+
+/*
+ * The source types.
+ */
+#define BENCH_SRC_STRING (0)
+#define BENCH_SRC_FILE   (1)
+#define BENCH_SRC_CUSTOM (2)
+#define BENCH_SRC_BLOCK  (3)
+#define BENCH_SRC_FD     (4)
+#define BENCH_SRC_AHEAD  (5)
+
+/*
+ * The stages.
+ */
+#define BENCH_STAGE_SOURCE (0)
+#define BENCH_STAGE_FILTER (1)
+#define BENCH_STAGE_TOKEN  (2)
+#define BENCH_STAGE_READER (3)
+
+/*
+ * The default size of each generated corpus in kilobytes, and the
+ * default minimum time of each measurement in seconds.
+ */
+#define BENCH_SIZE_DEFAULT (4096L)
+#define BENCH_TIME_DEFAULT (0.25)
+
+/*
+ * The number of bytes the block source delivers per callback.
+ */
+#define BENCH_BLOCK_SIZE (4096L)
+
+/*
+ * The nesting depth of the deep array corpus, which stays a little
+ * below the limit of the reader.
+ */
+#define BENCH_DEEP_DEPTH (SNREADER_AGSTACK_MAX - 24)
+
+/*
+ * The names of the source types and stages, in the order of the
+ * constants above.
+ */
+static const char *bench_src_name[BENCH_SRC_COUNT] = {
+  "string", "file", "custom", "block"
+#ifdef SHASTINA_POSIX
+  , "fd", "fdahead"
+#endif
+};
+static const char *bench_stage_name[BENCH_STAGE_COUNT] = {
+  "source", "filter", "token", "reader"
+};
+
+/*
+ * Words used by the generators.
+ * 
+ * The UTF-8 words are written with octal escapes so that this source
+ * file stays US-ASCII.
+ */
+static const char *bench_ops[8] = {
+  "add", "mul", "dup", "swap", "store_value", "load", "draw_line", "pop"
+};
+static const char *bench_words[8] = {
+  "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+  "elit"
+};
+static const char *bench_utf8[6] = {
+  "\316\261\316\262\316\263\316\264",                 /* Greek */
+  "\346\227\245\346\234\254\350\252\236",             /* CJK */
+  "\303\234n\303\257c\303\266d\303\251",              /* Latin-1 */
+  "\320\272\320\270\321\200\320\270\320\273\320\273", /* Cyrillic */
+  "\360\237\230\200\360\237\214\215",                 /* Emoji */
+  "caf\303\251"
+};
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * A corpus in memory.
+ * 
+ * pData is the data with a terminating nul, which is not counted in
+ * len.  cap is the allocated size of pData.  pFile is a temporary file
+ * holding the same data, or NULL if it has not been written yet.
+ */
+typedef struct {
+  const char *pName;
+  char *pData;
+  long len;
+  long cap;
+  FILE *pFile;
+} BENCH_CORPUS;
+
+/*
+ * The reading state of the custom and block sources.
+ */
+typedef struct {
+  const BENCH_CORPUS *pCorpus;
+  long pos;
+} BENCH_READER;
+
+/*
+ * Static data
+ * ===========
+ */
+
+/*
+ * The state of the pseudo-random generator.
+ */
+static unsigned long m_seed = 1;
+
+/*
+ * Corpus generation
+ * =================
+ */
+
+/*
+ * Return a pseudo-random number in range zero up to n - 1.
+ * 
+ * A fixed linear congruential generator is used so that the generated
+ * corpora are the same on every platform.
+ * 
+ * Parameters:
+ * 
+ *   n - the range, which must be greater than zero
+ * 
+ * Return:
+ * 
+ *   the pseudo-random number
+ */
+static long bench_rand(long n) {
+  m_seed = (m_seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+  return (long) ((m_seed >> 8) % ((unsigned long) n));
+}
+
+/*
+ * Append a string to a corpus, growing it as necessary.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   pStr - the string to append
+ */
+static void bench_add(BENCH_CORPUS *pc, const char *pStr) {
+  
+  long n = 0;
+  char *pNew = NULL;
+  
+  n = (long) strlen(pStr);
+  if (pc->len + n + 1 > pc->cap) {
+    while (pc->len + n + 1 > pc->cap) {
+      pc->cap = pc->cap * 2;
+    }
+    pNew = (char *) realloc(pc->pData, (size_t) pc->cap);
+    if (pNew == NULL) {
+      fprintf(stderr, "shbench: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    pc->pData = pNew;
+  }
+  memcpy(pc->pData + pc->len, pStr, (size_t) (n + 1));
+  pc->len += n;
+}
+
+/*
+ * Append a number to a corpus.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   pFmt - the printf format with a single long conversion
+ * 
+ *   v - the number
+ */
+static void bench_addNum(BENCH_CORPUS *pc, const char *pFmt, long v) {
+  char buf[64];
+  sprintf(buf, pFmt, v);
+  bench_add(pc, buf);
+}
+
+/*
+ * Start a corpus with the given name.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus to initialize
+ * 
+ *   pName - the name of the corpus
+ */
+static void bench_start(BENCH_CORPUS *pc, const char *pName) {
+  memset(pc, 0, sizeof(BENCH_CORPUS));
+  pc->pName = pName;
+  pc->cap = 4096;
+  pc->pData = (char *) malloc((size_t) pc->cap);
+  if (pc->pData == NULL) {
+    fprintf(stderr, "shbench: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  pc->pData[0] = (char) 0;
+  pc->pFile = NULL;
+}
+
+/*
+ * Append a line of short tokens to a corpus.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   pEol - the line break to end the line with
+ */
+static void bench_tokenLine(BENCH_CORPUS *pc, const char *pEol) {
+  
+  int i = 0;
+  
+  for(i = 0; i < 12; i++) {
+    switch (bench_rand(10)) {
+      case 0:
+      case 1:
+        bench_addNum(pc, "%ld ", bench_rand(100000));
+        break;
+      case 2:
+        bench_addNum(pc, "-%ld.", bench_rand(1000));
+        bench_addNum(pc, "%ld ", bench_rand(1000));
+        break;
+      case 3:
+        bench_addNum(pc, "?v%ld ", bench_rand(100));
+        break;
+      case 4:
+        bench_addNum(pc, "@c%ld ", bench_rand(100));
+        break;
+      case 5:
+        bench_addNum(pc, ":v%ld ", bench_rand(100));
+        break;
+      case 6:
+        bench_addNum(pc, "=v%ld ", bench_rand(100));
+        break;
+      case 7:
+        bench_addNum(pc, "( %ld 2 mul ) ", bench_rand(100));
+        break;
+      case 8:
+        bench_add(pc, "\"");
+        bench_add(pc, bench_words[bench_rand(8)]);
+        bench_add(pc, "\" ");
+        break;
+      default:
+        bench_add(pc, bench_ops[bench_rand(8)]);
+        bench_add(pc, " ");
+    }
+  }
+  bench_add(pc, pEol);
+}
+
+/*
+ * Generate a corpus.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus to generate
+ * 
+ *   pName - the name of the corpus, which selects what to generate
+ * 
+ *   size - the approximate size to generate in bytes
+ */
+static void bench_generate(
+    BENCH_CORPUS * pc,
+    const char   * pName,
+    long           size) {
+  
+  long i = 0;
+  long j = 0;
+  long n = 0;
+  
+  bench_start(pc, pName);
+  m_seed = 1;
+  
+  if (strcmp(pName, "tokens") == 0) {
+    while (pc->len < size) {
+      bench_tokenLine(pc, "\n");
+    }
+  
+  } else if (strcmp(pName, "crlf") == 0) {
+    while (pc->len < size) {
+      bench_tokenLine(pc, "\r\n");
+    }
+  
+  } else if (strcmp(pName, "deep") == 0) {
+    while (pc->len < size) {
+      for(i = 0; i < BENCH_DEEP_DEPTH; i++) {
+        bench_add(pc, "[");
+      }
+      bench_add(pc, "1, 2, 3");
+      for(i = 0; i < BENCH_DEEP_DEPTH; i++) {
+        bench_add(pc, (i % 16 == 15) ? "], 4\n" : "]");
+      }
+      bench_add(pc, " pop\n");
+    }
+  
+  } else if (strcmp(pName, "curly") == 0) {
+    while (pc->len < size) {
+      bench_add(pc, "text{");
+      n = 16384 + bench_rand(40000);
+      j = pc->len;
+      while (pc->len - j < n) {
+        bench_add(pc, bench_words[bench_rand(8)]);
+        switch (bench_rand(12)) {
+          case 0:
+            bench_add(pc, " {nested {braces}} ");
+            break;
+          case 1:
+            bench_add(pc, " \\} ");
+            break;
+          case 2:
+            bench_add(pc, "\n");
+            break;
+          default:
+            bench_add(pc, " ");
+        }
+      }
+      bench_add(pc, "} emit\n");
+    }
+  
+  } else if (strcmp(pName, "utf8") == 0) {
+    while (pc->len < size) {
+      bench_add(pc, "# ");
+      for(i = 0; i < 6; i++) {
+        bench_add(pc, bench_utf8[bench_rand(6)]);
+        bench_add(pc, " ");
+      }
+      bench_add(pc, "\n\"");
+      for(i = 0; i < 10; i++) {
+        bench_add(pc, bench_utf8[bench_rand(6)]);
+        bench_add(pc, " ");
+      }
+      bench_add(pc, "\" print {");
+      for(i = 0; i < 10; i++) {
+        bench_add(pc, bench_utf8[bench_rand(6)]);
+        bench_add(pc, " ");
+      }
+      bench_add(pc, "} print\n");
+    }
+  
+  } else if (strcmp(pName, "comments") == 0) {
+    while (pc->len < size) {
+      for(i = 0; i < 4; i++) {
+        bench_add(pc, "# ");
+        for(j = 0; j < 10; j++) {
+          bench_add(pc, bench_words[bench_rand(8)]);
+          bench_add(pc, " ");
+        }
+        bench_add(pc, "\n");
+      }
+      bench_addNum(pc, "%ld ", bench_rand(1000));
+      bench_add(pc, bench_ops[bench_rand(8)]);
+      bench_add(pc, "  # trailing comment\n\n");
+    }
+  
+  } else {
+    abort();
+  }
+  
+  bench_add(pc, "|;\n");
+}
+
+/*
+ * Load a corpus from a file.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus to load
+ * 
+ *   pPath - the path to the file
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file could not be read
+ */
+static int bench_load(BENCH_CORPUS *pc, const char *pPath) {
+  
+  int status = 1;
+  FILE *fh = NULL;
+  char buf[4096];
+  size_t n = 0;
+  
+  bench_start(pc, pPath);
+  
+  fh = fopen(pPath, "rb");
+  if (fh == NULL) {
+    status = 0;
+  }
+  
+  while (status) {
+    n = fread(buf, 1, sizeof(buf) - 1, fh);
+    if (n < 1) {
+      break;
+    }
+    buf[n] = (char) 0;
+    
+    /* Embedded nuls are not supported by string sources */
+    if (strlen(buf) != n) {
+      fprintf(stderr, "shbench: %s: contains nul bytes\n", pPath);
+      status = 0;
+    } else {
+      bench_add(pc, buf);
+    }
+  }
+  
+  if (status && ferror(fh)) {
+    status = 0;
+  }
+  if (fh != NULL) {
+    fclose(fh);
+  }
+  
+  return status;
+}
+
+/*
+ * Write a corpus to a file in a directory.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   pDir - the directory
+ * 
+ * Return:
+ * 
+ *   non-zero if successful, zero if the file could not be written
+ */
+static int bench_save(const BENCH_CORPUS *pc, const char *pDir) {
+  
+  int status = 1;
+  FILE *fh = NULL;
+  char *pPath = NULL;
+  
+  pPath = (char *) malloc(strlen(pDir) + strlen(pc->pName) + 8);
+  if (pPath == NULL) {
+    status = 0;
+  }
+  
+  if (status) {
+    sprintf(pPath, "%s/%s.sn", pDir, pc->pName);
+    fh = fopen(pPath, "wb");
+    if (fh == NULL) {
+      status = 0;
+    }
+  }
+  
+  if (status) {
+    if (fwrite(pc->pData, 1, (size_t) pc->len, fh) !=
+          (size_t) pc->len) {
+      status = 0;
+    }
+    if (fclose(fh)) {
+      status = 0;
+    }
+  }
+  
+  if (!status) {
+    fprintf(stderr, "shbench: can't write corpus %s\n", pc->pName);
+  }
+  free(pPath);
+  return status;
+}
+
+/*
+ * Sources
+ * =======
+ */
+
+/*
+ * Custom source read callback reading from a BENCH_READER.
+ */
+static int bench_readByte(void *pCustom) {
+  
+  BENCH_READER *pr = (BENCH_READER *) pCustom;
+  int result = SNERR_EOF;
+  
+  if (pr->pos < pr->pCorpus->len) {
+    result = (int) ((unsigned char *) pr->pCorpus->pData)[pr->pos];
+    (pr->pos)++;
+  }
+  
+  return result;
+}
+
+/*
+ * Block source read callback reading from a BENCH_READER.
+ */
+static long bench_readBlock(
+    void          * pCustom,
+    unsigned char * pBuf,
+    long            len) {
+  
+  BENCH_READER *pr = (BENCH_READER *) pCustom;
+  long result = SNERR_EOF;
+  
+  if (pr->pos < pr->pCorpus->len) {
+    result = pr->pCorpus->len - pr->pos;
+    if (result > len) {
+      result = len;
+    }
+    if (result > BENCH_BLOCK_SIZE) {
+      result = BENCH_BLOCK_SIZE;
+    }
+    memcpy(pBuf, pr->pCorpus->pData + pr->pos, (size_t) result);
+    pr->pos += result;
+  }
+  
+  return result;
+}
+
+/*
+ * Open a source of the given type over a corpus.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   kind - the BENCH_SRC_ type of source
+ * 
+ *   pr - the reading state to use for custom and block sources
+ * 
+ * Return:
+ * 
+ *   the new source
+ */
+static SNSOURCE *bench_open(
+    BENCH_CORPUS * pc,
+    int            kind,
+    BENCH_READER * pr) {
+  
+  SNSOURCE *pSrc = NULL;
+  
+  pr->pCorpus = pc;
+  pr->pos = 0;
+  
+  /* Write the temporary file on first use */
+  if ((kind == BENCH_SRC_FILE) || (kind == BENCH_SRC_FD) ||
+      (kind == BENCH_SRC_AHEAD)) {
+    if (pc->pFile == NULL) {
+      pc->pFile = tmpfile();
+      if (pc->pFile == NULL) {
+        fprintf(stderr, "shbench: can't create temporary file\n");
+        exit(EXIT_FAILURE);
+      }
+      if (fwrite(pc->pData, 1, (size_t) pc->len, pc->pFile) !=
+            (size_t) pc->len) {
+        fprintf(stderr, "shbench: can't write temporary file\n");
+        exit(EXIT_FAILURE);
+      }
+      if (fflush(pc->pFile)) {
+        fprintf(stderr, "shbench: can't write temporary file\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    rewind(pc->pFile);
+  }
+  
+  if (kind == BENCH_SRC_STRING) {
+    pSrc = snsource_string(pc->pData);
+  
+  } else if (kind == BENCH_SRC_FILE) {
+    pSrc = snsource_file(pc->pFile, 0);
+  
+#ifdef SHASTINA_POSIX
+  } else if ((kind == BENCH_SRC_FD) || (kind == BENCH_SRC_AHEAD)) {
+    lseek(fileno(pc->pFile), 0, SEEK_SET);
+    if (kind == BENCH_SRC_AHEAD) {
+      pSrc = snsource_fd(fileno(pc->pFile), SNSTREAM_AHEAD);
+    } else {
+      pSrc = snsource_fd(fileno(pc->pFile), SNSTREAM_NORMAL);
+    }
+
+#endif
+  } else if (kind == BENCH_SRC_CUSTOM) {
+    pSrc = snsource_custom(&bench_readByte, NULL, NULL, (void *) pr);
+  
+  } else if (kind == BENCH_SRC_BLOCK) {
+    pSrc = snsource_block(&bench_readBlock, NULL, NULL, (void *) pr);
+  
+  } else {
+    abort();
+  }
+  
+  if (pSrc == NULL) {
+    fprintf(stderr, "shbench: can't allocate source\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  return pSrc;
+}
+
+/*
+ * Stages
+ * ======
+ */
+
+/*
+ * Run a single pass of a stage over a corpus.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   kind - the BENCH_SRC_ type of source
+ * 
+ *   stage - the BENCH_STAGE_ stage
+ * 
+ *   pParser - the parser to use
+ * 
+ *   pErr - receives the error code the pass ended with, or zero
+ * 
+ * Return:
+ * 
+ *   the number of items the pass produced
+ */
+static long bench_pass(
+    BENCH_CORPUS * pc,
+    int            kind,
+    int            stage,
+    SNPARSER     * pParser,
+    int          * pErr) {
+  
+  long count = 0;
+  long c = 0;
+  int done = 0;
+  SNSOURCE *pSrc = NULL;
+  SNFILTER filter;
+  SNTOKEN tk;
+  SNENTITY ent;
+  BENCH_READER rd;
+  
+  memset(&filter, 0, sizeof(SNFILTER));
+  memset(&tk, 0, sizeof(SNTOKEN));
+  memset(&ent, 0, sizeof(SNENTITY));
+  memset(&rd, 0, sizeof(BENCH_READER));
+  
+  *pErr = 0;
+  pSrc = bench_open(pc, kind, &rd);
+  snfilter_reset(&filter);
+  snparser_reset(pParser, SNRESET_NORMAL);
+  
+  if (stage == BENCH_STAGE_SOURCE) {
+    /* Count raw bytes */
+    for(c = snsource_read(pSrc); c >= 0; c = snsource_read(pSrc)) {
+      count++;
+    }
+    if (c != SNERR_EOF) {
+      *pErr = (int) c;
+    }
+  
+  } else if (stage == BENCH_STAGE_FILTER) {
+    /* Count filtered codepoints */
+    for(c = snfilter_read(&filter, pSrc);
+        c >= 0;
+        c = snfilter_read(&filter, pSrc)) {
+      count++;
+    }
+    if (c != SNERR_EOF) {
+      *pErr = (int) c;
+    }
+  
+  } else if (stage == BENCH_STAGE_TOKEN) {
+    /* Count tokens up to the final token, borrowing the buffers of the
+     * reader of the parser */
+    tk.pKey = &(pParser->reader.buf_key);
+    tk.pValue = &(pParser->reader.buf_value);
+    tk.view = 0;
+    tk.pChunk = NULL;
+    while (!done) {
+      sntoken_read(&tk, pSrc, &filter);
+      if (tk.status < 0) {
+        *pErr = tk.status;
+        done = 1;
+      } else {
+        count++;
+        if (tk.status == SNTOKEN_FINAL) {
+          done = 1;
+        }
+      }
+    }
+  
+  } else if (stage == BENCH_STAGE_READER) {
+    /* Count entities up to and including EOF */
+    while (!done) {
+      snparser_read(pParser, &ent, pSrc);
+      if (ent.status < 0) {
+        *pErr = ent.status;
+        done = 1;
+      } else {
+        count++;
+        if (ent.status == SNENTITY_EOF) {
+          done = 1;
+        }
+      }
+    }
+  
+  } else {
+    abort();
+  }
+  
+  snsource_free(pSrc);
+  return count;
+}
+
+/*
+ * Measure a stage over a corpus and report the result.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   kind - the BENCH_SRC_ type of source
+ * 
+ *   stage - the BENCH_STAGE_ stage
+ * 
+ *   pParser - the parser to use
+ * 
+ *   min_time - the minimum time to measure for, in seconds
+ * 
+ *   pErr - receives the error code the passes ended with, or zero
+ * 
+ * Return:
+ * 
+ *   the number of items a single pass produced
+ */
+static long bench_measure(
+    BENCH_CORPUS * pc,
+    int            kind,
+    int            stage,
+    SNPARSER     * pParser,
+    double         min_time,
+    int          * pErr) {
+  
+  long count = 0;
+  long passes = 0;
+  double elapsed = 0.0;
+  clock_t start;
+  
+  start = clock();
+  do {
+    count = bench_pass(pc, kind, stage, pParser, pErr);
+    passes++;
+    elapsed = ((double) (clock() - start)) / ((double) CLOCKS_PER_SEC);
+  } while (elapsed < min_time);
+  
+  if (elapsed <= 0.0) {
+    elapsed = 1.0 / ((double) CLOCKS_PER_SEC);
+  }
+  
+  printf("%-12s %-7s %-7s %10ld %10ld %9.2f %12.0f\n",
+          pc->pName, bench_src_name[kind], bench_stage_name[stage],
+          pc->len, count,
+          ((double) pc->len) * ((double) passes) / elapsed / 1.0e6,
+          ((double) count) * ((double) passes) / elapsed);
+  fflush(stdout);
+  
+  return count;
+}
+
+/*
+ * Benchmark a corpus on all source types and stages.
+ * 
+ * Parameters:
+ * 
+ *   pc - the corpus
+ * 
+ *   pParser - the parser to use
+ * 
+ *   min_time - the minimum time of each measurement, in seconds
+ * 
+ *   must_parse - non-zero if the corpus must parse without error
+ * 
+ * Return:
+ * 
+ *   non-zero if the results were consistent, zero if not
+ */
+static int bench_corpus(
+    BENCH_CORPUS * pc,
+    SNPARSER     * pParser,
+    double         min_time,
+    int            must_parse) {
+  
+  int status = 1;
+  int kind = 0;
+  int stage = 0;
+  int err = 0;
+  int first_err = 0;
+  long count = 0;
+  long first_count = 0;
+  
+  for(kind = 0; kind < BENCH_SRC_COUNT; kind++) {
+    for(stage = 0; stage < BENCH_STAGE_COUNT; stage++) {
+      count = bench_measure(pc, kind, stage, pParser, min_time, &err);
+      
+      if (stage == BENCH_STAGE_READER) {
+        if (kind == 0) {
+          first_count = count;
+          first_err = err;
+        } else if ((count != first_count) || (err != first_err)) {
+          fprintf(stderr, "shbench: %s: %s source gives %ld entities "
+                  "instead of %ld\n",
+                  pc->pName, bench_src_name[kind], count, first_count);
+          status = 0;
+        }
+        if (err && must_parse) {
+          fprintf(stderr, "shbench: %s: %s\n",
+                  pc->pName, snerror_str(err));
+          status = 0;
+        }
+      }
+    }
+  }
+  
+  if (first_err) {
+    printf("%-12s error after %ld entities: %s\n",
+            pc->pName, first_count, snerror_str(first_err));
+  }
+  
+  return status;
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+  
+  static const char *names[6] = {
+    "tokens", "deep", "curly", "utf8", "crlf", "comments"
+  };
+  
+  int status = 1;
+  int i = 0;
+  long size = BENCH_SIZE_DEFAULT;
+  double min_time = BENCH_TIME_DEFAULT;
+  const char *pDir = NULL;
+  SNPARSER *pParser = NULL;
+  BENCH_CORPUS corpus;
+  
+  memset(&corpus, 0, sizeof(BENCH_CORPUS));
+  
+  /* Parse options */
+  for(i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      size = atol(argv[i + 1]);
+      i++;
+    } else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+      min_time = atof(argv[i + 1]);
+      i++;
+    } else if ((strcmp(argv[i], "-w") == 0) && (i + 1 < argc)) {
+      pDir = argv[i + 1];
+      i++;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr,
+        "Syntax: shbench [-s kilobytes] [-t seconds] [-w directory] "
+        "[file ...]\n");
+      return EXIT_FAILURE;
+    } else {
+      break;
+    }
+  }
+  if ((size < 1) || (size > LONG_MAX / 1024)) {
+    fprintf(stderr, "shbench: invalid size\n");
+    return EXIT_FAILURE;
+  }
+  
+  /* Allocate a parser */
+  pParser = snparser_alloc();
+  if (pParser == NULL) {
+    fprintf(stderr, "shbench: can't allocate parser\n");
+    return EXIT_FAILURE;
+  }
+  
+  printf("%-12s %-7s %-7s %10s %10s %9s %12s\n",
+          "corpus", "source", "stage", "bytes", "items", "MB/s",
+          "items/s");
+  
+  if (i < argc) {
+    /* Benchmark the given files */
+    for( ; i < argc; i++) {
+      if (bench_load(&corpus, argv[i])) {
+        if (!bench_corpus(&corpus, pParser, min_time, 0)) {
+          status = 0;
+        }
+      } else {
+        fprintf(stderr, "shbench: can't read %s\n", argv[i]);
+        status = 0;
+      }
+      free(corpus.pData);
+      if (corpus.pFile != NULL) {
+        fclose(corpus.pFile);
+      }
+    }
+  
+  } else {
+    /* Benchmark the generated corpora */
+    for(i = 0; i < 6; i++) {
+      bench_generate(&corpus, names[i], size * 1024);
+      if (pDir != NULL) {
+        if (!bench_save(&corpus, pDir)) {
+          status = 0;
+        }
+      }
+      if (!bench_corpus(&corpus, pParser, min_time, 1)) {
+        status = 0;
+      }
+      free(corpus.pData);
+      if (corpus.pFile != NULL) {
+        fclose(corpus.pFile);
+      }
+    }
+  }
+  
+  snparser_free(pParser);
+  
+  if (!status) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,548 @@
+/*
+ * shtest.c
+ * ========
+ * 
+ * Check that the entities that snparser_readbatch() and a Shastina
+ * parser pool deliver leave the fields they do not use NULL or zero,
+ * and that snparser_seek() works after a pass that stopped on an
+ * error.
+ * 
+ * A few documents are parsed with snparser_readbatch(), with and
+ * without the pipeline of snparser_pipeline(), and with
+ * snpool_sources() and snpool_stream() on one worker and on several
+ * workers, and each entity of each document is checked.  Then a
+ * document with invalid UTF-8 near the end is indexed in one pass over
+ * a string source and over a block source, and each of its entities is
+ * read again after seeking to it.  The program prints the entities
+ * that are wrong and exits with EXIT_FAILURE if there are any, else it
+ * prints nothing and exits with EXIT_SUCCESS.
+ * 
+ * Compile with libshastina
+ */
+
+#include "shastina.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Constants
+ * =========
+ */
+
+/*
+ * The number of test documents.
+ */
+#define DOC_COUNT (4)
+
+/*
+ * The number of entities read at a time with snparser_readbatch().
+ */
+#define BATCH_MAX (3)
+
+/*
+ * The most entities that the seek document may have.
+ */
+#define SEEK_MAX (64)
+
+/*
+ * The spacing of the offset index for the seek document.
+ */
+#define SEEK_SPACING (8)
+
+/*
+ * The most bytes that the block source delivers at a time.
+ */
+#define BLOCK_MAX (5)
+
+/*
+ * The test documents.
+ * 
+ * These are parsed one at a time with snparser_readbatch() and
+ * snpool_sources(), and then all joined together as one stream for
+ * snpool_stream().  They have strings and tokens in between all the
+ * kinds of entities that have none, so that a stale pointer would show
+ * up.  The last one ends with an error.
+ */
+static const char *m_docs[DOC_COUNT] = {
+  "%meta \"s\" tok;\n[1, {x}] ( ) \"q\" |;\n",
+  "%a; %b {c} d; [ ] [ \"e\" ] ( f ( g ) ) |;\n",
+  "=h ?h +h: [ (1) , (2) , (3) ] %\"i\";\n|;\n",
+  "\"j\" ( k ] |;\n"
+};
+
+/*
+ * The test document for snparser_seek().
+ * 
+ * The invalid UTF-8 near the end stops the first pass with an error,
+ * which must not keep later seeks to the checkpoints before it from
+ * working.
+ */
+static const char *m_seekdoc =
+  "alpha \"one\" beta {two} gamma\n"
+  "delta [1, 2] epsilon \"three\" zeta\n"
+  "eta (theta) iota \"four\" kappa\n"
+  "lambda mu nu xi omicron pi\n"
+  "rho sigma \xff\xfe tau |;\n";
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * The custom data of the block source.
+ */
+typedef struct {
+
+  /*
+   * The input data.
+   */
+  const char *pData;
+  
+  /*
+   * The length of the input data in bytes.
+   */
+  long len;
+  
+  /*
+   * The offset of the next byte to deliver.
+   */
+  long pos;
+
+} BLOCKSRC;
+
+/*
+ * Local data
+ * ==========
+ */
+
+/*
+ * The number of wrong entities found so far.
+ */
+static long m_errors = 0;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Check the unused fields of one entity.
+ * 
+ * Parameters:
+ * 
+ *   pEnt - the entity
+ * 
+ *   doc - the index of the document
+ * 
+ *   i - the index of the entity within the document
+ */
+static void checkEntity(const SNENTITY *pEnt, long doc, long i) {
+
+  int has_key = 0;
+  int has_value = 0;
+  int has_type = 0;
+  
+  /* Check parameters */
+  if (pEnt == NULL) {
+    abort();
+  }
+  
+  /* Figure out which fields the entity uses */
+  switch (pEnt->status) {
+    case SNENTITY_META_TOKEN:
+    case SNENTITY_NUMERIC:
+    case SNENTITY_VARIABLE:
+    case SNENTITY_CONSTANT:
+    case SNENTITY_ASSIGN:
+    case SNENTITY_GET:
+    case SNENTITY_OPERATION:
+      has_key = 1;
+      break;
+    
+    case SNENTITY_BEGIN_STRING:
+      has_key = 1;
+      has_type = 1;
+      break;
+    
+    case SNENTITY_STRING:
+    case SNENTITY_META_STRING:
+      has_key = 1;
+      has_value = 1;
+      has_type = 1;
+      break;
+    
+    case SNENTITY_STRING_CHUNK:
+      has_value = 1;
+      has_type = 1;
+      break;
+    
+    case SNENTITY_END_STRING:
+      has_type = 1;
+      break;
+  }
+  
+  /* Report the entity if any unused field is set */
+  if (((!has_key) && ((pEnt->pKey != NULL) || (pEnt->key_len != 0))) ||
+      ((!has_value) &&
+        ((pEnt->pValue != NULL) || (pEnt->value_len != 0))) ||
+      ((!has_type) && (pEnt->str_type != 0)) ||
+      ((pEnt->status != SNENTITY_ARRAY) && (pEnt->count != 0))) {
+    printf("Document %ld entity %ld (status %d): unused field set\n",
+            doc, i, pEnt->status);
+    m_errors++;
+  }
+}
+
+/*
+ * Document callback that checks every entity of the document.
+ * 
+ * Parameters:
+ * 
+ *   custom - ignored
+ * 
+ *   pDoc - the document
+ * 
+ * Return:
+ * 
+ *   non-zero to keep going
+ */
+static int checkDoc(void *custom, const SNDOC *pDoc) {
+
+  long i = 0;
+  
+  /* Ignore custom */
+  (void) custom;
+  
+  /* Check parameters */
+  if (pDoc == NULL) {
+    abort();
+  }
+  
+  /* Check each entity */
+  for(i = 0; i < pDoc->count; i++) {
+    checkEntity(&((pDoc->pEntities)[i]), pDoc->index, i);
+  }
+  
+  /* Keep going */
+  return 1;
+}
+
+/*
+ * Block read callback of the block source.
+ * 
+ * Only a few bytes are delivered at a time, so that the window of the
+ * source is refilled many times over.
+ * 
+ * Parameters:
+ * 
+ *   custom - the BLOCKSRC
+ * 
+ *   pBuf - the buffer to fill
+ * 
+ *   buf_len - the size of the buffer
+ * 
+ * Return:
+ * 
+ *   the number of bytes delivered, or SNERR_EOF
+ */
+static long blockRead(void *custom, unsigned char *pBuf, long buf_len) {
+
+  BLOCKSRC *pb = NULL;
+  long result = 0;
+  
+  /* Check parameters */
+  if ((custom == NULL) || (pBuf == NULL) || (buf_len < 1)) {
+    abort();
+  }
+  pb = (BLOCKSRC *) custom;
+  
+  /* Deliver the next few bytes, if any */
+  if (pb->pos < pb->len) {
+    result = pb->len - pb->pos;
+    if (result > buf_len) {
+      result = buf_len;
+    }
+    if (result > BLOCK_MAX) {
+      result = BLOCK_MAX;
+    }
+    memcpy(pBuf, pb->pData + pb->pos, (size_t) result);
+    pb->pos = pb->pos + result;
+  
+  } else {
+    result = SNERR_EOF;
+  }
+  
+  /* Return result */
+  return result;
+}
+
+/*
+ * Rewind callback of the block source.
+ * 
+ * Parameters:
+ * 
+ *   custom - the BLOCKSRC
+ * 
+ * Return:
+ * 
+ *   non-zero, since rewinding always works
+ */
+static int blockRewind(void *custom) {
+
+  /* Check parameters */
+  if (custom == NULL) {
+    abort();
+  }
+  
+  /* Start over */
+  ((BLOCKSRC *) custom)->pos = 0;
+  return 1;
+}
+
+/*
+ * Run the checks with snparser_readbatch().
+ * 
+ * A small ring is used for the pipeline so that its slots get reused
+ * many times over.
+ * 
+ * Parameters:
+ * 
+ *   pipe - non-zero to enable the pipeline, zero to read sequentially
+ */
+static void checkBatch(int pipe) {
+
+  SNPARSER *pParser = NULL;
+  SNSOURCE *pSrc = NULL;
+  SNENTITY ent[BATCH_MAX];
+  long doc = 0;
+  long base = 0;
+  long count = 0;
+  long i = 0;
+  int done = 0;
+  
+  /* Check each document with a new parser */
+  for(doc = 0; doc < DOC_COUNT; doc++) {
+    /* Allocate the parser and source */
+    pParser = snparser_alloc();
+    pSrc = snsource_string(m_docs[doc]);
+    if ((pParser == NULL) || (pSrc == NULL)) {
+      fprintf(stderr, "Can't allocate parser!\n");
+      exit(EXIT_FAILURE);
+    }
+    if (pipe) {
+      snparser_pipeline(pParser, 1, 2);
+    }
+    
+    /* Read and check batches until the EOF entity or an error */
+    base = 0;
+    done = 0;
+    while (!done) {
+      memset(ent, 0, sizeof(ent));
+      count = snparser_readbatch(pParser, ent, BATCH_MAX, pSrc);
+      for(i = 0; i < count; i++) {
+        checkEntity(&(ent[i]), doc, base + i);
+      }
+      if ((count < 1) || (ent[count - 1].status <= 0)) {
+        done = 1;
+      }
+      base += count;
+    }
+    
+    /* Release the parser and source */
+    snparser_free(pParser);
+    snsource_free(pSrc);
+  }
+}
+
+/*
+ * Run the checks with a parser pool of a given number of workers.
+ * 
+ * Parameters:
+ * 
+ *   threads - the number of workers
+ */
+static void checkPool(int threads) {
+
+  SNPOOL *pPool = NULL;
+  SNSOURCE *ppSrc[DOC_COUNT];
+  SNSOURCE *pStream = NULL;
+  char *pAll = NULL;
+  size_t len = 0;
+  long i = 0;
+  
+  /* Clear the source array */
+  memset(ppSrc, 0, sizeof(ppSrc));
+  
+  /* Allocate the pool */
+  pPool = snpool_alloc(threads, NULL, NULL);
+  if (pPool == NULL) {
+    fprintf(stderr, "Can't allocate pool!\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  /* Check each document as a separate source */
+  for(i = 0; i < DOC_COUNT; i++) {
+    ppSrc[i] = snsource_string(m_docs[i]);
+    if (ppSrc[i] == NULL) {
+      fprintf(stderr, "Can't allocate source!\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  snpool_sources(pPool, ppSrc, DOC_COUNT, SNPOOL_NORMAL,
+                  &checkDoc, NULL);
+  for(i = 0; i < DOC_COUNT; i++) {
+    snsource_free(ppSrc[i]);
+    ppSrc[i] = NULL;
+  }
+  
+  /* Join all the documents together */
+  for(i = 0; i < DOC_COUNT; i++) {
+    len += strlen(m_docs[i]);
+  }
+  pAll = (char *) malloc(len + 1);
+  if (pAll == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(EXIT_FAILURE);
+  }
+  pAll[0] = (char) 0;
+  for(i = 0; i < DOC_COUNT; i++) {
+    strcat(pAll, m_docs[i]);
+  }
+  
+  /* Check the documents as one stream */
+  pStream = snsource_string(pAll);
+  if (pStream == NULL) {
+    fprintf(stderr, "Can't allocate source!\n");
+    exit(EXIT_FAILURE);
+  }
+  snpool_stream(pPool, pStream, SNPOOL_NORMAL, &checkDoc, NULL);
+  
+  /* Release everything */
+  snsource_free(pStream);
+  free(pAll);
+  snpool_free(pPool);
+}
+
+/*
+ * Run the seek checks on the seek document.
+ * 
+ * Parameters:
+ * 
+ *   block - non-zero to read the document through a block source, zero
+ *   to read it through a string source
+ */
+static void checkSeek(int block) {
+
+  SNPARSER *pParser = NULL;
+  SNSOURCE *pSrc = NULL;
+  SNINDEX *pIndex = NULL;
+  SNENTITY ent;
+  BLOCKSRC bs;
+  long offs[SEEK_MAX];
+  int ents[SEEK_MAX];
+  long count = 0;
+  long i = 0;
+  long j = 0;
+  
+  /* Initialize structures */
+  memset(&ent, 0, sizeof(SNENTITY));
+  memset(&bs, 0, sizeof(BLOCKSRC));
+  memset(offs, 0, sizeof(offs));
+  memset(ents, 0, sizeof(ents));
+  
+  /* Allocate the parser, index, and source */
+  pParser = snparser_alloc();
+  pIndex = snindex_alloc(SEEK_SPACING);
+  if (block) {
+    bs.pData = m_seekdoc;
+    bs.len = (long) strlen(m_seekdoc);
+    bs.pos = 0;
+    pSrc = snsource_block(&blockRead, NULL, &blockRewind, &bs);
+  } else {
+    pSrc = snsource_string(m_seekdoc);
+  }
+  if ((pParser == NULL) || (pIndex == NULL) || (pSrc == NULL)) {
+    fprintf(stderr, "Can't allocate parser!\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  /* Read the whole document once with the index attached, recording
+   * the offset and status of each entity */
+  snparser_index(pParser, pIndex);
+  for(count = 0; count < SEEK_MAX; count++) {
+    snparser_read(pParser, &ent, pSrc);
+    offs[count] = ent.offset;
+    ents[count] = ent.status;
+    if (ent.status <= 0) {
+      count++;
+      break;
+    }
+  }
+  snparser_index(pParser, NULL);
+  
+  /* The first pass must have stopped on the error and recorded a few
+   * checkpoints */
+  if ((ents[count - 1] >= 0) || (snindex_count(pIndex) < 2)) {
+    printf("Seek (block %d): first pass not as expected\n", block);
+    m_errors++;
+  }
+  
+  /* Seek to each entity and read it again; entities that share their
+   * offset with earlier ones, such as the first element of an array
+   * after the BEGIN_GROUP of the array, read back as the first entity
+   * at that offset */
+  for(i = 0; i < count; i++) {
+    for(j = i; (j > 0) && (offs[j - 1] == offs[i]); j--);
+    
+    if (snparser_seek(pParser, pSrc, pIndex, offs[i]) >= 0) {
+      do {
+        snparser_read(pParser, &ent, pSrc);
+      } while ((ent.status > 0) && (ent.offset < offs[i]));
+      
+      if ((ent.offset != offs[j]) || (ent.status != ents[j])) {
+        printf("Seek (block %d) entity %ld: read back wrong\n",
+                block, i);
+        m_errors++;
+      }
+    
+    } else {
+      printf("Seek (block %d) entity %ld: seek failed\n", block, i);
+      m_errors++;
+    }
+  }
+  
+  /* Release everything */
+  snsource_free(pSrc);
+  snindex_free(pIndex);
+  snparser_free(pParser);
+}
+
+/*
+ * Program entrypoint
+ * ==================
+ */
+
+int main(int argc, char *argv[]) {
+
+  /* Ignore arguments */
+  (void) argc;
+  (void) argv;
+  
+  /* Run the checks with and without the pipeline, then on one worker
+   * and on several, then the seek checks on a string source and a
+   * block source */
+  checkBatch(0);
+  checkBatch(1);
+  checkPool(1);
+  checkPool(4);
+  checkSeek(0);
+  checkSeek(1);
+  
+  /* Report result */
+  if (m_errors > 0) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
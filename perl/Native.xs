@@ -0,0 +1,206 @@
+/*
+ * Native.xs
+ * =========
+ * 
+ * XS glue for the Shastina::Native module, which lets the Perl
+ * Shastina::Parser run on top of the C library.
+ * 
+ * Each Shastina::Native object holds a C parser and a feed source (see
+ * snsource_feed() in shastina.h).  Shastina::Parser pushes blocks of
+ * bytes from its Perl input source into the feed source, and reads
+ * entities back in the same format that the pure-Perl parser returns
+ * them.
+ * 
+ * The C library is included directly rather than linked, the same way
+ * as the C benchmark program does it, so that the module builds without
+ * installing libshastina first.  It is included before the Perl
+ * headers so that none of the Perl macros affect it.
+ * 
+ * See Makefile.PL for build instructions.
+ */
+
+#include "shastina.c"
+
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+/*
+ * Type declarations
+ * =================
+ */
+
+/*
+ * Structure wrapped by each Shastina::Native object.
+ */
+typedef struct {
+  
+  /*
+   * The C parser.
+   */
+  SNPARSER *pParser;
+  
+  /*
+   * The feed source that blocks are pushed into.
+   */
+  SNSOURCE *pSrc;
+
+} SNPERL;
+
+typedef SNPERL *Shastina__Native;
+
+/*
+ * Local functions
+ * ===============
+ */
+
+/*
+ * Build a Perl string from a string in an entity.
+ * 
+ * The C parser has already validated the UTF-8 and resolved any
+ * surrogates in string data, so the bytes can directly be used as a
+ * Unicode string.
+ * 
+ * Parameters:
+ * 
+ *   pStr - the string data
+ * 
+ *   len - the length of the string data in bytes
+ * 
+ * Return:
+ * 
+ *   a new Perl string
+ */
+static SV *snperl_str(pTHX_ const char *pStr, long len) {
+
+  SV *result = NULL;
+  
+  /* Check parameters */
+  if ((len < 0) || ((pStr == NULL) && (len > 0))) {
+    abort();
+  }
+  
+  /* Build the string with the UTF-8 flag on */
+  result = newSVpvn((len > 0) ? pStr : "", (STRLEN) len);
+  SvUTF8_on(result);
+  
+  /* Return the new string */
+  return result;
+}
+
+MODULE = Shastina::Native  PACKAGE = Shastina::Native
+
+PROTOTYPES: DISABLE
+
+Shastina::Native
+new(class)
+    const char *class
+  PREINIT:
+    SNPERL *pNat = NULL;
+  CODE:
+    PERL_UNUSED_VAR(class);
+    Newxz(pNat, 1, SNPERL);
+    pNat->pParser = snparser_alloc();
+    pNat->pSrc = snsource_feed();
+    RETVAL = pNat;
+  OUTPUT:
+    RETVAL
+
+void
+push(self, data)
+    Shastina::Native self
+    SV *data
+  PREINIT:
+    const char *pData = NULL;
+    STRLEN len = 0;
+  CODE:
+    pData = SvPVbyte(data, len);
+    if (len > (STRLEN) LONG_MAX) {
+      croak("Block is too long, stopped");
+    }
+    if (!snsource_push(self->pSrc, pData, (long) len)) {
+      croak("Out of memory, stopped");
+    }
+
+void
+end(self)
+    Shastina::Native self
+  CODE:
+    snsource_end(self->pSrc);
+
+SV *
+read(self)
+    Shastina::Native self
+  PREINIT:
+    SNENTITY ent;
+    AV *pEnt = NULL;
+  CODE:
+    snparser_read(self->pParser, &ent, self->pSrc);
+    if (ent.status <= 0) {
+      /* EOF and errors, including SNERR_MORE, are returned as
+       * integers */
+      RETVAL = newSViv(ent.status);
+    
+    } else {
+      /* Other entities are array references with the entity type
+       * first, followed by the same fields as the pure-Perl parser */
+      pEnt = newAV();
+      av_push(pEnt, newSViv(ent.status));
+      
+      switch (ent.status) {
+        case SNENTITY_STRING:
+        case SNENTITY_META_STRING:
+          av_push(pEnt, snperl_str(aTHX_ ent.pKey, ent.key_len));
+          av_push(pEnt, newSViv(ent.str_type));
+          av_push(pEnt, snperl_str(aTHX_ ent.pValue, ent.value_len));
+          break;
+        
+        case SNENTITY_META_TOKEN:
+        case SNENTITY_NUMERIC:
+        case SNENTITY_VARIABLE:
+        case SNENTITY_CONSTANT:
+        case SNENTITY_ASSIGN:
+        case SNENTITY_GET:
+        case SNENTITY_OPERATION:
+          av_push(pEnt, snperl_str(aTHX_ ent.pKey, ent.key_len));
+          break;
+        
+        case SNENTITY_ARRAY:
+          av_push(pEnt, newSViv((IV) ent.count));
+          break;
+      }
+      
+      RETVAL = newRV_noinc((SV *) pEnt);
+    }
+  OUTPUT:
+    RETVAL
+
+SV *
+count(self)
+    Shastina::Native self
+  PREINIT:
+    long lc = 0;
+  CODE:
+    lc = snparser_count(self->pParser);
+    RETVAL = (lc < LONG_MAX) ? newSViv((IV) lc) : newSV(0);
+  OUTPUT:
+    RETVAL
+
+SV *
+bytes(self)
+    Shastina::Native self
+  PREINIT:
+    long bc = 0;
+  CODE:
+    bc = snsource_bytes(self->pSrc);
+    RETVAL = (bc < LONG_MAX) ? newSViv((IV) bc) : newSV(0);
+  OUTPUT:
+    RETVAL
+
+void
+DESTROY(self)
+    Shastina::Native self
+  CODE:
+    snparser_free(self->pParser);
+    snsource_free(self->pSrc);
+    Safefree(self);
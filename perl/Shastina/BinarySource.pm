@@ -34,7 +34,17 @@ may be slightly faster.)
 See the documentation for the parent class C<Shastina::Source> for more
 information about how input sources work.
 
-This subclass supports multipass operation.
+This subclass supports multipass operation and block reads.
+
+=cut
+
+# =========
+# Constants
+# =========
+
+# The maximum number of bytes in a block returned by readBlock.
+#
+use constant BLOCK_SIZE => 65536;
 
 =head1 CONSTRUCTOR
 
@@ -296,6 +306,103 @@ sub rewind {
   $self->{'_char'} = 0;
 }
 
+=item B<blockable()>
+
+This subclass I<does> support block reads, so this function always
+returns 1.
+
+=cut
+
+sub blockable {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # This subclass supports block reads
+  return 1;
+}
+
+=item B<readBlock()>
+
+Blocks are taken directly from the underlying string, up to 64
+kilobytes at a time.
+
+=cut
+
+sub readBlock {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # If we are in a special state, return undef
+  ($self->{'_state'} > 0) or return undef;
+  
+  # If _char is beyond end of string, go to EOF state and set that state
+  # property
+  if ($self->{'_char'} >= length(${$self->{'_src'}})) {
+    $self->{'_state'} = 0;
+    return undef;
+  }
+  
+  # If we got here, get the next block of characters
+  my $block = substr(${$self->{'_src'}}, $self->{'_char'}, BLOCK_SIZE);
+  
+  # If there is a character out of binary range [0, 255], cut the block
+  # just before it; if that leaves nothing, go to IOERR state and set
+  # that state property
+  if ($block =~ /[^\x{00}-\x{ff}]/g) {
+    my $bad = (pos $block) - 1;
+    if ($bad < 1) {
+      $self->{'_state'} = -1;
+      return undef;
+    }
+    $block = substr($block, 0, $bad);
+  }
+  
+  # Update the _char and _count properties
+  $self->{'_char' } += length($block);
+  $self->{'_count'} += length($block);
+  
+  # Return the block as a binary string
+  utf8::downgrade($block);
+  return $block;
+}
+
+=item B<unreadBlock(bytes)>
+
+=cut
+
+sub unreadBlock {
+  # Get parameters
+  ($#_ == 1) or die "Wrong number of parameters, stopped";
+  
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  my $block = shift;
+  (not ref($block)) or die "Wrong parameter type, stopped";
+  
+  # Nothing is given back in IOERR state or if there is nothing to give
+  # back
+  (($self->{'_state'} >= 0) and (length($block) > 0)) or return;
+  
+  # Step back over the given bytes and clear any EOF state
+  (length($block) <= $self->{'_char'}) or
+    die "Invalid parameter, stopped";
+  $self->{'_char' } -= length($block);
+  $self->{'_count'} -= length($block);
+  $self->{'_state'} = 1;
+}
+
 =back
 
 =head1 AUTHOR
@@ -115,9 +115,14 @@ these, you must import them with the C<:ERROR_CODES> tag:
   SNERR_OPENARRAY   Unclosed array
   SNERR_COMMA       Comma used outside of array or meta
   SNERR_UTF8        Invalid UTF-8 in input
+  SNERR_NOMEM       Memory allocation failed
+  SNERR_MORE        More input needed from feed source
 
 All of these error codes are integer values that are less than zero.
 
+C<SNERR_NOMEM> and C<SNERR_MORE> only come from the native backend (see
+C<Shastina::Native>).  C<Shastina::Parser> never returns C<SNERR_MORE>.
+
 =cut
 
 use constant SNERR_IOERR     =>  -1;
@@ -143,6 +148,8 @@ use constant SNERR_OPENMETA  => -20;
 use constant SNERR_OPENARRAY => -21;
 use constant SNERR_COMMA     => -22;
 use constant SNERR_UTF8      => -23;
+use constant SNERR_NOMEM     => -24;
+use constant SNERR_MORE      => -25;
 
 =head1 FUNCTIONS
 
@@ -190,7 +197,9 @@ my %ERROR_MESSAGES = (
   SNERR_OPENMETA()  => "Unclosed metacommand",
   SNERR_OPENARRAY() => "Unclosed array",
   SNERR_COMMA()     => "Comma used outside of array or meta",
-  SNERR_UTF8()      => "Invalid UTF-8 encountered in input"
+  SNERR_UTF8()      => "Invalid UTF-8 encountered in input",
+  SNERR_NOMEM()     => "Out of memory",
+  SNERR_MORE()      => "More input needed"
 );
 
 # The actual function
@@ -270,6 +279,8 @@ our @EXPORT_OK = qw(
   SNERR_OPENARRAY
   SNERR_COMMA
   SNERR_UTF8
+  SNERR_NOMEM
+  SNERR_MORE
 );
 our %EXPORT_TAGS = (
   CONSTANTS => [qw(
@@ -315,6 +326,8 @@ our %EXPORT_TAGS = (
     SNERR_OPENARRAY
     SNERR_COMMA
     SNERR_UTF8
+    SNERR_NOMEM
+    SNERR_MORE
   )]
 );
 
@@ -40,6 +40,9 @@ Shastina::Filter - Shastina codepoint input filter.
   
   # Push the most recently read codepoint back onto input stream
   $filter->pushback;
+  
+  # When done, give bytes that were read ahead back to the source
+  $filter->release;
 
 =head1 DESCRIPTION
 
@@ -81,6 +84,21 @@ that the filter behaves as the codepoint hasn't been read yet.  This is
 implemented with an internal buffer, so the underlying source instances
 do not need to support pushback.
 
+If the source supports block reads (see C<blockable()> in
+C<Shastina::Source>), the filter runs in I<block mode>.  It reads the
+source a block at a time and checks each run of clean input with a
+single regular expression match, where clean input is well-formed UTF-8
+that encodes no surrogates and has no CR except in CR+LF pairs.  Clean
+input needs no further checks when it is decoded.  Anything else is
+decoded one byte at a time with the regular filters, so the output is
+exactly the same in both modes.  The buffer of clean input also allows
+C<Shastina::Token> to match whole tokens with regular expressions
+instead of reading them one codepoint at a time.
+
+In block mode, the filter reads ahead of the codepoints it has returned.
+Call C<release()> when done to give the bytes that were read ahead back
+to the source.
+
 =cut
 
 # =========
@@ -100,6 +118,24 @@ use constant CPV_BOM => 0xfeff;
 #
 use constant MAX_COUNT => 9007199254740991;
 
+# Match the longest run of clean input at the start of a byte string.
+#
+# Clean input is well-formed UTF-8 with no encoded surrogates and no CR
+# except as part of a CR+LF pair.  The number of repeats is limited to
+# stay below the limit of the regular expression engine.
+#
+use constant CLEAN_RX => qr/\A(?:
+  [\x{00}-\x{0c}\x{0e}-\x{7f}]++ |
+  \x{0d}\x{0a} |
+  [\x{c2}-\x{df}][\x{80}-\x{bf}] |
+  \x{e0}[\x{a0}-\x{bf}][\x{80}-\x{bf}] |
+  [\x{e1}-\x{ec}\x{ee}\x{ef}][\x{80}-\x{bf}]{2} |
+  \x{ed}[\x{80}-\x{9f}][\x{80}-\x{bf}] |
+  \x{f0}[\x{90}-\x{bf}][\x{80}-\x{bf}]{2} |
+  [\x{f1}-\x{f3}][\x{80}-\x{bf}]{3} |
+  \x{f4}[\x{80}-\x{8f}][\x{80}-\x{bf}]{2}
+){1,32767}+/x;
+
 =head1 CONSTRUCTOR
 
 =over 4
@@ -138,9 +174,10 @@ sub wrap {
   # line count is updated after the LF leaves the buffer
   $self->{'_count'} = 0;
   
-  # The '_c' property stores the value that was most recently read; only
-  # valid when _count is greater than zero; either a Unicode codepoint
-  # (excluding surrogates), or an error code with a value less than zero
+  # The '_c' property stores the value that was most recently read;
+  # either a Unicode codepoint (excluding surrogates), which is only
+  # valid when _count is greater than zero, or an error code with a
+  # value less than zero, which may also be the very first thing read
   $self->{'_c'} = 0;
   
   # The '_push' flag is set when pushback mode is set; this may only be
@@ -154,6 +191,29 @@ sub wrap {
   # function
   $self->{'_dbuf'} = [0, 0, 0, 0];
   
+  # The '_bom' flag is cleared once the BOM filter can no longer apply;
+  # the BOM filter also requires _count to be zero, but in block mode
+  # the tokenizer may skip a BOM without reading a codepoint
+  $self->{'_bom'} = 1;
+  
+  # The '_blk' flag is set for block mode, which is used if the source
+  # supports block reads
+  $self->{'_blk'} = $src->blockable ? 1 : 0;
+  
+  # In block mode, the '_cln' property is a binary string of clean input
+  # and '_cpos' is the index of the next byte in it that has not been
+  # read; '_cln' may include CR+LF pairs, which the CR+LF filter handles
+  # the same way as anywhere else
+  $self->{'_cln'} = '';
+  $self->{'_cpos'} = 0;
+  
+  # In block mode, the '_raw' property is a binary string with the bytes
+  # that have been read from the source but not checked yet, and '_end'
+  # is zero until the source returns no more blocks, then SNERR_EOF or
+  # SNERR_IOERR
+  $self->{'_raw'} = '';
+  $self->{'_end'} = 0;
+  
   # Return the new object
   return $self;
 }
@@ -166,6 +226,305 @@ sub wrap {
 # Private instance methods
 # ========================
 
+# _readByte()
+# -----------
+#
+# Read the next byte that has not been checked.
+#
+# Outside of block mode, this just reads a byte from the input source.
+# In block mode, the byte is taken from the _raw buffer, reading another
+# block from the source if necessary.  The return is the same as for
+# the readByte function of sources.
+#
+sub _readByte {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Outside of block mode, read directly from the source
+  unless ($self->{'_blk'}) {
+    return $self->{'_src'}->readByte;
+  }
+  
+  # If nothing is buffered, read another block unless the source has
+  # already ended
+  unless (length($self->{'_raw'}) > 0) {
+    $self->_readBlock or return $self->{'_end'};
+  }
+  
+  # Take the first buffered byte
+  return ord(substr($self->{'_raw'}, 0, 1, ''));
+}
+
+# _readBlock()
+# ------------
+#
+# Append the next block from the source to the _raw buffer.
+#
+# Only used in block mode.  Returns one if a block was appended, or zero
+# if the source has ended, in which case _end is set.
+#
+sub _readBlock {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Once the source has ended, don't read further
+  ($self->{'_end'} == 0) or return 0;
+  
+  # Read a block and set _end if there is none
+  my $block = $self->{'_src'}->readBlock;
+  unless (defined $block) {
+    $self->{'_end'} =
+      $self->{'_src'}->hasError ? SNERR_IOERR : SNERR_EOF;
+    return 0;
+  }
+  
+  # Append the block
+  $self->{'_raw'} .= $block;
+  return 1;
+}
+
+# _fill()
+# -------
+#
+# Move more clean input into the _cln buffer.
+#
+# Only used in block mode.  Bytes of _cln that have already been read
+# are dropped, and then the run of clean input at the start of _raw is
+# moved to the end of _cln, reading blocks from the source as needed.
+# Returns one if at least one byte was moved.  Returns
+# zero if _raw does not start with clean input, in which case the next
+# codepoint must be read one byte at a time, or if the source has ended.
+#
+# Since no CR is clean unless it is followed by LF, and multibyte UTF-8
+# sequences may be split across blocks, more input is read whenever
+# _raw has less than four bytes.
+#
+sub _fill {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Drop the bytes that have been read
+  if ($self->{'_cpos'} > 0) {
+    $self->{'_cln'} = substr($self->{'_cln'}, $self->{'_cpos'});
+    $self->{'_cpos'} = 0;
+  }
+  
+  # Find a run of clean input, reading blocks while there are less than
+  # four bytes buffered
+  while (1) {
+    if ($self->{'_raw'} =~ CLEAN_RX) {
+      # Move the run
+      $self->{'_cln'} .= substr($self->{'_raw'}, 0, $+[0], '');
+      return 1;
+    }
+    
+    ((length($self->{'_raw'}) < 4) and $self->_readBlock) or return 0;
+  }
+}
+
+# _take(n)
+# --------
+#
+# Read n bytes of the _cln buffer at once.
+#
+# Only used in block mode, by Shastina::Token.  Pushback mode must be
+# off, the n bytes must be in the _cln buffer, n must be zero or
+# greater, and the bytes must end on a codepoint boundary that is not
+# between the CR and LF of a pair.  The line count is updated the same
+# way as if each codepoint were read with readCode, where each CR+LF
+# pair is a single LF codepoint.
+#
+# Returns the binary string that was read, with CR+LF pairs included.
+#
+sub _take {
+  # Get parameters
+  ($#_ == 1) or die "Wrong number of parameters, stopped";
+  
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  my $n = shift;
+  
+  (not $self->{'_push'}) or die "Invalid take, stopped";
+  ($self->{'_cpos'} + $n <= length($self->{'_cln'})) or
+    die "Invalid take, stopped";
+  
+  # Read the bytes
+  my $str = substr($self->{'_cln'}, $self->{'_cpos'}, $n);
+  $self->{'_cpos'} += $n;
+  ($n > 0) or return $str;
+  
+  # Decode the last codepoint
+  my $last = ord(substr($str, -1));
+  if ($last >= 0x80) {
+    ($str =~ /([\x{c0}-\x{ff}][\x{80}-\x{bf}]*)\z/) or die "Unexpected";
+    my $cs = $1;
+    utf8::decode($cs) or die "Unexpected";
+    $last = ord($cs);
+  }
+  
+  # Count the LF codepoints before the last one, which includes all of
+  # them unless the last codepoint is LF; CR+LF counts as one LF
+  my $lf = ($str =~ tr/\n//);
+  if ($last == CPV_LF) {
+    $lf--;
+  }
+  
+  # Update the line count; if it is zero, this is the very first
+  # codepoint, which starts line one; otherwise, an LF that was the
+  # last codepoint read before also counts
+  if ($self->{'_count'} == 0) {
+    $self->{'_count'} = 1;
+  } elsif (($self->{'_count'} > 0) and ($self->{'_c'} == CPV_LF)) {
+    $lf++;
+  }
+  if ($self->{'_count'} > 0) {
+    if ($self->{'_count'} <= MAX_COUNT - $lf) {
+      $self->{'_count'} += $lf;
+    } else {
+      $self->{'_count'} = -1;
+    }
+  }
+  
+  # The last codepoint is now the most recent one, and the BOM filter no
+  # longer applies
+  $self->{'_c'} = $last;
+  $self->{'_bom'} = 0;
+  
+  # Return the bytes
+  return $str;
+}
+
+# _isBlock()
+# ----------
+#
+# Return one if the filter is in block mode, zero otherwise.
+#
+sub _isBlock {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  return $self->{'_blk'};
+}
+
+# _text()
+# -------
+#
+# Return a reference to the _cln buffer.
+#
+# Used by Shastina::Token to match tokens directly in the buffer.  The
+# bytes starting at index _pos() have not been read yet.  The reference
+# stays valid, but _fill() changes the buffer.
+#
+sub _text {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  return \$self->{'_cln'};
+}
+
+# _pos()
+# ------
+#
+# Return the index of the next byte to read in the _cln buffer.
+#
+sub _pos {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  return $self->{'_cpos'};
+}
+
+# _pushed()
+# ---------
+#
+# Return the codepoint that was pushed back, or -1 if pushback mode is
+# off.
+#
+sub _pushed {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  return $self->{'_push'} ? $self->{'_c'} : -1;
+}
+
+# _unpush()
+# ---------
+#
+# Clear pushback mode, so that the codepoint that was pushed back counts
+# as read again.
+#
+sub _unpush {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  $self->{'_push'} = 0;
+}
+
+# _skipBOM()
+# ----------
+#
+# If nothing has been read yet and the _cln buffer starts with a BOM,
+# skip over it the same way as the BOM filter in readCode would.
+#
+sub _skipBOM {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  if ($self->{'_bom'} and ($self->{'_count'} == 0) and
+        (substr($self->{'_cln'}, $self->{'_cpos'}, 3) eq
+          "\x{ef}\x{bb}\x{bf}")) {
+    $self->{'_cpos'} += 3;
+    $self->{'_bom'} = 0;
+  }
+}
+
 # _readCPV()
 # ----------
 #
@@ -187,9 +546,27 @@ sub _readCPV {
   (ref($self) and $self->isa(__PACKAGE__)) or
     die "Wrong parameter type, stopped";
   
+  # In block mode, decode the next codepoint of clean input if there is
+  # any; clean input is always well-formed
+  if ($self->{'_blk'}) {
+    if (($self->{'_cpos'} < length($self->{'_cln'})) or $self->_fill) {
+      my $c = ord(substr($self->{'_cln'}, $self->{'_cpos'}, 1));
+      if ($c < 0x80) {
+        $self->{'_cpos'}++;
+        return $c;
+      }
+      
+      my $n = sn_utf8_trail($c) + 1;
+      my $cs = substr($self->{'_cln'}, $self->{'_cpos'}, $n);
+      $self->{'_cpos'} += $n;
+      utf8::decode($cs) or die "Unexpected";
+      return ord($cs);
+    }
+  }
+  
   # Read the lead byte from the underlying input source into the start
   # of the decoding buffer
-  $self->{'_dbuf'}->[0] = $self->{'_src'}->readByte;
+  $self->{'_dbuf'}->[0] = $self->_readByte;
   if ($self->{'_dbuf'}->[0] < 0) {
     # Error condition while reading lead byte, so return that
     return $self->{'_dbuf'}->[0];
@@ -202,7 +579,7 @@ sub _readCPV {
   # Read all trailing bytes into the decoding buffer; if EOF error
   # encountered return UTF8 error; else, pass through the error
   for(my $i = 1; $i <= $trail; $i++) {
-    $self->{'_dbuf'}->[$i] = $self->{'_src'}->readByte;
+    $self->{'_dbuf'}->[$i] = $self->_readByte;
     if ($self->{'_dbuf'}->[$i] < 0) {
       if ($self->{'_dbuf'}->[$i] == SNERR_EOF) {
         return SNERR_UTF8;
@@ -249,11 +626,11 @@ sub readCode {
   (ref($self) and $self->isa(__PACKAGE__)) or
     die "Wrong parameter type, stopped";
   
-  # If we are not in pushback mode AND either we haven't read anything
-  # yet, or we have read something other than an error code, then we
-  # need to read another codepoint
-  if ((not $self->{'_push'}) and
-        (($self->{'_count'} == 0) or ($self->{'_c'} >= 0))) {
+  # If we are not in pushback mode AND we have not read an error code,
+  # then we need to read another codepoint; _c starts out as zero, so
+  # this includes the case where nothing has been read yet, while an
+  # error at the very first codepoint is kept just like any other
+  if ((not $self->{'_push'}) and ($self->{'_c'} >= 0)) {
     
     # Read an unfiltered codepoint from the input source
     my $cpv = $self->_readCPV;
@@ -262,7 +639,7 @@ sub readCode {
     if ($cpv == CPV_BOM) {
       # If this BOM codepoint is the very first codepoint read, then
       # skip it by reading another codepoint
-      if ($self->{'_count'} == 0) {
+      if (($self->{'_count'} == 0) and $self->{'_bom'}) {
         $cpv = $self->_readCPV;
       }
     }
@@ -415,7 +792,7 @@ sub pushback {
     die "Wrong parameter type, stopped";
   
   # Only proceed if not in an error code state
-  if (($self->{'_count'} == 0) || ($self->{'_c'} >= 0)) {
+  if ($self->{'_c'} >= 0) {
     # At least one codepoint must have already been read
     ($self->{'_count'} > 0) or die "Invalid pushback, stopped";
     
@@ -427,6 +804,41 @@ sub pushback {
   }
 }
 
+=item B<release()>
+
+Give the bytes that were read ahead in block mode back to the source.
+
+Afterwards, the C<count()> function of the source counts the same bytes
+as if the source had been read one byte at a time, and the source can
+be used again, for example to C<consume()> the rest of input.  Only call
+this when done reading from the filter.  Nothing happens if the filter
+is not in block mode, or if the source has run into an I/O error.
+
+=cut
+
+sub release {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Only applies to block mode
+  $self->{'_blk'} or return;
+  
+  # Give back the clean input that has not been read along with the
+  # bytes that have not been checked
+  $self->{'_src'}->unreadBlock(
+    substr($self->{'_cln'}, $self->{'_cpos'}) . $self->{'_raw'});
+  
+  # Clear the buffers
+  $self->{'_cln'} = '';
+  $self->{'_cpos'} = 0;
+  $self->{'_raw'} = '';
+}
+
 =back
 
 =head1 AUTHOR
@@ -39,7 +39,7 @@ until parsing is complete.
 
 Standard input can only be read through once, so this input source does
 I<not> support multipass operation.  Also, you can't create more than
-one instance of this class.
+one instance of this class.  Block reads are supported.
 
 See the documentation for the parent class C<Shastina::Source> for more
 information about how input sources work.
@@ -52,7 +52,7 @@ information about how input sources work.
 
 # The size in bytes of the buffer to use when reading through input.
 #
-use constant BUFFER_SIZE => 4096;
+use constant BUFFER_SIZE => 65536;
 
 # The maximum byte count size, to avoid overflow problems.
 #
@@ -372,6 +372,126 @@ sub consume {
   }
 }
 
+=item B<blockable()>
+
+This subclass I<does> support block reads, so this function always
+returns 1.
+
+=cut
+
+sub blockable {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # This subclass supports block reads
+  return 1;
+}
+
+=item B<readBlock()>
+
+Each block is whatever remains in the buffer, or else the next buffer of
+data read from standard input.
+
+=cut
+
+sub readBlock {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # If we are in a special state, return undef
+  ($self->{'_state'} > 0) or return undef;
+  
+  # If nothing is buffered, refill the buffer
+  unless ($self->{'_take'} < $self->{'_fill'}) {
+    # Attempt to read into the buffer
+    my $rc = read STDIN, $self->{'_buf'}, $self->{'_bsize'};
+    
+    # Handle EOF and IOERR conditions
+    if (not (defined $rc)) {
+      # I/O error
+      $self->{'_state'} = -1;
+      return undef;
+    
+    } elsif ($rc < 1) {
+      # EOF
+      $self->{'_state'} = 0;
+      return undef;
+    }
+    
+    # If we got here, at least one character was read, so update the
+    # _take and _fill
+    $self->{'_take'} = 0;
+    $self->{'_fill'} = $rc;
+  }
+  
+  # Take everything that is buffered
+  my $block = substr($self->{'_buf'}, $self->{'_take'},
+                      $self->{'_fill'} - $self->{'_take'});
+  $self->{'_take'} = 0;
+  $self->{'_fill'} = 0;
+  
+  # If count has not overflown yet, attempt to increase, watching for
+  # overflow
+  if ($self->{'_count'} >= 0) {
+    if ($self->{'_count'} <= MAX_COUNT - length($block)) {
+      $self->{'_count'} += length($block);
+    } else {
+      $self->{'_count'} = -1;
+    }
+  }
+  
+  # Return the block
+  return $block;
+}
+
+=item B<unreadBlock(bytes)>
+
+The given bytes are put back in front of the buffer.  If the byte
+counter has overflown, it stays overflown.
+
+=cut
+
+sub unreadBlock {
+  # Get parameters
+  ($#_ == 1) or die "Wrong number of parameters, stopped";
+  
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  my $block = shift;
+  (not ref($block)) or die "Wrong parameter type, stopped";
+  
+  # Nothing is given back in IOERR state or if there is nothing to give
+  # back
+  (($self->{'_state'} >= 0) and (length($block) > 0)) or return;
+  
+  # Put the bytes back in front of whatever remains in the buffer and
+  # clear any EOF state
+  $self->{'_buf'} = $block . substr($self->{'_buf'}, $self->{'_take'},
+                      $self->{'_fill'} - $self->{'_take'});
+  $self->{'_take'} = 0;
+  $self->{'_fill'} = length($self->{'_buf'});
+  $self->{'_state'} = 1;
+  
+  # Take the bytes back out of the count unless it has overflown
+  if ($self->{'_count'} >= 0) {
+    ($self->{'_count'} >= length($block)) or
+      die "Invalid parameter, stopped";
+    $self->{'_count'} -= length($block);
+  }
+}
+
 =back
 
 =head1 AUTHOR
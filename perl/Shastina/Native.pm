@@ -0,0 +1,157 @@
+package Shastina::Native;
+use v5.14;
+use warnings;
+
+# Core imports
+use XSLoader;
+
+our $VERSION = '1.00';
+
+XSLoader::load('Shastina::Native', $VERSION);
+
+=head1 NAME
+
+Shastina::Native - Optional native backend for the Shastina parser.
+
+=head1 SYNOPSIS
+
+  use Shastina::Native;
+  use Shastina::Const qw(:ERROR_CODES);
+  
+  # Construct a native parser around a feed source
+  my $nat = Shastina::Native->new;
+  
+  # Read entities, pushing more bytes whenever they are needed
+  my $ent;
+  while (1) {
+    $ent = $nat->read;
+    if ((not ref($ent)) and ($ent == SNERR_MORE)) {
+      my $block = ...;
+      if (defined $block) {
+        $nat->push($block);
+      } else {
+        $nat->end;
+      }
+      next;
+    }
+    
+    # Entities have the same format as Shastina::Parser readEntity
+    ...
+    (ref($ent)) or last;
+  }
+  
+  # Current line count, or undef on overflow
+  my $lcount = $nat->count;
+  
+  # Bytes read through the |; EOF marker, or undef on overflow
+  my $bcount = $nat->bytes;
+
+=head1 DESCRIPTION
+
+This module wraps the C Shastina library with XS.  Each object holds a
+C parser and a C feed source.  Blocks of input bytes are pushed into the
+feed source, and entities are read back in the same format that
+C<Shastina::Parser> uses.
+
+Clients do not normally use this module directly.  C<Shastina::Parser>
+loads it automatically if it is available, and then parses input
+sources that support block reads (see C<blockable()> in
+C<Shastina::Source>) with the C library instead of with the pure-Perl
+implementation.  Setting the C<SHASTINA_PUREPERL> environment variable
+to a true value before the first parser is constructed disables the
+native backend.
+
+The module is built with the C<Makefile.PL> in the Perl library
+directory, which compiles the C library from the C<c> directory of the
+source tree into the module.  If the module has not been built, the
+pure-Perl implementation is used and nothing else changes.
+
+=head1 CONSTRUCTOR
+
+=over 4
+
+=item B<new()>
+
+Construct a new native parser with an empty feed source.
+
+=back
+
+=head1 INSTANCE METHODS
+
+=over 4
+
+=item B<push(bytes)>
+
+Push a binary string of input bytes into the feed source.
+
+=item B<end()>
+
+Mark the end of input.  After this call, C<read()> never returns
+C<SNERR_MORE> and no more bytes may be pushed.
+
+=item B<read()>
+
+Read the next entity.
+
+Entities are returned as array references in the format described for
+C<readEntity()> in C<Shastina::Parser>.  The C<SNENTITY_EOF> entity and
+errors are returned as integers, and errors are kept the same way as in
+C<Shastina::Parser>.
+
+The exception is C<SNERR_MORE> (which is -25), which means that more
+input must be pushed or the end of input must be marked before calling
+this function again.  It is not kept.
+
+The C library may also report C<SNERR_NOMEM> (which is -24) if memory
+can not be allocated.
+
+=item B<count()>
+
+Return the current line count, or C<undef> if the line count has
+overflowed.
+
+=item B<bytes()>
+
+Return how many pushed bytes the parser has read.  After the
+C<SNENTITY_EOF> entity, this is the number of bytes up to and including
+the semicolon of the C<|;> EOF marker.  Returns C<undef> if the count
+has overflowed.
+
+=back
+
+=head1 AUTHOR
+
+Noah Johnson E<lt>noah.johnson@loupmail.comE<gt>
+
+=head1 COPYRIGHT
+
+Copyright 2022 Multimedia Data Technology, Inc.
+
+This program is free software.  You can redistribute it and/or modify it
+under the same terms as Perl itself.
+
+This program is also dual-licensed under the MIT license:
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+=cut
+
+# End with something that evaluates to true
+1;
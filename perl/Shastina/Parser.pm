@@ -195,6 +195,22 @@ The C<count()> instance function allows you at any time to return the
 current line number in the underlying source file.  This is especially
 useful for error reporting.
 
+If the optional C<Shastina::Native> module has been built, parsers
+automatically use the C library to parse sources that support block
+reads, which includes the file, standard input, and binary string
+sources.  The pure-Perl implementation is still used for all other
+sources, or if the native module is not available, or if the
+C<SHASTINA_PUREPERL> environment variable is set to a true value.  See
+C<Shastina::Native> for further information.
+
+The entities, line counts, and error codes are meant to be the same with
+either implementation, including on malformed input such as invalid
+UTF-8 or a CR that is not followed by LF.  The one exception is
+C<SNERR_NOMEM>, which only the native module returns, when the C
+library runs out of memory.  The C<shcmp.pl> program in the C<perl>
+directory compares the two implementations on a list of mostly
+malformed inputs, or on the files given to it.
+
 =cut
 
 # =========
@@ -216,6 +232,19 @@ use constant MAX_COUNT => 2147483647;
 #
 use constant MAX_AG_STACK => 1024;
 
+# ==========
+# Local data
+# ==========
+
+# Flag indicating whether the native backend is used.
+#
+# This is undef until the first parser is constructed, which attempts to
+# load Shastina::Native unless the SHASTINA_PUREPERL environment
+# variable is set; then it is one if the native backend was loaded and
+# zero if not.
+#
+my $_native;
+
 =head1 CONSTRUCTOR
 
 =over 4
@@ -265,10 +294,41 @@ sub parse {
   my $self = { };
   bless($self, $class);
   
+  # Attempt to load the native backend if this is the first parser
+  unless (defined $_native) {
+    if ($ENV{'SHASTINA_PUREPERL'}) {
+      $_native = 0;
+    } else {
+      $_native = (eval { require Shastina::Native; 1 }) ? 1 : 0;
+    }
+  }
+  
   # The '_state' property is one if OK, zero if final entity has been
   # returned, negative if an error has been returned
   $self->{'_state'} = 1;
   
+  # The '_nat' property stores the Shastina::Native parser if the native
+  # backend is used for this source, or else undef; the native backend
+  # requires block reads from the source
+  $self->{'_nat'} = undef;
+  if ($_native and $src->blockable) {
+    $self->{'_nat'} = Shastina::Native->new;
+    
+    # The '_src' property stores the input source, which blocks are read
+    # from and given back to
+    $self->{'_src'} = $src;
+    
+    # The '_pend' property stores a binary string with the pushed bytes
+    # that the native parser might not have read yet, and '_pbase' is
+    # the native byte count at the start of '_pend'; these allow the
+    # unread bytes to be given back to the source at the end
+    $self->{'_pend'} = '';
+    $self->{'_pbase'} = 0;
+    
+    # Nothing else is needed for the native backend
+    return $self;
+  }
+  
   # The '_fil' property stores the filter that is wrapped around the
   # input source; this is used for getting the line number
   $self->{'_fil'} = Shastina::Filter->wrap($src);
@@ -319,6 +379,84 @@ sub parse {
 # Private instance methods
 # ========================
 
+# _nativeRead()
+# -------------
+#
+# Read the next entity with the native backend.
+#
+# Whenever the native parser needs more input, the next block is read
+# from the source and pushed into it, and the end of input is marked
+# once the source reaches EOF.  An I/O error in the source becomes an
+# SNERR_IOERR error.
+#
+# When the native parser returns the EOF entity or an error, any pushed
+# bytes that it did not read are given back to the source, so the
+# source count and consume() work the same way as with the pure-Perl
+# implementation.  The EOF entity or error is then stored in _state.
+#
+# The return value is the same as for readEntity().  This may only be
+# used while _state is one.
+#
+sub _nativeRead {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  my $nat = $self->{'_nat'};
+  my $src = $self->{'_src'};
+  
+  # Read entities, feeding the native parser as needed
+  my $ent;
+  for($ent = $nat->read; (not ref($ent)) and ($ent == SNERR_MORE);
+      $ent = $nat->read) {
+    # Drop the pending bytes that the native parser has read already
+    my $bc = $nat->bytes;
+    if ((defined $bc) and ($bc > $self->{'_pbase'})) {
+      $self->{'_pend'} = substr($self->{'_pend'},
+                                  $bc - $self->{'_pbase'});
+      $self->{'_pbase'} = $bc;
+    }
+    
+    # Read the next block from the source
+    my $block = $src->readBlock;
+    if (defined $block) {
+      # Push the block into the native parser
+      $nat->push($block);
+      $self->{'_pend'} .= $block;
+    
+    } elsif ($src->hasError) {
+      # I/O error
+      $ent = SNERR_IOERR;
+      last;
+    
+    } else {
+      # EOF
+      $nat->end;
+    }
+  }
+  
+  # If we got an entity, return it
+  if (ref($ent)) {
+    return $ent;
+  }
+  
+  # We reached the end, so give back the bytes that were not read
+  my $bc = $nat->bytes;
+  if ((defined $bc) and ($bc >= $self->{'_pbase'})) {
+    $src->unreadBlock(
+      substr($self->{'_pend'}, $bc - $self->{'_pbase'}));
+  }
+  $self->{'_pend'} = '';
+  
+  # Store the EOF entity or error in state and return it
+  $self->{'_state'} = $ent;
+  return $ent;
+}
+
 # _arrayPrefix()
 # --------------
 #
@@ -576,8 +714,12 @@ sub _fill {
     } elsif ($tk eq '[') { # ===========================================
       # Begin array -- just set the array flag here and don't add any
       # entities because we don't know yet whether the array is empty or
-      # not
+      # not; the array prefix may have queued an entity for an enclosing
+      # array, though
       $self->{'_array'} = 1;
+      if (scalar(@{$self->{'_queue'}}) > 0) {
+        return 1;
+      }
       return 0;
       
     } elsif ($tk eq ']') { # ===========================================
@@ -760,7 +902,13 @@ sub readEntity {
     return $self->{'_state'};
   }
   
-  # If queue is empty, fill it
+  # If the native backend is used, read through that
+  if (defined $self->{'_nat'}) {
+    return $self->_nativeRead;
+  }
+  
+  # If queue is empty, fill it; once the final state is reached, give
+  # the bytes the filter read ahead back to the source
   unless (scalar(@{$self->{'_queue'}}) > 0) {
     my $retval;
     for(
@@ -768,6 +916,7 @@ sub readEntity {
       $retval == 0;
       $retval = $self->_fill) { }
     unless ($retval > 0) {
+      $self->{'_fil'}->release;
       return $self->{'_state'};
     }
   }
@@ -781,6 +930,7 @@ sub readEntity {
   unless (ref($ent)) {
     ($ent == SNENTITY_EOF) or die "Unexpected";
     $self->{'_state'} = 0;
+    $self->{'_fil'}->release;
   }
   
   # Return the entity we read
@@ -804,10 +954,33 @@ sub count {
   (ref($self) and $self->isa(__PACKAGE__)) or
     die "Wrong parameter type, stopped";
   
-  # Call through to the filter
+  # Call through to the native parser or the filter
+  if (defined $self->{'_nat'}) {
+    return $self->{'_nat'}->count;
+  }
   return $self->{'_fil'}->count;
 }
 
+=item B<native()>
+
+Return one if this parser uses the native backend, or zero if it uses
+the pure-Perl implementation.
+
+=cut
+
+sub native {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Check whether there is a native parser
+  return (defined $self->{'_nat'}) ? 1 : 0;
+}
+
 =back
 
 =head1 AUTHOR
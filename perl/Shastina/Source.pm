@@ -37,6 +37,14 @@ Shastina::Source - Base class for Shastina input sources.
   if ($src->multipass) {
     $src->rewind;
   }
+  
+  # If block reads are supported, many bytes can be read at once
+  if ($src->blockable) {
+    my $block = $src->readBlock;
+    if (defined $block) {
+      ...
+    }
+  }
 
 =head1 DESCRIPTION
 
@@ -93,9 +101,10 @@ sub readByte {
 
 Check whether the data source has encountered an I/O error.
 
-This is true if C<readByte()> has returned C<SNERR_IOERR>, and otherwise
-false.  For multipass sources, rewinding the source might clear this
-error condition.
+This is true if C<readByte()> has returned C<SNERR_IOERR> or
+C<readBlock()> has run into an I/O error, and otherwise false.  For
+multipass sources, rewinding the source might clear this error
+condition.
 
 =cut
 
@@ -228,6 +237,92 @@ sub rewind {
   die "Multipass operation not supported on this input source, stopped";
 }
 
+=item B<blockable()>
+
+Check whether this input source supports block reads.  If block reads
+are supported, this function will return one and the C<readBlock> and
+C<unreadBlock> functions will be available.
+
+Block reads let C<Shastina::Parser> hand the input to the native backend
+(see C<Shastina::Native>) many bytes at a time.  Sources that do not
+support block reads are always parsed with the pure-Perl implementation.
+
+The implementation in the base class returns zero from this function and
+causes an error if C<readBlock> or C<unreadBlock> is called, the same
+way as for C<multipass> and C<rewind>.
+
+=cut
+
+sub blockable {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # This base implementation always returns no block reads
+  return 0;
+}
+
+=item B<readBlock()>
+
+Read the next block of bytes from the data source.
+
+The return value is a binary string of one or more bytes, or else
+C<undef> at End Of File or on an I/O error.  (Error codes would be
+ambiguous here, because a block may itself look like a number.)  Call
+C<hasError> to tell the two conditions apart.  Blocks have no fixed
+size.  C<count()> includes all the bytes of each block that has been
+returned.
+
+This is only supported if the C<blockable()> function is true.
+
+=cut
+
+sub readBlock {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # This base implementation always causes an error
+  die "Block reads not supported on this input source, stopped";
+}
+
+=item B<unreadBlock(bytes)>
+
+Give back the bytes at the end of what has been read from the source,
+so that they are read again, and take them out of C<count()>.
+
+The given binary string must be a suffix of the bytes that have been
+read since the last rewind, or undefined behavior occurs.  If the source
+is at EOF, giving back bytes clears the EOF condition.  Nothing is given
+back if the source has an I/O error.
+
+This is how C<Shastina::Parser> gives back the bytes after the C<|;> EOF
+marker that the native backend did not use.  It is only supported if
+the C<blockable()> function is true.
+
+=cut
+
+sub unreadBlock {
+  # Check parameter count
+  ($#_ == 1) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # This base implementation always causes an error
+  die "Block reads not supported on this input source, stopped";
+}
+
 =back
 
 =head1 AUTHOR
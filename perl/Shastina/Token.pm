@@ -59,6 +59,14 @@ instance that allows a filtered codepoint sequence to be read.
 There is a single public instance function, C<readToken>, which allows
 iteration through all the tokens.
 
+If the filter is in block mode (see C<Shastina::Filter>), tokens are
+matched with regular expressions directly in the buffer of clean input
+in the filter, which is much faster than reading them one codepoint at
+a time.  Whenever a token can not be matched that way, because it is an
+error or because the buffer ends in a place where the regular filters
+are needed, the token is read one codepoint at a time as usual.  The
+tokens, line counts, and error codes are the same either way.
+
 =cut
 
 # =========
@@ -102,6 +110,13 @@ use constant CPV_VISIBLE_MAX => 0x7e;
 use constant MAX_STRING => 65534;
 use constant MAX_TOKEN  => 65534;
 
+# Maximum number of characters of a comment that will be buffered while
+# looking for its end in block mode.
+#
+# Longer comments are read one codepoint at a time instead.
+#
+use constant MAX_COMMENT => 1048576;
+
 # Maximum curly nesting within curly string literals.
 #
 use constant MAX_NEST => 2147483647;
@@ -261,6 +276,10 @@ sub wrap {
   # parsing functions
   $self->{'_err'} = 0;
   
+  # The '_fast' property is one if tokens are matched directly in the
+  # buffer of a filter in block mode, zero otherwise
+  $self->{'_fast'} = $fil->_isBlock;
+  
   # Return the new object
   return $self;
 }
@@ -625,6 +644,218 @@ sub _readPlain {
   return $tks;
 }
 
+# _fastScan()
+# -----------
+#
+# Match the next token in the buffer of a filter in block mode.
+#
+# Pushback mode must be off in the filter.  Whitespace and comments are
+# skipped, and then the token is matched.  If the complete token is in
+# the buffer, it is read from the filter and returned in the same
+# format as readToken, except that errors are never returned.
+#
+# If the buffer ends before the token does, nothing of the token is
+# read and the return is one, which means the buffer should be filled
+# and the function called again.  If the token is an error, or the
+# filter can not add the next character to the buffer, nothing of
+# the token is read and the return is undef, which means the token
+# should be read one codepoint at a time instead.
+#
+sub _fastScan {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Get the filter and its buffer
+  my $fil = $self->{'_fil'};
+  my $d = $fil->_text;
+  
+  # Skip a BOM at the very start, and then whitespace and comments
+  $fil->_skipBOM;
+  my $p = $fil->_pos;
+  pos($$d) = $p;
+  while ($$d =~ /\G(?:[ \t\r\n]++|#[^\n]*+\n)/gc) { }
+  if (pos($$d) > $p) {
+    $fil->_take(pos($$d) - $p);
+    $p = pos($$d);
+  }
+  
+  # Get the first character of the token, checking whether there is a
+  # comment that has not ended within the buffer
+  my $len = length($$d);
+  ($p < $len) or return 1;
+  
+  my $c = substr($$d, $p, 1);
+  if ($c eq '#') {
+    ($len - $p <= MAX_COMMENT) or return undef;
+    return 1;
+  }
+  
+  # Check for the |; token
+  if ($c eq '|') {
+    ($p + 1 < $len) or return 1;
+    if (substr($$d, $p + 1, 1) eq ';') {
+      $fil->_take(2);
+      return 0;
+    }
+  }
+  
+  # Atomic characters other than the string openers are tokens by
+  # themselves
+  if ($c =~ /\A[()\[\],%;}]\z/) {
+    return [ $fil->_take(1) ];
+  }
+  
+  # Get the string prefix and the opening quote or curly, or else return
+  # a simple token that ends with an exclusive character
+  my $prefix = '';
+  my $q = $p;
+  unless (($c eq '"') or ($c eq '{')) {
+    pos($$d) = $p;
+    ($$d =~ /\G[!\$&'*+\-.\/0-9:<=>?\@A-Z\\^_`a-z|~]++/gc) or
+      return undef;
+    $q = pos($$d);
+    ($q - $p <= MAX_TOKEN) or return undef;
+    ($q < $len) or return 1;
+    
+    $c = substr($$d, $q, 1);
+    if ($c =~ /\A[ \t\r\n()\[\],%;#}]\z/) {
+      return [ $fil->_take($q - $p) ];
+    }
+    
+    (($c eq '"') or ($c eq '{')) or return undef;
+    ($q + 1 - $p <= MAX_TOKEN) or return undef;
+    $prefix = substr($$d, $p, $q - $p);
+  }
+  
+  # Find the character that closes the string payload, skipping over
+  # escaped characters; nul characters are errors
+  my $s = $q + 1;
+  my $nest = 1;
+  my $e;
+  pos($$d) = $s;
+  while (1) {
+    if ($c eq '"') {
+      $$d =~ /\G[^"\\\x{00}]*+/gc;
+    } else {
+      $$d =~ /\G[^{}\\\x{00}]*+/gc;
+    }
+    $e = pos($$d);
+    
+    # Strings that are much longer than the limit are always errors
+    ($e - $s <= 2 * MAX_STRING + 2) or return undef;
+    ($e < $len) or return 1;
+    
+    my $x = substr($$d, $e, 1);
+    if ($x eq '\\') {
+      ($e + 1 < $len) or return 1;
+      (substr($$d, $e + 1, 1) ne "\x{00}") or return undef;
+      pos($$d) = $e + 2;
+    
+    } elsif ($x eq '"') {
+      last;
+    
+    } elsif ($x eq '{') {
+      $nest++;
+      pos($$d) = $e + 1;
+    
+    } elsif ($x eq '}') {
+      $nest--;
+      last if ($nest < 1);
+      pos($$d) = $e + 1;
+    
+    } else {
+      return undef;
+    }
+  }
+  
+  # Get the payload with CR+LF pairs filtered, check its length in
+  # bytes, and decode it
+  my $payload = substr($$d, $s, $e - $s);
+  $payload =~ s/\r\n/\n/g;
+  (length($payload) <= MAX_STRING) or return undef;
+  utf8::decode($payload) or die "Unexpected";
+  
+  # Read the whole string token and return it
+  $fil->_take($e + 1 - $p);
+  return [ $prefix, ($c eq '"') ? SNSTRING_QUOTED : SNSTRING_CURLY,
+            $payload ];
+}
+
+# _fastToken()
+# ------------
+#
+# Read the next token directly from the buffer of a filter in
+# block mode.
+#
+# The return is the same as for _fastScan, except that one is never
+# returned.  If undef is returned, the token should be read one
+# codepoint at a time from the filter instead.
+#
+sub _fastToken {
+  # Check parameter count
+  ($#_ == 0) or die "Wrong number of parameters, stopped";
+  
+  # Get self
+  my $self = shift;
+  (ref($self) and $self->isa(__PACKAGE__)) or
+    die "Wrong parameter type, stopped";
+  
+  # Get the filter
+  my $fil = $self->{'_fil'};
+  
+  # The previous token may have ended with an exclusive character that
+  # was pushed back, in which case handle that character first
+  my $c = $fil->_pushed;
+  if (($c == CPV_SP) or ($c == CPV_HT) or ($c == CPV_LF)) {
+    # Whitespace is skipped, so just read it again
+    $fil->_unpush;
+  
+  } elsif (($c == CPV_LPAREN) or ($c == CPV_RPAREN) or
+            ($c == CPV_LSQR) or ($c == CPV_RSQR) or
+            ($c == CPV_COMMA) or ($c == CPV_PERCENT) or
+            ($c == CPV_SEMICOLON) or ($c == CPV_RCURL)) {
+    # Atomic character is a token by itself
+    $fil->_unpush;
+    return [ chr($c) ];
+  
+  } elsif ($c == CPV_POUNDSIGN) {
+    # Start of a comment, so skip through the end of the comment if it
+    # can be found in the buffer
+    my $d = $fil->_text;
+    while (1) {
+      pos($$d) = $fil->_pos;
+      if ($$d =~ /\G[^\n]*+\n/gc) {
+        my $n = pos($$d) - $fil->_pos;
+        $fil->_unpush;
+        $fil->_take($n);
+        last;
+      }
+      
+      ((length($$d) - $fil->_pos <= MAX_COMMENT) and $fil->_fill) or
+        return undef;
+    }
+  
+  } elsif ($c >= 0) {
+    return undef;
+  }
+  
+  # Match the token, filling the buffer as needed
+  my $tk;
+  for($tk = $self->_fastScan;
+      (defined $tk) and (not ref($tk)) and ($tk == 1);
+      $tk = $self->_fastScan) {
+    $fil->_fill or return undef;
+  }
+  
+  # Return the token
+  return $tk;
+}
+
 =head1 INSTANCE METHODS
 
 =over 4
@@ -665,6 +896,18 @@ sub readToken {
     return $self->{'_state'};
   }
   
+  # In block mode, first try to match the token directly in the buffer
+  # of the filter
+  if ($self->{'_fast'}) {
+    my $tk = $self->_fastToken;
+    if (defined $tk) {
+      unless (ref($tk)) {
+        $self->{'_state'} = $tk;
+      }
+      return $tk;
+    }
+  }
+  
   # Read a plain token
   my $plain = $self->_readPlain;
   unless (defined $plain) {
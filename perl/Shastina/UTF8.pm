@@ -350,7 +350,8 @@ array or decoding will fail.
 This function returns the decoded Unicode codepoint, or -1 if decoding
 failed.  Surrogate codepoints will successfully decode with this
 function, even though they are not technically supposed to be present in
-UTF-8.  However, overlong encodings will cause decoding to fail.
+UTF-8.  However, overlong encodings and encodings of values beyond the
+Unicode codepoint range will cause decoding to fail.
 
 =cut
 
@@ -413,6 +414,9 @@ sub sn_utf8_decode {
   # Fail if overlong encoding
   ($result >= $OVERLONG_CHECK[$trail]) or return -1;
   
+  # Fail if beyond Unicode codepoint range
+  ($result <= 0x10ffff) or return -1;
+  
   # If we got here, return result
   return $result;
 }
@@ -0,0 +1,168 @@
+#!/usr/bin/env perl
+use v5.14;
+use warnings;
+
+# Core imports
+use Time::HiRes qw(time);
+
+# Shastina imports
+use Shastina::Const qw(:CONSTANTS :ERROR_CODES snerror_str);
+use Shastina::FileSource;
+use Shastina::Filter;
+use Shastina::Parser;
+use Shastina::Token;
+
+=head1 NAME
+
+shbench.pl - Shastina parser benchmark program.
+
+=head1 SYNOPSIS
+
+  ./shbench.pl [-t seconds] file1.shastina file2.shastina ...
+
+=head1 DESCRIPTION
+
+Benchmarks the Perl Shastina parser on each of the given files, and
+reports the throughput of each processing stage.
+
+The output has the same format as the C benchmark program C<shbench.c>,
+with C<perl> as the source type.  Use the C<-w> option of the C program
+to write its generated corpora to files, and then give those files to
+both programs to compare the two implementations on the same input.
+The item counts of each stage must be the same in both programs.
+
+The C<source> stage reads raw bytes, the C<filter> stage reads
+codepoints through the input filter, the C<token> stage reads tokens,
+and the C<reader> stage reads entities.  Each measurement is repeated
+until it has taken at least the number of seconds given with C<-t>,
+which is 0.25 by default.
+
+If the native backend (see C<Shastina::Native>) is available, the
+C<reader> stage uses it and is reported with C<native> as the source
+type.  Set the C<SHASTINA_PUREPERL> environment variable to measure the
+pure-Perl reader instead.
+
+=cut
+
+# ===============
+# Local functions
+# ===============
+
+# run_pass(path, stage)
+# ---------------------
+#
+# Run a single pass of the given stage over the file at the given path.
+#
+# Returns the number of items the pass produced, the error code the
+# pass ended with, or zero, and whether the native backend was used.
+#
+sub run_pass {
+  ($#_ == 1) or die "Wrong number of parameters, stopped";
+  my $path  = shift;
+  my $stage = shift;
+  
+  my $src = Shastina::FileSource->load($path);
+  (defined $src) or die "Can't open $path, stopped";
+  
+  my $count = 0;
+  my $err = 0;
+  my $native = 0;
+  
+  if ($stage eq 'source') {
+    my $c;
+    for($c = $src->readByte; $c >= 0; $c = $src->readByte) {
+      $count++;
+    }
+    ($c == SNERR_EOF) or $err = $c;
+  
+  } elsif ($stage eq 'filter') {
+    my $fil = Shastina::Filter->wrap($src);
+    my $c;
+    for($c = $fil->readCode; $c >= 0; $c = $fil->readCode) {
+      $count++;
+    }
+    ($c == SNERR_EOF) or $err = $c;
+  
+  } elsif ($stage eq 'token') {
+    my $tok = Shastina::Token->wrap(Shastina::Filter->wrap($src));
+    my $tk;
+    for($tk = $tok->readToken; ref($tk); $tk = $tok->readToken) {
+      $count++;
+    }
+    if ($tk == 0) {
+      $count++;
+    } else {
+      $err = $tk;
+    }
+  
+  } elsif ($stage eq 'reader') {
+    my $sr = Shastina::Parser->parse($src);
+    $native = $sr->native;
+    my $ent;
+    for($ent = $sr->readEntity; ref($ent); $ent = $sr->readEntity) {
+      $count++;
+    }
+    if ($ent == SNENTITY_EOF) {
+      $count++;
+    } else {
+      $err = $ent;
+    }
+  
+  } else {
+    die "Unknown stage, stopped";
+  }
+  
+  $src->closeFile;
+  return ($count, $err, $native);
+}
+
+# ==================
+# Program entrypoint
+# ==================
+
+# Parse options
+#
+my $min_time = 0.25;
+if ((scalar(@ARGV) >= 2) and ($ARGV[0] eq '-t')) {
+  shift @ARGV;
+  $min_time = shift @ARGV;
+}
+(scalar(@ARGV) > 0) or
+  die "Syntax: shbench.pl [-t seconds] file ...\n";
+
+printf "%-12s %-7s %-7s %10s %10s %9s %12s\n",
+  "corpus", "source", "stage", "bytes", "items", "MB/s", "items/s";
+
+# Measure each stage on each file
+#
+for my $path (@ARGV) {
+  my $bytes = -s $path;
+  (defined $bytes) or die "Can't read $path, stopped";
+  
+  # Report the file under its path, the same as the C program does
+  my $name = $path;
+  
+  for my $stage ('source', 'filter', 'token', 'reader') {
+    my $count = 0;
+    my $err = 0;
+    my $native = 0;
+    my $passes = 0;
+    my $elapsed = 0;
+    my $start = time;
+    do {
+      ($count, $err, $native) = run_pass($path, $stage);
+      $passes++;
+      $elapsed = time - $start;
+    } while ($elapsed < $min_time);
+    
+    printf "%-12s %-7s %-7s %10d %10d %9.2f %12.0f\n",
+      $name, ($native ? 'native' : 'perl'), $stage, $bytes, $count,
+      $bytes * $passes / $elapsed / 1.0e6,
+      $count * $passes / $elapsed;
+    
+    if (($stage eq 'reader') and $err) {
+      printf "%-12s error after %d entities: %s\n",
+        $name, $count, snerror_str($err);
+    }
+  }
+}
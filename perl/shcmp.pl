@@ -0,0 +1,228 @@
+#!/usr/bin/env perl
+use v5.14;
+use warnings;
+
+# Shastina imports
+use Shastina::Const qw(:CONSTANTS snerror_str);
+use Shastina::BinarySource;
+use Shastina::Parser;
+
+=head1 NAME
+
+shcmp.pl - Compare the native and pure-Perl Shastina parsers.
+
+=head1 SYNOPSIS
+
+  ./shcmp.pl
+  ./shcmp.pl file1.shastina file2.shastina ...
+
+=head1 DESCRIPTION
+
+Parses each input with the native backend (see C<Shastina::Native>) and
+with the pure-Perl implementation, and reports every input where the
+entities, the line counts after each entity, or the final error code
+are not the same.
+
+Without arguments, a built-in list of short inputs is used.  Most of
+them are malformed in some way, such as invalid or overlong UTF-8,
+unpaired surrogates, or a CR that is not followed by LF, at the very
+start of the input, in the middle of a token, in a string, or in a
+comment.  Otherwise, each of the given files is compared.
+
+Each input is parsed in a child process, with the C<SHASTINA_PUREPERL>
+environment variable set or cleared, since C<Shastina::Parser> chooses
+the backend once per process.  The native module must be built and in
+Perl's module search path.
+
+The program prints one line for each input and exits with a failure
+status if any of the inputs differed or the native backend could not be
+loaded.
+
+=cut
+
+# =========
+# Constants
+# =========
+
+# The built-in inputs, as name and binary string pairs.
+#
+use constant CASES => [
+  ['valid',             "%meta \"s\" {c};\n=v 12 ?v [1, 2] (op) |;\n"],
+  ['valid-bom',         "\xef\xbb\xbfa b |;"],
+  ['valid-pair',        "\xed\xa0\x80\xed\xb0\x80 |;"],
+  ['bad-lead-first',    "\xff a |;"],
+  ['bad-lead-token',    "ab\xffc |;"],
+  ['bad-lead-string',   "\"x\xffy\" |;"],
+  ['bad-lead-curly',    "{x\xffy} |;"],
+  ['bad-lead-comment',  "# \xff\na |;"],
+  ['continuation',      "\x80 a |;"],
+  ['overlong-2',        "\xc0\x80 a |;"],
+  ['overlong-3',        "a \xe0\x80\x80 |;"],
+  ['overlong-4',        "a \xf0\x80\x80\x80 |;"],
+  ['beyond-unicode',    "a \xf4\x90\x80\x80 |;"],
+  ['truncated',         "a \xe2\x82"],
+  ['truncated-token',   "a\xe2\x82 |;"],
+  ['bad-trail',         "\xc3( |;"],
+  ['lone-low-first',    "\xed\xb0\x80#c\n|;"],
+  ['lone-low-token',    "a\xed\xb0\x80 |;"],
+  ['lone-high',         "\xed\xa0\x80a |;"],
+  ['lone-high-end',     "a \xed\xa0\x80"],
+  ['bom-then-bad',      "\xef\xbb\xbf\xff |;"],
+  ['bad-cr-first',      "\r] |;"],
+  ['bad-cr-token',      "a\rb |;"],
+  ['bad-cr-string',     "\"a\rb\" |;"],
+  ['cr-end',            "a |;\r"],
+  ['crlf',              "a\r\nb\r\n|;"],
+  ['nul',               "\x00 |;"],
+  ['nul-string',        "\"a\x00b\" |;"],
+  ['meta-bad',          "%a \xff; |;"],
+  ['array-bad',         "[1, \xc0\x80] |;"],
+  ['after-final',       "a |; \xff"],
+];
+
+# ===============
+# Local functions
+# ===============
+
+# dump_parse(bytes, pure)
+# -----------------------
+#
+# Parse a binary string in a child process and return what the parser
+# reported, as a string.
+#
+# If pure is true, the child uses the pure-Perl implementation;
+# otherwise, it uses the native backend if it can be loaded.  The first
+# line of the result says which backend was used, and each following
+# line describes an entity with the line count after it, ending with the
+# final entity or error.
+#
+sub dump_parse {
+  # Check parameter count
+  ($#_ == 1) or die "Wrong number of parameters, stopped";
+  
+  # Get parameters
+  my $bytes = shift;
+  my $pure  = shift;
+  
+  # Start the child with a pipe from its standard output
+  my $pid = open(my $fh, '-|');
+  (defined $pid) or die "Failed to start child process, stopped";
+  
+  if ($pid == 0) {
+    # In the child -- choose the backend and parse the input
+    if ($pure) {
+      $ENV{'SHASTINA_PUREPERL'} = 1;
+    } else {
+      delete $ENV{'SHASTINA_PUREPERL'};
+    }
+    
+    binmode(STDOUT, ':encoding(UTF-8)') or
+      die "Failed to set output encoding, stopped";
+    
+    my $src = Shastina::BinarySource->load(\$bytes);
+    my $sr = Shastina::Parser->parse($src);
+    printf "native %d\n", $sr->native;
+    
+    my $ent;
+    for($ent = $sr->readEntity; ref($ent); $ent = $sr->readEntity) {
+      my $lcount = $sr->count;
+      printf "%s: %s\n", (defined $lcount ? $lcount : '??'),
+        join('|', map { defined($_) ? $_ : '' } @$ent);
+    }
+    
+    my $lcount = $sr->count;
+    printf "%s: %s\n", (defined $lcount ? $lcount : '??'),
+      (($ent == SNENTITY_EOF) ? 'End Of File' : snerror_str($ent));
+    exit 0;
+  }
+  
+  # In the parent -- collect the output of the child
+  binmode($fh, ':raw') or die "Failed to set binary mode, stopped";
+  my $result = do { local $/; <$fh> };
+  close($fh) or die "Child process failed, stopped";
+  (defined $result) or $result = '';
+  
+  return $result;
+}
+
+# ==================
+# Program entrypoint
+# ==================
+
+# Gather the inputs, either the built-in ones or the given files
+#
+my @inputs;
+if ($#ARGV < 0) {
+  @inputs = @{CASES()};
+} else {
+  for my $path (@ARGV) {
+    open(my $fh, '< :raw', $path) or die "Can't open $path, stopped";
+    my $bytes = do { local $/; <$fh> };
+    close($fh);
+    (defined $bytes) or $bytes = '';
+    push @inputs, [$path, $bytes];
+  }
+}
+
+# Compare the two backends on each input
+#
+my $diffs = 0;
+for my $input (@inputs) {
+  my ($name, $bytes) = @$input;
+  
+  my $nat = dump_parse($bytes, 0);
+  my $pur = dump_parse($bytes, 1);
+  
+  # The first lines say which backend was used
+  ($nat =~ s/\Anative 1\n//) or
+    die "Shastina::Native could not be loaded!\n";
+  ($pur =~ s/\Anative 0\n//) or die "Unexpected";
+  
+  if ($nat eq $pur) {
+    printf "ok   %s\n", $name;
+  } else {
+    printf "DIFF %s\n", $name;
+    $diffs++;
+  }
+}
+
+# Report result
+#
+if ($diffs > 0) {
+  printf "%d of %d inputs differed\n", $diffs, scalar(@inputs);
+  exit 1;
+}
+
+=head1 AUTHOR
+
+Noah Johnson E<lt>noah.johnson@loupmail.comE<gt>
+
+=head1 COPYRIGHT
+
+Copyright 2022 Multimedia Data Technology, Inc.
+
+This program is free software.  You can redistribute it and/or modify it
+under the same terms as Perl itself.
+
+This program is also dual-licensed under the MIT license:
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the
+"Software"), to deal in the Software without restriction, including
+without limitation the rights to use, copy, modify, merge, publish,
+distribute, sublicense, and/or sell copies of the Software, and to
+permit persons to whom the Software is furnished to do so, subject to
+the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+=cut